@@ -31,7 +31,7 @@ void boosting_releaseLocksCallback(void*, void*, void*) {
   _thread().rwlockset.unsafe_clear();
 }
 
-void transReadLock(RWLock *lock) {
+void transReadLock(BoostingRWLock *lock) {
   if (!_thread().rwlockset.exists(lock)) {
     if (!lock->tryReadLock(READ_SPIN)) {
       DO_ABORT();
@@ -41,7 +41,7 @@ void transReadLock(RWLock *lock) {
   }
 }
 
-void transWriteLock(RWLock *lock) {
+void transWriteLock(BoostingRWLock *lock) {
   if (!_thread().rwlockset.exists(lock)) {
     // don't have the lock in any form yet
     if (!lock->tryWriteLock(WRITE_SPIN)) {
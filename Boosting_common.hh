@@ -24,7 +24,7 @@
 
 struct boosting_threadinfo {
   FastSet<SpinLock*> lockset;
-  FastSet<RWLock*> rwlockset;
+  FastSet<BoostingRWLock*> rwlockset;
 };
 
 #define BOOSTING_MAX_THREADS 16
@@ -42,5 +42,5 @@ void boosting_setThreadID(int threadid);
 
 void boosting_releaseLocksCallback(void*, void*, void*);
 
-void transReadLock(RWLock *lock);
-void transWriteLock(RWLock *lock);
+void transReadLock(BoostingRWLock *lock);
+void transWriteLock(BoostingRWLock *lock);
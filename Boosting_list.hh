@@ -75,5 +75,5 @@ public:
   
 private:
   inner_list_t list_;
-  RWLock listlock_;
+  BoostingRWLock listlock_;
 };
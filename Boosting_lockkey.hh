@@ -4,33 +4,65 @@
 #include "Boosting_sto.hh"
 #include "Boosting_locks.hh"
 
-#include "Hashtable.hh"
+#include <memory>
+#include <new>
+#include <type_traits>
 
+// Abstract locks on keys, striped: a key's lock is one of a fixed,
+// power-of-two number of locks, chosen by its hash. Taking a key lock is
+// one cache miss and memory doesn't grow with the number of keys; the
+// price is that keys sharing a stripe conflict with each other, so size
+// the stripe count to the expected number of concurrently locked keys.
+// Pred is unused, since the lock of a key doesn't depend on key equality.
 template <typename K, unsigned Init_size = 129, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
 class LockKey {
 public:
-  LockKey(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : lockMap(size, h, p) {}
+  LockKey(unsigned size = Init_size, Hash h = Hash(), Pred = Pred())
+    : hash_(h), bits_(stripe_bits(size)),
+      raw_(new char[sizeof(stripe) * stripes() + CACHE_LINE_SIZE - 1]) {
+    // new[] doesn't align to cache lines
+    stripes_ = reinterpret_cast<stripe*>((uintptr_t(raw_.get()) + CACHE_LINE_SIZE - 1) & ~uintptr_t(CACHE_LINE_SIZE - 1));
+    for (unsigned i = 0; i != stripes(); ++i)
+      new(&stripes_[i]) stripe;
+  }
 
   void readLock(const K& key) {
-    RWLock *lock = getLock(key);
+    BoostingRWLock *lock = getLock(key);
     TRANS_READ_LOCK(lock);
   }
 
   void writeLock(const K& key) {
-    RWLock *lock = getLock(key);
+    BoostingRWLock *lock = getLock(key);
     TRANS_WRITE_LOCK(lock);
   }
 
-public:
-  Hashtable<K, RWLock, true, Init_size, RWLock, Hash, Pred> lockMap;
-
-  RWLock *getLock(const K& key) {
-    RWLock *lock = lockMap.readPtr(key);
-    if (!lock) {
-      // TODO(nate): might want to acquire the lock before we insert it
-      // lock will either stay the same or be set to the current lock if one exists.
-      lock = lockMap.putIfAbsentPtr(key, RWLock());
-    }
-    return lock;
+  unsigned stripes() const {
+    return 1U << bits_;
+  }
+
+  BoostingRWLock *getLock(const K& key) {
+    // take the high bits of a multiplicative hash, since std::hash is
+    // often the identity
+    uint64_t h = uint64_t(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+    return &stripes_[bits_ ? h >> (64 - bits_) : 0].lock;
+  }
+
+private:
+  struct stripe {
+    BoostingRWLock lock;
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+  static_assert(std::is_trivially_destructible<BoostingRWLock>::value, "stripes are never destroyed");
+
+  Hash hash_;
+  unsigned bits_;
+  std::unique_ptr<char[]> raw_;
+  stripe* stripes_;
+
+  // at least size stripes
+  static unsigned stripe_bits(unsigned size) {
+    unsigned bits = 0;
+    while ((1U << bits) < size && bits < 31)
+      ++bits;
+    return bits;
   }
 };
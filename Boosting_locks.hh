@@ -2,6 +2,7 @@
 
 #include "config.h"
 #include "compiler.hh"
+#include <algorithm>
 
 // XXX: these should really be standalone classes rather than a boosting specific header.
 
@@ -113,6 +114,11 @@ public:
   void writeUnlock() {
     __sync_fetch_and_and(&lock, ~write_lock_bit);
   }
+
+  // trade our write lock for a read lock
+  void downgrade() {
+    __sync_fetch_and_add(&lock, 1 - write_lock_bit);
+  }
   
   // if successful, we now hold a write lock. doesn't release the read lock in
   // either case.
@@ -159,3 +165,158 @@ public:
     return (cur & write_lock_bit);
   }
 };
+
+// A reader-biased RWLock (BRAVO: Dice and Kogan, USENIX ATC '19).
+//
+// While the lock is read-biased, readers don't write it: each reader
+// publishes the lock in its own row of a global table of visible readers,
+// so readers of a read-mostly lock don't bounce its cache line. A writer
+// takes the underlying RWLock, revokes the bias, and waits for published
+// readers to leave; the bias then stays off for a while proportional to
+// how long that took, so write-heavy locks behave like a plain RWLock.
+// Readers fall back to the RWLock when the bias is off, when their slot
+// is taken by another lock, or when they are beyond the first
+// visible_rows threads.
+class BiasedRWLock {
+public:
+  BiasedRWLock() : rbias_(true), inhibit_until_(0) {}
+
+  bool tryReadLock(long spin = 0) {
+    if (rbias_) {
+      const void** s = reader_slot();
+      // the exchange orders our slot before the bias check, like revoke()'s
+      // fence orders the bias before its slot checks
+      if (s && !*s && !__sync_lock_test_and_set(s, this)) {
+        if (rbias_)
+          return true;
+        *s = nullptr;
+      }
+    }
+    if (!lock_.tryReadLock(spin))
+      return false;
+    // no writer can be revoking now, so it's safe to restore the bias
+    if (!rbias_ && read_tsc() >= inhibit_until_)
+      rbias_ = true;
+    return true;
+  }
+
+  void readUnlock() {
+    const void** s = reader_slot();
+    if (s && *s == this) {
+      release_fence();
+      *s = nullptr;
+    } else
+      lock_.readUnlock();
+  }
+
+  bool tryWriteLock(long spin = 0) {
+    if (!lock_.tryWriteLock(spin))
+      return false;
+    if (rbias_ && !revoke(spin, nullptr)) {
+      lock_.writeUnlock();
+      return false;
+    }
+    return true;
+  }
+
+  void writeUnlock() {
+    lock_.writeUnlock();
+  }
+
+  // as RWLock::tryUpgrade
+  bool tryUpgrade(long spin = 0) {
+    const void** s = reader_slot();
+    if (s && *s == this) {
+      // a published reader holds nothing on lock_, and the bias is on
+      if (!lock_.tryWriteLock(spin))
+        return false;
+      if (!revoke(spin, s)) {
+        lock_.writeUnlock();
+        return false;
+      }
+      *s = nullptr;
+      return true;
+    }
+    if (!lock_.tryUpgrade(spin))
+      return false;
+    if (rbias_ && !revoke(spin, nullptr)) {
+      lock_.downgrade();
+      return false;
+    }
+    return true;
+  }
+
+  bool isWriteLocked() {
+    return lock_.isWriteLocked();
+  }
+
+  static constexpr int visible_rows = 64;
+
+private:
+  static constexpr unsigned slot_bits = 6;
+  // how much longer than a revocation the bias stays off
+  static constexpr uint64_t inhibit_multiplier = 9;
+
+  struct reader_row {
+    const void* slot[1 << slot_bits];
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  RWLock lock_;
+  bool rbias_;
+  uint64_t inhibit_until_;
+
+  static reader_row* rows() {
+    static reader_row table[visible_rows];
+    return table;
+  }
+  static int& next_row() {
+    static int n;
+    return n;
+  }
+  static reader_row* my_row() {
+    static __thread int row = -1;
+    if (unlikely(row < 0))
+      row = __sync_fetch_and_add(&next_row(), 1);
+    return row < visible_rows ? &rows()[row] : nullptr;
+  }
+  unsigned column() const {
+    return (uintptr_t(this) * 0x9E3779B97F4A7C15ULL) >> (64 - slot_bits);
+  }
+  const void** reader_slot() const {
+    reader_row* r = my_row();
+    return r ? &r->slot[column()] : nullptr;
+  }
+
+  // With lock_ write-locked: turns off the bias and waits for published
+  // readers other than `own` to leave. On timeout, restores the bias,
+  // since those readers are still there.
+  bool revoke(long spin, const void** own) {
+    rbias_ = false;
+    memory_fence();
+    uint64_t start = read_tsc();
+    unsigned c = column();
+    // only rows handed out so far can hold readers
+    int nrows = std::min(next_row(), visible_rows);
+    for (int r = 0; r != nrows; ++r) {
+      const void* volatile* s = &rows()[r].slot[c];
+      while (s != own && *s == this) {
+        if (--spin < 0) {
+          rbias_ = true;
+          return false;
+        }
+        relax_fence();
+      }
+    }
+    acquire_fence();
+    uint64_t now = read_tsc();
+    inhibit_until_ = now + (now - start) * inhibit_multiplier;
+    return true;
+  }
+};
+
+// the reader-writer lock of boosted data structures
+#ifdef BOOSTING_PLAIN_RWLOCK
+typedef RWLock BoostingRWLock;
+#else
+typedef BiasedRWLock BoostingRWLock;
+#endif
@@ -6,6 +6,13 @@
 #include "Interface.hh"
 #include "Transaction.hh"
 #include "TWrapped.hh"
+#include "TCommute.hh"
+#include "TIntRange.hh"
+#include "TShardedCounter.hh"
+#include "TVersionChain.hh"
+#include "TTrace.hh"
+#include "TCheckpoint.hh"
+#include "TSlab.hh"
 #include "simple_str.hh"
 #include "print_value.hh"
 
@@ -15,7 +22,22 @@
 #define READ_MY_WRITES 1
 #endif 
 
-template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129, typename W = V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+// allocate elements from per-thread slab pools (see TSlab.hh) rather
+// than with new
+#ifndef HASHTABLE_SLAB
+#define HASHTABLE_SLAB 1
+#endif
+
+// absent-key versions per bucket (1, 2 or 4): a failed lookup observes
+// the one its key's fingerprint selects, so inserts of keys with other
+// fingerprints don't invalidate it
+#ifndef HASHTABLE_ABSENT_SLOTS
+#define HASHTABLE_ABSENT_SLOTS 4
+#endif
+
+// With Snapshots, the table keeps the versions it overwrites and deletes
+// so snapshot transactions can read it (see Sto::start_snapshot_transaction).
+template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129, typename W = V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>, bool Snapshots = false>
 #ifdef STO_NO_STM
 class Hashtable {
 #else
@@ -33,118 +55,288 @@ public:
     typedef V write_value_type;
 
     static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
+    static_assert(!Snapshots || (Opacity && mass::is_trivially_copyable<Value>::value),
+                  "snapshot hashtables need TID versions and trivially copyable values");
 private:
+  struct internal_elem;
+  // snapshot state, as (empty unless Snapshots) bases of internal_elem and
+  // bucket_entry: old values of an element, and the bucket's list of
+  // deleted elements that older snapshots may still read
+  struct elem_history {
+    TVersionChain<Value> history;
+    internal_elem *dead_next;
+  };
+  struct bucket_history {
+    internal_elem *dead;
+    bucket_history() : dead(NULL) {}
+  };
+  struct no_history {};
+  typedef std::integral_constant<bool, Snapshots> snapshot_tag;
+  typedef typename std::conditional<Snapshots, elem_history, no_history>::type elem_history_type;
+  typedef typename std::conditional<Snapshots, bucket_history, no_history>::type bucket_history_type;
+
   // our hashtable is an array of linked lists. 
   // an internal_elem is the node type for these linked lists
-  struct internal_elem {
+  struct internal_elem : public elem_history_type {
     // nate: I wonder if this would perform better if these had their own
     // cache line.
+    // (With HASHTABLE_SLAB they never straddle cache lines.)
     Key key;
+    // high 32 bits of the key's hash: searches compare it before the key,
+    // and migration splits buckets by it
+    uint32_t fp;
     internal_elem *next;
     Version_type version;
     wrapped_type value;
 #ifndef STO_NO_STM
-    internal_elem(Key k, Value val, bool mark_valid)
-        : key(k), next(NULL), version(Sto::initialized_tid() | (mark_valid ? 0 : invalid_bit)), value(val) {}
+    internal_elem(Key k, uint32_t f, Value val, bool mark_valid)
+        : key(k), fp(f), next(NULL), version(Sto::initialized_tid() | (mark_valid ? 0 : invalid_bit)), value(val) {}
     bool valid() const {
         return !(version.value() & invalid_bit);
     }
 #else
-    internal_elem(Key k, Value val, bool)
-        : key(k), next(NULL), version(Sto::initialized_tid()), value(val) {}
+    internal_elem(Key k, uint32_t f, Value val, bool)
+        : key(k), fp(f), next(NULL), version(Sto::initialized_tid()), value(val) {}
 #endif
   };
 
-  struct bucket_entry {
+  struct bucket_entry : public bucket_history_type {
     // nate: we could inline the first element of a bucket. Would probably
     // make resize harder though.
     internal_elem *head;
-    // this is the bucket version number, which is incremented on insert
-    // we use it to make sure that an unsuccessful key lookup will still be
-    // unsuccessful at commit time (because this will always be true if no
-    // new inserts have occurred in this bucket)
+    // the bucket lock, and moved_bit
     Version_type version;
-    bucket_entry() : head(NULL), version(0) {}
+    // once the bucket has migrated (moved_bit), the two buckets of the
+    // next table that took its elements
+    bucket_entry *split;
+    // absent-key version numbers, incremented on insert, by the low bits
+    // of the inserted key's fingerprint. we use them to make sure that an
+    // unsuccessful key lookup will still be unsuccessful at commit time
+    // (because this will always be true if no new inserts of keys in its
+    // slot have occurred in this bucket)
+    Version_type absent[HASHTABLE_ABSENT_SLOTS];
+    bucket_entry() : head(NULL), version(0), split(NULL) {
+      for (auto& a : absent)
+        a = Version_type(0);
+    }
+  };
+
+  // The hashtable itself: a power-of-two array of bucket_entry's, where
+  // hash h goes in bucket h >> shift. To grow, we hang a table twice the
+  // size off next and migrate buckets into it a few at a time, as writers
+  // come by; bucket i splits into next's buckets 2i and 2i+1. Lookups
+  // start at table_ and follow migrated buckets down. Once every bucket
+  // has moved, next becomes table_ and the old table is freed by RCU.
+  struct bucket_table {
+    unsigned shift;
+    size_t size;
+    bucket_table *next;
+    size_t migrate_pos; // buckets claimed for migration
+    size_t migrated;    // buckets migrated
+    bucket_entry *buckets;
+    bucket_table(unsigned s)
+        : shift(s), size(size_t(1) << (64 - s)), next(NULL),
+          migrate_pos(0), migrated(0), buckets(new bucket_entry[size]) {}
+    ~bucket_table() {
+      delete[] buckets;
+    }
   };
 
-  typedef std::vector<bucket_entry> MapType;
-  // this is the hashtable itself, an array of bucket_entry's
-  MapType map_;
+  bucket_table *table_;
+  // element count, sharded by thread so that writers on different
+  // threads don't share its cache line. Only growth reads it, summing
+  // the shards each time a shard passes a multiple of nelem_check.
+  static constexpr unsigned nelem_shards = 8;
+  static constexpr ssize_t nelem_check = 16;
+  struct nelem_shard {
+    ssize_t n;
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+  nelem_shard nelem_[nelem_shards];
+  // transactional count of committed elements (see track_size)
+  TShardedCounter<ssize_t>* tsize_;
   Hash hasher_;
   Pred pred_;
+  bool read_my_writes_;
 
   // used to mark whether a key is a bucket (for bucket version checks)
-  // or a pointer (which will always have the lower 3 bits as 0)
+  // or a pointer (which will always have the lower 3 bits as 0). bucket
+  // keys hold the absent slot in the next two bits.
   static constexpr uintptr_t bucket_bit = 1U<<0;
+  static constexpr unsigned absent_slots = HASHTABLE_ABSENT_SLOTS;
+  static_assert(absent_slots == 1 || absent_slots == 2 || absent_slots == 4,
+                "HASHTABLE_ABSENT_SLOTS must be 1, 2 or 4");
+  static_assert(alignof(bucket_entry) >= 8, "bucket keys need 3 low bits");
+  // bucket versions with moved_bit belong to migrated buckets
+  static constexpr typename Version_type::type moved_bit = TransactionTid::user_bit;
+  // grow once there are this many elements per bucket
+  static constexpr size_t max_load = 2;
+  // buckets each writer migrates while the table grows
+  static constexpr size_t migrate_batch = 8;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+  // predicate of elements' conditional updates, which only integer
+  // values have; the std::false_type overloads cover the rest
+  typedef TIntRange<Value> cond_type;
+  typedef std::integral_constant<bool, std::is_integral<Value>::value> cond_tag;
+
+#ifndef STO_NO_STM
+  // Owner of trans_scan's bucket items, keyed by bucket, so they don't
+  // share Hashtable's bucket and element keys. A bucket item reads the
+  // bucket's scan version (see set_bucket_scans).
+  struct scan_object : public TObject {
+    Hashtable* h;
+    explicit scan_object(Hashtable* ht)
+      : h(ht) {
+    }
+    bool lock(TransItem&, Transaction&) override {
+      always_assert(false);
+      return false;
+    }
+    bool check(TransItem& item, Transaction& txn) override {
+      return h->check_scan(*item.key<bucket_entry*>(), item.template read_value<Version_type>(), txn);
+    }
+    void install(TransItem&, Transaction&) override {
+      always_assert(false);
+    }
+    void unlock(TransItem&) override {
+      always_assert(false);
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+      w << "{Hashtable " << (void*) h << ".scan[" << item.key<void*>() << "]";
+      if (item.has_read())
+        w << " R" << item.read_value<Version_type>();
+      w << "}";
+    }
+  };
+  scan_object scans_;
+#endif
+  bool bucket_scans_;
+  uint64_t log_id_;
+  uint32_t trace_id_;
+
+  // the buckets of table t a trans_scan part covers, [first, last), and
+  // its keys' fingerprints' top bits if a bucket has several parts' keys
+  // (fp_shift is 32 if not)
+  struct scan_range {
+    bucket_table *t;
+    size_t first;
+    size_t last;
+    unsigned part;
+    unsigned fp_shift;
+  };
 
 public:
-  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : map_(), hasher_(h), pred_(p) {
-    map_.resize(size);
+  // The table starts with at least size buckets, and grows as elements
+  // are added, except with Snapshots.
+  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred())
+      : table_(new bucket_table(table_shift(size))), nelem_(), tsize_(nullptr),
+        hasher_(h), pred_(p), read_my_writes_(true),
+#ifndef STO_NO_STM
+        scans_(this),
+#endif
+        bucket_scans_(false), log_id_(0), trace_id_(0) {
   }
+  ~Hashtable() {
+    delete table_->next;
+    delete table_;
+    delete tsize_;
+  }
+  Hashtable(const Hashtable&) = delete;
+  Hashtable& operator=(const Hashtable&) = delete;
 
+  // buckets use the high bits, so mix them well (std::hash is often the
+  // identity)
   inline size_t hash(const Key& k) {
-    return hasher_(k);
+    return hasher_(k) * size_t(0x9E3779B97F4A7C15ULL);
+  }
+
+  // With read-my-writes off, transactions promise never to read a key
+  // after writing it and to write each key at most once, and transGet
+  // and transPut add items without looking for existing ones. A
+  // transaction can make the same promise for every table with
+  // Sto::no_read_my_writes. Debug builds assert the promise.
+  void set_read_my_writes(bool x) {
+    read_my_writes_ = x;
+  }
+  bool read_my_writes() const {
+    return read_my_writes_;
   }
 
   inline size_t nbuckets() {
-    return map_.size();
+    return table_->size;
   }
 
   inline size_t bucket(const Key& k) {
-    return hash(k) % nbuckets();
+    return hash(k) >> table_->shift;
   }
 
 #ifndef STO_NO_STM
   // returns true if found false if not
   template <typename KT, typename VT>
   bool transGet(const KT& k, VT& retval) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
-    if (e) {
-      auto item = t_read_only_item(e);
-      if (!validity_check(item, e)) {
-        Sto::abort();
-        return false;
-      }
-#if READ_MY_WRITES
-      // deleted
-      if (has_delete(item)) {
-        return false;
+    return trans_get(k, hash(k), retval);
+  }
+
+  // Batched lookups: like transGet on each of keys[0..n) in order, with
+  // values[i] set for those found, but hashing each group of keys and
+  // prefetching their buckets and first elements before any search.
+  // found[i], if given, says whether keys[i] was found. Returns the
+  // number found.
+  template <typename KT, typename VT>
+  size_t transGetMany(const KT* keys, size_t n, VT* values, bool* found = NULL) {
+    size_t h[prefetch_batch];
+    size_t nfound = 0;
+    for (size_t i = 0; i < n; i += prefetch_batch) {
+      size_t m = std::min(n - i, prefetch_batch);
+      prefetch_keys(keys + i, m, h);
+      for (size_t j = 0; j != m; ++j) {
+        bool f = trans_get(keys[i + j], h[j], values[i + j]);
+        if (found)
+          found[i + j] = f;
+        nfound += f;
       }
-      if (item.has_write()) {
-        retval = item.template write_value<write_value_type>();
-        return true;
+    }
+    return nfound;
+  }
+
+  // Batched transPut of values[i] at keys[i], prefetching like
+  // transGetMany. Items for runs of new keys are added together with
+  // Sto::new_items. Returns the number of keys that already existed.
+  template <typename KT, typename VT>
+  size_t transPutMany(const KT* keys, const VT* values, size_t n) {
+    size_t h[prefetch_batch];
+    size_t nexisted = 0;
+    pending_inserts<VT> pend;
+    try {
+      for (size_t i = 0; i < n; i += prefetch_batch) {
+        size_t m = std::min(n - i, prefetch_batch);
+        prefetch_keys(keys + i, m, h);
+        for (size_t j = 0; j != m; ++j)
+          nexisted += trans_write</*insert*/true, /*set*/true>(keys[i + j], h[j], values[i + j], &pend);
       }
-#endif
-      //Version_type elem_vers;
-      // "atomic" read of both the current value and the version #
-      //atomicRead(e, elem_vers, retval);
-      // check both node changes and node deletes
-      //item.add_read(elem_vers);
-      //if (Opacity)
-      //  check_opacity(e->version);
-      retval = e->value.read(item, e->version);
-      return true;
-    } else {
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
-      //if (Opacity)
-      //  check_opacity(buck.version);
-      return false;
+      flush_inserts(pend);
+    } catch (...) {
+      // an abort won't clean up elements that have no items yet
+      if (Sto::in_progress())
+        flush_inserts(pend);
+      else
+        for (unsigned i = 0; i != pend.n; ++i)
+          _remove(pend.e[i]);
+      throw;
     }
+    return nexisted;
   }
 
 #if HASHTABLE_DELETE
   // returns true if successful
   bool transDelete(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
+    if (unlikely(trace_id_) && TTrace::enabled())
+      TTrace::record(trace_id_, TTrace::op_erase, TTrace::key<Key>(k), 0);
+    bucket_entry *buck;
+    Version_type buck_version;
+    size_t h = hash(k);
+    internal_elem *e = find(k, h, buck, buck_version);
     if (e) {
       Version_type elemvers = e->version;
       fence();
@@ -157,8 +349,9 @@ public:
         // no way to remove an item (would be pretty inefficient)
         // so we just unmark all attributes so the item is ignored
         item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
+        count_size(-1);
         // insert-then-delete still can only succeed if no one else inserts this node so we add a check for that
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
+        Sto::item(this, pack_bucket(*buck, absent_slot(e->fp))).observe(Version_type(buck_version.unlocked()));
         return true;
       } else
 #endif
@@ -174,16 +367,19 @@ public:
       }
 #endif
       // we need to make sure this bucket didn't change (e.g. what was once there got removed)
-      item.observe(elemvers);
+      // (a conditional update's predicate checks that already)
+      if (!item.has_predicate())
+        item.observe(elemvers);
       //if (Opacity)
       //  check_opacity(e->version);
       // we use delete_bit to detect deletes so we don't need any other data
       // for deletes, just to mark it as a write
-      item.add_write().add_flags(delete_bit);
+      item.add_write().clear_flags(TCommute::mask).add_flags(delete_bit);
+      count_size(-1);
       return true;
     } else {
       // add a read that yes this element doesn't exist
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
+      Sto::item(this, pack_bucket(*buck, absent_slot(h >> 32))).observe(Version_type(buck_version.unlocked()));
       //if (Opacity)
       //  check_opacity(buck.version);
       return false;
@@ -192,21 +388,119 @@ public:
 #endif
 
 private:
-  // returns true if item already existed, false if it did not
-  template <bool INSERT, bool SET, typename KT, typename VT>
-  bool trans_write(const KT& k, const VT& v) {
+  // h is hash(k)
+  template <typename KT, typename VT>
+  bool trans_get(const KT& k, size_t h, VT& retval) {
+    if (unlikely(trace_id_) && TTrace::enabled())
+      TTrace::record(trace_id_, TTrace::op_get, TTrace::key<Key>(k), 0);
+    if (Snapshots) {
+      if (auto s = Sto::snapshot_tid())
+        return snapshot_trans_get(k, h, retval, s);
+    }
+    bucket_entry *buck;
+    Version_type buck_version;
+    internal_elem *e = find(k, h, buck, buck_version);
+    if (e) {
+      auto item = t_read_only_item(e);
+      if (!validity_check(item, e)) {
+        Sto::abort();
+        return false;
+      }
+#if READ_MY_WRITES
+      // deleted
+      if (has_delete(item)) {
+        return false;
+      }
+      if (TCommute::pending(item)) {
+        retval = TCommute::materialize(item, read_base(item, e));
+        return true;
+      }
+      if (item.has_write()) {
+        retval = item.template write_value<write_value_type>();
+        return true;
+      }
+#endif
+      if (item.has_predicate()) {
+        retval = read_base(item, e);
+        return true;
+      }
+      //Version_type elem_vers;
+      // "atomic" read of both the current value and the version #
+      //atomicRead(e, elem_vers, retval);
+      // check both node changes and node deletes
+      //item.add_read(elem_vers);
+      //if (Opacity)
+      //  check_opacity(e->version);
+      retval = e->value.read(item, e->version);
+      return true;
+    } else {
+      Sto::item(this, pack_bucket(*buck, absent_slot(h >> 32))).observe(Version_type(buck_version.unlocked()));
+      //if (Opacity)
+      //  check_opacity(buck.version);
+      return false;
+    }
+  }
+  static constexpr size_t prefetch_batch = 16;
+
+  // elements a batch inserted whose items haven't been added yet
+  template <typename VT>
+  struct pending_inserts {
+    static constexpr unsigned capacity = 256;
+    internal_elem* e[capacity];
+    const VT* v[capacity];
+    unsigned n = 0;
+  };
+  template <typename VT>
+  void flush_inserts(pending_inserts<VT>& p) {
+    unsigned n = p.n;
+    p.n = 0;
+    Sto::new_items(this, p.e, n, [&] (TransProxy item, unsigned i) {
+        item.template add_write<write_value_type>(*p.v[i]).add_flags(insert_bit);
+      });
+  }
+
+  // sets h[i] = hash(keys[i]) and prefetches those keys' buckets, then
+  // the buckets' first elements
+  template <typename KT>
+  void prefetch_keys(const KT* keys, size_t m, size_t* h) {
+    bucket_table *t = table_;
+    for (size_t i = 0; i != m; ++i) {
+      h[i] = hash(keys[i]);
+      prefetch(&t->buckets[h[i] >> t->shift]);
+    }
+    for (size_t i = 0; i != m; ++i)
+      prefetch(t->buckets[h[i] >> t->shift].head);
+  }
+
+  // returns true if item already existed, false if it did not. An
+  // rvalue v is moved into the write value.
+  template <bool INSERT, bool SET, bool BLIND = false, typename KT, typename VT>
+  bool trans_write(const KT& k, VT&& v) {
+    return trans_write<INSERT, SET, BLIND>(k, hash(k), std::forward<VT>(v));
+  }
+  // With pend, items for new elements are left to a later
+  // flush_inserts. BLIND writes to existing elements don't observe them.
+  template <bool INSERT, bool SET, bool BLIND = false, typename KT, typename VT>
+  bool trans_write(const KT& k, size_t h, VT&& v,
+                   pending_inserts<typename std::decay<VT>::type>* pend = nullptr) {
+    if (unlikely(trace_id_) && TTrace::enabled())
+      TTrace::record(trace_id_, INSERT && SET ? TTrace::op_put : INSERT ? TTrace::op_insert : TTrace::op_update,
+                     TTrace::key<Key>(k), TTrace::value_size(v));
     // TODO: technically puts don't need to look into the table at all until lock time
-    bucket_entry& buck = buck_entry(k);
+    resize_step();
     // TODO: update doesn't need to lock the table
     // also we should lock the head pointer instead so we don't
     // mess with tids
-    lock(buck.version);
-    internal_elem *e = find(buck, k);
+    bucket_entry& buck = lock_bucket(k, h);
+    internal_elem *e = find(buck, k, h >> 32);
     if (e) {
       unlock(buck.version);
+      // e may be one of our pending inserts
+      if (pend && pend->n)
+        flush_inserts(*pend);
       Version_type elemvers = e->version;
       fence();
-      auto item = t_item(e);
+      auto item = t_write_item(e);
       if (!validity_check(item, e)) {
         Sto::abort();
         // unreachable (t.abort() raises an exception)
@@ -217,7 +511,8 @@ private:
         // delete-then-insert == update (technically v# would get set to 0, but this doesn't matter
         // if user can't read v#)
         if (INSERT) {
-          item.clear_flags(delete_bit).clear_write().template add_write<write_value_type>(v);
+          item.clear_flags(delete_bit | TCommute::mask).clear_write().template add_write<write_value_type>(std::forward<VT>(v));
+          count_size(1);
         } else {
           // delete-then-update == not found
           // delete will check for other deletes so we don't need to re-log that check
@@ -226,51 +521,66 @@ private:
       }
 #endif
 
+      // a blind write instead checks at lock time that the element
+      // wasn't deleted under it
+      bool blind = BLIND && SET && !has_insert(item);
 #if HASHTABLE_DELETE
       // make sure the item doesn't get deleted before us
-      item.observe(elemvers);
+      if (!blind && !item.has_predicate())
+        item.observe(elemvers);
       //if (Opacity)
       //  check_opacity(e->version);
 #endif
       if (SET) {
-        item.template add_write<write_value_type>(v);
+        item.template add_write<write_value_type>(std::forward<VT>(v)).clear_flags(TCommute::mask | TransItem::blind_bit);
+        if (blind)
+          item.mark_blind();
 #if READ_MY_WRITES
         if (has_insert(item)) {
           // Updating the value here, as we won't update it during install
-          e->value.write(v);
+          e->value.write(item.template write_value<write_value_type>());
         }
 #endif
       }
       return true;
     } else {
+      unsigned slot = absent_slot(h >> 32);
       if (!INSERT) {
-        auto buck_vers = buck.version.unlocked();
+        auto buck_vers = buck.absent[slot].unlocked();
         fence();
         unlock(buck.version);
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_vers));
+        Sto::item(this, pack_bucket(buck, slot)).observe(Version_type(buck_vers));
         //if (Opacity)
         //    check_opacity(buck.version);
         return false;
       }
 
-      auto prev_version = buck.version.unlocked();
+      auto prev_version = buck.absent[slot].unlocked();
       // not there so need to insert
       insert_locked<false>(buck, k, v); // marked as invalid
       auto new_head = buck.head;
-      auto new_version = buck.version.unlocked();
+      auto new_version = buck.absent[slot].unlocked();
       fence();
       unlock(buck.version);
+      count_size(1);
       // see if this item was previously read
-      auto bucket_item = Sto::check_item(this, pack_bucket(bucket(k)));
+      auto bucket_item = Sto::check_item(this, pack_bucket(buck, slot));
       if (bucket_item) {
         bucket_item->update_read(Version_type(prev_version), Version_type(new_version));
         //} else { could abort transaction now
       }
+      if (pend) {
+        pend->e[pend->n] = new_head;
+        pend->v[pend->n] = &v;
+        if (++pend->n == pend->capacity)
+          flush_inserts(*pend);
+        return false;
+      }
       // use new_item because we know there are no collisions
       auto item = Sto::new_item(this, new_head);
       // don't actually need to Store anything for the write, just mark as valid on install
       // (for now insert and set will just do the same thing on install, set a value and then mark valid)
-      item.template add_write<write_value_type>(v);
+      item.template add_write<write_value_type>(std::forward<VT>(v));
       // need to remove this item if we abort
       item.add_flags(insert_bit);
       return false;
@@ -279,27 +589,196 @@ private:
 
 public:
   template <typename KT, typename VT>
-  bool transPut(const KT& k, const VT& v) {
-    return trans_write</*insert*/true, /*set*/true>(k, v);
+  bool transPut(const KT& k, VT&& v) {
+    return trans_write</*insert*/true, /*set*/true>(k, std::forward<VT>(v));
+  }
+  // A last-writer-wins transPut (see TBox::write_blind): updating a
+  // present key doesn't observe its version, so concurrent puts to the
+  // key don't fail validation, and a transaction whose only item is the
+  // put may have it dropped as overwritten by a concurrent writer. A
+  // concurrent delete aborts the put at lock time.
+  template <typename KT, typename VT>
+  bool transPutBlind(const KT& k, VT&& v) {
+    return trans_write</*insert*/true, /*set*/true, /*blind*/true>(k, std::forward<VT>(v));
   }
 
   // returns true if successful
   template <typename KT, typename VT>
-  bool transInsert(const KT& k, const VT& v) {
-    return !trans_write</*insert*/true, /*set*/false>(k, v);
+  bool transInsert(const KT& k, VT&& v) {
+    return !trans_write</*insert*/true, /*set*/false>(k, std::forward<VT>(v));
   }
 
   template <typename KT, typename VT>
-  bool transUpdate(const KT& k, const VT& v) {
-    return trans_write</*insert*/false, /*set*/true>(k, v);
+  bool transUpdate(const KT& k, VT&& v) {
+    return trans_write</*insert*/false, /*set*/true>(k, std::forward<VT>(v));
   }
 
+  // Commutative updates of k's value (see TCommute.hh); an absent key is
+  // inserted with value x. Updating a present key doesn't observe its
+  // version, so concurrent updates of a hot key don't conflict; a
+  // concurrent delete aborts the update at lock time.
+  template <typename KT>
+  void trans_add(const KT& k, const Value& x) {
+    trans_commute(k, TCommute::add, x);
+  }
+  template <typename KT>
+  void trans_max(const KT& k, const Value& x) {
+    trans_commute(k, TCommute::max, x);
+  }
+  template <typename KT>
+  void trans_min(const KT& k, const Value& x) {
+    trans_commute(k, TCommute::min, x);
+  }
 
-  bool check(TransItem& item, Transaction&) override {
-    if (is_bucket(item)) {
-      bucket_entry& buck = map_[bucket_key(item)];
-      return buck.version.check_version(item.template read_value<Version_type>());
+  // Conditional updates of k's integer value. Each tests the value,
+  // updates it if the test passes, and returns whether it did. The test
+  // is recorded as a predicate on the value (see TIntRange), not a read
+  // of its version, and commit re-evaluates it, under the element's lock
+  // if the update wrote; so concurrent updates that don't change the
+  // outcome don't conflict. Later reads of the key in the transaction
+  // narrow the predicate to the value read. A test of a value the
+  // transaction has already read or written uses that. An absent key
+  // fails, and its absence is observed as by transGet.
+
+  // If k's value is expected, sets it to desired.
+  template <typename KT>
+  bool trans_cas(const KT& k, const Value& expected, const Value& desired) {
+    return trans_update_cond(k, cond_type{expected, expected}, TCommute::none, desired);
+  }
+  // Adds delta to k's value unless the sum would pass bound (exceed it
+  // for delta >= 0, or fall below it for delta < 0). Successful updates
+  // commute with each other, like trans_add's.
+  template <typename KT>
+  bool trans_add_bounded(const KT& k, const Value& delta, const Value& bound) {
+    return trans_update_cond(k, cond_type::add_bounded(delta, bound), TCommute::add, delta);
+  }
+  // If k's value is in [lo, hi], sets it to desired.
+  template <typename KT>
+  bool trans_update_if(const KT& k, const Value& lo, const Value& hi, const Value& desired) {
+    return trans_update_cond(k, cond_type{lo, hi}, TCommute::none, desired);
+  }
+
+  // Transactional element count, kept once track_size() is called. As
+  // with TVector's size, a comparison like trans_size() < n records a
+  // predicate on the count, not a read of it, so it conflicts only with
+  // commits that change its outcome. Inserts and deletes add to their
+  // thread's slot of a TShardedCounter, so they don't conflict with each
+  // other; a transaction's own inserts and deletes are included. Call
+  // track_size() while no other threads use the table.
+  void track_size() {
+    if (!tsize_)
+      tsize_ = new TShardedCounter<ssize_t>(nelem());
+  }
+  bool tracks_size() const {
+    return tsize_;
+  }
+  const TShardedCounter<ssize_t>& trans_size() const {
+    assert(tsize_);
+    return *tsize_;
+  }
+
+  // With bucket scans on, committing an insert, update or delete also
+  // bumps a scan version in the element's bucket (kept in the bucket's
+  // lock word), and trans_scan reads each bucket with one item for that
+  // version rather than an item per element. That costs updates a bucket
+  // lock at install. Set it before transactions use the table.
+  void set_bucket_scans(bool x) {
+    bucket_scans_ = x;
+  }
+  bool bucket_scans() const {
+    return bucket_scans_;
+  }
+
+  // Transactional scan: calls f(key, value) on every key, in bucket
+  // order, as transGet would see it, and returns the number visited.
+  // Committed inserts, updates and deletes in the buckets read make the
+  // transaction fail validation. Part part of nparts (a power of two)
+  // visits only the keys whose hashes' top bits are part, so nparts
+  // threads can split a scan, each in its own transaction; parts don't
+  // depend on the table's size, so they stay disjoint as it grows. A
+  // scan that meets a migrating bucket aborts.
+  template <typename F>
+  size_t trans_scan(F f, unsigned part = 0, unsigned nparts = 1) {
+    scan_range r = make_scan_range(part, nparts);
+    size_t n = 0;
+    auto visit = [&](bucket_entry& buck) {
+      n += scan_bucket(buck, f, r);
+    };
+    for (size_t i = r.first; i != r.last; ++i)
+      for_each_bucket(r.t->buckets[i], visit);
+    return n;
+  }
+
+  // Transactional iteration, like trans_scan, over (key, value) pairs
+  // copied out a bucket at a time.
+  class trans_iterator {
+  public:
+    typedef std::pair<Key, Value> value_type;
+
+    const value_type& operator*() const {
+      return buf_[pos_];
+    }
+    const value_type* operator->() const {
+      return &buf_[pos_];
     }
+    trans_iterator& operator++() {
+      ++pos_;
+      fill();
+      return *this;
+    }
+    bool operator==(const trans_iterator& x) const {
+      return h_ == x.h_ && (!h_ || (i_ == x.i_ && pos_ == x.pos_));
+    }
+    bool operator!=(const trans_iterator& x) const {
+      return !(*this == x);
+    }
+
+  private:
+    Hashtable* h_;
+    scan_range r_;
+    size_t i_;
+    std::vector<value_type> buf_;
+    size_t pos_;
+
+    trans_iterator()
+      : h_(NULL), i_(0), pos_(0) {
+    }
+    trans_iterator(Hashtable* h, const scan_range& r)
+      : h_(h), r_(r), i_(r.first), pos_(0) {
+      fill();
+    }
+    // reads buckets until there's a pair to yield; h_ is NULL at the end
+    void fill() {
+      auto push = [&](const Key& k, const Value& v) {
+        buf_.emplace_back(k, v);
+      };
+      auto visit = [&](bucket_entry& buck) {
+        h_->scan_bucket(buck, push, r_);
+      };
+      while (pos_ == buf_.size()) {
+        if (i_ == r_.last) {
+          h_ = NULL;
+          return;
+        }
+        buf_.clear();
+        pos_ = 0;
+        h_->for_each_bucket(r_.t->buckets[i_++], visit);
+      }
+    }
+    friend class Hashtable;
+  };
+
+  trans_iterator trans_begin(unsigned part = 0, unsigned nparts = 1) {
+    return trans_iterator(this, make_scan_range(part, nparts));
+  }
+  trans_iterator trans_end() {
+    return trans_iterator();
+  }
+
+
+  bool check(TransItem& item, Transaction&) override {
+    if (is_bucket(item))
+      return check_bucket(bucket_key(item), bucket_slot(item), item.template read_value<Version_type>());
     auto el = item.key<internal_elem*>();
     auto read_version = item.template read_value<Version_type>();
     // if item has insert_bit then its an insert so no validity check needed.
@@ -309,10 +788,56 @@ public:
     return el->version.check_version(read_version);
   }
 
+  // conditional updates' predicates; a conditional write's element is
+  // locked by now, others' must be stable
+  bool check_predicate(TransItem& item, Transaction& txn, bool) override {
+    assert(!is_bucket(item));
+    return check_cond(item, txn, cond_tag());
+  }
+  bool check_cond(TransItem& item, Transaction& txn, std::true_type) {
+    auto el = item.key<internal_elem*>();
+    const cond_type& cond = item.template predicate_value<cond_type>();
+    while (1) {
+      Version_type v0 = el->version;
+      fence();
+      Value value = el->value.access();
+      fence();
+      Version_type v1 = el->version;
+      if (v1.is_locked_elsewhere(txn))
+        return false;
+      if (v0 == v1 || v1.is_locked())
+        return (has_insert(item) || el->valid()) && cond.verify(value);
+      relax_fence();
+    }
+  }
+  bool check_cond(TransItem&, Transaction&, std::false_type) {
+    return false;
+  }
+
+  bool absent_check(const TransItem& item) const override {
+    return is_bucket(item);
+  }
+
+  void prefetch_check(const TransItem& item) const override {
+    if (is_bucket(item))
+      prefetch(&bucket_key(item).absent[bucket_slot(item)]);
+    else
+      prefetch(&item.key<internal_elem*>()->version);
+  }
+
   bool lock(TransItem& item, Transaction& txn) override {
     assert(!is_bucket(item));
     auto el = item.key<internal_elem*>();
-    return txn.try_lock(item, el->version);
+    if (!txn.try_lock(item, el->version))
+      return false;
+    // commutative updates and blind writes never observed the element,
+    // so make sure it wasn't deleted under them
+    if ((TCommute::pending(item) || item.has_flag(TransItem::blind_bit))
+        && !has_insert(item) && !el->valid()) {
+      unlock(el->version);
+      return false;
+    }
+    return true;
   }
 
   void install(TransItem& item, Transaction& t) override {
@@ -321,18 +846,33 @@ public:
     assert(is_locked(el));
     // delete
     if (item.flags() & delete_bit) {
-      // XXX: think we need an extra bit in here for opacity, or we should remove this now 
-      // rather than in cleanup
-      el->version.set_version_locked(el->version.value() | invalid_bit);
-      // we wait to remove the node til cleanup() (unclear that this is actually necessary)
+      if (Snapshots) {
+        // snapshots need the deletion's TID, and the deleted value
+        save_history(el, snapshot_tag());
+        el->version.set_version(t.commit_tid() | invalid_bit);
+      } else {
+        // XXX: think we need an extra bit in here for opacity, or we should remove this now
+        // rather than in cleanup
+        el->version.set_version_locked(el->version.value() | invalid_bit);
+        // we wait to remove the node til cleanup() (unclear that this is actually necessary)
+      }
+      if (log_id_ && t.logging())
+        log_elem(el, true, t);
+      if (bucket_scans_)
+        bump_scan_version(el);
       return;
     }
     // else must be insert/update
     if (!(item.flags() & insert_bit)) {
       // Update
       Value& new_v = item.template write_value<write_value_type>();
-      el->value.write(new_v);
+      if (TCommute::pending(item))
+        new_v = TCommute::installed_value(item, el->value.access());
+      save_history(el, snapshot_tag());
+      el->value.write(std::move(new_v));
     }
+    if (log_id_ && t.logging())
+      log_elem(el, false, t);
     //if (!__has_trivial_copy(Value)) {
       //Transaction::rcu_delete(new_v);
     //}
@@ -342,15 +882,22 @@ public:
 #if 1
     // convert nonopaque bucket version to a commit tid
     if (Opacity && has_insert(item)) {
-      bucket_entry& buck = buck_entry(el->key);
-      lock(buck.version);
+      bucket_entry& buck = lock_bucket(el->key);
       // only update if it's still nonopaque. Otherwise someone with a higher tid
       // could've already updated it.
-      if (buck.version.value() & TransactionTid::nonopaque_bit)
-	buck.version.set_version(t.commit_tid());
+      Version_type& a = buck.absent[absent_slot(el->fp)];
+      if (a.value() & TransactionTid::nonopaque_bit) {
+        release_fence();
+        a = Version_type(t.commit_tid());
+      }
+      if (bucket_scans_)
+        inc_scan_version(buck);
       unlock(buck.version);
+      return;
     }
 #endif
+    if (bucket_scans_)
+      bump_scan_version(el);
   }
 
   void unlock(TransItem& item) override {
@@ -359,14 +906,138 @@ public:
     unlock(el->version);
   }
 
+  // grouped commit (see Transaction::group_commit), without a virtual
+  // call per item
+  unsigned lock_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+    for (unsigned i = 0; i != n; ++i)
+      if (!Hashtable::lock(*items[i], txn))
+        return i;
+    return n;
+  }
+  unsigned check_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+    constexpr unsigned dist = Transaction::check_prefetch_distance;
+    unsigned prefetch_end = Transaction::prefetch_validation ? n : 0;
+    for (unsigned i = 0; i < dist && i < prefetch_end; ++i)
+      Hashtable::prefetch_check(*items[i]);
+    for (unsigned i = 0; i != n; ++i) {
+      if (i + dist < prefetch_end)
+        Hashtable::prefetch_check(*items[i + dist]);
+      if (!Hashtable::check(*items[i], txn))
+        return i;
+    }
+    return n;
+  }
+  void install_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+    for (unsigned i = 0; i != n; ++i)
+      Hashtable::install(*items[i], txn);
+  }
+  // written elements have locks of their own
+  bool parallel_install() const override {
+    return true;
+  }
+
   void cleanup(TransItem& item, bool committed) override {
     if (committed ? has_delete(item) : has_insert(item)) {
       auto el = item.key<internal_elem*>();
       assert(!el->valid());
-      _remove(el);
+      _remove(el, committed);
     }
   }
 
+  bool supports_snapshots() const override {
+    return Snapshots;
+  }
+
+  // Write a consistent checkpoint of the table to path (see
+  // TCheckpoint.hh). With Snapshots, scans as of a snapshot, so writers
+  // are never blocked or aborted; otherwise scans in a read-only
+  // transaction, retried until it commits. Call outside a transaction.
+  bool checkpoint(const char* path) {
+    TCheckpointWriter w;
+    return w.open(path) && w.commit(checkpoint_scan(w, snapshot_tag()));
+  }
+
+  // Load a checkpoint into this table, which must be empty and unused by
+  // other threads. Grows the table to at least a bucket per entry and
+  // links the entries in directly, without transactions.
+  bool restore(const char* path) {
+    TCheckpointReader r;
+    if (!r.open(path))
+      return false;
+    reserve(r.count());
+    Key k;
+    Value v;
+    while (r.next(k, v)) {
+      bucket_entry& buck = buck_entry(k);
+      auto e = new_elem(k, fingerprint(k), v, true);
+      e->next = buck.head;
+      buck.head = e;
+      count_elems(1);
+      count_size_nontrans(1);
+    }
+    return r.done();
+  }
+
+  static constexpr uint64_t log_delete_bit = uint64_t(1) << 63;
+  // Log committed writes to the redo log (see TLog.hh) under object id
+  // `id`, which must be nonzero and unique among logged objects. An
+  // entry's key field is the encoded key's length, plus log_delete_bit
+  // for a delete; its data is the encoded key, then a put's value.
+  void set_log_id(uint64_t id) {
+    static_assert(TLogCodec<Key>::supported && TLogCodec<Value>::supported,
+                  "TLogCodec<Key> and TLogCodec<Value> needed for logging");
+    log_id_ = id;
+  }
+  // Record this table's operations in workload traces (see TTrace.hh)
+  // under container id `id`; 0 stops recording.
+  void set_trace_id(uint32_t id) {
+    trace_id_ = id;
+  }
+  // Apply a logged write without a transaction, e.g. from TLog::replay
+  // or on a replica (see TReplication.hh).
+  void apply_log(const TLog::entry& e) {
+    uint32_t kl = e.key & ~log_delete_bit;
+    Key k = TLogCodec<Key>::decode(e.data, kl);
+    if (e.key & log_delete_bit)
+      remove(k);
+    else
+      put(k, TLogCodec<Value>::decode(e.data + kl, e.length - kl));
+  }
+
+  // Grow this table, which must be empty and unused by other threads, to
+  // at least n buckets, e.g. before bulk_load.
+  void reserve(size_t n) {
+    assert(nelem() == 0 && !table_->next);
+    if (n > table_->size) {
+      delete table_;
+      table_ = new bucket_table(table_shift(n));
+    }
+  }
+
+  // Non-transactional bulk load of keys[i] => values[i] for i < n, as
+  // committed elements with Sto::initialized_tid() versions. Keys must be
+  // new. Many threads may load disjoint parts of the input at once, but
+  // no transactions may use the table meanwhile. The table doesn't grow
+  // during the load; reserve room first. Loaders only lock a bucket to
+  // link an element, which rarely contends, so input need not be
+  // partitioned by bucket, though that avoids sharing bucket cache lines.
+  template <typename KT, typename VT>
+  void bulk_load(const KT* keys, const VT* values, size_t n) {
+    for (size_t i = 0; i != n; ++i) {
+      size_t h = hash(keys[i]);
+      bucket_entry& buck = table_->buckets[h >> table_->shift];
+      auto e = new_elem(keys[i], uint32_t(h >> 32), values[i], true);
+      lock(buck.version);
+      assert(!find(buck, e->key, e->fp));
+      e->next = buck.head;
+      buck.head = e;
+      unlock(buck.version);
+    }
+    // growth waits for the next writer; loaders don't migrate
+    __sync_fetch_and_add(&nelem_[nelem_home()].n, n);
+    count_size_nontrans(n);
+  }
+
   // these are wrappers for concurrent.cc and other
   // frameworks we use the hashtable in
   Value transGet(Key k) {
@@ -392,12 +1063,13 @@ public:
     int tot_count = 0;
     int max_chaining = 0;
     int num_empty = 0;
+    int num_buckets = 0;
 
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    for_each_bucket([&](bucket_entry& buck) {
+      num_buckets++;
       if (!buck.head) {
         num_empty++;
-        continue;
+        return;
       }
       int ct = 0;
       internal_elem * list = buck.head;
@@ -408,15 +1080,42 @@ public:
       }
 
       if (ct > max_chaining) max_chaining = ct;
-    }
+    });
 
-    printf("Total count: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_empty, ((double)(tot_count))/(map_.size() - num_empty), max_chaining);
+    printf("Total count: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_empty, ((double)(tot_count))/(num_buckets - num_empty), max_chaining);
+  }
+
+  // Memory of the table: keys and values (with snapshot history) as
+  // data; element, bucket and absent versions; and chain links,
+  // fingerprints and the rest of the bucket arrays as index.
+  footprint memory_footprint() {
+    footprint f;
+    auto add_elem = [&](internal_elem* e) {
+      f.data += sizeof(e->key) + sizeof(e->value);
+      f.versions += sizeof(e->version);
+      f.index += sizeof(internal_elem) - sizeof(e->key) - sizeof(e->value) - sizeof(e->version);
+      add_history_footprint(*e, f, snapshot_tag());
+    };
+    for_each_bucket([&](bucket_entry& buck) {
+      for (internal_elem* e = buck.head; e; e = e->next)
+        add_elem(e);
+      for_each_dead(buck, add_elem, snapshot_tag());
+    });
+    for (bucket_table* t = table_; t; t = t->next) {
+      size_t vers = t->size * sizeof(Version_type) * (1 + absent_slots);
+      f.versions += vers;
+      f.index += sizeof(bucket_table) + t->size * sizeof(bucket_entry) - vers;
+    }
+    f.index += sizeof(*this);
+    if (tsize_)
+      f.index += sizeof(*tsize_);
+    return f;
   }
 
     void print(std::ostream& w, const TransItem& item) const override {
         w << "{Hashtable<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
         if (is_bucket(item)) {
-            w << ".b[" << bucket_key(item) << "]";
+            w << ".b[" << (void*) &bucket_key(item) << "." << bucket_slot(item) << "]";
             if (item.has_read())
                 w << " R" << item.read_value<Version_type>();
         } else {
@@ -425,74 +1124,82 @@ public:
             if (item.has_read())
                 w << " R" << item.read_value<Version_type>();
             if (item.has_write())
-                w << " =" << mass::print_value(item.write_value<write_value_type>());
+                w << (TCommute::pending(item) ? " ⊕" : " =") << mass::print_value(item.write_value<write_value_type>());
         }
         w << "}";
     }
 
   void print() {
     printf("Hashtable:\n");
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    int i = 0;
+    for_each_bucket([&](bucket_entry& buck) {
+      ++i;
       if (!buck.head)
-        continue;
-      printf("bucket %d (version %d): ", i, buck.version);
+        return;
+      printf("bucket %d (version %d): ", i - 1, buck.version);
       internal_elem *list = buck.head;
       while (list) {
         printf("key: %d, val: %d, version: %d, valid: %d ; ", list->key, list->value, list->version, list->valid());
         list = list->next;
       }
       printf("\n");
-    }
+    });
   }
 
-  // non-transactional const iteration
-  // (we don't have current support for transactional iteration)
+  // non-transactional const iteration (see trans_iterator for
+  // transactional iteration)
   class const_iterator {
   public:
     std::pair<Key, Value> operator*() const {
-      return std::make_pair(node->key, node->value);
+      return std::make_pair(node->key, node->value.access());
     }
 
     const_iterator& operator++() {
       if (node) {
         node = node->next;
       }
-      while (!node && bucket != table->map_.size()) {
-        node = table->map_[bucket].head;
-        bucket++;
+      // a growing table's elements are in either the table or its next
+      while (!node && table) {
+        if (bucket == table->size) {
+          table = table->next;
+          bucket = 0;
+        } else {
+          node = table->buckets[bucket].head;
+          bucket++;
+        }
       }
       return *this;
     }
     
     bool operator!=(const const_iterator& it) const {
-      return node != it.node || bucket != it.bucket;
+      return node != it.node || bucket != it.bucket || table != it.table;
     }
   private:
-    const Hashtable *table;
-    int bucket;
+    const bucket_table *table;
+    size_t bucket;
     internal_elem *node;
     friend class Hashtable;
   };
 
   const_iterator begin() const {
     const_iterator begin;
-    begin.table = this;
-    begin.bucket = -1;
+    begin.table = table_;
+    begin.bucket = 0;
     begin.node = NULL;
     return ++begin; //eh
   }
   const_iterator end() const {
     const_iterator end;
-    end.bucket = map_.size();
+    end.table = NULL;
+    end.bucket = 0;
     end.node = NULL;
     return end;
   }
 
-  // remove given the internal element node. used by transaction system
-  void _remove(internal_elem *el) {
-    bucket_entry& buck = buck_entry(el->key);
-    lock(buck.version);
+  // remove given the internal element node. used by transaction system.
+  // deleted is true if el holds a committed delete.
+  void _remove(internal_elem *el, bool deleted = false) {
+    bucket_entry& buck = lock_bucket(el->key);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && cur != el) {
@@ -500,19 +1207,23 @@ public:
       cur = cur->next;
     }
     assert(cur);
+    // snapshot readers search the dead list after the live list, so link
+    // el there before unlinking it
+    bool buried = deleted && bury(buck, el, snapshot_tag());
     if (prev) {
       prev->next = cur->next;
     } else {
       buck.head = cur->next;
     }
     unlock(buck.version);
-    Transaction::rcu_delete(cur);
+    count_elems(-1);
+    if (!buried)
+      rcu_delete_elem(cur);
   }
 
   // non-txnal remove given a key
   bool remove(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && !pred_(cur->key, k)) {
@@ -529,13 +1240,33 @@ public:
       buck.head = cur->next;
     }
     unlock(buck.version);    
+    count_elems(-1);
+    count_size_nontrans(-1);
     // TODO(nate): this would probably work fine as-is
     // Transaction::rcu_free(cur);
     return true;
   }
 
+  // non-txnal remove that transactions notice: marks k's element deleted
+  // first, so anyone who read or wrote k fails validation. Gives up
+  // (returning false) if k is absent, uncommitted, or locked.
+  bool try_remove(const Key& k) {
+    internal_elem *e = elem(k);
+    if (!e || !e->version.try_lock())
+      return false;
+    if (!e->valid()) {
+      unlock(e->version);
+      return false;
+    }
+    e->version.set_version_locked(e->version.value() | invalid_bit);
+    unlock(e->version);
+    _remove(e);
+    count_size_nontrans(-1);
+    return true;
+  }
+
   bool read(const Key& k, Value& retval) {
-    auto e = find(buck_entry(k), k);
+    auto e = elem(k);
     if (e) {
       // TODO(nate): this isn't safe for non-trivial types (need an atomic read)
       assign_val(retval, e->value.access());
@@ -552,7 +1283,7 @@ public:
   }
 
   Value* readPtr(const Key& k) {
-    auto e = find(buck_entry(k), k);
+    auto e = elem(k);
     if (e) {
       return &e->value.access();
     }
@@ -562,8 +1293,8 @@ public:
   // returns pointer to the value in the hashtable 
   // (no current way to distinguish if insert or set)
   Value* putIfAbsentPtr(const Key& k, const Value& val) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    resize_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (!e) {
       insert_locked<true>(buck, k, val);
@@ -577,8 +1308,8 @@ public:
   // returns true if inserted. otherwise return false and val is set to current value.
   bool putIfAbsent(const Key& k, Value& val) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    resize_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       assign_val(val, e->value.access());
@@ -595,8 +1326,8 @@ public:
   template <bool Insert = true, bool Set = true>
   bool put(const Key& k, const Value& val) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    resize_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       // XXX: kind of a stupid Set-only (still locks bucket)
@@ -617,8 +1348,8 @@ public:
   template <bool Insert = true, bool Set = true>
   bool put_getold(const Key& k, const Value& val, Value& oldval) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    resize_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       assign_val(oldval, e->value.access());
@@ -662,22 +1393,340 @@ public:
   bool nontrans_remove(const Key& k, Value& oldval) { if (read(k,oldval)) return remove(k); else return false; }
 
 private:
+  // bucket indexes use at most the 31 high hash bits, which leaves a
+  // split bit in the fingerprint
+  static constexpr unsigned min_shift = 33;
+  static unsigned table_shift(size_t size) {
+    unsigned shift = 63;
+    while (shift > min_shift && (size_t(1) << (64 - shift)) < size)
+      --shift;
+    return shift;
+  }
+
+  // k's bucket in table_, ignoring migrations (for tables that aren't
+  // growing)
   bucket_entry& buck_entry(const Key& k) {
-    return map_[bucket(k)];
+    return table_->buckets[bucket(k)];
+  }
+
+  // the split bucket of migrated bucket buck that holds hash h; shift is
+  // buck's table's, and becomes the split bucket's
+  static bucket_entry* follow_split(bucket_entry* buck, size_t h, unsigned& shift) {
+    while (is_locked(buck->version))
+      relax_fence();
+    acquire_fence();
+    --shift;
+    return buck->split + ((h >> shift) & 1);
+  }
+
+  // Looks up k, with hash h, returning its element or NULL. Sets buck to
+  // k's current bucket and buck_version to k's absent version there
+  // before the search. Migration relinks elements, so a search that raced with
+  // one might miss an element; we retry those that found nothing.
+  internal_elem* find(const Key& k, size_t h, bucket_entry*& buck, Version_type& buck_version) {
+    bucket_table *t = table_;
+    unsigned shift = t->shift;
+    bucket_entry *b = &t->buckets[h >> shift];
+    unsigned slot = absent_slot(h >> 32);
+    while (1) {
+      if (b->version.value() & moved_bit) {
+        b = follow_split(b, h, shift);
+        continue;
+      }
+      acquire_fence();
+      buck_version = b->absent[slot];
+      fence();
+      internal_elem *e = find(*b, k, h >> 32);
+      fence();
+      if (e || !(b->version.value() & moved_bit)) {
+        buck = b;
+        return e;
+      }
+    }
+  }
+
+  // locks and returns k's current bucket
+  bucket_entry& lock_bucket(const Key& k) {
+    return lock_bucket(k, hash(k));
+  }
+  bucket_entry& lock_bucket(const Key&, size_t h) {
+    bucket_table *t = table_;
+    unsigned shift = t->shift;
+    bucket_entry *b = &t->buckets[h >> shift];
+    while (1) {
+      lock(b->version);
+      if (!(b->version.value() & moved_bit))
+        return *b;
+      unlock(b->version);
+      b = follow_split(b, h, shift);
+    }
+  }
+
+  // Whether an absent read of buck's slot at version v is still valid.
+  // Split buckets start with their bucket's absent versions, so readers
+  // of a migrated bucket stay valid until an insert in their slot reaches
+  // one of them.
+  bool check_bucket(const bucket_entry& buck, unsigned slot, Version_type v) const {
+    auto cur = buck.version.value();
+    if (!(cur & moved_bit)) {
+      acquire_fence();
+      return buck.absent[slot].check_version(v);
+    }
+    if (TransactionTid::is_locked(cur))
+      return false;
+    acquire_fence();
+    return check_bucket(buck.split[0], slot, v) && check_bucket(buck.split[1], slot, v);
+  }
+
+  template <typename E>
+  static void add_history_footprint(const E&, footprint&, std::false_type) {
+  }
+  template <typename E>
+  static void add_history_footprint(const E& e, footprint& f, std::true_type) {
+    e.history.add_footprint(f);
+  }
+  template <typename B, typename F>
+  static void for_each_dead(B&, F&, std::false_type) {
+  }
+  template <typename B, typename F>
+  static void for_each_dead(B& buck, F& f, std::true_type) {
+    for (internal_elem* e = buck.dead; e; e = e->dead_next)
+      f(e);
+  }
+
+  // calls f on every bucket that hasn't migrated
+  template <typename F>
+  void for_each_bucket(F f) {
+    for (size_t i = 0; i != table_->size; ++i)
+      for_each_bucket(table_->buckets[i], f);
+  }
+  template <typename F>
+  void for_each_bucket(bucket_entry& buck, F& f) {
+    if (buck.version.value() & moved_bit) {
+      for_each_bucket(buck.split[0], f);
+      for_each_bucket(buck.split[1], f);
+    } else
+      f(buck);
+  }
+
+  static unsigned nelem_home() {
+    return TThread::id() % nelem_shards;
+  }
+  size_t nelem() const {
+    ssize_t n = 0;
+    for (auto& s : nelem_)
+      n += s.n;
+    return std::max(n, ssize_t(0));
+  }
+  // Adds delta to this thread's shard of the element count; an insert
+  // that takes the shard past a multiple of nelem_check checks the load.
+  void count_elems(ssize_t delta) {
+    ssize_t n = __sync_add_and_fetch(&nelem_[nelem_home()].n, delta);
+    if (delta > 0 && (n - delta) / nelem_check != n / nelem_check)
+      start_growing();
+  }
+  // Starts growing the table once it is too full. Writers then migrate
+  // buckets in resize_step.
+  void start_growing() {
+    bucket_table *t = table_;
+    if (!t->next && t->shift > min_shift && !Snapshots
+        && nelem() > t->size * max_load) {
+      // snapshot readers don't follow migrations, so those tables don't grow
+      auto n = new bucket_table(t->shift - 1);
+      if (!bool_cmpxchg(&t->next, (bucket_table*) NULL, n))
+        delete n;
+    }
+  }
+
+  // Called by writers before they lock a bucket: migrates some buckets
+  // while the table grows.
+  void resize_step() {
+    bucket_table *t = table_;
+    if (unlikely(t->next))
+      migrate_some(t);
+  }
+
+  void migrate_some(bucket_table *t) {
+    size_t i = __sync_fetch_and_add(&t->migrate_pos, migrate_batch);
+    if (i >= t->size)
+      return;
+    size_t end = std::min(i + migrate_batch, t->size);
+    for (size_t j = i; j != end; ++j)
+      migrate_bucket(t, j);
+    if (__sync_add_and_fetch(&t->migrated, end - i) == t->size) {
+      fence();
+      table_ = t->next;
+      Transaction::rcu_delete(t);
+    }
+  }
+
+  // Moves bucket i of t into t->next. Nobody can reach its split buckets
+  // until it unlocks.
+  void migrate_bucket(bucket_table *t, size_t i) {
+    bucket_entry& buck = t->buckets[i];
+    bucket_entry *split = &t->next->buckets[2 * i];
+    lock(buck.version);
+    for (unsigned s = 0; s != absent_slots; ++s)
+      split[0].absent[s] = split[1].absent[s] = buck.absent[s];
+    // and scan versions, like absent versions
+    split[0].version = split[1].version = Version_type(buck.version.unlocked());
+    buck.split = split;
+    // searches check moved_bit afterwards, so set it before relinking
+    buck.version.set_version_locked(buck.version.value() | moved_bit);
+    fence();
+    internal_elem *e = buck.head;
+    while (e) {
+      internal_elem *next = e->next;
+      bucket_entry& to = split[((size_t(e->fp) << 32) >> (t->shift - 1)) & 1];
+      e->next = to.head;
+      to.head = e;
+      e = next;
+    }
+    buck.head = NULL;
+    fence();
+    unlock(buck.version);
+  }
+
+  uint32_t fingerprint(const Key& k) {
+    return hash(k) >> 32;
+  }
+  // the absent version for keys with fingerprint fp. bucket indexes and
+  // splits use fingerprints' high bits, so keep to the low ones
+  static unsigned absent_slot(uint32_t fp) {
+    return fp & (absent_slots - 1);
   }
 
   // looks up a key's internal_elem, given its bucket
-  internal_elem* find(bucket_entry& buck, const Key& k) {
+  internal_elem* find(bucket_entry& buck, const Key& k, uint32_t fp) {
     internal_elem *list = buck.head;
-    while (list && ! pred_(list->key, k)) {
+    while (list && (list->fp != fp || ! pred_(list->key, k))) {
       list = list->next;
     }
     return list;
   }
+  internal_elem* find(bucket_entry& buck, const Key& k) {
+    return find(buck, k, fingerprint(k));
+  }
+
+  template <typename... Args>
+  static internal_elem* new_elem(Args&&... args) {
+#if HASHTABLE_SLAB
+    return TSlab<internal_elem>::make(std::forward<Args>(args)...);
+#else
+    return new internal_elem(std::forward<Args>(args)...);
+#endif
+  }
+  static void rcu_delete_elem(internal_elem *e) {
+#if HASHTABLE_SLAB
+    TSlab<internal_elem>::rcu_free(e);
+#else
+    Transaction::rcu_delete(e);
+#endif
+  }
 
   // looks up a key's internal_elem
   internal_elem* elem(const Key& k) {
-    return find(buck_entry(k), k);
+    bucket_entry *buck;
+    Version_type buck_version;
+    return find(k, hash(k), buck, buck_version);
+  }
+
+  template <typename KT>
+  void trans_commute(const KT& k, TCommute::op_type op, const Value& x) {
+    size_t h = hash(k);
+    while (1) {
+      bucket_entry *buck;
+      Version_type buck_version;
+      internal_elem *e = find(k, h, buck, buck_version);
+      if (!e) {
+        // absent: insert x, unless someone inserted k in the meantime
+        if (!trans_write</*insert*/true, /*set*/false>(k, h, x))
+          return;
+        continue;
+      }
+      auto item = t_item(e);
+      if (!validity_check(item, e))
+        Sto::abort();
+      if (has_delete(item)) {
+        // delete-then-update acts like delete-then-insert
+        item.clear_flags(delete_bit | TCommute::mask).clear_write().template add_write<write_value_type>(x);
+        count_size(1);
+      } else if (has_insert(item)) {
+        // our own insert's value is kept in the element too
+        TCommute::record(item, op, x);
+        e->value.write(item.template write_value<write_value_type>());
+      } else if (!TCommute::record(item, op, x)) {
+        TCommute::materialize(item, read_base(item, e));
+        TCommute::record(item, op, x);
+      }
+      return;
+    }
+  }
+
+  // conditional update: applies op(x) (or sets x for TCommute::none) if
+  // k's value is in cond
+  template <typename KT>
+  bool trans_update_cond(const KT& k, const cond_type& cond, TCommute::op_type op, const Value& x) {
+    static_assert(std::is_integral<Value>::value, "conditional updates need integer values");
+    if (cond.first > cond.second)
+      // fails whatever the value
+      return false;
+    size_t h = hash(k);
+    internal_elem *e;
+    while (1) {
+      bucket_entry *buck;
+      Version_type buck_version;
+      if ((e = find(k, h, buck, buck_version)))
+        break;
+      // observe the absence, unless someone inserted k in the meantime
+      Value v;
+      if (!trans_get(k, h, v))
+        return false;
+    }
+    auto item = t_item(e);
+    if (!validity_check(item, e))
+      Sto::abort();
+    if (has_delete(item))
+      return false;
+    if (TCommute::pending(item))
+      TCommute::materialize(item, read_base(item, e));
+    if (!item.has_write() && !item.has_read()) {
+      // the common case: test under a predicate, and leave the value unread
+      Value v = e->value.snapshot(item, e->version);
+      if (!item.predicate_value(cond_type::unconstrained()).observe_in(v, cond.first, cond.second))
+        return false;
+      if (op == TCommute::none)
+        item.template add_write<write_value_type>(x);
+      else
+        TCommute::record(item, op, x);
+      return true;
+    }
+    Value v = item.has_write() ? item.template write_value<write_value_type>() : read_base(item, e);
+    if (!cond.verify(v))
+      return false;
+    TCommute::apply(op, v, x);
+    item.template add_write<write_value_type>(v).clear_flags(TCommute::mask | TransItem::blind_bit);
+    if (has_insert(item))
+      // our own insert's value is kept in the element too
+      e->value.write(v);
+    return true;
+  }
+
+  // e's value, through the predicate of the item's conditional updates
+  // if it has one (narrowing it to the value), and otherwise read
+  Value read_base(TransProxy item, internal_elem* e) {
+    return read_base(item, e, cond_tag());
+  }
+  Value read_base(TransProxy item, internal_elem* e, std::false_type) {
+    return e->value.read(item, e->version);
+  }
+  Value read_base(TransProxy item, internal_elem* e, std::true_type) {
+    if (item.has_predicate()) {
+      Value v = e->value.snapshot(item, e->version);
+      item.template predicate_value<cond_type>().observe(v);
+      return v;
+    }
+    return e->value.read(item, e->version);
   }
 
   bool has_delete(const TransItem& item) {
@@ -707,12 +1756,15 @@ private:
   static bool is_bucket(void* key) {
       return (uintptr_t)key & bucket_bit;
   }
-  static unsigned bucket_key(const TransItem& item) {
+  static bucket_entry& bucket_key(const TransItem& item) {
       assert(is_bucket(item));
-      return (uintptr_t) item.key<void*>() >> 1;
+      return *(bucket_entry*) ((uintptr_t) item.key<void*>() & ~uintptr_t(7));
+  }
+  static unsigned bucket_slot(const TransItem& item) {
+      return ((uintptr_t) item.key<void*>() >> 1) & 3;
   }
-  void* pack_bucket(unsigned bucket) {
-      return (void*) ((bucket << 1) | bucket_bit);
+  static void* pack_bucket(bucket_entry& buck, unsigned slot) {
+      return (void*) ((uintptr_t) &buck | (slot << 1) | bucket_bit);
   }
 
   static bool is_locked(Version_type &v) {
@@ -725,16 +1777,42 @@ private:
     v.unlock();
   }
 
+  // count an insert (d = 1) or delete (d = -1) in trans_size
+  void count_size(ssize_t d) {
+    if (tsize_)
+      *tsize_ += d;
+  }
+  void count_size_nontrans(ssize_t d) {
+    if (tsize_)
+      tsize_->nontrans_add(d);
+  }
+
+  // redo log entry for installing el (see set_log_id)
+  void log_elem(internal_elem* el, bool is_delete, Transaction& t) {
+    uint32_t kl = TLogCodec<Key>::size(el->key);
+    uint32_t vl = is_delete ? 0 : TLogCodec<Value>::size(el->value.access());
+    char* p = t.log_entry(log_id_, kl | (is_delete ? log_delete_bit : 0), kl + vl);
+    TLogCodec<Key>::encode(p, el->key);
+    if (!is_delete)
+      TLogCodec<Value>::encode(p + kl, el->value.access());
+  }
+
   template <bool markValid>
   void insert_locked(bucket_entry& buck, const Key& k, const Value& val) {
     assert(is_locked(buck.version));
-    auto new_head = new internal_elem(k, val, markValid);
+    auto new_head = new_elem(k, fingerprint(k), val, markValid);
     internal_elem *cur_head = buck.head;
     new_head->next = cur_head;
     buck.head = new_head;
+    count_elems(1);
+    if (markValid)
+      count_size_nontrans(1);
     // TODO(nate): this means we'll always have to do a hard opacity check on 
     // the bucket version (but I don't think we can get a commit tid yet).
-    buck.version.inc_nonopaque_version();
+    Version_type& a = buck.absent[absent_slot(new_head->fp)];
+    auto next = TransactionTid::next_nonopaque_version(a.value());
+    release_fence();
+    a = Version_type(next);
   }
 
 #if 0
@@ -752,15 +1830,306 @@ private:
   }
 #endif
 
+  // snapshot support; the std::false_type overloads cover tables without it
+  void save_history(internal_elem *el, std::true_type) {
+    assert(is_locked(el) && el->valid());
+    el->history.push(el->value.access(), TransactionTid::unlocked(el->version.value()));
+  }
+  void save_history(internal_elem*, std::false_type) {}
+
+  // links a deleted element into its bucket's dead list, dropping dead
+  // elements deleted before every snapshot. Call with the bucket locked.
+  bool bury(bucket_entry& buck, internal_elem *el, std::true_type) {
+    assert(is_locked(buck.version));
+    auto floor = Transaction::snapshot_floor();
+    internal_elem **pprev = &buck.dead;
+    while (internal_elem *d = *pprev) {
+      if (TransactionTid::unlocked(d->version.value()) < floor) {
+        *pprev = d->dead_next;
+        rcu_delete_elem(d);
+      } else
+        pprev = &d->dead_next;
+    }
+    el->dead_next = buck.dead;
+    release_fence();
+    buck.dead = el;
+    release_fence();
+    return true;
+  }
+  bool bury(bucket_entry&, internal_elem*, std::false_type) {
+    return false;
+  }
+
+#ifndef STO_NO_STM
+  enum { snap_absent, snap_found, snap_later };
+  // reads el as of snapshot TID s. snap_later means el did not yet exist
+  // at s, so an older element for the same key might have.
+  int snapshot_elem(internal_elem *el, TransactionTid::type s, Value& retval) {
+    while (1) {
+      auto v0 = el->version.value();
+      if (TransactionTid::is_locked(v0)) {
+        // the locker may be a commit ordered before s; wait for it
+        relax_fence();
+        continue;
+      }
+      acquire_fence();
+      Value val = el->value.access();
+      fence();
+      if (el->version.value() != v0)
+        continue;
+      if (v0 >= s) {
+        if (const Value* old = el->history.find(s)) {
+          retval = *old;
+          return snap_found;
+        }
+        return snap_later;
+      } else if (!(v0 & invalid_bit)) {
+        retval = val;
+        return snap_found;
+      } else if (TransactionTid::unlocked(v0 & ~invalid_bit) == Sto::initialized_tid())
+        // uncommitted insert
+        return snap_later;
+      else
+        // deleted before s
+        return snap_absent;
+    }
+  }
+
+  template <typename KT, typename VT>
+  bool snapshot_get(const KT& k, VT& retval, TransactionTid::type s, std::true_type) {
+    bucket_entry& buck = buck_entry(k);
+    Value val = Value();
+    int r = snap_later;
+    for (internal_elem *e = buck.head; e && r == snap_later; e = e->next)
+      if (pred_(e->key, k))
+        r = snapshot_elem(e, s, val);
+    acquire_fence();
+    for (internal_elem *e = buck.dead; e && r == snap_later; e = e->dead_next)
+      if (pred_(e->key, k))
+        r = snapshot_elem(e, s, val);
+    if (r == snap_found)
+      retval = val;
+    return r == snap_found;
+  }
+  template <typename KT, typename VT>
+  bool snapshot_get(const KT&, VT&, TransactionTid::type, std::false_type) {
+    return false;
+  }
+  // a snapshot read of k that sees the transaction's own writes, as
+  // snapshot isolation requires
+  template <typename KT, typename VT>
+  bool snapshot_trans_get(const KT& k, size_t h, VT& retval, TransactionTid::type s) {
+    if (Sto::transaction()->any_writes()) {
+      bucket_entry *buck;
+      Version_type buck_version;
+      if (internal_elem *e = find(k, h, buck, buck_version))
+        if (auto item = Sto::check_item(this, e)) {
+          if (has_delete(*item))
+            return false;
+          if (TCommute::pending(*item)) {
+            Value base = Value();
+            snapshot_get(k, base, s, snapshot_tag());
+            retval = TCommute::materialize(*item, base);
+            return true;
+          }
+          if (item->has_write()) {
+            retval = item->template write_value<write_value_type>();
+            return true;
+          }
+        }
+    }
+    return snapshot_get(k, retval, s, snapshot_tag());
+  }
+
+  // checkpoint scans; return the checkpoint's TID
+  TransactionTid::type checkpoint_scan(TCheckpointWriter& w, std::true_type) {
+    Sto::start_snapshot_transaction();
+    auto s = Sto::snapshot_tid();
+    std::vector<Key> found;
+    Value val;
+    for (size_t i = 0; i != table_->size; ++i) {
+      bucket_entry& buck = table_->buckets[i];
+      found.clear();
+      for (internal_elem *e = buck.head; e; e = e->next)
+        if (snapshot_elem(e, s, val) == snap_found) {
+          w.add(e->key, val);
+          found.push_back(e->key);
+        }
+      // a deleted element may be on both lists for a moment
+      acquire_fence();
+      for (internal_elem *e = buck.dead; e; e = e->dead_next)
+        if (std::find_if(found.begin(), found.end(), [&](const Key& k) { return pred_(k, e->key); }) == found.end()
+            && snapshot_elem(e, s, val) == snap_found)
+          w.add(e->key, val);
+    }
+    Sto::commit();
+    return s;
+  }
+  TransactionTid::type checkpoint_scan(TCheckpointWriter& w, std::false_type) {
+    TRANSACTION {
+      w.reset();
+      for_each_bucket([&](bucket_entry& buck) {
+        if (buck.version.value() & moved_bit)
+          // migrated since for_each_bucket looked
+          Sto::abort();
+        acquire_fence();
+        for (unsigned s = 0; s != absent_slots; ++s)
+          Sto::item(this, pack_bucket(buck, s)).observe(Version_type(buck.absent[s].unlocked()));
+        fence();
+        for (internal_elem *e = buck.head; e; e = e->next) {
+          auto item = t_read_only_item(e);
+          Value val = e->value.read(item, e->version);
+          if (e->valid())
+            w.add(e->key, val);
+        }
+        fence();
+        if (buck.version.value() & moved_bit)
+          Sto::abort();
+      });
+    } RETRY(true);
+    return 0;
+  }
+
+  scan_range make_scan_range(unsigned part, unsigned nparts) {
+    assert(nparts && !(nparts & (nparts - 1)) && part < nparts);
+    unsigned pbits = __builtin_ctz(nparts);
+    scan_range r;
+    r.t = table_;
+    r.part = part;
+    unsigned bbits = 64 - r.t->shift;
+    if (bbits >= pbits) {
+      r.first = size_t(part) << (bbits - pbits);
+      r.last = size_t(part + 1) << (bbits - pbits);
+      r.fp_shift = 32;
+    } else {
+      r.first = part >> (pbits - bbits);
+      r.last = r.first + 1;
+      r.fp_shift = 32 - pbits;
+    }
+    return r;
+  }
+
+  // calls f on buck's keys in r, returning how many
+  template <typename F>
+  size_t scan_bucket(bucket_entry& buck, F& f, const scan_range& r) {
+    if (buck.version.value() & moved_bit)
+      // migrated since for_each_bucket looked
+      Sto::abort();
+    acquire_fence();
+    if (bucket_scans_)
+      Sto::item(&scans_, &buck).add_read(Version_type(buck.version.unlocked()));
+    else
+      for (unsigned s = 0; s != absent_slots; ++s)
+        Sto::item(this, pack_bucket(buck, s)).observe(Version_type(buck.absent[s].unlocked()));
+    fence();
+    bool own_writes = !skip_own_writes() && Sto::transaction()->any_writes();
+    size_t n = 0;
+    Value val;
+    for (internal_elem *e = buck.head; e; e = e->next) {
+      if (r.fp_shift != 32 && (e->fp >> r.fp_shift) != r.part)
+        continue;
+      bool found;
+      if (own_writes && Sto::check_item(this, e))
+        // our own write (or an earlier read), read as by transGet
+        found = trans_get(e->key, hash(e->key), val);
+      else if (bucket_scans_)
+        found = scan_elem(e, val);
+      else {
+        auto item = t_read_only_item(e);
+        val = e->value.read(item, e->version);
+        found = e->valid();
+      }
+      if (found) {
+        f(e->key, val);
+        ++n;
+      }
+    }
+    fence();
+    if (buck.version.value() & moved_bit)
+      Sto::abort();
+    return n;
+  }
+
+  // reads e's value without an item, for a bucket scan, and returns
+  // whether e is a committed element. Its bucket's scan version changes
+  // if a commit changes it, so an element being committed aborts.
+  bool scan_elem(internal_elem *e, Value& val) {
+    while (1) {
+      Version_type v0 = e->version;
+      fence();
+      val = e->value.access();
+      fence();
+      Version_type v1 = e->version;
+      if (v1.is_locked())
+        Sto::abort();
+      if (v0 == v1) {
+        if (Opacity)
+          Sto::transaction()->check_opacity(v1.value());
+        return !(v1.value() & invalid_bit);
+      }
+      relax_fence();
+    }
+  }
+
+  // Whether a scan of buck at scan version v is still valid: no commit
+  // changed the bucket since, and none by another transaction is
+  // changing it now. Like check_bucket, follows migrations, whose split
+  // buckets start with their bucket's scan version.
+  bool check_scan(bucket_entry& buck, Version_type v, Transaction& txn) {
+    while (1) {
+      auto cur = buck.version.value();
+      if (TransactionTid::is_locked(cur)) {
+        // migrating, or linking or committing an element: briefly
+        relax_fence();
+        continue;
+      }
+      acquire_fence();
+      if (cur & moved_bit)
+        return check_scan(buck.split[0], v, txn) && check_scan(buck.split[1], v, txn);
+      if (cur != v.value())
+        return false;
+      for (internal_elem *e = buck.head; e; e = e->next)
+        if (e->version.is_locked_elsewhere(txn))
+          return false;
+      fence();
+      if (buck.version.value() == cur)
+        return true;
+    }
+  }
+
+  // a commit changed el, so its bucket's scan version; el is locked
+  void bump_scan_version(internal_elem *el) {
+    bucket_entry& buck = lock_bucket(el->key);
+    inc_scan_version(buck);
+    unlock(buck.version);
+  }
+  static void inc_scan_version(bucket_entry& buck) {
+    buck.version.set_version_locked(Version_type(TransactionTid::next_nonopaque_version(buck.version.value())));
+  }
+#endif
+
   TransProxy t_item(internal_elem* e) {
     return Sto::item(this, e);
   }
 
+  bool skip_own_writes() const {
+    return !read_my_writes_ || !Sto::transaction()->reads_my_writes();
+  }
+
+  // item for a write to e by trans_write
+  TransProxy t_write_item(internal_elem* e) {
+    if (!skip_own_writes())
+      return Sto::item(this, e);
+    assert(!Sto::transaction()->has_write_item(this, e) && "key written twice without read-my-writes");
+    return Sto::fresh_item(this, e);
+  }
+
   TransProxy t_read_only_item(internal_elem* e) {
 #if READ_MY_WRITES
-    return Sto::read_item(this, e);
-#else
-    return Sto::fresh_item(this, e);
+    if (!skip_own_writes())
+      return Sto::read_item(this, e);
+    assert(!Sto::transaction()->has_write_item(this, e) && "key read after write without read-my-writes");
 #endif
+    return Sto::fresh_item(this, e);
   }
 };
@@ -12,16 +12,21 @@ class TransProxy;
 
 class TThread {
     static __thread int the_id;
+    // set once this thread uses an id (set_id or register_thread)
+    static __thread bool has_id;
 public:
     static __thread Transaction* txn;
 
     static int id() {
         return the_id;
     }
-    static void set_id(int id) {
-        assert(id >= 0 && id < 32);
-        the_id = id;
-    }
+    // Use thread id `id`, registering it if necessary.
+    static inline void set_id(int id);
+    // Claim the lowest unused thread id and use it; returns the id. The
+    // calling thread must not already have an id.
+    static int register_thread();
+    // Release this thread's id so another thread can register it.
+    static void unregister_thread();
 };
 
 class TransactionTid {
@@ -29,14 +34,16 @@ public:
     typedef uint64_t type;
     typedef int64_t signed_type;
 
-    static constexpr type threadid_mask = type(0x1F);
-    static constexpr type lock_bit = type(0x20);
+    // 8 bits of thread id (see MAX_THREADS), then the lock and nonopaque
+    // bits, then 3 user bits.
+    static constexpr type threadid_mask = type(0xFF);
+    static constexpr type lock_bit = type(0x100);
     // Used for data structures that don't use opacity. When they increment
     // a version they set the nonopaque_bit, forcing any opacity check to be
     // hard (checking the full read set).
-    static constexpr type nonopaque_bit = type(0x40);
-    static constexpr type user_bit = type(0x80);
-    static constexpr type increment_value = type(0x400);
+    static constexpr type nonopaque_bit = type(0x200);
+    static constexpr type user_bit = type(0x400);
+    static constexpr type increment_value = type(0x2000);
 
     // TODO: probably remove these once RBTree stops referencing them.
     static void lock_read(type& v) {
@@ -571,11 +578,60 @@ public:
         return false;
     }
     virtual bool check(TransItem& item, Transaction& txn) = 0;
+    // Return true if item's check() verifies that a key is still absent
+    // (phantom protection). Commit aborts on such items count as
+    // ar_commit_check_absent rather than ar_commit_check.
+    virtual bool absent_check(const TransItem& item) const {
+        (void) item;
+        return false;
+    }
+    // Called a few items ahead of check(item) at commit. Should prefetch
+    // what check() will load (usually the version word) so that the
+    // misses of many checks overlap. Must not block or modify state.
+    virtual void prefetch_check(const TransItem& item) const {
+        (void) item;
+    }
     virtual void install(TransItem& item, Transaction& txn) = 0;
     virtual void unlock(TransItem& item) = 0;
+    // Batched lock, check and install, called once per owner by commits
+    // with Transaction::group_commit. items holds n of this object's
+    // items in the order they were added. lock_all and check_all return
+    // the index of the first item that failed, or n; lock_all leaves the
+    // items before that one locked. Objects can override them with loops
+    // that call their own methods directly.
+    virtual unsigned lock_all(TransItem* const* items, unsigned n, Transaction& txn) {
+        for (unsigned i = 0; i != n; ++i)
+            if (!lock(*items[i], txn))
+                return i;
+        return n;
+    }
+    virtual unsigned check_all(TransItem* const* items, unsigned n, Transaction& txn) {
+        for (unsigned i = 0; i != n; ++i)
+            if (!check(*items[i], txn))
+                return i;
+        return n;
+    }
+    virtual void install_all(TransItem* const* items, unsigned n, Transaction& txn) {
+        for (unsigned i = 0; i != n; ++i)
+            install(*items[i], txn);
+    }
+    // Return true if large commits may install this object's items from
+    // several threads at once (see Transaction::parallel_install_threshold)
+    // and unlock some of them before the transaction's other items are
+    // installed. Every item must have a lock of its own, and install()
+    // may use no Transaction state but commit_tid() and set_version.
+    virtual bool parallel_install() const {
+        return false;
+    }
     virtual void cleanup(TransItem& item, bool committed) {
         (void) item, (void) committed;
     }
+    // Return true if this object serves reads in snapshot transactions
+    // (Sto::snapshot_tid() != 0) from the version current as of the
+    // snapshot TID, without relying on commit-time validation.
+    virtual bool supports_snapshots() const {
+        return false;
+    }
     virtual void print(std::ostream& w, const TransItem& item) const;
 };
 
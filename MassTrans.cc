@@ -1,4 +1,32 @@
 #include "MassTrans.hh"
+#include <mutex>
 
 volatile bool recovering = false;
 volatile uint64_t globalepoch = 1;
+volatile mrcu_epoch_type active_epoch = 1;
+
+#if RCU
+std::atomic<threadinfo*> MassTransThreads::tis_[MAX_THREADS];
+
+threadinfo* MassTransThreads::make(unsigned id) {
+    static std::mutex mu;
+    std::lock_guard<std::mutex> guard(mu);
+    threadinfo* ti = tis_[id].load(std::memory_order_relaxed);
+    if (!ti) {
+        ti = threadinfo::make(threadinfo::TI_PROCESS, id);
+        tis_[id].store(ti, std::memory_order_release);
+    }
+    return ti;
+}
+
+void MassTransThreads::advance_epoch(threadinfo_t::epoch_type) {
+    // A transaction's start hook reads globalepoch after the transaction
+    // takes its STO epoch, and globalepoch trails STO's global epoch by
+    // at most one advance, so no running transaction's gc_epoch_ is below
+    // STO's active_epoch - 1.
+    threadinfo_t::epoch_type active = Transaction::global_epochs.active_epoch;
+    globalepoch = Transaction::global_epochs.global_epoch;
+    if (active > 1 && int64_t(active - 1 - active_epoch) > 0)
+        active_epoch = active - 1;
+}
+#endif
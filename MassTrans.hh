@@ -11,10 +11,15 @@
 #include "masstree_scan.hh"
 #include "string.hh"
 #include "Transaction.hh"
+#include "TCheckpoint.hh"
+#include "TCommute.hh"
+#include "TIntRange.hh"
+#include "TShardedCounter.hh"
 
 #include "StringWrapper.hh"
 #include "versioned_value.hh"
 #include "stuffed_str.hh"
+#include <atomic>
 
 #define RCU 1
 #define ABORT_ON_WRITE_READ_CONFLICT 0
@@ -76,6 +81,31 @@ struct versioned_str_struct : public versioned_str {
   }
 };
 
+#if RCU
+// Masstree threadinfos, one per STO thread id and shared by every
+// MassTrans. Masstree cannot free a threadinfo, so a thread that takes
+// over an id (TThread::set_id or TThread::register_thread) reuses the
+// previous holder's, limbo list and memory pools included, rather than
+// leaking a new one.
+class MassTransThreads {
+public:
+  static threadinfo* get(unsigned id) {
+    // pairs with make's release store, so ti's fields are visible
+    threadinfo* ti = tis_[id].load(std::memory_order_acquire);
+    return ti ? ti : make(id);
+  }
+
+  // An epoch_advance_callback (see MassTrans::static_init): moves
+  // Masstree's globalepoch with STO's, and sets Masstree's active_epoch,
+  // below which limbo memory is freed, from STO's active_epoch.
+  static void advance_epoch(threadinfo_t::epoch_type);
+
+private:
+  static std::atomic<threadinfo*> tis_[MAX_THREADS];
+  static threadinfo* make(unsigned id);
+};
+#endif
+
 template <typename V, typename Box = versioned_value_struct<V>, bool Opacity = true>
 class MassTrans : public TObject {
 public:
@@ -94,6 +124,11 @@ public:
   typedef typename Box::version_type Version;
   typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type tversion_type;
 
+  // With a box that keeps history (snapshot_versioned_value), the tree
+  // serves snapshot transactions
+  static constexpr bool Snapshots = box_keeps_history<Box>::value;
+  static_assert(!Snapshots || Opacity, "snapshot trees need TID versions");
+
   static __thread threadinfo_type mythreadinfo;
 
 protected:
@@ -104,44 +139,52 @@ public:
     typedef V write_value_type;
     typedef std::string key_write_value_type;
 
-  MassTrans() {
-#if RCU
-    if (!mythreadinfo.ti) {
-      auto* ti = threadinfo::make(threadinfo::TI_MAIN, -1);
-      mythreadinfo.ti = ti;
-    }
-#else
-    mythreadinfo.ti = new threadinfo;
-#endif
-    table_.initialize(*mythreadinfo.ti);
-    // TODO: technically we could probably free this threadinfo at this point since we won't use it again,
-    // but doesn't seem to be possible
+  MassTrans()
+    : tsize_(nullptr) {
+    table_.initialize(*bind_threadinfo());
+  }
+  ~MassTrans() {
+    delete tsize_;
   }
 
+  // Drive Masstree's epochs from STO's, so that Masstree frees nodes
+  // and values once no transaction can still see them.
   static void static_init() {
-    Transaction::epoch_advance_callback = [] (unsigned) {
-      // just advance blindly because of the way Masstree uses epochs
-      globalepoch++;
-    };
+#if RCU
+    Transaction::epoch_advance_callback = MassTransThreads::advance_epoch;
+#endif
   }
 
+  // Use the calling STO thread's threadinfo, and make its transactions
+  // enter and leave Masstree's RCU epochs.
   static void thread_init() {
-#if !RCU
-    mythreadinfo.ti = new threadinfo;
-    return;
+    threadinfo* ti = bind_threadinfo();
+#if RCU
+    Transaction::add_hook(Transaction::hook_start, rcu_start_hook, ti);
+    Transaction::add_hook(Transaction::hook_end, rcu_stop_hook, ti);
 #else
+    (void) ti;
+#endif
+  }
 
-    if (!mythreadinfo.ti) {
-      auto* ti = threadinfo::make(threadinfo::TI_PROCESS, TThread::id());
-      mythreadinfo.ti = ti;
-    }
-    Transaction::tinfo[TThread::id()].trans_start_callback = [] () {
-      mythreadinfo.ti->rcu_start();
-    };
-    Transaction::tinfo[TThread::id()].trans_end_callback = [] () {
-      mythreadinfo.ti->rcu_stop();
-    };
+#if RCU
+  static void rcu_start_hook(void* ti) {
+    static_cast<threadinfo*>(ti)->rcu_start();
+  }
+  static void rcu_stop_hook(void* ti) {
+    static_cast<threadinfo*>(ti)->rcu_stop();
+  }
 #endif
+
+  // point mythreadinfo at the calling STO thread's threadinfo
+  static threadinfo* bind_threadinfo() {
+#if RCU
+    mythreadinfo.ti = MassTransThreads::get(TThread::id());
+#else
+    static __thread threadinfo debug_ti;
+    mythreadinfo.ti = &debug_ti;
+#endif
+    return mythreadinfo.ti;
   }
 
   // print the content of the underlying Masstree
@@ -153,11 +196,35 @@ public:
   bool transGet(Str key, ValType& retval, threadinfo_type& ti = mythreadinfo) {
     unlocked_cursor_type lp(table_, key);
     bool found = lp.find_unlocked(*ti.ti);
+    if (Snapshots) {
+      if (auto s = Sto::snapshot_tid()) {
+        if (!found)
+          return false;
+        // under snapshot isolation, our own writes shadow the snapshot
+        if (Sto::transaction()->any_writes()) {
+          if (auto item = Sto::check_item(this, lp.value())) {
+            if (has_delete(*item))
+              return false;
+            materialize_pending(TransProxy(*Sto::transaction(), *item), lp.value());
+            if (item->has_write()) {
+              if (has_insert(*item))
+                assign_val(retval, lp.value()->read_value());
+              else
+                retval = item->template write_value<write_value_type>();
+              return true;
+            }
+          }
+        }
+        return snapshot_read(lp.value(), s, retval, snapshot_tag());
+      }
+    }
     if (found) {
       versioned_value *e = lp.value();
       //      __builtin_prefetch(&e->version);
       auto item = t_read_only_item(e);
       if (!validityCheck(item, e)) {
+        if (observe_tombstone(item, e))
+          return false;
         Sto::abort();
         return false;
       }
@@ -167,6 +234,7 @@ public:
       if (has_delete(item)) {
         return false;
       }
+      materialize_pending(item, e);
       if (item.has_write()) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
@@ -179,7 +247,7 @@ public:
 #endif
       Version elem_vers;
       atomicRead(e, elem_vers, retval);
-      item.observe(tversion_type(elem_vers));
+      observe_elem(item, elem_vers, retval, cond_tag());
     } else {
       ensureNotFound(lp.node(), lp.full_version_value());
     }
@@ -205,11 +273,14 @@ public:
         // otherwise this is an insert-then-delete
 	// has_insert() is used all over the place so we just keep that flag set
         item.add_flags(delete_bit);
+        count_size(-1);
         // key is already in write data since this used to be an insert
         return true;
       } else 
 #endif
      if (!valid) {
+        if (observe_tombstone(item, e))
+          return false;
         Sto::abort();
         return false;
       }
@@ -220,9 +291,12 @@ public:
         return false;
       }
 #endif
-      item.observe(tversion_type(v));
+      // (a conditional update's predicate checks that it's still there)
+      if (!item.has_predicate())
+        item.observe(tversion_type(v));
       // same as inserts we need to Store (copy) key so we can lookup to remove later
       item.template add_write<key_write_value_type>(key).add_flags(delete_bit);
+      count_size(-1);
       return found;
     } else {
       ensureNotFound(lp.node(), lp.full_version_value());
@@ -231,14 +305,15 @@ public:
   }
 
 private:
+  // An rvalue key or value is moved into the write set at its last use.
   template <bool INSERT, bool SET, typename StringType, typename ValueType>
-  bool trans_write(const StringType& key, const ValueType& value, threadinfo_type& ti = mythreadinfo) {
+  bool trans_write(StringType&& key, ValueType&& value, threadinfo_type& ti = mythreadinfo) {
     // optimization to do an unlocked lookup first
     if (SET) {
       unlocked_cursor_type lp(table_, key);
       bool found = lp.find_unlocked(*ti.ti);
       if (found) {
-        return handlePutFound<INSERT, SET>(lp.value(), key, value);
+        return handlePutFound<INSERT, SET>(lp.value(), key, std::forward<ValueType>(value));
       } else {
         if (!INSERT) {
           ensureNotFound(lp.node(), lp.full_version_value());
@@ -252,7 +327,7 @@ private:
     if (found) {
       versioned_value *e = lp.value();
       lp.finish(0, *ti.ti);
-      return handlePutFound<INSERT, SET>(e, key, value);
+      return handlePutFound<INSERT, SET>(e, key, std::forward<ValueType>(value));
     } else {
       //      auto p = ti.ti->allocate(sizeof(versioned_value), memtag_value);
       versioned_value* val = (versioned_value*)versioned_value::make(value, invalid_bit);
@@ -273,7 +348,8 @@ private:
 
       // this has to happen before we check opacity, so that aborts are safe.
       auto item = Sto::new_item(this, val);
-      item.template add_write<key_write_value_type>(key).add_flags(insert_bit);
+      item.template add_write<key_write_value_type>(std::forward<StringType>(key)).add_flags(insert_bit);
+      count_size(1);
 
       if (updateNodeVersion(orig_node, orig_version, upd_version)) {
         // add any new nodes as a result of splits, etc. to the read/absent set
@@ -295,25 +371,56 @@ private:
 
 public:
   template <typename KT, typename VT>
-  bool transPut(const KT& k, const VT& v, threadinfo_type& ti = mythreadinfo) {
-    return trans_write</*insert*/true, /*set*/true>(k, v, ti);
+  bool transPut(KT&& k, VT&& v, threadinfo_type& ti = mythreadinfo) {
+    return trans_write</*insert*/true, /*set*/true>(std::forward<KT>(k), std::forward<VT>(v), ti);
   }
 
   template <typename KT, typename VT>
-  bool transUpdate(const KT& k, const VT& v, threadinfo_type& ti = mythreadinfo) {
-    return trans_write</*insert*/false, /*set*/true>(k, v, ti);
+  bool transUpdate(KT&& k, VT&& v, threadinfo_type& ti = mythreadinfo) {
+    return trans_write</*insert*/false, /*set*/true>(std::forward<KT>(k), std::forward<VT>(v), ti);
   }
 
   template <typename KT, typename VT>
-  bool transInsert(const KT& k, const VT& v, threadinfo_type& ti = mythreadinfo) {
-    return !trans_write</*insert*/true, /*set*/false>(k, v, ti);
+  bool transInsert(KT&& k, VT&& v, threadinfo_type& ti = mythreadinfo) {
+    return !trans_write</*insert*/true, /*set*/false>(std::forward<KT>(k), std::forward<VT>(v), ti);
+  }
+
+  // Conditional updates of key's integer value, which commit without
+  // conflicting with concurrent updates that leave their tests' outcomes
+  // unchanged (see Hashtable::trans_cas).
+  bool trans_cas(Str key, const value_type& expected, const value_type& desired, threadinfo_type& ti = mythreadinfo) {
+    return trans_update_cond(key, cond_type{expected, expected}, TCommute::none, desired, ti);
+  }
+  bool trans_add_bounded(Str key, const value_type& delta, const value_type& bound, threadinfo_type& ti = mythreadinfo) {
+    return trans_update_cond(key, cond_type::add_bounded(delta, bound), TCommute::add, delta, ti);
+  }
+  bool trans_update_if(Str key, const value_type& lo, const value_type& hi, const value_type& desired, threadinfo_type& ti = mythreadinfo) {
+    return trans_update_cond(key, cond_type{lo, hi}, TCommute::none, desired, ti);
   }
 
 
+  // Transactional key count, kept once track_size() is called, with
+  // predicate semantics (see Hashtable::trans_size). track_size() counts
+  // the tree's keys with a scan; call it while no other threads use the
+  // tree.
+  void track_size(threadinfo_type& ti = mythreadinfo) {
+    if (tsize_)
+      return;
+    count_scanner scanner;
+    table_.scan(Str(), true, scanner, *ti.ti);
+    tsize_ = new TShardedCounter<ssize_t>(scanner.n);
+  }
+  bool tracks_size() const {
+    return tsize_;
+  }
+  const TShardedCounter<ssize_t>& trans_size() const {
+    assert(tsize_);
+    return *tsize_;
+  }
+
+  // The committed key count, non-transactionally, if tracked (0 if not).
   size_t approx_size() const {
-    // looks like if we want to implement this we have to tree walkers and all sorts of annoying things like that. could also possibly
-    // do a range query and just count keys
-    return 0;
+    return tsize_ ? tsize_->nontrans_read() : 0;
   }
 
   // goddammit templates/hax
@@ -339,6 +446,12 @@ public:
   // range queries
   template <typename Callback, typename ValAllocator = DefaultValAllocator>
   void transQuery(Str begin, Str end, Callback callback, ValAllocator *va = NULL, threadinfo_type& ti = mythreadinfo) {
+    if (Snapshots) {
+      if (auto s = Sto::snapshot_tid()) {
+        snapshot_query<false>(begin, end, callback, 0, s, ti, snapshot_tag());
+        return;
+      }
+    }
     auto node_callback = [&] (leaf_type* node, typename unlocked_cursor_type::nodeversion_value_type version) {
       this->ensureNotFound(node, version);
     };
@@ -349,6 +462,7 @@ public:
       if (has_delete(item)) {
         return true;
       }
+      this->materialize_pending(item, e);
       if (item.has_write()) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
@@ -364,7 +478,7 @@ public:
       value_type& val = va ? *(*va)() : stack_val;
       Version v;
       atomicRead(e, v, val);
-      item.observe(tversion_type(v));
+      this->observe_elem(item, v, val, cond_tag());
 
       // skip nodes that are marked invalid
       if (v & invalid_bit)
@@ -392,6 +506,7 @@ public:
       if (has_delete(item)) {
         return true;
       }
+      this->materialize_pending(item, e);
       if (item.has_write()) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
@@ -403,7 +518,7 @@ public:
 #endif
       Version v;
       atomicRead(e, v, val);
-      item.observe(tversion_type(v));
+      this->observe_elem(item, v, val, cond_tag());
 
       if (v & invalid_bit)
         return true;
@@ -415,6 +530,77 @@ public:
     table_.rscan(begin, true, scanner, *ti.ti);
   }
 
+  // Like transQuery, but validated leaf by leaf: rows read from a leaf
+  // are recorded in one item, together with the leaf version that
+  // transQuery also registers, instead of getting an item each. At commit
+  // that item checks its rows' versions in one go. Stops after limit rows
+  // (0 means no limit), leaving the rest of the last leaf unread. Returns
+  // the number of rows passed to callback.
+  template <typename Callback, typename ValAllocator = DefaultValAllocator>
+  size_t transScan(Str begin, Str end, Callback callback, size_t limit = 0, ValAllocator *va = NULL, threadinfo_type& ti = mythreadinfo) {
+    return scan_leaves<false>(begin, end, callback, limit, va, ti);
+  }
+
+  // transScan in descending key order: rows with keys <= begin and
+  // > end (an empty end means no bound), validated the same way.
+  template <typename Callback, typename ValAllocator = DefaultValAllocator>
+  size_t transRScan(Str begin, Str end, Callback callback, size_t limit = 0, ValAllocator *va = NULL, threadinfo_type& ti = mythreadinfo) {
+    return scan_leaves<true>(begin, end, callback, limit, va, ti);
+  }
+
+  // Memory of the tree's values (versions apart) and leaves, from a
+  // nontransactional scan. Values count their fixed part; interior
+  // nodes, and leaves' key suffixes, aren't counted.
+  footprint memory_footprint(threadinfo_type& ti = mythreadinfo) {
+    footprint_scanner scanner;
+    table_.scan(Str(), true, scanner, *ti.ti);
+    return scanner.f;
+  }
+
+  // Write a consistent checkpoint of the tree to path (see
+  // TCheckpoint.hh), scanning in a read-only transaction that is retried
+  // until it commits. Call outside a transaction.
+  bool checkpoint(const char* path, threadinfo_type& ti = mythreadinfo) {
+    TCheckpointWriter w;
+    if (!w.open(path))
+      return false;
+    TRANSACTION {
+      w.reset();
+      transQuery(Str(), Str(), [&] (Str key, const value_type& val) {
+          w.add(key.data(), key.length(), val);
+          return true;
+        }, (DefaultValAllocator*) NULL, ti);
+    } RETRY(true);
+    return w.commit(0);
+  }
+
+  // Load a checkpoint into this tree, which must be unused by other
+  // threads, inserting straight into Masstree without transactions.
+  bool restore(const char* path, threadinfo_type& ti = mythreadinfo) {
+    TCheckpointReader r;
+    if (!r.open(path))
+      return false;
+    const char* k;
+    const char* v;
+    uint32_t kl, vl;
+    while (r.next(k, kl, v, vl))
+      nontrans_load(Str(k, kl), TLogCodec<value_type>::decode(v, vl), ti);
+    return r.done();
+  }
+
+  // Non-transactional bulk load of keys[i] => values[i] for i < n,
+  // inserting straight into Masstree with Sto::initialized_tid() versions.
+  // Many threads may load at once, each with its own threadinfo (see
+  // thread_init), but no transactions may use the tree meanwhile. Sorted
+  // input loads fastest, since consecutive keys descend to the same,
+  // still cached leaf; so give each thread a sorted run of keys, ideally
+  // disjoint from the others' key ranges.
+  template <typename KT, typename VT>
+  void bulk_load(const KT* keys, const VT* values, size_t n, threadinfo_type& ti = mythreadinfo) {
+    for (size_t i = 0; i != n; ++i)
+      nontrans_load(Str(keys[i]), value_type(values[i]), ti);
+  }
+
 #if READ_MY_WRITES
   template <typename Callback, typename ValAllocator>
   // for some reason inlining this/not making it a function gives a 5% slowdown on g++...
@@ -476,6 +662,32 @@ protected:
     Valuecallback valuecallback_;
   };
 
+  // adds up the leaves and values a whole-tree scan visits
+  struct count_scanner {
+    ssize_t n = 0;
+    template <typename ITER>
+    void visit_leaf(const ITER&, const Masstree::key<uint64_t>&, threadinfo&) {
+    }
+    bool visit_value(const Masstree::key<uint64_t>&, versioned_value* e, threadinfo&) {
+      // skip tombstones
+      n += !(e->version() & invalid_bit);
+      return true;
+    }
+  };
+
+  struct footprint_scanner {
+    footprint f;
+    template <typename ITER>
+    void visit_leaf(const ITER& iter, const Masstree::key<uint64_t>&, threadinfo&) {
+      f.index += sizeof(*iter.node());
+    }
+    bool visit_value(const Masstree::key<uint64_t>&, versioned_value*, threadinfo&) {
+      f.versions += sizeof(Version);
+      f.data += sizeof(versioned_value) - sizeof(Version);
+      return true;
+    }
+  };
+
 public:
 
   // non-transaction put/get. These just wrap a transaction get/put
@@ -506,7 +718,23 @@ public:
         versioned_value* vv = item.key<versioned_value*>();
         return txn.try_lock(item, vv->version());
     }
+  void prefetch_check(const TransItem& item) const override {
+    if (is_scan(item))
+      prefetch(&item.template read_value<scan_rows>().e[0]->version());
+    else if (is_inter(item))
+      prefetch(untag_inter(item.key<leaf_type*>()));
+    else
+      prefetch(&item.key<versioned_value*>()->version());
+  }
+
   bool check(TransItem& item, Transaction&) override {
+    if (is_scan(item)) {
+      const scan_rows& rows = item.template read_value<scan_rows>();
+      for (unsigned i = 0; i != rows.n; ++i)
+        if (!TransactionTid::check_version(rows.e[i]->version(), rows.v[i]))
+          return false;
+      return true;
+    }
     if (is_inter(item)) {
       auto n = untag_inter(item.key<leaf_type*>());
       auto cur_version = n->full_version_value();
@@ -520,11 +748,22 @@ public:
       return false;
     return TransactionTid::check_version(e->version(), read_version);
   }
+  // conditional updates' predicates
+  bool check_predicate(TransItem& item, Transaction& txn, bool) override {
+    return check_cond(item, txn, cond_tag());
+  }
   void install(TransItem& item, Transaction& t) override {
     assert(!is_inter(item));
     auto e = item.key<versioned_value*>();
     assert(is_locked(e->version()));
     if (has_delete(item)) {
+      if (Snapshots && !has_insert(item)) {
+        // snapshots need the deleted value, so leave a tombstone
+        save_history(e, snapshot_tag());
+        TransactionTid::set_version(e->version(), t.commit_tid() | invalid_bit);
+        bury(e, Str(item.template write_value<key_write_value_type>()), snapshot_tag());
+        return;
+      }
       if (!has_insert(item)) {
         assert(!(e->version() & invalid_bit));
         e->version() |= invalid_bit;
@@ -542,6 +781,8 @@ public:
     }
     if (!has_insert(item)) {
         write_value_type& v = item.template write_value<write_value_type>();
+        install_pending(item, e, cond_tag());
+        save_history(e, snapshot_tag());
         e->set_value(v);
     }
     if (Opacity)
@@ -571,18 +812,24 @@ public:
     }
   }
 
+  bool supports_snapshots() const override {
+    return Snapshots;
+  }
+
   bool remove(const Str& key, threadinfo_type& ti = mythreadinfo) {
     cursor_type lp(table_, key);
     bool found = lp.find_locked(*ti.ti);
     lp.value()->deallocate_rcu(*ti.ti);
     lp.finish(found ? -1 : 0, *ti.ti);
+    if (found)
+      count_size_nontrans(-1);
     return found;
   }
 
 protected:
   // called once we've checked our own writes for a found put()
   template <typename ValueType>
-  void reallyHandlePutFound(TransProxy& item, versioned_value *e, Str key, const ValueType& value) {
+  void reallyHandlePutFound(TransProxy& item, versioned_value *e, Str key, ValueType&& value) {
     // resizing takes a lot of effort, so we first check if we'll need to
     // (values never shrink in size, so if we don't need to resize, we'll never need to)
     auto *new_location = e;
@@ -628,14 +875,132 @@ protected:
     {
       if (new_location != e)
         item = Sto::new_item(this, new_location);
-      item.template add_write<write_value_type>(value);
+      item.template add_write<write_value_type>(std::forward<ValueType>(value)).clear_flags(TCommute::mask);
     }
   }
 
+  // Conditional updates. The test is a predicate on the value, and a
+  // successful bounded add is a pending TCommute::add. Only integer
+  // values have them; the std::false_type overloads cover the rest.
+  typedef TIntRange<value_type> cond_type;
+  typedef std::integral_constant<bool, std::is_integral<value_type>::value> cond_tag;
+
+  bool trans_update_cond(Str key, const cond_type& cond, TCommute::op_type op, const value_type& x, threadinfo_type& ti) {
+    static_assert(std::is_integral<value_type>::value, "conditional updates need integer values");
+    if (cond.first > cond.second)
+      // fails whatever the value
+      return false;
+    unlocked_cursor_type lp(table_, key);
+    if (!lp.find_unlocked(*ti.ti)) {
+      ensureNotFound(lp.node(), lp.full_version_value());
+      return false;
+    }
+    versioned_value *e = lp.value();
+    auto item = t_item(e);
+    if (!validityCheck(item, e)) {
+      if (observe_tombstone(item, e))
+        return false;
+      Sto::abort();
+    }
+    if (has_delete(item))
+      return false;
+    materialize_pending(item, e);
+    Version v;
+    value_type val;
+    if (!item.has_write() && !item.has_read()) {
+      // the common case: test under a predicate, and leave the value unread
+      atomicRead(e, v, val);
+      if (Opacity)
+        check_opacity(v);
+      if (!item.predicate_value(cond_type::unconstrained()).observe_in(val, cond.first, cond.second))
+        return false;
+      if (op == TCommute::none)
+        item.template add_write<write_value_type>(x);
+      else
+        TCommute::record(item, op, x);
+      return true;
+    }
+    if (has_insert(item) || !item.has_write()) {
+      atomicRead(e, v, val);
+      if (!has_insert(item))
+        observe_elem(item, v, val, cond_tag());
+    } else
+      val = item.template write_value<write_value_type>();
+    if (!cond.verify(val))
+      return false;
+    TCommute::apply(op, val, x);
+    if (has_insert(item))
+      // our own insert's value lives in the element
+      e->set_value(val);
+    else
+      item.template add_write<write_value_type>(val).clear_flags(TCommute::mask);
+    return true;
+  }
+
+  // observes an element's version v and value val: through the item's
+  // predicate, narrowing it to val, if a conditional update left one
+  template <typename VT>
+  void observe_elem(TransProxy item, Version v, const VT& val, std::true_type) {
+    if (item.has_predicate()) {
+      if (Opacity)
+        check_opacity(v);
+      item.template predicate_value<cond_type>().observe(value_type(val));
+    } else
+      item.observe(tversion_type(v));
+  }
+  template <typename VT>
+  void observe_elem(TransProxy item, Version v, const VT&, std::false_type) {
+    item.observe(tversion_type(v));
+  }
+
+  // a pending bounded add becomes a plain write once the transaction
+  // reads the value
+  void materialize_pending(TransProxy item, versioned_value *e) {
+    if (TCommute::pending(item))
+      materialize_pending(item, e, cond_tag());
+  }
+  void materialize_pending(TransProxy item, versioned_value *e, std::true_type) {
+    Version v;
+    value_type val;
+    atomicRead(e, v, val);
+    observe_elem(item, v, val, cond_tag());
+    TCommute::materialize(item, val);
+  }
+  void materialize_pending(TransProxy, versioned_value*, std::false_type) {
+    always_assert(false);
+  }
+
+  void install_pending(TransItem& item, versioned_value *e, std::true_type) {
+    if (TCommute::pending(item))
+      item.template write_value<write_value_type>() = TCommute::installed_value(item, value_type(e->read_value()));
+  }
+  void install_pending(TransItem&, versioned_value*, std::false_type) {
+  }
+
+  bool check_cond(TransItem& item, Transaction& txn, std::true_type) {
+    auto e = item.key<versioned_value*>();
+    const cond_type& cond = item.template predicate_value<cond_type>();
+    while (1) {
+      Version v0 = e->version();
+      fence();
+      value_type val = e->read_value();
+      fence();
+      Version v1 = e->version();
+      if (TransactionTid::is_locked_elsewhere(v1, txn.threadid()))
+        return false;
+      if (v0 == v1 || is_locked(v1))
+        return validityCheck(item, e) && cond.verify(val);
+      relax_fence();
+    }
+  }
+  bool check_cond(TransItem&, Transaction&, std::false_type) {
+    return false;
+  }
+
   // returns true if already in tree, false otherwise
   // handles a transactional put when the given key is already in the tree
   template <bool INSERT, bool SET, typename ValueType>
-  bool handlePutFound(versioned_value *e, Str key, const ValueType& value) {
+  bool handlePutFound(versioned_value *e, Str key, ValueType&& value) {
     auto item = t_item(e);
     if (!validityCheck(item, e)) {
       Sto::abort();
@@ -648,7 +1013,8 @@ protected:
       if (INSERT) {
         item.clear_flags(delete_bit);
         assert(!has_delete(item));
-        reallyHandlePutFound(item, e, key, value);
+        reallyHandlePutFound(item, e, key, std::forward<ValueType>(value));
+        count_size(1);
       } else {
         // delete-then-update == not found
         // delete will check for other deletes so we don't need to re-log that check
@@ -656,7 +1022,7 @@ protected:
       return false;
     }
     // make sure this item doesn't get deleted (we don't care about other updates to it though)
-    if (!item.has_read() && !has_insert(item))
+    if (!item.has_read() && !has_insert(item) && !item.has_predicate())
 #endif
     {
       // XXX: I'm pretty sure there's a race here-- we should grab this
@@ -666,11 +1032,197 @@ protected:
       item.observe(tversion_type(v));
     }
     if (SET) {
-      reallyHandlePutFound(item, e, key, value);
+      reallyHandlePutFound(item, e, key, std::forward<ValueType>(value));
     }
     return true;
   }
 
+  // Snapshot support; the std::false_type overloads cover trees without
+  // it. A snapshot tree's deletes leave the key's box in the tree as a
+  // tombstone: invalid, with the deletion's TID, and the deleted value on
+  // its history. Lookups treat tombstones as absent keys, which stay
+  // absent until the tombstone is reaped: RCU runs the reaper once every
+  // transaction running at the delete is done, and any later snapshot
+  // postdates the delete. Reaping changes the tombstone's version, so
+  // absence validates against it. Writers abort on tombstones.
+  typedef std::integral_constant<bool, Snapshots> snapshot_tag;
+
+  void save_history(versioned_value *e, std::true_type) {
+    assert(is_locked(e->version()) && !(e->version() & invalid_bit));
+    e->history.push(e->read_value(), TransactionTid::unlocked(e->version()));
+  }
+  void save_history(versioned_value*, std::false_type) {}
+
+  struct tombstone {
+    MassTrans *tree;
+    versioned_value *e;
+    std::string key;
+  };
+  void bury(versioned_value *e, Str key, std::true_type) {
+    Transaction::rcu_call(reap_callback, new tombstone{this, e, std::string(key.data(), key.length())});
+  }
+  void bury(versioned_value*, Str, std::false_type) {}
+  static void reap_callback(void* p) {
+    tombstone* t = static_cast<tombstone*>(p);
+    t->tree->reap(t->e, Str(t->key));
+    delete t;
+  }
+  void reap(versioned_value *e, Str key) {
+    threadinfo& ti = *mythreadinfo.ti;
+    cursor_type lp(table_, key);
+    bool found = lp.find_locked(ti);
+    assert(found && lp.value() == e);
+    lock(e);
+    TransactionTid::inc_nonopaque_version(e->version());
+    unlock(e);
+    lp.finish(found ? -1 : 0, ti);
+    e->deallocate_rcu(ti);
+  }
+
+  // deleted keys are absent to readers of the tombstone's version
+  bool observe_tombstone(TransProxy& item, versioned_value *e) {
+    if (!Snapshots || has_insert(item))
+      return false;
+    Version v = e->version();
+    if (!(v & invalid_bit) || !TransactionTid::unlocked(v & ~invalid_bit))
+      // insert in progress
+      return false;
+    item.observe(tversion_type(v));
+    return true;
+  }
+
+  // transScan and transRScan
+  template <bool Reverse, typename Callback, typename ValAllocator>
+  size_t scan_leaves(Str begin, Str end, Callback& callback, size_t limit, ValAllocator *va, threadinfo_type& ti) {
+    if (Snapshots) {
+      if (auto s = Sto::snapshot_tid())
+        return snapshot_query<Reverse>(begin, end, callback, limit, s, ti, snapshot_tag());
+    }
+    scan_rows *rows = NULL;
+    size_t nrows = 0;
+    auto node_callback = [&] (leaf_type* node, typename unlocked_cursor_type::nodeversion_value_type version) {
+      this->ensureNotFound(node, version);
+      // rows from here on go in a new item
+      rows = NULL;
+    };
+    auto value_callback = [&] (Str key, versioned_value* e) {
+#if READ_MY_WRITES
+      if (auto item = Sto::check_item(this, e)) {
+        if (has_delete(*item))
+          return true;
+        this->materialize_pending(TransProxy(*Sto::transaction(), *item), e);
+        if (item->has_write()) {
+          ++nrows;
+          bool more;
+          if (has_insert(*item))
+            more = range_query_has_insert(callback, key, e, va);
+          else
+            more = callback(key, item->template write_value<write_value_type>());
+          return more && nrows != limit;
+        }
+      }
+#endif
+      value_type stack_val;
+      value_type& val = va ? *(*va)() : stack_val;
+      Version v;
+      atomicRead(e, v, val);
+      if (!rows || rows->n == scan_rows::capacity)
+        rows = this->new_scan_rows(e);
+      if (rows) {
+        rows->e[rows->n] = e;
+        rows->v[rows->n] = v;
+        ++rows->n;
+        if (Opacity)
+          Sto::check_opacity(v);
+      } else
+        // e already heads another scan's item; fall back to a row item
+        this->observe_elem(this->t_read_only_item(e), v, val, cond_tag());
+
+      // skip nodes that are marked invalid
+      if (v & invalid_bit)
+        return true;
+      ++nrows;
+      return callback(key, val) && nrows != limit;
+    };
+
+    range_scanner<decltype(node_callback), decltype(value_callback), Reverse> scanner(end, node_callback, value_callback);
+    if (Reverse)
+      table_.rscan(begin, true, scanner, *ti.ti);
+    else
+      table_.scan(begin, true, scanner, *ti.ti);
+    return nrows;
+  }
+
+  // reads e as of snapshot TID s; false if its key had no value then
+  template <typename ValType>
+  bool snapshot_read(versioned_value *e, TransactionTid::type s, ValType& retval, std::true_type) {
+    while (1) {
+      Version v0 = e->version();
+      if (is_locked(v0)) {
+        // the locker may be a commit ordered before s; wait for it
+        relax_fence();
+        continue;
+      }
+      acquire_fence();
+      value_type val = e->read_value();
+      fence();
+      if (e->version() != v0)
+        continue;
+      if (v0 >= s) {
+        if (const value_type* old = e->history.find(s)) {
+          assign_val(retval, *old);
+          return true;
+        }
+        return false;
+      } else if (v0 & invalid_bit)
+        // uncommitted insert, or deleted before s
+        return false;
+      assign_val(retval, val);
+      return true;
+    }
+  }
+  template <typename ValType>
+  bool snapshot_read(versioned_value*, TransactionTid::type, ValType&, std::false_type) {
+    return false;
+  }
+
+  // scans keys as of snapshot TID s, registering no items
+  template <bool Reverse, typename Callback>
+  size_t snapshot_query(Str begin, Str end, Callback& callback, size_t limit, TransactionTid::type s, threadinfo_type& ti, std::true_type) {
+    size_t nrows = 0;
+    auto node_callback = [&] (leaf_type*, typename unlocked_cursor_type::nodeversion_value_type) {};
+    auto value_callback = [&] (Str key, versioned_value* e) {
+      value_type val;
+      if (!this->snapshot_read(e, s, val, snapshot_tag()))
+        return true;
+      ++nrows;
+      return callback(key, val) && nrows != limit;
+    };
+    range_scanner<decltype(node_callback), decltype(value_callback), Reverse> scanner(end, node_callback, value_callback);
+    if (Reverse)
+      table_.rscan(begin, true, scanner, *ti.ti);
+    else
+      table_.scan(begin, true, scanner, *ti.ti);
+    return nrows;
+  }
+  template <bool Reverse, typename Callback>
+  size_t snapshot_query(Str, Str, Callback&, size_t, TransactionTid::type, threadinfo_type&, std::false_type) {
+    return 0;
+  }
+
+  // inserts or overwrites key without a transaction
+  void nontrans_load(Str key, const value_type& val, threadinfo_type& ti) {
+    cursor_type lp(table_, key);
+    bool found = lp.find_insert(*ti.ti);
+    if (found)
+      lp.value()->set_value(val);
+    else
+      lp.value() = (versioned_value*) versioned_value::make(val, Sto::initialized_tid());
+    lp.finish(!found, *ti.ti);
+    if (!found)
+      count_size_nontrans(1);
+  }
+
   template <typename NODE, typename VERSION>
   void ensureNotFound(NODE n, VERSION v) {
     // TODO: could be more efficient to use fresh_item here, but that will also require more work for read-then-insert
@@ -681,6 +1233,25 @@ protected:
       item.add_read(v);
   }
 
+  // The rows a transScan read from one leaf, and their versions. The
+  // item holding them is keyed by the first row, tagged with scan_bit.
+  struct scan_rows {
+    static constexpr unsigned capacity = 15;
+    unsigned n;
+    versioned_value* e[capacity];
+    Version v[capacity];
+    scan_rows() : n(0) {}
+  };
+
+  // adds a scan item headed by e, or returns NULL if there already is one
+  scan_rows* new_scan_rows(versioned_value *e) {
+    if (Sto::check_item(this, tag_scan(e)))
+      return NULL;
+    auto item = Sto::new_item(this, tag_scan(e));
+    item.add_read(scan_rows());
+    return &item.template read_value<scan_rows>();
+  }
+
   template <typename NODE, typename VERSION>
   bool updateNodeVersion(NODE *node, VERSION prev_version, VERSION new_version) {
     if (auto node_item = Sto::check_item(this, tag_inter(node))) {
@@ -724,6 +1295,7 @@ protected:
   static constexpr Version invalid_bit = TransactionTid::user_bit;
 
   static constexpr uintptr_t internode_bit = 1<<0;
+  static constexpr uintptr_t scan_bit = 1<<1;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
@@ -743,6 +1315,12 @@ protected:
   static bool is_inter(const TransItem& t) {
       return is_inter(t.key<versioned_value*>());
   }
+  static versioned_value* tag_scan(versioned_value* e) {
+    return (versioned_value*)((uintptr_t)e | scan_bit);
+  }
+  static bool is_scan(const TransItem& t) {
+      return (uintptr_t)t.key<versioned_value*>() & scan_bit;
+  }
 
   static void check_opacity(Version& v) {
     Version v2 = v;
@@ -808,6 +1386,18 @@ protected:
   typedef Masstree::tcursor<table_params> cursor_type;
   typedef Masstree::leaf<table_params> leaf_type;
   table_type table_;
+  // transactional count of committed keys (see track_size)
+  TShardedCounter<ssize_t>* tsize_;
+
+  // count an insert (d = 1) or delete (d = -1) in trans_size
+  void count_size(ssize_t d) {
+    if (tsize_)
+      *tsize_ += d;
+  }
+  void count_size_nontrans(ssize_t d) {
+    if (tsize_)
+      tsize_->nontrans_add(d);
+  }
 };
 
 template <typename V, typename Box, bool Opacity>
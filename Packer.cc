@@ -1,30 +1,137 @@
 #include "Packer.hh"
+#include "TPages.hh"
 
 constexpr size_t TransactionBuffer::default_capacity;
 
+// Chunks belong to the transaction's thread; large ones get huge pages
+// per TPages::policy().
+TransactionBuffer::elt* TransactionBuffer::allocate_elt(size_t capacity) {
+    elt* e = (elt*) TPages::allocate_local(sizeof(elthdr) + capacity);
+    e->next = nullptr;
+    e->pos = 0;
+    e->capacity = TPages::size(e) - sizeof(elthdr);
+    e->ndestroy = 0;
+    return e;
+}
+
+void TransactionBuffer::free_elt(elt* e) {
+    TPages::free(e);
+}
+
 void TransactionBuffer::hard_get_space(size_t needed) {
     size_t s = std::max(needed, e_ ? e_->capacity * 2 : default_capacity);
-    elt* ne = (elt*) new char[sizeof(elthdr) + s];
+    elt* ne = allocate_elt(s);
     ne->next = e_;
-    ne->pos = 0;
-    ne->capacity = s;
     if (e_)
         linked_size_ += e_->pos;
     e_ = ne;
 }
 
+void TransactionBuffer::rollback(const mark_type& m) {
+    while (e_ != m.e) {
+        if (!m.e && !e_->next) {
+            // marked before the first allocation; keep one chunk
+            e_->clear();
+            break;
+        }
+        elt* next = e_->next;
+        e_->clear();
+        free_elt(e_);
+        e_ = next;
+    }
+    if (m.e)
+        e_->truncate(m.pos);
+    linked_size_ = m.linked_size;
+    if (ucount_)
+        rollback_unique(m.linked_size + m.pos);
+}
+
+TransactionBuffer::unique_slot* TransactionBuffer::unique_insert_slot(size_t hash) {
+    if (2 * (ucount_ + 1) > umask_ + 1)
+        grow_unique();
+    size_t i = hash & umask_;
+    while (uslots_[i].gen == ugen_)
+        i = (i + 1) & umask_;
+    uslots_[i].hash = hash;
+    uslots_[i].gen = ugen_;
+    ++ucount_;
+    return &uslots_[i];
+}
+
+// rehashes the in-use slots into a table twice the size
+void TransactionBuffer::grow_unique() {
+    size_t capacity = uslots_ ? 2 * (umask_ + 1) : 64;
+    unique_slot* old = uslots_;
+    size_t old_capacity = uslots_ ? umask_ + 1 : 0;
+    uslots_ = new unique_slot[capacity];
+    for (size_t i = 0; i != capacity; ++i)
+        uslots_[i].gen = 0;
+    umask_ = capacity - 1;
+    unsigned gen = ugen_;
+    ugen_ = 1;
+    ucount_ = 0;
+    for (size_t i = 0; i != old_capacity; ++i)
+        if (old[i].gen == gen) {
+            unique_slot* s = unique_insert_slot(old[i].hash);
+            s->key = old[i].key;
+            s->pos = old[i].pos;
+        }
+    delete[] old;
+}
+
+void TransactionBuffer::clear_unique() {
+    ucount_ = 0;
+    if (++ugen_ == 0) {
+        for (size_t i = 0; i <= umask_; ++i)
+            uslots_[i].gen = 0;
+        ugen_ = 1;
+    }
+}
+
+// forgets keys at offsets >= pos, which rollback() destroyed
+void TransactionBuffer::rollback_unique(size_t pos) {
+    size_t nkeep = 0;
+    for (size_t i = 0; i <= umask_; ++i)
+        nkeep += uslots_[i].gen == ugen_ && uslots_[i].pos < pos;
+    if (nkeep == ucount_)
+        return;
+    // removing from an open-addressed table breaks probe chains, so
+    // reinsert the survivors from a copy
+    unique_slot* old = new unique_slot[umask_ + 1];
+    std::copy(uslots_, uslots_ + umask_ + 1, old);
+    unsigned gen = ugen_;
+    clear_unique();
+    for (size_t i = 0; i <= umask_; ++i)
+        if (old[i].gen == gen && old[i].pos < pos) {
+            unique_slot* s = unique_insert_slot(old[i].hash);
+            s->key = old[i].key;
+            s->pos = old[i].pos;
+        }
+    delete[] old;
+}
+
 void TransactionBuffer::hard_clear(bool delete_all) {
+    size_t total = buffer_size();
+    bool grown = e_ && e_->next;
     while (e_ && e_->next) {
         elt* e = e_->next;
         e_->next = e->next;
         e->clear();
-        delete[] (char*) e;
+        free_elt(e);
     }
     if (e_)
         e_->clear();
     linked_size_ = 0;
-    if (e_ && delete_all) {
-        delete[] (char*) e_;
+    if (e_ && (delete_all || (grown && total > e_->capacity))) {
+        free_elt(e_);
         e_ = 0;
     }
+    // keep one chunk big enough for this transaction, so the next
+    // transaction of the same size never chains
+    if (!delete_all && grown && !e_) {
+        size_t s = default_capacity;
+        while (s < total)
+            s *= 2;
+        e_ = allocate_elt(s);
+    }
 }
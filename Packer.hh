@@ -1,6 +1,7 @@
 #pragma once
 #include "compiler.hh"
 #include <algorithm>
+#include <functional>
 
 class TransactionBuffer;
 
@@ -40,17 +41,28 @@ template <typename T> struct UniqueKey {
     }
 };
 
+// Whether intern() can hash T with std::hash
+template <typename T, typename = void> struct is_std_hashable
+    : public std::false_type {};
+template <typename T> struct is_std_hashable<T, decltype((void) std::hash<T>()(std::declval<const T&>()))>
+    : public std::true_type {};
+
+// Per-transaction arena for packed keys and values. A Transaction reuses
+// its buffer, so the buffer keeps its grown capacity across transactions.
+// Only items with nontrivial destructors are destroyed on clear(), which
+// is O(1) when every item is trivially destructible and fits one chunk.
 class TransactionBuffer {
     struct elt;
     struct item;
 
 public:
     TransactionBuffer()
-        : e_(), linked_size_(0) {
+        : e_(), linked_size_(0), uslots_(), umask_(0), ucount_(0), ugen_(1) {
     }
     ~TransactionBuffer() {
         if (e_)
             hard_clear(true);
+        delete[] uslots_;
     }
 
     static constexpr size_t aligned_size(size_t x) {
@@ -63,20 +75,61 @@ public:
     template <typename T, typename U = T>
     const T* find(const U& x) const;
 
+    // The UniqueKey<T> equal to x, allocating one if there is none, so
+    // equal keys pack to the same pointer. Keys std::hash can hash are
+    // found through a hash index of the buffer's unique keys; others by
+    // find()'s linear scan.
+    template <typename T>
+    UniqueKey<T>* intern(const T& x) {
+        return intern(x, is_std_hashable<T>());
+    }
+
     size_t buffer_size() const {
         return linked_size_ + (e_ ? e_->pos : 0);
     }
+    // capacity of the current chunk
+    size_t buffer_capacity() const {
+        return e_ ? e_->capacity : 0;
+    }
+    // bytes of every chunk and of the interned-key index
+    size_t allocated_bytes() const {
+        size_t n = uslots_ ? (umask_ + 1) * sizeof(unique_slot) : 0;
+        for (elt* e = e_; e; e = e->next)
+            n += sizeof(elthdr) + e->capacity;
+        return n;
+    }
+    // A position in the buffer; rollback() destroys everything allocated
+    // after it. Valid until the next clear().
+    struct mark_type {
+        elt* e;
+        size_t pos;
+        size_t linked_size;
+    };
+    mark_type mark() const {
+        return mark_type{e_, e_ ? e_->pos : 0, linked_size_};
+    }
+    void rollback(const mark_type& m);
+
     void clear() {
-        if (e_ && e_->pos)
-            hard_clear(false);
+        if (e_ && e_->pos) {
+            if (!e_->next && !e_->ndestroy)
+                e_->pos = 0;
+            else
+                hard_clear(false);
+        }
+        if (ucount_)
+            clear_unique();
     }
 
 private:
     static constexpr size_t default_capacity = 4080;
+    // find() uses destroyer as a type tag, so every item has one; the
+    // size_destroy bit of size marks items whose destroyer must run
     struct itemhdr {
         void (*destroyer)(void*);
         size_t size;
     };
+    static constexpr size_t size_destroy = 1;
     struct item : public itemhdr {
         char buf[0];
     };
@@ -84,22 +137,46 @@ private:
         elt* next;
         size_t pos;
         size_t capacity;
+        size_t ndestroy; // items with nontrivial destructors
     };
     struct elt : public elthdr {
         char buf[0];
         void clear() {
-            size_t off = 0;
-            while (off < pos) {
+            truncate(0);
+        }
+        // destroy items at offsets >= to, which must be an item boundary
+        void truncate(size_t to) {
+            size_t off = to;
+            while (ndestroy && off < pos) {
                 itemhdr* i = (itemhdr*) &buf[off];
-                i->destroyer(i + 1);
-                off += i->size;
+                if (i->size & size_destroy) {
+                    i->destroyer(i + 1);
+                    --ndestroy;
+                }
+                off += i->size & ~size_destroy;
             }
-            pos = 0;
+            pos = to;
+            if (!to)
+                ndestroy = 0;
         }
     };
     elt* e_;
     size_t linked_size_;
 
+    // Open-addressed index of interned keys. A slot is in use only if its
+    // gen is ugen_, so clear() empties the index by bumping ugen_. pos is
+    // the key's buffer offset, which tells rollback() what to forget.
+    struct unique_slot {
+        size_t hash;
+        void* key;
+        size_t pos;
+        unsigned gen;
+    };
+    unique_slot* uslots_;
+    size_t umask_;
+    size_t ucount_;
+    unsigned ugen_;
+
     item* get_space(size_t needed) {
         if (!e_ || e_->pos + needed > e_->capacity)
             hard_get_space(needed);
@@ -108,6 +185,16 @@ private:
     }
     void hard_get_space(size_t needed);
     void hard_clear(bool delete_all);
+    template <typename T>
+    UniqueKey<T>* intern(const T& x, std::false_type);
+    template <typename T>
+    UniqueKey<T>* intern(const T& x, std::true_type);
+    unique_slot* unique_insert_slot(size_t hash);
+    void grow_unique();
+    void clear_unique();
+    void rollback_unique(size_t pos);
+    static elt* allocate_elt(size_t capacity);
+    static void free_elt(elt* e);
 };
 
 template <typename T, typename... Args>
@@ -116,7 +203,13 @@ T* TransactionBuffer::allocate(Args&&... args) {
     item* space = this->get_space(isize);
     space->destroyer = ObjectDestroyer<T>::destroy;
     space->size = isize;
-    return new (&space->buf[0]) T(std::forward<Args>(args)...);
+    T* x = new (&space->buf[0]) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+        // set only once constructed, so a throwing constructor is skipped
+        space->size |= size_destroy;
+        ++e_->ndestroy;
+    }
+    return x;
 }
 
 template <typename T, typename U>
@@ -130,12 +223,44 @@ const T* TransactionBuffer::find(const U& x) const {
                 if (contents->x == x)
                     return &contents->x;
             }
-            off += i->size;
+            off += i->size & ~size_destroy;
         }
     return nullptr;
 }
 
 
+template <typename T>
+UniqueKey<T>* TransactionBuffer::intern(const T& x, std::false_type) {
+    if (const UniqueKey<T>* k = find<UniqueKey<T> >(x))
+        return const_cast<UniqueKey<T>*>(k);
+    return allocate<UniqueKey<T> >(x);
+}
+
+template <typename T>
+UniqueKey<T>* TransactionBuffer::intern(const T& x, std::true_type) {
+    size_t hash = std::hash<T>()(x);
+    void (*destroyer)(void*) = ObjectDestroyer<UniqueKey<T> >::destroy;
+    if (ucount_)
+        for (size_t i = hash & umask_; uslots_[i].gen == ugen_; i = (i + 1) & umask_) {
+            unique_slot& s = uslots_[i];
+            // keys of other types can share a hash; the item's destroyer
+            // tells them apart
+            if (s.hash == hash
+                && reinterpret_cast<itemhdr*>(s.key)[-1].destroyer == destroyer) {
+                UniqueKey<T>* k = reinterpret_cast<UniqueKey<T>*>(s.key);
+                if (*k == x)
+                    return k;
+            }
+        }
+    // the key's offset, even if allocate() chains a new chunk
+    size_t pos = buffer_size();
+    UniqueKey<T>* k = allocate<UniqueKey<T> >(x);
+    unique_slot* s = unique_insert_slot(hash);
+    s->key = k;
+    s->pos = pos;
+    return k;
+}
+
 
 template <typename T> struct Packer<T, true> {
     static constexpr bool is_simple = true;
@@ -167,10 +292,7 @@ template <typename T> struct Packer<T, false> {
         return buf.template allocate<T>(std::forward<Args>(args)...);
     }
     static void* pack_unique(TransactionBuffer& buf, const T& x) {
-        if (const void* ptr = buf.template find<UniqueKey<T> >(x))
-            return const_cast<void*>(ptr);
-        else
-            return buf.template allocate<UniqueKey<T> >(x);
+        return buf.intern(x);
     }
     static void* repack(TransactionBuffer&, void* p, const T& x) {
         unpack(p) = x;
@@ -0,0 +1,120 @@
+#pragma once
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// Hardware event counts of the calling thread, read in-process through
+// perf_event_open(2). Only user-mode events are counted, so the default
+// perf_event_paranoid setting (2) allows them without privileges.
+enum hw_event {
+    hw_cycles = 0, hw_instructions, hw_llc_misses, hw_branch_misses, hw_count
+};
+
+struct hw_sample {
+    uint64_t v[hw_count];
+
+    void reset() {
+        memset(v, 0, sizeof(v));
+    }
+    hw_sample& operator+=(const hw_sample& x) {
+        for (int e = 0; e != hw_count; ++e)
+            v[e] += x.v[e];
+        return *this;
+    }
+    hw_sample& operator-=(const hw_sample& x) {
+        for (int e = 0; e != hw_count; ++e)
+            v[e] -= x.v[e];
+        return *this;
+    }
+
+    static const char* name(int e) {
+        static const char* names[] = {"cycles", "instructions", "LLC misses", "branch misses"};
+        return unsigned(e) < hw_count ? names[e] : "?";
+    }
+};
+
+// The events of hw_event as one perf event group, so a single read()
+// returns all of them counted over the same interval. Events the CPU or
+// kernel can't count (common in VMs) are left out and read as 0.
+class hw_counter_group {
+public:
+    hw_counter_group()
+        : leader_(-1), n_(0), events_(0) {
+    }
+    ~hw_counter_group() {
+        close();
+    }
+    hw_counter_group(const hw_counter_group&) = delete;
+    hw_counter_group& operator=(const hw_counter_group&) = delete;
+
+    // Starts counting for the calling thread. Returns false if no event
+    // could be opened.
+    bool open() {
+#if defined(__linux__)
+        static const uint64_t configs[hw_count] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        close();
+        for (int e = 0; e != hw_count; ++e) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[e];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+            if (fd < 0)
+                continue;
+            if (leader_ < 0)
+                leader_ = fd;
+            fds_[n_] = fd;
+            order_[n_] = e;
+            ++n_;
+            events_ |= 1U << e;
+        }
+#endif
+        return n_ != 0;
+    }
+    void close() {
+        for (unsigned i = 0; i != n_; ++i)
+            ::close(fds_[i]);
+        leader_ = -1;
+        n_ = 0;
+        events_ = 0;
+    }
+
+    bool is_open() const {
+        return n_ != 0;
+    }
+    // mask of the events counted, bit e for hw_event e
+    unsigned events() const {
+        return events_;
+    }
+
+    // The counts since open(). Costs one system call.
+    void read(hw_sample& s) const {
+        struct {
+            uint64_t nr;
+            uint64_t values[hw_count];
+        } buf;
+        s.reset();
+        if (n_ && ::read(leader_, &buf, sizeof(buf)) > 0)
+            for (unsigned i = 0; i != n_ && i != buf.nr; ++i)
+                s.v[order_[i]] = buf.values[i];
+    }
+
+private:
+    int leader_;
+    unsigned n_;
+    unsigned events_;
+    int fds_[hw_count];
+    int order_[hw_count];
+};
@@ -1,15 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include "TaggedLow.hh"
 #include "Transaction.hh"
 #include "versioned_value.hh"
 
 
-template <typename T, bool Opacity = false>
+// Arity is the heap's fan-out. Each heap slot keeps a copy of its element's
+// value next to the versioned_value pointer, so sifting compares values
+// without dereferencing anything and visits one run of siblings per level.
+template <typename T, bool Opacity = false, int Arity = 4>
 class PriorityQueue: public TObject {
+    static_assert(Arity >= 2, "PriorityQueue needs at least two children per node");
     typedef TransactionTid::type Version;
     typedef versioned_value_struct<T> versioned_value;
+
+    struct heap_entry {
+        T value;
+        versioned_value* vv;
+    };
     
     static constexpr TransItem::flags_type insert_tag = TransItem::user0_bit;
     static constexpr TransItem::flags_type delete_tag = TransItem::user0_bit<<1;
@@ -34,26 +44,23 @@ public:
 
     // Adds v to the priority queue
     void add(versioned_value* v) {
+        heap_entry e = {v->read_value(), v};
         int child = size_;
-        if (child >= heap_.size()) {
-            heap_.push_back(v);
-        } else {
-            heap_[child] = v;
+        if (child >= (int) heap_.size()) {
+            heap_.push_back(e);
         }
         size_++;
 
         while (child > 0) {
-            int parent = (child - 1) / 2;
-            versioned_value* before = heap_[parent];
-            int old = child;
-            versioned_value* parent_val = heap_[parent];
-            if (heap_[child]->read_value() > parent_val->read_value()) {
-                swap(child, parent);
+            int parent = (child - 1) / Arity;
+            if (heap_[parent].value < e.value) {
+                heap_[child] = heap_[parent];
                 child = parent;
             } else {
-                return;
+                break;
             }
         }
+        heap_[child] = e;
     }
     
     // Removes the maximum element from the heap
@@ -63,49 +70,40 @@ public:
             return NULL;
         }
         if (bottom == 0) {
-            versioned_value* res = heap_[0];
-            return res;
+            return heap_[0].vv;
         }
         
-        versioned_value* res = heap_[0];
+        versioned_value* res = heap_[0].vv;
 
         if (expVal != NULL && res != expVal) {
             unlock(&poplock_);
             Sto::abort();
             return NULL;
         }
-        swap(bottom, 0);
-        
-        int child = 0;
+
+        // sift the bottom entry down from the root
+        heap_entry e = heap_[bottom];
         int parent = 0;
-        while (2*parent < size_ - 1) {
-            int left = parent * 2 + 1;
-            int right = (parent * 2) + 2;
-            if (right >= size_) {
-                if (left >= size_) {
-                    break;
-                }
-                if (heap_[left]->read_value() > heap_[parent]->read_value()) {
-                    swap(parent, left);
-                    parent = left;
-                } else {
-                    break;
+        while (1) {
+            int first = parent * Arity + 1;
+            if (first >= size_) {
+                break;
+            }
+            int last = std::min(first + Arity, size_);
+            int child = first;
+            for (int c = first + 1; c < last; ++c) {
+                if (!(heap_[c].value < heap_[child].value)) {
+                    child = c;
                 }
-
+            }
+            if (e.value < heap_[child].value) {
+                heap_[parent] = heap_[child];
+                parent = child;
             } else {
-                if (heap_[left]->read_value() > heap_[right]->read_value()) {
-                    child = left;
-                } else {
-                    child = right;
-                }
-                if (heap_[child]->read_value() > heap_[parent]->read_value()) {
-                    swap(parent, child);
-                    parent = child;
-                } else {
-                    break;
-                }
+                break;
             }
         }
+        heap_[parent] = e;
         return res;
     }
     
@@ -115,7 +113,7 @@ public:
             return NULL;
         }
         while(1) {
-            versioned_value* val = heap_[0];
+            versioned_value* val = heap_[0].vv;
             auto item = Sto::item(this, val);
             if (is_inserted(val->version())) {
                 if (has_insert(item)) {
@@ -138,7 +136,7 @@ public:
     
     void push_nontrans(T v) {
         lock(&poplock_);
-        versioned_value* val = versioned_value::make(v, TransactionTid::increment_value + insert_bit);
+        versioned_value* val = versioned_value::make(v, TransactionTid::increment_value);
         add(val);
         unlock(&poplock_);
     }
@@ -282,7 +280,7 @@ public:
         else if (item.key<int>() == empty_key) {
             // check that no other transaction  pushed items onto the queue
             for (int i = 0; i < size_; i++) {
-                versioned_value* val = heap_[i];
+                versioned_value* val = heap_[i].vv;
                 if (!is_inserted(val->version())
                     || TransactionTid::is_locked_elsewhere(val->version()))
                     return false;
@@ -302,9 +300,9 @@ public:
             int level = 1; // level that contains the root
             bool found = false;
             for (int i = 0; i < size_; i++) {
-                versioned_value* val = heap_[i];
-                if (val == e || val->read_value() == e->read_value()) found = true; 
-                else if (val->read_value() > e->read_value()) {
+                versioned_value* val = heap_[i].vv;
+                if (val == e || heap_[i].value == e->read_value()) found = true; 
+                else if (heap_[i].value > e->read_value()) {
                     auto it = Sto::check_item(this, val);
                     if (it != NULL && has_insert(*it)) {
                         level = findLevel(i) + 1;
@@ -376,7 +374,8 @@ public:
     // Used for debugging
     void print() {
         for (int i =0; i < size_; i++) {
-            std::cout << heap_[i]->read_value() << "[" << (!is_inserted(heap_[i]->version()) && !is_deleted(heap_[i]->version())) << "] ";
+            Version v = heap_[i].vv->version();
+            std::cout << heap_[i].value << "[" << (!is_inserted(v) && !is_deleted(v)) << "] ";
         }
         std::cout << std::endl;
     }
@@ -440,23 +439,26 @@ private:
         *v = *v | delete_bit;
     }
     
+    // Levels are numbered from 1 (the root).
     static int findLevel(int i) {
-        return ceil(log((double) (i+2)) / log(2.0));
+        int l = 1;
+        while (endOfLevel(l) < i) {
+            ++l;
+        }
+        return l;
     }
     
     static int endOfLevel(int l) {
         assert(l >= 1);
-        return (1 << l) - 2;
+        int end = 0, width = 1;
+        while (--l) {
+            width *= Arity;
+            end += width;
+        }
+        return end;
     }
 
-
-    void swap(int i, int j) {
-        versioned_value* tmp = heap_[i];
-        heap_[i] = heap_[j];
-        heap_[j] = tmp;
-    }
-    
-    std::vector<versioned_value *> heap_;
+    std::vector<heap_entry> heap_;
     Version poplock_;
     Version popversion_;
     int size_;
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <list>
+#include "local_vector.hh"
 #include "TaggedLow.hh"
 #include "Transaction.hh"
 #include "TWrapped.hh"
@@ -13,11 +13,23 @@ public:
 
     Queue() : head_(0), tail_(0), tailversion_(0), headversion_(0) {}
 
+    // queueSlots is inline; see TPages
+    static void* operator new(size_t size) {
+        return TPages::allocate(size);
+    }
+    static void operator delete(void* p) {
+        TPages::free(p);
+    }
+
     static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit;
     static constexpr TransItem::flags_type read_writes = TransItem::user0_bit<<1;
     static constexpr TransItem::flags_type list_bit = TransItem::user0_bit<<2;
     static constexpr TransItem::flags_type empty_bit = TransItem::user0_bit<<3;
 
+    // A transaction's pushes, in order. The write value lives in the
+    // transaction's buffer, so short push lists never touch the heap.
+    typedef local_vector<T, 8> push_list_type;
+
     // NONTRANSACTIONAL PUSH/POP/EMPTY
     void nontrans_push(T v) {
         queueSlots[tail_] = v;
@@ -56,7 +68,7 @@ public:
         if (item.has_write()) {
             if (!is_list(item)) {
                 auto& val = item.template write_value<T>();
-                std::list<T> write_list;
+                push_list_type write_list;
                 if (!is_empty(item)) {
                     write_list.push_back(val);
                     item.clear_flags(empty_bit);
@@ -67,7 +79,7 @@ public:
                 item.add_flags(list_bit);
             }
             else {
-                auto& write_list = item.template write_value<std::list<T>>();
+                auto& write_list = item.template write_value<push_list_type>();
                 write_list.push_back(v);
             }
         }
@@ -91,10 +103,10 @@ public:
                         pushitem.observe(tv);
                     if (pushitem.has_write()) {
                         if (is_list(pushitem)) {
-                            auto& write_list = pushitem.template write_value<std::list<T>>();
+                            auto& write_list = pushitem.template write_value<push_list_type>();
                             // if there is an element to be pushed on the queue, return addr of queue element
                             if (!write_list.empty()) {
-                                write_list.pop_front();
+                                write_list.erase(write_list.begin());
                                 item.add_flags(read_writes);
                                 return true;
                             }
@@ -145,7 +157,7 @@ public:
                         pushitem.observe(tv);
                     if (pushitem.has_write()) {
                         if (is_list(pushitem)) {
-                            auto& write_list= pushitem.template write_value<std::list<T>>();
+                            auto& write_list= pushitem.template write_value<push_list_type>();
                             // if there is an element to be pushed on the queue, return addr of queue element
                             if (!write_list.empty()) {
                                 val = write_list.front();
@@ -234,14 +246,14 @@ private:
             auto head_index = head_;
             // write all the elements
             if (is_list(item)) {
-                auto& write_list = item.template write_value<std::list<T>>();
-                while (!write_list.empty()) {
-                    // assert queue is not out of space            
+                auto& write_list = item.template write_value<push_list_type>();
+                for (auto& v : write_list) {
+                    // assert queue is not out of space
                     assert(tail_ != (head_index-1) % BUF_SIZE);
-                    queueSlots[tail_] = write_list.front();
-                    write_list.pop_front();
+                    queueSlots[tail_] = v;
                     tail_ = (tail_+1) % BUF_SIZE;
                 }
+                write_list.clear();
             }
             else if (!is_empty(item)) {
                 auto& val = item.template write_value<T>();
@@ -91,7 +91,7 @@ public:
         return item.check_version(vers_);
     }
     void install(TransItem& item, const Transaction& txn) {
-        val_.write(item.template write_value<T>());
+        val_.write(std::move(item.template write_value<T>()));
         txn.set_version(vers_);
     }
 
@@ -229,21 +229,11 @@ public:
     }
 */
 
+    // lookups don't take treelock_; find_any validates against the node
+    // versions that inserts and erases lock
   __attribute__((always_inline)) std::tuple<wrapper_type*, Version, bool, boundaries_type> verified_lookup(rbwrapper<rbpair<K, T>>& rbkvp) const {
-        do {
-            auto initial = treelock_;
-	    fence();
-	    if (TransactionTid::is_locked(initial)) {
-                relax_fence();
-                continue;
-            }
-	    auto results = wrapper_tree_.find_any(rbkvp,
-                             rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare()));
-	    fence();
-	    if (initial == treelock_)
-                return results;
-	    relax_fence();
-	} while(1);
+        return wrapper_tree_.find_any(rbkvp,
+                   rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare()));
     }
 
 #ifndef STO_NO_STM
@@ -623,6 +613,8 @@ private:
     // only add a write to size if we erase or do an absent insert
     size_t size_;
     Version sizeversion_;
+    // Serializes structural changes (inserts and erases). Lookups don't
+    // take it; see rbtree::find_any.
     // XXX: this isn't actually a rwlock anymore so we could just make it a
     // normal tid or something
     mutable RWVersion treelock_;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <utility>
 #include <tuple>
 #include <vector>
@@ -188,9 +189,22 @@ class rbtree {
     rbpriv::rbrep<T, Compare> r_;
     // moved from RBTree.hh
     Version treeversion_;
+    // Lookups run concurrently with structural changes and validate
+    // hand-over-hand: a node's hohversion covers its child links, and
+    // rootversion_ covers r_.root_. Writers (serialized by the caller)
+    // lock every hohversion they are about to change and release them
+    // all when the insert or erase is done.
+    Version rootversion_;
+    // limitversion_ covers r_.limit_, which lookups read for boundaries
+    Version limitversion_;
+    std::vector<T*> touched_;
+    bool root_touched_;
 
     template <typename K, typename Comp>
     inline std::tuple<T*, Version, bool, boundaries_type> find_any(const K& key, Comp comp) const;
+    template <typename K, typename Comp>
+    inline bool find_any_once(const K& key, Comp comp,
+                              std::tuple<T*, Version, bool, boundaries_type>& result) const;
 
     template <typename K, typename Comp>
     inline std::tuple<T*, Version, bool, boundaries_type, node_info_type> find_insert(K& key, Comp comp);
@@ -202,6 +216,15 @@ class rbtree {
     T* delete_node(T* victim, T* successor_hint);
     void delete_node_fixup(rbnodeptr<T> p, bool side);
 
+    inline Version unlocked_rootversion() const;
+    inline void stable_limits(T*& lhs, T*& rhs) const;
+    inline void set_limit(int side, T* x);
+    inline void touch(T* n);
+    inline void touch_root();
+    inline void release_touched();
+    inline void set_link(rbnodeptr<T> p, bool side, rbnodeptr<T> x);
+    inline rbnodeptr<T> rotate(rbnodeptr<T> n, bool side);
+
     template<typename K, typename V, bool GlobalSize> friend class RBTree;
 };
 
@@ -352,13 +375,99 @@ inline Compare& rbcompare<Compare>::get_compare() const {
 // RBTREE FUNCTION DEFINITIONS
 template <typename T, typename C>
 inline rbtree<T, C>::rbtree(const value_compare &compare)
-    : r_(compare), treeversion_(Sto::initialized_tid()) {
+    : r_(compare), treeversion_(Sto::initialized_tid()),
+      rootversion_(), limitversion_(), root_touched_(false) {
 }
 
 template <typename T, typename C>
 rbtree<T, C>::~rbtree() {
 }
 
+template <typename T, typename C>
+inline typename rbtree<T, C>::Version rbtree<T, C>::unlocked_rootversion() const {
+    Version v = rootversion_;
+    while (v.is_locked()) {
+        relax_fence();
+        v = rootversion_;
+    }
+    acquire_fence();
+    return v;
+}
+
+// r_.limit_ as of one moment, retrying while a writer changes them
+template <typename T, typename C>
+inline void rbtree<T, C>::stable_limits(T*& lhs, T*& rhs) const {
+    while (1) {
+        Version v = limitversion_;
+        if (v.is_locked()) {
+            relax_fence();
+            continue;
+        }
+        acquire_fence();
+        lhs = r_.limit_[0];
+        rhs = r_.limit_[1];
+        acquire_fence();
+        if (limitversion_ == v)
+            return;
+    }
+}
+
+template <typename T, typename C>
+inline void rbtree<T, C>::set_limit(int side, T* x) {
+    limitversion_.lock();
+    r_.limit_[side] = x;
+    limitversion_.set_version_unlock(Version(limitversion_.value() + TransactionTid::increment_value));
+}
+
+// lock n's hohversion, once per structural change
+template <typename T, typename C>
+inline void rbtree<T, C>::touch(T* n) {
+    if (n && std::find(touched_.begin(), touched_.end(), n) == touched_.end()) {
+        n->lock_hohversion();
+        touched_.push_back(n);
+    }
+}
+
+template <typename T, typename C>
+inline void rbtree<T, C>::touch_root() {
+    if (!root_touched_) {
+        rootversion_.lock();
+        root_touched_ = true;
+    }
+}
+
+template <typename T, typename C>
+inline void rbtree<T, C>::release_touched() {
+    for (T* n : touched_)
+        n->unlock_hohversion();
+    touched_.clear();
+    if (root_touched_) {
+        rootversion_.set_version_unlock(Version(rootversion_.value() + TransactionTid::increment_value));
+        root_touched_ = false;
+    }
+}
+
+// p.set_child(side, x, r_.root_), locking whatever link actually changes
+template <typename T, typename C>
+inline void rbtree<T, C>::set_link(rbnodeptr<T> p, bool side, rbnodeptr<T> x) {
+    if (!p) {
+        if (r_.root_ != x.node())
+            touch_root();
+    } else if (p.child(side).node() != x.node())
+        touch(p.node());
+    p.set_child(side, x, r_.root_);
+}
+
+// n.rotate(side); the caller links the result into n's old parent with
+// set_link. A reader that reaches n or its child through the stale link
+// waits out the change and then fails to validate the parent.
+template <typename T, typename C>
+inline rbnodeptr<T> rbtree<T, C>::rotate(rbnodeptr<T> n, bool side) {
+    touch(n.node());
+    touch(n.child(!side).node());
+    return n.rotate(side);
+}
+
 template <typename T, typename C>
 void rbtree<T, C>::insert_commit(T* x, rbnodeptr<T> p, bool side) {
     // link in new node; it's red
@@ -367,11 +476,16 @@ void rbtree<T, C>::insert_commit(T* x, rbnodeptr<T> p, bool side) {
 
     // maybe set limits
     if (p) {
+        touch(p.node());
         p.child(side) = rbnodeptr<T>(x, true);
         if (p.node() == r_.limit_[side])
-            r_.limit_[side] = x;
-    } else
-        r_.root_ = r_.limit_[0] = r_.limit_[1] = x;
+            set_limit(side, x);
+    } else {
+        touch_root();
+        r_.root_ = x;
+        set_limit(0, x);
+        set_limit(1, x);
+    }
 
     // flip up the tree
     // invariant: we are looking at the `side` of `p`
@@ -383,14 +497,15 @@ void rbtree<T, C>::insert_commit(T* x, rbnodeptr<T> p, bool side) {
         } else {
             bool gpside = gp.find_child(p.node());
             if (gpside != side) {
-                gp.child(gpside) = p.rotate(gpside);
+                set_link(gp, gpside, rotate(p, gpside));
             } 
-            z = gp.rotate(!gpside); 
+            z = rotate(gp, !gpside);
             p = z.black_parent();
         }
         side = p.find_child(gp.node());
-        p.set_child(side, z, r_.root_);
+        set_link(p, side, z);
     }
+    release_touched();
 }
 
 template <typename T, typename C>
@@ -417,6 +532,7 @@ T* rbtree<T, C>::delete_node(T* victim_node, T* succ) {
     bool side = p.find_child(victim_node);
 
     // swap with successor if necessary
+    touch(victim_node);
     if (victim.child(0) && victim.child(1)) {
         if (!succ)
             for (succ = victim.child(true).node();
@@ -425,10 +541,9 @@ T* rbtree<T, C>::delete_node(T* victim_node, T* succ) {
                 /* nada */;
         rbnodeptr<T> succ_p = rbnodeptr<T>(succ->rblinks_.p_, false);
         bool sside = succ == succ_p.child(true).node();
-        if (p)
-            p.child(side) = rbnodeptr<T>(succ, p.child(side).red());
-        else
-            r_.root_ = succ;
+        touch(succ);
+        touch(succ_p.node());
+        set_link(p, side, rbnodeptr<T>(succ, p && p.child(side).red()));
         swap(succ->rblinks_, victim.node()->rblinks_);
         if (sside)
             succ->rblinks_.c_[sside] = victim.change_color(succ->rblinks_.c_[sside].red());
@@ -442,7 +557,7 @@ T* rbtree<T, C>::delete_node(T* victim_node, T* succ) {
     bool active = !victim.child(false);
     rbnodeptr<T> x = victim.child(active);
     bool color = p && p.child(side).red();
-    p.set_child(side, x, r_.root_);
+    set_link(p, side, x);
     if (x)
         x.parent() = p.node();
 
@@ -452,11 +567,12 @@ T* rbtree<T, C>::delete_node(T* victim_node, T* succ) {
             rbnodeptr<T> b = (x ? x : p);
             while (b && b.child(i))
                 b = b.child(i);
-            this->r_.limit_[i] = b.node();
+            set_limit(i, b.node());
         }
 
     if (!color)
         delete_node_fixup(p, side);
+    release_touched();
    
     // return parent node to increment nodeversion
     return p.node();
@@ -479,7 +595,7 @@ void rbtree<T, C>::delete_node_fixup(rbnodeptr<T> p, bool side) {
 
         if (p.child(!side).red()) {
             // invariant: p is black (b/c one of its children is red)
-            gp.set_child(gpside, p.rotate(side), r_.root_);
+            set_link(gp, gpside, rotate(p, side));
             gp = p.black_parent(); // p is now further down the tree
             gpside = side;         // (since we rotated in that direction)
         }
@@ -490,16 +606,16 @@ void rbtree<T, C>::delete_node_fixup(rbnodeptr<T> p, bool side) {
             p = p.change_color(false);
         } else {
             if (!w.child(!side).red()) {
-                p.child(!side) = w.rotate(!side);
+                set_link(p, !side, rotate(w, !side));
             }
             bool gpside = gp.find_child(p.node());
             if (gp)
                 p = gp.child(gpside); // fetch correct color for `p`
-            p = p.rotate(side);
+            p = rotate(p, side);
             p.child(0) = p.child(0).change_color(false);
             p.child(1) = p.child(1).change_color(false);
         }
-        gp.set_child(gpside, p, r_.root_);
+        set_link(gp, gpside, p);
     } else if (p)
         p.child(side) = p.child(side).change_color(false);
 }
@@ -512,16 +628,37 @@ inline T* rbtree<T, C>::root() {
 // Return a pair of node, bool: if bool is true, then the node is the found node, 
 // else if bool is false the node is the parent of the absent read. If (null, false), we have
 // an empty tree
+// Safe against concurrent structural changes: retries until a traversal
+// validates.
 template <typename T, typename C> template <typename K, typename Comp>
 inline std::tuple<T*, typename rbtree<T, C>::Version, bool,
        typename rbtree<T, C>::boundaries_type>
 rbtree<T, C>::find_any(const K& key, Comp comp) const {
+    std::tuple<T*, Version, bool, boundaries_type> result;
+    while (!find_any_once(key, comp, result))
+        relax_fence();
+    return result;
+}
 
+// One hand-over-hand traversal: a child's hohversion is read before the
+// parent's is revalidated, so each link followed was current at some
+// point. Returns false if a link changed underneath.
+template <typename T, typename C> template <typename K, typename Comp>
+inline bool rbtree<T, C>::find_any_once(const K& key, Comp comp,
+                                        std::tuple<T*, Version, bool, boundaries_type>& result) const {
+    Version rootv = unlocked_rootversion();
     rbnodeptr<T> n(r_.root_, false);
     rbnodeptr<T> p(nullptr, false);
+    Version nv, pv;
+    if (n.node()) {
+        nv = n.node()->unlocked_hohversion();
+        acquire_fence();
+    }
+    if (rootversion_ != rootv)
+        return false;
 
-    T* lhs = r_.limit_[0];
-    T* rhs = r_.limit_[1];
+    T* lhs, *rhs;
+    stable_limits(lhs, rhs);
     boundaries_type boundary = std::make_pair(std::make_tuple(lhs, lhs ? lhs->nodeversion() : 0),
                     std::make_tuple(rhs, rhs ? rhs->nodeversion() : 0));
 
@@ -540,14 +677,27 @@ rbtree<T, C>::find_any(const K& key, Comp comp) const {
             boundary.second = std::make_tuple(nb, nb->nodeversion());
         }
         p = n;
+        pv = nv;
         n = n.node()->rblinks_.c_[cmp > 0];
+        if (n.node()) {
+            nv = n.node()->unlocked_hohversion();
+            acquire_fence();
+        }
+        if (!p.node()->validate_hohversion(pv))
+            return false;
     }
 
     bool found = (n.node() != nullptr);
     T* retnode = found ? n.node() : p.node();
     Version retver = retnode ? retnode->version() : treeversion_;
+    if (!retnode) {
+        acquire_fence();
+        if (rootversion_ != rootv)
+            return false;
+    }
 
-    return std::make_tuple(retnode, retver, found, boundary);
+    result = std::make_tuple(retnode, retver, found, boundary);
+    return true;
 }
 
 template <typename T, typename C> template <typename K, typename Comp>
@@ -576,7 +726,8 @@ template <typename T, typename C> template <typename K, typename Comp>
 inline std::tuple<T*, typename rbtree<T, C>::Version, bool,
        typename rbtree<T, C>::boundaries_type, typename rbtree<T, C>::node_info_type>
 rbtree<T, C>::find_insert(K& key, Comp comp) {
-    // lookup part, almost identical to find_any()
+    // lookup part, almost identical to find_any(); the caller holds
+    // treelock_, so the limits can't change
     rbnodeptr<T> n(r_.root_, false);
     rbnodeptr<T> p(nullptr, false);
 
@@ -0,0 +1,560 @@
+#pragma once
+#include "compiler.hh"
+#include "Transaction.hh"
+#include "List.hh"
+#include <stdlib.h>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+template <typename T, bool Duplicates, typename Compare, bool Opacity> class SkipListIterator;
+
+// A sorted transactional set built as a skip list: a replacement for the
+// sorted List when it is too long to walk. Lookups take O(log n) steps and
+// never lock.
+//
+// Every node has two versions. The node version covers the element itself
+// (its validity and, for updates, its value), like List's node versions.
+// The link version is bumped whenever the node's level-0 successor
+// changes, so a transaction that finds no element between two nodes
+// observes the link version of the first, and conflicts only with inserts
+// into that gap rather than with every insert in the list. Structural
+// changes (linking a new node, unlinking a deleted one) are serialized on
+// a list-wide spinlock; they are short, since each touches O(log n) links.
+//
+// Opacity picks TVersion or TNonopaqueVersion for node versions.
+template <typename T, bool Duplicates = false, typename Compare = DefaultCompare<T>, bool Opacity = true>
+class SkipList : public TObject {
+public:
+    typedef SkipListIterator<T, Duplicates, Compare, Opacity> iterator;
+    typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type version_type;
+
+    static constexpr unsigned max_height = 16;
+    // in a node version: the element isn't (yet, or any longer) in the set
+    static constexpr TransactionTid::type invalid_bit = TransactionTid::user_bit;
+    // in a link version: the node has been unlinked
+    static constexpr TransactionTid::type dead_bit = TransactionTid::user_bit;
+
+    static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+    static constexpr TransItem::flags_type doupdate_bit = TransItem::user0_bit<<2;
+
+    struct node {
+        version_type vers;
+        TNonopaqueVersion linkvers;
+        unsigned height;
+        // the head node leaves this unconstructed
+        alignas(T) char valbuf[sizeof(T)];
+        node* next[1];
+
+        node(unsigned h, bool invalid)
+            : vers(Sto::initialized_tid() | (invalid ? invalid_bit : 0)), height(h) {
+            for (unsigned i = 0; i != h; ++i)
+                next[i] = nullptr;
+        }
+        T& val() {
+            return *reinterpret_cast<T*>(valbuf);
+        }
+        bool is_valid() const {
+            return !(vers.value() & invalid_bit);
+        }
+    };
+
+    SkipList(Compare comp = Compare())
+        : head_(make_node(nullptr, max_height, false)), listsize_(0), listlock_(0), comp_(comp) {
+    }
+    ~SkipList() {
+        node* n = head_->next[0];
+        while (n) {
+            node* next = n->next[0];
+            free_node(n);
+            n = next;
+        }
+        head_->~node();
+        free(head_);
+    }
+
+    // nontransactional interface; not safe against concurrent writers
+    bool find(const T& elem, T& val) {
+        node* pred;
+        TNonopaqueVersion predv;
+        node* n = search(elem, pred, predv);
+        if (n && comp_(n->val(), elem) == 0) {
+            val = n->val();
+            return true;
+        }
+        return false;
+    }
+    bool insert(const T& elem) {
+        bool inserted;
+        _insert<false>(elem, inserted);
+        return inserted;
+    }
+    size_t nontrans_size() const {
+        return listsize_;
+    }
+
+    // transactional interface
+    T* transFind(const T& elem) {
+        node* pred;
+        TNonopaqueVersion predv;
+        for (node* n = search(elem, pred, predv); n && comp_(n->val(), elem) == 0; n = n->next[0]) {
+            version_type version = n->vers;
+            fence();
+            auto item = t_item(n);
+            if (!validityCheck(n, item))
+                Sto::abort();
+            if (has_delete(item))
+                continue;
+            if (has_doupdate(item))
+                return &item.template write_value<T>();
+            if (!has_insert(item))
+                item.observe(version);
+            return &n->val();
+        }
+        observe_link(pred, predv);
+        return nullptr;
+    }
+
+    bool transInsert(const T& elem) {
+        bool inserted;
+        node* n = _insert<true>(elem, inserted);
+        auto item = t_item(n);
+        if (!inserted) {
+            version_type version = n->vers;
+            fence();
+            if (!validityCheck(n, item))
+                Sto::abort();
+            // insert-then-insert, or delete-then-insert then insert
+            if (has_insert(item) || has_doupdate(item))
+                return false;
+            // delete-then-insert: the delete already observed the version
+            if (has_delete(item)) {
+                item.clear_write().add_write(elem);
+                item.assign_flags(doupdate_bit);
+                add_trans_size_offs(1);
+                return true;
+            }
+            // failed insert: make sure it's still there at commit time
+            item.observe(version);
+            return false;
+        }
+        item.add_write(0);
+        item.add_flags(insert_bit);
+        add_trans_size_offs(1);
+        return true;
+    }
+
+    bool transDelete(const T& elem) {
+        node* pred;
+        TNonopaqueVersion predv;
+        for (node* n = search(elem, pred, predv); n && comp_(n->val(), elem) == 0; n = n->next[0]) {
+            version_type version = n->vers;
+            fence();
+            auto item = t_item(n);
+            if (!validityCheck(n, item))
+                Sto::abort();
+            if (has_delete(item))
+                continue;
+            erase_node(n, item, version);
+            return true;
+        }
+        observe_link(pred, predv);
+        return false;
+    }
+
+    // Deletes the element at it, which must not be end().
+    void transErase(const iterator& it) {
+        node* n = it.cur_;
+        version_type version = n->vers;
+        fence();
+        auto item = t_item(n);
+        if (!validityCheck(n, item) || has_delete(item))
+            Sto::abort();
+        erase_node(n, item, version);
+    }
+
+    size_t size() {
+        TNonopaqueVersion v = stable_version(sizeversion_);
+        size_t n = listsize_;
+        fence();
+        if (sizeversion_ != v)
+            Sto::abort();
+        Sto::item(this, size_key).observe(v);
+        return n + trans_size_offs();
+    }
+
+    iterator begin() {
+        return iterator(this, head_, false);
+    }
+    // Iterates without observing the gaps it passes or the elements it
+    // skips, and steps over other transactions' uncommitted inserts rather
+    // than aborting: the elements it returns may not be the first ones
+    // visible at commit time. For callers that only want some element near
+    // the front, like relaxed priority queues.
+    iterator relaxed_begin() {
+        return iterator(this, head_, true);
+    }
+    iterator end() {
+        return iterator();
+    }
+
+    // TObject interface
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, item.key<node*>()->vers);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        uintptr_t k = item.key<uintptr_t>();
+        if (k == size_key)
+            return item.check_version(sizeversion_);
+        if (k & link_bit)
+            return item.check_version(reinterpret_cast<node*>(k - link_bit)->linkvers);
+        node* n = item.key<node*>();
+        if (!n->is_valid())
+            return has_insert(item);
+        return item.check_version(n->vers);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        node* n = item.key<node*>();
+        if (has_delete(item)) {
+            txn.set_version(n->vers, invalid_bit);
+            remove<true>(n);
+            change_size(-1);
+        } else if (has_doupdate(item)) {
+            n->val() = item.template write_value<T>();
+            txn.set_version(n->vers);
+        } else {
+            // clears the invalid bit too
+            txn.set_version(n->vers);
+            change_size(1);
+        }
+    }
+    void unlock(TransItem& item) override {
+        item.key<node*>()->vers.unlock();
+    }
+    void cleanup(TransItem& item, bool committed) override {
+        if (!committed && has_insert(item))
+            remove<true>(item.key<node*>());
+    }
+
+private:
+    static constexpr uintptr_t link_bit = 1;
+    static constexpr uintptr_t size_key = 2;
+    static constexpr uintptr_t size_offs_key = 4;
+
+    node* head_;
+    size_t listsize_;
+    TNonopaqueVersion sizeversion_;
+    TransactionTid::type listlock_;
+    Compare comp_;
+
+    static node* make_node(const T* val, unsigned height, bool invalid) {
+        void* p = malloc(sizeof(node) + (height - 1) * sizeof(node*));
+        always_assert(p);
+        node* n = new(p) node(height, invalid);
+        if (val)
+            new(n->valbuf) T(*val);
+        return n;
+    }
+    static void free_node(node* n) {
+        n->val().~T();
+        n->~node();
+        free(n);
+    }
+    static void free_node_callback(void* p) {
+        free_node(static_cast<node*>(p));
+    }
+    // P(height > h) = 4^-h
+    static unsigned random_height() {
+        static __thread uint32_t seed;
+        if (!seed)
+            seed = 2654435761U * (TThread::id() + 1);
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        unsigned h = 1;
+        for (uint32_t r = seed; !(r & 3) && h != max_height; r >>= 2)
+            ++h;
+        return h;
+    }
+
+    static TNonopaqueVersion stable_version(const TNonopaqueVersion& v) {
+        TNonopaqueVersion x = v;
+        while (x.is_locked()) {
+            relax_fence();
+            x = v;
+        }
+        acquire_fence();
+        return x;
+    }
+    static uintptr_t link_key(node* n) {
+        return reinterpret_cast<uintptr_t>(n) + link_bit;
+    }
+
+    // Lock-free search: returns the first node not less than elem, and
+    // sets pred to its level-0 predecessor and predv to a version of
+    // pred's links at which that was true.
+    node* search(const T& elem, node*& pred, TNonopaqueVersion& predv) {
+    retry:
+        node* p = head_;
+        for (unsigned level = max_height - 1; level != 0; --level) {
+            node* c = p->next[level];
+            while (c && comp_(c->val(), elem) < 0) {
+                p = c;
+                c = c->next[level];
+            }
+        }
+        while (1) {
+            TNonopaqueVersion v = stable_version(p->linkvers);
+            if (v.value() & dead_bit)
+                goto retry;
+            node* c = p->next[0];
+            if (c && comp_(c->val(), elem) < 0) {
+                p = c;
+                continue;
+            }
+            fence();
+            if (p->linkvers == v) {
+                pred = p;
+                predv = v;
+                return c;
+            }
+        }
+    }
+
+    // with listlock_ held: preds[i] is the last node at level i before
+    // every node not less than elem
+    void find_preds(const T& elem, node** preds) {
+        node* p = head_;
+        for (int level = max_height - 1; level >= 0; --level) {
+            node* c = p->next[level];
+            while (c && comp_(c->val(), elem) < 0) {
+                p = c;
+                c = c->next[level];
+            }
+            preds[level] = p;
+        }
+    }
+
+    template <bool Txnal>
+    node* _insert(const T& elem, bool& inserted) {
+        node* preds[max_height];
+        TransactionTid::lock(listlock_);
+        find_preds(elem, preds);
+        node* pred = preds[0];
+        TNonopaqueVersion predv = pred->linkvers;
+        node* n = pred->next[0];
+        if (!Duplicates && n && comp_(n->val(), elem) == 0) {
+            TransactionTid::unlock(listlock_);
+            inserted = false;
+            return n;
+        }
+        n = make_node(&elem, random_height(), Txnal);
+        for (unsigned i = 0; i != n->height; ++i)
+            n->next[i] = preds[i]->next[i];
+        release_fence();
+        pred->linkvers.lock();
+        pred->next[0] = n;
+        pred->linkvers.inc_nonopaque_version();
+        pred->linkvers.unlock();
+        for (unsigned i = 1; i != n->height; ++i)
+            preds[i]->next[i] = n;
+        if (Txnal)
+            update_link_read(pred, predv);
+        else
+            ++listsize_;
+        TransactionTid::unlock(listlock_);
+        inserted = true;
+        return n;
+    }
+
+    // executing: n is our own insert, removed before commit
+    template <bool Txnal>
+    void remove(node* n, bool executing = false) {
+        node* preds[max_height];
+        TransactionTid::lock(listlock_);
+        find_preds(n->val(), preds);
+        // with duplicates, n may follow other equal nodes
+        for (unsigned i = 0; i != n->height; ++i)
+            while (preds[i]->next[i] != n)
+                preds[i] = preds[i]->next[i];
+        for (unsigned i = n->height - 1; i != 0; --i)
+            preds[i]->next[i] = n->next[i];
+        TNonopaqueVersion predv = preds[0]->linkvers;
+        preds[0]->linkvers.lock();
+        n->linkvers.lock();
+        preds[0]->next[0] = n->next[0];
+        preds[0]->linkvers.inc_nonopaque_version();
+        n->linkvers.inc_nonopaque_version();
+        n->linkvers = n->linkvers | TNonopaqueVersion(dead_bit);
+        n->linkvers.unlock();
+        preds[0]->linkvers.unlock();
+        if (executing) {
+            // the gap after n is now part of the gap after preds[0]
+            update_link_read(preds[0], predv);
+            if (auto link_item = Sto::check_item(this, link_key(n)))
+                link_item->remove_read();
+            observe_link(preds[0], preds[0]->linkvers);
+        }
+        TransactionTid::unlock(listlock_);
+        if (Txnal)
+            Transaction::rcu_call(free_node_callback, n);
+        else
+            free_node(n);
+    }
+
+    void change_size(int delta) {
+        sizeversion_.lock();
+        listsize_ += delta;
+        sizeversion_.inc_nonopaque_version();
+        sizeversion_.unlock();
+    }
+
+    // deletes visible element n, whose node version was version
+    void erase_node(node* n, TransProxy& item, version_type version) {
+        add_trans_size_offs(-1);
+        // delete-then-insert, then delete
+        if (has_doupdate(item))
+            item.assign_flags(delete_bit);
+        // insert-then-delete becomes an absent get
+        else if (has_insert(item)) {
+            remove<true>(n, true);
+            item.remove_read().remove_write().clear_flags(insert_bit);
+        } else {
+            item.assign_flags(delete_bit);
+            item.add_write(0);
+            item.observe(version);
+        }
+    }
+
+    // our own structural change moved pred's link version on from predv;
+    // that shouldn't abort us if we had read the gap
+    void update_link_read(node* pred, TNonopaqueVersion predv) {
+        if (auto link_item = Sto::check_item(this, link_key(pred)))
+            link_item->update_read(predv, pred->linkvers);
+    }
+
+    TransProxy t_item(node* n) {
+        return Sto::item(this, n);
+    }
+    void observe_link(node* n, TNonopaqueVersion v) {
+        Sto::item(this, link_key(n)).observe(v);
+    }
+
+    static bool has_insert(const TransItem& item) {
+        return item.flags() & insert_bit;
+    }
+    static bool has_delete(const TransItem& item) {
+        return item.flags() & delete_bit;
+    }
+    static bool has_doupdate(const TransItem& item) {
+        return item.flags() & doupdate_bit;
+    }
+    static bool validityCheck(node* n, TransItem& item) {
+        return n->is_valid() || has_insert(item);
+    }
+
+    void add_trans_size_offs(int size_offs) {
+        auto item = Sto::item(this, size_offs_key);
+        item.template set_stash<int>(item.template stash_value<int>(0) + size_offs);
+    }
+    int trans_size_offs() {
+        return Sto::item(this, size_offs_key).template stash_value<int>(0);
+    }
+
+    friend class SkipListIterator<T, Duplicates, Compare, Opacity>;
+};
+
+// Forward iterator over the elements visible to the current transaction.
+// It observes every node it returns and the link version of every node it
+// steps from, so elements inserted into or removed from the range it has
+// covered cause the transaction to abort.
+template <typename T, bool Duplicates, typename Compare, bool Opacity>
+class SkipListIterator : public std::iterator<std::forward_iterator_tag, T> {
+    typedef SkipList<T, Duplicates, Compare, Opacity> list_type;
+    typedef typename list_type::node node;
+public:
+    SkipListIterator()
+        : list_(nullptr), cur_(nullptr), relaxed_(false) {
+    }
+    SkipListIterator(list_type* list, node* head, bool relaxed)
+        : list_(list), cur_(head), relaxed_(relaxed) {
+        advance();
+    }
+
+    bool operator==(const SkipListIterator& x) const {
+        return cur_ == x.cur_;
+    }
+    bool operator!=(const SkipListIterator& x) const {
+        return cur_ != x.cur_;
+    }
+    const T& operator*() const {
+        auto item = Sto::check_item(list_, cur_);
+        if (item && list_type::has_doupdate(*item))
+            return item->template write_value<T>();
+        return cur_->val();
+    }
+    const T* operator->() const {
+        return &**this;
+    }
+    SkipListIterator& operator++() {
+        advance();
+        return *this;
+    }
+    SkipListIterator operator++(int) {
+        SkipListIterator it = *this;
+        advance();
+        return it;
+    }
+
+private:
+    list_type* list_;
+    node* cur_;
+    bool relaxed_;
+
+    friend class SkipList<T, Duplicates, Compare, Opacity>;
+
+    // moves from cur_ to the next visible element, or the end
+    void advance() {
+        if (relaxed_)
+            return advance_relaxed();
+        node* pred = cur_;
+        while (1) {
+            TNonopaqueVersion v = list_type::stable_version(pred->linkvers);
+            node* n = pred->next[0];
+            fence();
+            if (pred->linkvers != v)
+                continue;
+            if (v.value() & list_type::dead_bit)
+                Sto::abort();
+            list_->observe_link(pred, v);
+            if (!n) {
+                cur_ = nullptr;
+                return;
+            }
+            typename list_type::version_type version = n->vers;
+            fence();
+            auto item = list_->t_item(n);
+            if (!list_type::validityCheck(n, item))
+                Sto::abort();
+            if (list_type::has_delete(item)) {
+                pred = n;
+                continue;
+            }
+            if (!list_type::has_insert(item))
+                item.observe(version);
+            cur_ = n;
+            return;
+        }
+    }
+    void advance_relaxed() {
+        node* n = cur_->next[0];
+        for (; n; n = n->next[0]) {
+            auto item = Sto::check_item(list_, n);
+            if ((n->is_valid() || (item && list_type::has_insert(*item)))
+                && !(item && list_type::has_delete(*item)))
+                break;
+        }
+        cur_ = n;
+    }
+};
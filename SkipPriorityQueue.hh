@@ -0,0 +1,92 @@
+#pragma once
+#include "SkipList.hh"
+#include <iostream>
+
+// A transactional max-priority queue kept in a SkipList, with the same
+// push/pop/top interface as PriorityQueue. There is no queue-wide lock:
+// pushes only conflict with transactions that read the gap they land in,
+// and a pop conflicts with pushes of larger elements and with other pops
+// of the same element.
+//
+// Strict pops always take the largest element visible to the transaction,
+// so concurrent pops all contend for the front. With Relaxed, pop takes one
+// of roughly the first `spread` elements, chosen at random, without
+// observing the ones before it: pops spread out and rarely conflict, but a
+// pop may return an element smaller than the current maximum, and an
+// element pushed before the pop commits may be larger than the one it
+// returned. Empty pops and top() are strict either way.
+template <typename T, bool Relaxed = false>
+class SkipPriorityQueue {
+    struct greater {
+        int operator()(const T& a, const T& b) const {
+            if (b < a)
+                return -1;
+            return a < b ? 1 : 0;
+        }
+    };
+    typedef SkipList<T, true, greater> list_type;
+
+public:
+    SkipPriorityQueue(unsigned spread = 16)
+        : spread_(spread) {
+    }
+
+    void push(T v) {
+        q_.transInsert(v);
+    }
+    void push_nontrans(T v) {
+        q_.insert(v);
+    }
+
+    // Removes and returns the largest element, or returns -1 if the queue
+    // is empty.
+    T pop() {
+        auto it = q_.end();
+        if (Relaxed) {
+            it = q_.relaxed_begin();
+            for (unsigned skip = random_skip(); skip && it != q_.end(); --skip) {
+                auto next = it;
+                if (++next == q_.end())
+                    break;
+                it = next;
+            }
+        }
+        if (it == q_.end())
+            it = q_.begin();
+        if (it == q_.end())
+            return -1;
+        T v = *it;
+        q_.transErase(it);
+        return v;
+    }
+
+    // Returns the largest element, or -1 if the queue is empty.
+    T top() {
+        auto it = q_.begin();
+        return it == q_.end() ? T(-1) : *it;
+    }
+
+    int unsafe_size() {
+        return q_.nontrans_size();
+    }
+
+    void print() {
+        for (auto it = q_.begin(); it != q_.end(); ++it)
+            std::cout << *it << " ";
+        std::cout << std::endl;
+    }
+
+private:
+    list_type q_;
+    unsigned spread_;
+
+    unsigned random_skip() {
+        static __thread uint32_t seed;
+        if (!seed)
+            seed = 2246822519U * (TThread::id() + 1);
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed % spread_;
+    }
+};
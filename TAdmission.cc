@@ -0,0 +1,109 @@
+#include "TAdmission.hh"
+#include "Transaction.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+std::mutex TAdmission::all_mu_;
+std::vector<TAdmission*> TAdmission::all_;
+
+TAdmission::TAdmission(double low_ratio, double high_ratio, unsigned min_limit)
+    : limit_(0), active_(0), waiters_(0),
+      low_ratio_(low_ratio), high_ratio_(std::max(high_ratio, low_ratio)),
+      min_limit_(std::max(min_limit, 1U)), nstats_(Transaction::max_threads()),
+      stats_(allocate_stats(nstats_)), seen_(nstats_) {
+    std::lock_guard<std::mutex> guard(all_mu_);
+    all_.push_back(this);
+}
+
+TAdmission::~TAdmission() {
+    {
+        std::lock_guard<std::mutex> guard(all_mu_);
+        all_.erase(std::find(all_.begin(), all_.end(), this));
+    }
+    free(stats_);
+}
+
+// each thread's stat gets its own cache lines, an alignment plain new
+// doesn't honor before C++17
+TAdmission::stat* TAdmission::allocate_stats(unsigned n) {
+    void* p;
+    always_assert(posix_memalign(&p, alignof(stat), n * sizeof(stat)) == 0);
+    memset(p, 0, n * sizeof(stat));
+    return static_cast<stat*>(p);
+}
+
+bool TAdmission::enter_slow(unsigned tid) {
+    while (1) {
+        unsigned limit = limit_;
+        if (!limit)
+            return false;
+        int a = active_;
+        if (a < int(limit)) {
+            if (bool_cmpxchg(&active_, a, a + 1))
+                return true;
+            relax_fence();
+            continue;
+        }
+        ++stats_[tid].waits;
+        TXP_INCREMENT(txp_admission_waits);
+        std::unique_lock<std::mutex> guard(mu_);
+        ++waiters_;
+        // the timeout covers a slot freed between the check and the wait
+        if (limit_ && active_ >= int(limit_))
+            cv_.wait_for(guard, std::chrono::microseconds(park_us));
+        --waiters_;
+    }
+}
+
+void TAdmission::wake(bool all) {
+    std::lock_guard<std::mutex> guard(mu_);
+    if (all)
+        cv_.notify_all();
+    else
+        cv_.notify_one();
+}
+
+void TAdmission::adjust() {
+    uint64_t attempts = 0, aborts = 0;
+    unsigned nthreads = 0;
+    for (unsigned i = 0; i != nstats_; ++i) {
+        uint64_t a = stats_[i].attempts - seen_[i].attempts;
+        attempts += a;
+        aborts += stats_[i].aborts - seen_[i].aborts;
+        // parked threads count as users too
+        nthreads += a || stats_[i].waits != seen_[i].waits;
+    }
+    if (attempts < sample_min)
+        return;
+    for (unsigned i = 0; i != nstats_; ++i)
+        seen_[i] = seen_stat{stats_[i].attempts, stats_[i].aborts, stats_[i].waits};
+
+    double ratio = double(aborts) / attempts;
+    unsigned limit = limit_;
+    unsigned cur = limit ? limit : nthreads;
+    unsigned next = limit;
+    if (ratio > high_ratio_)
+        next = std::max(min_limit_, cur - std::max(cur / 4, 1U));
+    else if (ratio < low_ratio_ && limit)
+        next = cur + 1 >= nthreads ? 0 : cur + 1;
+    if (next == limit)
+        return;
+    limit_ = next;
+    if (!next || next > limit)
+        wake(true);
+}
+
+void TAdmission::adjust_all() {
+    std::lock_guard<std::mutex> guard(all_mu_);
+    for (TAdmission* a : all_)
+        a->adjust();
+}
+
+uint64_t TAdmission::waits() const {
+    uint64_t n = 0;
+    for (unsigned i = 0; i != nstats_; ++i)
+        n += stats_[i].waits;
+    return n;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Admission control for TRANSACTION loops. Under heavy contention aborts
+// cascade: past some point each added thread causes more aborts than
+// commits, and throughput falls below what fewer threads reach. A
+// TAdmission caps the number of transaction attempts running at once and
+// adapts the cap to the abort ratio of the attempts it admits. While more
+// than high_ratio of them abort, the cap shrinks by a quarter; while
+// fewer than low_ratio abort, it grows by one, and the gate opens again
+// once the cap reaches the number of threads using it. Threads over the
+// cap park until a slot frees up, so throughput levels off near its peak
+// instead of falling.
+//
+// Transaction::admission gates every TRANSACTION loop, and
+// TransactionLimits::admit gates particular loops, e.g. those that touch
+// a hot object. Each attempt takes its own slot, so a retry competes with
+// the other threads again. Snapshot transactions, which never abort, are
+// not gated. The epoch advancer adjusts every gate once per epoch.
+//
+// An open gate costs one load and two thread-local counter updates per
+// attempt. It starts counting slots only when it closes, so for a moment
+// after closing, attempts already running can exceed the cap.
+class TAdmission {
+public:
+    explicit TAdmission(double low_ratio = 0.1, double high_ratio = 0.3,
+                        unsigned min_limit = 1);
+    ~TAdmission();
+    TAdmission(const TAdmission&) = delete;
+    TAdmission& operator=(const TAdmission&) = delete;
+
+    // Start an attempt on thread tid, parking while the gate is full.
+    // Returns true iff the attempt took a slot.
+    bool enter(unsigned tid) {
+        if (!limit_)
+            return false;
+        return enter_slow(tid);
+    }
+    // End an attempt. admitted is enter's return value.
+    void leave(unsigned tid, bool admitted, bool committed) {
+        stat& st = stats_[tid];
+        ++st.attempts;
+        st.aborts += !committed;
+        if (admitted) {
+            fetch_and_add(&active_, -1);
+            if (waiters_)
+                wake(false);
+        }
+    }
+
+    // Recompute the cap from the attempts that ended since the last
+    // adjustment, once there are enough of them.
+    void adjust();
+    // adjust every gate; called by the epoch advancer
+    static void adjust_all();
+
+    // the current cap, or 0 while the gate is open
+    unsigned limit() const {
+        return limit_;
+    }
+    // total times a thread parked
+    uint64_t waits() const;
+
+    // adjust() waits for at least this many attempts
+    static constexpr unsigned sample_min = 32;
+    // longest a parked thread sleeps before looking again
+    static constexpr unsigned park_us = 1000;
+
+private:
+    struct __attribute__((aligned(128))) stat {
+        uint64_t attempts;
+        uint64_t aborts;
+        uint64_t waits;
+    };
+    struct seen_stat {
+        uint64_t attempts;
+        uint64_t aborts;
+        uint64_t waits;
+    };
+
+    volatile unsigned limit_;
+    int active_;
+    volatile unsigned waiters_;
+    double low_ratio_;
+    double high_ratio_;
+    unsigned min_limit_;
+    unsigned nstats_;
+    stat* stats_;
+    std::vector<seen_stat> seen_; // adjust()'s view of stats_
+    std::mutex mu_;
+    std::condition_variable cv_;
+
+    static std::mutex all_mu_;
+    static std::vector<TAdmission*> all_;
+
+    static stat* allocate_stats(unsigned n);
+    bool enter_slow(unsigned tid);
+    void wake(bool all);
+};
@@ -0,0 +1,241 @@
+#pragma once
+#include <vector>
+#include <stdexcept>
+#include "TWrapped.hh"
+#include "TArrayProxy.hh"
+#include "TIntRange.hh"
+
+// An append-only transactional vector for many concurrent appenders.
+//
+// Unlike TVector, push_back takes no size lock: a transaction's appends
+// are kept in a per-thread buffer and, once it cannot abort, claim their
+// slots with one atomic add to the size. So appenders don't conflict with
+// each other, and an appending transaction doesn't learn where its
+// elements went.
+//
+// Storage is a list of segments of Segment, 2*Segment, 4*Segment, ...
+// elements, allocated on demand; elements never move. Since the size only
+// grows, reading an element in range depends only on that element. Only
+// size() and out-of-range accesses register a size predicate.
+template <typename T, unsigned Segment = 64, template <typename> class W = TOpaqueWrapped>
+class TAppendVector : public TObject {
+public:
+    typedef T value_type;
+    typedef typename W<T>::read_type get_type;
+    typedef typename W<T>::version_type version_type;
+    typedef int size_type;
+    typedef TIntRangeProxy<size_type> size_proxy;
+    typedef TConstArrayProxy<TAppendVector<T, Segment, W> > const_proxy_type;
+    typedef TArrayProxy<TAppendVector<T, Segment, W> > proxy_type;
+
+    TAppendVector()
+        : size_(0) {
+        for (auto& s : segs_)
+            s = nullptr;
+    }
+    ~TAppendVector() {
+        using WT = W<T>;
+        for (size_type i = 0; i != size_; ++i)
+            slot(i).v.~WT();
+        for (unsigned k = 0; k != nsegments; ++k)
+            delete[] reinterpret_cast<char*>(segs_[k]);
+    }
+
+    // The size, including this transaction's appends.
+    size_proxy size() const {
+        auto sitem = size_item();
+        return size_proxy(&size_predicate(sitem), acquire_size(), npushes());
+    }
+
+    const_proxy_type operator[](size_type i) const {
+        return const_proxy_type(this, i);
+    }
+    proxy_type operator[](size_type i) {
+        return proxy_type(this, i);
+    }
+
+    void push_back(T x) {
+        auto item = Sto::item(this, append_key);
+        unsigned n = item.has_write() ? item.template write_value<unsigned>() : 0;
+        // drop leftovers from earlier transactions
+        auto& buf = pending_[TThread::id()].v;
+        buf.resize(n);
+        buf.push_back(std::move(x));
+        item.add_write(n + 1);
+    }
+
+    // Elements this transaction appended can't be indexed until it commits.
+    get_type transGet(size_type i) const {
+        auto item = Sto::item(this, i);
+        if (item.has_write())
+            return item.template write_value<T>();
+        if (!in_range(i))
+            version_type::opaque_throw(std::out_of_range("TAppendVector::transGet"));
+        elem& e = wait_slot(i);
+        return e.v.read(item, e.vers);
+    }
+    void transPut(size_type i, T x) {
+        if (!in_range(i))
+            version_type::opaque_throw(std::out_of_range("TAppendVector::transPut"));
+        Sto::item(this, i).add_write(std::move(x));
+    }
+
+    size_type nontrans_size() const {
+        return size_;
+    }
+    get_type nontrans_get(size_type i) const {
+        assert(i < size_);
+        return slot(i).v.access();
+    }
+    void nontrans_put(size_type i, const T& x) {
+        assert(i < size_);
+        slot(i).v.access() = x;
+    }
+    void nontrans_push_back(T x) {
+        elem& e = ensure_slot(size_);
+        new(reinterpret_cast<void*>(&e.v)) W<T>(std::move(x));
+        e.vers = version_type();
+        release_fence();
+        ++size_;
+    }
+
+    // transactional methods
+    bool check_predicate(TransItem& item, Transaction&, bool) override {
+        acquire_fence();
+        return item.template predicate_value<pred_type>().verify(size_);
+    }
+    bool lock(TransItem& item, Transaction& txn) override {
+        auto key = item.template key<key_type>();
+        // appends lock nothing
+        return key == append_key || txn.try_lock(item, slot(key).vers);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(slot(item.template key<key_type>()).vers);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        auto key = item.template key<key_type>();
+        if (key != append_key) {
+            elem& e = slot(key);
+            e.v.write(std::move(item.template write_value<T>()));
+            txn.set_version_unlock(e.vers, item);
+            return;
+        }
+        unsigned n = item.template write_value<unsigned>();
+        auto& buf = pending_[TThread::id()].v;
+        size_type base = fetch_and_add(&size_, int(n));
+        for (unsigned j = 0; j != n; ++j) {
+            elem& e = ensure_slot(base + j);
+            e.vers.lock();
+            new(reinterpret_cast<void*>(&e.v)) W<T>(std::move(buf[j]));
+            txn.set_version_unlock(e.vers, item);
+        }
+    }
+    void unlock(TransItem& item) override {
+        auto key = item.template key<key_type>();
+        if (key != append_key)
+            slot(key).vers.unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{TAppendVector<" << typeid(T).name() << "> " << (void*) this;
+        key_type key = item.key<key_type>();
+        if (key == size_key) {
+            w << ".size";
+            if (item.has_predicate())
+                w << ' ' << item.predicate_value<pred_type>();
+        } else if (key == append_key)
+            w << ".append " << item.write_value<unsigned>();
+        else {
+            w << "[" << key << "]";
+            if (item.has_read())
+                w << " R" << item.read_value<version_type>();
+            if (item.has_write())
+                w << " =" << item.write_value<T>();
+        }
+        w << "}";
+    }
+
+private:
+    using key_type = int;
+    using pred_type = TIntRange<size_type>;
+    static constexpr key_type size_key = -1;
+    static constexpr key_type append_key = -2;
+    static constexpr unsigned nsegments = 32;
+    // set on the versions of claimed slots until their element is installed
+    static constexpr typename version_type::type dead_bit = version_type::user_bit;
+
+    struct elem {
+        version_type vers;
+        W<T> v;
+    };
+    struct pending_buffer {
+        std::vector<T> v;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    size_type size_;
+    elem* segs_[nsegments];
+    pending_buffer pending_[MAX_THREADS];
+
+    // segment k holds elements [Segment * (2^k - 1), Segment * (2^(k+1) - 1))
+    static unsigned segment_of(size_type i) {
+        return 31 - __builtin_clz(unsigned(i) / Segment + 1);
+    }
+    static size_type segment_base(unsigned k) {
+        return Segment * ((size_type(1) << k) - 1);
+    }
+    elem& slot(size_type i) const {
+        unsigned k = segment_of(i);
+        return segs_[k][i - segment_base(k)];
+    }
+    elem& ensure_slot(size_type i) {
+        unsigned k = segment_of(i);
+        if (!segs_[k]) {
+            size_type n = Segment << k;
+            elem* seg = reinterpret_cast<elem*>(new char[sizeof(elem) * n]);
+            for (size_type j = 0; j != n; ++j)
+                seg[j].vers = version_type(dead_bit);
+            if (!bool_cmpxchg(&segs_[k], (elem*) nullptr, seg))
+                delete[] reinterpret_cast<char*>(seg);
+        }
+        return segs_[k][i - segment_base(k)];
+    }
+    // A slot below size_ may still be being installed by the appender
+    // that claimed it, which can't abort, so wait for it.
+    elem& wait_slot(size_type i) const {
+        unsigned k = segment_of(i);
+        while (!segs_[k])
+            relax_fence();
+        acquire_fence();
+        elem& e = segs_[k][i - segment_base(k)];
+        while (e.vers.value() & dead_bit)
+            relax_fence();
+        acquire_fence();
+        return e;
+    }
+
+    size_type acquire_size() const {
+        size_type s = size_;
+        acquire_fence();
+        return s;
+    }
+    bool in_range(size_type i) const {
+        if (i < 0)
+            return false;
+        if (i < acquire_size())
+            return true;
+        size_predicate(size_item()).observe_le(i);
+        return false;
+    }
+    unsigned npushes() const {
+        auto item = Sto::check_item(this, append_key);
+        return item && item->has_write() ? item->template write_value<unsigned>() : 0;
+    }
+    TransProxy size_item() const {
+        auto item = Sto::item(this, size_key);
+        if (!item.has_predicate())
+            item.set_predicate(pred_type::unconstrained());
+        return item;
+    }
+    static pred_type& size_predicate(TransProxy sitem) {
+        return sitem.template predicate_value<pred_type>();
+    }
+};
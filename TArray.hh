@@ -1,8 +1,11 @@
 #pragma once
 #include "TWrapped.hh"
 #include "TArrayProxy.hh"
+#include "TCommute.hh"
+#include "TLayout.hh"
 
-template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped>
+template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped,
+          TLayout L = TLayout::packed>
 class TArray : public TObject {
 public:
     class iterator;
@@ -12,12 +15,38 @@ public:
     typedef typename W<T>::version_type version_type;
     typedef unsigned size_type;
     typedef int difference_type;
-    typedef TConstArrayProxy<TArray<T, N, W> > const_proxy_type;
-    typedef TArrayProxy<TArray<T, N, W> > proxy_type;
+    typedef TConstArrayProxy<TArray<T, N, W, L> > const_proxy_type;
+    typedef TArrayProxy<TArray<T, N, W, L> > proxy_type;
+
+    TArray()
+        : log_id_(0) {
+    }
+
+    // data_ is inline, so large arrays get huge pages from here (see
+    // TPages). Arrays inside other objects follow their container.
+    static void* operator new(size_t size) {
+        return TPages::allocate(size);
+    }
+    static void operator delete(void* p) {
+        TPages::free(p);
+    }
 
     size_type size() const {
         return N;
     }
+    footprint memory_footprint() const {
+        footprint f = data_.memory_footprint();
+        f.index += sizeof(*this) - sizeof(data_);
+        return f;
+    }
+
+    // Log committed writes to the redo log (see TLog.hh) under object id
+    // `id`, keyed by index. id must be nonzero and unique among logged
+    // objects.
+    void set_log_id(uint64_t id) {
+        static_assert(TLogCodec<T>::supported, "TLogCodec<T> needed for logging");
+        log_id_ = id;
+    }
 
     const_proxy_type operator[](size_type i) const {
         assert(i < N);
@@ -39,65 +68,144 @@ public:
     get_type transGet(size_type i) const {
         assert(i < N);
         auto item = Sto::item(this, i);
-        if (item.has_write())
+        if (TCommute::pending(item))
+            return TCommute::materialize(item, T(data_.value(i).read(item, data_.vers(i))));
+        else if (item.has_write())
             return item.template write_value<T>();
         else
-            return data_[i].v.read(item, data_[i].vers);
+            return data_.value(i).read(item, data_.vers(i));
     }
     void transPut(size_type i, T x) const {
         assert(i < N);
-        Sto::item(this, i).add_write(x);
+        Sto::item(this, i).add_write(std::move(x)).clear_flags(TCommute::mask | TransItem::blind_bit);
+    }
+    // A last-writer-wins transPut (see TBox::write_blind)
+    void transPutBlind(size_type i, T x) const {
+        assert(i < N);
+        Sto::item(this, i).add_write(std::move(x)).clear_flags(TCommute::mask).mark_blind();
+    }
+
+    // Copies elements [i, i + n) to out, and in[0, n) to elements
+    // [i, i + n). Each element is its own item; see TBlockArray for an
+    // array whose range operations use one item per block.
+    void trans_read_range(size_type i, size_type n, T* out) const {
+        assert(i <= N && n <= N - i);
+        for (size_type j = 0; j != n; ++j)
+            out[j] = transGet(i + j);
+    }
+    void trans_write_range(size_type i, size_type n, const T* in) const {
+        assert(i <= N && n <= N - i);
+        for (size_type j = 0; j != n; ++j)
+            transPut(i + j, in[j]);
+    }
+
+    // Commutative updates (see TCommute.hh): applied at commit without
+    // reading the element, so concurrent updates don't conflict.
+    void trans_add(size_type i, const T& x) const {
+        commute(i, TCommute::add, x);
+    }
+    void trans_max(size_type i, const T& x) const {
+        commute(i, TCommute::max, x);
+    }
+    void trans_min(size_type i, const T& x) const {
+        commute(i, TCommute::min, x);
+    }
+    void trans_union(size_type i, const T& x) const {
+        commute(i, TCommute::set_union, x);
     }
 
     get_type nontrans_get(size_type i) const {
         assert(i < N);
-        return data_[i].v.access();
+        return data_.value(i).access();
     }
     void nontrans_put(size_type i, const T& x) {
         assert(i < N);
-        data_[i].v.access() = x;
+        data_.value(i).access() = x;
     }
     void nontrans_put(size_type i, T&& x) {
         assert(i < N);
-        data_[i].v.access() = std::move(x);
+        data_.value(i).access() = std::move(x);
     }
 
     // transactional methods
     bool lock(TransItem& item, Transaction& txn) override {
-        return txn.try_lock(item, data_[item.key<size_type>()].vers);
+        return txn.try_lock(item, data_.vers(item.key<size_type>()));
     }
     bool check(TransItem& item, Transaction&) override {
-        return item.check_version(data_[item.key<size_type>()].vers);
+        return item.check_version(data_.vers(item.key<size_type>()));
+    }
+    void prefetch_check(const TransItem& item) const override {
+        prefetch(&data_.vers(item.key<size_type>()));
     }
     void install(TransItem& item, Transaction& txn) override {
         size_type i = item.key<size_type>();
-        data_[i].v.write(item.write_value<T>());
-        txn.set_version_unlock(data_[i].vers, item);
+        if (TCommute::pending(item))
+            item.write_value<T>() = TCommute::installed_value(item, data_.value(i).access());
+        if (log_id_ && txn.logging())
+            txn.log_write(log_id_, i, item.write_value<T>());
+        data_.value(i).write(std::move(item.write_value<T>()));
+        txn.set_version_unlock(data_.vers(i), item);
     }
     void unlock(TransItem& item) override {
-        data_[item.key<size_type>()].vers.unlock();
+        data_.vers(item.key<size_type>()).unlock();
+    }
+
+    // grouped commit (see Transaction::group_commit), without a virtual
+    // call per item
+    unsigned lock_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+        for (unsigned i = 0; i != n; ++i)
+            if (!TArray::lock(*items[i], txn))
+                return i;
+        return n;
+    }
+    unsigned check_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+        constexpr unsigned dist = Transaction::check_prefetch_distance;
+        unsigned prefetch_end = Transaction::prefetch_validation ? n : 0;
+        for (unsigned i = 0; i < dist && i < prefetch_end; ++i)
+            TArray::prefetch_check(*items[i]);
+        for (unsigned i = 0; i != n; ++i) {
+            if (i + dist < prefetch_end)
+                TArray::prefetch_check(*items[i + dist]);
+            if (!TArray::check(*items[i], txn))
+                return i;
+        }
+        return n;
+    }
+    void install_all(TransItem* const* items, unsigned n, Transaction& txn) override {
+        for (unsigned i = 0; i != n; ++i)
+            TArray::install(*items[i], txn);
+    }
+    // each element has its own version
+    bool parallel_install() const override {
+        return true;
     }
 
 private:
-    struct elem {
-        version_type vers;
-        W<T> v;
-    };
-    elem data_[N];
+    TFixedElems<version_type, W<T>, N, L> data_;
+    uint64_t log_id_;
+
+    void commute(size_type i, TCommute::op_type op, const T& x) const {
+        assert(i < N);
+        auto item = Sto::item(this, i);
+        if (!TCommute::record(item, op, x)) {
+            TCommute::materialize(item, T(data_.value(i).read(item, data_.vers(i))));
+            TCommute::record(item, op, x);
+        }
+    }
 
     friend class iterator;
     friend class const_iterator;
 };
 
 
-template <typename T, unsigned N, template <typename> class W>
-class TArray<T, N, W>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+class TArray<T, N, W, L>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
 public:
-    typedef TArray<T, N, W> array_type;
+    typedef TArray<T, N, W, L> array_type;
     typedef typename array_type::size_type size_type;
     typedef typename array_type::difference_type difference_type;
 
-    const_iterator(const TArray<T, N, W>* a, size_type i)
+    const_iterator(const TArray<T, N, W, L>* a, size_type i)
         : a_(const_cast<array_type*>(a)), i_(i) {
     }
 
@@ -169,14 +277,14 @@ protected:
     size_type i_;
 };
 
-template <typename T, unsigned N, template <typename> class W>
-class TArray<T, N, W>::iterator : public const_iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+class TArray<T, N, W, L>::iterator : public const_iterator {
 public:
-    typedef TArray<T, N, W> array_type;
+    typedef TArray<T, N, W, L> array_type;
     typedef typename array_type::size_type size_type;
     typedef typename array_type::difference_type difference_type;
 
-    iterator(const TArray<T, N, W>* a, size_type i)
+    iterator(const TArray<T, N, W, L>* a, size_type i)
         : const_iterator(a, i) {
     }
 
@@ -216,32 +324,32 @@ public:
     }
 };
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::begin() -> iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::begin() -> iterator {
     return iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::end() -> iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::end() -> iterator {
     return iterator(this, N);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::cbegin() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::cbegin() const -> const_iterator {
     return const_iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::cend() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::cend() const -> const_iterator {
     return const_iterator(this, N);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::begin() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::begin() const -> const_iterator {
     return const_iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::end() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W, TLayout L>
+inline auto TArray<T, N, W, L>::end() const -> const_iterator {
     return const_iterator(this, N);
 }
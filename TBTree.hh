@@ -0,0 +1,774 @@
+#pragma once
+#include "compiler.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Ranking a key among the sorted keys of a B+tree node. Nodes keep their
+// keys in an array padded to whole vectors, so the SIMD versions compare
+// every slot and mask off those past n.
+namespace tbtree_search {
+template <typename K, unsigned Slots, typename = void>
+struct rank {
+    // number of keys[0, n) less than k
+    static unsigned less(const K* keys, unsigned n, K k) {
+        unsigned i = 0;
+        while (i != n && keys[i] < k)
+            ++i;
+        return i;
+    }
+    // number of keys[0, n) at most k
+    static unsigned less_equal(const K* keys, unsigned n, K k) {
+        unsigned i = 0;
+        while (i != n && !(k < keys[i]))
+            ++i;
+        return i;
+    }
+};
+
+#if defined(__SSE2__)
+template <typename K, unsigned Slots>
+struct rank<K, Slots, typename std::enable_if<sizeof(K) == 4>::type> {
+    static_assert(Slots % 4 == 0, "keys must fill whole vectors");
+    // SSE2 compares are signed; flip the sign bit of unsigned keys
+    static __m128i bias(__m128i x) {
+        if (std::is_signed<K>::value)
+            return x;
+        return _mm_xor_si128(x, _mm_set1_epi32(int32_t(0x80000000U)));
+    }
+    static __m128i load(const K* p) {
+        return bias(_mm_load_si128((const __m128i*) p));
+    }
+    static unsigned mask(__m128i x) {
+        return _mm_movemask_ps(_mm_castsi128_ps(x));
+    }
+    static unsigned less(const K* keys, unsigned n, K k) {
+        __m128i kv = bias(_mm_set1_epi32(int32_t(k)));
+        unsigned m = 0;
+        for (unsigned i = 0; i != Slots; i += 4)
+            m |= mask(_mm_cmplt_epi32(load(keys + i), kv)) << i;
+        return __builtin_popcount(m & ((1U << n) - 1));
+    }
+    static unsigned less_equal(const K* keys, unsigned n, K k) {
+        __m128i kv = bias(_mm_set1_epi32(int32_t(k)));
+        unsigned m = 0;
+        for (unsigned i = 0; i != Slots; i += 4)
+            m |= mask(_mm_cmpgt_epi32(load(keys + i), kv)) << i;
+        return n - __builtin_popcount(m & ((1U << n) - 1));
+    }
+};
+#endif
+
+#if defined(__SSE4_2__)
+template <typename K, unsigned Slots>
+struct rank<K, Slots, typename std::enable_if<sizeof(K) == 8>::type> {
+    static_assert(Slots % 2 == 0, "keys must fill whole vectors");
+    static __m128i bias(__m128i x) {
+        if (std::is_signed<K>::value)
+            return x;
+        return _mm_xor_si128(x, _mm_set1_epi64x(int64_t(0x8000000000000000ULL)));
+    }
+    static __m128i load(const K* p) {
+        return bias(_mm_load_si128((const __m128i*) p));
+    }
+    static unsigned mask(__m128i x) {
+        return _mm_movemask_pd(_mm_castsi128_pd(x));
+    }
+    static unsigned less(const K* keys, unsigned n, K k) {
+        __m128i kv = bias(_mm_set1_epi64x(int64_t(k)));
+        unsigned m = 0;
+        for (unsigned i = 0; i != Slots; i += 2)
+            m |= mask(_mm_cmpgt_epi64(kv, load(keys + i))) << i;
+        return __builtin_popcount(m & ((1U << n) - 1));
+    }
+    static unsigned less_equal(const K* keys, unsigned n, K k) {
+        __m128i kv = bias(_mm_set1_epi64x(int64_t(k)));
+        unsigned m = 0;
+        for (unsigned i = 0; i != Slots; i += 2)
+            m |= mask(_mm_cmpgt_epi64(load(keys + i), kv)) << i;
+        return n - __builtin_popcount(m & ((1U << n) - 1));
+    }
+};
+#endif
+}
+
+template <typename K, typename T, unsigned Width> class TBTree;
+template <typename K, typename T, unsigned Width> class TBTreeIterator;
+
+template <typename K, typename T, unsigned Width>
+class TBTreeProxy {
+public:
+    typedef TBTree<K, T, Width> tree_type;
+    typedef typename tree_type::record record;
+
+    TBTreeProxy(tree_type& tree, record* r)
+        : tree_(tree), r_(r) {
+    }
+    operator T() const {
+        return tree_.read_record(r_);
+    }
+    TBTreeProxy& operator=(const T& value) {
+        tree_.write_record(r_, value);
+        return *this;
+    }
+    TBTreeProxy& operator=(T&& value) {
+        tree_.write_record(r_, std::move(value));
+        return *this;
+    }
+    TBTreeProxy& operator=(const TBTreeProxy& other) {
+        return *this = T(other);
+    }
+
+private:
+    tree_type& tree_;
+    record* r_;
+};
+
+// A transactional B+tree over integer keys. Nodes are cache-line aligned
+// and hold up to Width keys, searched SIMD-wide, so lookups touch a few
+// lines per level instead of one node per level as in RBTree.
+//
+// Readers never lock. Each node has a TNonopaqueVersion that writers lock
+// and bump around every change; a lookup validates each node against its
+// parent on the way down and restarts if either moved. Structural changes
+// (adding a record to a leaf, splits, and removing a record when a delete
+// commits) are serialized on a tree-wide spinlock. Leaves are never merged
+// or freed before the tree is: empty leaves stay in place.
+//
+// Transactions observe record versions for keys they find, and leaf
+// versions for keys they miss and for iteration, so inserts into a range a
+// transaction has read cause it to abort.
+template <typename K, typename T, unsigned Width = 15>
+class TBTree : public TObject {
+    static_assert(std::is_integral<K>::value, "TBTree keys must be integers");
+    static_assert(Width >= 3 && Width < 32, "bad TBTree node width");
+public:
+    typedef K key_type;
+    typedef T value_type;
+    typedef TBTreeProxy<K, T, Width> proxy_type;
+    typedef TBTreeIterator<K, T, Width> iterator;
+    typedef TVersion Version;
+
+    static constexpr TransactionTid::type insert_bit = TransactionTid::user_bit;
+    static constexpr TransactionTid::type delete_bit = TransactionTid::user_bit << 1;
+    static constexpr TransItem::flags_type insert_tag = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_tag = TransItem::user0_bit << 1;
+
+    struct record {
+        Version version;
+        const K key;
+        TWrapped<T> value;
+
+        record(K k)
+            : version(Sto::initialized_tid() | insert_bit), key(k), value() {
+        }
+    };
+
+    TBTree()
+        : root_(make_node<internode_type>()), treelock_(0) {
+        root_->child[0] = make_node<leaf_type>();
+    }
+    ~TBTree() {
+        free_node(root_);
+    }
+
+    // transactional interface
+    size_t count(const K& key) const {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        if (record* r = find(key, l, lv)) {
+            auto item = Sto::item(this, r);
+            if (has_delete(item))
+                return 0;
+            if (!has_insert(item))
+                observe_record(item, r);
+            return 1;
+        }
+        observe_leaf(l, lv);
+        return 0;
+    }
+    bool transGet(const K& key, T& value) const {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        if (record* r = find(key, l, lv)) {
+            auto item = Sto::item(this, r);
+            if (has_delete(item))
+                return false;
+            value = read_record(r);
+            return true;
+        }
+        observe_leaf(l, lv);
+        return false;
+    }
+    proxy_type operator[](const K& key) {
+        return proxy_type(*this, insert(key));
+    }
+    size_t erase(const K& key) {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        record* r = find(key, l, lv);
+        if (!r) {
+            observe_leaf(l, lv);
+            return 0;
+        }
+        auto item = Sto::item(this, r);
+        if (has_delete(item))
+            return 0;
+        if (has_insert(item)) {
+            // erase-my-insert: cleanup removes the record after we abort
+            // or commit; nobody else can see it
+            item.clear_flags(insert_tag).add_flags(delete_tag);
+            return 1;
+        }
+        observe_record(item, r);
+        item.add_write(T()).add_flags(delete_tag);
+        return 1;
+    }
+    iterator begin() {
+        return iterator(this, leftmost_leaf());
+    }
+    iterator end() {
+        return iterator();
+    }
+
+    // nontransactional interface; not safe against concurrent writers
+    bool nontrans_find(const K& key, T& value) const {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        record* r = find(key, l, lv);
+        if (!r || (r->version.value() & (insert_bit | delete_bit)))
+            return false;
+        value = r->value.access();
+        return true;
+    }
+
+    // TObject interface
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, item.key<record*>()->version);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        uintptr_t x = item.key<uintptr_t>();
+        if (x & leaf_bit)
+            return item.check_version(reinterpret_cast<leaf_type*>(x - leaf_bit)->version);
+        return item.check_version(reinterpret_cast<record*>(x)->version);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        record* r = item.key<record*>();
+        assert(r->version.is_locked_here());
+        if (has_delete(item)) {
+            remove(r);
+            txn.set_version(r->version, delete_bit);
+            Transaction::rcu_delete(r);
+        } else {
+            r->value.write(std::move(item.template write_value<T>()));
+            txn.set_version(r->version);
+        }
+    }
+    void unlock(TransItem& item) override {
+        item.key<record*>()->version.unlock();
+    }
+    void cleanup(TransItem& item, bool) override {
+        if (item.key<uintptr_t>() & leaf_bit)
+            return;
+        record* r = item.key<record*>();
+        // our own insert, never committed (aborted, or erased again)
+        if ((has_insert(item) || has_delete(item))
+            && (r->version.value() & insert_bit)) {
+            remove(r);
+            Transaction::rcu_delete(r);
+        }
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{TBTree<" << typeid(K).name() << "," << typeid(T).name() << "> " << (void*) this;
+        uintptr_t x = item.key<uintptr_t>();
+        if (x & leaf_bit)
+            w << ".leaf " << (void*) (x - leaf_bit);
+        else
+            w << "." << reinterpret_cast<record*>(x)->key;
+        if (item.has_read())
+            w << " R" << item.read_value<Version>();
+        if (item.has_write())
+            w << " =" << item.write_value<T>();
+        w << "}";
+    }
+
+private:
+    static constexpr unsigned key_slots = (Width + 3) & ~3U;
+    static constexpr uintptr_t leaf_bit = 1;
+    static constexpr unsigned max_depth = 40;
+    typedef tbtree_search::rank<K, key_slots> rank;
+
+    struct alignas(CACHE_LINE_SIZE) node {
+        K keys[key_slots];
+        TNonopaqueVersion version;
+        uint8_t nkeys;
+        bool is_leaf;
+
+        node(bool leaf)
+            : keys(), nkeys(0), is_leaf(leaf) {
+        }
+    };
+    struct leaf_type : public node {
+        record* values[Width];
+        leaf_type* next;
+
+        leaf_type()
+            : node(true), values(), next(nullptr) {
+        }
+    };
+    struct internode_type : public node {
+        node* child[Width + 1];
+
+        internode_type()
+            : node(false), child() {
+        }
+    };
+
+    // The root is always an internode, so it never moves: a full root
+    // pushes its contents down into two new children.
+    internode_type* root_;
+    // serializes structural changes
+    mutable TransactionTid::type treelock_;
+
+    template <typename N>
+    static N* make_node() {
+        void* p;
+        always_assert(posix_memalign(&p, CACHE_LINE_SIZE, sizeof(N)) == 0);
+        return new(p) N;
+    }
+    static void free_node(node* n) {
+        if (n->is_leaf) {
+            leaf_type* l = static_cast<leaf_type*>(n);
+            for (unsigned i = 0; i != l->nkeys; ++i)
+                delete l->values[i];
+            l->~leaf_type();
+        } else {
+            internode_type* in = static_cast<internode_type*>(n);
+            for (unsigned i = 0; i <= in->nkeys; ++i)
+                free_node(in->child[i]);
+            in->~internode_type();
+        }
+        free(n);
+    }
+
+    static TNonopaqueVersion stable_version(const node* n) {
+        TNonopaqueVersion v = n->version;
+        while (v.is_locked()) {
+            relax_fence();
+            v = n->version;
+        }
+        acquire_fence();
+        return v;
+    }
+    static void lock_node(node* n) {
+        n->version.lock();
+    }
+    static void unlock_node(node* n) {
+        n->version.inc_nonopaque_version();
+        n->version.unlock();
+    }
+    static uintptr_t leaf_key(leaf_type* l) {
+        return reinterpret_cast<uintptr_t>(l) + leaf_bit;
+    }
+
+    static bool has_insert(const TransItem& item) {
+        return item.flags() & insert_tag;
+    }
+    static bool has_delete(const TransItem& item) {
+        return item.flags() & delete_tag;
+    }
+
+    // Lock-free lookup: finds key's leaf and a version at which the returned
+    // record (or its absence) was current.
+    record* find(K key, leaf_type*& leaf, TNonopaqueVersion& leafv) const {
+    retry:
+        const node* n = root_;
+        TNonopaqueVersion v = stable_version(n);
+        while (!n->is_leaf) {
+            const internode_type* in = static_cast<const internode_type*>(n);
+            unsigned nk = in->nkeys;
+            acquire_fence();
+            const node* c = in->child[rank::less_equal(in->keys, nk, key)];
+            if (!c)
+                goto retry;
+            TNonopaqueVersion cv = stable_version(c);
+            fence();
+            if (n->version != v)
+                goto retry;
+            n = c;
+            v = cv;
+        }
+        leaf = static_cast<leaf_type*>(const_cast<node*>(n));
+        unsigned nk = leaf->nkeys;
+        acquire_fence();
+        unsigned i = rank::less(leaf->keys, nk, key);
+        record* r = i != nk && leaf->keys[i] == key ? leaf->values[i] : nullptr;
+        fence();
+        if (leaf->version != v)
+            goto retry;
+        leafv = v;
+        return r;
+    }
+    leaf_type* leftmost_leaf() const {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        find(std::numeric_limits<K>::min(), l, lv);
+        return l;
+    }
+
+    // descent with treelock_ held; path[i] is the internode at depth i,
+    // and pos[i] the index of its child on the way to key
+    leaf_type* find_locked(K key, internode_type** path, unsigned* pos, unsigned& depth) const {
+        node* n = root_;
+        depth = 0;
+        while (!n->is_leaf) {
+            internode_type* in = static_cast<internode_type*>(n);
+            always_assert(depth != max_depth);
+            path[depth] = in;
+            pos[depth] = rank::less_equal(in->keys, in->nkeys, key);
+            n = in->child[pos[depth]];
+            ++depth;
+        }
+        return static_cast<leaf_type*>(n);
+    }
+
+    void observe_leaf(leaf_type* l, TNonopaqueVersion v) const {
+        Sto::item(this, leaf_key(l)).observe(v);
+    }
+    void observe_record(TransProxy& item, record* r) const {
+        Version v = r->version;
+        fence();
+        if (v.value() & (insert_bit | delete_bit))
+            Sto::abort();
+        item.observe(v);
+    }
+
+    T read_record(record* r) const {
+        auto item = Sto::item(this, r);
+        if (item.has_write())
+            return item.template write_value<T>();
+        T value = r->value.read(item, r->version);
+        if (r->version.value() & (insert_bit | delete_bit))
+            Sto::abort();
+        return value;
+    }
+    void write_record(record* r, const T& value) {
+        Sto::item(this, r).add_write(value);
+    }
+    void write_record(record* r, T&& value) {
+        Sto::item(this, r).add_write(std::move(value));
+    }
+
+    record* insert(K key) {
+        leaf_type* l;
+        TNonopaqueVersion lv;
+        record* r = find(key, l, lv);
+        if (!r) {
+            bool inserted;
+            r = find_insert(key, inserted);
+            if (inserted) {
+                Sto::item(this, r).add_write(T()).add_flags(insert_tag);
+                return r;
+            }
+        }
+        auto item = Sto::item(this, r);
+        if (has_delete(item)) {
+            // insert-my-delete
+            item.clear_flags(delete_tag);
+            if (r->version.value() & insert_bit)
+                item.add_flags(insert_tag);
+            item.add_write(T());
+        } else if (!has_insert(item))
+            observe_record(item, r);
+        return r;
+    }
+
+    record* find_insert(K key, bool& inserted) {
+        internode_type* path[max_depth];
+        unsigned pos[max_depth], depth;
+        TransactionTid::lock(treelock_);
+        leaf_type* l = find_locked(key, path, pos, depth);
+        unsigned i = rank::less(l->keys, l->nkeys, key);
+        record* r;
+        if (i != l->nkeys && l->keys[i] == key) {
+            r = l->values[i];
+            inserted = false;
+        } else {
+            r = new record(key);
+            TNonopaqueVersion old = l->version;
+            leaf_type* split = leaf_insert(l, i, key, r, path, pos, depth);
+            // our own structural change shouldn't abort us
+            if (auto item = Sto::check_item(this, leaf_key(l))) {
+                bool had_read = item->has_read();
+                item->update_read(old, l->version);
+                if (split && had_read)
+                    observe_leaf(split, split->version);
+            }
+            inserted = true;
+        }
+        TransactionTid::unlock(treelock_);
+        return r;
+    }
+
+    // Adds (key, r) at slot i of l, splitting up the tree as needed;
+    // returns the new right sibling if l split. Every node that changes is
+    // locked before any of them does, so a reader never sees a key missing
+    // from both halves of a split.
+    leaf_type* leaf_insert(leaf_type* l, unsigned i, K key, record* r,
+                           internode_type** path, unsigned* pos, unsigned depth) {
+        unsigned top = depth;
+        if (l->nkeys == Width) {
+            top = depth - 1;
+            while (top != 0 && path[top]->nkeys == Width)
+                --top;
+        }
+        for (unsigned d = top; d != depth; ++d)
+            lock_node(path[d]);
+        lock_node(l);
+
+        leaf_type* nl = nullptr;
+        unsigned n = l->nkeys;
+        if (n != Width) {
+            for (unsigned j = n; j != i; --j) {
+                l->keys[j] = l->keys[j - 1];
+                l->values[j] = l->values[j - 1];
+            }
+            l->keys[i] = key;
+            l->values[i] = r;
+            release_fence();
+            l->nkeys = n + 1;
+        } else {
+            K keys[Width + 1];
+            record* values[Width + 1];
+            for (unsigned j = 0, k = 0; j != Width + 1; ++j)
+                if (j == i) {
+                    keys[j] = key;
+                    values[j] = r;
+                } else {
+                    keys[j] = l->keys[k];
+                    values[j] = l->values[k];
+                    ++k;
+                }
+            unsigned left = (Width + 1) / 2;
+            nl = make_node<leaf_type>();
+            for (unsigned j = left; j != Width + 1; ++j) {
+                nl->keys[j - left] = keys[j];
+                nl->values[j - left] = values[j];
+            }
+            nl->nkeys = Width + 1 - left;
+            nl->next = l->next;
+            release_fence();
+            for (unsigned j = 0; j != left; ++j) {
+                l->keys[j] = keys[j];
+                l->values[j] = values[j];
+            }
+            l->next = nl;
+            release_fence();
+            l->nkeys = left;
+            internode_insert(path, pos, depth - 1, nl->keys[0], nl);
+        }
+
+        unlock_node(l);
+        for (unsigned d = top; d != depth; ++d)
+            unlock_node(path[d]);
+        return nl;
+    }
+
+    // adds separator sep and its right child c after child pos[d] of path[d]
+    void internode_insert(internode_type** path, unsigned* pos, unsigned d, K sep, node* c) {
+        internode_type* in = path[d];
+        unsigned i = pos[d], n = in->nkeys;
+        assert(in->version.is_locked_here());
+        if (n != Width) {
+            for (unsigned j = n; j != i; --j) {
+                in->keys[j] = in->keys[j - 1];
+                in->child[j + 1] = in->child[j];
+            }
+            in->keys[i] = sep;
+            in->child[i + 1] = c;
+            release_fence();
+            in->nkeys = n + 1;
+            return;
+        }
+
+        K keys[Width + 1];
+        node* child[Width + 2];
+        child[0] = in->child[0];
+        for (unsigned j = 0, k = 0; j != Width + 1; ++j)
+            if (j == i) {
+                keys[j] = sep;
+                child[j + 1] = c;
+            } else {
+                keys[j] = in->keys[k];
+                child[j + 1] = in->child[k + 1];
+                ++k;
+            }
+        // keys[left] moves up; the right node takes the keys after it
+        unsigned left = (Width + 1) / 2;
+        internode_type* right = make_node<internode_type>();
+        for (unsigned j = left + 1; j != Width + 1; ++j) {
+            right->keys[j - left - 1] = keys[j];
+            right->child[j - left - 1] = child[j];
+        }
+        right->child[Width - left] = child[Width + 1];
+        right->nkeys = Width - left;
+
+        if (d == 0) {
+            internode_type* lower = make_node<internode_type>();
+            for (unsigned j = 0; j != left; ++j) {
+                lower->keys[j] = keys[j];
+                lower->child[j] = child[j];
+            }
+            lower->child[left] = child[left];
+            lower->nkeys = left;
+            release_fence();
+            in->keys[0] = keys[left];
+            in->child[0] = lower;
+            in->child[1] = right;
+            release_fence();
+            in->nkeys = 1;
+        } else {
+            release_fence();
+            for (unsigned j = 0; j != left; ++j) {
+                in->keys[j] = keys[j];
+                in->child[j] = child[j];
+            }
+            in->child[left] = child[left];
+            release_fence();
+            in->nkeys = left;
+            internode_insert(path, pos, d - 1, keys[left], right);
+        }
+    }
+
+    void remove(record* r) {
+        internode_type* path[max_depth];
+        unsigned pos[max_depth], depth;
+        TransactionTid::lock(treelock_);
+        leaf_type* l = find_locked(r->key, path, pos, depth);
+        unsigned i = rank::less(l->keys, l->nkeys, r->key), n = l->nkeys;
+        always_assert(i != n && l->values[i] == r);
+        lock_node(l);
+        for (unsigned j = i + 1; j != n; ++j) {
+            l->keys[j - 1] = l->keys[j];
+            l->values[j - 1] = l->values[j];
+        }
+        release_fence();
+        l->nkeys = n - 1;
+        unlock_node(l);
+        TransactionTid::unlock(treelock_);
+    }
+
+    friend class TBTreeProxy<K, T, Width>;
+    friend class TBTreeIterator<K, T, Width>;
+};
+
+// Forward iterator over a TBTree in key order. It copies one leaf at a
+// time and observes that leaf's version, so keys inserted into the range
+// it has covered cause the transaction to abort.
+template <typename K, typename T, unsigned Width>
+class TBTreeIterator {
+public:
+    typedef TBTree<K, T, Width> tree_type;
+    typedef typename tree_type::record record;
+    typedef typename tree_type::leaf_type leaf_type;
+    typedef TBTreeProxy<K, T, Width> proxy_type;
+    typedef std::pair<const K, proxy_type> value_type;
+    typedef value_type reference;
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::ptrdiff_t difference_type;
+
+    struct pointer {
+        value_type x;
+        value_type* operator->() {
+            return &x;
+        }
+    };
+
+    TBTreeIterator()
+        : tree_(nullptr), pos_(0), n_(0) {
+    }
+    TBTreeIterator(tree_type* tree, leaf_type* l)
+        : tree_(tree), pos_(0), n_(0) {
+        load(l);
+        skip();
+    }
+
+    bool operator==(const TBTreeIterator& x) const {
+        return current() == x.current();
+    }
+    bool operator!=(const TBTreeIterator& x) const {
+        return !(*this == x);
+    }
+    reference operator*() const {
+        record* r = current();
+        return value_type(r->key, proxy_type(*tree_, r));
+    }
+    pointer operator->() const {
+        return pointer{**this};
+    }
+    TBTreeIterator& operator++() {
+        ++pos_;
+        skip();
+        return *this;
+    }
+    TBTreeIterator operator++(int) {
+        TBTreeIterator it = *this;
+        ++*this;
+        return it;
+    }
+
+private:
+    tree_type* tree_;
+    unsigned pos_;
+    unsigned n_;
+    record* values_[Width];
+    leaf_type* next_;
+
+    record* current() const {
+        return pos_ != n_ ? values_[pos_] : nullptr;
+    }
+    void load(leaf_type* l) {
+        while (1) {
+            TNonopaqueVersion v = tree_type::stable_version(l);
+            n_ = l->nkeys;
+            acquire_fence();
+            memcpy(values_, l->values, n_ * sizeof(record*));
+            next_ = l->next;
+            fence();
+            if (l->version == v) {
+                tree_->observe_leaf(l, v);
+                break;
+            }
+        }
+        pos_ = 0;
+    }
+    // moves to the next record visible to this transaction, or the end
+    void skip() {
+        while (1) {
+            for (; pos_ != n_; ++pos_) {
+                auto item = Sto::item(tree_, values_[pos_]);
+                if (tree_type::has_delete(item))
+                    continue;
+                if (!tree_type::has_insert(item))
+                    tree_->observe_record(item, values_[pos_]);
+                return;
+            }
+            if (!next_) {
+                pos_ = n_ = 0;
+                return;
+            }
+            load(next_);
+        }
+    }
+};
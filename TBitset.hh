@@ -0,0 +1,252 @@
+#pragma once
+#include <algorithm>
+#include "Transaction.hh"
+#include "TArrayProxy.hh"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// A fixed-size transactional bitset with one version per Group 64-bit
+// words. A transaction has one item per group it touches rather than one
+// per bit, and the bits themselves are packed. Scans work a group at a
+// time: trans_find_first and trans_count observe each group once, skip
+// zero words four at a time with AVX2, and count with POPCNT.
+//
+// As with TBlockArray, a write anywhere in a group conflicts with every
+// reader of that group. Group = 8 gives one version per cache line.
+template <unsigned N, unsigned Group = 1, bool Opaque = true>
+class TBitset : public TObject {
+    static_assert(Group > 0 && Group <= 8, "Group must be in [1, 8]");
+public:
+    typedef bool value_type;
+    typedef bool get_type;
+    typedef unsigned size_type;
+    typedef typename std::conditional<Opaque, TVersion, TNonopaqueVersion>::type version_type;
+    typedef TConstArrayProxy<TBitset<N, Group, Opaque> > const_proxy_type;
+    typedef TArrayProxy<TBitset<N, Group, Opaque> > proxy_type;
+    static constexpr unsigned nwords = (N + 63) / 64;
+    static constexpr unsigned ngroups = (nwords + Group - 1) / Group;
+    static constexpr unsigned group_bits = Group * 64;
+
+    TBitset()
+        : words_() {
+    }
+
+    size_type size() const {
+        return N;
+    }
+
+    const_proxy_type operator[](size_type i) const {
+        assert(i < N);
+        return const_proxy_type(this, i);
+    }
+    proxy_type operator[](size_type i) {
+        assert(i < N);
+        return proxy_type(this, i);
+    }
+
+    bool transGet(size_type i) const {
+        return transTest(i);
+    }
+    void transPut(size_type i, bool x) const {
+        trans_assign_range(i, 1, x);
+    }
+
+    bool transTest(size_type i) const {
+        assert(i < N);
+        size_type k = (i / 64) % Group;
+        uint64_t bit = uint64_t(1) << (i % 64);
+        auto item = Sto::item(this, i / group_bits);
+        if (item.has_write()) {
+            auto& w = item.template write_value<group_write>();
+            if (w.mask[k] & bit)
+                return w.bits[k] & bit;
+        }
+        uint64_t x[Group];
+        read_group(item, i / group_bits, x);
+        return x[k] & bit;
+    }
+    void transSet(size_type i) const {
+        trans_assign_range(i, 1, true);
+    }
+    void transClear(size_type i) const {
+        trans_assign_range(i, 1, false);
+    }
+
+    // Sets bits [i, i + n) to x, without reading them.
+    void trans_assign_range(size_type i, size_type n, bool x) const {
+        assert(i <= N && n <= N - i);
+        while (n) {
+            size_type off = i % 64, m = std::min(n, 64 - off);
+            auto item = Sto::item(this, i / group_bits);
+            if (!item.has_write())
+                item.add_write(group_write());
+            auto& w = item.template write_value<group_write>();
+            uint64_t mask = range_mask(off, m);
+            size_type k = (i / 64) % Group;
+            w.mask[k] |= mask;
+            if (x)
+                w.bits[k] |= mask;
+            else
+                w.bits[k] &= ~mask;
+            i += m;
+            n -= m;
+        }
+    }
+
+    // Returns the first set bit in [i, e), or e if there is none. Observes
+    // the groups up to the one holding the answer.
+    size_type trans_find_first(size_type i, size_type e) const {
+        return find(i, e, 0);
+    }
+    // Returns the first clear bit in [i, e), or e.
+    size_type trans_find_first_clear(size_type i, size_type e) const {
+        return find(i, e, ~uint64_t(0));
+    }
+    // Returns the number of set bits in [i, e).
+    size_type trans_count(size_type i, size_type e) const {
+        assert(i <= e && e <= N);
+        size_type n = 0;
+        for (size_type g = i / group_bits; i < e; ++g, i = g * group_bits) {
+            uint64_t x[Group];
+            read_range(g, i, e, 0, x);
+            for (unsigned k = 0; k != Group; ++k)
+                n += __builtin_popcountll(x[k]);
+        }
+        return n;
+    }
+
+    bool nontrans_test(size_type i) const {
+        assert(i < N);
+        return words_[i / 64] & (uint64_t(1) << (i % 64));
+    }
+    void nontrans_set(size_type i, bool x = true) {
+        assert(i < N);
+        if (x)
+            words_[i / 64] |= uint64_t(1) << (i % 64);
+        else
+            words_[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+    size_type nontrans_count() const {
+        size_type n = 0;
+        for (unsigned k = 0; k != nwords; ++k)
+            n += __builtin_popcountll(words_[k]);
+        return n;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, vers_[item.key<size_type>()]);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(vers_[item.key<size_type>()]);
+    }
+    void prefetch_check(const TransItem& item) const override {
+        prefetch(&vers_[item.key<size_type>()]);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        size_type g = item.key<size_type>();
+        auto& w = item.template write_value<group_write>();
+        uint64_t* dst = &words_[g * Group];
+        for (unsigned k = 0; k != Group; ++k)
+            if (w.mask[k])
+                dst[k] = (dst[k] & ~w.mask[k]) | (w.bits[k] & w.mask[k]);
+        txn.set_version_unlock(vers_[g], item);
+    }
+    void unlock(TransItem& item) override {
+        vers_[item.key<size_type>()].unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        size_type g = item.key<size_type>();
+        w << "{Bitset " << (void*) this << "[" << g * group_bits << "+" << group_bits << "]";
+        if (item.has_read())
+            w << " R" << item.read_value<version_type>();
+        if (item.has_write())
+            w << " W";
+        w << "}";
+    }
+
+private:
+    // write value of a group's item: which bits were written, and to what
+    struct group_write {
+        uint64_t mask[Group];
+        uint64_t bits[Group];
+
+        group_write()
+            : mask(), bits() {
+        }
+    };
+
+    uint64_t words_[ngroups * Group] __attribute__((aligned(CACHE_LINE_SIZE)));
+    version_type vers_[ngroups];
+
+    static uint64_t range_mask(unsigned off, unsigned n) {
+        return (n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1) << off;
+    }
+
+    // Copies group g into out, as this transaction sees it: the committed
+    // words, observed, with our own writes over them.
+    void read_group(TransProxy& item, size_type g, uint64_t* out) const {
+        const uint64_t* src = &words_[g * Group];
+        unsigned n = 0;
+        while (1) {
+            version_type v0 = vers_[g];
+            fence();
+            for (unsigned k = 0; k != Group; ++k)
+                out[k] = src[k];
+            fence();
+            version_type v1 = vers_[g];
+            if ((v0 == v1 || v1.is_locked())
+                && (!v1.is_locked_elsewhere(item.transaction())
+                    || !item.transaction().read_wait(++n, false))) {
+                item.observe(v1);
+                break;
+            }
+            relax_fence();
+        }
+        if (item.has_write()) {
+            auto& w = item.template write_value<group_write>();
+            for (unsigned k = 0; k != Group; ++k)
+                out[k] = (out[k] & ~w.mask[k]) | (w.bits[k] & w.mask[k]);
+        }
+    }
+
+    // Reads group g, flips it by flip, and keeps only bits in [i, e).
+    void read_range(size_type g, size_type i, size_type e, uint64_t flip,
+                    uint64_t* out) const {
+        auto item = Sto::item(this, g);
+        read_group(item, g, out);
+        for (unsigned k = 0; k != Group; ++k) {
+            size_type lo = std::max(i, (g * Group + k) * 64);
+            size_type hi = std::min(e, (g * Group + k + 1) * 64);
+            out[k] = lo < hi ? (out[k] ^ flip) & range_mask(lo % 64, hi - lo) : 0;
+        }
+    }
+
+    // Index of the first nonzero word of x, or Group.
+    static unsigned first_nonzero(const uint64_t* x) {
+        unsigned k = 0;
+#if defined(__AVX2__)
+        for (; k + 4 <= Group; k += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (x + k));
+            if (!_mm256_testz_si256(v, v))
+                break;
+        }
+#endif
+        while (k != Group && !x[k])
+            ++k;
+        return k;
+    }
+
+    size_type find(size_type i, size_type e, uint64_t flip) const {
+        assert(i <= e && e <= N);
+        for (size_type g = i / group_bits; i < e; ++g, i = g * group_bits) {
+            uint64_t x[Group];
+            read_range(g, i, e, flip, x);
+            unsigned k = first_nonzero(x);
+            if (k != Group)
+                return (g * Group + k) * 64 + __builtin_ctzll(x[k]);
+        }
+        return e;
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <string.h>
+#include <algorithm>
+#include "Transaction.hh"
+#include "TArrayProxy.hh"
+
+// A fixed-size transactional array with one version per Block elements.
+// Values are stored contiguously, apart from the versions, and a
+// transaction has one item per block it touches instead of one per
+// element, so copying a slice in or out is a memcpy per block.
+//
+// The price is granularity: a write anywhere in a block conflicts with
+// every reader of that block. T must be trivially copyable.
+template <typename T, unsigned N, unsigned Block = 64, bool Opaque = true>
+class TBlockArray : public TObject {
+    static_assert(mass::is_trivially_copyable<T>::value, "TBlockArray needs trivially copyable T");
+    static_assert(Block > 0 && Block <= 64, "Block must be in [1, 64]");
+public:
+    typedef T value_type;
+    typedef T get_type;
+    typedef unsigned size_type;
+    typedef typename std::conditional<Opaque, TVersion, TNonopaqueVersion>::type version_type;
+    typedef TConstArrayProxy<TBlockArray<T, N, Block, Opaque> > const_proxy_type;
+    typedef TArrayProxy<TBlockArray<T, N, Block, Opaque> > proxy_type;
+    static constexpr unsigned nblocks = (N + Block - 1) / Block;
+
+    TBlockArray()
+        : data_() {
+    }
+
+    size_type size() const {
+        return N;
+    }
+
+    const_proxy_type operator[](size_type i) const {
+        assert(i < N);
+        return const_proxy_type(this, i);
+    }
+    proxy_type operator[](size_type i) {
+        assert(i < N);
+        return proxy_type(this, i);
+    }
+
+    T transGet(size_type i) const {
+        T x;
+        trans_read_range(i, 1, &x);
+        return x;
+    }
+    void transPut(size_type i, const T& x) const {
+        trans_write_range(i, 1, &x);
+    }
+
+    // Copies elements [i, i + n) to out.
+    void trans_read_range(size_type i, size_type n, T* out) const {
+        assert(i <= N && n <= N - i);
+        while (n) {
+            size_type off = i % Block, m = std::min(n, Block - off);
+            read_block(i / Block, off, m, out);
+            i += m;
+            n -= m;
+            out += m;
+        }
+    }
+    // Writes in[0, n) to elements [i, i + n).
+    void trans_write_range(size_type i, size_type n, const T* in) const {
+        assert(i <= N && n <= N - i);
+        while (n) {
+            size_type off = i % Block, m = std::min(n, Block - off);
+            auto item = Sto::item(this, i / Block);
+            if (!item.has_write())
+                item.add_write(block_write());
+            auto& w = item.template write_value<block_write>();
+            memcpy(&w.v[off], in, m * sizeof(T));
+            w.mask |= range_mask(off, m);
+            i += m;
+            n -= m;
+            in += m;
+        }
+    }
+
+    T nontrans_get(size_type i) const {
+        assert(i < N);
+        return data_[i];
+    }
+    void nontrans_put(size_type i, const T& x) {
+        assert(i < N);
+        data_[i] = x;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, vers_[item.key<size_type>()]);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(vers_[item.key<size_type>()]);
+    }
+    void prefetch_check(const TransItem& item) const override {
+        prefetch(&vers_[item.key<size_type>()]);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        size_type b = item.key<size_type>();
+        auto& w = item.template write_value<block_write>();
+        T* dst = &data_[b * Block];
+        // copy each run of written elements
+        uint64_t mask = w.mask;
+        while (mask) {
+            unsigned first = __builtin_ctzll(mask);
+            unsigned last = first;
+            while (last != 64 && (mask & (uint64_t(1) << last)))
+                ++last;
+            memcpy(dst + first, &w.v[first], (last - first) * sizeof(T));
+            mask &= ~range_mask(first, last - first);
+        }
+        txn.set_version_unlock(vers_[b], item);
+    }
+    void unlock(TransItem& item) override {
+        vers_[item.key<size_type>()].unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        size_type b = item.key<size_type>();
+        w << "{BlockArray " << (void*) this << "[" << b * Block << "+" << Block << "]";
+        if (item.has_read())
+            w << " R" << item.read_value<version_type>();
+        if (item.has_write())
+            w << " W" << std::hex << item.write_value<block_write>().mask << std::dec;
+        w << "}";
+    }
+
+private:
+    // write value of a block's item: the written elements, and which
+    // they are
+    struct block_write {
+        uint64_t mask;
+        T v[Block];
+
+        block_write()
+            : mask(0) {
+        }
+    };
+
+    T data_[N] __attribute__((aligned(CACHE_LINE_SIZE)));
+    version_type vers_[nblocks];
+
+    static uint64_t range_mask(unsigned off, unsigned n) {
+        return (n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1) << off;
+    }
+
+    void read_block(size_type b, size_type off, size_type m, T* out) const {
+        auto item = Sto::item(this, b);
+        const block_write* w = nullptr;
+        uint64_t want = range_mask(off, m);
+        if (item.has_write()) {
+            w = &item.template write_value<block_write>();
+            if ((w->mask & want) == want) {
+                memcpy(out, &w->v[off], m * sizeof(T));
+                return;
+            }
+        }
+        // copy the committed elements, as in TWrappedAccess::read_atomic
+        const T* src = &data_[b * Block + off];
+        unsigned n = 0;
+        while (1) {
+            version_type v0 = vers_[b];
+            fence();
+            memcpy(out, src, m * sizeof(T));
+            fence();
+            version_type v1 = vers_[b];
+            if ((v0 == v1 || v1.is_locked())
+                && (!v1.is_locked_elsewhere(item.transaction())
+                    || !item.transaction().read_wait(++n, false))) {
+                item.observe(v1);
+                break;
+            }
+            relax_fence();
+        }
+        // then our own writes over them
+        if (w)
+            for (size_type j = 0; j != m; ++j)
+                if (w->mask & (uint64_t(1) << (off + j)))
+                    out[j] = w->v[off + j];
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include "Interface.hh"
 #include "TWrapped.hh"
+#include "TCommute.hh"
 
 template <typename T, typename W = TWrapped<T> >
 class TBox : public TObject {
@@ -8,29 +9,61 @@ public:
     typedef typename W::read_type read_type;
     typedef typename W::version_type version_type;
 
-    TBox() {
+    TBox()
+        : log_id_(0) {
     }
     template <typename... Args>
     explicit TBox(Args&&... args)
-        : v_(std::forward<Args>(args)...) {
+        : v_(std::forward<Args>(args)...), log_id_(0) {
+    }
+
+    // Log committed writes to the redo log (see TLog.hh) under object id
+    // `id`, which must be nonzero and unique among logged objects.
+    void set_log_id(uint64_t id) {
+        static_assert(TLogCodec<T>::supported, "TLogCodec<T> needed for logging");
+        log_id_ = id;
     }
 
     read_type read() const {
         auto item = Sto::item(this, 0);
-        if (item.has_write())
+        if (TCommute::pending(item))
+            return TCommute::materialize(item, T(v_.read(item, vers_)));
+        else if (item.has_write())
             return item.template write_value<T>();
         else
             return v_.read(item, vers_);
     }
     void write(const T& x) {
-        Sto::item(this, 0).add_write(x);
+        Sto::item(this, 0).add_write(x).clear_flags(TCommute::mask | TransItem::blind_bit);
     }
     void write(T&& x) {
-        Sto::item(this, 0).add_write(std::move(x));
+        Sto::item(this, 0).add_write(std::move(x)).clear_flags(TCommute::mask | TransItem::blind_bit);
     }
     template <typename... Args>
     void write(Args&&... args) {
-        Sto::item(this, 0).template add_write<T>(std::forward<Args>(args)...);
+        Sto::item(this, 0).template add_write<T>(std::forward<Args>(args)...).clear_flags(TCommute::mask | TransItem::blind_bit);
+    }
+    // A last-writer-wins write (see TransProxy::mark_blind): if it's the
+    // transaction's only item and another transaction writes the box
+    // meanwhile, the commit may drop it as overwritten instead of
+    // waiting.
+    void write_blind(T x) {
+        Sto::item(this, 0).add_write(std::move(x)).clear_flags(TCommute::mask).mark_blind();
+    }
+
+    // Commutative updates (see TCommute.hh): applied at commit without
+    // reading the value, so concurrent updates don't conflict.
+    void trans_add(const T& x) {
+        commute(TCommute::add, x);
+    }
+    void trans_max(const T& x) {
+        commute(TCommute::max, x);
+    }
+    void trans_min(const T& x) {
+        commute(TCommute::min, x);
+    }
+    void trans_union(const T& x) {
+        commute(TCommute::set_union, x);
     }
 
     operator read_type() const {
@@ -75,6 +108,10 @@ public:
         return item.check_version(vers_);
     }
     void install(TransItem& item, Transaction& txn) override {
+        if (TCommute::pending(item))
+            item.template write_value<T>() = TCommute::installed_value(item, v_.access());
+        if (log_id_ && txn.logging())
+            txn.log_write(log_id_, 0, item.template write_value<T>());
         v_.write(std::move(item.template write_value<T>()));
         txn.set_version_unlock(vers_, item);
     }
@@ -86,11 +123,21 @@ public:
         if (item.has_read())
             w << " R" << item.read_value<version_type>();
         if (item.has_write())
-            w << " =" << item.write_value<T>();
+            w << (TCommute::pending(item) ? " ⊕" : " =") << item.write_value<T>();
         w << "}";
     }
 
+private:
+    void commute(TCommute::op_type op, const T& x) {
+        auto item = Sto::item(this, 0);
+        if (!TCommute::record(item, op, x)) {
+            TCommute::materialize(item, T(v_.read(item, vers_)));
+            TCommute::record(item, op, x);
+        }
+    }
+
 protected:
     version_type vers_;
     W v_;
+    uint64_t log_id_;
 };
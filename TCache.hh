@@ -0,0 +1,197 @@
+#pragma once
+#include <vector>
+#include "Hashtable.hh"
+#include "local_vector.hh"
+
+// A bounded transactional cache: a Hashtable whose entries are evicted
+// CLOCK-style once their total size passes a byte budget.
+//
+// Hits stay read-only. A hit sets a reference bit for its key, chosen by
+// hash, with a plain store that no transaction reads or validates, so
+// readers never conflict with each other over recency. Puts and erases
+// only record their size change; the budget is charged at commit, and the
+// committing transaction then runs the clock hand, skipping keys whose
+// bit is set (and clearing it) and evicting the rest until the cache fits.
+// An eviction is a committed delete to anyone who read the key.
+//
+// Sizes are what the caller says they are, by default sizeof(K) +
+// sizeof(V) per entry. Bits are shared between keys that hash alike, so
+// recency is approximate.
+template <typename K, typename V, unsigned Init_size = 129,
+          typename Hash = std::hash<K>, typename Pred = std::equal_to<K> >
+class TCache : public TObject {
+public:
+    typedef K key_type;
+    typedef V value_type;
+
+    explicit TCache(size_t byte_budget, size_t nref_bits = 4096)
+        : budget_(byte_budget), used_(0), hand_(0), sweep_(0) {
+        size_t n = 64;
+        while (n < nref_bits)
+            n <<= 1;
+        refs_.assign(n, 0);
+    }
+
+    size_t budget() const {
+        return budget_;
+    }
+    // bytes charged by committed transactions
+    size_t nontrans_bytes() const {
+        return used_;
+    }
+    bool nontrans_get(const K& k, V& v) {
+        entry e;
+        if (!table_.read(k, e))
+            return false;
+        v = e.value;
+        return true;
+    }
+
+    static size_t default_size(const V&) {
+        return sizeof(K) + sizeof(V);
+    }
+
+    bool transGet(const K& k, V& v) {
+        entry e;
+        if (!table_.transGet(k, e))
+            return false;
+        v = e.value;
+        uint8_t& ref = refs_[Hash()(k) & (refs_.size() - 1)];
+        if (!ref)
+            ref = 1;
+        return true;
+    }
+
+    // Inserts or replaces k, charging bytes against the budget.
+    void transPut(const K& k, const V& v, size_t bytes) {
+        entry old;
+        bool existed = table_.transGet(k, old);
+        table_.transPut(k, entry(v, bytes));
+        auto& p = pending_item();
+        p.delta += int64_t(bytes) - (existed ? int64_t(old.bytes) : 0);
+        if (!existed)
+            p.added.push_back(k);
+    }
+    void transPut(const K& k, const V& v) {
+        transPut(k, v, default_size(v));
+    }
+
+    bool transErase(const K& k) {
+        entry old;
+        if (!table_.transGet(k, old))
+            return false;
+        table_.transDelete(k);
+        pending_item().delta -= old.bytes;
+        return true;
+    }
+
+    bool lock(TransItem&, Transaction&) override {
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        return true;
+    }
+    void install(TransItem& item, Transaction&) override {
+        auto& p = item.template write_value<pending>();
+        __sync_fetch_and_add(&used_, p.delta);
+        ring_lock_.lock();
+        for (auto& k : p.added)
+            place(k);
+        // two sweeps clear every reference bit, so this stops unless
+        // everything left is locked or uncommitted
+        for (size_t n = 2 * ring_.size(); n && used_ > int64_t(budget_); --n)
+            step(hand_, true);
+        ring_lock_.unlock();
+    }
+    void unlock(TransItem&) override {
+    }
+
+private:
+    struct entry {
+        V value;
+        size_t bytes;
+
+        entry()
+            : value(), bytes(0) {
+        }
+        entry(const V& v, size_t b)
+            : value(v), bytes(b) {
+        }
+    };
+    // write value of the cache's item: the net size change, and the keys
+    // this transaction inserted, which join the clock ring at commit
+    struct pending {
+        int64_t delta;
+        local_vector<K, 4> added;
+
+        pending()
+            : delta(0) {
+        }
+    };
+    // a ring slot for a key that may since have left the table
+    struct slot {
+        K key;
+        bool used;
+    };
+
+    Hashtable<K, entry, true, Init_size, entry, Hash, Pred> table_;
+    size_t budget_;
+    int64_t used_;
+    std::vector<uint8_t> refs_;
+    // the clock ring and its free slots, guarded by ring_lock_
+    TVersion ring_lock_;
+    std::vector<slot> ring_;
+    std::vector<unsigned> free_;
+    // the clock hand, and a second cursor that only frees slots, so that
+    // reclaiming doesn't move the hand past keys it never judged
+    size_t hand_;
+    size_t sweep_;
+
+    pending& pending_item() {
+        auto item = Sto::item(this, 0);
+        if (!item.has_write())
+            item.add_write(pending());
+        return item.template write_value<pending>();
+    }
+
+    void place(const K& k) {
+        // reclaim a few slots of departed keys before growing the ring
+        for (unsigned n = 0; free_.empty() && n != 8 && n != ring_.size(); ++n)
+            step(sweep_, false);
+        if (free_.empty()) {
+            free_.push_back(ring_.size());
+            ring_.push_back(slot{k, false});
+        }
+        slot& s = ring_[free_.back()];
+        free_.pop_back();
+        s.key = k;
+        s.used = true;
+    }
+
+    // Moves cursor one slot, freeing it if its key is gone and, if evict,
+    // evicting its key unless referenced.
+    void step(size_t& cursor, bool evict) {
+        if (ring_.empty())
+            return;
+        if (cursor >= ring_.size())
+            cursor = 0;
+        unsigned i = cursor++;
+        slot& s = ring_[i];
+        if (!s.used)
+            return;
+        entry e;
+        if (!table_.read(s.key, e)) {
+            s.used = false;
+            free_.push_back(i);
+        } else if (evict) {
+            uint8_t& ref = refs_[Hash()(s.key) & (refs_.size() - 1)];
+            if (ref)
+                ref = 0;
+            else if (table_.try_remove(s.key)) {
+                __sync_fetch_and_add(&used_, -int64_t(e.bytes));
+                s.used = false;
+                free_.push_back(i);
+            }
+        }
+    }
+};
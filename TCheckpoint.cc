@@ -0,0 +1,123 @@
+#include "TCheckpoint.hh"
+#include "compiler.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char TCheckpointWriter::magic[8] = {'S', 'T', 'O', 'C', 'K', 'P', 'T', '1'};
+
+TCheckpointWriter::~TCheckpointWriter() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        unlink(tmp_path_.c_str());
+    }
+}
+
+bool TCheckpointWriter::open(const char* path) {
+    always_assert(fd_ < 0);
+    path_ = path;
+    tmp_path_ = path_ + ".tmp";
+    fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0)
+        return false;
+    ok_ = true;
+    reset();
+    return true;
+}
+
+void TCheckpointWriter::reset() {
+    buf_.clear();
+    count_ = data_size_ = 0;
+    if (fd_ >= 0 && (ftruncate(fd_, 0) != 0
+                     || lseek(fd_, sizeof(header), SEEK_SET) < 0))
+        ok_ = false;
+}
+
+void TCheckpointWriter::flush() {
+    const char* p = buf_.data();
+    size_t n = buf_.size();
+    while (n && ok_) {
+        ssize_t r = ::write(fd_, p, n);
+        if (r < 0 && errno != EINTR)
+            ok_ = false;
+        else if (r > 0) {
+            p += r;
+            n -= r;
+        }
+    }
+    buf_.clear();
+}
+
+bool TCheckpointWriter::commit(uint64_t tid) {
+    if (fd_ < 0)
+        return false;
+    flush();
+    header h;
+    memcpy(h.magic, magic, sizeof(magic));
+    h.count = count_;
+    h.tid = tid;
+    h.data_size = data_size_;
+    ok_ = ok_ && pwrite(fd_, &h, sizeof(h), 0) == ssize_t(sizeof(h))
+        && fsync(fd_) == 0;
+    ok_ = ::close(fd_) == 0 && ok_;
+    fd_ = -1;
+    if (ok_ && rename(tmp_path_.c_str(), path_.c_str()) != 0)
+        ok_ = false;
+    if (!ok_)
+        unlink(tmp_path_.c_str());
+    return ok_;
+}
+
+TCheckpointReader::~TCheckpointReader() {
+    if (map_)
+        munmap(map_, size_);
+}
+
+bool TCheckpointReader::open(const char* path) {
+    always_assert(!map_);
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(hdr_);
+    if (ok) {
+        void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED)
+            ok = false;
+        else {
+            map_ = (char*) m;
+            size_ = st.st_size;
+        }
+    }
+    ::close(fd);
+    if (!ok)
+        return false;
+    madvise(map_, size_, MADV_SEQUENTIAL);
+    memcpy(&hdr_, map_, sizeof(hdr_));
+    if (memcmp(hdr_.magic, TCheckpointWriter::magic, sizeof(hdr_.magic)) != 0
+        || hdr_.data_size != size_ - sizeof(hdr_)) {
+        errno = EINVAL;
+        return false;
+    }
+    pos_ = sizeof(hdr_);
+    left_ = hdr_.count;
+    return true;
+}
+
+bool TCheckpointReader::next(const char*& key, uint32_t& keylen,
+                             const char*& value, uint32_t& valuelen) {
+    if (!left_ || size_ - pos_ < 8)
+        return false;
+    memcpy(&keylen, map_ + pos_, 4);
+    memcpy(&valuelen, map_ + pos_ + 4, 4);
+    if (size_ - pos_ - 8 < uint64_t(keylen) + valuelen)
+        return false;
+    key = map_ + pos_ + 8;
+    value = key + keylen;
+    pos_ += 8 + uint64_t(keylen) + valuelen;
+    --left_;
+    return true;
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include "TLog.hh"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Checkpoint files hold a consistent copy of one table for fast restart
+// (see Hashtable::checkpoint and MassTrans::checkpoint):
+//     char magic[8] = "STOCKPT1"; uint64_t count, tid, data bytes;
+// then `count` entries of
+//     uint32_t key length, uint32_t value length, key, value
+// encoded with TLogCodec, as in the redo log. A checkpoint reflects every
+// transaction with a commit TID below `tid` and none above it (tid is 0
+// when unknown), so restoring one and then replaying redo log entries
+// with larger TIDs recovers the table. Restore maps the file and bulk
+// loads it without running transactions.
+
+class TCheckpointWriter {
+public:
+    struct header {
+        char magic[8];
+        uint64_t count;
+        uint64_t tid;
+        uint64_t data_size;
+    };
+    static const char magic[8];
+
+    TCheckpointWriter()
+        : fd_(-1), ok_(false), count_(0), data_size_(0) {
+    }
+    // removes the partial file unless commit() succeeded
+    ~TCheckpointWriter();
+    TCheckpointWriter(const TCheckpointWriter&) = delete;
+    TCheckpointWriter& operator=(const TCheckpointWriter&) = delete;
+
+    // Start writing a checkpoint that commit() will move to path.
+    bool open(const char* path);
+    // Discard the entries added so far, e.g. when a scan retries.
+    void reset();
+
+    template <typename K, typename V>
+    void add(const K& key, const V& value) {
+        uint32_t kl = TLogCodec<K>::size(key);
+        uint32_t vl = TLogCodec<V>::size(value);
+        char* p = reserve(kl, vl);
+        TLogCodec<K>::encode(p, key);
+        TLogCodec<V>::encode(p + kl, value);
+    }
+    template <typename V>
+    void add(const char* key, uint32_t keylen, const V& value) {
+        uint32_t vl = TLogCodec<V>::size(value);
+        char* p = reserve(keylen, vl);
+        memcpy(p, key, keylen);
+        TLogCodec<V>::encode(p + keylen, value);
+    }
+
+    // Write the header, sync, and atomically replace the file at path.
+    bool commit(uint64_t tid);
+
+    uint64_t count() const {
+        return count_;
+    }
+
+private:
+    static constexpr size_t flush_size = 1 << 20;
+    int fd_;
+    bool ok_;
+    uint64_t count_;
+    uint64_t data_size_;
+    std::string path_;
+    std::string tmp_path_;
+    std::vector<char> buf_;
+
+    char* reserve(uint32_t keylen, uint32_t valuelen) {
+        size_t n = 8 + keylen + valuelen;
+        if (buf_.size() + n > flush_size && !buf_.empty())
+            flush();
+        size_t pos = buf_.size();
+        buf_.resize(pos + n);
+        char* p = buf_.data() + pos;
+        memcpy(p, &keylen, 4);
+        memcpy(p + 4, &valuelen, 4);
+        ++count_;
+        data_size_ += n;
+        return p + 8;
+    }
+    void flush();
+};
+
+class TCheckpointReader {
+public:
+    TCheckpointReader()
+        : map_(nullptr), size_(0), pos_(0), left_(0), hdr_() {
+    }
+    ~TCheckpointReader();
+    TCheckpointReader(const TCheckpointReader&) = delete;
+    TCheckpointReader& operator=(const TCheckpointReader&) = delete;
+
+    // Map a checkpoint file and check its header.
+    bool open(const char* path);
+
+    uint64_t count() const {
+        return hdr_.count;
+    }
+    uint64_t tid() const {
+        return hdr_.tid;
+    }
+
+    // The next entry's encoded key and value, which stay valid while the
+    // reader does. Returns false at the end or on a malformed entry.
+    bool next(const char*& key, uint32_t& keylen, const char*& value, uint32_t& valuelen);
+    template <typename K, typename V>
+    bool next(K& key, V& value) {
+        const char* k;
+        const char* v;
+        uint32_t kl, vl;
+        if (!next(k, kl, v, vl))
+            return false;
+        key = TLogCodec<K>::decode(k, kl);
+        value = TLogCodec<V>::decode(v, vl);
+        return true;
+    }
+    // true once every entry has been read
+    bool done() const {
+        return map_ && left_ == 0;
+    }
+
+private:
+    char* map_;
+    size_t size_;
+    size_t pos_;
+    uint64_t left_;
+    TCheckpointWriter::header hdr_;
+};
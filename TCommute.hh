@@ -0,0 +1,134 @@
+#pragma once
+#include <utility>
+#include "Transaction.hh"
+
+// Deferred commutative updates for TObjects.
+//
+// Instead of a plain write, a transaction can record "add x", "max x",
+// "min x" or "union x" on an item. The owning object applies the update
+// to the current value in install(), under its usual lock, but the
+// transaction never reads the value. So concurrent updates of a hot cell
+// don't fail validation against each other, the way TCounter's deltas
+// don't.
+//
+// The operation lives in three item flag bits (TCommute::mask, which an
+// object using TCommute must leave free) and the operand is the write
+// value, so the write value has type T either way. Folding rules:
+// - Repeated updates of the same kind fold into one operand.
+// - An update after a plain write folds into the written value.
+// - Reading the item, or mixing kinds, turns the pending update into a
+//   plain write of the updated value (see materialize()). At that point
+//   the transaction has to read the value anyway.
+namespace TCommute {
+
+enum op_type { none = 0, add, max, min, set_union };
+
+static constexpr int shift = 56;
+static constexpr TransItem::flags_type mask = TransItem::flags_type(7) << shift;
+static_assert(mask >= TransItem::user0_bit
+              && !(mask & TransItem::special_mask),
+              "TCommute flag bits must be user flags");
+
+inline op_type pending(const TransItem& item) {
+    return item.has_write() ? op_type((item.flags() & mask) >> shift) : none;
+}
+inline op_type pending(const TransProxy& item) {
+    return pending(item.item());
+}
+
+// Each operation only compiles for types that support it; applying one
+// that doesn't is a usage error caught at run time.
+template <typename T>
+inline auto apply_add(T& v, const T& x, int) -> decltype(v += x, void()) {
+    v += x;
+}
+template <typename T>
+inline void apply_add(T&, const T&, long) {
+    always_assert(false && "TCommute::add needs operator+=");
+}
+template <typename T>
+inline auto apply_max(T& v, const T& x, int) -> decltype(v < x, void()) {
+    if (v < x)
+        v = x;
+}
+template <typename T>
+inline void apply_max(T&, const T&, long) {
+    always_assert(false && "TCommute::max needs operator<");
+}
+template <typename T>
+inline auto apply_min(T& v, const T& x, int) -> decltype(x < v, void()) {
+    if (x < v)
+        v = x;
+}
+template <typename T>
+inline void apply_min(T&, const T&, long) {
+    always_assert(false && "TCommute::min needs operator<");
+}
+template <typename T>
+inline auto apply_union(T& v, const T& x, int) -> decltype(v.insert(x.begin(), x.end()), void()) {
+    v.insert(x.begin(), x.end());
+}
+template <typename T>
+inline void apply_union(T&, const T&, long) {
+    always_assert(false && "TCommute::set_union needs a set-like type");
+}
+
+template <typename T>
+void apply(op_type op, T& v, const T& x) {
+    switch (op) {
+    case none:
+        v = x;
+        break;
+    case add:
+        apply_add(v, x, 0);
+        break;
+    case max:
+        apply_max(v, x, 0);
+        break;
+    case min:
+        apply_min(v, x, 0);
+        break;
+    case set_union:
+        apply_union(v, x, 0);
+        break;
+    }
+}
+
+// Returns the value item installs over current.
+template <typename T>
+T installed_value(const TransItem& item, const T& current) {
+    const T& x = item.template write_value<T>();
+    op_type op = pending(item);
+    if (op == none)
+        return x;
+    T v = current;
+    apply(op, v, x);
+    return v;
+}
+
+// Replaces item's pending update with a plain write of it applied to
+// current, the value the transaction read, and returns the written value.
+template <typename T>
+T& materialize(TransProxy item, const T& current) {
+    item.template write_value<T>() = installed_value(item.item(), current);
+    item.clear_flags(mask);
+    return item.template write_value<T>();
+}
+
+// Records op(x) on item. Returns false if the item already has a pending
+// update of another kind; the caller should materialize() and retry.
+template <typename T>
+bool record(TransProxy item, op_type op, const T& x) {
+    if (!item.has_write()) {
+        item.add_write(x);
+        item.clear_flags(mask).add_flags(TransItem::flags_type(op) << shift);
+        return true;
+    }
+    op_type cur = pending(item);
+    if (cur != none && cur != op)
+        return false;
+    apply(op, item.template write_value<T>(), x);
+    return true;
+}
+
+} // namespace TCommute
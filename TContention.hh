@@ -0,0 +1,190 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+// Contention managers decide how long a transaction waits on a locked
+// version before giving up, and how long the TRANSACTION/RETRY loop pauses
+// before retrying an aborted transaction. Each thread has its own manager
+// (see Transaction::set_contention_manager), so stateful policies need no
+// synchronization. Managers are only consulted once contention is seen.
+
+class TContentionManager {
+public:
+    virtual ~TContentionManager() {}
+
+    // Transaction::try_lock failed for the nth time in a row (n >= 1) on a
+    // version locked by another transaction. Returns true to try again,
+    // false to give up; may pause first.
+    virtual bool lock_wait(unsigned n) = 0;
+    // A read found its version locked by another transaction for the nth
+    // time (n >= 1). Returns true to wait and reread, false to abort.
+    // Patient reads (wait_snapshot, usually at commit time) prefer waiting.
+    virtual bool read_wait(unsigned n, bool patient) = 0;
+    // A transaction on this thread finished.
+    virtual void finish(bool committed) {
+        (void) committed;
+    }
+    // The TRANSACTION/RETRY loop is about to restart a transaction that
+    // aborted n times in a row (n >= 1).
+    virtual void before_retry(unsigned n) {
+        (void) n;
+    }
+    virtual const char* name() const = 0;
+
+    // returns a new manager for a policy name ("spin", "backoff",
+    // "abort-fast", "adaptive"), or nullptr. Defined in Transaction.cc.
+    static TContentionManager* make(const char* policy);
+
+protected:
+    static void spin(unsigned count) {
+        for (; count; --count)
+            relax_fence();
+    }
+    // exponential backoff for the nth wait
+    static void backoff(unsigned n) {
+        if (n > 3)
+            spin(1U << std::min(15U, n - 2));
+    }
+};
+
+// Retry a lock up to lock_bound times and a patient read up to read_bound
+// times, optionally with exponential backoff. Impatient reads abort on
+// locked versions; if !abort_on_locked, all reads wait indefinitely. The
+// default policy, configured by STO_SPIN_EXPBACKOFF, STO_SPIN_BOUND_WRITE,
+// STO_SPIN_BOUND_WAIT and STO_ABORT_ON_LOCKED.
+class TSpinContention : public TContentionManager {
+public:
+    TSpinContention(unsigned lock_bound, unsigned read_bound,
+                    bool abort_on_locked, bool exponential)
+        : lock_bound_(lock_bound), read_bound_(read_bound),
+          abort_on_locked_(abort_on_locked), exponential_(exponential) {
+    }
+    bool lock_wait(unsigned n) override {
+        if (n >= lock_bound_)
+            return false;
+        if (exponential_)
+            backoff(n);
+        return true;
+    }
+    bool read_wait(unsigned n, bool patient) override {
+        if (!abort_on_locked_)
+            return true;
+        if (!patient || n > read_bound_)
+            return false;
+        if (exponential_)
+            backoff(n);
+        return true;
+    }
+    const char* name() const override {
+        return "spin";
+    }
+private:
+    unsigned lock_bound_;
+    unsigned read_bound_;
+    bool abort_on_locked_;
+    bool exponential_;
+};
+
+// Exponential backoff on locks and reads, and randomized exponential
+// backoff before each retry.
+class TBackoffContention : public TContentionManager {
+public:
+    TBackoffContention(unsigned lock_bound = 7, unsigned read_bound = 18)
+        : lock_bound_(lock_bound), read_bound_(read_bound),
+          rng_(uintptr_t(this) | 1) {
+    }
+    bool lock_wait(unsigned n) override {
+        if (n >= lock_bound_)
+            return false;
+        backoff(n);
+        return true;
+    }
+    bool read_wait(unsigned n, bool) override {
+        if (n > read_bound_)
+            return false;
+        backoff(n);
+        return true;
+    }
+    void before_retry(unsigned n) override {
+        spin(random() & ((1U << std::min(n + 4, 16U)) - 1));
+    }
+    const char* name() const override {
+        return "backoff";
+    }
+protected:
+    unsigned lock_bound_;
+    unsigned read_bound_;
+    uint32_t rng_;
+    uint32_t random() {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 17;
+        rng_ ^= rng_ << 5;
+        return rng_;
+    }
+};
+
+// Never wait: abort as soon as a lock or an impatient read is contended.
+// Patient reads still spin briefly, since they run while holding locks.
+class TAbortFastContention : public TContentionManager {
+public:
+    bool lock_wait(unsigned) override {
+        return false;
+    }
+    bool read_wait(unsigned n, bool patient) override {
+        return patient && n <= (1U << 10);
+    }
+    const char* name() const override {
+        return "abort-fast";
+    }
+};
+
+// Tracks this thread's recent abort rate. While aborts are rare, behaves
+// like abort-fast plus a short lock spin; as the rate rises, waits longer
+// and backs off before retries, scaled by the rate.
+class TAdaptiveContention : public TBackoffContention {
+public:
+    // rates are fixed point with one_rate == 100%
+    static constexpr unsigned one_rate = 1U << 16;
+    static constexpr unsigned rate_shift = 5; // EWMA weight 1/32
+
+    TAdaptiveContention(unsigned low_rate = one_rate / 20)
+        : low_rate_(low_rate), rate_(0) {
+    }
+    bool lock_wait(unsigned n) override {
+        if (!contended())
+            return n < 4;
+        return TBackoffContention::lock_wait(n);
+    }
+    bool read_wait(unsigned n, bool patient) override {
+        if (!contended())
+            return patient && n <= (1U << 10);
+        return TBackoffContention::read_wait(n, patient);
+    }
+    void finish(bool committed) override {
+        rate_ -= rate_ >> rate_shift;
+        if (!committed)
+            rate_ += one_rate >> rate_shift;
+    }
+    void before_retry(unsigned n) override {
+        if (contended()) {
+            // back off longer the more of our transactions abort
+            unsigned limit = std::min(n + 4, 16U) + (rate_ > one_rate / 4);
+            spin(random() & ((1U << limit) - 1));
+        }
+    }
+    const char* name() const override {
+        return "adaptive";
+    }
+    // current abort rate estimate, as a fraction of one_rate
+    unsigned abort_rate() const {
+        return rate_;
+    }
+private:
+    unsigned low_rate_;
+    unsigned rate_;
+    bool contended() const {
+        return rate_ > low_rate_;
+    }
+};
@@ -0,0 +1,507 @@
+#pragma once
+
+#include <vector>
+#include "Transaction.hh"
+#include "TWrapped.hh"
+
+// A transactional double-ended queue stored in a doubly-linked list of
+// fixed-size segments. It grows at either end without a capacity limit, and
+// segments emptied by pops are released through RCU.
+//
+// The head and the tail have separate versions, so transactions working at
+// opposite ends don't conflict while there are elements between them. A
+// transaction that reads or pops committed elements from one end records
+// how far it reached; at commit it checks that the other end hasn't been
+// popped past that point. Transactions committing at both ends at once each
+// publish their new bound under their own lock before reading the other's,
+// so at least one of them sees any overlap. A transaction that finds the
+// deque empty observes both versions.
+//
+// As in TQueue, pushes go to per-thread buffers reused across transactions,
+// and pops of committed elements are just counts.
+template <typename T, unsigned SegmentSize = 1024,
+          template <typename> class W = TOpaqueWrapped>
+class TDeque: public TObject {
+public:
+    typedef typename W<T>::version_type version_type;
+    typedef uint64_t index_type;
+
+    TDeque()
+        : head_(initial_index), head_bound_(initial_index),
+          tail_(initial_index), tail_bound_(initial_index) {
+        head_seg_ = tail_seg_ = new segment(initial_index);
+    }
+    ~TDeque() {
+        while (head_seg_) {
+            segment* next = head_seg_->next;
+            delete head_seg_;
+            head_seg_ = next;
+        }
+    }
+
+    // NONTRANSACTIONAL CALLS
+    void nontrans_push_back(const T& v) {
+        index_type t = tail_;
+        append(tail_seg_, t, v);
+        release_fence();
+        tail_ = tail_bound_ = t;
+    }
+
+    void nontrans_push_front(const T& v) {
+        index_type h = head_;
+        prepend(head_seg_, h, v);
+        release_fence();
+        head_ = head_bound_ = h;
+    }
+
+    T nontrans_pop_front() {
+        assert(head_ != tail_);
+        T v = head_seg_->slot[head_ - head_seg_->base];
+        advance_head(head_ + 1);
+        head_bound_ = head_;
+        return v;
+    }
+
+    T nontrans_pop_back() {
+        assert(head_ != tail_);
+        retreat_tail(tail_ - 1);
+        tail_bound_ = tail_;
+        return tail_seg_->slot[tail_ - tail_seg_->base];
+    }
+
+    bool nontrans_empty() const {
+        return head_ == tail_;
+    }
+
+    size_t nontrans_size() const {
+        return tail_ - head_;
+    }
+
+    void nontrans_clear() {
+        advance_head(tail_);
+        head_bound_ = head_;
+    }
+
+    // TRANSACTIONAL CALLS
+    void transPushFront(const T& v) {
+        push(head_key, v);
+    }
+
+    void transPushBack(const T& v) {
+        push(tail_key, v);
+    }
+
+    bool transPopFront() {
+        T* slot;
+        index_type index;
+        int where = find_front(slot, index);
+        if (where == at_end)
+            return false;
+        else if (where == in_front_pushes)
+            update_state(head_key, &end_state::pushed, -1);
+        else if (where == in_back_pushes)
+            update_state(tail_key, &end_state::taken, 1);
+        else {
+            update_state(head_key, &end_state::npop, 1);
+            reach(front_reach_key, index + 1);
+        }
+        return true;
+    }
+
+    bool transPopBack() {
+        T* slot;
+        index_type index;
+        int where = find_back(slot, index);
+        if (where == at_end)
+            return false;
+        else if (where == in_back_pushes)
+            update_state(tail_key, &end_state::pushed, -1);
+        else if (where == in_front_pushes)
+            update_state(head_key, &end_state::taken, 1);
+        else {
+            update_state(tail_key, &end_state::npop, 1);
+            reach(back_reach_key, index);
+        }
+        return true;
+    }
+
+    bool transFront(T& val) {
+        T* slot;
+        index_type index;
+        int where = find_front(slot, index);
+        if (where == at_end)
+            return false;
+        if (where == in_deque)
+            reach(front_reach_key, index + 1);
+        val = *slot;
+        return true;
+    }
+
+    bool transBack(T& val) {
+        T* slot;
+        index_type index;
+        int where = find_back(slot, index);
+        if (where == at_end)
+            return false;
+        if (where == in_deque)
+            reach(back_reach_key, index);
+        val = *slot;
+        return true;
+    }
+
+private:
+    static constexpr int head_key = 0;
+    static constexpr int tail_key = 1;
+    // read values: how far the transaction reached into the committed
+    // elements from the front (exclusive) or from the back (inclusive)
+    static constexpr int front_reach_key = 2;
+    static constexpr int back_reach_key = 3;
+    // leaves room to grow in both directions
+    static constexpr index_type initial_index = index_type(1) << 62;
+
+    enum { at_end, in_deque, in_front_pushes, in_back_pushes };
+
+    struct segment {
+        index_type base;
+        segment* prev;
+        segment* next;
+        T slot[SegmentSize];
+
+        segment(index_type b)
+            : base(b), prev(nullptr), next(nullptr) {
+        }
+    };
+
+    // write value of the head and tail items: committed elements popped
+    // from this end, elements pushed at this end, and how many of those
+    // pushes were popped from the other end once the deque looked empty
+    struct end_state {
+        unsigned npop;
+        unsigned pushed;
+        unsigned taken;
+    };
+
+    struct pending_buffer {
+        std::vector<T> v[2];
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    static end_state state(TransProxy& item) {
+        if (item.has_write())
+            return item.template write_value<end_state>();
+        return end_state{0, 0, 0};
+    }
+
+    void update_state(int key, unsigned end_state::* field, int delta) {
+        auto item = Sto::item(this, key);
+        end_state s = state(item);
+        s.*field += delta;
+        item.add_write(s);
+    }
+
+    void push(int key, const T& v) {
+        auto item = Sto::item(this, key);
+        end_state s = state(item);
+        // drop leftovers from earlier transactions and rolled-back pushes
+        auto& buf = pending_[TThread::id()].v[key];
+        buf.resize(s.pushed);
+        buf.push_back(v);
+        ++s.pushed;
+        item.add_write(s);
+    }
+
+    void reach(int key, index_type index) {
+        auto item = Sto::item(this, key);
+        if (!item.has_read())
+            item.add_read(index);
+        else {
+            index_type old = item.template read_value<index_type>();
+            if (key == front_reach_key ? index > old : index < old)
+                item.update_read(old, index);
+        }
+    }
+
+    index_type observe_head(TransProxy& item, segment*& seg) {
+        while (1) {
+            version_type hv = headversion_;
+            fence();
+            index_type h = head_;
+            seg = head_seg_;
+            fence();
+            if (hv == headversion_) {
+                if (item.has_read() && item.template read_value<version_type>() != hv)
+                    Sto::abort();
+                item.observe(hv);
+                return h;
+            }
+            relax_fence();
+        }
+    }
+
+    index_type observe_tail(TransProxy& item, segment*& seg) {
+        while (1) {
+            version_type tv = tailversion_;
+            fence();
+            index_type t = tail_;
+            seg = tail_seg_;
+            fence();
+            if (tv == tailversion_) {
+                if (item.has_read() && item.template read_value<version_type>() != tv)
+                    Sto::abort();
+                item.observe(tv);
+                return t;
+            }
+            relax_fence();
+        }
+    }
+
+    // Points slot at the transaction's front element: its own last front
+    // push, else the first committed element it hasn't popped, else, if it
+    // has seen the whole committed deque, its own first unpopped back push.
+    int find_front(T*& slot, index_type& index) {
+        auto hitem = Sto::item(this, head_key);
+        segment* seg;
+        index_type h = observe_head(hitem, seg);
+        end_state fs = state(hitem);
+        auto& pending = pending_[TThread::id()];
+        if (fs.pushed != fs.taken) {
+            slot = &pending.v[head_key][fs.pushed - 1];
+            return in_front_pushes;
+        }
+
+        index = h + fs.npop;
+        auto titem = Sto::item(this, tail_key);
+        end_state bs = state(titem);
+        segment* tseg;
+        index_type t = titem.has_read() ? observe_tail(titem, tseg) : tail_;
+        if (index + bs.npop >= t) {
+            // looks empty: any push at the back must now conflict
+            t = observe_tail(titem, tseg);
+            if (index + bs.npop >= t) {
+                if (bs.pushed == bs.taken)
+                    return at_end;
+                slot = &pending.v[tail_key][bs.taken];
+                return in_back_pushes;
+            }
+        }
+        acquire_fence();
+        while (index >= seg->base + SegmentSize)
+            if (!(seg = seg->next))
+                Sto::abort();
+        slot = &seg->slot[index - seg->base];
+        return in_deque;
+    }
+
+    int find_back(T*& slot, index_type& index) {
+        auto titem = Sto::item(this, tail_key);
+        segment* seg;
+        index_type t = observe_tail(titem, seg);
+        end_state bs = state(titem);
+        auto& pending = pending_[TThread::id()];
+        if (bs.pushed != bs.taken) {
+            slot = &pending.v[tail_key][bs.pushed - 1];
+            return in_back_pushes;
+        }
+
+        auto hitem = Sto::item(this, head_key);
+        end_state fs = state(hitem);
+        segment* hseg;
+        index_type h = hitem.has_read() ? observe_head(hitem, hseg) : head_;
+        if (h + fs.npop + bs.npop >= t) {
+            // looks empty: any push at the front must now conflict
+            h = observe_head(hitem, hseg);
+            if (h + fs.npop + bs.npop >= t) {
+                if (fs.pushed == fs.taken)
+                    return at_end;
+                slot = &pending.v[head_key][fs.taken];
+                return in_front_pushes;
+            }
+        }
+        index = t - bs.npop - 1;
+        acquire_fence();
+        while (index < seg->base)
+            if (!(seg = seg->prev))
+                Sto::abort();
+        slot = &seg->slot[index - seg->base];
+        return in_deque;
+    }
+
+    // Writes v just before h and moves h down, adding a segment in front of
+    // seg if h is at its start. Callers hold the head lock.
+    void prepend(segment*& seg, index_type& h, const T& v) {
+        if (h == seg->base) {
+            segment* p = new segment(h - SegmentSize);
+            p->next = seg;
+            seg->prev = p;
+            seg = p;
+        }
+        --h;
+        seg->slot[h - seg->base] = v;
+    }
+
+    // Writes v at t and advances t, adding a segment after seg if t reaches
+    // its end. Callers hold the tail lock.
+    void append(segment*& seg, index_type& t, const T& v) {
+        seg->slot[t - seg->base] = v;
+        ++t;
+        if (t == seg->base + SegmentSize) {
+            segment* n = new segment(t);
+            n->prev = seg;
+            seg->next = n;
+            seg = n;
+        }
+    }
+
+    void advance_head(index_type h) {
+        segment* seg = head_seg_;
+        if (h >= seg->base + SegmentSize) {
+            do {
+                segment* next = seg->next;
+                Transaction::rcu_delete(seg);
+                seg = next;
+            } while (h >= seg->base + SegmentSize);
+            seg->prev = nullptr;
+            head_seg_ = seg;
+        }
+        head_ = h;
+    }
+
+    void retreat_tail(index_type t) {
+        segment* seg = tail_seg_;
+        if (t < seg->base) {
+            do {
+                segment* prev = seg->prev;
+                Transaction::rcu_delete(seg);
+                seg = prev;
+            } while (t < seg->base);
+            seg->next = nullptr;
+            tail_seg_ = seg;
+        }
+        tail_ = t;
+    }
+
+    // The lowest the tail can get once the transactions committing now are
+    // done, or 0 if that can't be known yet.
+    index_type tail_limit(Transaction& txn) const {
+        while (1) {
+            version_type tv = tailversion_;
+            // our own pops don't count: they keep what we reached, and
+            // the tail version covers pops that came before our lock
+            if (tv.is_locked_here(txn))
+                return tail_;
+            fence();
+            index_type t = tail_;
+            if (tv.is_locked_elsewhere(txn)) {
+                // the tail's owner published its bound before checking
+                // ours; without the head lock we have no bound to publish
+                if (!headversion_.is_locked_here(txn))
+                    return 0;
+                return tail_bound_;
+            }
+            fence();
+            if (tv == tailversion_)
+                return t;
+            relax_fence();
+        }
+    }
+
+    // The highest the head can get, or the highest index if unknown.
+    index_type head_limit(Transaction& txn) const {
+        while (1) {
+            version_type hv = headversion_;
+            if (hv.is_locked_here(txn))
+                return head_;
+            fence();
+            index_type h = head_;
+            if (hv.is_locked_elsewhere(txn)) {
+                if (!tailversion_.is_locked_here(txn))
+                    return ~index_type(0);
+                return head_bound_;
+            }
+            fence();
+            if (hv == headversion_)
+                return h;
+            relax_fence();
+        }
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        unsigned npop = item.template write_value<end_state>().npop;
+        if (item.key<int>() == head_key) {
+            if (!txn.try_lock(item, headversion_))
+                return false;
+            head_bound_ = head_ + npop;
+        } else {
+            if (!txn.try_lock(item, tailversion_))
+                return false;
+            tail_bound_ = tail_ - npop;
+        }
+        // the bound must be visible before we read the other end's
+        memory_fence();
+        return true;
+    }
+
+    bool check(TransItem& item, Transaction& txn) override {
+        switch (item.key<int>()) {
+        case head_key:
+            return item.check_version(headversion_);
+        case tail_key:
+            return item.check_version(tailversion_);
+        case front_reach_key:
+            return tail_limit(txn) >= item.template read_value<index_type>();
+        default:
+            return head_limit(txn) <= item.template read_value<index_type>();
+        }
+    }
+
+    void install(TransItem& item, Transaction& txn) override {
+        end_state s = item.template write_value<end_state>();
+        if (s.npop == 0 && s.taken == s.pushed)
+            return;
+        int key = item.key<int>();
+        auto& buf = pending_[TThread::id()].v[key];
+        if (key == head_key) {
+            advance_head(head_ + s.npop);
+            index_type h = head_;
+            segment* seg = head_seg_;
+            for (unsigned i = s.taken; i != s.pushed; ++i)
+                prepend(seg, h, buf[i]);
+            head_seg_ = seg;
+            release_fence();
+            head_ = h;
+            headversion_.set_version(txn.commit_tid());
+        } else {
+            retreat_tail(tail_ - s.npop);
+            index_type t = tail_;
+            segment* seg = tail_seg_;
+            for (unsigned i = s.taken; i != s.pushed; ++i)
+                append(seg, t, buf[i]);
+            tail_seg_ = seg;
+            release_fence();
+            tail_ = t;
+            tailversion_.set_version(txn.commit_tid());
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        if (item.key<int>() == head_key) {
+            head_bound_ = head_;
+            release_fence();
+            headversion_.unlock();
+        } else {
+            tail_bound_ = tail_;
+            release_fence();
+            tailversion_.unlock();
+        }
+    }
+
+    index_type head_;
+    segment* head_seg_;
+    index_type head_bound_;
+    version_type headversion_;
+    char pad_[CACHE_LINE_SIZE];
+    index_type tail_;
+    segment* tail_seg_;
+    index_type tail_bound_;
+    version_type tailversion_;
+    pending_buffer pending_[MAX_THREADS];
+};
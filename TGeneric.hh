@@ -1,12 +1,64 @@
 #pragma once
 #include "Transaction.hh"
 #include "TWrapped.hh"
+#include <vector>
 
+// Transactional access to arbitrary words of memory.
+//
+// Words share versions from a hashed table of 2^table_bits entries, so
+// unrelated words that collide conflict with each other. For big heaps,
+// size the table at construction, or give hot allocations a version table
+// of their own with add_region(). conflicts() reports how many validation
+// failures were probably caused by such collisions.
 template <template <typename> class W = TOpaqueWrapped>
 class TBasicGeneric : public TObject {
 public:
     typedef typename W<int>::version_type version_type;
-    static constexpr unsigned table_size = 1 << 15;
+    static constexpr unsigned default_table_bits = 15;
+
+    explicit TBasicGeneric(unsigned table_bits = default_table_bits)
+        : table_(make_table(0, uintptr_t(1) << table_bits, 3)),
+          nconflicts_(0), nfalse_conflicts_(0) {
+        table_.mask = (uintptr_t(1) << table_bits) - 1;
+    }
+    ~TBasicGeneric() {
+        free_table(table_);
+        for (auto& r : regions_)
+            free_table(r);
+    }
+    TBasicGeneric(const TBasicGeneric&) = delete;
+    TBasicGeneric& operator=(const TBasicGeneric&) = delete;
+
+    // Gives the words in [begin, begin + size) a version table of their
+    // own, with one version per 2^grain_bits bytes, so they never collide
+    // with words elsewhere. Not concurrent with transactions on this
+    // object; regions must not overlap.
+    void add_region(void* begin, size_t size, unsigned grain_bits = 3) {
+        uintptr_t b = reinterpret_cast<uintptr_t>(begin);
+        uintptr_t n = ((size + (uintptr_t(1) << grain_bits) - 1) >> grain_bits);
+        version_table t = make_table(b, n, grain_bits);
+        t.end = b + size;
+        regions_.push_back(t);
+    }
+
+    struct conflict_stats {
+        uint64_t conflicts;
+        // failures where the version was last bumped for a different word
+        uint64_t false_conflicts;
+
+        double false_conflict_rate() const {
+            return conflicts ? double(false_conflicts) / conflicts : 0;
+        }
+    };
+    // Counts of failed validations. A transaction that wrote several words
+    // sharing a version is remembered by its last one, so false conflicts
+    // are an estimate.
+    conflict_stats conflicts() const {
+        return conflict_stats{nconflicts_, nfalse_conflicts_};
+    }
+    void reset_conflicts() {
+        nconflicts_ = nfalse_conflicts_ = 0;
+    }
 
     template <typename T>
     T read(T* word) {
@@ -34,13 +86,27 @@ public:
         return vers.is_locked_here() || txn.try_lock(item, vers);
     }
     bool check(TransItem& item, Transaction&) override {
-        return item.check_version(version(item.template key<void*>()));
+        void* word = item.template key<void*>();
+        const version_table& t = table(word);
+        uintptr_t i = t.index(word);
+        if (item.check_version(t.vers[i]))
+            return true;
+        fetch_and_add(&nconflicts_, uint64_t(1));
+        if (t.last_writer[i] != word)
+            fetch_and_add(&nfalse_conflicts_, uint64_t(1));
+        return false;
+    }
+    void prefetch_check(const TransItem& item) const override {
+        prefetch(&version(item.template key<void*>()));
     }
     void install(TransItem& item, Transaction& txn) override {
         void* word = item.template key<void*>();
         void* data = item.template write_value<void*>();
         memcpy(word, &data, item.shifted_user_flags());
-        txn.set_version(version(word));
+        const version_table& t = table(word);
+        uintptr_t i = t.index(word);
+        t.last_writer[i] = word;
+        txn.set_version(t.vers[i]);
     }
     void unlock(TransItem& item) override {
         version_type& vers = version(item.template key<void*>());
@@ -57,10 +123,45 @@ public:
     }
 
 private:
-    version_type table_[table_size];
+    struct version_table {
+        uintptr_t begin;
+        uintptr_t end;
+        unsigned shift;
+        uintptr_t mask;
+        version_type* vers;
+        // the word each version was last bumped for
+        void** last_writer;
+
+        uintptr_t index(void* k) const {
+            return ((reinterpret_cast<uintptr_t>(k) - begin) >> shift) & mask;
+        }
+    };
+
+    version_table table_;
+    std::vector<version_table> regions_;
+    uint64_t nconflicts_;
+    uint64_t nfalse_conflicts_;
 
-    inline version_type& version(void* k) {
-        return table_[(reinterpret_cast<uintptr_t>(k) >> 3) % table_size];
+    static version_table make_table(uintptr_t begin, uintptr_t n, unsigned shift) {
+        return version_table{begin, 0, shift, ~uintptr_t(0),
+                new version_type[n](), new void*[n]()};
+    }
+    static void free_table(version_table& t) {
+        delete[] t.vers;
+        delete[] t.last_writer;
+    }
+
+    // Few regions are expected, so scan them.
+    const version_table& table(void* k) const {
+        uintptr_t a = reinterpret_cast<uintptr_t>(k);
+        for (auto& r : regions_)
+            if (a >= r.begin && a < r.end)
+                return r;
+        return table_;
+    }
+    version_type& version(void* k) const {
+        const version_table& t = table(k);
+        return t.vers[t.index(k)];
     }
 };
 
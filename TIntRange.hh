@@ -50,10 +50,42 @@ struct TIntRange {
     void observe_ge(T value, bool was_ge = true) {
         observe_lt(value, !was_ge);
     }
+    // Records whether value is in [lo, hi], and returns it. For a value
+    // outside, only the side it is on is recorded.
+    bool observe_in(T value, T lo, T hi) {
+        if (!verify(value))
+            Sto::abort();
+        bool in = lo <= value && value <= hi;
+        if (in) {
+            first = std::max(first, lo);
+            second = std::min(second, hi);
+        } else if (value < lo)
+            second = std::min(second, lo - 1);
+        else
+            first = std::max(first, hi + 1);
+        return in;
+    }
     bool verify(T value) const {
         return first <= value && value <= second;
     }
 
+    // The values v for which v + delta doesn't pass bound: at most bound
+    // if delta >= 0, at least bound if not. Returns an empty range
+    // (first > second) if there are none.
+    static TIntRange<T> add_bounded(T delta, T bound) {
+        TIntRange<T> r = unconstrained();
+        if (delta >= T()) {
+            if (bound < r.first + delta)
+                return TIntRange<T>{r.second, r.first};
+            r.second = bound - delta;
+        } else {
+            if (bound > r.second + delta)
+                return TIntRange<T>{r.second, r.first};
+            r.first = bound - delta;
+        }
+        return r;
+    }
+
     friend std::ostream& operator<<(std::ostream& w, const TIntRange<T>& r) {
         return w << '[' << r.first << ',' << r.second << ']';
     }
@@ -0,0 +1,110 @@
+#pragma once
+#include "Transaction.hh"
+#include <vector>
+
+// Runs a batch of transactions on one thread, several at a time, so the
+// cache misses of one overlap with the work of the others. Each in-flight
+// task has its own transaction context (Sto::make_transaction), and the
+// interleaver switches contexts round-robin whenever a task yields.
+//
+// A Task provides
+//     void reset();  // the transaction (re)started: begin from scratch
+//     bool step();   // run to the next yield point; return true once done
+// step() runs inside the task's transaction, so it uses Sto:: calls as
+// usual. A step that is about to touch memory that is likely not cached
+// should prefetch it (see prefetch() in compiler.hh) and return false;
+// the access happens in its next step. Finished tasks commit at
+// once, without switching, so a task never yields while holding locks. A
+// task whose transaction aborts restarts from reset().
+template <typename Task>
+class TInterleaver {
+public:
+    explicit TInterleaver(unsigned width)
+        : slots_(width), restarts_(0) {
+        always_assert(width > 0);
+        for (auto& s : slots_)
+            s.txn = Sto::make_transaction();
+    }
+    ~TInterleaver() {
+        for (auto& s : slots_)
+            Sto::delete_transaction(s.txn);
+    }
+    TInterleaver(const TInterleaver&) = delete;
+    TInterleaver& operator=(const TInterleaver&) = delete;
+
+    unsigned width() const {
+        return slots_.size();
+    }
+    // number of restarts after aborts during the last run()
+    unsigned long long restarts() const {
+        return restarts_;
+    }
+
+    // Run every task in [first, last) to commit, keeping up to width() of
+    // them in flight. Tasks may finish in any order.
+    template <typename It>
+    void run(It first, It last) {
+        Transaction* saved = Sto::swap_transaction(nullptr);
+        restarts_ = 0;
+        try {
+            unsigned nactive;
+            do {
+                nactive = 0;
+                for (auto& s : slots_) {
+                    if (!s.task && first != last) {
+                        s.task = &*first;
+                        ++first;
+                        begin(s);
+                    }
+                    if (s.task) {
+                        ++nactive;
+                        advance(s);
+                    }
+                }
+            } while (nactive);
+        } catch (...) {
+            for (auto& s : slots_)
+                if (s.task) {
+                    s.txn->silent_abort();
+                    s.task = nullptr;
+                }
+            Sto::swap_transaction(saved);
+            throw;
+        }
+        Sto::swap_transaction(saved);
+    }
+
+private:
+    struct slot {
+        Transaction* txn;
+        Task* task;
+        slot()
+            : txn(nullptr), task(nullptr) {
+        }
+    };
+    std::vector<slot> slots_;
+    unsigned long long restarts_;
+
+    void begin(slot& s) {
+        Sto::swap_transaction(s.txn);
+        Sto::start_transaction();
+        s.task->reset();
+    }
+    void advance(slot& s) {
+        Sto::swap_transaction(s.txn);
+        try {
+            if (!s.task->step())
+                return;
+            if (s.txn->try_commit()) {
+                s.task = nullptr;
+                return;
+            }
+        } catch (Transaction::Abort&) {
+        }
+        // try_commit and aborting operations leave the context stopped
+        if (s.txn->in_progress())
+            s.txn->silent_abort();
+        ++restarts_;
+        begin(s);
+    }
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include "Interface.hh"
+#include "TWrapped.hh"
+
+// A TBox for large values, such as configuration blobs, that are read
+// often and overwritten rarely.
+//
+// The box holds a pointer to its value. Reads return a reference to the
+// value itself, which stays valid for the rest of the transaction because
+// replaced values are freed through RCU. A write builds the new value in
+// a private heap copy, which later writes and modify() update in place,
+// and commit just swaps the copy in. So no read or commit copies T.
+template <typename T, bool Opaque = true>
+class TLargeBox : public TObject {
+public:
+    typedef const T& read_type;
+    typedef typename std::conditional<Opaque, TVersion, TNonopaqueVersion>::type version_type;
+
+    template <typename... Args>
+    explicit TLargeBox(Args&&... args)
+        : vp_(new T(std::forward<Args>(args)...)) {
+    }
+    ~TLargeBox() {
+        Transaction::rcu_delete(vp_);
+    }
+
+    const T& read() const {
+        auto item = Sto::item(this, 0);
+        if (item.has_write())
+            return *item.template write_value<T*>();
+        else
+            return *TWrappedAccess::read_atomic(&vp_, item, vers_, true);
+    }
+    void write(const T& x) {
+        auto item = Sto::item(this, 0);
+        if (item.has_write())
+            *item.template write_value<T*>() = x;
+        else
+            item.add_write(new T(x));
+    }
+    void write(T&& x) {
+        auto item = Sto::item(this, 0);
+        if (item.has_write())
+            *item.template write_value<T*>() = std::move(x);
+        else
+            item.add_write(new T(std::move(x)));
+    }
+    // Returns this transaction's copy of the value, to update in place.
+    // The first call copies the current value, observing it.
+    T& modify() {
+        auto item = Sto::item(this, 0);
+        if (!item.has_write())
+            item.add_write(new T(*TWrappedAccess::read_atomic(&vp_, item, vers_, true)));
+        return *item.template write_value<T*>();
+    }
+
+    operator read_type() const {
+        return read();
+    }
+    TLargeBox<T, Opaque>& operator=(const T& x) {
+        write(x);
+        return *this;
+    }
+    TLargeBox<T, Opaque>& operator=(T&& x) {
+        write(std::move(x));
+        return *this;
+    }
+    TLargeBox<T, Opaque>& operator=(const TLargeBox<T, Opaque>& x) {
+        write(x.read());
+        return *this;
+    }
+
+    const T& nontrans_read() const {
+        return *vp_;
+    }
+    T& nontrans_access() {
+        return *vp_;
+    }
+    void nontrans_write(const T& x) {
+        *vp_ = x;
+    }
+    void nontrans_write(T&& x) {
+        *vp_ = std::move(x);
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, vers_);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(vers_);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        T* old = vp_;
+        vp_ = item.template write_value<T*>();
+        Transaction::rcu_delete(old);
+        txn.set_version_unlock(vers_, item);
+    }
+    void unlock(TransItem&) override {
+        vers_.unlock();
+    }
+    void cleanup(TransItem& item, bool committed) override {
+        // a committed copy now belongs to the box
+        if (!committed)
+            delete item.template write_value<T*>();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{TLargeBox<" << typeid(T).name() << "> " << (void*) this;
+        if (item.has_read())
+            w << " R" << item.read_value<version_type>();
+        if (item.has_write())
+            w << " =" << (void*) item.write_value<T*>();
+        w << "}";
+    }
+
+private:
+    version_type vers_;
+    T* vp_;
+};
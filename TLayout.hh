@@ -0,0 +1,206 @@
+#pragma once
+#include <string.h>
+#include "Transaction.hh"
+
+// Element layouts for arrays of versioned values (TArray, TVector).
+// - packed: each value right after its version. Compact, but neighbouring
+//   elements share cache lines, so writers of different elements contend
+//   for them.
+// - padded: each element starts a cache line of its own.
+// - split: versions in one array and values in another. Values are
+//   contiguous and validation scans only versions, but writers of
+//   neighbouring elements still share version cache lines.
+enum class TLayout { packed, padded, split };
+
+namespace TLayoutImpl {
+template <typename V, typename WT, bool Padded> struct elem {
+    V vers;
+    WT v;
+};
+template <typename V, typename WT> struct elem<V, WT, true> {
+    V vers;
+    WT v;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// n elements in use, of bytes allocated
+template <typename V, typename WT>
+inline footprint elems_footprint(size_t n, size_t bytes) {
+    footprint f;
+    f.versions = n * sizeof(V);
+    f.data = n * sizeof(WT);
+    f.index = bytes - f.versions - f.data;
+    return f;
+}
+
+template <typename T>
+inline T* align(char* p) {
+    return reinterpret_cast<T*>((uintptr_t(p) + alignof(T) - 1) & ~uintptr_t(alignof(T) - 1));
+}
+}
+
+// N elements laid out as L.
+template <typename V, typename WT, unsigned N, TLayout L>
+class TFixedElems {
+public:
+    V& vers(unsigned i) {
+        return e_[i].vers;
+    }
+    const V& vers(unsigned i) const {
+        return e_[i].vers;
+    }
+    WT& value(unsigned i) {
+        return e_[i].v;
+    }
+    const WT& value(unsigned i) const {
+        return e_[i].v;
+    }
+    footprint memory_footprint() const {
+        return TLayoutImpl::elems_footprint<V, WT>(N, sizeof(*this));
+    }
+
+private:
+    TLayoutImpl::elem<V, WT, L == TLayout::padded> e_[N];
+};
+
+template <typename V, typename WT, unsigned N>
+class TFixedElems<V, WT, N, TLayout::split> {
+public:
+    V& vers(unsigned i) {
+        return vers_[i];
+    }
+    const V& vers(unsigned i) const {
+        return vers_[i];
+    }
+    WT& value(unsigned i) {
+        return v_[i];
+    }
+    const WT& value(unsigned i) const {
+        return v_[i];
+    }
+    footprint memory_footprint() const {
+        return TLayoutImpl::elems_footprint<V, WT>(N, sizeof(*this));
+    }
+
+private:
+    V vers_[N];
+    WT v_[N] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+// Room for a growable number of elements laid out as L. Versions start
+// as `init`; the owner constructs and destroys values. Large rooms get
+// huge pages per TPages::policy().
+template <typename V, typename WT, TLayout L>
+class TDynamicElems {
+    typedef TLayoutImpl::elem<V, WT, L == TLayout::padded> elem;
+public:
+    TDynamicElems(unsigned capacity, V init)
+        : raw_(allocate(capacity)) {
+        e_ = TLayoutImpl::align<elem>(raw_);
+        for (unsigned i = 0; i != capacity; ++i)
+            e_[i].vers = init;
+    }
+    ~TDynamicElems() {
+        TPages::free(raw_);
+    }
+
+    V& vers(unsigned i) {
+        return e_[i].vers;
+    }
+    const V& vers(unsigned i) const {
+        return e_[i].vers;
+    }
+    WT& value(unsigned i) {
+        return e_[i].v;
+    }
+    const WT& value(unsigned i) const {
+        return e_[i].v;
+    }
+
+    // size elements in use, of room for capacity
+    footprint memory_footprint(unsigned size, unsigned capacity) const {
+        return TLayoutImpl::elems_footprint<V, WT>(size, sizeof(elem) * capacity + alignof(elem) - 1);
+    }
+
+    // Moves the elements bytewise to room for new_capacity. Concurrent
+    // readers may still use the old room, which is freed after RCU.
+    void grow(unsigned capacity, unsigned new_capacity, V init) {
+        char* raw = allocate(new_capacity);
+        elem* e = TLayoutImpl::align<elem>(raw);
+        memcpy(static_cast<void*>(e), e_, sizeof(elem) * capacity);
+        for (unsigned i = capacity; i != new_capacity; ++i)
+            e[i].vers = init;
+        Transaction::rcu_free_pages(raw_);
+        raw_ = raw;
+        e_ = e;
+    }
+
+private:
+    char* raw_;
+    elem* e_;
+
+    static char* allocate(unsigned capacity) {
+        return static_cast<char*>(TPages::allocate(sizeof(elem) * capacity + alignof(elem) - 1));
+    }
+};
+
+template <typename V, typename WT>
+class TDynamicElems<V, WT, TLayout::split> {
+public:
+    TDynamicElems(unsigned capacity, V init)
+        : raw_(allocate(capacity)) {
+        place(raw_, capacity);
+        for (unsigned i = 0; i != capacity; ++i)
+            vers_[i] = init;
+    }
+    ~TDynamicElems() {
+        TPages::free(raw_);
+    }
+
+    V& vers(unsigned i) {
+        return vers_[i];
+    }
+    const V& vers(unsigned i) const {
+        return vers_[i];
+    }
+    WT& value(unsigned i) {
+        return v_[i];
+    }
+    const WT& value(unsigned i) const {
+        return v_[i];
+    }
+
+    footprint memory_footprint(unsigned size, unsigned capacity) const {
+        return TLayoutImpl::elems_footprint<V, WT>(size, CACHE_LINE_SIZE - 1 + values_offset(capacity) + sizeof(WT) * capacity);
+    }
+
+    void grow(unsigned capacity, unsigned new_capacity, V init) {
+        char* old_raw = raw_;
+        V* old_vers = vers_;
+        WT* old_v = v_;
+        raw_ = allocate(new_capacity);
+        place(raw_, new_capacity);
+        memcpy(vers_, old_vers, sizeof(V) * capacity);
+        memcpy(static_cast<void*>(v_), old_v, sizeof(WT) * capacity);
+        for (unsigned i = capacity; i != new_capacity; ++i)
+            vers_[i] = init;
+        Transaction::rcu_free_pages(old_raw);
+    }
+
+private:
+    char* raw_;
+    V* vers_;
+    WT* v_;
+
+    // versions, then values starting on a new cache line
+    static size_t values_offset(unsigned capacity) {
+        return (sizeof(V) * capacity + CACHE_LINE_SIZE - 1) & ~size_t(CACHE_LINE_SIZE - 1);
+    }
+    static char* allocate(unsigned capacity) {
+        return static_cast<char*>(TPages::allocate(CACHE_LINE_SIZE - 1 + values_offset(capacity) + sizeof(WT) * capacity));
+    }
+    void place(char* raw, unsigned capacity) {
+        char* p = reinterpret_cast<char*>((uintptr_t(raw) + CACHE_LINE_SIZE - 1) & ~uintptr_t(CACHE_LINE_SIZE - 1));
+        vers_ = reinterpret_cast<V*>(p);
+        v_ = reinterpret_cast<WT*>(p + values_offset(capacity));
+    }
+};
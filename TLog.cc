@@ -0,0 +1,305 @@
+#include "TLog.hh"
+#include "Transaction.hh"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+
+bool TLog::enabled_;
+bool TLog::failed_;
+std::string TLog::dir_;
+int TLog::epoch_fd_ = -1;
+uint64_t TLog::epoch_base_;
+volatile uint64_t TLog::durable_epoch_;
+std::function<void(uint64_t)> TLog::durable_callback;
+std::function<void(uint64_t, const char*, size_t)> TLog::batch_callback;
+static std::mutex flush_lock;
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t r = ::write(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        else if (r < 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool read_file(const std::string& path, std::vector<char>& buf) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    buf.clear();
+    char tmp[65536];
+    ssize_t r;
+    while ((r = ::read(fd, tmp, sizeof(tmp))) != 0)
+        if (r > 0)
+            buf.insert(buf.end(), tmp, tmp + r);
+        else if (errno != EINTR)
+            break;
+    ::close(fd);
+    return r == 0;
+}
+
+// Length of the prefix of log data made of whole records from epochs
+// <= durable. Each thread logs records in nondecreasing epoch order.
+static size_t durable_prefix(const char* p, size_t n, uint64_t durable) {
+    size_t pos = 0;
+    while (n - pos >= TLogBuffer::record_header_size) {
+        uint64_t epoch;
+        uint32_t len;
+        memcpy(&epoch, p + pos, 8);
+        memcpy(&len, p + pos + 16, 4);
+        if (epoch > durable || n - pos - TLogBuffer::record_header_size < len)
+            break;
+        pos += TLogBuffer::record_header_size + len;
+    }
+    return pos;
+}
+
+struct log_record {
+    uint64_t tid;
+    const char* p;
+    size_t n;
+};
+
+// Appends the whole records in [p, p + n) to records.
+static void index_records(const char* p, size_t n, std::vector<log_record>& records) {
+    for (size_t pos = 0; pos != n; ) {
+        uint64_t tid;
+        uint32_t len;
+        memcpy(&tid, p + pos + 8, 8);
+        memcpy(&len, p + pos + 16, 4);
+        size_t rn = TLogBuffer::record_header_size + len;
+        records.push_back(log_record{tid, p + pos, rn});
+        pos += rn;
+    }
+}
+
+static void sort_records(std::vector<log_record>& records) {
+    std::stable_sort(records.begin(), records.end(),
+                     [](const log_record& a, const log_record& b) { return a.tid < b.tid; });
+}
+
+static bool read_durable_epoch(const std::string& dir, uint64_t& e) {
+    std::vector<char> buf;
+    e = 0;
+    if (!read_file(dir + "/epoch", buf))
+        return errno == ENOENT;
+    if (buf.size() >= 8)
+        memcpy(&e, buf.data(), 8);
+    return true;
+}
+
+static std::vector<std::string> log_files(const std::string& dir) {
+    std::vector<std::string> files;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (struct dirent* de = readdir(d))
+            if (strncmp(de->d_name, "log.", 4) == 0)
+                files.push_back(dir + "/" + de->d_name);
+        closedir(d);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+TLogBuffer::~TLogBuffer() {
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool TLogBuffer::write_out(bool ship) {
+    // records are appended under the lock, so out_ holds whole records
+    lock();
+    out_.swap(buf_);
+    unlock();
+    if (out_.empty())
+        return true;
+    bool ok = fd_ >= 0 && write_all(fd_, out_.data(), out_.size())
+        && fdatasync(fd_) == 0;
+    if (ship)
+        ship_.insert(ship_.end(), out_.begin(), out_.end());
+    out_.clear();
+    return ok;
+}
+
+bool TLog::open(const char* dir) {
+    always_assert(!enabled_);
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        return false;
+    dir_ = dir;
+    uint64_t durable;
+    if (!read_durable_epoch(dir_, durable))
+        return false;
+    // drop records a crash left behind past the durable epoch
+    std::vector<char> buf;
+    for (auto& path : log_files(dir_)) {
+        if (!read_file(path, buf))
+            return false;
+        size_t n = durable_prefix(buf.data(), buf.size(), durable);
+        if (n != buf.size() && truncate(path.c_str(), n) != 0)
+            return false;
+    }
+    epoch_fd_ = ::open((dir_ + "/epoch").c_str(), O_RDWR | O_CREAT, 0666);
+    if (epoch_fd_ < 0)
+        return false;
+    // every new log epoch exceeds the durable one
+    epoch_base_ = durable;
+    durable_epoch_ = durable;
+    failed_ = false;
+    release_fence();
+    enabled_ = true;
+    return true;
+}
+
+bool TLog::close() {
+    std::lock_guard<std::mutex> guard(flush_lock);
+    if (!enabled_)
+        return true;
+    bool ok = flush_locked(true);
+    enabled_ = false;
+    for (unsigned i = 0; i != Transaction::used_threads(); ++i) {
+        delete Transaction::tinfo[i].log;
+        Transaction::tinfo[i].log = nullptr;
+    }
+    ::close(epoch_fd_);
+    epoch_fd_ = -1;
+    return ok;
+}
+
+TLogBuffer* TLog::make_buffer(unsigned threadid) {
+    std::string path = dir_ + "/log." + std::to_string(threadid);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd < 0) {
+        // durability can't advance past this thread's records
+        perror(path.c_str());
+        failed_ = true;
+    }
+    return new TLogBuffer(fd);
+}
+
+bool TLog::write_durable_epoch(uint64_t e) {
+    return pwrite(epoch_fd_, &e, 8, 0) == 8 && fdatasync(epoch_fd_) == 0;
+}
+
+bool TLog::flush(bool all) {
+    std::lock_guard<std::mutex> guard(flush_lock);
+    return flush_locked(all);
+}
+
+bool TLog::flush_locked(bool all) {
+    if (!enabled_ || failed_)
+        return false;
+    // Commits read the global epoch after locking, and no thread's epoch
+    // is later than its commits' epochs, so every record from epochs
+    // before the active epoch is already in a buffer.
+    auto& epochs = Transaction::global_epochs;
+    uint64_t active = epochs.active_epoch;
+    uint64_t closed = all ? epochs.global_epoch : (active ? active - 1 : 0);
+    acquire_fence();
+    bool ok = true;
+    bool ship = bool(batch_callback);
+    for (unsigned i = 0; i != Transaction::used_threads(); ++i)
+        if (TLogBuffer* b = Transaction::tinfo[i].log)
+            ok = b->write_out(ship) && ok;
+    uint64_t d = log_epoch(closed);
+    if (ok && closed && d > durable_epoch_) {
+        ok = write_durable_epoch(d);
+        if (ok) {
+            durable_epoch_ = d;
+            if (ship)
+                ship_batch(d);
+            if (durable_callback)
+                durable_callback(d);
+        }
+    }
+    if (!ok)
+        failed_ = true;
+    return ok;
+}
+
+void TLog::ship_batch(uint64_t d) {
+    // each buffer's records up to d form a prefix, as in the log files
+    unsigned nthreads = Transaction::used_threads();
+    std::vector<log_record> records;
+    std::vector<size_t> taken(nthreads, 0);
+    size_t total = 0;
+    for (unsigned i = 0; i != nthreads; ++i)
+        if (TLogBuffer* b = Transaction::tinfo[i].log) {
+            std::vector<char>& v = b->shipped();
+            taken[i] = durable_prefix(v.data(), v.size(), d);
+            index_records(v.data(), taken[i], records);
+            total += taken[i];
+        }
+    sort_records(records);
+    std::vector<char> batch;
+    batch.reserve(total);
+    for (auto& r : records)
+        batch.insert(batch.end(), r.p, r.p + r.n);
+    for (unsigned i = 0; i != nthreads; ++i)
+        if (taken[i]) {
+            std::vector<char>& v = Transaction::tinfo[i].log->shipped();
+            v.erase(v.begin(), v.begin() + taken[i]);
+        }
+    batch_callback(d, batch.data(), batch.size());
+}
+
+void TLog::wait_durable(uint64_t epoch) {
+    while (durable_epoch_ < epoch && !failed_)
+        usleep(std::max(Transaction::epoch_interval_min_us / 4, 10U));
+}
+
+int64_t TLog::replay(const char* dir, const std::function<void(const entry&)>& f) {
+    uint64_t durable;
+    if (!read_durable_epoch(dir, durable))
+        return -1;
+    std::vector<std::vector<char>> bufs;
+    std::vector<log_record> records;
+    for (auto& path : log_files(dir)) {
+        bufs.emplace_back();
+        if (!read_file(path, bufs.back()))
+            return -1;
+        const char* p = bufs.back().data();
+        index_records(p, durable_prefix(p, bufs.back().size(), durable), records);
+    }
+    sort_records(records);
+    for (auto& r : records)
+        if (!for_each_entry(r.p, r.n, f))
+            return -1;
+    return durable;
+}
+
+bool TLog::for_each_entry(const char* p, size_t n, const std::function<void(const entry&)>& f) {
+    const char* end = p + n;
+    while (p != end) {
+        entry e;
+        uint32_t len;
+        if (size_t(end - p) < TLogBuffer::record_header_size)
+            return false;
+        memcpy(&e.epoch, p, 8);
+        memcpy(&e.tid, p + 8, 8);
+        memcpy(&len, p + 16, 4);
+        p += TLogBuffer::record_header_size;
+        if (size_t(end - p) < len)
+            return false;
+        const char* rend = p + len;
+        while (p != rend) {
+            if (size_t(rend - p) < TLogBuffer::entry_header_size)
+                return false;
+            memcpy(&e.id, p, 8);
+            memcpy(&e.key, p + 8, 8);
+            memcpy(&e.length, p + 16, 4);
+            e.data = p + TLogBuffer::entry_header_size;
+            if (size_t(rend - e.data) < e.length)
+                return false;
+            f(e);
+            p = e.data + e.length;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,203 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Optional redo log for durability, with epoch-based group commit as in
+// Silo. After TLog::open, committing transactions append their writes to
+// per-thread buffers: TObjects with a log id (e.g. TBox::set_log_id) call
+// Transaction::log_write from install(). The epoch advancer writes and
+// fsyncs every buffer once per epoch, then advances the durable epoch. A
+// committed transaction is durable once TLog::durable_epoch() reaches its
+// Sto::commit_epoch(); clients can wait for that or get notified through
+// TLog::durable_callback.
+//
+// Thread i logs to <dir>/log.<i>: a sequence of transaction records, each
+//     uint64_t epoch, uint64_t commit tid, uint32_t entry bytes, entries
+// where each entry is
+//     uint64_t object log id, uint64_t key, uint32_t length, data.
+// <dir>/epoch holds the durable epoch as a uint64_t. Records from later
+// epochs may be partially written and are ignored by TLog::replay, and
+// trimmed when a log is reopened.
+//
+// Setting TLog::batch_callback also hands each newly durable epoch's
+// records, in commit TID order, to the callback; TReplicator (see
+// TReplication.hh) ships these batches to replicas.
+
+// Encodes values of type T into log entries. The default copies the
+// bytes of trivially copyable types; specialize TLogCodec<T, false> to
+// log other types.
+template <typename T, bool = mass::is_trivially_copyable<T>::value>
+struct TLogCodec {
+    static constexpr bool supported = true;
+    static size_t size(const T&) {
+        return sizeof(T);
+    }
+    static void encode(char* p, const T& x) {
+        memcpy(p, &x, sizeof(T));
+    }
+    static T decode(const char* p, size_t len) {
+        T x;
+        always_assert(len == sizeof(T));
+        memcpy(&x, p, sizeof(T));
+        return x;
+    }
+};
+
+template <typename T>
+struct TLogCodec<T, false> {
+    static constexpr bool supported = false;
+    static size_t size(const T&) {
+        return 0;
+    }
+    static void encode(char*, const T&) {
+    }
+};
+
+template <>
+struct TLogCodec<std::string, false> {
+    static constexpr bool supported = true;
+    static size_t size(const std::string& x) {
+        return x.size();
+    }
+    static void encode(char* p, const std::string& x) {
+        memcpy(p, x.data(), x.size());
+    }
+    static std::string decode(const char* p, size_t len) {
+        return std::string(p, len);
+    }
+};
+
+// One thread's log buffer. The thread appends a record per committing
+// transaction while the epoch advancer writes out what has accumulated;
+// a small lock, held for the duration of each record, keeps them apart.
+class TLogBuffer {
+public:
+    static constexpr size_t record_header_size = 20;
+    static constexpr size_t entry_header_size = 20;
+
+    explicit TLogBuffer(int fd)
+        : locked_(false), fd_(fd), record_(0) {
+    }
+    ~TLogBuffer();
+    TLogBuffer(const TLogBuffer&) = delete;
+    TLogBuffer& operator=(const TLogBuffer&) = delete;
+
+    void begin_record(uint64_t epoch, uint64_t tid) {
+        lock();
+        record_ = buf_.size();
+        buf_.resize(record_ + record_header_size);
+        char* p = buf_.data() + record_;
+        memcpy(p, &epoch, 8);
+        memcpy(p + 8, &tid, 8);
+    }
+    // returns space for len bytes of entry data
+    char* append_entry(uint64_t id, uint64_t key, uint32_t len) {
+        size_t pos = buf_.size();
+        buf_.resize(pos + entry_header_size + len);
+        char* p = buf_.data() + pos;
+        memcpy(p, &id, 8);
+        memcpy(p + 8, &key, 8);
+        memcpy(p + 16, &len, 4);
+        return p + entry_header_size;
+    }
+    void end_record() {
+        uint32_t n = buf_.size() - record_ - record_header_size;
+        memcpy(buf_.data() + record_ + 16, &n, 4);
+        unlock();
+    }
+
+    // Write out and sync everything appended so far, keeping a copy in
+    // shipped() if ship. Epoch advancer only.
+    bool write_out(bool ship = false);
+    // records written out but not yet handed to TLog::batch_callback
+    std::vector<char>& shipped() {
+        return ship_;
+    }
+
+private:
+    bool locked_;
+    int fd_;
+    size_t record_;
+    std::vector<char> buf_;
+    std::vector<char> out_;
+    std::vector<char> ship_;
+
+    void lock() {
+        while (locked_ || !bool_cmpxchg(&locked_, false, true))
+            relax_fence();
+    }
+    void unlock() {
+        release_fence();
+        locked_ = false;
+    }
+};
+
+class TLog {
+public:
+    struct entry {
+        uint64_t epoch;
+        uint64_t tid;
+        uint64_t id;
+        uint64_t key;
+        const char* data;
+        uint32_t length;
+    };
+
+    // Start logging to directory dir, creating it if needed. Logs left
+    // there are trimmed to their durable prefix and extended, and epochs
+    // continue from the durable one. Call before any thread commits.
+    // Returns false (with errno set) on error.
+    static bool open(const char* dir);
+    // Make everything logged so far durable and stop logging. Call once
+    // no transactions are running.
+    static bool close();
+    static bool enabled() {
+        return enabled_;
+    }
+
+    // Write out every thread's buffer and advance the durable epoch as far
+    // as is safe. The epoch advancer calls this after each epoch; `all`
+    // assumes no transactions are running. Returns false on I/O error.
+    static bool flush(bool all = false);
+    static uint64_t durable_epoch() {
+        return durable_epoch_;
+    }
+    // Sleep until durable_epoch() >= epoch; needs the epoch advancer.
+    static void wait_durable(uint64_t epoch);
+    // called by flush with each new durable epoch
+    static std::function<void(uint64_t)> durable_callback;
+    // If set, called by flush with each new durable epoch e and the
+    // records (in the log file format) of epochs up to e not passed
+    // before, in commit TID order. Set before TLog::open.
+    static std::function<void(uint64_t e, const char* p, size_t n)> batch_callback;
+
+    // Call f for every durable entry logged in dir, by transaction in
+    // commit TID order. Returns the durable epoch (0 if there is no log),
+    // or -1 on error.
+    static int64_t replay(const char* dir, const std::function<void(const entry&)>& f);
+    // Call f for every entry of the records in [p, p + n), in order.
+    // Returns false if they are malformed.
+    static bool for_each_entry(const char* p, size_t n, const std::function<void(const entry&)>& f);
+
+    // log epoch of transactions committing in global epoch e
+    static uint64_t log_epoch(uint64_t e) {
+        return epoch_base_ + e;
+    }
+    static TLogBuffer* make_buffer(unsigned threadid);
+
+private:
+    static bool enabled_;
+    static bool failed_; // an I/O error stopped the durable epoch
+    static std::string dir_;
+    static int epoch_fd_;
+    static uint64_t epoch_base_;
+    static volatile uint64_t durable_epoch_;
+
+    static bool flush_locked(bool all);
+    static void ship_batch(uint64_t d);
+    static bool write_durable_epoch(uint64_t e);
+};
@@ -0,0 +1,267 @@
+#include "TMetrics.hh"
+#include "Transaction.hh"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+volatile bool TMetrics::active_;
+unsigned TMetrics::interval_us_ = 1000000;
+uint64_t TMetrics::last_us_;
+std::string TMetrics::path_;
+std::mutex TMetrics::mu_;
+std::string TMetrics::snapshot_;
+int TMetrics::listen_fd_ = -1;
+volatile bool TMetrics::serving_;
+std::thread TMetrics::server_;
+
+namespace {
+void appendf(std::string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list val;
+    va_start(val, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, val);
+    va_end(val);
+    out.append(buf, std::min(n, int(sizeof(buf)) - 1));
+}
+
+void header(std::string& out, const char* name, const char* type, const char* help) {
+    appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metric(std::string& out, const char* name, const char* type,
+            const char* help, double v) {
+    header(out, name, type, help);
+    appendf(out, "%s %.17g\n", name, v);
+}
+
+// log_histogram buckets regrouped at powers of two, in seconds
+void histogram(std::string& out, const char* name, const char* help,
+               const log_histogram& h, tc_counter_type sum_ticks) {
+    header(out, name, "histogram", help);
+    double ticks_per_s = tsc_ghz() * 1e9;
+    unsigned long long n = 0;
+    unsigned b = 0;
+    for (unsigned e = log_histogram::sub_bits; e <= log_histogram::max_bits; ++e) {
+        uint64_t bound = uint64_t(1) << e;
+        for (; b != log_histogram::nbuckets && log_histogram::bucket_high(b) <= bound; ++b)
+            n += h.count(b);
+        appendf(out, "%s_bucket{le=\"%g\"} %llu\n", name, bound / ticks_per_s, n);
+    }
+    for (; b != log_histogram::nbuckets; ++b)
+        n += h.count(b);
+    appendf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, n);
+    appendf(out, "%s_sum %.17g\n%s_count %llu\n", name, sum_ticks / ticks_per_s, name, n);
+}
+
+uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t r = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == ENOTSOCK)
+            r = ::write(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        else if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+}
+
+std::string TMetrics::render() {
+    Transaction::counter_snapshot s = Transaction::counters_snapshot();
+    std::string out;
+
+    uint64_t starts = s.p.p(txp_total_starts), aborts = s.p.p(txp_total_aborts);
+    metric(out, "sto_transaction_starts_total", "counter",
+           "Transaction attempts started, including retries.", starts);
+    metric(out, "sto_transaction_commits_total", "counter",
+           "Transactions committed.", starts - std::min(aborts, starts));
+    header(out, "sto_transaction_aborts_total", "counter",
+           "Transaction attempts aborted, by reason.");
+    for (int r = 0; r != ar_count; ++r) {
+        unsigned long long n = 0;
+        for (auto& sl : s.aborts.slots_)
+            n += sl.n[r];
+        std::string reason = abort_counters::reason_name(r);
+        std::replace(reason.begin(), reason.end(), ' ', '_');
+        appendf(out, "sto_transaction_aborts_total{reason=\"%s\"} %llu\n",
+                reason.c_str(), n);
+    }
+    static const struct { int p; const char* name; const char* help; } counters[] = {
+        {txp_early_aborts, "sto_early_aborts_total", "Aborts by incremental validation."},
+        {txp_nested_retries, "sto_nested_retries_total", "Nested transaction retries."},
+        {txp_total_fallbacks, "sto_fallbacks_total", "Attempts run holding the fallback token."},
+        {txp_htm_commits, "sto_htm_commits_total", "Commits inside a hardware transaction."},
+        {txp_admission_waits, "sto_admission_waits_total", "Times a thread parked in admission control."},
+        {txp_rcu_eager, "sto_rcu_eager_total", "Eager RCU reclamations."}
+    };
+    for (auto& c : counters)
+        metric(out, c.name, "counter", c.help, s.p.p(c.p));
+
+    static const struct { int tc; const char* name; const char* help; } latencies[] = {
+        {tc_transaction, "sto_transaction_latency_seconds", "TRANSACTION loop latency, with retries."},
+        {tc_commit, "sto_commit_latency_seconds", "Commit latency."},
+        {tc_abort, "sto_abort_latency_seconds", "Abort latency."}
+    };
+    for (auto& l : latencies)
+        histogram(out, l.name, l.help, s.latency[l.tc], s.tc.tcs_[l.tc]);
+
+    Transaction::rcu_backlog_stats rcu = Transaction::rcu_backlog_combined();
+    metric(out, "sto_rcu_backlog", "gauge",
+           "RCU elements waiting to be freed.", rcu.total);
+    metric(out, "sto_rcu_backlog_max", "gauge",
+           "Largest per-thread RCU backlog.", rcu.max);
+    metric(out, "sto_global_epoch", "gauge", "Global epoch.",
+           Transaction::global_epochs.global_epoch);
+    metric(out, "sto_active_epoch", "gauge", "Oldest epoch a thread may be in.",
+           Transaction::global_epochs.active_epoch);
+    metric(out, "sto_epoch_interval_seconds", "gauge",
+           "Epoch advancer sleep between epochs.",
+           Transaction::global_epochs.interval_us / 1e6);
+    metric(out, "sto_recent_commit_tid", "gauge",
+           "Commit TID clock at the last epoch.",
+           Transaction::global_epochs.recent_tid);
+    if (TLog::enabled())
+        metric(out, "sto_log_durable_epoch", "gauge",
+               "Latest durable log epoch.", TLog::durable_epoch());
+    if (TAdmission* a = Transaction::admission)
+        metric(out, "sto_admission_limit", "gauge",
+               "Admission control cap, or 0 if open.", a->limit());
+    return out;
+}
+
+void TMetrics::enable_counters() {
+    // commits are starts minus aborts, both level 1 counters
+    threadinfo_t::default_profile_level = std::max(threadinfo_t::default_profile_level, uint8_t(1));
+    for (unsigned i = 0; i != Transaction::max_threads(); ++i)
+        Transaction::tinfo[i].profile_level = std::max(Transaction::tinfo[i].profile_level, uint8_t(1));
+}
+
+void TMetrics::export_file(const char* path, unsigned interval_us) {
+    enable_counters();
+    {
+        std::lock_guard<std::mutex> guard(mu_);
+        path_ = path;
+        interval_us_ = interval_us;
+    }
+    active_ = true;
+}
+
+void TMetrics::epoch_tick() {
+    if (active_ && now_us() - last_us_ >= interval_us_)
+        refresh();
+}
+
+void TMetrics::refresh() {
+    last_us_ = now_us();
+    std::string s = render();
+    std::lock_guard<std::mutex> guard(mu_);
+    if (!path_.empty()) {
+        std::string tmp = path_ + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            bool ok = write_all(fd, s.data(), s.size());
+            if (close(fd) == 0 && ok)
+                rename(tmp.c_str(), path_.c_str());
+            else
+                unlink(tmp.c_str());
+        }
+    }
+    snapshot_.swap(s);
+}
+
+int TMetrics::serve(int port, bool any_address) {
+    if (serving_)
+        return -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(any_address ? INADDR_ANY : INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&sin), sizeof(sin)) != 0
+        || listen(fd, 16) != 0
+        || getsockname(fd, reinterpret_cast<struct sockaddr*>(&sin), &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    enable_counters();
+    listen_fd_ = fd;
+    serving_ = active_ = true;
+    server_ = std::thread(serve_loop);
+    return ntohs(sin.sin_port);
+}
+
+void TMetrics::serve_loop() {
+    // poll so that stop() needn't wait for a client
+    while (serving_) {
+        struct pollfd pfd = {listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        int c = accept(listen_fd_, nullptr, nullptr);
+        if (c < 0)
+            continue;
+        // any request gets the snapshot; read its head and ignore it
+        struct timeval tv = {1, 0};
+        setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char req[2048];
+        size_t got = 0;
+        while (got != sizeof(req)) {
+            ssize_t r = read(c, req + got, sizeof(req) - got);
+            if (r <= 0)
+                break;
+            got += r;
+            if (memmem(req, got, "\r\n\r\n", 4))
+                break;
+        }
+        std::string body;
+        {
+            std::lock_guard<std::mutex> guard(mu_);
+            body = snapshot_;
+        }
+        if (body.empty())
+            body = render();
+        std::string resp;
+        appendf(resp, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n\r\n", body.size());
+        resp += body;
+        write_all(c, resp.data(), resp.size());
+        close(c);
+    }
+}
+
+void TMetrics::stop() {
+    active_ = false;
+    if (serving_) {
+        serving_ = false;
+        server_.join();
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    std::lock_guard<std::mutex> guard(mu_);
+    path_.clear();
+    snapshot_.clear();
+}
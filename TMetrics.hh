@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Live transaction statistics in the Prometheus text exposition format:
+// starts, commits, aborts by reason, latency histograms, RCU backlog, and
+// epoch and TID progress. The numbers come from the per-thread counters
+// that Transaction::print_stats reports at shutdown; threads update them
+// without synchronization and the exporter reads them without locks, so
+// exporting adds nothing to the transaction path. Commit and start
+// counts need profile level 1 (see Transaction::set_profile_all), which
+// export_file and serve turn on; latency histograms need profile timing,
+// which they leave to the caller.
+//
+// The epoch advancer renders a snapshot at most every interval_us and
+// writes it to the export file, if any, and keeps it for the HTTP
+// endpoint, if any. Without an epoch advancer, call epoch_tick yourself.
+class TMetrics {
+public:
+    // Write each snapshot to path. The file is replaced atomically, so
+    // readers never see a partial snapshot; under /dev/shm it stays in
+    // shared memory, and node_exporter's textfile collector can read it.
+    static void export_file(const char* path, unsigned interval_us = 1000000);
+    // Serve the latest snapshot over HTTP on port (0 picks a free port),
+    // on the loopback interface unless any_address. Returns the port, or
+    // -1 on error.
+    static int serve(int port, bool any_address = false);
+    // Stop exporting and serving.
+    static void stop();
+
+    // the current statistics
+    static std::string render();
+    // Refresh the snapshot if interval_us has passed since the last one.
+    static void epoch_tick();
+    // Refresh the snapshot now.
+    static void refresh();
+
+private:
+    static volatile bool active_;
+    static unsigned interval_us_;
+    static uint64_t last_us_;
+    static std::string path_;
+    static std::mutex mu_;
+    static std::string snapshot_;
+    static int listen_fd_;
+    static volatile bool serving_;
+    static std::thread server_;
+
+    static void enable_counters();
+    static void serve_loop();
+};
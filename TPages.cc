@@ -0,0 +1,117 @@
+#include "config.h"
+#include "TPages.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <new>
+#if HAVE_LIBNUMA && HAVE_NUMA_H
+#include <numa.h>
+#endif
+
+TPages::policy_type TPages::policy_ = TPages::thp;
+bool TPages::local_ = false;
+unsigned long TPages::nfallbacks_ = 0;
+
+static constexpr size_t small_page = 4096;
+static constexpr size_t huge_2m_page = size_t(2) << 20;
+static constexpr size_t huge_1g_page = size_t(1) << 30;
+
+bool TPages::parse_policy(const char* spec, policy_type& p) {
+    if (strcmp(spec, "normal") == 0)
+        p = normal;
+    else if (strcmp(spec, "thp") == 0)
+        p = thp;
+    else if (strcmp(spec, "2m") == 0)
+        p = huge_2m;
+    else if (strcmp(spec, "1g") == 0)
+        p = huge_1g;
+    else
+        return false;
+    return true;
+}
+
+const char* TPages::policy_name(policy_type p) {
+    return p == thp ? "thp" : p == huge_2m ? "2m" : p == huge_1g ? "1g" : "normal";
+}
+
+static size_t round_up(size_t x, size_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+// Maps at least length bytes with policy p, and sets length to what was
+// mapped. The mapping is aligned to its page size.
+char* TPages::map(size_t& length, policy_type p) {
+#if HAVE_MAP_HUGETLB
+    if (p == huge_2m || p == huge_1g) {
+        size_t page = p == huge_1g && length >= huge_1g_page ? huge_1g_page : huge_2m_page;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+# ifdef MAP_HUGE_SHIFT
+        flags |= (page == huge_1g_page ? 30 : 21) << MAP_HUGE_SHIFT;
+# endif
+        size_t n = round_up(length, page);
+        void* m = mmap(nullptr, n, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (m != MAP_FAILED) {
+            length = n;
+            return static_cast<char*>(m);
+        }
+    }
+#endif
+    if (p == huge_2m || p == huge_1g) {
+        __sync_fetch_and_add(&nfallbacks_, 1);
+        p = thp;
+    }
+
+    size_t align = p == thp ? huge_2m_page : small_page;
+    size_t n = round_up(length, align);
+    char* m = static_cast<char*>(mmap(nullptr, n + align - small_page, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (m == static_cast<char*>(MAP_FAILED))
+        throw std::bad_alloc();
+    char* a = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(m), align));
+    if (a != m)
+        munmap(m, a - m);
+    if (a + n != m + n + align - small_page)
+        munmap(a + n, m + align - small_page - a);
+#ifdef MADV_HUGEPAGE
+    if (p == thp)
+        madvise(a, n, MADV_HUGEPAGE);
+#endif
+    length = n;
+    return a;
+}
+
+void* TPages::allocate(size_t size, bool local) {
+    size_t length = size + header_size;
+    policy_type p = length >= huge_min ? policy_ : normal;
+    char* base;
+    size_t mapped;
+    if (p == normal && !(local && length >= small_page)) {
+        void* m;
+        if (posix_memalign(&m, CACHE_LINE_SIZE, length) != 0)
+            throw std::bad_alloc();
+        base = static_cast<char*>(m);
+        mapped = 0;
+    } else {
+        base = map(length, p);
+#if HAVE_LIBNUMA && HAVE_NUMA_H
+        // bind before the header's write faults in the first page
+        if (local && numa_available() >= 0)
+            numa_setlocal_memory(base, length);
+#endif
+        mapped = length;
+    }
+    header_type* h = reinterpret_cast<header_type*>(base);
+    h->size = length - header_size;
+    h->mapped = mapped;
+    return base + header_size;
+}
+
+void TPages::free(void* p) {
+    if (!p)
+        return;
+    header_type* h = header(p);
+    if (h->mapped)
+        munmap(h, h->mapped);
+    else
+        ::free(h);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "compiler.hh"
+#include <stddef.h>
+
+// Backing memory for large and thread-owned structures: transaction
+// contexts and their item chunks, TransactionBuffer chunks, and the
+// storage of TArray, TVector and Queue.
+//
+// The page policy applies to allocations at least huge_min bytes long,
+// which get a mapping of their own:
+// - normal: plain heap memory, as for small allocations.
+// - thp: normal pages, advised to use transparent huge pages.
+// - huge_2m: 2 MB hugetlbfs pages.
+// - huge_1g: 1 GB hugetlbfs pages for allocations of at least 1 GB, and
+//   2 MB pages for the rest.
+// When the hugetlbfs pool can't supply pages, allocations fall back to
+// thp (see nfallbacks()).
+//
+// allocate_local is for structures a single thread owns. When local
+// placement is on, their pages are bound to the NUMA node of the thread
+// that allocates them, whatever the process's memory policy (needs
+// libnuma; otherwise they land wherever the thread first touches them).
+//
+// Set the policy before allocating; every allocation remembers how it
+// was made, so free() is right either way. Memory is aligned to
+// CACHE_LINE_SIZE and is not zeroed.
+class TPages {
+public:
+    enum policy_type { normal, thp, huge_2m, huge_1g };
+    static constexpr size_t huge_min = size_t(2) << 20;
+
+    static void set_policy(policy_type p) {
+        policy_ = p;
+    }
+    static policy_type policy() {
+        return policy_;
+    }
+    static void set_local(bool local) {
+        local_ = local;
+    }
+    static bool local() {
+        return local_;
+    }
+    // Parses "normal", "thp", "2m" or "1g". Returns false on a bad spec.
+    static bool parse_policy(const char* spec, policy_type& p);
+    static const char* policy_name(policy_type p);
+
+    static void* allocate(size_t size) {
+        return allocate(size, false);
+    }
+    static void* allocate_local(size_t size) {
+        return allocate(size, local_);
+    }
+    static void free(void* p);
+    // Bytes usable at p, at least the size it was allocated with.
+    static size_t size(const void* p) {
+        return header(p)->size;
+    }
+
+    // Allocations that asked for hugetlbfs pages but got thp.
+    static unsigned long nfallbacks() {
+        return nfallbacks_;
+    }
+
+private:
+    struct header_type {
+        size_t size;
+        size_t mapped;          // length of the mapping, 0 if on the heap
+    };
+    static constexpr size_t header_size = CACHE_LINE_SIZE;
+    static_assert(sizeof(header_type) <= header_size, "TPages header too big");
+
+    static policy_type policy_;
+    static bool local_;
+    static unsigned long nfallbacks_;
+
+    static header_type* header(const void* p) {
+        return reinterpret_cast<header_type*>(const_cast<char*>(static_cast<const char*>(p)) - header_size);
+    }
+    static void* allocate(size_t size, bool local);
+    static char* map(size_t& length, policy_type p);
+};
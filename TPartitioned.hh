@@ -0,0 +1,159 @@
+#pragma once
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "placement.hh"
+
+// A container split into partitions, each a C of its own with a home
+// thread, for workloads that partition naturally (TPC-C's warehouses,
+// or customers). Route maps a key to its partition: route(key) modulo
+// the number of partitions. Threads that keep to their own partitions
+// share no container state, and build() allocates each partition from a
+// thread placed like its home, so under local NUMA placement (or first
+// touch) its memory is on its home's node.
+//
+// Partitions are ordinary STO objects: a transaction may use any of
+// them, and one that spans partitions commits like any other. Routed
+// accesses count, per thread, as local (from the home thread, or from
+// a thread on its NUMA node when placement pins threads) or remote; see
+// stats().
+//
+// Works over Hashtable, MassTrans, TArray and the like. for_key and
+// route return the partition itself; transGet, transPut and transDelete
+// forward to containers that have them.
+template <typename C, typename Route>
+class TPartitioned {
+public:
+    typedef C container_type;
+    struct stats_type {
+        uint64_t local;
+        uint64_t remote;
+    };
+
+    // nparts partitions, partition p's home being thread p % MAX_THREADS
+    // until set_home. Call build() before use.
+    explicit TPartitioned(unsigned nparts, Route route = Route())
+        : route_(route), parts_(nparts), placement_(NULL) {
+        assert(nparts > 0);
+        for (unsigned p = 0; p != nparts; ++p)
+            parts_[p].home = p % MAX_THREADS;
+        reset_stats();
+    }
+    ~TPartitioned() {
+        for (auto& part : parts_)
+            delete part.c;
+    }
+    TPartitioned(const TPartitioned&) = delete;
+    TPartitioned& operator=(const TPartitioned&) = delete;
+
+    unsigned nparts() const {
+        return parts_.size();
+    }
+    void set_home(unsigned p, int thread) {
+        assert(!parts_[p].c && thread >= 0 && thread < MAX_THREADS);
+        parts_[p].home = thread;
+    }
+    int home(unsigned p) const {
+        return parts_[p].home;
+    }
+
+    // Constructs the partitions as C(args...). With pinning placement,
+    // each is constructed by a thread pinned as its home (see
+    // ThreadPlacement::pin_thread); otherwise by the caller. placement
+    // must outlive this object.
+    template <typename... Args>
+    void build(const ThreadPlacement& placement, const Args&... args) {
+        placement_ = &placement;
+        for (unsigned p = 0; p != parts_.size(); ++p) {
+            assert(!parts_[p].c);
+            parts_[p].node = placement.node(parts_[p].home);
+            if (placement.pinning())
+                std::thread([&] {
+                        placement.pin_thread(parts_[p].home);
+                        parts_[p].c = new C(args...);
+                    }).join();
+            else
+                parts_[p].c = new C(args...);
+        }
+    }
+
+    template <typename K>
+    unsigned partition(const K& key) const {
+        return route_(key) % parts_.size();
+    }
+    // The partition of key, counting the access.
+    template <typename K>
+    C& for_key(const K& key) {
+        return route(partition(key));
+    }
+    // Partition p, counting the access.
+    C& route(unsigned p) {
+        auto& s = stats_[TThread::id()];
+        if (local(p))
+            ++s.local;
+        else
+            ++s.remote;
+        return *parts_[p].c;
+    }
+    // Partition p, uncounted, e.g. for loading.
+    C& part(unsigned p) {
+        return *parts_[p].c;
+    }
+
+    // Whether the calling thread is local to partition p.
+    bool local(unsigned p) const {
+        const part_type& part = parts_[p];
+        int me = TThread::id();
+        return me == part.home
+            || (part.node >= 0 && placement_->node(me) == part.node);
+    }
+
+    template <typename K, typename V>
+    bool transGet(const K& key, V& value) {
+        return for_key(key).transGet(key, value);
+    }
+    template <typename K, typename V>
+    bool transPut(const K& key, V&& value) {
+        return for_key(key).transPut(key, std::forward<V>(value));
+    }
+    template <typename K>
+    bool transDelete(const K& key) {
+        return for_key(key).transDelete(key);
+    }
+
+    // Routed accesses so far, summed over threads. Counters are per
+    // thread and unsynchronized, so read them once threads are done.
+    stats_type stats() const {
+        stats_type sum = {0, 0};
+        for (auto& s : stats_) {
+            sum.local += s.local;
+            sum.remote += s.remote;
+        }
+        return sum;
+    }
+    stats_type thread_stats(int thread) const {
+        return stats_type{stats_[thread].local, stats_[thread].remote};
+    }
+    void reset_stats() {
+        for (auto& s : stats_)
+            s.local = s.remote = 0;
+    }
+
+private:
+    struct part_type {
+        C* c = nullptr;
+        int home = 0;
+        // home's NUMA node, or -1 if threads aren't pinned
+        int node = -1;
+    };
+    struct thread_stats_type {
+        uint64_t local;
+        uint64_t remote;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    Route route_;
+    std::vector<part_type> parts_;
+    const ThreadPlacement* placement_;
+    thread_stats_type stats_[MAX_THREADS];
+};
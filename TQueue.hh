@@ -0,0 +1,306 @@
+#pragma once
+
+#include <vector>
+#include "Transaction.hh"
+#include "TWrapped.hh"
+
+// A transactional FIFO queue stored in a list of fixed-size segments, so it
+// grows as needed and releases segments (through RCU) once they are popped.
+//
+// A transaction's pushes are kept in a per-thread buffer that is reused
+// across transactions, and its pops are just a count, so neither
+// allocates. Both are applied in one batch at commit: pops advance the
+// head under the head version's lock, and pushes are appended under the
+// tail version's lock. Pushes therefore conflict with each other only at
+// commit time, and only with transactions that saw the queue as empty.
+template <typename T, unsigned SegmentSize = 1024,
+          template <typename> class W = TOpaqueWrapped>
+class TQueue: public TObject {
+public:
+    typedef typename W<T>::version_type version_type;
+    typedef uint64_t index_type;
+
+    TQueue()
+        : head_(0), tail_(0) {
+        head_seg_ = tail_seg_ = new segment(0);
+    }
+    ~TQueue() {
+        while (head_seg_) {
+            segment* next = head_seg_->next;
+            delete head_seg_;
+            head_seg_ = next;
+        }
+    }
+
+    // NONTRANSACTIONAL PUSH/POP/EMPTY
+    void nontrans_push(const T& v) {
+        index_type t = tail_;
+        append(t, v);
+        release_fence();
+        tail_ = t;
+    }
+
+    T nontrans_pop() {
+        assert(head_ != tail_);
+        T v = head_seg_->slot[head_ - head_seg_->base];
+        advance_head(1);
+        return v;
+    }
+
+    bool nontrans_empty() const {
+        return head_ == tail_;
+    }
+
+    size_t nontrans_size() const {
+        return tail_ - head_;
+    }
+
+    void nontrans_clear() {
+        advance_head(tail_ - head_);
+    }
+
+    // TRANSACTIONAL CALLS
+    void transPush(const T& v) {
+        auto item = Sto::item(this, tail_key);
+        push_state ps = {0, 0};
+        if (item.has_write())
+            ps = item.template write_value<push_state>();
+        // drop leftovers from earlier transactions and rolled-back pushes
+        auto& buf = pending_[TThread::id()].v;
+        buf.resize(ps.pushed);
+        buf.push_back(v);
+        ++ps.pushed;
+        item.add_write(ps);
+    }
+
+    bool transPop() {
+        T* slot;
+        int where = find_front(slot);
+        if (where == at_tail)
+            return false;
+        else if (where == in_pushes) {
+            auto item = Sto::item(this, tail_key);
+            push_state ps = item.template write_value<push_state>();
+            ++ps.popped;
+            item.add_write(ps);
+        } else {
+            auto item = Sto::item(this, head_key);
+            unsigned npop = item.has_write() ? item.template write_value<unsigned>() : 0;
+            item.add_write(npop + 1);
+        }
+        return true;
+    }
+
+    bool transFront(T& val) {
+        T* slot;
+        if (find_front(slot) == at_tail)
+            return false;
+        val = *slot;
+        return true;
+    }
+
+private:
+    static constexpr int head_key = 0;
+    static constexpr int tail_key = 1;
+
+    enum { at_tail, in_queue, in_pushes };
+
+    struct segment {
+        index_type base;
+        segment* next;
+        T slot[SegmentSize];
+
+        segment(index_type b)
+            : base(b), next(nullptr) {
+        }
+    };
+
+    // write value of the tail item: how many elements this transaction
+    // pushed, and how many of those it popped again
+    struct push_state {
+        unsigned pushed;
+        unsigned popped;
+    };
+
+    struct pending_buffer {
+        std::vector<T> v;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    // Points slot at the transaction's next element: the first committed
+    // element it hasn't popped, or, if it has seen the whole committed
+    // queue, its own first unpopped push.
+    int find_front(T*& slot) {
+        auto hitem = Sto::item(this, head_key);
+        index_type index;
+        segment* seg;
+        while (1) {
+            version_type hv = headversion_;
+            fence();
+            index = head_;
+            seg = head_seg_;
+            fence();
+            if (hv == headversion_) {
+                if (hitem.has_read() && hitem.template read_value<version_type>() != hv)
+                    Sto::abort();
+                hitem.observe(hv);
+                break;
+            }
+            relax_fence();
+        }
+        if (hitem.has_write())
+            index += hitem.template write_value<unsigned>();
+
+        if (index == tail_) {
+            auto tv = tailversion_;
+            fence();
+            // if someone has pushed onto tail, read that instead of our own pushes
+            if (index == tail_) {
+                auto titem = Sto::item(this, tail_key);
+                if (!titem.has_read())
+                    titem.observe(tv);
+                if (!titem.has_write())
+                    return at_tail;
+                push_state ps = titem.template write_value<push_state>();
+                if (ps.popped == ps.pushed)
+                    return at_tail;
+                slot = &pending_[TThread::id()].v[ps.popped];
+                return in_pushes;
+            }
+        }
+        acquire_fence();
+        while (index >= seg->base + SegmentSize)
+            seg = seg->next;
+        slot = &seg->slot[index - seg->base];
+        return in_queue;
+    }
+
+    // Writes v at index t and advances t. Callers hold the tail lock and
+    // publish t to tail_ afterwards.
+    void append(index_type& t, const T& v) {
+        segment* seg = tail_seg_;
+        seg->slot[t - seg->base] = v;
+        ++t;
+        if (t == seg->base + SegmentSize) {
+            seg->next = new segment(t);
+            tail_seg_ = seg->next;
+        }
+    }
+
+    void advance_head(index_type n) {
+        index_type h = head_ + n;
+        segment* seg = head_seg_;
+        while (h >= seg->base + SegmentSize) {
+            segment* next = seg->next;
+            Transaction::rcu_delete(seg);
+            seg = next;
+        }
+        head_seg_ = seg;
+        head_ = h;
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        if (item.key<int>() == head_key)
+            return txn.try_lock(item, headversion_);
+        else
+            return txn.try_lock(item, tailversion_);
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        if (item.key<int>() == head_key)
+            return item.check_version(headversion_);
+        else
+            return item.check_version(tailversion_);
+    }
+
+    void install(TransItem& item, Transaction& txn) override {
+        if (item.key<int>() == head_key) {
+            advance_head(item.template write_value<unsigned>());
+            headversion_.set_version(txn.commit_tid());
+        } else {
+            push_state ps = item.template write_value<push_state>();
+            if (ps.popped == ps.pushed)
+                return;
+            auto& buf = pending_[TThread::id()].v;
+            index_type t = tail_;
+            for (unsigned i = ps.popped; i != ps.pushed; ++i)
+                append(t, buf[i]);
+            release_fence();
+            tail_ = t;
+            tailversion_.set_version(txn.commit_tid());
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        if (item.key<int>() == head_key)
+            headversion_.unlock();
+        else
+            tailversion_.unlock();
+    }
+
+    index_type head_;
+    segment* head_seg_;
+    version_type headversion_;
+    char pad_[CACHE_LINE_SIZE];
+    index_type tail_;
+    segment* tail_seg_;
+    version_type tailversion_;
+    pending_buffer pending_[MAX_THREADS];
+};
+
+
+// A relaxed-FIFO queue sharded by thread. Each thread pushes onto its own
+// TQueue, so producers never conflict; fronts and pops take from the
+// calling thread's shard first, then from the others in turn. Elements
+// pushed by one thread come out in order, but there is no order between
+// threads. A transFront followed by a transPop removes the element front
+// returned unless the transaction pushed in between.
+template <typename T, unsigned Shards = 8, unsigned SegmentSize = 1024,
+          template <typename> class W = TOpaqueWrapped>
+class TShardedQueue {
+public:
+    void nontrans_push(const T& v) {
+        shards_[home()].nontrans_push(v);
+    }
+
+    T nontrans_pop() {
+        for (unsigned i = 0; i != Shards; ++i) {
+            auto& q = shards_[(home() + i) % Shards];
+            if (!q.nontrans_empty())
+                return q.nontrans_pop();
+        }
+        assert(false);
+        return T();
+    }
+
+    bool nontrans_empty() const {
+        for (auto& q : shards_)
+            if (!q.nontrans_empty())
+                return false;
+        return true;
+    }
+
+    void transPush(const T& v) {
+        shards_[home()].transPush(v);
+    }
+
+    bool transPop() {
+        for (unsigned i = 0; i != Shards; ++i)
+            if (shards_[(home() + i) % Shards].transPop())
+                return true;
+        return false;
+    }
+
+    bool transFront(T& val) {
+        for (unsigned i = 0; i != Shards; ++i)
+            if (shards_[(home() + i) % Shards].transFront(val))
+                return true;
+        return false;
+    }
+
+private:
+    TQueue<T, SegmentSize, W> shards_[Shards];
+
+    static unsigned home() {
+        return TThread::id() % Shards;
+    }
+};
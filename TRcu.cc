@@ -1,7 +1,7 @@
 #include "TRcu.hh"
 
 TRcuSet::TRcuSet()
-    : clean_epoch_(0) {
+    : clean_epoch_(0), nadded_(0), nfreed_(0), cleaning_(false) {
     unsigned capacity = (4080 - sizeof(TRcuGroup)) / sizeof(TRcuGroup::TRcuElement);
     current_ = first_ = TRcuGroup::make(capacity);
     // ngroups_ = 1;
@@ -39,6 +39,13 @@ void TRcuSet::check() {
     // assert(ngroups_ > 0);
 }
 
+size_t TRcuSet::allocated_bytes() const {
+    size_t n = 0;
+    for (TRcuGroup* g = first_; g; g = g->next_)
+        n += sizeof(TRcuGroup) + sizeof(TRcuGroup::TRcuElement) * (g->capacity_ - 1);
+    return n;
+}
+
 void TRcuSet::grow() {
     if (!current_->next_) {
         unsigned capacity = (16368 - sizeof(TRcuGroup)) / sizeof(TRcuGroup::TRcuElement);
@@ -49,12 +56,23 @@ void TRcuSet::grow() {
     assert(current_->head_ == 0 && current_->tail_ == 0);
 }
 
-inline bool TRcuGroup::clean_until(epoch_type max_epoch) {
+inline bool TRcuGroup::clean_until(epoch_type max_epoch, uint64_t& nfreed, uint64_t& budget) {
     while (head_ != tail_ && signed_epoch_type(max_epoch - e_[head_].u.epoch) > 0) {
+        epoch_type epoch = e_[head_].u.epoch;
         ++head_;
         while (head_ != tail_ && e_[head_].function) {
+            if (!budget) {
+                // out of budget mid-epoch: reuse the slot just freed to
+                // mark where the rest of the epoch starts
+                --head_;
+                e_[head_].function = nullptr;
+                e_[head_].u.epoch = epoch;
+                return false;
+            }
             e_[head_].function(e_[head_].u.argument);
             ++head_;
+            ++nfreed;
+            --budget;
         }
     }
     if (head_ == tail_) {
@@ -64,23 +82,44 @@ inline bool TRcuGroup::clean_until(epoch_type max_epoch) {
         return false;
 }
 
-void TRcuSet::hard_clean_until(epoch_type max_epoch) {
+bool TRcuSet::hard_clean_until(epoch_type max_epoch, uint64_t budget) {
     TRcuGroup* empty_head = nullptr;
     TRcuGroup* empty_tail = nullptr;
+    bool done = false;
+    cleaning_ = true;
     // clean [first_, current_]
-    while (first_->clean_until(max_epoch)) {
+    while (first_->clean_until(max_epoch, nfreed_, budget)) {
         if (!empty_head)
             empty_head = first_;
         empty_tail = first_;
         if (first_ == current_) {
             first_ = current_ = empty_head;
-            return;
+            done = true;
+            break;
         }
         first_ = first_->next_;
     }
+    cleaning_ = false;
     // hook empties after current_; everything after current_ guaranteed empty
-    if (empty_head) {
+    if (empty_head && !done) {
         empty_tail->next_ = current_->next_;
         current_->next_ = empty_head;
     }
+    if (empty_head)
+        trim_spares();
+    // a group that stopped early either has later epochs or ran out of budget
+    return done || budget;
+}
+
+void TRcuSet::trim_spares() {
+    TRcuGroup* g = current_;
+    for (unsigned n = 0; g->next_ && n != max_spare_groups; ++n)
+        g = g->next_;
+    TRcuGroup* extra = g->next_;
+    g->next_ = nullptr;
+    while (extra) {
+        TRcuGroup* next = extra->next_;
+        TRcuGroup::free(extra);
+        extra = next;
+    }
 }
@@ -56,13 +56,18 @@ public:
         e_[tail_].u.argument = argument;
         ++tail_;
     }
-    inline bool clean_until(epoch_type max_epoch);
+    // Frees elements before max_epoch, at most budget of them, adding the
+    // number freed to nfreed and subtracting it from budget. Returns true
+    // iff the group is now empty.
+    inline bool clean_until(epoch_type max_epoch, uint64_t& nfreed, uint64_t& budget);
 };
 
 class TRcuSet {
 public:
     typedef TRcuGroup::epoch_type epoch_type;
     typedef TRcuGroup::signed_epoch_type signed_epoch_type;
+    // emptied groups kept for reuse; more are freed
+    static constexpr unsigned max_spare_groups = 8;
 
     TRcuSet();
     ~TRcuSet();
@@ -71,25 +76,47 @@ public:
         if (unlikely(current_->tail_ + 2 > current_->capacity_))
             grow();
         current_->add(epoch, function, argument);
+        ++nadded_;
     }
-    void clean_until(epoch_type max_epoch) {
-        if (clean_epoch_ != max_epoch)
-            hard_clean_until(max_epoch);
-        clean_epoch_ = max_epoch;
+    // Free elements added before max_epoch. With a budget, frees at most
+    // that many; the next call continues where this one stopped.
+    void clean_until(epoch_type max_epoch, uint64_t budget = ~uint64_t(0)) {
+        if (clean_epoch_ != max_epoch && hard_clean_until(max_epoch, budget))
+            clean_epoch_ = max_epoch;
+    }
+    // true while clean_until is running callbacks
+    bool cleaning() const {
+        return cleaning_;
     }
     epoch_type clean_epoch() const {
         return clean_epoch_;
     }
 
+    // Number of elements waiting to be freed. Other threads may read these
+    // counts for monitoring; they are only approximate while the owner runs.
+    uint64_t size() const {
+        return nadded_ - nfreed_;
+    }
+    // total elements ever added
+    uint64_t nadded() const {
+        return nadded_;
+    }
+    // bytes of the groups, spares included
+    size_t allocated_bytes() const;
+
 private:
     TRcuGroup* current_;
     TRcuGroup* first_;
     epoch_type clean_epoch_;
+    uint64_t nadded_;
+    uint64_t nfreed_;
+    bool cleaning_;
     // unsigned ngroups_;
 
     TRcuSet(const TRcuSet&) = delete;
     TRcuSet& operator=(const TRcuSet&) = delete;
     void check();
     void grow();
-    void hard_clean_until(epoch_type max_epoch);
+    bool hard_clean_until(epoch_type max_epoch, uint64_t budget);
+    void trim_spares();
 };
@@ -0,0 +1,192 @@
+#include "TReplication.hh"
+#include "compiler.hh"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Writes to sockets don't raise SIGPIPE when a replica goes away.
+static bool send_all(int fd, const char* p, size_t n) {
+    bool sock = true;
+    while (n) {
+        ssize_t r = sock ? ::send(fd, p, n, MSG_NOSIGNAL) : ::write(fd, p, n);
+        if (r < 0 && sock && errno == ENOTSOCK) {
+            sock = false;
+            continue;
+        } else if (r < 0 && errno == EINTR)
+            continue;
+        else if (r < 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// Returns the number of bytes read, short only at end of file or on error.
+static size_t read_all(int fd, char* p, size_t n) {
+    size_t pos = 0;
+    while (pos != n) {
+        ssize_t r = ::read(fd, p + pos, n - pos);
+        if (r < 0 && errno == EINTR)
+            continue;
+        else if (r <= 0)
+            break;
+        pos += r;
+    }
+    return pos;
+}
+
+unsigned TReplicator::add_replica(int fd, int ack_fd) {
+    std::lock_guard<std::mutex> guard(mu_);
+    always_assert(!stopping_);
+    replicas_.emplace_back(new replica);
+    replica* r = replicas_.back().get();
+    r->fd = fd;
+    r->ack_fd = ack_fd;
+    r->next_seq = first_seq_ + queue_.size();
+    r->sent_epoch = r->acked_epoch = published_epoch_;
+    r->failed = false;
+    r->sender = std::thread(&TReplicator::send_loop, this, r);
+    if (ack_fd >= 0)
+        r->acker = std::thread(&TReplicator::ack_loop, this, r);
+    return replicas_.size() - 1;
+}
+
+void TReplicator::start() {
+    always_assert(!started_ && !TLog::enabled());
+    started_ = true;
+    TLog::batch_callback = [this](uint64_t epoch, const char* p, size_t n) {
+        publish(epoch, p, n);
+    };
+}
+
+void TReplicator::stop() {
+    {
+        std::lock_guard<std::mutex> guard(mu_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+    }
+    if (started_)
+        TLog::batch_callback = nullptr;
+    cv_.notify_all();
+    for (auto& r : replicas_) {
+        r->sender.join();
+        if (r->acker.joinable())
+            r->acker.join();
+    }
+}
+
+uint64_t TReplicator::replica_epoch(unsigned r) const {
+    const replica* rep = replicas_[r].get();
+    return rep->ack_fd >= 0 ? rep->acked_epoch : rep->sent_epoch;
+}
+
+void TReplicator::publish(uint64_t epoch, const char* p, size_t n) {
+    // called from the epoch advancer: copy and queue, nothing more
+    auto b = std::make_shared<std::vector<char>>(batch_header_size + n);
+    uint64_t bytes = n;
+    memcpy(b->data(), &epoch, 8);
+    memcpy(b->data() + 8, &bytes, 8);
+    memcpy(b->data() + batch_header_size, p, n);
+    {
+        std::lock_guard<std::mutex> guard(mu_);
+        queue_.push_back(std::move(b));
+        published_epoch_ = epoch;
+        trim_locked();
+    }
+    cv_.notify_all();
+}
+
+// Drops batches every live replica has been sent.
+void TReplicator::trim_locked() {
+    uint64_t end = first_seq_ + queue_.size();
+    uint64_t min_seq = end;
+    for (auto& r : replicas_)
+        if (!r->failed)
+            min_seq = std::min(min_seq, r->next_seq);
+    while (first_seq_ != min_seq) {
+        queue_.pop_front();
+        ++first_seq_;
+    }
+}
+
+void TReplicator::send_loop(replica* r) {
+    while (1) {
+        batch_ptr b;
+        {
+            std::unique_lock<std::mutex> guard(mu_);
+            cv_.wait(guard, [&] {
+                    return r->next_seq != first_seq_ + queue_.size() || stopping_;
+                });
+            if (r->next_seq == first_seq_ + queue_.size())
+                return;
+            b = queue_[r->next_seq - first_seq_];
+        }
+        bool ok = send_all(r->fd, b->data(), b->size());
+        std::lock_guard<std::mutex> guard(mu_);
+        if (!ok) {
+            r->failed = true;
+            trim_locked();
+            return;
+        }
+        uint64_t epoch;
+        memcpy(&epoch, b->data(), 8);
+        r->sent_epoch = epoch;
+        ++r->next_seq;
+        trim_locked();
+    }
+}
+
+void TReplicator::ack_loop(replica* r) {
+    // poll so that stop() needn't wait for the replica
+    while (!stopping_) {
+        struct pollfd pfd = {r->ack_fd, POLLIN, 0};
+        int n = poll(&pfd, 1, 100);
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0)
+            break;
+        else if (n == 0)
+            continue;
+        uint64_t epoch;
+        if (read_all(r->ack_fd, reinterpret_cast<char*>(&epoch), 8) != 8)
+            break;
+        if (epoch > r->acked_epoch)
+            r->acked_epoch = epoch;
+    }
+}
+
+bool TReplica::receive(const std::function<void(const TLog::entry&)>& apply) {
+    char hdr[TReplicator::batch_header_size];
+    size_t n = read_all(fd_, hdr, sizeof(hdr));
+    if (n != sizeof(hdr)) {
+        // a clean end falls between batches
+        error_ = n != 0;
+        return false;
+    }
+    uint64_t epoch, bytes;
+    memcpy(&epoch, hdr, 8);
+    memcpy(&bytes, hdr + 8, 8);
+    buf_.resize(bytes);
+    if (read_all(fd_, buf_.data(), bytes) != bytes
+        || !TLog::for_each_entry(buf_.data(), bytes, apply)) {
+        error_ = true;
+        return false;
+    }
+    applied_epoch_ = epoch;
+    if (ack_fd_ >= 0 && !send_all(ack_fd_, reinterpret_cast<const char*>(&epoch), 8)) {
+        error_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool TReplica::run(const std::function<void(const TLog::entry&)>& apply) {
+    while (receive(apply))
+        /* do nothing */;
+    return !error_;
+}
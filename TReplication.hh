@@ -0,0 +1,133 @@
+#pragma once
+#include "TLog.hh"
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Log-shipping replication built on the redo log (see TLog.hh). On the
+// primary, a TReplicator receives each newly durable epoch's records in
+// commit TID order from the epoch advancer and queues them as one batch;
+// a sender thread per replica writes the batches to that replica's file
+// descriptor, usually a socket. Commits only append to their log buffers
+// as before, and the epoch advancer only queues, so neither waits on
+// the network. A replica that falls behind costs the primary memory
+// for the batches it has yet to receive.
+//
+// On a replica, TReplica reads batches and applies their entries, in
+// order, with a callback that writes them non-transactionally (e.g.
+// Hashtable::apply_log, or TBox::nontrans_write), then acknowledges each
+// batch's epoch. A replica seeded from a checkpoint or from TLog::replay
+// of the primary's log, then added before any further commits, stays an
+// exact copy of the logged objects as of its acknowledged epoch.
+//
+// The stream is a sequence of batches, each
+//     uint64_t epoch, uint64_t bytes, records
+// where the records are as in the log files. Every durable epoch sends
+// a batch, possibly empty, so replicas see the primary's progress.
+// Acknowledgements are uint64_t epochs. Lag is in log epochs.
+class TReplicator {
+public:
+    static constexpr size_t batch_header_size = 16;
+
+    TReplicator()
+        : first_seq_(0), published_epoch_(0), stopping_(false), started_(false) {
+    }
+    ~TReplicator() {
+        stop();
+    }
+    TReplicator(const TReplicator&) = delete;
+    TReplicator& operator=(const TReplicator&) = delete;
+
+    // Ship batches to a replica over fd, reading its acknowledgements
+    // from ack_fd (which may equal fd; -1 for none). The replica gets
+    // every batch published after this call. Returns its index.
+    unsigned add_replica(int fd, int ack_fd = -1);
+    // Start receiving batches from TLog. Call before TLog::open.
+    void start();
+    // Send what has been published, then stop. Call after TLog::close.
+    // The caller closes the file descriptors.
+    void stop();
+
+    unsigned nreplicas() const {
+        return replicas_.size();
+    }
+    // the epoch of the latest batch
+    uint64_t published_epoch() const {
+        return published_epoch_;
+    }
+    // the latest epoch the replica acknowledged, or, without
+    // acknowledgements, that was sent to it
+    uint64_t replica_epoch(unsigned r) const;
+    // published_epoch() - replica_epoch(r)
+    uint64_t lag(unsigned r) const {
+        uint64_t e = replica_epoch(r);
+        return published_epoch_ > e ? published_epoch_ - e : 0;
+    }
+    // whether an I/O error cut off replica r
+    bool failed(unsigned r) const {
+        return replicas_[r]->failed;
+    }
+
+    // TLog::batch_callback
+    void publish(uint64_t epoch, const char* p, size_t n);
+
+private:
+    typedef std::shared_ptr<const std::vector<char>> batch_ptr;
+    struct replica {
+        int fd;
+        int ack_fd;
+        uint64_t next_seq;
+        volatile uint64_t sent_epoch;
+        volatile uint64_t acked_epoch;
+        volatile bool failed;
+        std::thread sender;
+        std::thread acker;
+    };
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<batch_ptr> queue_;
+    uint64_t first_seq_; // sequence number of queue_.front()
+    volatile uint64_t published_epoch_;
+    volatile bool stopping_;
+    bool started_;
+    std::vector<std::unique_ptr<replica>> replicas_;
+
+    void send_loop(replica* r);
+    void ack_loop(replica* r);
+    void trim_locked();
+};
+
+class TReplica {
+public:
+    // Read batches from fd, acknowledging them on ack_fd (-1 for none).
+    explicit TReplica(int fd, int ack_fd = -1)
+        : fd_(fd), ack_fd_(ack_fd), applied_epoch_(0) {
+    }
+
+    // Read and apply one batch. Returns false at end of stream or on
+    // error (see error()).
+    bool receive(const std::function<void(const TLog::entry&)>& apply);
+    // Apply batches until the stream ends. Returns true at a clean end.
+    bool run(const std::function<void(const TLog::entry&)>& apply);
+
+    // the epoch of the latest batch applied
+    uint64_t applied_epoch() const {
+        return applied_epoch_;
+    }
+    bool error() const {
+        return error_;
+    }
+
+private:
+    int fd_;
+    int ack_fd_;
+    volatile uint64_t applied_epoch_;
+    bool error_ = false;
+    std::vector<char> buf_;
+};
@@ -0,0 +1,251 @@
+#pragma once
+#include "TIntPredicate.hh"
+
+// A TCounter whose value is split across Shards cache-line-sized slots,
+// one per thread (modulo Shards), each with its own version. Increments
+// touch only the calling thread's slot, so counters updated by many
+// threads commit without conflicting or sharing a cache line.
+//
+// Reads sum every slot and record a TIntRange predicate on the sum, which
+// is checked at commit by summing the slots again and validating each
+// slot's version; increments by other threads therefore only conflict
+// with readers whose predicate they break. Assignments write every slot.
+template <typename T, unsigned Shards = 32, typename W = TWrapped<T> >
+class TShardedCounter : public TObject {
+    typedef TIntPredicate<T, W> ip_type;
+    typedef typename ip_type::pred_type pred_type;
+public:
+    typedef typename W::version_type version_type;
+    static constexpr TransItem::flags_type delta_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type assigned_bit = TransItem::user0_bit << 1;
+
+    TShardedCounter() {
+    }
+    explicit TShardedCounter(T x) {
+        shards_[0].v.access() = x;
+    }
+
+    operator T() const {
+        T result = snapshot();
+        if (!assigned())
+            get(pred_item()).observe(result);
+        return result + delta();
+    }
+
+    TShardedCounter<T, Shards, W>& operator=(T x) {
+        for (unsigned i = 0; i != Shards; ++i)
+            Sto::item(this, i).add_write(i == home() ? x : T()).assign_flags(assigned_bit);
+        return *this;
+    }
+    TShardedCounter<T, Shards, W>& operator=(const TShardedCounter<T, Shards, W>& x) {
+        return *this = x.operator T();
+    }
+
+    T nontrans_read() const {
+        T result = T();
+        for (auto& s : shards_)
+            result += s.v.access();
+        return result;
+    }
+    void nontrans_write(T x) {
+        for (auto& s : shards_)
+            s.v.access() = T();
+        shards_[0].v.access() = x;
+    }
+    // Adds delta to the calling thread's slot without a transaction, e.g.
+    // for a container's non-transactional inserts. Safe against other
+    // threads' nontrans_adds, not against concurrent transactions.
+    void nontrans_add(T delta) {
+        shard& s = shards_[home()];
+        s.vers.lock();
+        s.v.access() += delta;
+        s.vers.unlock();
+    }
+
+    bool operator==(T x) const {
+        return observe_eq(x);
+    }
+    bool operator!=(T x) const {
+        return !observe_eq(x);
+    }
+    bool operator<(T x) const {
+        return observe_lt(x);
+    }
+    bool operator<=(T x) const {
+        return observe_le(x);
+    }
+    bool operator>=(T x) const {
+        return !observe_lt(x);
+    }
+    bool operator>(T x) const {
+        return !observe_le(x);
+    }
+
+    TShardedCounter<T, Shards, W>& operator+=(T delta) {
+        auto item = Sto::item(this, home());
+        item.add_write(item.template write_value<T>(T()) + delta);
+        if (!item.has_flag(assigned_bit))
+            item.add_flags(delta_bit);
+        return *this;
+    }
+    TShardedCounter<T, Shards, W>& operator-=(T delta) {
+        auto item = Sto::item(this, home());
+        item.add_write(item.template write_value<T>(T()) - delta);
+        if (!item.has_flag(assigned_bit))
+            item.add_flags(delta_bit);
+        return *this;
+    }
+    TShardedCounter<T, Shards, W>& operator++() {
+        return *this += 1;
+    }
+    void operator++(int) {
+        *this += 1;
+    }
+    TShardedCounter<T, Shards, W>& operator--() {
+        return *this -= 1;
+    }
+    void operator--(int) {
+        *this -= 1;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, shards_[item.key<unsigned>()].vers);
+    }
+    bool check_predicate(TransItem& item, Transaction& txn, bool committing) override {
+        // The reads that set the predicate created every slot's item, so
+        // this adds no items during commit.
+        pred_type pred = item.template predicate_value<pred_type>();
+        T value = T();
+        for (unsigned i = 0; i != Shards; ++i) {
+            auto p = txn.check_item(this, i);
+            assert(p);
+            value += shards_[i].v.wait_snapshot(*p, shards_[i].vers, committing);
+        }
+        return pred.verify(value);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(shards_[item.key<unsigned>()].vers);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        shard& s = shards_[item.key<unsigned>()];
+        T result = item.template write_value<T>();
+        if (item.has_flag(delta_bit))
+            result += s.v.access();
+        s.v.write(result);
+        txn.set_version_unlock(s.vers, item);
+    }
+    void unlock(TransItem& item) override {
+        shards_[item.key<unsigned>()].vers.unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        unsigned i = item.key<unsigned>();
+        w << "{ShardedCounter " << (void*) this;
+        if (i == Shards) {
+            if (item.has_predicate()) {
+                auto& p = item.predicate_value<pred_type>();
+                w << " P[" << p.first << "," << p.second << "]";
+            }
+        } else {
+            w << "[" << i << "]=" << shards_[i].v.access() << ".v" << shards_[i].vers.value();
+            if (item.has_read())
+                w << " R" << item.read_value<version_type>();
+            if (item.has_write() && item.has_flag(delta_bit))
+                w << " Δ" << item.template write_value<T>();
+            else if (item.has_write())
+                w << " =" << item.template write_value<T>();
+        }
+        w << "}";
+    }
+
+private:
+    struct shard {
+        version_type vers;
+        W v;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    shard shards_[Shards];
+
+    static unsigned home() {
+        return TThread::id() % Shards;
+    }
+    TransProxy pred_item() const {
+        return Sto::item(this, Shards);
+    }
+    static pred_type& get(TransProxy item) {
+        return item.predicate_value<pred_type>(pred_type::unconstrained());
+    }
+    bool assigned() const {
+        auto item = Sto::check_item(this, home());
+        return item && item->has_flag(assigned_bit);
+    }
+    // The value as of this transaction's reads: its assignment, or the sum
+    // of the committed slots. Excludes its increments.
+    T snapshot() const {
+        T result = T();
+        for (unsigned i = 0; i != Shards; ++i) {
+            auto item = Sto::item(this, i);
+            if (item.has_flag(assigned_bit))
+                result += item.template write_value<T>();
+            else
+                result += shards_[i].v.snapshot(item, shards_[i].vers);
+        }
+        return result;
+    }
+    static T delta(TransProxy item) {
+        return item.has_flag(delta_bit) ? item.template write_value<T>() : T();
+    }
+    T delta() const {
+        auto item = Sto::check_item(this, home());
+        if (!item)
+            return T();
+        return item->has_flag(assigned_bit) ? T() : delta(*item);
+    }
+    bool observe_eq(T value) const {
+        value -= delta();
+        T s = snapshot();
+        if (!assigned())
+            get(pred_item()).observe_test_eq(s, value);
+        return s == value;
+    }
+    bool observe_lt(T value) const {
+        value -= delta();
+        bool result = snapshot() < value;
+        if (!assigned())
+            get(pred_item()).observe_lt(value, result);
+        return result;
+    }
+    bool observe_le(T value) const {
+        value -= delta();
+        bool result = snapshot() <= value;
+        if (!assigned())
+            get(pred_item()).observe_le(value, result);
+        return result;
+    }
+};
+
+
+template <typename T, unsigned S, typename W>
+bool operator==(T a, const TShardedCounter<T, S, W>& b) {
+    return b == a;
+}
+template <typename T, unsigned S, typename W>
+bool operator!=(T a, const TShardedCounter<T, S, W>& b) {
+    return b != a;
+}
+template <typename T, unsigned S, typename W>
+bool operator<(T a, const TShardedCounter<T, S, W>& b) {
+    return b > a;
+}
+template <typename T, unsigned S, typename W>
+bool operator<=(T a, const TShardedCounter<T, S, W>& b) {
+    return b >= a;
+}
+template <typename T, unsigned S, typename W>
+bool operator>=(T a, const TShardedCounter<T, S, W>& b) {
+    return b <= a;
+}
+template <typename T, unsigned S, typename W>
+bool operator>(T a, const TShardedCounter<T, S, W>& b) {
+    return b < a;
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include "compiler.hh"
+#include "Transaction.hh"
+#include <stdlib.h>
+#include <new>
+#include <utility>
+
+// Per-thread pools of T objects carved from cache-line-aligned slabs.
+// Slots are padded to a power of two up to a cache line (to whole cache
+// lines beyond that), so no object straddles lines, and the objects a
+// thread allocates together sit together. rcu_free returns an object to
+// a pool once concurrent readers are done with it: RCU callbacks run on
+// the thread that registered them, so each pool is only ever touched by
+// its own thread and needs no locks. Slabs are never returned to the
+// system; freed slots just move to the freeing thread's pool.
+template <typename T>
+class TSlab {
+public:
+    static constexpr size_t slab_size = 64 << 10;
+
+    template <typename... Args>
+    static T* make(Args&&... args) {
+        return new(alloc()) T(std::forward<Args>(args)...);
+    }
+    // destroy x and reuse its slot once concurrent readers are done
+    static void rcu_free(T* x) {
+        Transaction::rcu_call(rcu_callback, x);
+    }
+    // destroy x and reuse its slot right away
+    static void free(T* x) {
+        x->~T();
+        slot* s = reinterpret_cast<slot*>(x);
+        s->next = free_;
+        free_ = s;
+    }
+
+private:
+    static constexpr size_t slot_size(size_t n) {
+        size_t s = sizeof(void*);
+        while (s < n && s < CACHE_LINE_SIZE)
+            s *= 2;
+        return s >= n ? s : (n + CACHE_LINE_SIZE - 1) & ~size_t(CACHE_LINE_SIZE - 1);
+    }
+    union alignas(slot_size(sizeof(T)) < CACHE_LINE_SIZE ? slot_size(sizeof(T)) : CACHE_LINE_SIZE) slot {
+        slot* next;
+        char data[slot_size(sizeof(T))];
+    };
+    static_assert(sizeof(slot) == slot_size(sizeof(T)) && alignof(T) <= alignof(slot),
+                  "bad slot layout");
+    static_assert(sizeof(slot) <= slab_size, "T too large for a slab");
+
+    static __thread slot* free_;
+    static __thread slot* next_;
+    static __thread slot* end_;
+
+    static void* alloc() {
+        if (slot* s = free_) {
+            free_ = s->next;
+            return s;
+        }
+        if (next_ == end_) {
+            void* p;
+            always_assert(posix_memalign(&p, CACHE_LINE_SIZE, slab_size) == 0);
+            next_ = static_cast<slot*>(p);
+            end_ = next_ + slab_size / sizeof(slot);
+        }
+        return next_++;
+    }
+    static void rcu_callback(void* x) {
+        free(static_cast<T*>(x));
+    }
+};
+
+template <typename T> __thread typename TSlab<T>::slot* TSlab<T>::free_;
+template <typename T> __thread typename TSlab<T>::slot* TSlab<T>::next_;
+template <typename T> __thread typename TSlab<T>::slot* TSlab<T>::end_;
+
+// malloc() and free() from TSlab pools, one per power-of-two size class
+// up to max_size bytes. Each block starts with a header naming its class,
+// so free() needs no size; larger blocks come from ::malloc. Like TSlab,
+// freed blocks go to the freeing thread's pools and never back to the
+// system.
+class TSlabAlloc {
+    struct alignas(16) header {
+        unsigned shift;     // 0 for blocks from ::malloc
+    };
+public:
+    static constexpr size_t max_size = size_t(4096) - sizeof(header);
+
+    static void* malloc(size_t sz) {
+        size_t n = sz + sizeof(header);
+        unsigned shift = min_shift;
+        while ((size_t(1) << shift) < n && shift <= max_shift)
+            ++shift;
+        header* h;
+        if (shift > max_shift) {
+            h = static_cast<header*>(::malloc(n));
+            always_assert(h);
+            shift = 0;
+        } else
+            h = static_cast<header*>(alloc_class(shift));
+        h->shift = shift;
+        return h + 1;
+    }
+    static void free(void* p) {
+        if (!p)
+            return;
+        header* h = static_cast<header*>(p) - 1;
+        if (h->shift == 0)
+            ::free(h);
+        else
+            free_class(h->shift, h);
+    }
+    // free p once concurrent readers are done with it
+    static void rcu_free(void* p) {
+        Transaction::rcu_call(free, p);
+    }
+
+private:
+    static constexpr unsigned min_shift = 5;
+    static constexpr unsigned max_shift = 12;
+
+    template <unsigned Shift> struct block {
+        alignas(16) char data[size_t(1) << Shift];
+        block() {           // leave data uninitialized
+        }
+    };
+    template <unsigned Shift> static void* make_block() {
+        return TSlab<block<Shift> >::make();
+    }
+    template <unsigned Shift> static void free_block(void* p) {
+        TSlab<block<Shift> >::free(static_cast<block<Shift>*>(p));
+    }
+
+    static void* alloc_class(unsigned shift) {
+        static constexpr void* (*fns[])() = {
+            &make_block<5>, &make_block<6>, &make_block<7>, &make_block<8>,
+            &make_block<9>, &make_block<10>, &make_block<11>, &make_block<12>
+        };
+        return fns[shift - min_shift]();
+    }
+    static void free_class(unsigned shift, void* p) {
+        static constexpr void (*fns[])(void*) = {
+            &free_block<5>, &free_block<6>, &free_block<7>, &free_block<8>,
+            &free_block<9>, &free_block<10>, &free_block<11>, &free_block<12>
+        };
+        fns[shift - min_shift](p);
+    }
+};
@@ -0,0 +1,290 @@
+#pragma once
+#include <vector>
+#include "Transaction.hh"
+
+// An append-only transactional log, read by position.
+//
+// Appenders don't conflict with each other or share a tail. A
+// transaction's appends wait in a per-thread buffer and, once it cannot
+// abort, take positions from a block its thread reserved earlier; only
+// reserving a block (every Block appends) touches shared state. So
+// positions follow commit order within a thread, but not across threads.
+//
+// Every position below the reservation frontier ends up stable: filled
+// with an entry, or a hole. A reader that reaches a position still
+// waiting in some thread's block turns it into a hole, and that thread
+// moves on to a fresh block; entries never appear behind a reader.
+// Reading stable positions registers nothing. Only reaching the end of
+// the log registers a predicate, checked at commit, that nothing was
+// appended after that point. A transaction doesn't see its own appends.
+//
+// trim(p) drops the entries before p; their segments are freed through
+// RCU, so concurrent transactions can keep reading them.
+template <typename T, unsigned Segment = 1024, unsigned Block = 64>
+class TStream : public TObject {
+    static_assert(Block > 0 && Segment % Block == 0, "Block must divide Segment");
+public:
+    typedef T value_type;
+    typedef uint64_t size_type;
+
+    TStream()
+        : frontier_(0), trim_(0), dir_(new directory(0, 4)) {
+    }
+    ~TStream() {
+        for (unsigned k = 0; k != dir_->n; ++k)
+            delete dir_->segs[k];
+        delete dir_;
+    }
+
+    void transAppend(T x) {
+        auto item = Sto::item(this, append_key);
+        unsigned n = item.has_write() ? item.template write_value<unsigned>() : 0;
+        // drop leftovers from earlier transactions
+        auto& buf = threads_[TThread::id()].pending;
+        buf.resize(n);
+        buf.push_back(std::move(x));
+        item.add_write(n + 1);
+    }
+
+    // Reads the first entry at or after pos into x and moves pos past it.
+    // If there is none, sets pos to the end of the log and returns false.
+    // Trimmed positions are skipped.
+    bool trans_read(size_type& pos, T& x) const {
+        if (read_from(pos, x))
+            return true;
+        auto item = Sto::item(this, end_key);
+        if (!item.has_predicate() || pos < item.template predicate_value<size_type>())
+            item.set_predicate(pos);
+        return false;
+    }
+
+    // Reserved positions, filled or not; every entry is below this.
+    size_type frontier() const {
+        return acquire_frontier();
+    }
+    size_type trim_point() const {
+        return trim_;
+    }
+
+    // Not safe against a concurrent trim.
+    void nontrans_append(T x) {
+        place(threads_[TThread::id()], std::move(x));
+    }
+    // Not safe against a concurrent trim.
+    bool nontrans_read(size_type& pos, T& x) const {
+        return read_from(pos, x);
+    }
+
+    // Drops the entries before p (at most the frontier), waiting out any
+    // being installed there. Memory goes back through RCU once no
+    // running transaction can still see it.
+    void trim(size_type p) {
+        dir_lock_.lock();
+        p = std::min(p, frontier_);
+        for (size_type q = trim_; q < p; ++q)
+            settle(*find_slot(dir_, q));
+        directory* d = dir_;
+        unsigned ndrop = 0;
+        if (p / Segment > d->first)
+            ndrop = std::min(size_type(d->n), p / Segment - d->first);
+        if (ndrop) {
+            directory* nd = new directory(d->first + ndrop, std::max(d->cap, 4U));
+            for (unsigned k = ndrop; k != d->n; ++k)
+                nd->segs[nd->n++] = d->segs[k];
+            for (unsigned k = 0; k != ndrop; ++k)
+                Transaction::rcu_delete(d->segs[k]);
+            release_fence();
+            dir_ = nd;
+            Transaction::rcu_delete(d);
+        }
+        if (p > trim_)
+            trim_ = p;
+        dir_lock_.unlock();
+    }
+
+    // transactional methods
+    bool check_predicate(TransItem& item, Transaction&, bool) override {
+        // Nothing may have landed after where we saw the end. Punching
+        // holes makes this stay true: later appends go past the frontier.
+        size_type f = acquire_frontier();
+        directory* d = acquire_dir();
+        for (size_type q = item.template predicate_value<size_type>(); q < f; ++q)
+            if (slot* s = find_slot(d, q))
+                if (settle(*s) == filled)
+                    return false;
+        return true;
+    }
+    bool lock(TransItem&, Transaction&) override {
+        // appends lock nothing
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        assert(false);
+        return false;
+    }
+    void install(TransItem& item, Transaction&) override {
+        unsigned n = item.template write_value<unsigned>();
+        auto& th = threads_[TThread::id()];
+        for (unsigned j = 0; j != n; ++j)
+            place(th, std::move(th.pending[j]));
+    }
+    void unlock(TransItem&) override {
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{TStream<" << typeid(T).name() << "> " << (void*) this;
+        if (item.key<int>() == end_key)
+            w << ".end >= " << item.predicate_value<size_type>();
+        else
+            w << ".append " << item.write_value<unsigned>();
+        w << "}";
+    }
+
+private:
+    static constexpr int append_key = 0;
+    static constexpr int end_key = 1;
+    enum { empty = 0, busy = 1, filled = 2, hole = 3 };
+
+    struct slot {
+        unsigned state;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T& value() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+    };
+    struct segment {
+        slot s[Segment];
+
+        segment() {
+            for (auto& x : s)
+                x.state = empty;
+        }
+        ~segment() {
+            for (auto& x : s)
+                if (x.state == filled)
+                    x.value().~T();
+        }
+    };
+    // segments [first, first + n); readers index it without locking, so
+    // only dir_lock_ holders append, and a trim replaces it
+    struct directory {
+        size_type first;
+        unsigned n;
+        unsigned cap;
+        segment** segs;
+
+        directory(size_type f, unsigned c)
+            : first(f), n(0), cap(c), segs(new segment*[c]) {
+        }
+        ~directory() {
+            delete[] segs;
+        }
+    };
+    struct thread_state {
+        std::vector<T> pending;
+        // this thread's reserved positions
+        size_type next = 0;
+        size_type end = 0;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    size_type frontier_;
+    size_type trim_;
+    directory* dir_;
+    TVersion dir_lock_;
+    thread_state threads_[MAX_THREADS];
+
+    size_type acquire_frontier() const {
+        size_type f = frontier_;
+        acquire_fence();
+        return f;
+    }
+    directory* acquire_dir() const {
+        directory* d = dir_;
+        acquire_fence();
+        return d;
+    }
+    // Slot p, or null if p was trimmed. p must be below the frontier.
+    static slot* find_slot(directory* d, size_type p) {
+        size_type k = p / Segment;
+        if (k < d->first)
+            return nullptr;
+        return &d->segs[k - d->first]->s[p % Segment];
+    }
+
+    // Waits for s to become stable, punching a hole if it is empty, and
+    // returns its final state.
+    static unsigned settle(slot& s) {
+        unsigned st;
+        while (1) {
+            st = s.state;
+            if (st == empty && bool_cmpxchg(&s.state, unsigned(empty), unsigned(hole)))
+                return hole;
+            // a busy slot's appender can't abort
+            if (st == filled || st == hole)
+                break;
+            relax_fence();
+        }
+        acquire_fence();
+        return st;
+    }
+
+    bool read_from(size_type& pos, T& x) const {
+        pos = std::max(pos, trim_);
+        size_type f = acquire_frontier();
+        directory* d = acquire_dir();
+        while (pos < f) {
+            slot* s = find_slot(d, pos);
+            if (!s)
+                pos = d->first * Segment;
+            else if (settle(*s) == filled) {
+                x = s->value();
+                ++pos;
+                return true;
+            } else
+                ++pos;
+        }
+        return false;
+    }
+
+    void reserve(thread_state& th) {
+        dir_lock_.lock();
+        size_type p = frontier_;
+        if (p % Segment == 0) {
+            directory* d = dir_;
+            if (d->n == d->cap) {
+                directory* nd = new directory(d->first, 2 * d->cap);
+                std::copy(d->segs, d->segs + d->n, nd->segs);
+                nd->n = d->n;
+                release_fence();
+                dir_ = nd;
+                Transaction::rcu_delete(d);
+                d = nd;
+            }
+            d->segs[d->n] = new segment;
+            release_fence();
+            ++d->n;
+        }
+        release_fence();
+        frontier_ = p + Block;
+        dir_lock_.unlock();
+        th.next = p;
+        th.end = p + Block;
+    }
+
+    void place(thread_state& th, T x) {
+        while (1) {
+            if (th.next == th.end)
+                reserve(th);
+            slot* s = find_slot(acquire_dir(), th.next++);
+            if (!s)
+                // a trim punched the rest of our block and dropped it
+                th.next = th.end;
+            else if (bool_cmpxchg(&s->state, unsigned(empty), unsigned(busy))) {
+                new(reinterpret_cast<void*>(&s->storage)) T(std::move(x));
+                release_fence();
+                s->state = filled;
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,199 @@
+#include "TTrace.hh"
+#include "Transaction.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+
+bool TTrace::enabled_;
+const char* const TTrace::op_names[op_count] = {
+    "get", "put", "insert", "update", "erase"
+};
+
+namespace {
+const char trace_magic[8] = {'S', 'T', 'O', 'T', 'R', 'C', '0', '1'};
+// a thread writes its buffer once it holds this many bytes
+constexpr size_t trace_flush_size = 1 << 16;
+
+struct trace_thread {
+    std::vector<char> buf;
+    std::vector<TTrace::op> ops; // the current attempt's
+    uint64_t start_us;
+    bool hooked;
+};
+
+std::mutex trace_mu;
+int trace_fd = -1;
+bool trace_failed;
+uint64_t trace_base_us;
+// indexed by thread id; never freed, since end hooks point into it
+trace_thread* trace_threads;
+unsigned trace_nthreads;
+
+uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void put_varint(std::vector<char>& b, uint64_t x) {
+    while (x >= 0x80) {
+        b.push_back(char(x | 0x80));
+        x >>= 7;
+    }
+    b.push_back(char(x));
+}
+
+void write_locked(std::vector<char>& b) {
+    const char* p = b.data();
+    size_t n = b.size();
+    while (n && !trace_failed) {
+        ssize_t r = ::write(trace_fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        else if (r <= 0)
+            trace_failed = true;
+        else {
+            p += r;
+            n -= r;
+        }
+    }
+    b.clear();
+}
+
+void trace_end_hook(void* ctx) {
+    trace_thread& tt = *static_cast<trace_thread*>(ctx);
+    if (tt.ops.empty())
+        return;
+    if (TTrace::enabled()) {
+        std::vector<char>& b = tt.buf;
+        put_varint(b, tt.start_us);
+        put_varint(b, &tt - trace_threads);
+        b.push_back(!TThread::txn->aborted());
+        put_varint(b, tt.ops.size());
+        for (auto& o : tt.ops) {
+            put_varint(b, o.container);
+            b.push_back(o.type);
+            put_varint(b, o.key);
+            put_varint(b, o.value_size);
+        }
+        if (b.size() >= trace_flush_size) {
+            std::lock_guard<std::mutex> guard(trace_mu);
+            if (trace_fd >= 0)
+                write_locked(b);
+        }
+    }
+    tt.ops.clear();
+}
+}
+
+bool TTrace::start(const char* path) {
+    std::lock_guard<std::mutex> guard(trace_mu);
+    if (enabled_)
+        return false;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    if (::write(fd, trace_magic, sizeof(trace_magic)) != ssize_t(sizeof(trace_magic))) {
+        close(fd);
+        return false;
+    }
+    if (!trace_threads) {
+        trace_nthreads = Transaction::max_threads();
+        trace_threads = new trace_thread[trace_nthreads]();
+    }
+    for (unsigned i = 0; i != trace_nthreads; ++i) {
+        trace_threads[i].buf.clear();
+        trace_threads[i].ops.clear();
+    }
+    trace_fd = fd;
+    trace_failed = false;
+    trace_base_us = now_us();
+    release_fence();
+    enabled_ = true;
+    return true;
+}
+
+bool TTrace::stop() {
+    std::lock_guard<std::mutex> guard(trace_mu);
+    if (!enabled_)
+        return false;
+    enabled_ = false;
+    for (unsigned i = 0; i != trace_nthreads; ++i)
+        write_locked(trace_threads[i].buf);
+    bool ok = close(trace_fd) == 0 && !trace_failed;
+    trace_fd = -1;
+    return ok;
+}
+
+void TTrace::record(uint32_t container, op_type type, uint64_t key, uint32_t value_size) {
+    unsigned tid = TThread::id();
+    if (!enabled_ || tid >= trace_nthreads || !Sto::in_progress())
+        return;
+    trace_thread& tt = trace_threads[tid];
+    if (!tt.hooked) {
+        Transaction::add_hook(Transaction::hook_end, trace_end_hook, &tt);
+        tt.hooked = true;
+    }
+    if (tt.ops.empty())
+        tt.start_us = now_us() - trace_base_us;
+    tt.ops.push_back(op{container, uint8_t(type), key, value_size});
+}
+
+TTrace::reader::reader(const char* path)
+    : f_(fopen(path, "rb")), error_(false) {
+    char magic[sizeof(trace_magic)];
+    if (f_ && (fread(magic, 1, sizeof(magic), f_) != sizeof(magic)
+               || memcmp(magic, trace_magic, sizeof(magic)) != 0))
+        error_ = true;
+}
+
+TTrace::reader::~reader() {
+    if (f_)
+        fclose(f_);
+}
+
+bool TTrace::reader::get_varint(uint64_t& x) {
+    x = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = getc(f_);
+        if (c == EOF)
+            return false;
+        x |= uint64_t(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool TTrace::reader::next(txn& t) {
+    if (!ok())
+        return false;
+    int c = getc(f_);
+    if (c == EOF)
+        return false;
+    ungetc(c, f_);
+    uint64_t start, thread, nops;
+    int committed;
+    if (!get_varint(start) || !get_varint(thread)
+        || (committed = getc(f_)) == EOF || !get_varint(nops)) {
+        error_ = true;
+        return false;
+    }
+    t.start_us = start;
+    t.thread = thread;
+    t.committed = committed;
+    t.ops.clear();
+    for (uint64_t i = 0; i != nops; ++i) {
+        uint64_t container, key, size;
+        int type;
+        if (!get_varint(container) || (type = getc(f_)) == EOF
+            || type >= op_count || !get_varint(key) || !get_varint(size)) {
+            error_ = true;
+            return false;
+        }
+        t.ops.push_back(op{uint32_t(container), uint8_t(type), key, uint32_t(size)});
+    }
+    return true;
+}
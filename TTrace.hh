@@ -0,0 +1,113 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Workload traces, for replaying a production workload against a new
+// build (see trace-replay.cc). A container with a trace id (e.g.
+// Hashtable::set_trace_id) records each operation while tracing is on:
+// its container id, the operation, a 64-bit key, and the value size.
+// At the end of every attempt, committed or not, the calling thread
+// appends the attempt's operations as one transaction record to a
+// thread-local buffer, which it writes to the trace file when full.
+// Recording costs a branch per operation while tracing is off.
+//
+// A trace file is the magic "STOTRC01", then transaction records:
+//     varint start_us, varint thread, uint8_t committed, varint nops
+// then nops operations of
+//     varint container, uint8_t op, varint key, varint value_size
+// Varints are LEB128. start_us counts from TTrace::start. Records from
+// different threads interleave in blocks, so start_us is not sorted.
+// Integer keys are recorded as is, other keys as their std::hash, or a
+// hash of their bytes if they have none.
+class TTrace {
+public:
+    enum op_type { op_get = 0, op_put, op_insert, op_update, op_erase, op_count };
+    static const char* const op_names[op_count];
+
+    struct op {
+        uint32_t container;
+        uint8_t type;
+        uint64_t key;
+        uint32_t value_size;
+    };
+    struct txn {
+        uint64_t start_us;
+        unsigned thread;
+        bool committed;
+        std::vector<op> ops;
+    };
+
+    // Start recording to path. Returns false on error.
+    static bool start(const char* path);
+    // Write out buffered records and stop recording. Call once traced
+    // threads are quiet.
+    static bool stop();
+    static bool enabled() {
+        return enabled_;
+    }
+
+    // Record an operation in the calling thread's transaction.
+    static void record(uint32_t container, op_type type, uint64_t key, uint32_t value_size);
+
+    template <typename K>
+    static uint64_t key(const K& k) {
+        return trace_key(k, std::is_integral<K>());
+    }
+    template <typename V>
+    static uint32_t value_size(const V&) {
+        return sizeof(V);
+    }
+    static uint32_t value_size(const std::string& v) {
+        return v.size();
+    }
+
+    // Reads a trace file record by record.
+    class reader {
+    public:
+        explicit reader(const char* path);
+        ~reader();
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+        // false if the file couldn't be opened or isn't a trace
+        bool ok() const {
+            return f_ && !error_;
+        }
+        // Read the next record. Returns false at the end or on a
+        // truncated record (see ok()).
+        bool next(txn& t);
+    private:
+        FILE* f_;
+        bool error_;
+        bool get_varint(uint64_t& x);
+    };
+
+private:
+    static bool enabled_;
+
+    template <typename K>
+    static uint64_t trace_key(const K& k, std::true_type) {
+        return uint64_t(k);
+    }
+    template <typename K>
+    static uint64_t trace_key(const K& k, std::false_type) {
+        return hash_key(k, 0);
+    }
+    template <typename K>
+    static auto hash_key(const K& k, int) -> decltype(std::hash<K>()(k)) {
+        return std::hash<K>()(k);
+    }
+    // keys without std::hash: FNV-1a of their bytes
+    template <typename K>
+    static uint64_t hash_key(const K& k, long) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(&k);
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i != sizeof(K); ++i)
+            h = (h ^ p[i]) * 1099511628211ULL;
+        return h;
+    }
+};
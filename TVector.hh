@@ -2,8 +2,10 @@
 #include "TWrapped.hh"
 #include "TArrayProxy.hh"
 #include "TIntPredicate.hh"
+#include "TLayout.hh"
 
-template <typename T, template <typename> class W = TOpaqueWrapped>
+template <typename T, template <typename> class W = TOpaqueWrapped,
+          TLayout L = TLayout::packed>
 class TVector : public TObject {
 public:
     using size_type = int;
@@ -39,22 +41,19 @@ public:
     using difference_proxy = TIntRangeDifferenceProxy<size_type>;
     typedef T value_type;
     typedef typename W<T>::read_type get_type;
-    typedef TConstArrayProxy<TVector<T, W> > const_proxy_type;
-    typedef TArrayProxy<TVector<T, W> > proxy_type;
+    typedef TConstArrayProxy<TVector<T, W, L> > const_proxy_type;
+    typedef TArrayProxy<TVector<T, W, L> > proxy_type;
     typedef proxy_type reference;
     typedef const_proxy_type const_reference;
 
     TVector()
-        : size_(0), max_size_(0), capacity_(default_capacity) {
-        data_ = reinterpret_cast<elem*>(new char[sizeof(elem) * capacity_]);
-        for (size_type i = 0; i != capacity_; ++i)
-            data_[i].vers = dead_bit;
+        : data_(default_capacity, dead_bit), size_(0), max_size_(0),
+          capacity_(default_capacity) {
     }
     ~TVector() {
         using WT = W<T>;
         for (size_type i = 0; i != max_size_; ++i)
-            data_[i].v.~WT();
-        delete[] reinterpret_cast<char*>(data_);
+            data_.value(i).~WT();
     }
 
     size_proxy size() const {
@@ -128,10 +127,11 @@ public:
         size_type& sz = size_.access();
         assert(sz < capacity_);
         if (sz == max_size_) {
-            new(reinterpret_cast<void*>(&data_[sz].v)) W<T>(std::move(x));
+            new(reinterpret_cast<void*>(&data_.value(sz))) W<T>(std::move(x));
             ++max_size_;
         } else
-            data_[sz].v.write(std::move(x));
+            data_.value(sz).write(std::move(x));
+        data_.vers(sz) = data_.vers(sz).value() & ~dead_bit;
         ++sz;
     }
 
@@ -151,7 +151,7 @@ public:
             return item.write_value<T>();
         } else {
             item.add_flags(indexed_bit);
-            get_type result = data_[i].v.read(item, data_[i].vers);
+            get_type result = data_.value(i).read(item, data_.vers(i));
             if (item.read_value<version_type>().value() & dead_bit)
                 goto out_of_range;
             return result;
@@ -174,15 +174,23 @@ public:
     }
     get_type nontrans_get(size_type i) const {
         assert(i < size_.access());
-        return data_[i].v.access();
+        return data_.value(i).access();
     }
     void nontrans_put(size_type i, const T& x) {
         assert(i < size_.access());
-        data_[i].v.access() = x;
+        data_.value(i).access() = x;
     }
     void nontrans_put(size_type i, T&& x) {
         assert(i < size_.access());
-        data_[i].v.access() = std::move(x);
+        data_.value(i).access() = std::move(x);
+    }
+
+    // Spare capacity counts as index.
+    footprint memory_footprint() const {
+        footprint f = data_.memory_footprint(size_.access(), capacity_);
+        f.versions += sizeof(size_vers_);
+        f.index += sizeof(*this) - sizeof(data_) - sizeof(size_vers_);
+        return f;
     }
 
     // transactional methods
@@ -203,18 +211,22 @@ public:
             key += item.has_flag(indexed_bit) ? 0 : size_delta_;
             if (key < 0)
                 return false; // popped too much!
-            return txn.try_lock(item, data_[key].vers);
+            return txn.try_lock(item, data_.vers(key));
         }
     }
+    void prefetch_check(const TransItem& item) const override {
+        auto key = item.template key<key_type>();
+        prefetch(key == size_key ? &size_vers_ : &data_.vers(key));
+    }
     bool check(TransItem& item, Transaction& txn) override {
         auto key = item.template key<key_type>();
         if (key == size_key)
             return item.check_version(size_vers_);
         else if (item.has_flag(onlyexists_bit))
-            return !(data_[key].vers.snapshot(item, txn) & dead_bit);
+            return !(data_.vers(key).snapshot(item, txn) & dead_bit);
         else {
             assert(item.has_flag(indexed_bit));
-            return item.check_version(data_[key].vers);
+            return item.check_version(data_.vers(key));
         }
     }
     void install(TransItem& item, Transaction& txn) override {
@@ -230,12 +242,12 @@ public:
         if (!item.has_flag(pop_bit)) {
             assert(key <= max_size_ && key < capacity_);
             if (key == max_size_) {
-                new(reinterpret_cast<void*>(&data_[key].v)) W<T>(std::move(item.write_value<T>()));
+                new(reinterpret_cast<void*>(&data_.value(key))) W<T>(std::move(item.write_value<T>()));
                 ++max_size_;
             } else
-                data_[key].v.write(std::move(item.write_value<T>()));
+                data_.value(key).write(std::move(item.write_value<T>()));
         }
-        txn.set_version_unlock(data_[key].vers, item, item.has_flag(pop_bit) ? dead_bit : 0);
+        txn.set_version_unlock(data_.vers(key), item, item.has_flag(pop_bit) ? dead_bit : 0);
     }
     void unlock(TransItem& item) override {
         auto key = item.template key<key_type>();
@@ -243,7 +255,7 @@ public:
             size_vers_.unlock();
         else {
             key += item.has_flag(indexed_bit) ? 0 : size_delta_;
-            data_[key].vers.unlock();
+            data_.vers(key).unlock();
         }
     }
     void print(std::ostream& w, const TransItem& item) const override {
@@ -276,18 +288,14 @@ public:
             return false;
         size_type max_size = max_size_;
         for (size_type i = 0; i != max_size; ++i)
-            if (data_[i].vers.is_locked_here(here))
+            if (data_.vers(i).is_locked_here(here))
                 return false;
         return true;
     }
     void print(std::ostream& w) const;
 
 private:
-    struct elem {
-        version_type vers;
-        W<T> v;
-    };
-    elem* data_;
+    TDynamicElems<version_type, W<T>, L> data_;
     W<size_type> size_;
     version_type size_vers_;
     size_type size_delta_; // protected by size_vers_ lock
@@ -333,12 +341,12 @@ private:
         if (item.has_write())
             return item.template write_value<T>();
         else
-            return data_[i].v.read(item, data_[i].vers);
+            return data_.value(i).read(item, data_.vers(i));
     }
     bool put_in_range(TransProxy& item, size_type i) const {
         if (i >= capacity_)
             return false;
-        item.observe(data_[i].vers).add_flags(onlyexists_bit);
+        item.observe(data_.vers(i)).add_flags(onlyexists_bit);
         return !(item.read_value<version_type>().value() & dead_bit);
     }
 
@@ -347,10 +355,10 @@ private:
 };
 
 
-template <typename T, template <typename> class W>
-class TVector<T, W>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
+template <typename T, template <typename> class W, TLayout L>
+class TVector<T, W, L>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
 public:
-    typedef TVector<T, W> vector_type;
+    typedef TVector<T, W, L> vector_type;
     typedef typename vector_type::size_type size_type;
     typedef typename vector_type::difference_type difference_type;
     typedef typename vector_type::pred_type pred_type;
@@ -359,7 +367,7 @@ public:
     const_iterator()
         : a_() {
     }
-    const_iterator(const TVector<T, W>* a, size_type i, TransItem* eitem)
+    const_iterator(const TVector<T, W, L>* a, size_type i, TransItem* eitem)
         : a_(const_cast<vector_type*>(a)), i_(i), eitem_(eitem) {
     }
 
@@ -451,19 +459,19 @@ protected:
     bool different_end(const const_iterator& x) const {
         return eitem_ != x.eitem_;
     }
-    friend class TVector<T, W>;
+    friend class TVector<T, W, L>;
 };
 
-template <typename T, template <typename> class W>
-class TVector<T, W>::iterator : public const_iterator {
+template <typename T, template <typename> class W, TLayout L>
+class TVector<T, W, L>::iterator : public const_iterator {
 public:
-    typedef TVector<T, W> vector_type;
+    typedef TVector<T, W, L> vector_type;
     typedef typename vector_type::size_type size_type;
     typedef typename vector_type::difference_type difference_type;
 
     iterator() {
     }
-    iterator(const TVector<T, W>* a, size_type i, TransItem* eitem)
+    iterator(const TVector<T, W, L>* a, size_type i, TransItem* eitem)
         : const_iterator(a, i, eitem) {
     }
 
@@ -507,45 +515,45 @@ public:
     }
 
 private:
-    friend class TVector<T, W>;
+    friend class TVector<T, W, L>;
 };
 
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::begin() -> iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::begin() -> iterator {
     return iterator(this, 0, 0);
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::end() -> iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::end() -> iterator {
     TransProxy sitem = size_item();
     return iterator(this, size_info(sitem).second, &sitem.item());
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::cbegin() const -> const_iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::cbegin() const -> const_iterator {
     return const_iterator(this, 0, 0);
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::cend() const -> const_iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::cend() const -> const_iterator {
     TransProxy sitem = size_item();
     return const_iterator(this, size_info(sitem).second, &sitem.item());
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::begin() const -> const_iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::begin() const -> const_iterator {
     return cbegin();
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::end() const -> const_iterator {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::end() const -> const_iterator {
     return cend();
 }
 
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::const_iterator::operator-(const const_iterator& x) const -> difference_proxy {
+template <typename T, template <typename> class W, TLayout L>
+inline auto TVector<T, W, L>::const_iterator::operator-(const const_iterator& x) const -> difference_proxy {
     assert(a_ == x.a_);
     if (different_end(x)) {
         TransItem* eitem = eitem_ ? eitem_ : x.eitem_;
@@ -556,8 +564,8 @@ inline auto TVector<T, W>::const_iterator::operator-(const const_iterator& x) co
 }
 
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::clear() {
+template <typename T, template <typename> class W, TLayout L>
+void TVector<T, W, L>::clear() {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     for (size_type i = 0; i != wval.second; ++i)
@@ -565,8 +573,8 @@ void TVector<T, W>::clear() {
     wval.second = 0;
 }
 
-template <typename T, template <typename> class W>
-auto TVector<T, W>::erase(iterator pos) -> iterator {
+template <typename T, template <typename> class W, TLayout L>
+auto TVector<T, W, L>::erase(iterator pos) -> iterator {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     if (pos.i_ >= wval.second)
@@ -583,8 +591,8 @@ auto TVector<T, W>::erase(iterator pos) -> iterator {
     return pos;
 }
 
-template <typename T, template <typename> class W>
-auto TVector<T, W>::insert(iterator pos, T value) -> iterator {
+template <typename T, template <typename> class W, TLayout L>
+auto TVector<T, W, L>::insert(iterator pos, T value) -> iterator {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     if (pos.i_ > wval.second)
@@ -601,8 +609,8 @@ auto TVector<T, W>::insert(iterator pos, T value) -> iterator {
     return pos;
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::resize(size_type size, T value) {
+template <typename T, template <typename> class W, TLayout L>
+void TVector<T, W, L>::resize(size_type size, T value) {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     size_predicate(sitem).observe(wval.first);
@@ -615,24 +623,19 @@ void TVector<T, W>::resize(size_type size, T value) {
             .add_write(value);
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::nontrans_reserve(size_type size) {
+template <typename T, template <typename> class W, TLayout L>
+void TVector<T, W, L>::nontrans_reserve(size_type size) {
     size_type new_capacity = capacity_;
     while (size > new_capacity)
         new_capacity <<= 1;
     if (new_capacity > capacity_) {
-        elem* new_data = reinterpret_cast<elem*>(new char[sizeof(elem) * new_capacity]);
-        memcpy(new_data, data_, sizeof(elem) * capacity_);
-        for (size_type i = capacity_; i != new_capacity; ++i)
-            new_data[i].vers = dead_bit;
-        Transaction::rcu_delete_array(reinterpret_cast<char*>(data_));
-        data_ = new_data;
+        data_.grow(capacity_, new_capacity, dead_bit);
         capacity_ = new_capacity;
     }
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::print(std::ostream& w) const {
+template <typename T, template <typename> class W, TLayout L>
+void TVector<T, W, L>::print(std::ostream& w) const {
     size_type sz = size_.access();
     w << "TVector<" << typeid(T).name() << ">{" << (void*) this
       << "size=" << sz << '@' << size_vers_ << " [";
@@ -641,22 +644,22 @@ void TVector<T, W>::print(std::ostream& w) const {
             w << ", ";
         if (i >= 10)
             w << '[' << i << ']';
-        w << data_[i].v.access() << '@' << data_[i].vers;
+        w << data_.value(i).access() << '@' << data_.vers(i);
     }
     w << "]";
     for (size_type i = sz; i < max_size_ && i < sz + 10; ++i) {
         w << ", ";
         if (i >= 10)
             w << '[' << i << ']';
-        w << '@' << data_[i].vers;
+        w << '@' << data_.vers(i);
     }
     if (sz + 10 < max_size_)
         w << "...";
     w << "}";
 }
 
-template <typename T, template <typename> class W>
-std::ostream& operator<<(std::ostream& w, const TVector<T, W>& v) {
+template <typename T, template <typename> class W, TLayout L>
+std::ostream& operator<<(std::ostream& w, const TVector<T, W, L>& v) {
     v.print(w);
     return w;
 }
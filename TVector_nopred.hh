@@ -173,6 +173,10 @@ public:
         else
             return txn.try_lock(item, data_[key].vers);
     }
+    void prefetch_check(const TransItem& item) const override {
+        auto key = item.template key<key_type>();
+        prefetch(key == size_key ? &size_vers_ : &data_[key].vers);
+    }
     bool check(TransItem& item, Transaction& txn) override {
         auto key = item.template key<key_type>();
         if (key == size_key)
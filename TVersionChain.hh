@@ -0,0 +1,89 @@
+#pragma once
+#include "Transaction.hh"
+
+// Superseded (version, value) pairs for one record, newest first. TObjects
+// that support snapshot transactions (see Sto::start_snapshot_transaction)
+// push the value they are about to overwrite while holding the record's
+// lock; snapshot readers walk the chain without locking. Versions that no
+// snapshot can reach any more are unlinked and freed through RCU.
+template <typename T>
+class TVersionChain {
+public:
+    typedef TransactionTid::type tid_type;
+
+    TVersionChain()
+        : head_(nullptr) {
+    }
+    ~TVersionChain() {
+        // the record itself is being freed, so no reader can see head_
+        free_nodes(head_);
+    }
+    TVersionChain(const TVersionChain&) = delete;
+    TVersionChain& operator=(const TVersionChain&) = delete;
+
+    // Record that `value` was current as of `version` and is being
+    // replaced. Call with the record locked; `version` must be unlocked.
+    void push(const T& value, tid_type version) {
+        assert(!TransactionTid::is_locked(version));
+        node* n = new node(value, version, head_);
+        release_fence();
+        head_ = n;
+        prune(Transaction::snapshot_floor());
+    }
+
+    // Return the newest value whose version precedes snapshot TID `s`, or
+    // nullptr if the record had no committed value before `s`.
+    const T* find(tid_type s) const {
+        for (node* n = head_; n; n = n->next) {
+            acquire_fence();
+            if (n->version < s)
+                return &n->value;
+        }
+        return nullptr;
+    }
+
+    // Adds the chain's nodes to f: old values as data.
+    void add_footprint(footprint& f) const {
+        for (node* n = head_; n; n = n->next) {
+            f.data += sizeof(T);
+            f.versions += sizeof(tid_type);
+            f.index += sizeof(node) - sizeof(T) - sizeof(tid_type);
+        }
+    }
+
+private:
+    struct node {
+        tid_type version;
+        T value;
+        node* next;
+        node(const T& v, tid_type vers, node* nxt)
+            : version(vers), value(v), next(nxt) {
+        }
+    };
+
+    node* head_;
+
+    // Every snapshot TID is >= floor, so a reader stops at or before the
+    // first node older than floor; everything after it is unreachable.
+    void prune(tid_type floor) {
+        for (node* n = head_; n; n = n->next)
+            if (n->version < floor) {
+                if (node* rest = n->next) {
+                    n->next = nullptr;
+                    Transaction::rcu_call(free_nodes_callback, rest);
+                }
+                return;
+            }
+    }
+
+    static void free_nodes(node* n) {
+        while (n) {
+            node* next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+    static void free_nodes_callback(void* p) {
+        free_nodes(static_cast<node*>(p));
+    }
+};
@@ -8,103 +8,59 @@ template <typename T, bool Opaque = true,
           > class TWrapped;
 
 namespace TWrappedAccess {
+// The thread's contention manager (Transaction::contention) decides how
+// long a read waits on a version locked by another transaction. Patient
+// reads (wait_snapshot) tell it they would rather wait than abort.
 template <typename T, typename V>
-static T read_wait_atomic(const T*, TransProxy, const V&, bool);
-template <typename T, typename V>
-static T read_wait_nonatomic(const T*, TransProxy, const V&, bool);
-
-template <typename T, typename V>
-static T read_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
-#if STO_ABORT_ON_LOCKED
-    // This version returns immediately if v1 is locked. We assume as a result
-    // that we will quickly converge to either `v0 == v1` or `v1.is_locked()`,
-    // and don't bother to back off.
+static T read_atomic(const T* v, TransProxy item, const V& version, bool add_read, bool patient) {
+    unsigned n = 0;
     while (1) {
         V v0 = version;
         fence();
         T result = *v;
         fence();
         V v1 = version;
-        if (v0 == v1 || v1.is_locked()) {
+        if ((v0 == v1 || v1.is_locked())
+            && (!v1.is_locked_elsewhere(item.transaction())
+                || !item.transaction().read_wait(++n, patient))) {
+            // observe aborts if v1 is still locked elsewhere
             item.observe(v1, add_read);
             return result;
         }
         relax_fence();
     }
-#else
-    return read_wait_atomic(v, item, version, add_read);
-#endif
 }
 template <typename T, typename V>
-static T read_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
-#if STO_ABORT_ON_LOCKED
-    item.observe(version, add_read);
-    fence();
-    return *v;
-#else
-    return read_wait_nonatomic(v, item, version, add_read);
-#endif
+static T read_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    return read_atomic(v, item, version, add_read, false);
 }
 template <typename T, typename V>
 static T read_wait_atomic(const T* v, TransProxy item, const V& version, bool add_read) {
-    unsigned n = 0;
-    while (1) {
-        V v0 = version;
-        fence();
-        T result = *v;
-        fence();
-        V v1 = version;
-        if (v0 == v1 && !v1.is_locked_elsewhere(item.transaction())) {
-            item.observe(v1, add_read);
-            return result;
-        }
-
-#if !STO_ABORT_ON_LOCKED
-        relax_fence();
-        continue;
-#endif
-
-#if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
-            Sto::abort();
-        if (n > 3)
-            for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                relax_fence();
-#else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
-            Sto::abort();
-#endif
-        relax_fence();
-    }
+    return read_atomic(v, item, version, add_read, true);
 }
 template <typename T, typename V>
-static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+static T read_nonatomic(const T* v, TransProxy item, const V& version, bool add_read, bool patient) {
     unsigned n = 0;
     while (1) {
         V v0 = version;
         fence();
-        if (!v0.is_locked_elsewhere(item.transaction())) {
+        if (!v0.is_locked_elsewhere(item.transaction())
+            || !item.transaction().read_wait(++n, patient)) {
             item.observe(v0, add_read);
+            fence();
             return *v;
         }
         relax_fence();
-
-#if !STO_ABORT_ON_LOCKED
-        continue;
-#endif
-
-#if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
-            Sto::abort();
-        if (n > 3)
-            for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                relax_fence();
-#else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
-            Sto::abort();
-#endif
     }
 }
+template <typename T, typename V>
+static T read_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    return read_nonatomic(v, item, version, add_read, false);
+}
+template <typename T, typename V>
+static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool add_read) {
+    return read_nonatomic(v, item, version, add_read, true);
+}
 }
 
 template <typename T>
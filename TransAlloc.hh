@@ -3,36 +3,46 @@
 #include "compiler.hh"
 #include "Interface.hh"
 #include "Transaction.hh"
+#include "TSlab.hh"
 
+// Transactional allocation from per-thread slab pools (see TSlabAlloc).
+// Memory from transMalloc and transNew must be released with transFree,
+// transDelete, or TSlabAlloc::free/rcu_free, not with ::free or delete.
 class TransAlloc : public TObject {
+    template <typename T>
+    static void destroy_and_free(void* x) {
+        static_cast<T*>(x)->~T();
+        TSlabAlloc::free(x);
+    }
 public:
     static constexpr TransItem::flags_type alloc_flag = TransItem::user0_bit;
     typedef void (*free_type)(void*);
 
     // used to free things only if successful commit
     void transFree(void *ptr) {
-        Sto::new_item(this, ptr).template add_write<free_type, free_type>(::free);
+        Sto::new_item(this, ptr).template add_write<free_type, free_type>(TSlabAlloc::free);
     }
 
     // malloc() which will be freed on abort
     void* transMalloc(size_t sz) {
-        void *ptr = malloc(sz);
-        Sto::new_item(this, ptr).template add_write<free_type, free_type>(::free).add_flags(alloc_flag);
+        void *ptr = TSlabAlloc::malloc(sz);
+        Sto::new_item(this, ptr).template add_write<free_type, free_type>(TSlabAlloc::free).add_flags(alloc_flag);
         return ptr;
     }
 
     // delete which only applies if transaction commits
     template <typename T>
     void transDelete(T *x) {
-        Sto::new_item(this, x).template add_write<free_type, free_type>(&ObjectDestroyer<T>::destroy_and_free);
+        Sto::new_item(this, x).template add_write<free_type, free_type>(&destroy_and_free<T>);
     }
 
     // new which will be delete'd on abort.
     // arguments go to T's constructor
     template <typename T, typename... Args>
     T* transNew(Args&&... args) {
-        T* x = new T(std::forward<Args>(args)...);
-        Sto::new_item(this, x).template add_write<free_type, free_type>(&ObjectDestroyer<T>::destroy_and_free).add_flags(alloc_flag);
+        static_assert(alignof(T) <= 16, "T overaligned for TSlabAlloc");
+        T* x = new(TSlabAlloc::malloc(sizeof(T))) T(std::forward<Args>(args)...);
+        Sto::new_item(this, x).template add_write<free_type, free_type>(&destroy_and_free<T>).add_flags(alloc_flag);
         return x;
     }
 
@@ -41,8 +51,15 @@ public:
     void install(TransItem&, Transaction&) override {}
     void unlock(TransItem&) override {}
     void cleanup(TransItem& item, bool committed) override {
-        if (committed == !item.has_flag(alloc_flag))
-	  Transaction::rcu_call(item.write_value<free_type>(), item.key<void*>());
+        if (committed == !item.has_flag(alloc_flag)) {
+            free_type f = item.write_value<free_type>();
+            if (committed)
+                Transaction::rcu_call(f, item.key<void*>());
+            else
+                // an aborted allocation was never published, so it goes
+                // straight back to this thread's pool
+                f(item.key<void*>());
+        }
     }
     void print(std::ostream& w, const TransItem& item) const override {
         w << "{TransAlloc @" << item.key<void*>();
@@ -24,17 +24,25 @@ class TransItem {
     static constexpr flags_type lock_bit = flags_type(1) << 61;
     static constexpr flags_type predicate_bit = flags_type(1) << 60;
     static constexpr flags_type stash_bit = flags_type(1) << 59;
-    static constexpr flags_type pointer_mask = (flags_type(1) << 48) - 1;
+    static constexpr flags_type pointer_mask = (flags_type(1) << 47) - 1;
     static constexpr flags_type owner_mask = pointer_mask;
+    // set when the item's read and write data are in a split_data; user
+    // space pointers leave this bit clear
+    static constexpr flags_type split_bit = flags_type(1) << 47;
     static constexpr flags_type user0_bit = flags_type(1) << 48;
     static constexpr int userf_shift = 48;
     static constexpr flags_type shifted_userf_mask = 0x7FF;
-    static constexpr flags_type special_mask = owner_mask | read_bit | write_bit | lock_bit | predicate_bit | stash_bit;
+    static constexpr flags_type special_mask = owner_mask | split_bit | read_bit | write_bit | lock_bit | predicate_bit | stash_bit;
+    // A user flag that marks a write made without reading the item's
+    // value (see TransProxy::mark_blind). Objects that take blind writes
+    // must leave it free.
+    static constexpr flags_type blind_bit = flags_type(1) << 55;
 
 
     TransItem() = default;
     TransItem(TObject* owner, void* k)
         : s_(reinterpret_cast<ownerstore_type>(owner)), key_(k) {
+        assert(!(s_ & ~pointer_mask));
     }
 
     TObject* owner() const {
@@ -71,12 +79,12 @@ class TransItem {
     template <typename T>
     T& read_value() {
         assert(has_read());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
     template <typename T>
     const T& read_value() const {
         assert(has_read());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
     bool check_version(TVersion v) const {
         assert(has_read());
@@ -90,55 +98,59 @@ class TransItem {
     template <typename T>
     T& predicate_value() {
         assert(has_predicate() && !has_read());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
     template <typename T>
     const T& predicate_value() const {
         assert(has_predicate() && !has_read());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
 
     template <typename T>
     T& write_value() {
         assert(has_write());
-        return Packer<T>::unpack(wdata_);
+        return Packer<T>::unpack(wslot());
     }
     template <typename T>
     const T& write_value() const {
         assert(has_write());
-        return Packer<T>::unpack(wdata_);
+        return Packer<T>::unpack(wslot());
     }
     template <typename T>
     T write_value(T default_value) const {
-        return has_write() ? Packer<T>::unpack(wdata_) : default_value;
+        return has_write() ? Packer<T>::unpack(wslot()) : default_value;
     }
 
+    // Write data that may exist without a write (TVector's size item).
+    // Set it through TransProxy::xwrite_value, which gives it a slot of
+    // its own; here it's only read back.
     template <typename T>
     T& xwrite_value() {
         static_assert(Packer<T>::is_simple, "xwrite_value only works on simple types");
-        return Packer<T>::unpack(wdata_);
+        assert(split() || !has_flag(read_bit | predicate_bit | stash_bit));
+        return Packer<T>::unpack(wslot());
     }
     template <typename T>
     const T& xwrite_value() const {
         static_assert(Packer<T>::is_simple, "xwrite_value only works on simple types");
-        return Packer<T>::unpack(wdata_);
+        return Packer<T>::unpack(wslot());
     }
 
     template <typename T>
     T& stash_value() {
         assert(has_stash());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
     template <typename T>
     const T& stash_value() const {
         assert(has_stash());
-        return Packer<T>::unpack(rdata_);
+        return Packer<T>::unpack(rslot());
     }
     template <typename T>
     T stash_value(T default_value) const {
         assert(!has_read());
         if (has_stash())
-            return Packer<T>::unpack(rdata_);
+            return Packer<T>::unpack(rslot());
         else
             return std::move(default_value);
     }
@@ -183,11 +195,55 @@ class TransItem {
     }
 
 private:
+    // Most items only read, so an item holds its read data (a version,
+    // predicate or stash) or its write data in data_, and only an item
+    // with both keeps them in a split_data in the transaction buffer.
+    // That keeps items at three words for the execution's lookups and
+    // phase 2's scan. data_ is the write data iff has_write() (and the
+    // read data otherwise) until the item is split.
+    struct split_data {
+        void* r;
+        void* w;
+    };
+
     ownerstore_type s_;
     // this word must be unique (to a particular item) and consistently ordered across transactions
     void* key_;
-    void* rdata_;
-    void* wdata_;
+    void* data_;
+
+    bool split() const {
+        return s_ & split_bit;
+    }
+    // an unsplit item holds one kind of data
+    bool one_kind() const {
+        return !has_write() || !has_flag(read_bit | predicate_bit | stash_bit);
+    }
+    void*& rslot() {
+        assert(split() || one_kind());
+        return split() ? static_cast<split_data*>(data_)->r : data_;
+    }
+    void* const& rslot() const {
+        return split() ? static_cast<const split_data*>(data_)->r : data_;
+    }
+    void*& wslot() {
+        assert(split() || one_kind());
+        return split() ? static_cast<split_data*>(data_)->w : data_;
+    }
+    void* const& wslot() const {
+        return split() ? static_cast<const split_data*>(data_)->w : data_;
+    }
+    // gives the read and write data separate slots
+    void make_split(TransactionBuffer& buf) {
+        split_data sd;
+        sd.r = sd.w = data_;
+        data_ = Packer<split_data>::pack(buf, sd);
+        s_ |= split_bit;
+    }
+    // a fresh copy of the split data, so that a savepoint's copy of this
+    // item keeps the old one
+    void copy_split(TransactionBuffer& buf) {
+        data_ = Packer<split_data>::pack(buf, *static_cast<split_data*>(data_));
+    }
 
     void __rm_flags(flags_type flags) {
         s_ = s_ & ~flags;
@@ -273,6 +329,10 @@ class TransProxy {
         item().__rm_flags(TransItem::write_bit);
         return *this;
     }
+    // Marks the item's write as blind: the transaction never reads the
+    // value it overwrites. A transaction whose only item is a blind write
+    // commits by the Thomas write rule (see Transaction::blind_commit).
+    inline TransProxy& mark_blind();
 
     template <typename T>
     inline TransProxy& set_stash(T sdata);
@@ -318,9 +378,7 @@ class TransProxy {
     }
 
     template <typename T>
-    T& xwrite_value() {
-        return item().xwrite_value<T>();
-    }
+    inline T& xwrite_value();
 
     template <typename T>
     T& stash_value() {
@@ -377,6 +435,11 @@ private:
     inline Transaction* t() const {
         return t_;
     }
+    // the item's read data slot, split from its write data if any
+    inline void*& rdata_slot();
+    // the item's write data slot, split from its read data if any; call
+    // before setting write_bit
+    inline void*& wdata_slot();
     friend class Transaction;
     friend class OptionalTransProxy;
 };
@@ -14,7 +14,7 @@ public:
   // XXX: it might be cleaner if we had 1 method that took a lock and its
   // unlock method. But this specificity allows us to inline the unlock methods.
   // We could potentially also make RWLock and SpinLock shared objects
-  void transReadLock(RWLock *lock) {
+  void transReadLock(BoostingRWLock *lock) {
     auto item = Sto::item(this, lock);
     // if we have the lock already (whether as a read lock or write lock), we're done.
     if (!item.has_write()) {
@@ -25,7 +25,7 @@ public:
       item.add_write(read_lock());
     }
   }
-  void transWriteLock(RWLock *lock) {
+  void transWriteLock(BoostingRWLock *lock) {
     auto item = Sto::item(this, lock);
     if (!item.has_write()) {
       if (!lock->tryWriteLock(WRITE_SPIN)) {
@@ -53,8 +53,8 @@ public:
   }
 
   bool lock(TransItem&, Transaction&) override { return true; }
-  bool check(const TransItem&, const Transaction&) override { return false; }
-  void install(TransItem&, const Transaction&) override {}
+  bool check(TransItem&, Transaction&) override { return false; }
+  void install(TransItem&, Transaction&) override {}
   void unlock(TransItem&) override {}
   void cleanup(TransItem& item, bool committed) override {
     auto type = item.template write_value<bit_type>();
@@ -62,7 +62,7 @@ public:
       item.template key<SpinLock*>()->unlock();
       return;
     }
-    auto *lock = item.template key<RWLock*>();
+    auto *lock = item.template key<BoostingRWLock*>();
     if (type == read_lock()) {
       lock->readUnlock();
     } else if (type == write_lock()) {
@@ -19,8 +19,8 @@ public:
 
   bool lock(TransItem&, Transaction&) override { return true; }
   void unlock(TransItem&) override {}
-  bool check(const TransItem&, const Transaction&) override { return false; }
-  void install(TransItem&, const Transaction&) override {}
+  bool check(TransItem&, Transaction&) override { return false; }
+  void install(TransItem&, Transaction&) override {}
   void cleanup(TransItem& item, bool committed) override {
     if (!committed) {
       auto undo_func = item.key<UndoFunction>();
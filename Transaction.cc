@@ -1,19 +1,154 @@
 #include "Transaction.hh"
+#include "htm.hh"
+#include "TMetrics.hh"
 #include <typeinfo>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 Transaction::testing_type Transaction::testing;
-threadinfo_t Transaction::tinfo[MAX_THREADS];
+static threadinfo_t* allocate_tinfo(unsigned n) {
+    void* space;
+    if (posix_memalign(&space, alignof(threadinfo_t), sizeof(threadinfo_t) * n) != 0)
+        throw std::bad_alloc();
+    threadinfo_t* ti = reinterpret_cast<threadinfo_t*>(space);
+    for (unsigned i = 0; i != n; ++i)
+        new(&ti[i]) threadinfo_t;
+    return ti;
+}
+
+static unsigned default_max_threads() {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return std::min(std::max(ncpu, 32L), long(MAX_THREADS));
+}
+
+uint8_t threadinfo_t::default_profile_level = STO_PROFILE_COUNTERS;
+bool threadinfo_t::default_profile_timing = STO_TSC_PROFILE;
+bool threadinfo_t::default_profile_hw = false;
+constexpr unsigned threadinfo_t::max_hooks;
+unsigned Transaction::tinfo_capacity = default_max_threads();
+unsigned Transaction::tinfo_high_water = 0;
+threadinfo_t* Transaction::tinfo = allocate_tinfo(Transaction::tinfo_capacity);
 __thread int TThread::the_id;
+__thread bool TThread::has_id;
 Transaction::epoch_state __attribute__((aligned(128))) Transaction::global_epochs = {
-    1, 0, TransactionTid::increment_value, true
+    1, 0, TransactionTid::increment_value, 0, true, false, false, STO_EPOCH_INTERVAL_MAX
 };
 __thread Transaction *TThread::txn = nullptr;
 std::function<void(threadinfo_t::epoch_type)> Transaction::epoch_advance_callback;
+unsigned Transaction::epoch_interval_min_us = STO_EPOCH_INTERVAL_MIN;
+unsigned Transaction::epoch_interval_max_us = STO_EPOCH_INTERVAL_MAX;
+uint64_t Transaction::rcu_eager_threshold = STO_RCU_EAGER_THRESHOLD;
+unsigned Transaction::rcu_clean_budget = STO_RCU_CLEAN_BUDGET;
+bool Transaction::decentralized_tids = STO_DECENTRALIZED_TID;
+bool Transaction::prefetch_validation = false;
+bool Transaction::group_commit = false;
+unsigned Transaction::parallel_install_threshold = 0;
+unsigned Transaction::opacity_extensions = STO_OPACITY_EXTENSIONS;
+unsigned Transaction::validate_interval = STO_VALIDATE_INTERVAL;
+unsigned Transaction::conflict_sample_period = 0;
+unsigned Transaction::fallback_aborts = STO_FALLBACK_ABORTS;
+TAdmission* Transaction::admission = nullptr;
+unsigned Transaction::htm_max_items = STO_HTM_MAX_ITEMS;
+uint64_t __attribute__((aligned(128))) Transaction::fallback_token_ = 0;
+#if STO_SPIN_EXPBACKOFF
+TSpinContention Transaction::default_contention(STO_SPIN_BOUND_WRITE, STO_SPIN_BOUND_WAIT,
+                                                STO_ABORT_ON_LOCKED, true);
+#else
+TSpinContention Transaction::default_contention(1U << STO_SPIN_BOUND_WRITE, 1U << STO_SPIN_BOUND_WAIT,
+                                                STO_ABORT_ON_LOCKED, false);
+#endif
 TransactionTid::type __attribute__((aligned(128))) Transaction::_TID = 2 * TransactionTid::increment_value;
    // reserve TransactionTid::increment_value for prepopulated
 
 static void __attribute__((used)) check_static_assertions() {
     static_assert(sizeof(threadinfo_t) % 128 == 0, "threadinfo is 2-cache-line aligned");
+    static_assert(MAX_THREADS <= TransactionTid::threadid_mask + 1, "thread ids fit in versions");
+}
+
+TContentionManager* TContentionManager::make(const char* policy) {
+    if (strcmp(policy, "spin") == 0)
+        return new TSpinContention(Transaction::default_contention);
+    else if (strcmp(policy, "backoff") == 0)
+        return new TBackoffContention;
+    else if (strcmp(policy, "abort-fast") == 0)
+        return new TAbortFastContention;
+    else if (strcmp(policy, "adaptive") == 0)
+        return new TAdaptiveContention;
+    else
+        return nullptr;
+}
+
+void Transaction::start_snapshot() {
+    threadinfo_t& thr = tinfo[threadid_];
+    always_assert(!interleaved_ && "interleaved contexts can't take snapshots");
+    if (decentralized_tids) {
+        // make commits that got ahead of the clock visible
+        tid_type recent = 0;
+        for (unsigned i = 0; i != used_threads(); ++i)
+            recent = std::max(recent, tinfo[i].last_commit_tid);
+        advance_tid_clock(recent);
+    }
+    // Publish a placeholder before sampling the clock. The epoch advancer
+    // samples the clock before scanning snapshot_tids, so it either sees
+    // this snapshot or computes a floor no larger than our snapshot TID.
+    thr.snapshot_tid = 1;
+    memory_fence();
+    // Commits choose their TIDs while holding their write locks, so any
+    // commit ordered before this snapshot is either installed or still
+    // holds the locks of everything it writes.
+    snapshot_tid_ = thr.snapshot_tid = _TID;
+}
+
+void Transaction::set_max_threads(unsigned n) {
+    always_assert(n > 0 && n <= MAX_THREADS);
+    if (n == tinfo_capacity)
+        return;
+    always_assert(tinfo_high_water == 0 && "threads registered before set_max_threads");
+    for (unsigned i = 0; i != tinfo_capacity; ++i)
+        tinfo[i].~threadinfo_t();
+    free(tinfo);
+    tinfo = allocate_tinfo(n);
+    tinfo_capacity = n;
+}
+
+void Transaction::note_thread(unsigned id) {
+    while (1) {
+        unsigned hw = tinfo_high_water;
+        if (id < hw || bool_cmpxchg(&tinfo_high_water, hw, id + 1))
+            break;
+        relax_fence();
+    }
+}
+
+int TThread::register_thread() {
+    assert(!has_id && "thread already has an id");
+    for (unsigned i = 0; i != Transaction::tinfo_capacity; ++i) {
+        threadinfo_t& thr = Transaction::tinfo[i];
+        if (!thr.live && bool_cmpxchg(&thr.live, false, true)) {
+            Transaction::note_thread(i);
+            the_id = i;
+            has_id = true;
+            // a Transaction kept from before unregister_thread
+            if (txn)
+                txn->threadid_ = i;
+            return i;
+        }
+    }
+    always_assert(false && "thread registry full");
+    return -1;
+}
+
+void TThread::unregister_thread() {
+    threadinfo_t& thr = Transaction::tinfo[the_id];
+    assert(thr.live && !(txn && txn->in_progress()));
+    thr.epoch = 0;
+    thr.rcu_set.clean_until(Transaction::global_epochs.active_epoch);
+    release_fence();
+    thr.live = false;
+    has_id = false;
 }
 
 void Transaction::initialize() {
@@ -21,27 +156,451 @@ void Transaction::initialize() {
     hash_base_ = 32768;
     tset_size_ = 0;
     lrng_state_ = 12897;
+    index_ = nullptr;
+    index_mask_ = 0;
+    index_active_ = index_deferred_ = read_only_ = false;
+    no_read_my_writes_ = false;
+    isolation_ = serializable;
+    read_index_ = nullptr;
+    read_index_mask_ = 0;
+    read_index_ready_ = false;
+    hw_phase_ = -1;
+    writeset_ = nullptr;
+    write_keys_ = nullptr;
+    writeset_capacity_ = 0;
+    group_items_ = nullptr;
+    snapshot_tid_ = blind_stamp_ = 0;
+    log_epoch_ = 0;
+    log_ = nullptr;
+    interleaved_ = false;
+    savepoint_mark_ = nsavepoints_ = nested_depth_ = 0;
+    tset_ = tset_dir0_;
+    tset_dir_size_ = arraysize(tset_dir0_);
     for (unsigned i = 0; i != tset_initial_capacity / tset_chunk; ++i)
         tset_[i] = &tset0_[i * tset_chunk];
-    for (unsigned i = tset_initial_capacity / tset_chunk; i != arraysize(tset_); ++i)
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_dir_size_; ++i)
         tset_[i] = nullptr;
+    if (!is_test_ && !tinfo[threadid_].txn)
+        tinfo[threadid_].txn = this;
 }
 
+struct Transaction::write_key {
+    uintptr_t key;
+    uintptr_t owner;
+    unsigned tidx;
+
+    bool operator<(const write_key& x) const {
+        // same order as TransItem::operator<
+        return key < x.key || (key == x.key && owner < x.owner);
+    }
+};
+
 Transaction::~Transaction() {
     if (in_progress())
         silent_abort();
-    TransItem* live = tset0_;
-    for (unsigned i = 0; i != arraysize(tset_); ++i, live += tset_chunk)
-        if (live != tset_[i])
-            delete[] tset_[i];
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_dir_size_; ++i)
+        TPages::free(tset_[i]);
+    if (tset_ != tset_dir0_)
+        delete[] tset_;
+    delete[] index_;
+    delete[] read_index_;
+    delete[] writeset_;
+    delete[] write_keys_;
+    delete[] group_items_;
+    if (tinfo[threadid_].txn == this)
+        tinfo[threadid_].txn = nullptr;
+}
+
+footprint Transaction::memory_footprint() const {
+    footprint f;
+    size_t nitems = tset_initial_capacity;
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_dir_size_; ++i)
+        if (tset_[i])
+            nitems += tset_chunk;
+    f.data = nitems * sizeof(TransItem) + buf_.allocated_bytes()
+        + undo_.capacity() * sizeof(undo_entry);
+    f.index = sizeof(*this) - sizeof(tset0_)
+        + (tset_ != tset_dir0_ ? tset_dir_size_ * sizeof(TransItem*) : 0)
+        + (index_ ? (index_mask_ + 1) * sizeof(unsigned) : 0)
+        + (read_index_ ? (read_index_mask_ + 1) * sizeof(unsigned) : 0)
+        + writeset_capacity_ * sizeof(unsigned)
+        + (write_keys_ ? 2 * writeset_capacity_ * sizeof(write_key) : 0)
+        + (group_items_ ? 3 * writeset_capacity_ * sizeof(TransItem*) : 0);
+    return f;
+}
+
+footprint Transaction::memory_footprint_combined() {
+    footprint f;
+    for (unsigned i = 0; i != used_threads(); ++i) {
+        threadinfo_t& thr = tinfo[i];
+        if (thr.txn)
+            f += thr.txn->memory_footprint();
+        f.rcu_pending += thr.rcu_set.allocated_bytes() + std::max(thr.rcu_bytes, int64_t(0));
+    }
+    return f;
+}
+
+TransItem* Transaction::new_tset_chunk() {
+    static_assert(std::is_trivially_default_constructible<TransItem>::value,
+                  "tset chunks are raw memory");
+    return static_cast<TransItem*>(TPages::allocate_local(sizeof(TransItem) * tset_chunk));
 }
 
 void Transaction::refresh_tset_chunk() {
     assert(tset_size_ % tset_chunk == 0);
-    assert(tset_size_ < tset_max_capacity);
-    if (!tset_[tset_size_ / tset_chunk])
-        tset_[tset_size_ / tset_chunk] = new TransItem[tset_chunk];
-    tset_next_ = tset_[tset_size_ / tset_chunk];
+    unsigned c = tset_size_ / tset_chunk;
+    // keep a directory slot past the last chunk: loops form pointers
+    // from tset_[tset_size_ / tset_chunk]
+    if (unlikely(c + 1 >= tset_dir_size_))
+        grow_tset_dir(c + 2);
+    if (!tset_[c])
+        tset_[c] = new_tset_chunk();
+    tset_next_ = tset_[c];
+}
+
+void Transaction::grow_tset_dir(unsigned nchunks) {
+    unsigned size = tset_dir_size_;
+    while (size < nchunks)
+        size *= 2;
+    TransItem** dir = new TransItem*[size];
+    memcpy(dir, tset_, sizeof(TransItem*) * tset_dir_size_);
+    std::fill(dir + tset_dir_size_, dir + size, nullptr);
+    if (tset_ != tset_dir0_)
+        delete[] tset_;
+    tset_ = dir;
+    tset_dir_size_ = size;
+}
+
+void Transaction::reserve_items(unsigned n) {
+    unsigned nchunks = iceil(n, tset_chunk) / tset_chunk;
+    if (nchunks >= tset_dir_size_)
+        grow_tset_dir(nchunks + 1);
+    for (unsigned c = tset_initial_capacity / tset_chunk; c < nchunks; ++c)
+        if (!tset_[c])
+            tset_[c] = new_tset_chunk();
+    if (n >= writeset_capacity_)
+        grow_writeset(n);
+    if (n > index_threshold && index_mask_ + 1 < 4 * n) {
+        unsigned cap = std::max(index_mask_ + 1, 4 * index_threshold);
+        while (cap < 4 * n)
+            cap *= 2;
+        delete[] index_;
+        index_ = new unsigned[cap];
+        index_mask_ = cap - 1;
+        if (index_active_)
+            build_index();
+    }
+}
+
+void Transaction::grow_writeset(unsigned nitems) {
+    // room for every item plus writeset[0]'s sentinel
+    unsigned cap = std::max(writeset_capacity_, tset_initial_capacity);
+    while (cap <= nitems)
+        cap *= 2;
+    delete[] writeset_;
+    delete[] write_keys_;
+    delete[] group_items_;
+    writeset_ = new unsigned[cap];
+    write_keys_ = STO_SORT_WRITESET ? new write_key[2 * cap] : nullptr;
+    group_items_ = group_commit || parallel_install_threshold ? new TransItem*[3 * cap] : nullptr;
+    writeset_capacity_ = cap;
+}
+
+void Transaction::sort_writeset(unsigned* writeset, unsigned nwriteset) {
+    write_key* keys = write_keys_;
+    uintptr_t key_diff = 0, owner_diff = 0;
+    for (unsigned i = 0; i != nwriteset; ++i) {
+        TransItem* it = tset_item(writeset[i]);
+        keys[i].key = reinterpret_cast<uintptr_t>(it->key_);
+        keys[i].owner = it->s_ & TransItem::owner_mask;
+        keys[i].tidx = writeset[i];
+        key_diff |= keys[i].key ^ keys[0].key;
+        owner_diff |= keys[i].owner ^ keys[0].owner;
+    }
+
+    if (nwriteset <= writeset_radix_threshold)
+        std::sort(keys, keys + nwriteset);
+    else {
+        // LSD radix sort, one byte per pass, least significant field
+        // first. Bytes that are the same in every key are skipped, so
+        // typical write sets (one or a few owners, keys in one heap
+        // region) need three or four passes.
+        write_key* tmp = keys + writeset_capacity_;
+        for (int field = 0; field != 2; ++field) {
+            uintptr_t diff = field ? key_diff : owner_diff;
+            for (unsigned shift = 0; shift != 8 * sizeof(diff) && (diff >> shift); shift += 8) {
+                if (!((diff >> shift) & 0xFF))
+                    continue;
+                unsigned count[257] = {0};
+                for (unsigned i = 0; i != nwriteset; ++i) {
+                    uintptr_t v = field ? keys[i].key : keys[i].owner;
+                    ++count[((v >> shift) & 0xFF) + 1];
+                }
+                for (unsigned b = 1; b != 256; ++b)
+                    count[b] += count[b - 1];
+                for (unsigned i = 0; i != nwriteset; ++i) {
+                    uintptr_t v = field ? keys[i].key : keys[i].owner;
+                    tmp[count[(v >> shift) & 0xFF]++] = keys[i];
+                }
+                std::swap(keys, tmp);
+            }
+        }
+    }
+
+    for (unsigned i = 0; i != nwriteset; ++i)
+        writeset[i] = keys[i].tidx;
+}
+
+// Copies items[0, n) to out grouped by owner: owners in order of first
+// appearance, items in order within an owner. A counting sort over a
+// small table of owners, since most transactions touch a few objects.
+void Transaction::group_by_owner(TransItem* const* items, unsigned n, TransItem** out) {
+    TObject* owners[group_max_owners];
+    unsigned pos[group_max_owners + 1] = {0};
+    unsigned nowners = 0, last = 0;
+    auto slot = [&](TObject* owner) {
+        if (last < nowners && owners[last] == owner)
+            return last;
+        for (unsigned s = 0; s != nowners; ++s)
+            if (owners[s] == owner)
+                return last = s;
+        if (nowners == group_max_owners)
+            return unsigned(group_max_owners);
+        owners[nowners] = owner;
+        return last = nowners++;
+    };
+    for (unsigned i = 0; i != n; ++i)
+        ++pos[slot(items[i]->owner())];
+    for (unsigned s = 0, sum = 0; s != group_max_owners + 1; ++s) {
+        unsigned count = pos[s];
+        pos[s] = sum;
+        sum += count;
+    }
+    for (unsigned i = 0; i != n; ++i)
+        out[pos[slot(items[i]->owner())]++] = items[i];
+}
+
+// end of the run of items[i]'s owner in items[0, n)
+static inline unsigned owner_run_end(TransItem* const* items, unsigned i, unsigned n) {
+    TObject* owner = items[i]->owner();
+    for (++i; i != n && items[i]->owner() == owner; ++i)
+        /* do nothing */;
+    return i;
+}
+
+bool Transaction::lock_grouped(const unsigned* writeset, unsigned nwriteset) {
+    TransItem** unsorted = group_items_ + writeset_capacity_;
+    for (unsigned i = 0; i != nwriteset; ++i)
+        unsorted[i] = tset_item(writeset[i]);
+    TransItem** items = group_items_;
+    group_by_owner(unsorted, nwriteset, items);
+    for (unsigned i = 0, j; i != nwriteset; i = j) {
+        j = owner_run_end(items, i, nwriteset);
+        unsigned k = i + items[i]->owner()->lock_all(items + i, j - i, *this);
+        for (unsigned x = i; x != k; ++x)
+            items[x]->__or_flags(TransItem::lock_bit);
+        if (k != j) {
+            mark_abort_because(items[k], lock_abort_reason());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Transaction::check_grouped(bool check_reads) {
+    TransItem** unsorted = group_items_ + writeset_capacity_;
+    unsigned nreads = 0;
+    TransItem* it = nullptr;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+        if (it->has_read() && (check_reads || it->has_write()))
+            unsorted[nreads++] = it;
+        else if (it->has_predicate() && it->has_write()) {
+            // try_commit left written items' predicates for after locking
+            TXP_INCREMENT(txp_total_check_predicate);
+            if (!it->owner()->check_predicate(*it, *this, true)) {
+                mark_abort_because(it, ar_commit_check_predicate);
+                return false;
+            }
+        }
+    }
+    TXP_ACCOUNT(txp_total_check_read, nreads);
+    TransItem** items = unsorted + writeset_capacity_;
+    group_by_owner(unsorted, nreads, items);
+    for (unsigned i = 0, j; i != nreads; i = j) {
+        j = owner_run_end(items, i, nreads);
+        TObject* owner = items[i]->owner();
+        unsigned k = i + owner->check_all(items + i, j - i, *this);
+        if (k != j) {
+            mark_abort_because(items[k], owner->absent_check(*items[k]) ? ar_commit_check_absent : ar_commit_check);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Transaction::install_grouped(unsigned nwriteset) {
+    TransItem** items = group_items_;
+    TXP_ACCOUNT(txp_total_w, nwriteset);
+    for (unsigned i = 0, j; i != nwriteset; i = j) {
+        j = owner_run_end(items, i, nwriteset);
+        items[i]->owner()->install_all(items + i, j - i, *this);
+    }
+}
+
+// A parallel install's write items, cut into nparts parts that the
+// committing thread and install pool threads claim one at a time.
+struct install_job {
+    Transaction* txn;
+    TransItem** items;
+    unsigned n;
+    unsigned nparts;
+    unsigned next_part;
+    // pool threads that may still claim parts
+    unsigned users;
+};
+
+static struct {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<install_job*> jobs;
+    std::vector<std::thread> threads;
+    bool stop = false;
+} install_pool;
+
+static void install_parts(install_job* job) {
+    unsigned p;
+    while ((p = fetch_and_add(&job->next_part, 1)) < job->nparts) {
+        unsigned i = uint64_t(job->n) * p / job->nparts;
+        unsigned end = uint64_t(job->n) * (p + 1) / job->nparts;
+        TransItem** items = job->items;
+        for (unsigned j = i, k; j != end; j = k) {
+            k = owner_run_end(items, j, end);
+            items[j]->owner()->install_all(items + j, k - j, *job->txn);
+        }
+        // the part is installed: let other threads at it
+        for (unsigned j = i; j != end; ++j) {
+            items[j]->owner()->unlock(*items[j]);
+            items[j]->clear_needs_unlock();
+        }
+    }
+}
+
+static void remove_install_job(install_job* job) {
+    auto it = std::find(install_pool.jobs.begin(), install_pool.jobs.end(), job);
+    if (it != install_pool.jobs.end())
+        install_pool.jobs.erase(it);
+}
+
+static void install_pool_thread() {
+    TThread::register_thread();
+    std::unique_lock<std::mutex> guard(install_pool.mu);
+    while (1) {
+        install_pool.cv.wait(guard, [] {
+                return !install_pool.jobs.empty() || install_pool.stop;
+            });
+        if (install_pool.jobs.empty())
+            break;
+        install_job* job = install_pool.jobs.front();
+        ++job->users;
+        guard.unlock();
+        install_parts(job);
+        guard.lock();
+        // every part is claimed
+        remove_install_job(job);
+        --job->users;
+    }
+    guard.unlock();
+    TThread::unregister_thread();
+}
+
+void Transaction::start_install_pool(unsigned n) {
+    std::lock_guard<std::mutex> guard(install_pool.mu);
+    install_pool.stop = false;
+    for (unsigned i = 0; i != n; ++i)
+        install_pool.threads.emplace_back(install_pool_thread);
+}
+
+void Transaction::stop_install_pool() {
+    {
+        std::lock_guard<std::mutex> guard(install_pool.mu);
+        install_pool.stop = true;
+    }
+    install_pool.cv.notify_all();
+    for (auto& t : install_pool.threads)
+        t.join();
+    install_pool.threads.clear();
+}
+
+void Transaction::install_parallel(const unsigned* writeset, unsigned nwriteset, bool grouped) {
+    TXP_ACCOUNT(txp_total_w, nwriteset);
+    // installs read the commit TID; compute it before they share it
+    commit_tid();
+    TransItem** items = group_items_ + writeset_capacity_;
+    unsigned n = 0;
+    for (unsigned i = 0; i != nwriteset; ++i) {
+        TransItem* it = grouped ? group_items_[i] : tset_item(writeset[i]);
+        if (it->owner()->parallel_install())
+            items[n++] = it;
+        else
+            it->owner()->install(*it, *this);
+    }
+    install_job job;
+    job.txn = this;
+    job.items = items;
+    job.n = n;
+    job.nparts = std::max(std::min(n / install_part_min, unsigned(install_pool.threads.size()) + 1), 1U);
+    job.next_part = 0;
+    job.users = 0;
+    if (job.nparts > 1) {
+        {
+            std::lock_guard<std::mutex> guard(install_pool.mu);
+            install_pool.jobs.push_back(&job);
+        }
+        install_pool.cv.notify_all();
+    }
+    install_parts(&job);
+    if (job.nparts > 1)
+        // once the job is off the queue and no pool thread holds it,
+        // every part is installed
+        while (1) {
+            std::lock_guard<std::mutex> guard(install_pool.mu);
+            remove_install_job(&job);
+            if (!job.users)
+                break;
+            relax_fence();
+        }
+}
+
+void Transaction::index_deferred_items() {
+    index_deferred_ = false;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        TransItem* it = tset_item(tidx);
+        index_item(it->owner(), it->key_, tidx);
+    }
+}
+
+void Transaction::build_index() {
+    // (re)index the whole tset at <= 25% load; the table is kept across
+    // transactions, so large transactions rarely reallocate
+    unsigned cap = std::max(index_mask_ + 1, 4 * index_threshold);
+    while (cap < 4 * tset_size_)
+        cap *= 2;
+    if (cap != index_mask_ + 1) {
+        delete[] index_;
+        index_ = new unsigned[cap];
+        index_mask_ = cap - 1;
+    }
+    memset(index_, 0, sizeof(unsigned) * cap);
+    index_active_ = true;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        TransItem* it = tset_item(tidx);
+        unsigned i = index_hash(it->owner(), it->key_) & index_mask_;
+        while (index_[i] && !tset_item(index_[i] - 1)->same_item(*it))
+            i = (i + 1) & index_mask_;
+        if (!index_[i])
+            index_[i] = tidx + 1;
+    }
 }
 
 void* Transaction::epoch_advancer(void*) {
@@ -52,35 +611,291 @@ void* Transaction::epoch_advancer(void*) {
     // don't bother epoch'ing til things have picked up
     usleep(100000);
     while (global_epochs.run) {
-        epoch_type g = global_epochs.global_epoch;
-        epoch_type e = g;
-        for (auto& t : tinfo) {
-            if (t.epoch != 0 && signed_epoch_type(t.epoch - e) < 0)
-                e = t.epoch;
-        }
-        global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
-        global_epochs.active_epoch = e;
-        global_epochs.recent_tid = Transaction::_TID;
-
+        advance_epoch();
+        TAdmission::adjust_all();
         if (epoch_advance_callback)
             epoch_advance_callback(global_epochs.global_epoch);
+        if (TLog::enabled())
+            TLog::flush();
+        TMetrics::epoch_tick();
 
-        usleep(100000);
+        unsigned interval = next_epoch_interval(global_epochs.interval_us);
+        global_epochs.interval_us = interval;
+        // sleep in slices so that memory pressure cuts the sleep short
+        unsigned slice = std::max(epoch_interval_min_us, 1U);
+        for (unsigned slept = 0;
+             slept < interval && global_epochs.run && !global_epochs.pressure;
+             slept += slice)
+            usleep(std::min(slice, interval - slept));
     }
     fetch_and_add(&num_epoch_advancers, -1);
     return NULL;
 }
 
-bool Transaction::preceding_duplicate_read(TransItem* needle) const {
-    const TransItem* it = nullptr;
-    for (unsigned tidx = 0; ; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it == needle)
-            return false;
-        if (it->owner() == needle->owner() && it->key_ == needle->key_
-            && it->has_read())
-            return true;
+bool Transaction::advance_epoch() {
+    if (global_epochs.advancing
+        || !bool_cmpxchg(&global_epochs.advancing, false, true))
+        return false;
+    epoch_type g = global_epochs.global_epoch;
+    epoch_type e = g;
+    unsigned nthreads = used_threads();
+    for (unsigned i = 0; i != nthreads; ++i) {
+        threadinfo_t& t = tinfo[i];
+        if (t.epoch != 0 && signed_epoch_type(t.epoch - e) < 0)
+            e = t.epoch;
+    }
+    global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
+    global_epochs.active_epoch = e;
+    if (decentralized_tids) {
+        // the clock lags behind per-thread TIDs; catch it up so that
+        // opacity checks on older versions stay on the fast path
+        tid_type recent = 0;
+        for (unsigned i = 0; i != nthreads; ++i)
+            recent = std::max(recent, tinfo[i].last_commit_tid);
+        advance_tid_clock(recent);
+    }
+    global_epochs.recent_tid = Transaction::_TID;
+
+    // snapshot floor: the oldest running snapshot, or the clock if none.
+    // Sample the clock before scanning; see start_snapshot().
+    tid_type floor = global_epochs.recent_tid;
+    memory_fence();
+    for (unsigned i = 0; i != nthreads; ++i) {
+        tid_type s = tinfo[i].snapshot_tid;
+        if (s != 0 && s < floor)
+            floor = s;
+    }
+    if (floor > global_epochs.snapshot_floor)
+        global_epochs.snapshot_floor = floor;
+    release_fence();
+    global_epochs.advancing = false;
+    return true;
+}
+
+unsigned Transaction::next_epoch_interval(unsigned interval) {
+    uint64_t threshold = rcu_eager_threshold;
+    uint64_t max_backlog = 0, max_added = 0;
+    for (unsigned i = 0; i != used_threads(); ++i) {
+        threadinfo_t& t = tinfo[i];
+        uint64_t nadded = t.rcu_set.nadded();
+        max_backlog = std::max(max_backlog, t.rcu_set.size());
+        max_added = std::max(max_added, nadded - t.rcu_epoch_nadded);
+        t.rcu_epoch_nadded = nadded;
+    }
+
+    uint64_t next = interval;
+    if (global_epochs.pressure) {
+        global_epochs.pressure = false;
+        next = 0;
+    } else if (threshold && (max_backlog > threshold / 2
+                             || max_added > threshold / 8))
+        next /= 2;
+    else if (!threshold || (max_backlog < threshold / 8
+                            && max_added < threshold / 32))
+        next *= 2;
+    unsigned lo = epoch_interval_min_us;
+    unsigned hi = std::max(lo, epoch_interval_max_us);
+    return std::min(std::max(next, uint64_t(lo)), uint64_t(hi));
+}
+
+void Transaction::rcu_check_pressure(threadinfo_t& thr) {
+    uint64_t threshold = rcu_eager_threshold;
+    uint64_t n = thr.rcu_set.size();
+    if (!threshold) {
+        thr.rcu_check_mark = ~uint64_t(0);
+        return;
+    } else if (n <= threshold) {
+        // earliest point the backlog can exceed the threshold
+        thr.rcu_check_mark = thr.rcu_set.nadded() + threshold - n + 1;
+        return;
+    }
+    // recheck after another quarter threshold, even if nothing is freed
+    thr.rcu_check_mark = thr.rcu_set.nadded() + std::max(threshold / 4, uint64_t(1));
+    TXP_INCREMENT(txp_rcu_eager);
+    global_epochs.pressure = true;
+    advance_epoch();
+    // an RCU callback may have added this element
+    if (!thr.rcu_set.cleaning())
+        thr.rcu_set.clean_until(global_epochs.active_epoch);
+}
+
+unsigned Transaction::tset_index(const TransItem* ti) const {
+    if (ti >= tset0_ && ti < tset0_ + tset_initial_capacity)
+        return ti - tset0_;
+    for (unsigned c = tset_initial_capacity / tset_chunk; ; ++c)
+        if (ti >= tset_[c] && ti < tset_[c] + tset_chunk)
+            return c * tset_chunk + (ti - tset_[c]);
+}
+
+void Transaction::savepoint_log(TransItem* ti) const {
+    unsigned tidx = tset_index(ti);
+    if (tidx < savepoint_mark_
+        && (undo_.empty() || undo_.back().tidx != tidx)) {
+        undo_.push_back(undo_entry{tidx, *ti});
+        // the copy restores split data too; give the item its own
+        if (ti->split())
+            ti->copy_split(const_cast<Transaction*>(this)->buf_);
+    }
+}
+
+auto Transaction::savepoint() -> savepoint_type {
+    assert(in_progress());
+    savepoint_type sp;
+    sp.tset_size = tset_size_;
+    sp.undo_size = undo_.size();
+    sp.prev_mark = savepoint_mark_;
+    sp.buf = buf_.mark();
+    sp.any_writes = any_writes_;
+    sp.any_nonopaque = any_nonopaque_;
+    sp.may_duplicate_items = may_duplicate_items_;
+    savepoint_mark_ = tset_size_;
+    ++nsavepoints_;
+    return sp;
+}
+
+void Transaction::rollback(const savepoint_type& sp) {
+    assert(in_progress() && nsavepoints_ && sp.tset_size <= tset_size_);
+    // an abort inside an opacity check leaves state_ behind
+    state_ = s_in_progress;
+    // like an abort for the items added since sp
+    for (unsigned tidx = tset_size_; tidx != sp.tset_size; ) {
+        TransItem* it = tset_item(--tidx);
+        if (it->has_write())
+            it->owner()->cleanup(*it, false);
+    }
+    // restore older items; the earliest copy of each is restored last
+    while (undo_.size() > sp.undo_size) {
+        *tset_item(undo_.back().tidx) = undo_.back().item;
+        undo_.pop_back();
+    }
+#if TRANSACTION_HASHTABLE
+    // drop entries for discarded items (saturated entries may be older,
+    // and are kept if so)
+    if (tset_size_ - sp.tset_size < hash_size / TRANSACTION_HASHTABLE) {
+        bool drop_saturated = hash_base_ + sp.tset_size + 1 < hash_saturated;
+        for (unsigned tidx = sp.tset_size; tidx != tset_size_; ++tidx) {
+            TransItem* it = tset_item(tidx);
+            unsigned v = hash_base_ + tidx + 1;
+            if (v >= hash_saturated) {
+                if (!drop_saturated)
+                    break;
+                v = hash_saturated;
+            }
+            unsigned hi = hash(it->owner(), it->key_);
+            for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
+                if (hashtable_[hi] == v)
+                    hashtable_[hi] = 0;
+                hi = (hi + hash_step) % hash_size;
+            }
+        }
+    } else
+        for (unsigned i = 0; i != hash_size; ++i)
+            if (hashtable_[i] > hash_base_ + sp.tset_size)
+                hashtable_[i] = 0;
+#endif
+    tset_size_ = sp.tset_size;
+    tset_next_ = tset_size_ ? tset_item(tset_size_ - 1) + 1 : tset0_;
+    if (tset_size_ <= index_threshold)
+        index_active_ = false;
+    else if (index_active_)
+        build_index();
+    buf_.rollback(sp.buf);
+    any_writes_ = sp.any_writes;
+    any_nonopaque_ = sp.any_nonopaque;
+    may_duplicate_items_ = sp.may_duplicate_items;
+    savepoint_mark_ = sp.tset_size;
+}
+
+void Transaction::release(const savepoint_type& sp) {
+    assert(nsavepoints_);
+    savepoint_mark_ = sp.prev_mark;
+    if (!--nsavepoints_)
+        undo_.clear();
+}
+
+TransItem* Transaction::first_invalid_read(unsigned n) {
+    read_index_ready_ = false;
+    for (unsigned tidx = 0; tidx != n; ++tidx) {
+        TransItem* it = tset_item(tidx);
+        if (it->has_read()) {
+            if (!it->owner()->check(*it, *this)
+                && (!may_duplicate_items_ || !preceding_duplicate_read(it, tidx)))
+                return it;
+        } else if (it->has_predicate()) {
+            if (!it->owner()->check_predicate(*it, *this, false))
+                return it;
+        }
+    }
+    return nullptr;
+}
+
+// allocate_item reached validate_mark_: abort if past the limits, and
+// validate if due
+void Transaction::item_checkpoint() {
+    abort_reason r = limits_passed();
+    if (r != ar_count) {
+        mark_abort_because(nullptr, r);
+        abort();
+    }
+    if (tset_size_ >= next_validation_)
+        incremental_validate();
+    if (deadline_tsc_ || cancel_token_)
+        validate_mark_ = std::min(next_validation_, tset_size_ + limits_check_interval);
+    else
+        validate_mark_ = next_validation_;
+}
+
+void Transaction::incremental_validate() {
+    next_validation_ = validate_interval ? tset_size_ + validate_interval : ~0U;
+    if (state_ != s_in_progress || snapshot_tid_ || isolation_ == read_committed)
+        return;
+    TransItem* bad;
+    {
+        TimeKeeper<tc_validate> tk;
+        TXP_INCREMENT(txp_validations);
+        bad = first_invalid_read(tset_size_);
+    }
+    if (bad) {
+        TXP_INCREMENT(txp_early_aborts);
+        abort_because(*bad, ar_incremental_check);
+    }
+}
+
+void Transaction::build_read_index() {
+    // earliest read item per key, at <= 50% load; rebuilt once per
+    // validation pass that finds a failing duplicate
+    unsigned cap = std::max(read_index_mask_ + 1, 2 * index_threshold);
+    while (cap < 2 * tset_size_)
+        cap *= 2;
+    if (cap != read_index_mask_ + 1) {
+        delete[] read_index_;
+        read_index_ = new unsigned[cap];
+        read_index_mask_ = cap - 1;
     }
+    memset(read_index_, 0, sizeof(unsigned) * cap);
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        TransItem* it = tset_item(tidx);
+        if (!it->has_read())
+            continue;
+        unsigned i = index_hash(it->owner(), it->key_) & read_index_mask_;
+        while (read_index_[i] && !tset_item(read_index_[i] - 1)->same_item(*it))
+            i = (i + 1) & read_index_mask_;
+        if (!read_index_[i])
+            read_index_[i] = tidx + 1;
+    }
+    read_index_ready_ = true;
+}
+
+bool Transaction::preceding_duplicate_read(TransItem* needle, unsigned tidx) {
+    if (!read_index_ready_)
+        build_read_index();
+    unsigned i = index_hash(needle->owner(), needle->key_) & read_index_mask_;
+    while (read_index_[i]) {
+        if (tset_item(read_index_[i] - 1)->same_item(*needle))
+            return read_index_[i] - 1 < tidx;
+        i = (i + 1) & read_index_mask_;
+    }
+    return false;
 }
 
 void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
@@ -95,7 +910,7 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
 
     // die on recursive opacity check; this is only possible for predicates
     if (unlikely(state_ == s_opacity_check)) {
-        mark_abort_because(item, "recursive opacity check", t);
+        mark_abort_because(item, ar_opacity_check_predicate, t);
     abort:
         TXP_INCREMENT(txp_hco_abort);
         abort();
@@ -105,29 +920,49 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
     TXP_INCREMENT(txp_hco);
     if (TransactionTid::is_locked_elsewhere(t, threadid_)) {
         TXP_INCREMENT(txp_hco_lock);
-        mark_abort_because(item, "locked", t);
+        mark_abort_because(item, ar_locked, t);
         goto abort;
     }
+    // read committed never revalidates
+    if (isolation_ == read_committed)
+        return;
     if (t & TransactionTid::nonopaque_bit)
+        // a retry would see the same version, so always extend
         TXP_INCREMENT(txp_hco_invalid);
+    else if (nextensions_ >= opacity_extensions) {
+        if (decentralized_tids)
+            advance_tid_clock(TransactionTid::unlocked(t));
+        TXP_INCREMENT(txp_hco_tl2_abort);
+        mark_abort_because(item, ar_opacity_check, t);
+        goto abort;
+    } else
+        ++nextensions_;
 
     state_ = s_opacity_check;
+    if (decentralized_tids)
+        // decentralized commit TIDs can run ahead of _TID; advance the
+        // clock past t so this snapshot extension covers the new version.
+        // Committers read _TID after locking their write sets, so any
+        // transaction that can still modify our read set will pick a TID
+        // above the new start_tid_.
+        advance_tid_clock(TransactionTid::unlocked(t));
     start_tid_ = _TID;
     release_fence();
+    read_index_ready_ = false;
     TransItem* it = nullptr;
     for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
         it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
         if (it->has_read()) {
             TXP_INCREMENT(txp_total_check_read);
             if (!it->owner()->check(*it, *this)
-                && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(item, "opacity check");
+                && (!may_duplicate_items_ || !preceding_duplicate_read(it, tidx))) {
+                mark_abort_because(it, ar_opacity_check);
                 goto abort;
             }
         } else if (it->has_predicate()) {
             TXP_INCREMENT(txp_total_check_predicate);
             if (!it->owner()->check_predicate(*it, *this, false)) {
-                mark_abort_because(item, "opacity check_predicate");
+                mark_abort_because(it, ar_opacity_check_predicate);
                 goto abort;
             }
         }
@@ -135,19 +970,100 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
     state_ = s_in_progress;
 }
 
+auto Transaction::decentralized_commit_tid() const -> tid_type {
+    // Silo-style: larger than the opacity clock, every version this
+    // transaction observed or locked, and this thread's previous TID.
+    // Called after the write set is locked. Reads the shared clock but
+    // never writes it.
+    threadinfo_t& thr = tinfo[threadid_];
+    tid_type t = std::max(tid_type(_TID), thr.last_commit_tid);
+    t = std::max(t, TransactionTid::unlocked(max_observed_tid_));
+    t = (t & ~(TransactionTid::increment_value - 1)) + TransactionTid::increment_value;
+    thr.last_commit_tid = t;
+    return t;
+}
+
+void Transaction::advance_tid_clock(tid_type t) {
+    t = (t & ~(TransactionTid::increment_value - 1)) + TransactionTid::increment_value;
+    while (1) {
+        tid_type cur = _TID;
+        if (TransactionTid::signed_type(cur - t) >= 0 || bool_cmpxchg(&_TID, cur, t))
+            break;
+        relax_fence();
+    }
+}
+
+void Transaction::acquire_fallback() {
+    uint64_t me = TThread::id() + 1;
+    while (1) {
+        uint64_t token = fallback_token_;
+        if (!(token & fallback_owner_mask)
+            && bool_cmpxchg(&fallback_token_, token,
+                            ((token & ~fallback_owner_mask) + (uint64_t(1) << 32)) | me))
+            break;
+        relax_fence();
+    }
+    acquire_fence();
+    TXP_INCREMENT(txp_total_fallbacks);
+}
+
+void Transaction::wait_for_fallback(uint64_t token) {
+    while (fallback_token_ == token)
+        relax_fence();
+    acquire_fence();
+}
+
+int Transaction::hw_begin(threadinfo_t& thr) {
+    if (!thr.hw) {
+        if (thr.hw_failed)
+            return -1;
+        // counters count the thread that opened them, so a slot reused by
+        // another thread keeps counting its first thread
+        thr.hw = new hw_counter_group;
+        if (!thr.hw->open()) {
+            delete thr.hw;
+            thr.hw = nullptr;
+            thr.hw_failed = true;
+            return -1;
+        }
+        thr.hw_.events = thr.hw->events();
+    }
+    thr.hw->read(hw_mark_);
+    return hp_execute;
+}
+
+void Transaction::hw_switch(int p) {
+    threadinfo_t& thr = tinfo[threadid_];
+    hw_sample now;
+    thr.hw->read(now);
+    hw_sample& acc = thr.hw_.phase[hw_phase_];
+    acc += now;
+    acc -= hw_mark_;
+    hw_mark_ = now;
+    hw_phase_ = p;
+}
+
 void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
-#if STO_TSC_PROFILE
     TimeKeeper<tc_cleanup> tk;
-#endif
     if (!committed) {
         TXP_INCREMENT(txp_total_aborts);
+        abort_reason limit = limits_passed();
+        if (unlikely(limit != ar_count)) {
+            abort_reason_ = limit;
+            TXP_INCREMENT(txp_limit_aborts);
+        }
+        threadinfo_t& thr = tinfo[TThread::id()];
+        thr.aborts_.account(abort_owner_, abort_reason_);
+        if (unlikely(conflict_sample_period) && abort_owner_ && abort_reason_ != ar_user
+            && (conflict_sample_period == 1 || local_random() % conflict_sample_period == 0))
+            thr.conflicts_.add(abort_owner_, abort_key_,
+                               abort_reason_ == ar_locked || abort_reason_ == ar_commit_lock);
 #if STO_DEBUG_ABORTS
         if (local_random() <= uint32_t(0xFFFFFFFF * STO_DEBUG_ABORTS_FRACTION)) {
             std::ostringstream buf;
             buf << "$" << (threadid_ < 10 ? "0" : "") << threadid_
                 << " abort " << state_name(state_);
-            if (abort_reason_)
-                buf << " " << abort_reason_;
+            buf << " " << abort_counters::reason_name(abort_reason_);
             if (abort_item_)
                 buf << " " << *abort_item_;
             if (abort_version_)
@@ -204,23 +1120,89 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
 after_unlock:
     // TODO: this will probably mess up with nested transactions
     threadinfo_t& thr = tinfo[TThread::id()];
-    if (thr.trans_end_callback)
-        thr.trans_end_callback();
-    // XXX should reset trans_end_callback after calling it...
+    if (snapshot_tid_)
+        thr.snapshot_tid = 0;
+    if (thr.contention)
+        thr.contention->finish(committed);
+    if (unlikely(hw_phase_ >= 0)) {
+        hw_switch(-1);
+        thr.hw_.commits += committed;
+    }
     state_ = s_aborted + committed;
+    if (!interleaved_ || interleave_stop(thr))
+        for (unsigned i = 0; i != thr.nend_hooks; ++i)
+            thr.end_hooks[i].fn(thr.end_hooks[i].ctx);
 
-#if STO_TSC_PROFILE
-    auto endtime = read_tsc();
-    if (!committed)
-        TSC_ACCOUNT(tc_abort, endtime - start_tsc_);
-#endif
+    if (!committed && start_tsc_)
+        TSC_ACCOUNT(tc_abort, read_tsc() - start_tsc_);
+}
+
+TLogBuffer* Transaction::log_begin() {
+    threadinfo_t& thr = tinfo[TThread::id()];
+    if (!thr.log)
+        thr.log = TLog::make_buffer(TThread::id());
+    log_ = thr.log;
+    log_->begin_record(log_epoch_, commit_tid());
+    return log_;
+}
+
+void Transaction::add_hook(hook_type type, void (*fn)(void*), void* ctx) {
+    threadinfo_t& thr = tinfo[TThread::id()];
+    auto hooks = type == hook_start ? thr.start_hooks : thr.end_hooks;
+    auto& n = type == hook_start ? thr.nstart_hooks : thr.nend_hooks;
+    for (unsigned i = 0; i != n; ++i)
+        if (hooks[i].fn == fn && hooks[i].ctx == ctx)
+            return;
+    always_assert(n < threadinfo_t::max_hooks && "too many transaction hooks");
+    hooks[n].fn = fn;
+    hooks[n].ctx = ctx;
+    ++n;
+}
+
+void Transaction::remove_hook(hook_type type, void (*fn)(void*), void* ctx) {
+    threadinfo_t& thr = tinfo[TThread::id()];
+    auto hooks = type == hook_start ? thr.start_hooks : thr.end_hooks;
+    auto& n = type == hook_start ? thr.nstart_hooks : thr.nend_hooks;
+    for (unsigned i = 0; i != n; ++i)
+        if (hooks[i].fn == fn && hooks[i].ctx == ctx) {
+            std::copy(hooks + i + 1, hooks + n, hooks + i);
+            --n;
+            return;
+        }
+}
+
+bool Transaction::interleave_start(threadinfo_t& thr) {
+    unsigned o = thr.interleave_old;
+    // the new generation is empty whenever the old one is
+    if (!thr.ninterleaved[o]) {
+        interleave_gen_ = o;
+        ++thr.ninterleaved[o];
+        return true;
+    }
+    if (!thr.ninterleaved[!o])
+        thr.interleave_epoch = global_epochs.global_epoch;
+    interleave_gen_ = !o;
+    ++thr.ninterleaved[!o];
+    return false;
+}
+
+bool Transaction::interleave_stop(threadinfo_t& thr) {
+    unsigned o = thr.interleave_old;
+    if (--thr.ninterleaved[interleave_gen_] || interleave_gen_ != o)
+        return false;
+    if (!thr.ninterleaved[!o])
+        return true;
+    // every transaction still in flight started at or after
+    // interleave_epoch
+    thr.epoch = thr.interleave_epoch;
+    thr.interleave_old = !o;
+    return false;
 }
 
 bool Transaction::try_commit() {
-#if STO_TSC_PROFILE
     TimeKeeper<tc_commit> tk;
-#endif
     assert(TThread::id() == threadid_);
+    assert(!nested_depth_);
 #if ASSERT_TX_SIZE
     if (tset_size_ > TX_SIZE_LIMIT) {
         std::cerr << "transSet_ size at " << tset_size_
@@ -235,21 +1217,85 @@ bool Transaction::try_commit() {
     if (state_ >= s_aborted)
         return state_ > s_aborted;
 
+    // snapshot transactions read a consistent past state; nothing to check
+    if (snapshot_tid_ && isolation_ == serializable) {
+        always_assert(!any_writes_ && "snapshot transactions are read-only");
+        stop(true, nullptr, 0);
+        return true;
+    }
+
     if (any_nonopaque_)
         TXP_INCREMENT(txp_commit_time_nonopaque);
 #if !CONSISTENCY_CHECK
-    // commit immediately if read-only transaction with opacity
-    if (!any_writes_ && !any_nonopaque_) {
+    if (read_only_) {
+        always_assert(!any_writes_ && "read-only transactions can't write");
+        if (any_nonopaque_ && !validate_read_only()) {
+            TXP_INCREMENT(txp_commit_time_aborts);
+            stop(false, nullptr, 0);
+            if (tk.init_tsc_val())
+                TSC_ACCOUNT(tc_commit_wasted, read_tsc() - tk.init_tsc_val());
+            return false;
+        }
+        stop(true, nullptr, 0);
+        return true;
+    }
+
+    // commit immediately if read-only transaction with opacity, or at
+    // read committed
+    if (!any_writes_ && (!any_nonopaque_ || isolation_ == read_committed)) {
         stop(true, nullptr, 0);
         return true;
     }
 #endif
 
+    // don't disturb another thread's fallback transaction
+    uint64_t token = fallback_token_;
+    if ((token & fallback_owner_mask)
+        && (token & fallback_owner_mask) != unsigned(threadid_ + 1)
+        && any_writes_)
+        wait_for_fallback(token);
+
+    // a lone blind write may be ordered before a concurrent writer;
+    // decentralized TIDs can run ahead of _TID, so the stamp would
+    // misjudge which writers are concurrent
+    if (unlikely(blind_stamp_)) {
+        TransItem* it = &tset0_[0];
+        if (tset_size_ == 1 && it->has_flag(TransItem::blind_bit)
+            && !it->has_read() && !it->has_predicate()
+            && isolation_ == serializable && !TLog::enabled()
+            && !decentralized_tids)
+            return blind_commit(it);
+        blind_stamp_ = 0;
+    }
+
+    // duplicate items need check's per-item fallback
+    bool grouped = !STO_SORT_WRITESET && group_commit && !may_duplicate_items_;
+    // a written item's predicate (e.g. a conditional update's) must hold
+    // under its lock; if locking comes after this loop, check it later
+    bool late_predicates = STO_SORT_WRITESET || grouped;
+    bool parallel = !STO_SORT_WRITESET && parallel_install_threshold
+        && tset_size_ >= parallel_install_threshold && !TLog::enabled();
+    if (tset_size_ >= writeset_capacity_ || ((grouped || parallel) && !group_items_))
+        grow_writeset(tset_size_);
+
+    // an HTM commit counts wholly as locking
+    hw_enter(hp_lock);
+
+#if !CONSISTENCY_CHECK
+    if (tset_size_ <= htm_max_items && tset_size_ <= tset_initial_capacity
+        && isolation_ == serializable
+        && !TLog::enabled() && htm_available() && htm_try_commit())
+        return true;
+#endif
+
     state_ = s_committing;
 
-    unsigned writeset[tset_size_];
+    unsigned* writeset = writeset_;
     unsigned nwriteset = 0;
     writeset[0] = tset_size_;
+    unsigned prefetch_end = 0;
+    // read committed checks only the reads of written items
+    bool check_reads = isolation_ != read_committed;
 
     TransItem* it = nullptr;
     for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
@@ -257,23 +1303,26 @@ bool Transaction::try_commit() {
         if (it->has_write()) {
             writeset[nwriteset++] = tidx;
 #if !STO_SORT_WRITESET
-            if (nwriteset == 1) {
-                first_write_ = writeset[0];
-                state_ = s_committing_locked;
-            }
-            if (!it->owner()->lock(*it, *this)) {
-                mark_abort_because(it, "commit lock");
-                goto abort;
+            if (!grouped) {
+                if (nwriteset == 1) {
+                    first_write_ = writeset[0];
+                    state_ = s_committing_locked;
+                }
+                if (!it->owner()->lock(*it, *this)) {
+                    mark_abort_because(it, lock_abort_reason());
+                    goto abort;
+                }
+                it->__or_flags(TransItem::lock_bit);
             }
-            it->__or_flags(TransItem::lock_bit);
 #endif
         }
         if (it->has_read())
             TXP_INCREMENT(txp_total_r);
-        else if (it->has_predicate()) {
+        else if (it->has_predicate() && (check_reads || it->has_write())
+                 && !(late_predicates && it->has_write())) {
             TXP_INCREMENT(txp_total_check_predicate);
             if (!it->owner()->check_predicate(*it, *this, true)) {
-                mark_abort_because(it, "commit check_predicate");
+                mark_abort_because(it, ar_commit_check_predicate);
                 goto abort;
             }
         }
@@ -282,12 +1331,15 @@ bool Transaction::try_commit() {
     first_write_ = writeset[0];
 
     //phase1
-#if STO_SORT_WRITESET
-    std::sort(writeset, writeset + nwriteset, [&] (unsigned i, unsigned j) {
-        TransItem* ti = &tset_[i / tset_chunk][i % tset_chunk];
-        TransItem* tj = &tset_[j / tset_chunk][j % tset_chunk];
-        return *ti < *tj;
-    });
+#if !STO_SORT_WRITESET
+    if (grouped && nwriteset) {
+        state_ = s_committing_locked;
+        if (!lock_grouped(writeset, nwriteset))
+            goto abort;
+    }
+#else
+    if (nwriteset > 1)
+        sort_writeset(writeset, nwriteset);
 
     if (nwriteset) {
         state_ = s_committing_locked;
@@ -295,7 +1347,7 @@ bool Transaction::try_commit() {
         for (auto it = writeset; it != writeset_end; ) {
             TransItem* me = &tset_[*it / tset_chunk][*it % tset_chunk];
             if (!me->owner()->lock(*me, *this)) {
-                mark_abort_because(me, "commit lock");
+                mark_abort_because(me, lock_abort_reason());
                 goto abort;
             }
             me->__or_flags(TransItem::lock_bit);
@@ -304,6 +1356,13 @@ bool Transaction::try_commit() {
     }
 #endif
 
+    // As in Silo, log records take the epoch read after locking, so a
+    // transaction's epoch is at least that of every transaction whose
+    // effects it saw or overwrote
+    if (unlikely(TLog::enabled()) && nwriteset) {
+        fence();
+        log_epoch_ = TLog::log_epoch(global_epochs.global_epoch);
+    }
 
 #if CONSISTENCY_CHECK
     fence();
@@ -312,14 +1371,36 @@ bool Transaction::try_commit() {
 #endif
 
     //phase2
-    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it->has_read()) {
-            TXP_INCREMENT(txp_total_check_read);
-            if (!it->owner()->check(*it, *this)
-                && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(it, "commit check");
-                goto abort;
+    hw_enter(hp_validate);
+    // each check() usually misses on a version word; keep several of
+    // those loads in flight for transactions large enough to benefit
+    if (prefetch_validation && !grouped && tset_size_ > check_prefetch_distance) {
+        prefetch_end = tset_size_;
+        for (unsigned tidx = 0; tidx != check_prefetch_distance; ++tidx)
+            prefetch_check_item(tidx);
+    }
+    read_index_ready_ = false;
+    if (grouped) {
+        if (!check_grouped(check_reads))
+            goto abort;
+    } else {
+        for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+            it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+            if (tidx + check_prefetch_distance < prefetch_end)
+                prefetch_check_item(tidx + check_prefetch_distance);
+            if (it->has_read() && (check_reads || it->has_write())) {
+                TXP_INCREMENT(txp_total_check_read);
+                if (!it->owner()->check(*it, *this)
+                    && (!may_duplicate_items_ || !preceding_duplicate_read(it, tidx))) {
+                    mark_abort_because(it, it->owner()->absent_check(*it) ? ar_commit_check_absent : ar_commit_check);
+                    goto abort;
+                }
+            } else if (late_predicates && it->has_predicate() && it->has_write()) {
+                TXP_INCREMENT(txp_total_check_predicate);
+                if (!it->owner()->check_predicate(*it, *this, true)) {
+                    mark_abort_because(it, ar_commit_check_predicate);
+                    goto abort;
+                }
             }
         }
     }
@@ -327,6 +1408,7 @@ bool Transaction::try_commit() {
     // fence();
 
     //phase3
+    hw_enter(hp_install);
 #if STO_SORT_WRITESET
     for (unsigned tidx = first_write_; tidx != tset_size_; ++tidx) {
         it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
@@ -336,7 +1418,11 @@ bool Transaction::try_commit() {
         }
     }
 #else
-    if (nwriteset) {
+    if (parallel && nwriteset >= parallel_install_threshold)
+        install_parallel(writeset, nwriteset, grouped);
+    else if (grouped)
+        install_grouped(nwriteset);
+    else if (nwriteset) {
         auto writeset_end = writeset + nwriteset;
         for (auto idxit = writeset; idxit != writeset_end; ++idxit) {
             if (likely(*idxit < tset_initial_capacity))
@@ -349,6 +1435,12 @@ bool Transaction::try_commit() {
     }
 #endif
 
+    if (log_) {
+        log_->end_record();
+        log_ = nullptr;
+    } else
+        log_epoch_ = 0;
+
     // fence();
     stop(true, writeset, nwriteset);
     return true;
@@ -357,14 +1449,164 @@ abort:
     // fence();
     TXP_INCREMENT(txp_commit_time_aborts);
     stop(false, nullptr, 0);
-#if STO_TSC_PROFILE
-    auto endtime = read_tsc();
-    TSC_ACCOUNT(tc_commit_wasted, endtime - tk.init_tsc_val());
+    if (tk.init_tsc_val())
+        TSC_ACCOUNT(tc_commit_wasted, read_tsc() - tk.init_tsc_val());
+    return false;
+}
+
+// Commits a transaction whose only item is a blind write by the Thomas
+// write rule. A version at or above blind_stamp_ was committed after the
+// write was made, by a transaction concurrent with this one, so this one
+// can be ordered just before it: its write would be overwritten, so it's
+// dropped without locking the item. Otherwise the item is locked, waiting
+// out other committers rather than aborting, and installed. With more
+// items this would be unsafe: a reader could see the newer version
+// alongside another item's value from before this transaction.
+bool Transaction::blind_commit(TransItem* it) {
+    unsigned writeset = 0;
+    hw_enter(hp_lock);
+    state_ = s_committing_locked;
+    if (!it->owner()->lock(*it, *this)) {
+        if (blind_stamp_) {
+            mark_abort_because(it, lock_abort_reason());
+            TXP_INCREMENT(txp_commit_time_aborts);
+            stop(false, nullptr, 0);
+            return false;
+        }
+        TXP_INCREMENT(txp_blind_drops);
+        stop(true, &writeset, 1);
+        return true;
+    }
+    it->__or_flags(TransItem::lock_bit);
+    hw_enter(hp_install);
+    TXP_INCREMENT(txp_total_w);
+    it->owner()->install(*it, *this);
+    stop(true, &writeset, 1);
+    return true;
+}
+
+// Commit-time checks of a read-only transaction: with nothing to lock or
+// install, one pass checks every read and predicate.
+bool Transaction::validate_read_only() {
+    state_ = s_committing;
+    hw_enter(hp_validate);
+    read_index_ready_ = false;
+    TransItem* it = nullptr;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+        if (it->has_read()) {
+            TXP_INCREMENT(txp_total_r);
+            TXP_INCREMENT(txp_total_check_read);
+            if (!it->owner()->check(*it, *this)
+                && (!may_duplicate_items_ || !preceding_duplicate_read(it, tidx))) {
+                mark_abort_because(it, it->owner()->absent_check(*it) ? ar_commit_check_absent : ar_commit_check);
+                return false;
+            }
+        } else if (it->has_predicate()) {
+            TXP_INCREMENT(txp_total_check_predicate);
+            if (!it->owner()->check_predicate(*it, *this, true)) {
+                mark_abort_because(it, ar_commit_check_predicate);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Run try_commit's phases inside a hardware transaction. Locks taken
+// here are released before the hardware commit, so no other thread sees
+// them; a conflicting commit or a change to a version word read here
+// aborts the hardware transaction instead. Returns false if the commit
+// should run in software.
+HTM_TARGET bool Transaction::htm_try_commit() {
+#if HTM_SUPPORTED
+    enum { htm_abort_locked = 1, htm_abort_invalid = 2 };
+    TransItem* end = tset0_ + tset_size_;
+    for (unsigned attempt = 0; attempt != htm_max_retries; ++attempt) {
+        htm_status status = htm_begin();
+        if (status == HTM_STARTED) {
+            state_ = s_committing_locked;
+            unsigned nwriteset = 0;
+            writeset_[0] = tset_size_;
+            for (TransItem* it = tset0_; it != end; ++it) {
+                if (it->has_write()) {
+                    writeset_[nwriteset++] = it - tset0_;
+                    if (!it->owner()->lock(*it, *this))
+                        htm_abort(htm_abort_locked);
+                    it->__or_flags(TransItem::lock_bit);
+                }
+                if (!it->has_read() && it->has_predicate()
+                    && !it->owner()->check_predicate(*it, *this, true))
+                    htm_abort(htm_abort_invalid);
+            }
+            first_write_ = writeset_[0];
+            read_index_ready_ = false;
+            for (TransItem* it = tset0_; it != end; ++it)
+                if (it->has_read() && !it->owner()->check(*it, *this)
+                    && (!may_duplicate_items_ || !preceding_duplicate_read(it, it - tset0_)))
+                    htm_abort(htm_abort_invalid);
+            for (unsigned i = 0; i != nwriteset; ++i)
+                tset0_[writeset_[i]].owner()->install(tset0_[writeset_[i]], *this);
+            for (unsigned i = nwriteset; i != 0; --i) {
+                TransItem& item = tset0_[writeset_[i - 1]];
+                if (item.needs_unlock()) {
+                    item.owner()->unlock(item);
+                    item.clear_needs_unlock();
+                }
+            }
+            htm_end();
+            TXP_INCREMENT(txp_htm_commits);
+            log_epoch_ = 0;
+            stop(true, writeset_, nwriteset);
+            return true;
+        }
+        TXP_INCREMENT(txp_htm_aborts);
+        if (htm_capacity_abort(status))
+            TXP_INCREMENT(txp_htm_capacity_aborts);
+        if (htm_explicit_abort(status) || !htm_may_retry(status))
+            break;
+        relax_fence();
+    }
+    TXP_INCREMENT(txp_htm_fallbacks);
 #endif
     return false;
 }
 
+double tsc_ghz() {
+#ifdef PROC_TSC_FREQ
+    return PROC_TSC_FREQ;
+#else
+    static double ghz = [] {
+        // count ticks over 20ms of wall-clock time
+        typedef std::chrono::steady_clock clock_type;
+        auto t0 = clock_type::now();
+        uint64_t c0 = read_tsc();
+        std::chrono::nanoseconds d;
+        do {
+            relax_fence();
+            d = clock_type::now() - t0;
+        } while (d < std::chrono::milliseconds(20));
+        uint64_t c1 = read_tsc();
+        return double(c1 - c0) / d.count();
+    }();
+    return ghz;
+#endif
+}
+
+const char* abort_counters::reason_name(int r) {
+    static const char* const names[] = {
+        "user", "locked", "opacity check", "opacity check_predicate",
+        "commit lock", "commit check", "commit check_predicate",
+        "commit check_absent", "incremental check", "write conflict", "deadline",
+        "cancelled"
+    };
+    static_assert(arraysize(names) == ar_count, "abort reason names");
+    return names[r];
+}
+
 void Transaction::print_stats() {
+    // every counter below txp_total_n is kept at all profile levels
+    static_assert(txp_admission_waits + 1 == txp_total_n, "txp layout");
     txp_counters out = txp_counters_combined();
     if (txp_count >= txp_max_set) {
         unsigned long long txc_total_starts = out.p(txp_total_starts);
@@ -391,6 +1633,34 @@ void Transaction::print_stats() {
         fprintf(stderr, "$ %llu HCO (%llu lock, %llu invalid, %llu aborts) out of %llu check attempts (%.3f%%)\n",
                 out.p(txp_hco), out.p(txp_hco_lock), out.p(txp_hco_invalid), out.p(txp_hco_abort), out.p(txp_tco),
                 100.0 * (double) out.p(txp_hco) / out.p(txp_tco));
+    if (out.p(txp_hco_tl2_abort))
+        fprintf(stderr, "$ %llu aborts past the opacity extension limit\n", out.p(txp_hco_tl2_abort));
+    if (out.p(txp_validations))
+        fprintf(stderr, "$ %llu incremental validations, %llu early aborts\n",
+                out.p(txp_validations), out.p(txp_early_aborts));
+    if (out.p(txp_limit_aborts) || out.p(txp_give_ups))
+        fprintf(stderr, "$ %llu aborts past deadlines or cancelled, %llu limited loops gave up\n",
+                out.p(txp_limit_aborts), out.p(txp_give_ups));
+    if (out.p(txp_blind_drops))
+        fprintf(stderr, "$ %llu blind writes dropped by the Thomas write rule\n", out.p(txp_blind_drops));
+    if (out.p(txp_admission_waits))
+        fprintf(stderr, "$ %llu admission control waits\n", out.p(txp_admission_waits));
+    if (out.p(txp_total_fallbacks))
+        fprintf(stderr, "$ %llu fallback attempts\n", out.p(txp_total_fallbacks));
+    if (out.p(txp_nested_retries))
+        fprintf(stderr, "$ %llu nested transaction retries\n", out.p(txp_nested_retries));
+    if (out.p(txp_htm_commits) || out.p(txp_htm_aborts))
+        fprintf(stderr, "$ %llu HTM commits, %llu software commits; %llu HTM aborts (%llu capacity), %llu HTM fallbacks\n",
+                out.p(txp_htm_commits),
+                out.p(txp_total_starts) - out.p(txp_total_aborts) - out.p(txp_htm_commits),
+                out.p(txp_htm_aborts), out.p(txp_htm_capacity_aborts), out.p(txp_htm_fallbacks));
+    if (out.p(txp_rcu_eager))
+        fprintf(stderr, "$ %llu eager RCU reclamations\n", out.p(txp_rcu_eager));
+    rcu_backlog_stats rcu = rcu_backlog_combined();
+    if (rcu.total)
+        fprintf(stderr, "$ RCU backlog %llu, at most %llu (thread %u), epoch interval %uus\n",
+                (unsigned long long) rcu.total, (unsigned long long) rcu.max,
+                rcu.max_thread, global_epochs.interval_us);
     if (txp_count >= txp_hash_collision)
         fprintf(stderr, "$ %llu (%.3f%%) hash collisions, %llu second level\n", out.p(txp_hash_collision),
                 100.0 * (double) out.p(txp_hash_collision) / out.p(txp_hash_find),
@@ -398,10 +1668,28 @@ void Transaction::print_stats() {
     if (txp_count >= txp_total_transbuffer)
         fprintf(stderr, "$ %llu max buffer per txn, %llu total buffer\n",
                 out.p(txp_max_transbuffer), out.p(txp_total_transbuffer));
+    abort_counters ac = abort_counters_combined();
+    for (auto& sl : ac.slots_) {
+        std::stringstream ss;
+        for (int r = 0; r != ar_count; ++r)
+            if (sl.n[r])
+                ss << ", " << sl.n[r] << " " << abort_counters::reason_name(r);
+        if (!ss.str().empty())
+            fprintf(stderr, "$ aborts on %p%s\n", (const void*) sl.owner, ss.str().c_str());
+    }
+    for (auto& e : top_conflicts(10))
+        fprintf(stderr, "$ conflicts on %p key %#llx: %llu (%llu lock), error %llu\n",
+                (const void*) e.owner, (unsigned long long) reinterpret_cast<uintptr_t>(e.key),
+                (unsigned long long) e.count, (unsigned long long) e.locks,
+                (unsigned long long) e.error);
     fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) _TID);
 
-#if STO_TSC_PROFILE
     tc_counters out_tcs = tc_counters_combined();
+    bool any_timing = false;
+    for (int t = 0; t != tc_count; ++t)
+        any_timing = any_timing || out_tcs.tcs_[t];
+    if (!any_timing)
+        return;
     std::stringstream ss;
     ss << std::endl << "$ Timing breakdown: " << std::endl;
     ss << "   time_commit: " << out_tcs.to_realtime(tc_commit) << std::endl;
@@ -410,9 +1698,79 @@ void Transaction::print_stats() {
     ss << "   time_abort: " << out_tcs.to_realtime(tc_abort) << std::endl;
     ss << "   time_cleanup: " << out_tcs.to_realtime(tc_cleanup) << std::endl;
     ss << "   time_opacity: " << out_tcs.to_realtime(tc_opacity) << std::endl;
+    ss << "   time_transaction: " << out_tcs.to_realtime(tc_transaction) << std::endl;
+    ss << "   time_validate: " << out_tcs.to_realtime(tc_validate) << std::endl;
+    ss << "$ Latency (us, p50/p99/p999):";
+    static const struct { int tc; const char* name; } latencies[] = {
+        {tc_transaction, "transaction"}, {tc_commit, "commit"},
+        {tc_abort, "abort"}, {tc_find_item, "find_item"}
+    };
+    for (auto& l : latencies) {
+        log_histogram h = latency_combined(l.tc);
+        if (h.count())
+            ss << std::endl << "   " << l.name << ": "
+               << h.quantile(0.5) / tsc_ghz() / 1000 << " / "
+               << h.quantile(0.99) / tsc_ghz() / 1000 << " / "
+               << h.quantile(0.999) / tsc_ghz() / 1000
+               << " (" << h.count() << " samples)";
+    }
+    ss << std::endl;
 
     fprintf(stderr, "%s\n", ss.str().c_str());
-#endif
+}
+
+std::vector<conflict_sketch::entry> Transaction::top_conflicts(unsigned k) {
+    std::vector<conflict_sketch::entry> all;
+    for (unsigned i = 0; i != used_threads(); ++i) {
+        const conflict_sketch& cs = tinfo[i].conflicts_;
+        for (unsigned j = 0; j != cs.n_; ++j) {
+            const conflict_sketch::entry& e = cs.e_[j];
+            auto it = std::find_if(all.begin(), all.end(), [&](const conflict_sketch::entry& x) {
+                    return x.owner == e.owner && x.key == e.key;
+                });
+            if (it == all.end())
+                all.push_back(e);
+            else {
+                it->count += e.count;
+                it->error += e.error;
+                it->locks += e.locks;
+            }
+        }
+    }
+    std::sort(all.begin(), all.end(), [](const conflict_sketch::entry& a, const conflict_sketch::entry& b) {
+            return a.count > b.count;
+        });
+    if (all.size() > k)
+        all.resize(k);
+    return all;
+}
+
+auto Transaction::counters_snapshot() -> counter_snapshot {
+    counter_snapshot s;
+    s.p = txp_counters_combined();
+    s.tc = tc_counters_combined();
+    for (int t = 0; t != tc_count; ++t)
+        s.latency[t] = latency_combined(t);
+    s.aborts = abort_counters_combined();
+    return s;
+}
+
+auto Transaction::counter_snapshot::since(const counter_snapshot& earlier) const -> counter_snapshot {
+    counter_snapshot d = *this;
+    for (int i = 0; i != txp_count; ++i)
+        if (!txp_is_max(i))
+            d.p.p_[i] -= earlier.p.p_[i];
+    for (int t = 0; t != tc_count; ++t) {
+        d.tc.tcs_[t] -= earlier.tc.tcs_[t];
+        d.latency[t].subtract(earlier.latency[t]);
+    }
+    // abort slots are matched by owner, not position
+    for (auto& sl : d.aborts.slots_)
+        if (sl.owner || &sl == d.aborts.slots_)
+            if (auto e = earlier.aborts.lookup(sl.owner))
+                for (int r = 0; r != ar_count; ++r)
+                    sl.n[r] -= e->n[r];
+    return d;
 }
 
 const char* Transaction::state_name(int state) {
@@ -4,14 +4,26 @@
 #include "compiler.hh"
 #include "small_vector.hh"
 #include "TRcu.hh"
+#include "fingerprint.hh"
+#include "histogram.hh"
+#include "TContention.hh"
+#include "TAdmission.hh"
+#include "TLog.hh"
+#include "PerfCounters.hh"
+#include "footprint.hh"
+#include "TPages.hh"
 #include <algorithm>
 #include <functional>
 #include <memory>
 #include <type_traits>
 #include <unistd.h>
+#include <malloc.h>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
+// Initial profiling settings (see Transaction::set_profile): the txp
+// counter level kept (0-2), and whether TSC timing counters are kept
 #ifndef STO_PROFILE_COUNTERS
 #define STO_PROFILE_COUNTERS 0
 #endif
@@ -25,9 +37,7 @@
 #error "BILLION already defined!"
 #endif
 
-#ifndef PROC_TSC_FREQ
-#define PROC_TSC_FREQ 2.2 // Default processor base freq in GHz
-#endif
+// Define PROC_TSC_FREQ (in GHz) to skip TSC calibration (see tsc_ghz())
 
 #ifndef STO_DEBUG_HASH_COLLISIONS
 #define STO_DEBUG_HASH_COLLISIONS 0
@@ -59,6 +69,48 @@
 #define STO_ABORT_ON_LOCKED 1
 #endif
 
+// Default for Transaction::decentralized_tids (can be changed at run time)
+#ifndef STO_DECENTRALIZED_TID
+#define STO_DECENTRALIZED_TID 0
+#endif
+
+// Defaults for Transaction::epoch_interval_min_us, epoch_interval_max_us
+// and rcu_eager_threshold (can be changed at run time)
+#ifndef STO_EPOCH_INTERVAL_MIN
+#define STO_EPOCH_INTERVAL_MIN 1000
+#endif
+#ifndef STO_EPOCH_INTERVAL_MAX
+#define STO_EPOCH_INTERVAL_MAX 100000
+#endif
+#ifndef STO_RCU_EAGER_THRESHOLD
+#define STO_RCU_EAGER_THRESHOLD 262144
+#endif
+
+// Default for Transaction::rcu_clean_budget (can be changed at run time)
+#ifndef STO_RCU_CLEAN_BUDGET
+#define STO_RCU_CLEAN_BUDGET 256
+#endif
+
+// Default for Transaction::fallback_aborts (can be changed at run time)
+#ifndef STO_FALLBACK_ABORTS
+#define STO_FALLBACK_ABORTS 0
+#endif
+
+// Default for Transaction::opacity_extensions (can be changed at run time)
+#ifndef STO_OPACITY_EXTENSIONS
+#define STO_OPACITY_EXTENSIONS (~0U)
+#endif
+
+// Default for Transaction::validate_interval (can be changed at run time)
+#ifndef STO_VALIDATE_INTERVAL
+#define STO_VALIDATE_INTERVAL 0
+#endif
+
+// Default for Transaction::htm_max_items (can be changed at run time)
+#ifndef STO_HTM_MAX_ITEMS
+#define STO_HTM_MAX_ITEMS 0
+#endif
+
 #ifndef STO_SPIN_BOUND_WRITE
 #if STO_SPIN_EXPBACKOFF
 #define STO_SPIN_BOUND_WRITE 7
@@ -90,7 +142,10 @@
 
 #include "config.h"
 
-#define MAX_THREADS 32
+// Upper bound on the thread registry size; limited by the thread id field
+// of TransactionTid. The registry itself is sized at startup (see
+// Transaction::set_max_threads).
+#define MAX_THREADS 256
 
 // TRANSACTION macros that can be used to wrap transactional code
 #define TRANSACTION                               \
@@ -99,13 +154,29 @@
         while (1) {                               \
             __txn_guard.start();                  \
             try {
+#define TRANSACTION_KIND(kind)                    \
+    do {                                          \
+        TransactionLoopGuard __txn_guard(kind);   \
+        while (1) {                               \
+            __txn_guard.start();                  \
+            try {
+// a TRANSACTION loop bounded by a TransactionLimits
+#define TRANSACTION_LIMITED(limits)               \
+    do {                                          \
+        TransactionLoopGuard __txn_guard(limits); \
+        while (1) {                               \
+            __txn_guard.start();                  \
+            try {
+#define SNAPSHOT_TRANSACTION TRANSACTION_KIND(TransactionLoopGuard::snapshot)
+#define READ_ONLY_TRANSACTION TRANSACTION_KIND(TransactionLoopGuard::read_only)
+#define SNAPSHOT_ISOLATION_TRANSACTION TRANSACTION_KIND(TransactionLoopGuard::snapshot_isolation)
+#define READ_COMMITTED_TRANSACTION TRANSACTION_KIND(TransactionLoopGuard::read_committed)
 #define RETRY(retry)                              \
                 if (__txn_guard.try_commit())     \
                     break;                        \
             } catch (Transaction::Abort e) {      \
             }                                     \
-            if (!(retry))                         \
-                throw Transaction::Abort();       \
+            __txn_guard.after_abort(!(retry));    \
         }                                         \
     } while (0)
 
@@ -122,7 +193,21 @@ enum txp {
     txp_hco_lock,
     txp_hco_invalid,
     txp_hco_abort,
-    // STO_PROFILE_COUNTERS > 1 only
+    txp_hco_tl2_abort,
+    txp_total_fallbacks,
+    txp_rcu_eager,
+    txp_nested_retries,
+    txp_htm_commits,
+    txp_htm_aborts,
+    txp_htm_capacity_aborts,
+    txp_htm_fallbacks,
+    txp_validations,
+    txp_early_aborts,
+    txp_limit_aborts,
+    txp_give_ups,
+    txp_blind_drops,
+    txp_admission_waits,
+    // profile level > 1 only
     txp_total_n,
     txp_total_r,
     txp_total_w,
@@ -136,13 +221,7 @@ enum txp {
     txp_hash_collision,
     txp_hash_collision2,
     txp_total_searched,
-#if !STO_PROFILE_COUNTERS
-    txp_count = 0
-#elif STO_PROFILE_COUNTERS == 1
-    txp_count = txp_hco_abort + 1
-#else
     txp_count
-#endif
 };
 typedef uint64_t txp_counter_type;
 
@@ -150,6 +229,11 @@ inline constexpr bool txp_is_max(unsigned p) {
     return p == txp_max_set || p == txp_max_transbuffer;
 }
 
+// the lowest profile level at which counter p is kept
+inline constexpr unsigned txp_level(unsigned p) {
+    return p < txp_total_n ? 1 : 2;
+}
+
 template <unsigned P, unsigned N, bool Less = (P < N)> struct txp_helper;
 template <unsigned P, unsigned N> struct txp_helper<P, N, true> {
     static bool counter_exists(unsigned p) {
@@ -193,11 +277,17 @@ enum TimingCounters {
     tc_abort,
     tc_cleanup,
     tc_opacity,
+    tc_transaction, // TRANSACTION loops: first start to commit, with retries
+    tc_validate,    // incremental validation (Transaction::validate_interval)
     tc_count
 };
 
 typedef uint64_t tc_counter_type;
 
+// TSC ticks per nanosecond: PROC_TSC_FREQ if defined, otherwise measured
+// against the system clock on first call
+double tsc_ghz();
+
 template <int C, int N, bool Less = (C < N)>
 struct tc_helper;
 
@@ -224,7 +314,7 @@ struct tc_counters {
         return tc_helper<0, tc_count>::counter_exists(name) ? tcs_[name] : 0;
     }
     double to_realtime(int name) {
-        return (double)timing_counter(name) / BILLION / PROC_TSC_FREQ;
+        return (double)timing_counter(name) / BILLION / tsc_ghz();
     }
     void reset() {
         for (int i = 0; i < tc_count; ++i)
@@ -232,6 +322,188 @@ struct tc_counters {
     }
 };
 
+// Phases of a transaction for hardware counter profiling (see
+// Transaction::set_profile_hw): execution from start() to try_commit(),
+// then try_commit's locking, validation, and install (through cleanup)
+enum hw_phase {
+    hp_execute = 0,
+    hp_lock,
+    hp_validate,
+    hp_install,
+    hp_count
+};
+
+// Hardware counts per phase. Aborted attempts count in the phases they
+// ran, so per-commit figures include the work that aborts wasted.
+struct hw_phase_counters {
+    hw_sample phase[hp_count];
+    uint64_t commits;
+    unsigned events; // see hw_counter_group::events
+    hw_phase_counters() { reset(); }
+    void reset() {
+        for (auto& s : phase)
+            s.reset();
+        commits = 0;
+        events = 0;
+    }
+    hw_sample total() const {
+        hw_sample s = phase[0];
+        for (int p = 1; p != hp_count; ++p)
+            s += phase[p];
+        return s;
+    }
+    hw_phase_counters since(const hw_phase_counters& earlier) const {
+        hw_phase_counters d = *this;
+        for (int p = 0; p != hp_count; ++p)
+            d.phase[p] -= earlier.phase[p];
+        d.commits -= earlier.commits;
+        return d;
+    }
+    static const char* phase_name(int p) {
+        static const char* names[] = {"execute", "lock", "validate", "install"};
+        return unsigned(p) < hp_count ? names[p] : "?";
+    }
+};
+
+// Why a transaction aborted (see Transaction::abort_counters_combined)
+enum abort_reason {
+    ar_user = 0,                // Sto::abort(), an exception, or a TObject
+    ar_locked,                  // observed a version locked by another txn
+    ar_opacity_check,
+    ar_opacity_check_predicate, // including recursive opacity checks
+    ar_commit_lock,
+    ar_commit_check,
+    ar_commit_check_predicate,
+    ar_commit_check_absent,     // see TObject::absent_check
+    ar_incremental_check,       // see Transaction::validate_interval
+    ar_write_conflict,          // snapshot isolation's first-committer-wins
+    ar_deadline,                // see Transaction::set_limits
+    ar_cancelled,
+    ar_count
+};
+
+class TObject;
+
+// A flag that cancels the transactions watching it (see
+// Transaction::set_limits and TransactionLimits). Any thread may cancel;
+// transactions notice at their next checkpoint or lock wait.
+class TCancelToken {
+public:
+    TCancelToken()
+        : cancelled_(false) {
+    }
+    void cancel() {
+        cancelled_ = true;
+        fence();
+    }
+    void reset() {
+        cancelled_ = false;
+    }
+    bool cancelled() const {
+        return cancelled_;
+    }
+private:
+    volatile bool cancelled_;
+};
+
+// Abort counts by owning TObject and reason. Table slot 0 holds owner
+// nullptr: aborts not attributed to an item, plus aborts on objects that
+// did not fit in the table.
+struct abort_counters {
+    static constexpr unsigned nslots = 32;
+    struct slot {
+        const TObject* owner;
+        txp_counter_type n[ar_count];
+    };
+    slot slots_[nslots];
+
+    abort_counters() {
+        reset();
+    }
+    // returns owner's slot, adding it if there's room
+    slot& find(const TObject* owner) {
+        if (owner) {
+            unsigned i = (reinterpret_cast<uintptr_t>(owner) >> 6) % (nslots - 1);
+            for (unsigned probe = 0; probe != nslots - 1; ++probe) {
+                slot& sl = slots_[1 + (i + probe) % (nslots - 1)];
+                if (sl.owner == owner)
+                    return sl;
+                if (!sl.owner) {
+                    sl.owner = owner;
+                    return sl;
+                }
+            }
+        }
+        return slots_[0];
+    }
+    // returns owner's slot, or nullptr if owner has none
+    const slot* lookup(const TObject* owner) const {
+        if (owner) {
+            unsigned i = (reinterpret_cast<uintptr_t>(owner) >> 6) % (nslots - 1);
+            for (unsigned probe = 0; probe != nslots - 1; ++probe) {
+                const slot& sl = slots_[1 + (i + probe) % (nslots - 1)];
+                if (sl.owner == owner)
+                    return &sl;
+                if (!sl.owner)
+                    return nullptr;
+            }
+            return nullptr;
+        }
+        return &slots_[0];
+    }
+    void account(const TObject* owner, abort_reason r) {
+        ++find(owner).n[r];
+    }
+    void reset() {
+        memset(slots_, 0, sizeof(slots_));
+    }
+    static const char* reason_name(int r);
+};
+
+// The items whose conflicts aborted transactions, as a Space-Saving
+// summary (Metwally et al.) of capacity entries: each entry's count is
+// at least its item's true count and at most error more, and every item
+// conflicting more than 1/capacity of the time has an entry. An item is
+// its owner and raw key, so keys that don't fit in a pointer (Packer
+// stores those out of line) don't match across transactions.
+struct conflict_sketch {
+    static constexpr unsigned capacity = 64;
+    struct entry {
+        const TObject* owner;
+        void* key;
+        txp_counter_type count;
+        txp_counter_type error;
+        txp_counter_type locks; // of count, lock failures
+    };
+    entry e_[capacity];
+    unsigned n_;
+
+    conflict_sketch() {
+        reset();
+    }
+    void add(const TObject* owner, void* key, bool lock) {
+        entry* min = e_;
+        for (entry* e = e_; e != e_ + n_; ++e) {
+            if (e->owner == owner && e->key == key) {
+                ++e->count;
+                e->locks += lock;
+                return;
+            }
+            if (e->count < min->count)
+                min = e;
+        }
+        if (n_ != capacity)
+            *(min = &e_[n_++]) = entry{owner, key, 0, 0, 0};
+        else
+            *min = entry{owner, key, min->count, min->count, 0};
+        ++min->count;
+        min->locks += lock;
+    }
+    void reset() {
+        n_ = 0;
+    }
+};
+
 #include "Interface.hh"
 #include "TransItem.hh"
 
@@ -242,24 +514,80 @@ struct __attribute__((aligned(128))) threadinfo_t {
     using epoch_type = TRcuSet::epoch_type;
     epoch_type epoch;
     TRcuSet rcu_set;
-    // XXX(NH): these should be vectors so multiple data structures can register
-    // callbacks for these
-    std::function<void(void)> trans_start_callback;
-    std::function<void(void)> trans_end_callback;
+    // Transaction::rcu_check_pressure runs when rcu_set.nadded() reaches this
+    uint64_t rcu_check_mark;
+    // rcu_set.nadded() at the epoch advancer's last pass
+    uint64_t rcu_epoch_nadded;
+    // bytes of rcu_set's pending frees whose size is known
+    int64_t rcu_bytes;
+    // the thread's own transaction, for Transaction::memory_footprint_combined
+    Transaction* txn;
+    // hooks run as transactions start and end (see Transaction::add_hook)
+    struct trans_hook {
+        void (*fn)(void*);
+        void* ctx;
+    };
+    static constexpr unsigned max_hooks = 4;
+    trans_hook start_hooks[max_hooks];
+    trans_hook end_hooks[max_hooks];
+    uint8_t nstart_hooks;
+    uint8_t nend_hooks;
+    // last commit TID chosen by this thread (decentralized TID mode)
+    TransactionTid::type last_commit_tid;
+    // snapshot TID of this thread's snapshot transaction, or 0
+    TransactionTid::type snapshot_tid;
+    // In-flight transactions from Sto::make_transaction, in two
+    // generations. epoch is the start epoch of the old generation,
+    // interleave_epoch that of the new one; once the old generation
+    // drains, the new one takes its place and epoch moves forward.
+    unsigned ninterleaved[2];
+    uint8_t interleave_old;
+    epoch_type interleave_epoch;
+    // nullptr means Transaction::default_contention
+    TContentionManager* contention;
+    // redo log buffer, created at this thread's first logged commit
+    TLogBuffer* log;
     txp_counters p_;
     tc_counters tcs_;
+    // latency distribution of each timing counter's samples, in ticks
+    log_histogram latency_[tc_count];
+    abort_counters aborts_;
+    // see Transaction::conflict_sample_period
+    conflict_sketch conflicts_;
+    // see Transaction::set_profile; new slots copy the defaults, which
+    // Transaction::set_profile_all changes
+    uint8_t profile_level;
+    bool profile_timing;
+    static uint8_t default_profile_level;
+    static bool default_profile_timing;
+    // see Transaction::set_profile_hw. hw is opened at the thread's first
+    // profiled transaction; hw_failed records that opening it failed.
+    bool profile_hw;
+    bool hw_failed;
+    static bool default_profile_hw;
+    hw_counter_group* hw;
+    hw_phase_counters hw_;
+    bool live;
     threadinfo_t()
-        : epoch(0) {
+        : epoch(0), rcu_check_mark(0), rcu_epoch_nadded(0), rcu_bytes(0), txn(nullptr),
+          nstart_hooks(0), nend_hooks(0),
+          last_commit_tid(0), snapshot_tid(0),
+          ninterleaved{0, 0}, interleave_old(0), interleave_epoch(0), contention(nullptr), log(nullptr),
+          profile_level(default_profile_level), profile_timing(default_profile_timing),
+          profile_hw(default_profile_hw), hw_failed(false), hw(nullptr),
+          live(false) {
     }
 };
 
+// Accounts the TSC ticks of its lifetime to timing counter T, if the
+// thread's profile_timing is set.
 template <int T, bool tmp_stats=false>
 class TimeKeeper {
 public:
-    TimeKeeper() {
-        init_tsc = read_tsc();
-    }
+    inline TimeKeeper();
     ~TimeKeeper() {
+        if (!init_tsc)
+            return;
         if (tmp_stats)
             sync_thread_counter_tmp();
         else
@@ -277,10 +605,7 @@ private:
     inline void sync_thread_counter_tmp();
 };
 
-#define TSC_ACCOUNT(tc, ticks)                       \
-    tc_helper<tc, tc_count>::account_array(          \
-        Transaction::tinfo[TThread::id()].tcs_.tcs_, \
-        ticks)
+#define TSC_ACCOUNT(tc, ticks) Transaction::tsc_account<(tc)>((ticks))
 
 class Transaction {
 public:
@@ -288,26 +613,242 @@ public:
 
     static constexpr unsigned hash_size = 1024;
     static constexpr unsigned hash_step = 5;
+    // transactions with more items than this also index every item in
+    // a growable open-addressing table, so lookups never scan the tset
+    static constexpr unsigned index_threshold = 128;
+    static_assert(index_threshold % sto_fingerprint::block_size == 0
+                  && index_threshold <= tset_initial_capacity,
+                  "fingerprints cover whole blocks of tset0_");
     using epoch_type = TRcuSet::epoch_type;
     using signed_epoch_type = TRcuSet::signed_epoch_type;
 
-    static threadinfo_t tinfo[MAX_THREADS];
+    // thread registry, indexed by TThread::id()
+    static threadinfo_t* tinfo;
+    static unsigned tinfo_capacity;
+    // one more than the highest thread id ever registered
+    static unsigned tinfo_high_water;
     static struct epoch_state {
         epoch_type global_epoch; // != 0
         epoch_type active_epoch; // no thread is before this epoch
         TransactionTid::type recent_tid;
+        TransactionTid::type snapshot_floor; // no snapshot reads below this
         bool run;
+        bool pressure; // a thread's RCU backlog is over rcu_eager_threshold
+        bool advancing; // advance_epoch() is running
+        unsigned interval_us; // current epoch_advancer sleep
     } global_epochs;
     typedef TransactionTid::type tid_type;
 private:
     static TransactionTid::type _TID;
+    // low 32 bits: holder's thread id + 1, or 0; high 32 bits: number of
+    // acquisitions, so waiters notice a release even if it's immediately
+    // reacquired
+    static uint64_t fallback_token_;
+    static constexpr uint64_t fallback_owner_mask = 0xFFFFFFFFU;
 public:
 
     static std::function<void(threadinfo_t::epoch_type)> epoch_advance_callback;
 
+    // The epoch advancer sleeps between epoch_interval_min_us and
+    // epoch_interval_max_us between epochs: shorter while RCU backlogs or
+    // per-epoch RCU additions are large relative to rcu_eager_threshold,
+    // longer while they are small.
+    static unsigned epoch_interval_min_us;
+    static unsigned epoch_interval_max_us;
+    // A thread whose RCU backlog exceeds this many elements advances the
+    // epoch itself, if it can, and frees what it can right away. 0 never
+    // reclaims eagerly. Change with set_rcu_eager_threshold.
+    static uint64_t rcu_eager_threshold;
+    // Transaction::start frees at most this many RCU elements, leaving
+    // the rest for later starts (or eager reclamation); 0 means no limit.
+    static unsigned rcu_clean_budget;
+    static void set_rcu_eager_threshold(uint64_t n) {
+        rcu_eager_threshold = n;
+        for (unsigned i = 0; i != tinfo_capacity; ++i)
+            tinfo[i].rcu_check_mark = 0;
+    }
+
+    // If true, commit TIDs are computed from the versions a transaction
+    // observed and locked plus a per-thread counter, rather than by
+    // incrementing the shared _TID. _TID then acts only as an opacity clock,
+    // advanced when a hard opacity check or the epoch advancer needs it.
+    static bool decentralized_tids;
+
+    // Opacity checks see a version newer than the transaction's snapshot
+    // at most this many times per transaction (default
+    // STO_OPACITY_EXTENSIONS, unlimited) before falling back to TL2-style
+    // opacity. Each extension revalidates the whole read set and moves
+    // the snapshot to the current _TID, which under write-heavy load can
+    // cost more than the reads do. Once the limit is reached, such a
+    // version aborts the transaction instead; the retry takes a fresh
+    // snapshot. With decentralized_tids the abort first advances _TID
+    // past the version, so each thread's clock reaches other threads
+    // only when a reader needs it (as in TL2's GV5). 0 gives pure TL2.
+    static unsigned opacity_extensions;
+
+    // If nonzero (default STO_VALIDATE_INTERVAL), a running transaction
+    // rechecks its read set each time it grows by this many items, and
+    // aborts right away if validation would fail at commit. This catches
+    // doomed transactions early, mostly those with nonopaque reads, which
+    // would otherwise run to try_commit. Each pass checks every read, so
+    // small intervals make long transactions quadratic. The time spent
+    // shows as tc_validate, and the time saved as lower tc_abort and
+    // tc_commit_wasted.
+    static unsigned validate_interval;
+
+    // If true (default false), commit-time validation prefetches each read
+    // item's version (TObject::prefetch_check) check_prefetch_distance
+    // items ahead.
+    static bool prefetch_validation;
+    // If true (default false), commit groups the write set and the reads
+    // it checks by owner, and calls each owner's lock_all, check_all and
+    // install_all (see TObject) once per group instead of interleaving
+    // the per-item virtuals of many objects. Owners lock in order of
+    // first appearance. Not used with STO_SORT_WRITESET, or for
+    // transactions that may hold duplicate items.
+    static bool group_commit;
+    // group_commit groups this many owners; items of any others keep
+    // their order after the groups
+    static constexpr unsigned group_max_owners = 16;
+    // If nonzero (default 0), commits with at least this many writes
+    // split phase 3 across the install pool (see start_install_pool).
+    // Writes whose owners allow it (TObject::parallel_install) are cut
+    // into parts of at least install_part_min items; pool threads and
+    // the committing thread each install a part at a time and unlock it
+    // right away, so other threads wait on fewer locks for less time.
+    // Other writes install on the committing thread first. cleanup()
+    // and end hooks still run after every write is installed. Not used
+    // with TLog or STO_SORT_WRITESET.
+    static unsigned parallel_install_threshold;
+    static constexpr unsigned install_part_min = 512;
+    // Start n install threads, each registering a thread id; stop them
+    // with stop_install_pool once no transactions are running.
+    static void start_install_pool(unsigned n);
+    static void stop_install_pool();
+    // If nonzero (default 0), about one in conflict_sample_period aborts
+    // caused by a lock failure or failed validation records the item
+    // involved in its thread's conflict_sketch; see top_conflicts.
+    static unsigned conflict_sample_period;
+    static constexpr unsigned check_prefetch_distance = 8;
+    // how often, in items added, a transaction with limits checks them
+    static constexpr unsigned limits_check_interval = 8;
+    // sort_writeset radix sorts write sets larger than this
+    static constexpr unsigned writeset_radix_threshold = 256;
+
+    // used by threads without their own contention manager
+    static TSpinContention default_contention;
+    // Set the calling thread's contention manager (nullptr for the
+    // default). The manager must outlive the thread's transactions.
+    static void set_contention_manager(TContentionManager* cm) {
+        tinfo[TThread::id()].contention = cm;
+    }
+    static TContentionManager& contention_manager() {
+        TContentionManager* cm = tinfo[TThread::id()].contention;
+        return cm ? *cm : default_contention;
+    }
+
+    // If set (default nullptr), TRANSACTION loops without a gate of their
+    // own (TransactionLimits::admit) run their attempts through this one.
+    static TAdmission* admission;
+
+    // If nonzero (default STO_FALLBACK_ABORTS), a TRANSACTION loop whose
+    // transaction aborted this many times in a row runs each further
+    // attempt holding the global fallback token. While one thread holds
+    // the token, other threads' writing transactions wait before their
+    // commit phase, so only commits already under way can abort it.
+    static unsigned fallback_aborts;
+    static void acquire_fallback();
+    static void release_fallback() {
+        assert(in_fallback());
+        release_fence();
+        fallback_token_ &= ~fallback_owner_mask;
+    }
+    // true iff the calling thread holds the fallback token
+    static bool in_fallback() {
+        return (fallback_token_ & fallback_owner_mask) == unsigned(TThread::id() + 1);
+    }
+
+    // If nonzero (default STO_HTM_MAX_ITEMS), committing transactions with at
+    // most this many items commit inside a hardware transaction (Intel RTM
+    // or Arm TME) when the CPU has one: locking, validation and install
+    // run with no lock visible to other threads, and the hardware tracks
+    // the version words read. After a capacity or conflict abort, or once
+    // a few retries fail, the commit runs in software as usual. Works best
+    // with decentralized_tids, since the global TID counter is a conflict
+    // point for every hardware commit. Ignored while logging.
+    static unsigned htm_max_items;
+    static constexpr unsigned htm_max_retries = 3;
+
+    // Snapshot transactions never read versions older than this, so
+    // TObjects may discard those from their version chains.
+    static tid_type snapshot_floor() {
+        return global_epochs.snapshot_floor;
+    }
+
+    static unsigned max_threads() {
+        return tinfo_capacity;
+    }
+    // Resize the thread registry. Must be called before any thread
+    // registers (with TThread::set_id or TThread::register_thread).
+    static void set_max_threads(unsigned n);
+    // number of registry slots that may hold state
+    static unsigned used_threads() {
+        return std::max(tinfo_high_water, 1U);
+    }
+
+    // Profiling for the calling thread: keep txp counters of level <= level
+    // (0: none, 1: commits and aborts, 2: also per-item counts), and keep
+    // timing counters iff timing. Counters that are off cost one branch.
+    static void set_profile(unsigned level, bool timing) {
+        threadinfo_t& thr = tinfo[TThread::id()];
+        thr.profile_level = level;
+        thr.profile_timing = timing;
+    }
+    // Profiling for every thread, including threads not registered yet
+    static void set_profile_all(unsigned level, bool timing) {
+        threadinfo_t::default_profile_level = level;
+        threadinfo_t::default_profile_timing = timing;
+        for (unsigned i = 0; i != tinfo_capacity; ++i) {
+            tinfo[i].profile_level = level;
+            tinfo[i].profile_timing = timing;
+        }
+    }
+    static unsigned profile_level() {
+        return tinfo[TThread::id()].profile_level;
+    }
+    static bool profile_timing() {
+        return tinfo[TThread::id()].profile_timing;
+    }
+
+    // Hardware counter profiling (see PerfCounters.hh) for every thread,
+    // including threads not registered yet: count cycles, instructions,
+    // LLC misses, and branch misses per hw_phase. Each phase boundary
+    // costs a system call, so this slows transactions down noticeably;
+    // compare counts between runs rather than against unprofiled times.
+    // Interleaved transactions (Sto::make_transaction) are not counted.
+    static void set_profile_hw(bool on) {
+        threadinfo_t::default_profile_hw = on;
+        for (unsigned i = 0; i != tinfo_capacity; ++i)
+            tinfo[i].profile_hw = on;
+    }
+    static bool profile_hw() {
+        return threadinfo_t::default_profile_hw;
+    }
+    static hw_phase_counters hw_counters_combined() {
+        hw_phase_counters ret;
+        for (unsigned i = 0; i != used_threads(); ++i) {
+            const hw_phase_counters& h = tinfo[i].hw_;
+            for (int p = 0; p != hp_count; ++p)
+                ret.phase[p] += h.phase[p];
+            ret.commits += h.commits;
+            ret.events |= h.events;
+        }
+        return ret;
+    }
+
     static txp_counters txp_counters_combined() {
         txp_counters out;
-        for (int i = 0; i != MAX_THREADS; ++i)
+        for (unsigned i = 0; i != used_threads(); ++i)
             for (int p = 0; p != txp_count; ++p) {
                 if (txp_is_max(p))
                     out.p_[p] = std::max(out.p_[p], tinfo[i].p_.p_[p]);
@@ -319,7 +860,7 @@ public:
 
     static tc_counters tc_counters_combined() {
         tc_counters ret;
-        for (int i = 0; i < MAX_THREADS; ++i) {
+        for (unsigned i = 0; i < used_threads(); ++i) {
             for (int t = 0; t < tc_count; ++t) {
                 ret.tcs_[t] += tinfo[i].tcs_.tcs_[t];
             }
@@ -327,46 +868,155 @@ public:
         return ret;
     }
 
+    // samples of timing counter tc from all threads
+    static log_histogram latency_combined(int tc) {
+        log_histogram ret;
+        for (unsigned i = 0; i != used_threads(); ++i)
+            ret.merge(tinfo[i].latency_[tc]);
+        return ret;
+    }
+
+    // The k items with the most sampled conflicts (see
+    // conflict_sample_period), merged over threads, most first. Merged
+    // counts and errors are sums of the threads' entries.
+    static std::vector<conflict_sketch::entry> top_conflicts(unsigned k);
+
+    // abort counts by owning TObject and reason, summed over threads
+    static abort_counters abort_counters_combined() {
+        abort_counters ret;
+        for (unsigned i = 0; i != used_threads(); ++i)
+            for (auto& sl : tinfo[i].aborts_.slots_) {
+                if (!sl.owner && &sl != tinfo[i].aborts_.slots_)
+                    continue;
+                auto& out = ret.find(sl.owner);
+                for (int r = 0; r != ar_count; ++r)
+                    out.n[r] += sl.n[r];
+            }
+        return ret;
+    }
+
+    // Combined counters at one point in time. b.since(a) gives the
+    // counts accumulated between snapshots a and b; max counters (like
+    // txp_max_set) keep b's values.
+    struct counter_snapshot {
+        txp_counters p;
+        tc_counters tc;
+        log_histogram latency[tc_count];
+        abort_counters aborts;
+
+        counter_snapshot since(const counter_snapshot& earlier) const;
+    };
+    static counter_snapshot counters_snapshot();
+
     static void print_stats();
 
     static void clear_stats() {
-        for (int i = 0; i != MAX_THREADS; ++i) {
+        for (unsigned i = 0; i != used_threads(); ++i) {
             tinfo[i].p_.reset();
             tinfo[i].tcs_.reset();
+            for (auto& h : tinfo[i].latency_)
+                h.reset();
+            tinfo[i].aborts_.reset();
+            tinfo[i].conflicts_.reset();
+            unsigned events = tinfo[i].hw_.events;
+            tinfo[i].hw_.reset();
+            tinfo[i].hw_.events = events;
         }
     }
 
     static void* epoch_advancer(void*);
+    // Advance the global epoch once, unless another thread is already
+    // advancing it. Returns false if it did nothing.
+    static bool advance_epoch();
+    static unsigned epoch_interval_us() {
+        return global_epochs.interval_us;
+    }
+
+    // RCU elements waiting to be freed, per thread and in total
+    struct rcu_backlog_stats {
+        uint64_t total;
+        uint64_t max;
+        unsigned max_thread;
+    };
+    static uint64_t rcu_backlog(unsigned thread) {
+        return tinfo[thread].rcu_set.size();
+    }
+    static rcu_backlog_stats rcu_backlog_combined() {
+        rcu_backlog_stats ret = {0, 0, 0};
+        for (unsigned i = 0; i != used_threads(); ++i) {
+            uint64_t n = tinfo[i].rcu_set.size();
+            ret.total += n;
+            if (n > ret.max) {
+                ret.max = n;
+                ret.max_thread = i;
+            }
+        }
+        return ret;
+    }
+
+    // Memory of this transaction context: items and buffer as data, its
+    // indexes and write set arrays as index.
+    footprint memory_footprint() const;
+    // Every thread's own transaction context, plus pending RCU frees:
+    // their bookkeeping, and the objects from rcu_delete, rcu_free,
+    // rcu_free_pages and rcu_delete_array of trivially destructible types
+    // (rcu_call's arguments have no known size).
+    static footprint memory_footprint_combined();
+
     template <typename T>
     static void rcu_delete(T* x) {
-        auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free, x);
+        threadinfo_t& thr = tinfo[TThread::id()];
+        thr.rcu_bytes += sizeof(T);
+        rcu_add(thr, rcu_destroy_counted<T>, x);
     }
     template <typename T>
     static void rcu_delete_array(T* x) {
-        auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free_array, x);
+        threadinfo_t& thr = tinfo[TThread::id()];
+        if (std::is_trivially_destructible<T>::value) {
+            // no array cookie, so x is the start of its allocation
+            thr.rcu_bytes += malloc_usable_size(reinterpret_cast<void*>(x));
+            rcu_add(thr, rcu_destroy_array_counted<T>, x);
+        } else
+            rcu_add(thr, ObjectDestroyer<T>::destroy_and_free_array, x);
     }
     static void rcu_free(void* ptr) {
-        auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ::free, ptr);
+        threadinfo_t& thr = tinfo[TThread::id()];
+        thr.rcu_bytes += malloc_usable_size(ptr);
+        rcu_add(thr, rcu_free_counted, ptr);
+    }
+    // frees memory from TPages after RCU
+    static void rcu_free_pages(void* ptr) {
+        threadinfo_t& thr = tinfo[TThread::id()];
+        thr.rcu_bytes += TPages::size(ptr);
+        rcu_add(thr, rcu_free_pages_counted, ptr);
     }
     static void rcu_call(void (*function)(void*), void* argument) {
-        auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, function, argument);
+        rcu_add(tinfo[TThread::id()], function, argument);
     }
     static void rcu_quiesce() {
         tinfo[TThread::id()].epoch = 0;
     }
 
-#if STO_PROFILE_COUNTERS
+    // Run fn(ctx) on this thread as each transaction starts (before its
+    // first operation) or ends (after it commits or aborts; end hooks can
+    // tell which from TThread::txn->aborted()). Hooks run in
+    // registration order; adding a registered hook again does nothing.
+    // At most threadinfo_t::max_hooks of each kind per thread.
+    enum hook_type { hook_start, hook_end };
+    static void add_hook(hook_type type, void (*fn)(void*), void* ctx);
+    static void remove_hook(hook_type type, void (*fn)(void*), void* ctx);
+
     template <unsigned P> static void txp_account(txp_counter_type n) {
-        txp_helper<P, txp_count>::account_array(tinfo[TThread::id()].p_.p_, n);
+        threadinfo_t& thr = tinfo[TThread::id()];
+        if (unlikely(thr.profile_level >= txp_level(P)))
+            txp_helper<P, txp_count>::account_array(thr.p_.p_, n);
     }
-#else
-    template <unsigned P> static void txp_account(txp_counter_type) {
+
+    template <int TC> static void tsc_account(tc_counter_type ticks) {
+        threadinfo_t& thr = tinfo[TThread::id()];
+        tc_helper<TC, tc_count>::account_array(thr.tcs_.tcs_, ticks);
+        thr.latency_[TC].add(ticks);
     }
-#endif
 
 #define TXP_INCREMENT(p) Transaction::txp_account<(p)>(1)
 #define TXP_ACCOUNT(p, n) Transaction::txp_account<(p)>((n))
@@ -374,7 +1024,12 @@ public:
 
 private:
     static constexpr unsigned tset_chunk = 512;
-    static constexpr unsigned tset_max_capacity = 32768;
+    // items the inline chunk directory covers; larger transactions move
+    // the directory to the heap
+    static constexpr unsigned tset_dir_initial_capacity = 32768;
+    // hashtable_ entry for items whose hash_base_-relative index doesn't
+    // fit; lookups that reach one fall back to the index
+    static constexpr uint16_t hash_saturated = 0xFFFF;
 
     void initialize();
 
@@ -401,35 +1056,61 @@ private:
 
     ~Transaction();
 
+    // Contexts, like their item chunks, belong to one thread (see
+    // TPages::allocate_local).
+    static void* operator new(size_t size) {
+        return TPages::allocate_local(size);
+    }
+    static void operator delete(void* p) {
+        TPages::free(p);
+    }
+
     // reset data so we can be reused for another transaction
     void start() {
         threadinfo_t& thr = tinfo[TThread::id()];
         //if (isAborted_
         //   && tinfo[TThread::id()].p(txp_total_aborts) % 0x10000 == 0xFFFF)
            //print_stats();
-#if STO_TSC_PROFILE
-        start_tsc_ = read_tsc();
-#endif
-        thr.epoch = global_epochs.global_epoch;
-        thr.rcu_set.clean_until(global_epochs.active_epoch);
-        if (thr.trans_start_callback)
-            thr.trans_start_callback();
-        hash_base_ += tset_size_ + 1;
-        tset_size_ = 0;
-        tset_next_ = tset0_;
+        start_tsc_ = unlikely(thr.profile_timing) ? read_tsc() : 0;
+        hw_phase_ = unlikely(thr.profile_hw) && !interleaved_ ? hw_begin(thr) : -1;
+        // interleaved transactions share the thread's epoch, which only
+        // the first one in flight sets
+        bool first = !interleaved_ || interleave_start(thr);
+        if (first)
+            thr.epoch = global_epochs.global_epoch;
+        thr.rcu_set.clean_until(global_epochs.active_epoch,
+                                rcu_clean_budget ? rcu_clean_budget : ~uint64_t(0));
+        if (first)
+            for (unsigned i = 0; i != thr.nstart_hooks; ++i)
+                thr.start_hooks[i].fn(thr.start_hooks[i].ctx);
 #if TRANSACTION_HASHTABLE
-        if (hash_base_ >= 32768) {
+        if (hash_base_ + tset_size_ + 1 >= 32768) {
             memset(hashtable_, 0, sizeof(hashtable_));
             hash_base_ = 0;
-        }
+        } else
 #endif
+            hash_base_ += tset_size_ + 1;
+        tset_size_ = 0;
+        index_active_ = index_deferred_ = read_only_ = false;
+        no_read_my_writes_ = false;
+        isolation_ = serializable;
+        tset_next_ = tset0_;
         any_writes_ = any_nonopaque_ = may_duplicate_items_ = false;
         first_write_ = 0;
-        start_tid_ = commit_tid_ = 0;
+        start_tid_ = commit_tid_ = max_observed_tid_ = snapshot_tid_ = 0;
+        log_epoch_ = 0;
         buf_.clear();
+        savepoint_mark_ = nsavepoints_ = nested_depth_ = 0;
+        nextensions_ = 0;
+        validate_mark_ = next_validation_ = validate_interval ? validate_interval : ~0U;
+        deadline_tsc_ = 0;
+        cancel_token_ = nullptr;
+        blind_stamp_ = 0;
+        undo_.clear();
+        abort_owner_ = nullptr;
+        abort_reason_ = ar_user;
 #if STO_DEBUG_ABORTS
         abort_item_ = nullptr;
-        abort_reason_ = nullptr;
         abort_version_ = 0;
 #endif
         TXP_INCREMENT(txp_total_starts);
@@ -444,14 +1125,74 @@ private:
         return (n + (n >> 16) * 9) % hash_size;
     }
 #endif
+    static unsigned index_hash(const TObject* obj, void* key) {
+        uint64_t n = reinterpret_cast<uintptr_t>(key) ^ (reinterpret_cast<uintptr_t>(obj) << 12);
+        n *= 0x9E3779B97F4A7C15ULL;
+        return n >> 32;
+    }
 
     void refresh_tset_chunk();
+    TransItem* new_tset_chunk();
+    void grow_tset_dir(unsigned nchunks);
+
+    TransItem* tset_item(unsigned tidx) {
+        if (likely(tidx < tset_initial_capacity))
+            return &tset0_[tidx];
+        else
+            return &tset_[tidx / tset_chunk][tidx % tset_chunk];
+    }
+    const TransItem* tset_item(unsigned tidx) const {
+        return const_cast<Transaction*>(this)->tset_item(tidx);
+    }
+    void prefetch_check_item(unsigned tidx) const {
+        const TransItem* it = tset_item(tidx);
+        if (it->has_read())
+            it->owner()->prefetch_check(*it);
+    }
+
+    void index_add(TObject* obj, void* xkey, unsigned tidx) {
+        if (unlikely(!index_active_ || 2 * tset_size_ > index_mask_))
+            build_index();
+        else {
+            unsigned i = index_hash(obj, xkey) & index_mask_;
+            while (index_[i]) {
+                const TransItem* ti = tset_item(index_[i] - 1);
+                if (ti->owner() == obj && ti->key_ == xkey)
+                    return;
+                i = (i + 1) & index_mask_;
+            }
+            index_[i] = tidx + 1;
+        }
+    }
+    TransItem* index_find(TObject* obj, void* xkey) const {
+        unsigned i = index_hash(obj, xkey) & index_mask_;
+        while (index_[i]) {
+            const TransItem* ti = tset_item(index_[i] - 1);
+            if (ti->owner() == obj && ti->key_ == xkey)
+                return const_cast<TransItem*>(ti);
+            i = (i + 1) & index_mask_;
+        }
+        return nullptr;
+    }
+    void build_index();
 
     TransItem* allocate_item(const TObject* obj, void* xkey) {
+        if (unlikely(tset_size_ >= validate_mark_))
+            item_checkpoint();
+        // snapshot transactions commit without validation, so only objects
+        // that serve snapshot reads may track items in them
+        if (unlikely(snapshot_tid_) && isolation_ == serializable)
+            always_assert(obj->supports_snapshots());
         if (tset_size_ && tset_size_ % tset_chunk == 0)
             refresh_tset_chunk();
         ++tset_size_;
         new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
+        if (likely(!index_deferred_))
+            index_item(obj, xkey, tset_size_ - 1);
+        return tset_next_++;
+    }
+    // makes item tidx findable by find_item; items must be indexed in order
+    void index_item(const TObject* obj, void* xkey, unsigned tidx) {
 #if TRANSACTION_HASHTABLE
         unsigned hi = hash(obj, xkey);
 # if TRANSACTION_HASHTABLE > 1
@@ -459,16 +1200,82 @@ private:
             hi = (hi + hash_step) % hash_size;
 # endif
         if (hashtable_[hi] <= hash_base_)
-            hashtable_[hi] = hash_base_ + tset_size_;
+            hashtable_[hi] = likely(hash_base_ + tidx + 1 < hash_saturated)
+                ? hash_base_ + tidx + 1 : hash_saturated;
 #endif
-        return tset_next_++;
+        if (likely(tidx < index_threshold))
+            fingerprint_[tidx] = index_hash(obj, xkey);
+        else
+            index_add(const_cast<TObject*>(obj), xkey, tidx);
     }
+    void index_deferred_items();
 
 public:
     int threadid() const {
         return threadid_;
     }
 
+    // Snapshot TID of a snapshot transaction, 0 otherwise. A snapshot
+    // transaction sees exactly the commits with TIDs below this.
+    tid_type snapshot_tid() const {
+        return snapshot_tid_;
+    }
+
+    // Isolation levels weaker than serializability, which validate less
+    // at commit:
+    // - snapshot_isolation: objects that support snapshots serve reads as
+    //   of the transaction's start, and their writes abort if another
+    //   transaction committed to the same item since then (checked when
+    //   locking). Reads of other objects are validated as usual.
+    // - read_committed: reads see committed state, but commit checks only
+    //   items the transaction also writes. Opacity checks still refuse
+    //   locked versions, but never revalidate.
+    // Neither level uses HTM commits.
+    enum isolation_type { serializable, snapshot_isolation, read_committed };
+    isolation_type isolation() const {
+        return isolation_;
+    }
+    bool any_writes() const {
+        return any_writes_;
+    }
+
+    // Hint that this transaction won't look its items up by key, as when
+    // it is read-only and reads through Sto::read_item: items are added
+    // without indexing them. The first lookup indexes every item, so a
+    // wrong hint costs time, not correctness. Call before adding items.
+    void defer_index() {
+        if (!tset_size_)
+            index_deferred_ = true;
+    }
+
+    // Hint that this transaction never reads a key after writing it and
+    // writes each key at most once, so containers that honor it (see
+    // Hashtable::set_read_my_writes) needn't look for existing items.
+    void no_read_my_writes() {
+        no_read_my_writes_ = true;
+    }
+    bool reads_my_writes() const {
+        return !no_read_my_writes_;
+    }
+    // true iff an item of obj with this key has a write. Linear in the
+    // item count; for assertions.
+    template <typename T>
+    bool has_write_item(const TObject* obj, T key) const {
+        void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
+        for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+            const TransItem* ti = tset_item(tidx);
+            if (ti->owner() == obj && ti->key_ == xkey && ti->has_write())
+                return true;
+        }
+        return false;
+    }
+
+    // Bulk mode for very large transactions: preallocate room for n items
+    // (chunks, directory, write set and index) so adding them never grows
+    // anything. Transactions have no size limit either way. Allocations are
+    // kept for later transactions.
+    void reserve_items(unsigned n);
+
     // adds item for a key that is known to be new (must NOT exist in the set)
     template <typename T>
     TransProxy new_item(const TObject* obj, T key) {
@@ -476,6 +1283,33 @@ public:
         return TransProxy(*this, *allocate_item(obj, xkey));
     }
 
+    // Adds items for keys[0..n), all known to be new as with new_item,
+    // calling f(proxy, i) on each as it is added. Room for all n items
+    // is reserved up front and each chunk is filled in a tight loop.
+    // f must not add items.
+    template <typename T, typename F>
+    void new_items(const TObject* obj, const T* keys, unsigned n, F&& f) {
+        if (unlikely(snapshot_tid_) && isolation_ == serializable)
+            always_assert(obj->supports_snapshots());
+        reserve_items(tset_size_ + n);
+        for (unsigned i = 0; i != n; ) {
+            if (tset_size_ && tset_size_ % tset_chunk == 0)
+                refresh_tset_chunk();
+            unsigned end = i + std::min(n - i, tset_chunk - tset_size_ % tset_chunk);
+            for (; i != end; ++i, ++tset_next_) {
+                void* xkey = Packer<T>::pack_unique(buf_, keys[i]);
+                new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
+                ++tset_size_;
+                if (likely(!index_deferred_))
+                    index_item(obj, xkey, tset_size_ - 1);
+                f(TransProxy(*this, *tset_next_), i);
+            }
+        }
+        // the batch may have passed the checkpoint
+        if (unlikely(validate_mark_ <= tset_size_))
+            item_checkpoint();
+    }
+
     // adds item without checking its presence in the array
     template <typename T>
     TransProxy fresh_item(const TObject* obj, T key) {
@@ -491,6 +1325,8 @@ public:
         TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
         if (!ti)
             ti = allocate_item(obj, xkey);
+        else if (unlikely(savepoint_mark_))
+            savepoint_log(ti);
         return TransProxy(*this, *ti);
     }
 
@@ -506,6 +1342,8 @@ public:
             may_duplicate_items_ = tset_size_ > 0;
         if (!ti)
             ti = allocate_item(obj, xkey);
+        else if (unlikely(savepoint_mark_))
+            savepoint_log(ti);
         return TransProxy(*this, *ti);
     }
 
@@ -513,21 +1351,54 @@ public:
     OptionalTransProxy check_item(const TObject* obj, T key) const {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
         TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
+        if (unlikely(savepoint_mark_) && ti)
+            savepoint_log(ti);
         return OptionalTransProxy(const_cast<Transaction&>(*this), ti);
     }
 
+    // A point to roll this transaction back to. Rolling back discards the
+    // items added since the savepoint (running cleanup(item, false) on
+    // their writes), restores the items it changed, and frees their
+    // buffer data. Savepoints nest and must be released or rolled back
+    // innermost first. Items are logged for restoring when looked up, so
+    // don't keep TransProxies across a savepoint. TObjects that change a
+    // write value in place through write_value() references, or keep
+    // per-item state outside the item, may not be restored exactly.
+    struct savepoint_type {
+        unsigned tset_size;
+        unsigned undo_size;
+        unsigned prev_mark;
+        TransactionBuffer::mark_type buf;
+        bool any_writes;
+        bool any_nonopaque;
+        bool may_duplicate_items;
+    };
+    savepoint_type savepoint();
+    // Undo everything since sp; sp stays active
+    void rollback(const savepoint_type& sp);
+    // Keep everything since sp and deactivate it
+    void release(const savepoint_type& sp);
+
+    // Run f() as a closed-nested transaction. If it aborts and the reads
+    // made before it are still valid, roll it back and run it again, up to
+    // `retries` more times; otherwise abort the whole transaction.
+    template <typename F>
+    void nested(F&& f, unsigned retries);
+
 private:
     // tries to find an existing item with this key, returns NULL if not found
     TransItem* find_item(TObject* obj, void* xkey) const {
-#if STO_TSC_PROFILE
         TimeKeeper<tc_find_item> tk;
-#endif
+        if (unlikely(index_deferred_))
+            const_cast<Transaction*>(this)->index_deferred_items();
 #if TRANSACTION_HASHTABLE
         TXP_INCREMENT(txp_hash_find);
         unsigned hi = hash(obj, xkey);
         for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
             if (hashtable_[hi] <= hash_base_)
                 return nullptr;
+            if (unlikely(hashtable_[hi] == hash_saturated))
+                break;
             unsigned tidx = hashtable_[hi] - hash_base_ - 1;
             const TransItem* ti;
             if (likely(tidx < tset_initial_capacity))
@@ -551,31 +1422,40 @@ private:
             hi = (hi + hash_step) % hash_size;
         }
 #endif
-        const TransItem* it = nullptr;
-        for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-            it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-            TXP_INCREMENT(txp_total_searched);
-            if (it->owner() == obj && it->key_ == xkey)
-                return const_cast<TransItem*>(it);
-        }
-        return nullptr;
-    }
-
-    bool preceding_duplicate_read(TransItem *it) const;
-
+        if (index_active_)
+            return index_find(obj, xkey);
+        // small transaction: vector-compare fingerprints, then check
+        // the few candidate items
+        TXP_ACCOUNT(txp_total_searched, tset_size_);
+        unsigned tidx = sto_fingerprint::find(fingerprint_, tset_size_, index_hash(obj, xkey), [&] (unsigned i) {
+                return tset0_[i].owner() == obj && tset0_[i].key_ == xkey;
+            });
+        return tidx != tset_size_ ? const_cast<TransItem*>(&tset0_[tidx]) : nullptr;
+    }
+
+    // true iff an item before tset index tidx has its key and a read.
+    // Call read_index_ready_ = false before each validation pass.
+    bool preceding_duplicate_read(TransItem* it, unsigned tidx);
+    void build_read_index();
+
+    // why a commit-time lock() failed (see write_conflict)
+    abort_reason lock_abort_reason() const {
+        return abort_reason_ == ar_write_conflict ? ar_write_conflict : ar_commit_lock;
+    }
+    void mark_abort_because(TransItem* item, abort_reason reason, TVersion::type version = 0) const {
+        abort_owner_ = item ? item->owner() : nullptr;
+        abort_key_ = item ? item->key<void*>() : nullptr;
+        abort_reason_ = reason;
 #if STO_DEBUG_ABORTS
-    void mark_abort_because(TransItem* item, const char* reason, TVersion::type version = 0) const {
         abort_item_ = item;
-        abort_reason_ = reason;
         if (version)
             abort_version_ = version;
-    }
 #else
-    void mark_abort_because(TransItem*, const char*, TVersion::type = 0) const {
-    }
+        (void) version;
 #endif
+    }
 
-    void abort_because(TransItem& item, const char* reason, TVersion::type version = 0) {
+    void abort_because(TransItem& item, abort_reason reason, TVersion::type version = 0) {
         mark_abort_because(&item, reason, version);
         abort();
     }
@@ -587,7 +1467,9 @@ public:
     }
 
     void abort() {
-        silent_abort();
+        // inside nested(), let the nested scope decide
+        if (likely(!nested_depth_))
+            silent_abort();
         throw Abort();
     }
 
@@ -616,47 +1498,113 @@ public:
         return try_lock(item, const_cast<TransactionTid::type&>(vers.value()));
     }
     bool try_lock(TransItem& item, TransactionTid::type& vers) {
+        if (unlikely(blind_stamp_))
+            return blind_lock(vers);
 #if STO_SORT_WRITESET
-        (void) item;
         TransactionTid::lock(vers, threadid_);
+        if (unlikely(snapshot_tid_) && write_conflict(item, vers))
+            return false;
+        observe_tid(vers);
         return true;
 #else
         // This function will eventually help us track the commit TID when we
         // have no opacity, or for GV7 opacity.
         unsigned n = 0;
         while (1) {
-            if (TransactionTid::try_lock(vers, threadid_))
+            if (TransactionTid::try_lock(vers, threadid_)) {
+                if (unlikely(snapshot_tid_) && write_conflict(item, vers))
+                    return false;
+                observe_tid(vers);
                 return true;
-            ++n;
-# if STO_SPIN_EXPBACKOFF
-            if (item.has_read() || n == STO_SPIN_BOUND_WRITE) {
-#  if STO_DEBUG_ABORTS
-                abort_version_ = vers;
-#  endif
-                return false;
             }
-            if (n > 3)
-                for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                    relax_fence();
-# else
-            if (item.has_read() || n == (1 << STO_SPIN_BOUND_WRITE)) {
-#  if STO_DEBUG_ABORTS
+            ++n;
+            // a read of a locked item will fail validation anyway
+            if (item.has_read() || !contention().lock_wait(n)
+                || unlikely(limits_passed() != ar_count)) {
+# if STO_DEBUG_ABORTS
                 abort_version_ = vers;
-#  endif
+# endif
                 return false;
             }
-# endif
             relax_fence();
         }
 #endif
     }
 
+    // try_lock in blind_commit. Returns false without locking, and clears
+    // blind_stamp_, if the item has a version at or above the stamp;
+    // otherwise waits out other committers and locks it.
+    bool blind_lock(TransactionTid::type& vers) {
+        while (1) {
+            TransactionTid::type v = vers;
+            if (!TransactionTid::is_locked(v)) {
+                if (TransactionTid::unlocked(v) >= blind_stamp_) {
+                    blind_stamp_ = 0;
+                    return false;
+                }
+                if (TransactionTid::try_lock(vers, threadid_)) {
+                    observe_tid(vers);
+                    return true;
+                }
+            } else if (unlikely(limits_passed() != ar_count))
+                return false;
+            relax_fence();
+        }
+    }
+
+    // Snapshot isolation: a locked item of a snapshot object conflicts if
+    // it changed since the snapshot. Unlocks it on conflict.
+    bool write_conflict(TransItem& item, TransactionTid::type& vers) {
+        if (TransactionTid::unlocked(vers) < snapshot_tid_
+            || !item.owner()->supports_snapshots())
+            return false;
+        TransactionTid::unlock(vers, threadid_);
+        abort_reason_ = ar_write_conflict;
+        return true;
+    }
+
+    TContentionManager& contention() const {
+        TContentionManager* cm = tinfo[threadid_].contention;
+        return cm ? *cm : default_contention;
+    }
+    // A read found its version locked elsewhere for the nth time: asks
+    // the contention manager, except that past the limits it stops
+    // waiting.
+    bool read_wait(unsigned n, bool patient) const {
+        if (unlikely(limits_passed() != ar_count))
+            return false;
+        return contention().read_wait(n, patient);
+    }
+
+    // Bounds this transaction (until it ends; start() clears them): it
+    // aborts once the TSC reaches deadline_tsc (0 for none) or once token
+    // (nullptr for none) is cancelled. Running transactions check every
+    // limits_check_interval items they add, and lock and read waits stop
+    // waiting. Any abort past the limits counts as ar_deadline or
+    // ar_cancelled, and in txp_limit_aborts. Usually set through
+    // TRANSACTION_LIMITED.
+    void set_limits(uint64_t deadline_tsc, const TCancelToken* token) {
+        deadline_tsc_ = deadline_tsc;
+        cancel_token_ = token;
+        if (deadline_tsc || token)
+            validate_mark_ = std::min(validate_mark_, tset_size_ + limits_check_interval);
+    }
+    // ar_cancelled or ar_deadline if past the limits, else ar_count
+    abort_reason limits_passed() const {
+        if (likely(!deadline_tsc_ && !cancel_token_))
+            return ar_count;
+        if (cancel_token_ && cancel_token_->cancelled())
+            return ar_cancelled;
+        if (deadline_tsc_ && read_tsc() >= deadline_tsc_)
+            return ar_deadline;
+        return ar_count;
+    }
+
     void check_opacity(TransItem& item, TransactionTid::type v) {
-#if STO_TSC_PROFILE
         TimeKeeper<tc_opacity> tk;
-#endif
         assert(state_ <= s_committing_locked);
         TXP_INCREMENT(txp_tco);
+        observe_tid(v);
         if (!start_tid_)
             start_tid_ = _TID;
         if (!TransactionTid::try_check_opacity(start_tid_, v)
@@ -682,13 +1630,48 @@ public:
         check_opacity(_TID);
     }
 
+    // Record a version this transaction has seen. In decentralized TID mode
+    // the commit TID is chosen greater than every observed version, so
+    // a new version never equals a version another transaction read.
+    void observe_tid(TransactionTid::type v) const {
+        if (v > max_observed_tid_)
+            max_observed_tid_ = v;
+    }
+
     // committing
     tid_type commit_tid() const {
         assert(state_ == s_committing_locked || state_ == s_committing);
-        if (!commit_tid_)
-            commit_tid_ = fetch_and_add(&_TID, TransactionTid::increment_value);
+        if (!commit_tid_) {
+            if (decentralized_tids)
+                commit_tid_ = decentralized_commit_tid();
+            else
+                commit_tid_ = fetch_and_add(&_TID, TransactionTid::increment_value);
+        }
         return commit_tid_;
     }
+
+    // True while this transaction is installing writes with redo logging
+    // on (see TLog.hh): install() should pass its writes to log_write.
+    bool logging() const {
+        return log_epoch_ && state_ == s_committing_locked;
+    }
+    template <typename T>
+    void log_write(uint64_t id, uint64_t key, const T& value) {
+        uint32_t n = TLogCodec<T>::size(value);
+        TLogCodec<T>::encode(log_entry(id, key, n), value);
+    }
+    // returns space for a log entry of len bytes, for writes that
+    // log_write can't encode
+    char* log_entry(uint64_t id, uint64_t key, uint32_t len) {
+        TLogBuffer* b = log_ ? log_ : log_begin();
+        return b->append_entry(id, key, len);
+    }
+    // After a commit, its log epoch; 0 if it logged nothing. The commit is
+    // durable once TLog::durable_epoch() reaches this.
+    uint64_t commit_epoch() const {
+        return state_ == s_committed ? log_epoch_ : 0;
+    }
+
     void set_version(TVersion& vers, TVersion::type flags = 0) const {
         vers.set_version(commit_tid() | flags);
     }
@@ -722,6 +1705,8 @@ public:
     void print(std::ostream& w) const;
 
     class Abort {};
+    // thrown by a TRANSACTION_LIMITED loop that gives up
+    class Expired : public Abort {};
 
     uint32_t local_random() const {
         lrng_state_ = lrng_state_ * 1664525 + 1013904223;
@@ -739,48 +1724,229 @@ private:
 
     int threadid_;
     uint16_t hash_base_;
-    uint16_t first_write_;
+    unsigned first_write_;
     uint8_t state_;
     bool any_writes_;
     bool any_nonopaque_;
     bool may_duplicate_items_;
     bool is_test_;
+    bool interleaved_;
+    uint8_t interleave_gen_;
+    bool index_active_;
+    bool index_deferred_;
+    bool read_only_;
+    isolation_type isolation_;
+    bool no_read_my_writes_;
     TransItem* tset_next_;
     unsigned tset_size_;
     mutable tid_type start_tid_;
     mutable tid_type commit_tid_;
+    mutable tid_type max_observed_tid_;
+    tid_type snapshot_tid_;
+    // _TID at the first blind write (see TransProxy::mark_blind), or 0
+    tid_type blind_stamp_;
+    // log epoch read at commit, and the thread's log buffer once this
+    // commit has logged something
+    uint64_t log_epoch_;
+    TLogBuffer* log_;
     mutable TransactionBuffer buf_;
     mutable uint32_t lrng_state_;
+    mutable const TObject* abort_owner_;
+    mutable abort_reason abort_reason_;
+    mutable void* abort_key_;
 #if STO_DEBUG_ABORTS
     mutable TransItem* abort_item_;
-    mutable const char* abort_reason_;
     mutable TVersion::type abort_version_;
 #endif
-#if STO_TSC_PROFILE
+    // start time, if the thread's profile_timing was set at start()
     mutable tc_counter_type start_tsc_;
-#endif
-    TransItem* tset_[tset_max_capacity / tset_chunk];
+    // with profile_hw, the hw_phase running and the counts at its start;
+    // otherwise hw_phase_ is -1
+    int hw_phase_;
+    hw_sample hw_mark_;
+    // chunk directory: tset_dir0_ or, for huge transactions, the heap
+    TransItem** tset_;
+    unsigned tset_dir_size_;
+    TransItem* tset_dir0_[tset_dir_initial_capacity / tset_chunk];
 #if TRANSACTION_HASHTABLE
     uint16_t hashtable_[hash_size];
 #endif
+    // index_hash() of each item while tset_size_ <= index_threshold
+    uint32_t fingerprint_[index_threshold];
+    // index for large transactions: tset index + 1 per slot, 0 if empty
+    unsigned* index_;
+    unsigned index_mask_;
+    // earliest read item per key, for validating duplicate items;
+    // built on demand by preceding_duplicate_read
+    unsigned* read_index_;
+    unsigned read_index_mask_;
+    bool read_index_ready_;
+    // try_commit's write set indexes, and scratch space for sorting them;
+    // kept across transactions
+    struct write_key;
+    // items before this index are logged to undo_ when looked up (the
+    // innermost savepoint's tset size), or 0
+    unsigned savepoint_mark_;
+    unsigned nsavepoints_;
+    unsigned nested_depth_;
+    // opacity snapshot extensions so far
+    unsigned nextensions_;
+    // tset size at the next checkpoint (see item_checkpoint)
+    unsigned validate_mark_;
+    // tset size at the next incremental validation
+    unsigned next_validation_;
+    // see set_limits
+    uint64_t deadline_tsc_;
+    const TCancelToken* cancel_token_;
+    struct undo_entry {
+        unsigned tidx;
+        TransItem item;
+    };
+    mutable std::vector<undo_entry> undo_;
+    unsigned* writeset_;
+    write_key* write_keys_;
+    unsigned writeset_capacity_;
+    // group_commit's item lists: the grouped write set, then room for two
+    // more lists of writeset_capacity_ items (parallel install uses the
+    // second)
+    TransItem** group_items_;
     TransItem tset0_[tset_initial_capacity];
 
     void hard_check_opacity(TransItem* item, TransactionTid::type t);
+    tid_type decentralized_commit_tid() const;
+    void start_snapshot();
+    bool validate_read_only();
+    bool blind_commit(TransItem* it);
+    static void note_thread(unsigned id);
+    static void advance_tid_clock(tid_type t);
     void stop(bool committed, unsigned* writes, unsigned nwrites);
+    // join this thread's interleaved transactions; returns true if none
+    // were in flight
+    bool interleave_start(threadinfo_t& thr);
+    // leave them; returns true if none are left in flight
+    bool interleave_stop(threadinfo_t& thr);
+    // start this commit's log record
+    TLogBuffer* log_begin();
+    void grow_writeset(unsigned nitems);
+    static void group_by_owner(TransItem* const* items, unsigned n, TransItem** out);
+    bool lock_grouped(const unsigned* writeset, unsigned nwriteset);
+    bool check_grouped(bool check_reads);
+    void install_grouped(unsigned nwriteset);
+    void install_parallel(const unsigned* writeset, unsigned nwriteset, bool grouped);
+    bool htm_try_commit();
+    // hardware counter profiling: start counting at hp_execute, returning
+    // the phase (or -1 if thr can't count); end the running phase and
+    // move to phase p (-1 to stop)
+    int hw_begin(threadinfo_t& thr);
+    void hw_enter(int p) {
+        if (unlikely(hw_phase_ >= 0))
+            hw_switch(p);
+    }
+    void hw_switch(int p);
+    void sort_writeset(unsigned* writeset, unsigned nwriteset);
+    static void wait_for_fallback(uint64_t token);
+    static void rcu_add(threadinfo_t& thr, void (*function)(void*), void* argument) {
+        thr.rcu_set.add(thr.epoch, function, argument);
+        if (unlikely(thr.rcu_set.nadded() >= thr.rcu_check_mark))
+            rcu_check_pressure(thr);
+    }
+    static void rcu_check_pressure(threadinfo_t& thr);
+    // RCU callbacks run on the thread that added them
+    template <typename T>
+    static void rcu_destroy_counted(void* x) {
+        tinfo[TThread::id()].rcu_bytes -= sizeof(T);
+        ObjectDestroyer<T>::destroy_and_free(x);
+    }
+    template <typename T>
+    static void rcu_destroy_array_counted(void* x) {
+        tinfo[TThread::id()].rcu_bytes -= malloc_usable_size(x);
+        ObjectDestroyer<T>::destroy_and_free_array(x);
+    }
+    static void rcu_free_counted(void* x) {
+        tinfo[TThread::id()].rcu_bytes -= malloc_usable_size(x);
+        ::free(x);
+    }
+    static void rcu_free_pages_counted(void* x) {
+        tinfo[TThread::id()].rcu_bytes -= TPages::size(x);
+        TPages::free(x);
+    }
+    unsigned tset_index(const TransItem* ti) const;
+    void savepoint_log(TransItem* ti) const;
+    bool savepoint_reads_valid(const savepoint_type& sp) {
+        return !first_invalid_read(sp.tset_size);
+    }
+    // first of the first n items whose read or predicate no longer holds
+    TransItem* first_invalid_read(unsigned n);
+    void item_checkpoint();
+    void incremental_validate();
+    // Packer<T>::repack, except that under a savepoint it packs a fresh
+    // copy, so rolling back restores the old value
+    template <typename T, typename... Args>
+    void* repack(void* p, Args&&... args) {
+        if (unlikely(savepoint_mark_))
+            return Packer<T>::pack(buf_, std::forward<Args>(args)...);
+        return Packer<T>::repack(buf_, p, std::forward<Args>(args)...);
+    }
+    static unsigned next_epoch_interval(unsigned interval);
 
     friend class TransProxy;
     friend class TransItem;
     friend class Sto;
     friend class TestTransaction;
     friend class TNonopaqueVersion;
+    friend class TThread;
 };
 
+template <typename F>
+void Transaction::nested(F&& f, unsigned retries) {
+    savepoint_type sp = savepoint();
+    ++nested_depth_;
+    for (unsigned attempt = 0; ; ++attempt) {
+        try {
+            f();
+        } catch (Abort&) {
+            if (attempt < retries && in_progress()) {
+                rollback(sp);
+                if (savepoint_reads_valid(sp)) {
+                    TXP_INCREMENT(txp_nested_retries);
+                    continue;
+                }
+            }
+            --nested_depth_;
+            release(sp);
+            if (!nested_depth_)
+                silent_abort();
+            throw;
+        } catch (...) {
+            --nested_depth_;
+            release(sp);
+            throw;
+        }
+        --nested_depth_;
+        release(sp);
+        return;
+    }
+}
+
+inline void TThread::set_id(int id) {
+    assert(id >= 0 && unsigned(id) < Transaction::tinfo_capacity);
+    threadinfo_t& thr = Transaction::tinfo[id];
+    if (!thr.live) {
+        thr.live = true;
+        Transaction::note_thread(id);
+    }
+    the_id = id;
+    has_id = true;
+}
+
+template <int T, bool tmp_stats>
+inline TimeKeeper<T, tmp_stats>::TimeKeeper()
+    : init_tsc(unlikely(Transaction::tinfo[TThread::id()].profile_timing) ? read_tsc() : 0) {
+}
+
 template <int T, bool tmp_stats>
 inline void TimeKeeper<T, tmp_stats>::sync_thread_counter() {
-    tc_helper<T, tc_count>::account_array(
-        Transaction::tinfo[TThread::id()].tcs_.tcs_,
-        read_tsc() - init_tsc
-    );
+    Transaction::tsc_account<T>(read_tsc() - init_tsc);
 }
 
 template <int T, bool tmp_stats>
@@ -797,12 +1963,71 @@ public:
         return TThread::txn;
     }
 
+    // Create another transaction context for this thread. Switching
+    // TThread::txn between contexts between operations lets one thread
+    // run several transactions at once, for instance to overlap their
+    // cache misses (see TInterleave.hh). Contexts must not be switched
+    // inside try_commit, and may not run snapshot transactions. Regular
+    // transactions shouldn't run on the thread while contexts are in
+    // flight.
+    static Transaction* make_transaction() {
+        Transaction* t = new Transaction(false);
+        t->interleaved_ = true;
+        return t;
+    }
+
+    // Make t (which may be nullptr) this thread's current transaction and
+    // return the previous one.
+    static Transaction* swap_transaction(Transaction* t) {
+        Transaction* old = TThread::txn;
+        TThread::txn = t;
+        return old;
+    }
+
+    // Destroy a context from make_transaction, aborting it if in progress.
+    static void delete_transaction(Transaction* t) {
+        assert(t != TThread::txn && t->interleaved_);
+        delete t;
+    }
+
     static void start_transaction() {
         Transaction* t = transaction();
         always_assert(!t->in_progress());
         t->start();
     }
 
+    // Start a read-only transaction that reads the consistent state as of
+    // its start and commits without validation. Every TObject it touches
+    // must support snapshots.
+    static void start_snapshot_transaction() {
+        start_transaction();
+        TThread::txn->start_snapshot();
+    }
+
+    // Start a transaction that promises not to write. Its items aren't
+    // indexed (see Transaction::defer_index), and it commits by
+    // validating its reads and predicates, without taking locks or a
+    // commit TID. With opacity it commits without validation.
+    static void start_read_only_transaction() {
+        start_transaction();
+        TThread::txn->read_only_ = TThread::txn->index_deferred_ = true;
+    }
+
+    // Start a transaction at a weaker isolation level (see
+    // Transaction::isolation_type). Snapshot isolation takes a snapshot
+    // as start_snapshot_transaction does, but may write.
+    static void start_transaction(Transaction::isolation_type level) {
+        start_transaction();
+        if (level == Transaction::snapshot_isolation)
+            TThread::txn->start_snapshot();
+        TThread::txn->isolation_ = level;
+    }
+
+    static TransactionTid::type snapshot_tid() {
+        always_assert(in_progress());
+        return TThread::txn->snapshot_tid();
+    }
+
     static void update_threadid() {
         if (TThread::txn)
             TThread::txn->threadid_ = TThread::id();
@@ -838,6 +2063,40 @@ public:
         TThread::txn->check_opacity();
     }
 
+    static void reserve_items(unsigned n) {
+        always_assert(in_progress());
+        TThread::txn->reserve_items(n);
+    }
+
+    static void defer_index() {
+        always_assert(in_progress());
+        TThread::txn->defer_index();
+    }
+
+    static void no_read_my_writes() {
+        always_assert(in_progress());
+        TThread::txn->no_read_my_writes();
+    }
+
+    // see Transaction::savepoint_type
+    static Transaction::savepoint_type savepoint() {
+        always_assert(in_progress());
+        return TThread::txn->savepoint();
+    }
+    static void rollback(const Transaction::savepoint_type& sp) {
+        always_assert(in_progress());
+        TThread::txn->rollback(sp);
+    }
+    static void release(const Transaction::savepoint_type& sp) {
+        always_assert(in_progress());
+        TThread::txn->release(sp);
+    }
+    template <typename F>
+    static void nested(F&& f, unsigned retries = 3) {
+        always_assert(in_progress());
+        TThread::txn->nested(std::forward<F>(f), retries);
+    }
+
     template <typename T>
     static OptionalTransProxy check_item(const TObject* s, T key) {
         always_assert(in_progress());
@@ -856,6 +2115,12 @@ public:
         return TThread::txn->read_item(s, key);
     }
 
+    template <typename T, typename F>
+    static void new_items(const TObject* s, const T* keys, unsigned n, F&& f) {
+        always_assert(in_progress());
+        TThread::txn->new_items(s, keys, n, std::forward<F>(f));
+    }
+
     template <typename T>
     static TransProxy fresh_item(const TObject* s, T key) {
         always_assert(in_progress());
@@ -876,6 +2141,10 @@ public:
         return TThread::txn->commit_tid();
     }
 
+    static uint64_t commit_epoch() {
+        return TThread::txn->commit_epoch();
+    }
+
     static TransactionTid::type recent_tid() {
         return Transaction::global_epochs.recent_tid;
     }
@@ -931,29 +2200,187 @@ class TransactionGuard {
     }
 };
 
+// Bounds on a TRANSACTION_LIMITED loop, across its retries: it gives up,
+// throwing Transaction::Expired, once the deadline passes, the token is
+// cancelled, or max_attempts attempts have aborted. Each attempt also
+// carries the deadline and token (see Transaction::set_limits), so a
+// doomed attempt stops early instead of running to commit.
+//   TRANSACTION_LIMITED(TransactionLimits().within_us(500).cancel_on(tok)) {
+//       ...
+//   } RETRY(true);
+struct TransactionLimits {
+    uint64_t deadline_tsc;
+    const TCancelToken* token;
+    unsigned max_attempts;
+    TAdmission* gate;
+
+    TransactionLimits()
+        : deadline_tsc(0), token(nullptr), max_attempts(0), gate(nullptr) {
+    }
+    TransactionLimits& until_tsc(uint64_t tsc) {
+        deadline_tsc = tsc;
+        return *this;
+    }
+    TransactionLimits& within_us(double us) {
+        deadline_tsc = read_tsc() + uint64_t(us * 1000 * tsc_ghz());
+        return *this;
+    }
+    TransactionLimits& cancel_on(const TCancelToken& t) {
+        token = &t;
+        return *this;
+    }
+    TransactionLimits& attempts(unsigned n) {
+        max_attempts = n;
+        return *this;
+    }
+    // run attempts through g instead of Transaction::admission
+    TransactionLimits& admit(TAdmission& g) {
+        gate = &g;
+        return *this;
+    }
+
+    bool passed(unsigned nattempts) const {
+        return (max_attempts && nattempts >= max_attempts)
+            || (token && token->cancelled())
+            || (deadline_tsc && read_tsc() >= deadline_tsc);
+    }
+};
+
 class TransactionLoopGuard {
   public:
-    TransactionLoopGuard() {
+    enum kind_type { normal, snapshot, read_only, snapshot_isolation, read_committed };
+
+    TransactionLoopGuard()
+        : kind_(normal), fallback_(false), admitted_(false), attempts_(0),
+          start_tsc_(0), gate_(nullptr) {
+    }
+    explicit TransactionLoopGuard(kind_type kind)
+        : kind_(kind), fallback_(false), admitted_(false), attempts_(0),
+          start_tsc_(0), gate_(nullptr) {
+    }
+    explicit TransactionLoopGuard(const TransactionLimits& limits, kind_type kind = normal)
+        : kind_(kind), fallback_(false), admitted_(false), attempts_(0),
+          start_tsc_(0), limits_(limits), gate_(nullptr) {
     }
     ~TransactionLoopGuard() {
         if (TThread::txn->in_progress())
             TThread::txn->silent_abort();
+        end_fallback();
+        leave_gate(false);
     }
     void start() {
-        Sto::start_transaction();
+        if (attempts_) {
+            // release the token between attempts: the transaction might be
+            // waiting for another thread's commit
+            end_fallback();
+            leave_gate(false);
+            Transaction::contention_manager().before_retry(attempts_);
+        } else if (unlikely(Transaction::profile_timing()))
+            start_tsc_ = read_tsc();
+        ++attempts_;
+        if (kind_ == snapshot)
+            Sto::start_snapshot_transaction();
+        else {
+            // enter before taking the fallback token, so a thread never
+            // parks while holding it
+            enter_gate();
+            if (Transaction::fallback_aborts
+                && attempts_ > Transaction::fallback_aborts) {
+                Transaction::acquire_fallback();
+                fallback_ = true;
+            }
+            if (kind_ == read_only)
+                Sto::start_read_only_transaction();
+            else if (kind_ == snapshot_isolation)
+                Sto::start_transaction(Transaction::snapshot_isolation);
+            else if (kind_ == read_committed)
+                Sto::start_transaction(Transaction::read_committed);
+            else
+                Sto::start_transaction();
+        }
+        if (limits_.deadline_tsc || limits_.token)
+            TThread::txn->set_limits(limits_.deadline_tsc, limits_.token);
     }
     bool try_commit() {
-        return TThread::txn->try_commit();
+        bool committed = TThread::txn->try_commit();
+        if (committed) {
+            end_fallback();
+            leave_gate(true);
+            if (start_tsc_)
+                TSC_ACCOUNT(tc_transaction, read_tsc() - start_tsc_);
+        }
+        return committed;
+    }
+    // RETRY after an abort: throws Expired if past the limits, or Abort
+    // if stop
+    void after_abort(bool stop) {
+        if (unlikely(limits_.passed(attempts_))) {
+            TXP_INCREMENT(txp_give_ups);
+            throw Transaction::Expired();
+        }
+        if (stop)
+            throw Transaction::Abort();
+    }
+  private:
+    kind_type kind_;
+    bool fallback_;
+    bool admitted_;
+    unsigned attempts_;
+    tc_counter_type start_tsc_;
+    TransactionLimits limits_;
+    TAdmission* gate_;
+
+    void end_fallback() {
+        if (fallback_) {
+            Transaction::release_fallback();
+            fallback_ = false;
+        }
+    }
+    void enter_gate() {
+        gate_ = limits_.gate ? limits_.gate : Transaction::admission;
+        if (gate_)
+            admitted_ = gate_->enter(TThread::id());
+    }
+    void leave_gate(bool committed) {
+        if (gate_) {
+            gate_->leave(TThread::id(), admitted_, committed);
+            gate_ = nullptr;
+        }
     }
 };
 
 
+inline void*& TransProxy::rdata_slot() {
+    TransItem& it = item();
+    if (it.has_write() && !it.split())
+        it.make_split(t()->buf_);
+    return it.rslot();
+}
+
+inline void*& TransProxy::wdata_slot() {
+    TransItem& it = item();
+    if (!it.has_write() && !it.split()
+        && it.has_flag(TransItem::read_bit | TransItem::predicate_bit | TransItem::stash_bit))
+        it.make_split(t()->buf_);
+    return it.wslot();
+}
+
+// xwrite data can exist without write_bit, so data_ can't tell whether
+// it holds that or the read data; the item always splits
+template <typename T>
+inline T& TransProxy::xwrite_value() {
+    TransItem& it = item();
+    if (!it.split())
+        it.make_split(t()->buf_);
+    return it.xwrite_value<T>();
+}
+
 template <typename T>
 inline TransProxy& TransProxy::add_read(T rdata) {
     assert(!has_stash());
     if (!has_read()) {
         item().__or_flags(TransItem::read_bit);
-        item().rdata_ = Packer<T>::pack(t()->buf_, std::move(rdata));
+        rdata_slot() = Packer<T>::pack(t()->buf_, std::move(rdata));
         t()->any_nonopaque_ = true;
     }
     return *this;
@@ -968,7 +2395,7 @@ inline TransProxy& TransProxy::add_read_opaque(T rdata) {
     t()->check_opacity();
     if (!has_read()) {
         item().__or_flags(TransItem::read_bit);
-        item().rdata_ = Packer<T>::pack(t()->buf_, std::move(rdata));
+        rdata_slot() = Packer<T>::pack(t()->buf_, std::move(rdata));
     }
     return *this;
 }
@@ -976,11 +2403,11 @@ inline TransProxy& TransProxy::add_read_opaque(T rdata) {
 inline TransProxy& TransProxy::observe(TVersion version, bool add_read) {
     assert(!has_stash());
     if (version.is_locked_elsewhere(t()->threadid_))
-        t()->abort_because(item(), "locked", version.value());
+        t()->abort_because(item(), ar_locked, version.value());
     t()->check_opacity(item(), version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
-        item().rdata_ = Packer<TVersion>::pack(t()->buf_, std::move(version));
+        rdata_slot() = Packer<TVersion>::pack(t()->buf_, std::move(version));
     }
     return *this;
 }
@@ -988,10 +2415,10 @@ inline TransProxy& TransProxy::observe(TVersion version, bool add_read) {
 inline TransProxy& TransProxy::observe(TNonopaqueVersion version, bool add_read) {
     assert(!has_stash());
     if (version.is_locked_elsewhere(t()->threadid_))
-        t()->abort_because(item(), "locked", version.value());
+        t()->abort_because(item(), ar_locked, version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
-        item().rdata_ = Packer<TNonopaqueVersion>::pack(t()->buf_, std::move(version));
+        rdata_slot() = Packer<TNonopaqueVersion>::pack(t()->buf_, std::move(version));
         t()->any_nonopaque_ = true;
     }
     return *this;
@@ -1000,11 +2427,11 @@ inline TransProxy& TransProxy::observe(TNonopaqueVersion version, bool add_read)
 inline TransProxy& TransProxy::observe(TCommutativeVersion version, bool add_read) {
     assert(!has_stash());
     if (version.is_locked())
-        t()->abort_because(item(), "locked", version.value());
+        t()->abort_because(item(), ar_locked, version.value());
     t()->check_opacity(item(), version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
-        item().rdata_ = Packer<TCommutativeVersion>::pack(t()->buf_, std::move(version));
+        rdata_slot() = Packer<TCommutativeVersion>::pack(t()->buf_, std::move(version));
     }
     return *this;
 }
@@ -1035,8 +2462,10 @@ inline TransProxy& TransProxy::observe_opacity(TCommutativeVersion version) {
 
 template <typename T>
 inline TransProxy& TransProxy::update_read(T old_rdata, T new_rdata) {
-    if (has_read() && this->read_value<T>() == old_rdata)
-        item().rdata_ = Packer<T>::repack(t()->buf_, item().rdata_, new_rdata);
+    if (has_read() && this->read_value<T>() == old_rdata) {
+        void*& r = rdata_slot();
+        r = t()->repack<T>(r, new_rdata);
+    }
     return *this;
 }
 
@@ -1044,6 +2473,8 @@ inline TransProxy& TransProxy::update_read(T old_rdata, T new_rdata) {
 inline TransProxy& TransProxy::set_predicate() {
     assert(!has_read());
     item().__or_flags(TransItem::predicate_bit);
+    // the predicate owns the read slot even without data
+    rdata_slot();
     return *this;
 }
 
@@ -1051,7 +2482,7 @@ template <typename T>
 inline TransProxy& TransProxy::set_predicate(T pdata) {
     assert(!has_read());
     item().__or_flags(TransItem::predicate_bit);
-    item().rdata_ = Packer<T>::pack(t()->buf_, std::move(pdata));
+    rdata_slot() = Packer<T>::pack(t()->buf_, std::move(pdata));
     return *this;
 }
 
@@ -1065,6 +2496,8 @@ inline T& TransProxy::predicate_value(T default_pdata) {
 
 inline TransProxy& TransProxy::add_write() {
     if (!has_write()) {
+        assert(!t()->read_only_ && "read-only transactions can't write");
+        wdata_slot();
         item().__or_flags(TransItem::write_bit);
         t()->any_writes_ = true;
     }
@@ -1085,15 +2518,27 @@ inline TransProxy& TransProxy::add_write(T&& wdata) {
 template <typename T, typename... Args>
 inline TransProxy& TransProxy::add_write(Args&&... args) {
     if (!has_write()) {
+        assert(!t()->read_only_ && "read-only transactions can't write");
+        void*& w = wdata_slot();
         item().__or_flags(TransItem::write_bit);
-        item().wdata_ = Packer<T>::pack(t()->buf_, std::forward<Args>(args)...);
+        w = Packer<T>::pack(t()->buf_, std::forward<Args>(args)...);
         t()->any_writes_ = true;
-    } else
+    } else {
         // TODO: this assumes that a given writer data always has the same type.
         // this is certainly true now but we probably shouldn't assume this in general
         // (hopefully we'll have a system that can automatically call destructors and such
         // which will make our lives much easier)
-        item().wdata_ = Packer<T>::repack(t()->buf_, item().wdata_, std::forward<Args>(args)...);
+        void*& w = item().wslot();
+        w = t()->repack<T>(w, std::forward<Args>(args)...);
+    }
+    return *this;
+}
+
+inline TransProxy& TransProxy::mark_blind() {
+    assert(has_write());
+    item().__or_flags(TransItem::blind_bit);
+    if (!t()->blind_stamp_)
+        t()->blind_stamp_ = Transaction::_TID;
     return *this;
 }
 
@@ -1102,9 +2547,11 @@ inline TransProxy& TransProxy::set_stash(T sdata) {
     assert(!has_read());
     if (!has_stash()) {
         item().__or_flags(TransItem::stash_bit);
-        item().rdata_ = Packer<T>::pack(t()->buf_, std::move(sdata));
-    } else
-        item().rdata_ = Packer<T>::repack(t()->buf_, item().rdata_, std::move(sdata));
+        rdata_slot() = Packer<T>::pack(t()->buf_, std::move(sdata));
+    } else {
+        void*& r = rdata_slot();
+        r = t()->repack<T>(r, std::move(sdata));
+    }
     return *this;
 }
 
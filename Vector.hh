@@ -10,6 +10,7 @@
 #include "TArrayProxy.hh"
 #include "Box.hh"
 #include "rwlock.hh"
+#include "local_vector.hh"
 #include <stdexcept>
 
 #define IT_SIZE 10000
@@ -38,6 +39,9 @@ private:
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
   static constexpr int32_t value_shift = 1;
   static constexpr int32_t geq_mask = 1;
+  // Pending push_backs live in the write value, inside the transaction's
+  // buffer; short lists need no heap allocation.
+  typedef local_vector<T, 8> push_list_type;
 public:
   typedef int key_type;
   typedef T value_type;
@@ -100,7 +104,7 @@ public:
     if (item.has_write()) {
       if (!is_list(item)) {
         auto& val = item.template write_value<T>();
-        std::vector<T> write_list;
+        push_list_type write_list;
         write_list.push_back(val);
         write_list.push_back(v);
         item.clear_write();
@@ -108,7 +112,7 @@ public:
         item.add_flags(list_bit);
       }
       else {
-        auto& write_list = item.template write_value<std::vector<T>>();
+        auto& write_list = item.template write_value<push_list_type>();
         write_list.push_back(v);
       }
     }
@@ -135,7 +139,7 @@ public:
       }
       else {
         /* list */
-        auto& write_list= item.template write_value<std::vector<T>>();
+        auto& write_list= item.template write_value<push_list_type>();
         write_list.pop_back();
         if (write_list.size() == 0) item.clear_write();
         add_trans_size_offs(-1);
@@ -272,7 +276,7 @@ public:
       add_vector_version(TransactionTid::unlocked(ver));
       if (extra_items.has_write()) {
         if (is_list(extra_items)) {
-          auto& write_list= extra_items.template write_value<std::vector<T>>();
+          auto& write_list= extra_items.template write_value<push_list_type>();
           if (!write_list.empty()) {
             return write_list[diff];
           }
@@ -308,7 +312,7 @@ public:
       add_vector_version(TransactionTid::unlocked(ver));
       if (extra_items.has_write()) {
         if (is_list(extra_items)) {
-          auto& write_list= extra_items.template write_value<std::vector<T>>();
+          auto& write_list= extra_items.template write_value<push_list_type>();
           if (!write_list.empty()) {
             write_list[diff] = v;
           }
@@ -432,7 +436,7 @@ public:
     if (item.key<int>() == push_back_key) {
       // write all the elements
       if (is_list(item)) {
-        auto& write_list = item.template write_value<std::vector<T>>();
+        auto& write_list = item.template write_value<push_list_type>();
         for (size_t i = 0; i < write_list.size(); i++) {
           if (size_ >= capacity_) {
             // Need to resize
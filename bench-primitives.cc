@@ -0,0 +1,422 @@
+// Microbenchmarks for STO's hot paths, in TSC ticks per operation.
+//
+// Each benchmark runs a batch of operations several times and reports the
+// median batch, so one interrupted batch doesn't move the result. With
+// --save=FILE the results are written as "name ticks" lines; with
+// --compare=FILE they are checked against such a baseline, and the
+// program exits with status 1 if any benchmark is more than --threshold
+// percent slower. Baselines only make sense on the machine (and build
+// flags) that produced them.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "TArray.hh"
+#include "TWrapped.hh"
+#include "clp.h"
+
+namespace {
+
+class Dummy : public TObject {
+public:
+    bool lock(TransItem&, Transaction&) override { return true; }
+    bool check(TransItem&, Transaction&) override { return true; }
+    void install(TransItem&, Transaction&) override {}
+    void unlock(TransItem&) override {}
+};
+
+void* key_for(unsigned i) {
+    return reinterpret_cast<void*>(uintptr_t(i) * 8 + 8);
+}
+
+unsigned repetitions = 11;
+unsigned scale = 1;
+std::vector<std::pair<std::string, double> > results;
+volatile int sink;
+
+// batches of n-operation benchmarks repeat enough to take a few
+// microseconds, whatever n is
+unsigned rounds(unsigned n) {
+    return scale * std::max(16384 / n, 1U);
+}
+
+// Runs f(), which performs nops operations and returns the TSC ticks
+// they took, repetitions times; records the median per operation.
+template <typename F>
+void bench(const std::string& name, unsigned nops, F f) {
+    std::vector<uint64_t> ticks;
+    f(); // warm up
+    for (unsigned i = 0; i != repetitions; ++i)
+        ticks.push_back(f());
+    std::sort(ticks.begin(), ticks.end());
+    double per_op = double(ticks[ticks.size() / 2]) / nops;
+    printf("%-28s %10.1f ticks %10.2f ns\n", name.c_str(), per_op, per_op / tsc_ghz());
+    results.push_back(std::make_pair(name, per_op));
+}
+
+// Sto::item on keys not yet in the transaction, which appends items
+void bench_item_new(unsigned nitems) {
+    Dummy d;
+    char name[64];
+    snprintf(name, sizeof(name), "item-new/%u", nitems);
+    unsigned nrounds = rounds(nitems);
+    bench(name, nitems * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned r = 0; r != nrounds; ++r) {
+                Sto::start_transaction();
+                uint64_t t0 = read_tsc();
+                for (unsigned i = 0; i != nitems; ++i)
+                    Sto::item(&d, key_for(i));
+                t += read_tsc() - t0;
+                Sto::transaction()->silent_abort();
+            }
+            return t;
+        });
+}
+
+// Sto::read_item on new keys, as read-only transactions add items, with
+// or without a defer_index() hint
+void bench_read_item(unsigned nitems, bool defer) {
+    Dummy d;
+    char name[64];
+    snprintf(name, sizeof(name), "read-item%s/%u", defer ? "-deferred" : "", nitems);
+    unsigned nrounds = rounds(nitems);
+    bench(name, nitems * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned r = 0; r != nrounds; ++r) {
+                Sto::start_transaction();
+                if (defer)
+                    Sto::defer_index();
+                uint64_t t0 = read_tsc();
+                for (unsigned i = 0; i != nitems; ++i)
+                    Sto::read_item(&d, key_for(i));
+                t += read_tsc() - t0;
+                Sto::transaction()->silent_abort();
+            }
+            return t;
+        });
+}
+
+// writes to known-new keys, as batch inserts add them: one
+// Sto::new_item each, or all at once with Sto::new_items
+void bench_new_items(unsigned nitems, bool batch) {
+    Dummy d;
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%u", batch ? "new-items" : "new-item", nitems);
+    unsigned nrounds = rounds(nitems);
+    std::vector<void*> keys;
+    for (unsigned i = 0; i != nitems; ++i)
+        keys.push_back(key_for(i));
+    bench(name, nitems * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned r = 0; r != nrounds; ++r) {
+                Sto::start_transaction();
+                uint64_t t0 = read_tsc();
+                if (batch)
+                    Sto::new_items(&d, keys.data(), nitems, [] (TransProxy item, unsigned i) {
+                            item.add_write(int(i));
+                        });
+                else
+                    for (unsigned i = 0; i != nitems; ++i)
+                        Sto::new_item(&d, keys[i]).add_write(int(i));
+                t += read_tsc() - t0;
+                Sto::transaction()->silent_abort();
+            }
+            return t;
+        });
+}
+
+// Sto::item on keys already in a transaction of nitems items (find_item)
+void bench_item_find(unsigned nitems) {
+    Dummy d;
+    char name[64];
+    snprintf(name, sizeof(name), "item-find/%u", nitems);
+    unsigned nlookups = 4096 * scale;
+    bench(name, nlookups, [&] {
+            Sto::start_transaction();
+            for (unsigned i = 0; i != nitems; ++i)
+                Sto::item(&d, key_for(i));
+            uint64_t t0 = read_tsc();
+            for (unsigned i = 0; i != nlookups; ++i)
+                Sto::item(&d, key_for((i * 7919) % nitems));
+            uint64_t t = read_tsc() - t0;
+            Sto::transaction()->silent_abort();
+            return t;
+        });
+}
+
+// start, nreads TBox reads, nwrites TBox writes, and try_commit
+void bench_commit(unsigned nreads, unsigned nwrites) {
+    std::vector<TBox<int> > boxes(nreads + nwrites);
+    char name[64];
+    snprintf(name, sizeof(name), "commit/%ur%uw", nreads, nwrites);
+    unsigned ntxns = 1000 * scale;
+    bench(name, ntxns, [&] {
+            uint64_t t0 = read_tsc();
+            int sum = 0;
+            for (unsigned n = 0; n != ntxns; ++n) {
+                TRANSACTION {
+                    for (unsigned i = 0; i != nreads; ++i)
+                        sum += boxes[i];
+                    for (unsigned i = 0; i != nwrites; ++i)
+                        boxes[nreads + i] = n;
+                } RETRY(false);
+            }
+            sink = sum;
+            return read_tsc() - t0;
+        });
+}
+
+// transactions writing nwrites 100-byte strings to a TArray, which
+// should move each into the buffer and then into the array
+void bench_commit_strings(unsigned nwrites) {
+    TArray<std::string, 128> a;
+    char name[64];
+    snprintf(name, sizeof(name), "commit-strings/%uw", nwrites);
+    unsigned ntxns = 1000 * scale;
+    bench(name, ntxns, [&] {
+            uint64_t t0 = read_tsc();
+            for (unsigned n = 0; n != ntxns; ++n) {
+                TRANSACTION {
+                    for (unsigned i = 0; i != nwrites; ++i)
+                        a[i] = std::string(100, 'a' + (n + i) % 26);
+                } RETRY(false);
+            }
+            return read_tsc() - t0;
+        });
+}
+
+// Packer::pack_unique of distinct strings into one buffer, which
+// searches the buffer for an equal key first
+void bench_pack_unique(unsigned nkeys) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i != nkeys; ++i)
+        keys.push_back("key-" + std::to_string(i * 7919) + "-padding-past-sso");
+    char name[64];
+    snprintf(name, sizeof(name), "pack_unique/%u", nkeys);
+    TransactionBuffer buf;
+    unsigned nrounds = rounds(nkeys);
+    bench(name, 2 * nkeys * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned s = 0; s != nrounds; ++s) {
+                uint64_t t0 = read_tsc();
+                // each key once, then each again (found)
+                for (unsigned r = 0; r != 2; ++r)
+                    for (auto& k : keys)
+                        Packer<std::string>::pack_unique(buf, k);
+                t += read_tsc() - t0;
+                buf.clear();
+            }
+            return t;
+        });
+}
+
+// TransactionBuffer::allocate of small trivial values, then clear()
+void bench_buffer_allocate(unsigned n) {
+    char name[64];
+    snprintf(name, sizeof(name), "buffer-allocate/%u", n);
+    TransactionBuffer buf;
+    unsigned nrounds = rounds(n);
+    bench(name, n * nrounds, [&] {
+            uint64_t t0 = read_tsc();
+            for (unsigned s = 0; s != nrounds; ++s) {
+                for (unsigned i = 0; i != n; ++i)
+                    buf.allocate<uint64_t>(i);
+                buf.clear();
+            }
+            return read_tsc() - t0;
+        });
+}
+
+void noop(void*) {
+}
+
+// TRcuSet::add of n elements over 16 epochs, then clean_until of all
+void bench_rcu(unsigned n) {
+    TRcuSet set;
+    TRcuSet::epoch_type epoch = 1;
+    unsigned nrounds = rounds(n);
+    char name[64];
+    snprintf(name, sizeof(name), "rcu-add/%u", n);
+    bench(name, n * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned s = 0; s != nrounds; ++s) {
+                uint64_t t0 = read_tsc();
+                for (unsigned i = 0; i != n; ++i)
+                    set.add(epoch + i * 16 / n, noop, nullptr);
+                t += read_tsc() - t0;
+                epoch += 16;
+                set.clean_until(epoch);
+            }
+            return t;
+        });
+    snprintf(name, sizeof(name), "rcu-clean/%u", n);
+    bench(name, n * nrounds, [&] {
+            uint64_t t = 0;
+            for (unsigned s = 0; s != nrounds; ++s) {
+                for (unsigned i = 0; i != n; ++i)
+                    set.add(epoch + i * 16 / n, noop, nullptr);
+                epoch += 16;
+                uint64_t t0 = read_tsc();
+                set.clean_until(epoch);
+                t += read_tsc() - t0;
+            }
+            return t;
+        });
+}
+
+// TWrapped reads (version check and read-set insert) of distinct values
+void bench_twrapped_read(unsigned n) {
+    struct elem {
+        TVersion vers;
+        TOpaqueWrapped<int> v;
+    };
+    std::vector<elem> elems(n);
+    Dummy d;
+    char name[64];
+    snprintf(name, sizeof(name), "twrapped-read/%u", n);
+    unsigned nrounds = rounds(n);
+    bench(name, n * nrounds, [&] {
+            uint64_t t = 0;
+            int sum = 0;
+            for (unsigned s = 0; s != nrounds; ++s) {
+                Sto::start_transaction();
+                uint64_t t0 = read_tsc();
+                for (unsigned i = 0; i != n; ++i)
+                    sum += elems[i].v.read(Sto::item(&d, key_for(i)), elems[i].vers);
+                t += read_tsc() - t0;
+                Sto::transaction()->silent_abort();
+            }
+            always_assert(sum == 0);
+            return t;
+        });
+}
+
+bool save(const char* file) {
+    FILE* f = fopen(file, "w");
+    if (!f)
+        return false;
+    for (auto& r : results)
+        fprintf(f, "%s %.2f\n", r.first.c_str(), r.second);
+    return fclose(f) == 0;
+}
+
+// Returns the number of regressions, or -1 if file can't be read.
+int compare(const char* file, double threshold) {
+    FILE* f = fopen(file, "r");
+    if (!f)
+        return -1;
+    std::map<std::string, double> baseline;
+    char name[128];
+    double x;
+    while (fscanf(f, "%127s %lf", name, &x) == 2)
+        baseline[name] = x;
+    fclose(f);
+    int nregressions = 0;
+    printf("\n%-28s %10s %10s %8s\n", "vs baseline", "baseline", "now", "change");
+    for (auto& r : results) {
+        auto it = baseline.find(r.first);
+        if (it == baseline.end()) {
+            printf("%-28s %10s %10.1f\n", r.first.c_str(), "-", r.second);
+            continue;
+        }
+        double change = 100 * (r.second - it->second) / it->second;
+        bool regressed = change > threshold;
+        nregressions += regressed;
+        printf("%-28s %10.1f %10.1f %+7.1f%%%s\n", r.first.c_str(), it->second,
+               r.second, change, regressed ? "  REGRESSION" : "");
+    }
+    return nregressions;
+}
+
+enum { opt_repetitions = 1, opt_scale, opt_save, opt_compare, opt_threshold };
+
+const Clp_Option options[] = {
+    { "repetitions", 'r', opt_repetitions, Clp_ValUnsigned, 0 },
+    { "scale", 0, opt_scale, Clp_ValUnsigned, 0 },
+    { "save", 0, opt_save, Clp_ValString, 0 },
+    { "compare", 0, opt_compare, Clp_ValString, 0 },
+    { "threshold", 0, opt_threshold, Clp_ValDouble, 0 }
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const char* save_file = nullptr;
+    const char* compare_file = nullptr;
+    double threshold = 10;
+
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_repetitions:
+            repetitions = std::max(clp->val.u, 1U);
+            break;
+        case opt_scale:
+            scale = std::max(clp->val.u, 1U);
+            break;
+        case opt_save:
+            save_file = clp->vstr;
+            break;
+        case opt_compare:
+            compare_file = clp->vstr;
+            break;
+        case opt_threshold:
+            threshold = clp->val.d;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r REPETITIONS] [--scale=N] [--save=FILE] [--compare=FILE] [--threshold=PERCENT]\n", argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    TThread::set_id(0);
+    tsc_ghz(); // calibrate before timing anything
+    for (unsigned n : {16, 256, 4096})
+        bench_item_new(n);
+    for (unsigned n : {16, 256, 4096})
+        bench_item_find(n);
+    for (unsigned n : {256, 4096}) {
+        bench_new_items(n, false);
+        bench_new_items(n, true);
+    }
+    for (unsigned n : {16, 4096}) {
+        bench_read_item(n, false);
+        bench_read_item(n, true);
+    }
+    bench_commit(1, 0);
+    bench_commit(1, 1);
+    bench_commit(16, 4);
+    bench_commit(100, 10);
+    bench_commit_strings(4);
+    for (unsigned n : {16, 256})
+        bench_pack_unique(n);
+    bench_buffer_allocate(1024);
+    bench_rcu(1024);
+    for (unsigned n : {16, 1024})
+        bench_twrapped_read(n);
+
+    if (save_file && !save(save_file)) {
+        perror(save_file);
+        return 1;
+    }
+    if (compare_file) {
+        int n = compare(compare_file, threshold);
+        if (n < 0) {
+            perror(compare_file);
+            return 1;
+        }
+        if (n) {
+            printf("%d regression%s over %g%%\n", n, n == 1 ? "" : "s", threshold);
+            return 1;
+        }
+    }
+    return 0;
+}
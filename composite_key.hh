@@ -0,0 +1,174 @@
+#pragma once
+#include "compiler.hh"
+#include "str.hh"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+// An order-preserving composite key of at most N bytes, built in place
+// with no allocation, for Silo-style keys such as (warehouse, district,
+// order) in MassTrans. Comparing encodings bytewise, as Masstree does,
+// compares the components lexicographically:
+// - unsigned integers are big-endian;
+// - signed integers are big-endian with the sign bit flipped;
+// - strings have each 0 byte escaped as 0 0xFF and end with 0 1, so a
+//   string sorts before its extensions. append_last skips the escaping
+//   for a string that is the key's last component.
+// Pass str() to MassTrans::transGet, transPut, transDelete or
+// transQuery; lookups and queries then allocate nothing. (A transPut
+// that inserts still copies the key into its write.) composite_key_reader
+// decodes keys.
+template <unsigned N = 64>
+class composite_key {
+public:
+    static constexpr unsigned capacity = N;
+
+    composite_key()
+        : len_(0) {
+    }
+
+    template <typename T>
+    composite_key<N>& append(T x) {
+        static_assert(std::is_integral<T>::value, "composite_key components are integers or strings");
+        typedef typename std::make_unsigned<T>::type U;
+        U u = x;
+        if (std::is_signed<T>::value)
+            u ^= U(1) << (sizeof(T) * 8 - 1);
+        char* p = reserve(sizeof(T));
+        for (int i = sizeof(T) - 1; i >= 0; --i, u >>= 8)
+            p[i] = char(u & 0xFF);
+        return *this;
+    }
+    composite_key<N>& append(const char* s, size_t len) {
+        for (size_t i = 0; i != len; ++i)
+            if (s[i] == 0) {
+                char* p = reserve(2);
+                p[0] = 0;
+                p[1] = char(0xFF);
+            } else
+                *reserve(1) = s[i];
+        char* p = reserve(2);
+        p[0] = 0;
+        p[1] = 1;
+        return *this;
+    }
+    composite_key<N>& append(const char* s) {
+        return append(s, strlen(s));
+    }
+    composite_key<N>& append(lcdf::Str s) {
+        return append(s.data(), s.length());
+    }
+    composite_key<N>& append(const std::string& s) {
+        return append(s.data(), s.length());
+    }
+    composite_key<N>& append_last(const char* s, size_t len) {
+        memcpy(reserve(len), s, len);
+        return *this;
+    }
+
+    // Drops components past length len, e.g. to reuse a key's prefix.
+    void truncate(unsigned len) {
+        assert(len <= len_);
+        len_ = len;
+    }
+    void clear() {
+        len_ = 0;
+    }
+
+    // Sets end to the least key above every key that starts with this
+    // one, for a transQuery over a prefix. Returns false if there is
+    // none (the prefix is all 0xFF bytes); query to Str() instead.
+    bool prefix_end(composite_key<N>& end) const {
+        end = *this;
+        while (end.len_ && (unsigned char) end.buf_[end.len_ - 1] == 0xFF)
+            --end.len_;
+        if (!end.len_)
+            return false;
+        ++end.buf_[end.len_ - 1];
+        return true;
+    }
+
+    const char* data() const {
+        return buf_;
+    }
+    unsigned length() const {
+        return len_;
+    }
+    lcdf::Str str() const {
+        return lcdf::Str(buf_, len_);
+    }
+    operator lcdf::Str() const {
+        return str();
+    }
+
+private:
+    unsigned len_;
+    char buf_[N];
+
+    char* reserve(unsigned n) {
+        always_assert(len_ + n <= N && "composite_key overflow");
+        char* p = buf_ + len_;
+        len_ += n;
+        return p;
+    }
+};
+
+// Reads the components of a composite_key encoding, in order.
+class composite_key_reader {
+public:
+    composite_key_reader(lcdf::Str key)
+        : p_(key.data()), end_(key.data() + key.length()) {
+    }
+
+    template <typename T>
+    T read() {
+        static_assert(std::is_integral<T>::value, "composite_key components are integers or strings");
+        typedef typename std::make_unsigned<T>::type U;
+        assert(end_ - p_ >= int(sizeof(T)));
+        U u = 0;
+        for (unsigned i = 0; i != sizeof(T); ++i)
+            u = U(u << 8) | (unsigned char) p_[i];
+        p_ += sizeof(T);
+        if (std::is_signed<T>::value)
+            u ^= U(1) << (sizeof(T) * 8 - 1);
+        return T(u);
+    }
+    // Reads a string component into out, which holds up to cap bytes
+    // (more are dropped), returning its length.
+    size_t read(char* out, size_t cap) {
+        size_t n = 0;
+        while (1) {
+            assert(p_ < end_);
+            char c = *p_++;
+            if (c == 0) {
+                assert(p_ < end_);
+                if (*p_++ == 1)
+                    return n;
+            }
+            if (n < cap)
+                out[n] = c;
+            ++n;
+        }
+    }
+    std::string read_string() {
+        std::string s;
+        while (1) {
+            char c = *p_++;
+            if (c == 0 && *p_++ == 1)
+                return s;
+            s += c;
+        }
+    }
+    // The rest of the key, as appended by append_last.
+    lcdf::Str rest() const {
+        return lcdf::Str(p_, end_ - p_);
+    }
+    bool done() const {
+        return p_ == end_;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
@@ -3,16 +3,20 @@
 #include <sstream>
 #include <fstream>
 #include <set>
+#include <algorithm>
 #include <assert.h>
 #include <random>
 #include <thread>
 #include <climits>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <unistd.h>
+#include <sched.h>
 
 #include "TArray.hh"
 #include "TGeneric.hh"
 #include "Hashtable.hh"
+#include "inline_str.hh"
 #include "Queue.hh"
 #include "Vector.hh"
 #include "TVector.hh"
@@ -22,8 +26,10 @@
 #include "randgen.hh"
 #include "sampling.hh"
 #include "SystemProfiler.hh"
+#include "placement.hh"
 
 #include "MassTrans.hh"
+#include "TBTree.hh"
 
 // size of array (for hashtables or other non-array structures, this is the
 // size of the key space)
@@ -41,6 +47,12 @@
 #define USE_MASSTREE_STR 8
 #define USE_HASHTABLE_STR 9
 #define USE_ARRAY_NONOPAQUE 10
+#define USE_TBTREE 11
+#define USE_ARRAY_PADDED 12
+#define USE_ARRAY_SPLIT 13
+#define USE_TVECTOR_PADDED 14
+#define USE_TVECTOR_SPLIT 15
+#define USE_HASHTABLE_SNAPSHOT 16
 
 // set this to USE_DATASTRUCTUREYOUWANT
 #define DATA_STRUCTURE USE_HASHTABLE
@@ -146,17 +158,27 @@ inline value_type strtoval(const std::string& s) {
 #endif
 }
 
-volatile mrcu_epoch_type active_epoch = 1;
-
 unsigned initial_seeds[64];
 
 
 template <int DS> struct Container {};
 
+// transScan callback that just reads the rows
+struct scan_rows {
+    template <typename V>
+    bool operator()(lcdf::Str, const V&) const {
+        return true;
+    }
+};
+
 template <> struct Container<USE_ARRAY> {
     typedef TArray<value_type, ARRAY_SZ> type;
     typedef int index_type;
     static constexpr bool has_delete = false;
+    Container() {
+        // logged only with --log-dir
+        v_.set_log_id(1);
+    }
     value_type nontrans_get(index_type key) {
         return v_.nontrans_get(key);
     }
@@ -170,6 +192,9 @@ template <> struct Container<USE_ARRAY> {
     }
     static void thread_init(Container<USE_ARRAY>&) {
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
@@ -191,6 +216,9 @@ template <> struct Container<USE_ARRAY_NONOPAQUE> {
     }
     static void thread_init(Container<USE_ARRAY_NONOPAQUE>&) {
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
@@ -213,6 +241,9 @@ template <> struct Container<USE_VECTOR> {
     void transPut(index_type key, value_type value) {
         return v_.transUpdate(key, value);
     }
+    void transAppend(value_type value) {
+        v_.push_back(value);
+    }
     static void init() {
     }
     static void thread_init(Container<USE_VECTOR>&) {
@@ -241,8 +272,14 @@ template <> struct Container<USE_TVECTOR> {
     }
     static void init() {
     }
+    void transAppend(value_type value) {
+        v_.push_back(value);
+    }
     static void thread_init(Container<USE_TVECTOR>&) {
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
@@ -273,6 +310,8 @@ private:
 template <> struct Container<USE_MASSTREE> {
 #if STRING_VALUES && UNBOXED_STRINGS
     typedef MassTrans<value_type, versioned_str_struct> type;
+#elif !STRING_VALUES
+    typedef MassTrans<value_type, slab_versioned_value<value_type> > type;
 #else
     typedef MassTrans<value_type> type;
 #endif
@@ -301,15 +340,25 @@ template <> struct Container<USE_MASSTREE> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(IntStr(key).str(), value);
     }
+    // reads n rows from key on, in key order
+    size_t transScan(index_type key, int n) {
+        return v_.transScan(IntStr(key), lcdf::Str(), scan_rows(), n);
+    }
     static void init() {
-        Transaction::epoch_advance_callback = [] (unsigned) {
-            // just advance blindly because of the way Masstree uses epochs
-            globalepoch++;
-        };
+        type::static_init();
+    }
+    void bulk_load(const index_type* keys, const value_type* values, size_t n) {
+        std::vector<std::string> k;
+        for (size_t i = 0; i != n; ++i)
+            k.push_back(IntStr(keys[i]).str());
+        v_.bulk_load(k.data(), values, n);
     }
     static void thread_init(Container<USE_MASSTREE>&) {
         type::thread_init();
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
@@ -347,22 +396,37 @@ template <> struct Container<USE_MASSTREE_STR> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(IntStr(key).str(), valtostr(value));
     }
+    size_t transScan(index_type key, int n) {
+        return v_.transScan(IntStr(key), lcdf::Str(), scan_rows(), n);
+    }
     static void init() {
-        Transaction::epoch_advance_callback = [] (unsigned) {
-            // just advance blindly because of the way Masstree uses epochs
-            globalepoch++;
-        };
+        type::static_init();
+    }
+    void bulk_load(const index_type* keys, const value_type* values, size_t n) {
+        std::vector<std::string> k, v;
+        for (size_t i = 0; i != n; ++i) {
+            k.push_back(IntStr(keys[i]).str());
+            v.push_back(valtostr(values[i]));
+        }
+        v_.bulk_load(k.data(), v.data(), n);
     }
     static void thread_init(Container<USE_MASSTREE_STR>&) {
         type::thread_init();
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
 
-template <> struct Container<USE_HASHTABLE> {
+// With Snapshots, the table keeps history, so snapshot isolation reads
+// it as of a snapshot (string values can't be kept, so they run without)
+template <bool Snapshots> struct HashtableContainer {
 #ifndef BOOSTING
-    typedef Hashtable<int, value_type, true, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
+    typedef Hashtable<int, value_type, true, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR),
+                      value_type, std::hash<int>, std::equal_to<int>,
+                      Snapshots && std::is_trivially_copyable<value_type>::value> type;
 #else
     typedef TransMap<int, value_type, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
 #endif
@@ -388,23 +452,41 @@ template <> struct Container<USE_HASHTABLE> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(key, value);
     }
+#ifndef BOOSTING
+    void reserve(size_t n) {
+        v_.reserve(n / HASHTABLE_LOAD_FACTOR);
+    }
+    void bulk_load(const index_type* keys, const value_type* values, size_t n) {
+        v_.bulk_load(keys, values, n);
+    }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
+#endif
     static void init() {
     }
-    static void thread_init(Container<USE_HASHTABLE>&) {
+    template <typename C>
+    static void thread_init(C&) {
     }
 private:
     type v_;
 };
 
+template <> struct Container<USE_HASHTABLE> : public HashtableContainer<false> {
+};
+template <> struct Container<USE_HASHTABLE_SNAPSHOT> : public HashtableContainer<true> {
+};
+
 template <> struct Container<USE_HASHTABLE_STR> {
-    typedef Hashtable<int, std::string, false, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
+    // values are short, so store them inline
+    typedef Hashtable<int, inline_str<>, false, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
     typedef int index_type;
     static constexpr bool has_delete = true;
     value_type nontrans_get(index_type key) {
         return strtoval(v_.unsafe_get(key));
     }
     value_type transGet(index_type key) {
-        std::string v;
+        inline_str<> v;
         v_.transGet(key, v);
         return strtoval(v);
     }
@@ -420,14 +502,144 @@ template <> struct Container<USE_HASHTABLE_STR> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(key, valtostr(value));
     }
+    void reserve(size_t n) {
+        v_.reserve(n / HASHTABLE_LOAD_FACTOR);
+    }
+    void bulk_load(const index_type* keys, const value_type* values, size_t n) {
+        std::vector<inline_str<> > v;
+        for (size_t i = 0; i != n; ++i)
+            v.push_back(valtostr(values[i]));
+        v_.bulk_load(keys, v.data(), n);
+    }
     static void init() {
     }
     static void thread_init(Container<USE_HASHTABLE_STR>&) {
     }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
+private:
+    type v_;
+};
+
+template <> struct Container<USE_TBTREE> {
+    typedef TBTree<int, value_type> type;
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    value_type nontrans_get(index_type key) {
+        value_type v = value_type();
+        v_.nontrans_find(key, v);
+        return v;
+    }
+    value_type transGet(index_type key) {
+        value_type v = value_type();
+        v_.transGet(key, v);
+        return v;
+    }
+    void transPut(index_type key, value_type value) {
+        v_[key] = value;
+    }
+    bool transDelete(index_type key) {
+        return v_.erase(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        if (v_.count(key))
+            return false;
+        v_[key] = value;
+        return true;
+    }
+    bool transUpdate(index_type key, value_type value) {
+        if (!v_.count(key))
+            return false;
+        v_[key] = value;
+        return true;
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_TBTREE>&) {
+    }
+private:
+    type v_;
+};
+
+// TArray and TVector with other element layouts (see TLayout.hh)
+template <TLayout L> struct LayoutArrayContainer {
+    typedef TArray<value_type, ARRAY_SZ, TOpaqueWrapped, L> type;
+    typedef int index_type;
+    static constexpr bool has_delete = false;
+    value_type nontrans_get(index_type key) {
+        return v_.nontrans_get(key);
+    }
+    value_type transGet(index_type key) {
+        return v_.transGet(key);
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    static void init() {
+    }
+    template <typename C>
+    static void thread_init(C&) {
+    }
+    // padded and split elements are cache-line aligned, which plain new
+    // doesn't honor before C++17
+    static void* operator new(size_t n) {
+        void* p;
+        always_assert(posix_memalign(&p, CACHE_LINE_SIZE, n) == 0);
+        return p;
+    }
+    static void operator delete(void* p) {
+        free(p);
+    }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
 private:
     type v_;
 };
 
+template <TLayout L> struct LayoutTVectorContainer {
+    typedef TVector<value_type, TOpaqueWrapped, L> type;
+    typedef typename type::size_type index_type;
+    static constexpr bool has_delete = false;
+    LayoutTVectorContainer() {
+        v_.nontrans_reserve(ARRAY_SZ);
+        while (v_.nontrans_size() < ARRAY_SZ)
+            v_.nontrans_push_back(value_type());
+    }
+    value_type nontrans_get(index_type key) {
+        return v_.nontrans_get(key);
+    }
+    value_type transGet(index_type key) {
+        return v_.transGet(key);
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    void transAppend(value_type value) {
+        v_.push_back(value);
+    }
+    static void init() {
+    }
+    template <typename C>
+    static void thread_init(C&) {
+    }
+    footprint memory_footprint() {
+        return v_.memory_footprint();
+    }
+private:
+    type v_;
+};
+
+template <> struct Container<USE_ARRAY_PADDED> : public LayoutArrayContainer<TLayout::padded> {
+};
+template <> struct Container<USE_ARRAY_SPLIT> : public LayoutArrayContainer<TLayout::split> {
+};
+template <> struct Container<USE_TVECTOR_PADDED> : public LayoutTVectorContainer<TLayout::padded> {
+};
+template <> struct Container<USE_TVECTOR_SPLIT> : public LayoutTVectorContainer<TLayout::split> {
+};
+
 #if DATA_STRUCTURE == USE_QUEUE
 typedef Queue<value_type, ARRAY_SZ> QueueType;
 QueueType* q;
@@ -444,12 +656,128 @@ int prepopulate = ARRAY_SZ;//ARRAY_SZ/10;
 double readonly_percent = 0.0;
 double write_percent = 0.5;
 bool blindRandomWrite = true;
+// run transactions that only read as read-only transactions
+bool ro_transactions = false;
+// how workload transactions run, unless read-only (see --isolation)
+TransactionLoopGuard::kind_type isolation_kind = TransactionLoopGuard::normal;
+// hotspot transactions promise not to read their own writes
+bool skip_own_writes = false;
+// per-thread contention manager policy; nullptr means the default
+const char* contention_policy = nullptr;
+const char* log_dir = nullptr;
 double zipf_skew = 1.0;
 bool profile = false;
+bool perf_record = false;
 bool dump_trace = false;
 
 bool stop = false; // global stop signal
 
+// Where worker threads run (--pin) and where memory goes (--numa-*).
+// Threads pin themselves as their test thread index.
+ThreadPlacement placement;
+
+// With --duration, threads run transactions for warmup_duration and then
+// run_duration more seconds, instead of ntrans in total. A sampler thread
+// records each thread's commits and aborts every sample_interval seconds
+// (see run_sampler).
+double run_duration = 0;
+double warmup_duration = 0;
+double sample_interval = 0.1;
+const char* timeline_file = nullptr;
+
+inline bool sampling() {
+    return run_duration > 0 || timeline_file;
+}
+
+// Whether a thread should run its i-th transaction: the first n of them,
+// or with --duration, until the sampler raises stop.
+inline bool keep_running(size_t i, size_t n) {
+    if (run_duration > 0) {
+        acquire_fence();
+        return !stop;
+    }
+    return i < n;
+}
+
+// Open-loop load (--rate): instead of starting a transaction as soon as
+// the last one commits, each thread gets requests at rate/nthreads per
+// second, with exponential (--arrivals=poisson) or equal gaps, on a
+// schedule that starts with the run. A request's response time runs from
+// its scheduled arrival to its commit, so time spent queued behind slow
+// transactions counts: there's no coordinated omission. Service time
+// runs from the transaction's actual start.
+double arrival_rate = 0;
+bool poisson_arrivals = true;
+unsigned long run_start_tsc;
+
+inline bool open_loop() {
+    return arrival_rate > 0;
+}
+
+struct open_loop_thread {
+    std::mt19937_64 gen;
+    double mean_gap;        // TSC ticks
+    double next;            // ticks after run_start_tsc
+    uint64_t measure_from;  // ticks after run_start_tsc (the warmup)
+    uint64_t arrival;       // of the current request
+    uint64_t start;
+    log_histogram response;
+    log_histogram service;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+open_loop_thread open_loop_state[MAX_THREADS];
+
+// Waits for thread me's next request. Returns false if the run stopped
+// first.
+bool await_arrival(int me) {
+    if (!open_loop())
+        return true;
+    open_loop_thread& ol = open_loop_state[me];
+    if (ol.mean_gap == 0) {
+        ol.gen.seed(initial_seeds[2*me] ^ ((uint64_t) initial_seeds[2*me + 1] << 32));
+        ol.mean_gap = tsc_ghz() * BILLION * nthreads / arrival_rate;
+        ol.next = 0;
+        ol.measure_from = uint64_t(warmup_duration * tsc_ghz() * BILLION);
+    }
+    if (poisson_arrivals)
+        ol.next += std::exponential_distribution<double>(1)(ol.gen) * ol.mean_gap;
+    else
+        ol.next += ol.mean_gap;
+    ol.arrival = run_start_tsc + uint64_t(ol.next);
+    while (1) {
+        uint64_t now = read_tsc();
+        if (now >= ol.arrival)
+            break;
+        if (run_duration > 0) {
+            acquire_fence();
+            if (stop)
+                return false;
+        }
+        // sleep through long gaps, allowing for oversleeping, and spin
+        // through short ones
+        double us = (ol.arrival - now) / tsc_ghz() / 1000;
+        if (us > 1000)
+            usleep(std::min(us - 500, 10000.0));
+        else if (us > 50)
+            sched_yield();
+        else
+            relax_fence();
+    }
+    ol.start = read_tsc();
+    return true;
+}
+
+// Records the latency of thread me's request, which just committed.
+void count_response(int me) {
+    if (!open_loop())
+        return;
+    open_loop_thread& ol = open_loop_state[me];
+    if (ol.arrival - run_start_tsc < ol.measure_from)
+        return;
+    uint64_t now = read_tsc();
+    ol.response.add(now - ol.arrival);
+    ol.service.add(now - ol.start);
+}
+
 
 using namespace std;
 
@@ -458,14 +786,79 @@ bool maintain_true_array_state = true;
 int true_array_state[ARRAY_SZ];
 #endif
 
+template <typename T>
+auto container_reserve(T& a, size_t n, int) -> decltype(a.reserve(n), void()) {
+  a.reserve(n);
+}
+template <typename T>
+void container_reserve(T&, size_t, long) {
+}
+
+// Runs load(t, begin, end) on nthreads loader threads, loader t taking
+// the t-th contiguous run of the prepopulate keys. Loader t is pinned like
+// worker t, so its keys' memory is first touched on that worker's node.
+// Reports load throughput.
+template <typename T, typename F>
+void parallel_load(T& a, const char* how, F load) {
+  struct timeval tv1, tv2;
+  gettimeofday(&tv1, nullptr);
+  std::vector<std::thread> loaders;
+  for (int t = 0; t < nthreads; ++t)
+      loaders.emplace_back([&a, &load, t] {
+          TThread::set_id(t);
+          placement.pin_thread(t);
+          T::thread_init(a);
+          load(t, (int) ((int64_t) prepopulate * t / nthreads),
+               (int) ((int64_t) prepopulate * (t + 1) / nthreads));
+      });
+  for (auto& l : loaders)
+      l.join();
+  gettimeofday(&tv2, nullptr);
+  double secs = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+  printf("Done prepopulating %d keys (%s, %d loaders): %.3f s, %.0f keys/s\n",
+         prepopulate, how, nthreads, secs, secs > 0 ? prepopulate / secs : 0.);
+  fflush(stdout);
+}
+
+// containers with bulk_load skip transactions
+template <typename T>
+auto prepopulate_func(T& a, int) -> decltype(a.bulk_load(nullptr, nullptr, 0), void()) {
+  container_reserve(a, prepopulate, 0);
+  parallel_load(a, "bulk", [&a](int, int begin, int end) {
+          const int chunk = 1024;
+          typename T::index_type keys[chunk];
+          value_type values[chunk];
+          for (int i = begin; i < end; i += chunk) {
+              int n = std::min(chunk, end - i);
+              for (int j = 0; j != n; ++j) {
+                  keys[j] = i + j;
+                  values[j] = val(i + j + 1);
+              }
+              a.bulk_load(keys, values, n);
+          }
+      });
+}
+
+// others put keys in batches, one transaction per batch; loaders' keys
+// are disjoint, so retries come only from shared buckets or nodes
+template <typename T>
+void prepopulate_func(T& a, long) {
+  container_reserve(a, prepopulate, 0);
+  parallel_load(a, "transactional", [&a](int, int begin, int end) {
+          const int batch = 64;
+          for (int i = begin; i < end; i += batch) {
+              int n = std::min(batch, end - i);
+              TRANSACTION {
+                  for (int j = i; j != i + n; ++j)
+                      a.transPut(j, val(j+1));
+              } RETRY(true);
+          }
+      });
+}
+
 template <typename T>
 void prepopulate_func(T& a) {
-  for (int i = 0; i < prepopulate; ++i) {
-      TRANSACTION {
-          a.transPut(i, val(i+1));
-      } RETRY(false);
-  }
-  std::cout << "Done prepopulating " << std::endl;
+  prepopulate_func(a, 0);
 }
 
 void prepopulate_func(int *array) {
@@ -556,6 +949,10 @@ static void doDelete(T& a, int slot) {
 struct Tester {
     Tester() {}
     virtual void initialize() = 0;
+    // the container's memory, if it can tell
+    virtual footprint memory_footprint() {
+        return footprint();
+    }
     virtual void run(int me) {
         (void) me;
         assert(0 && "Test not supported");
@@ -569,9 +966,22 @@ struct Tester {
     }
 };
 
+// containers without memory_footprint report nothing
+template <typename T>
+auto container_footprint(T& c, int) -> decltype(c.memory_footprint()) {
+    return c.memory_footprint();
+}
+template <typename T>
+footprint container_footprint(T&, long) {
+    return footprint();
+}
+
 template <int DS> struct DSTester : public Tester {
     DSTester() : a() {}
     void initialize();
+    footprint memory_footprint() override {
+        return a ? container_footprint(*a, 0) : footprint();
+    }
     virtual bool prepopulate() { return true; }
     typedef Container<DS> container_type;
   protected:
@@ -579,7 +989,11 @@ template <int DS> struct DSTester : public Tester {
 };
 
 template <int DS> void DSTester<DS>::initialize() {
-    a = new container_type;
+    // containers are never freed; large ones get huge pages per --pages
+    void* p = TPages::allocate(sizeof(container_type));
+    if (placement.numa() == ThreadPlacement::numa_local)
+        placement.first_touch(p, sizeof(container_type), nthreads);
+    a = ::new(p) container_type;
     if (prepopulate()) {
         prepopulate_func(*a);
 #if MAINTAIN_TRUE_ARRAY_STATE
@@ -639,12 +1053,14 @@ struct HotspotRW : public DSTester<DS> {
     typedef typename DSTester<DS>::container_type container_type;
     typedef std::vector<RWOperation> query_type;
     typedef std::vector<query_type> workload_type;
-    HotspotRW() {}
+    HotspotRW() : distinct_keys(true) {}
     void run(int me) override;
     bool prepopulate() override;
     void report() override;
 
     std::vector<workload_type> workloads;
+    // no key appears twice in a transaction, except in an inc
+    bool distinct_keys;
     virtual void per_thread_workload_init(int thread_id);
 
 #if DEBUG_SKEW
@@ -751,22 +1167,31 @@ void HotspotRW<DS>::run(int me) {
 
 
     auto &tw = workloads[me];
+    size_t ntxns = tw.size();
 
 #if DEBUG_SKEW
     bool seen_stop = false;
     unsigned long start_tsc = read_tsc();
 #endif
 
-    for (auto txn_it = tw.begin(); txn_it != tw.end(); ++txn_it) {
+    for (size_t i = 0; ntxns && keep_running(i, ntxns) && await_arrival(me); ++i) {
+        // with --duration, cycle through the workload
+        auto txn_it = tw.begin() + i % ntxns;
 #if DEBUG_SKEW
         if (stop && !seen_stop) {
             auto ticks = read_tsc() - start_tsc;
-            skew_account[me].ntxns_at_stop = txn_it - tw.begin();
+            skew_account[me].ntxns_at_stop = i;
             skew_account[me].time_to_stop = ticks;
             seen_stop = true;
         }
 #endif
-        TRANSACTION {
+        bool ro = ro_transactions
+            && std::all_of(txn_it->begin(), txn_it->end(), [] (const RWOperation& op) {
+                    return op.type == OpType::read;
+                });
+        TRANSACTION_KIND(ro ? TransactionLoopGuard::read_only : isolation_kind) {
+            if (skip_own_writes && distinct_keys)
+                Sto::no_read_my_writes();
             for (auto &req : *txn_it) {
                 switch (req.type) {
                 case OpType::read:
@@ -787,6 +1212,7 @@ void HotspotRW<DS>::run(int me) {
                 }
             }
         } RETRY(true);
+        count_response(me);
     }
 
 #if DEBUG_SKEW
@@ -810,8 +1236,8 @@ void HotspotRW<DS>::report() {
     for (int i = 0; i < nthreads; ++i) {
         ss << "Thread " << i;
         ss << ": n=" << skew_account[i].ntxns_at_stop;
-        ss << ", t_stop=" << (unsigned long)((double)skew_account[i].time_to_stop / PROC_TSC_FREQ);
-        auto ttq = (unsigned long)((double)skew_account[i].time_to_quota / PROC_TSC_FREQ);
+        ss << ", t_stop=" << (unsigned long)((double)skew_account[i].time_to_stop / tsc_ghz());
+        auto ttq = (unsigned long)((double)skew_account[i].time_to_quota / tsc_ghz());
         times_to_quota.push_back(ttq);
         ss << ", t_quota=" << ttq;
         ss << std::endl;
@@ -915,6 +1341,9 @@ void SingleRW<DS>::per_thread_workload_init(int thread_id) {
 template <int DS>
 struct ZipfRW : public HotspotRW<DS> {
     typedef std::vector<RWOperation> query_type;
+    ZipfRW() {
+        this->distinct_keys = false;
+    }
     void per_thread_workload_init(int thread_id) override;
 };
 
@@ -955,6 +1384,149 @@ void ZipfRW<DS>::per_thread_workload_init(int thread_id) {
         dump_thread_trace(thread_id, thread_workload);
 }
 
+// Test: YCSB core workloads. Each transaction runs opspertrans operations
+// (--opspertrans=1 is YCSB's one per transaction) drawn from the mix:
+//   a: 50% read, 50% update
+//   b: 95% read, 5% update
+//   c: 100% read
+//   d: 95% read, 5% insert; reads pick keys by recency of insertion
+//   e: 95% scan of 1-100 rows, 5% insert
+//   f: 50% read, 50% read-modify-write
+// Other keys are Zipf-distributed (--skew; 0 means uniform) over the
+// prepopulated keys, scrambled so hot keys are spread out.
+//
+// Inserts add a new key to containers with transInsert, append to those
+// with transAppend, and otherwise overwrite the slot the new key wraps
+// to. Scans use the container's transScan where it has one (Masstree),
+// and otherwise read consecutive keys.
+template <typename T>
+auto ycsb_insert(T& a, int key, value_type v, int) -> decltype(a.transInsert(key, v), std::true_type()) {
+    a.transInsert(key, v);
+    return std::true_type();
+}
+template <typename T>
+auto ycsb_insert(T& a, int, value_type v, long) -> decltype(a.transAppend(v), std::true_type()) {
+    a.transAppend(v);
+    return std::true_type();
+}
+template <typename T>
+std::false_type ycsb_insert(T& a, int key, value_type v, ...) {
+    a.transPut(key % ARRAY_SZ, v);
+    return std::false_type();
+}
+
+template <int DS, char Workload>
+struct YCSB : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    // whether inserts add keys
+    typedef decltype(ycsb_insert(std::declval<container_type&>(), 0, value_type(), 0)) grows;
+    static_assert(Workload >= 'a' && Workload <= 'f', "YCSB workloads are a-f");
+
+    YCSB()
+        : inserted_(0), claimed_(0) {
+    }
+    void initialize() override;
+    void run(int me) override;
+    void report() override;
+
+  private:
+    std::vector<std::unique_ptr<StoSampling::StoRandomDistribution> > ranks_;
+    // committed inserts, which reads may see, and claimed insert keys
+    int inserted_ __attribute__((aligned(CACHE_LINE_SIZE)));
+    int claimed_ __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    int slot(int key) const {
+        return grows::value ? key : key % ARRAY_SZ;
+    }
+    // rank 0 is the hottest key
+    static int scramble(StoSampling::index_t rank) {
+        return (rank * 2654435761ULL) % prepopulate;
+    }
+    template <typename C>
+    static auto scan(C& a, int key, int n, int, int) -> decltype(a.transScan(key, n), void()) {
+        a.transScan(key, n);
+    }
+    template <typename C>
+    void scan(C& a, int key, int n, int limit, long) const {
+        for (int j = 0; j != n; ++j)
+            doRead(a, slot((key + j) % limit));
+    }
+};
+
+template <int DS, char Workload>
+void YCSB<DS, Workload>::initialize() {
+    if (prepopulate < 2) {
+        fprintf(stderr, "ycsb needs --prepopulate of at least 2\n");
+        exit(1);
+    }
+    DSTester<DS>::initialize();
+    for (int t = 0; t < nthreads; ++t)
+        if (zipf_skew == 0.0)
+            ranks_.emplace_back(new StoSampling::StoUniformDistribution(t, 0, prepopulate - 1));
+        else
+            ranks_.emplace_back(new StoSampling::StoZipfDistribution(t, 0, prepopulate - 1, zipf_skew));
+}
+
+template <int DS, char Workload>
+void YCSB<DS, Workload>::run(int me) {
+    TThread::set_id(me);
+    container_type* a = this->a;
+    container_type::thread_init(*a);
+
+    // percentages of reads (or scans) and of updates (or
+    // read-modify-writes); the rest are inserts
+    const unsigned read_pct = Workload == 'a' || Workload == 'f' ? 50 : Workload == 'c' ? 100 : 95;
+    const unsigned update_pct = Workload == 'a' || Workload == 'f' ? 50 : Workload == 'b' ? 5 : 0;
+    auto& ranks = *ranks_[me];
+    Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+    int N = ntrans/nthreads;
+    int OPS = opspertrans;
+    std::vector<StoSampling::index_t> rank(OPS);
+    for (int i = 0; keep_running(i, N) && await_arrival(me); ++i) {
+        // so that retries of this transaction do the same thing
+        Rand transgen_snap = transgen;
+        ranks.sample_batch(rank.data(), OPS);
+        int ninserts;
+        TRANSACTION_KIND(Workload == 'c' && ro_transactions ? TransactionLoopGuard::read_only : isolation_kind) {
+            transgen = transgen_snap;
+            ninserts = 0;
+            int limit = prepopulate + *(volatile int*) &inserted_;
+            for (int j = 0; j < OPS; ++j) {
+                unsigned r = transgen() % 100;
+                if (r < read_pct) {
+                    if (Workload == 'd')
+                        doRead(*a, slot(limit - 1 - rank[j]));
+                    else if (Workload == 'e')
+                        scan(*a, slot(scramble(rank[j])), transgen() % 100 + 1, limit, 0);
+                    else
+                        doRead(*a, slot(scramble(rank[j])));
+                } else if (r < read_pct + update_pct) {
+                    int k = slot(scramble(rank[j]));
+                    if (Workload == 'f')
+                        a->transPut(k, val(unval(a->transGet(k)) + 1));
+                    else
+                        a->transPut(k, val(i));
+                } else {
+                    int key = prepopulate + fetch_and_add(&claimed_, 1);
+                    ycsb_insert(*a, key, val(key + 1), 0);
+                    ++ninserts;
+                }
+            }
+        } RETRY(true);
+        if (ninserts)
+            fetch_and_add(&inserted_, ninserts);
+        count_response(me);
+    }
+}
+
+template <int DS, char Workload>
+void YCSB<DS, Workload>::report() {
+    if (Workload == 'd' || Workload == 'e')
+        printf("ycsb-%c: %d inserts %s\n", Workload, inserted_,
+               grows::value ? "added keys" : "overwrote slots (fixed-size container)");
+}
+
 
 // Test: ReadThenWrite
 template <int DS> struct ReadThenWrite : public DSTester<DS> {
@@ -973,7 +1545,7 @@ template <int DS> void ReadThenWrite<DS>::run(int me) {
 
   int N = ntrans/nthreads;
   int OPS = opspertrans;
-  for (int i = 0; i < N; ++i) {
+  for (int i = 0; keep_running(i, N) && await_arrival(me); ++i) {
     // so that retries of this transaction do the same thing
     Rand transgen_snap = transgen;
     TRANSACTION {
@@ -982,6 +1554,7 @@ template <int DS> void ReadThenWrite<DS>::run(int me) {
       nreads(*a, OPS - OPS*write_percent, gen);
       nwrites(*a, OPS*write_percent, gen);
     } RETRY(true);
+    count_response(me);
   }
 }
 
@@ -1019,7 +1592,7 @@ void RandomRWs_parent<DS>::do_run(int me) {
 
   int N = ntrans/nthreads;
   int OPS = opspertrans;
-  for (int i = 0; i < N; ++i) {
+  for (int i = 0; keep_running(i, N) && await_arrival(me); ++i) {
     // so that retries of this transaction do the same thing
     Rand transgen_snap = transgen;
 #if MAINTAIN_TRUE_ARRAY_STATE
@@ -1056,6 +1629,7 @@ void RandomRWs_parent<DS>::do_run(int me) {
         }
       }
     } RETRY(true);
+    count_response(me);
 #if MAINTAIN_TRUE_ARRAY_STATE
     if (maintain_true_array_state) {
         std::sort(slots_written, slots_written + nslots_written);
@@ -1217,7 +1791,7 @@ template <int DS> void XorDelete<DS, true>::run(int me) {
   int N = ntrans/nthreads;
   int OPS = opspertrans;
 
-  for (int i = 0; i < N; ++i) {
+  for (int i = 0; keep_running(i, N); ++i) {
     Rand transgen_snap = transgen;
     TRANSACTION {
         transgen = transgen_snap;
@@ -1431,12 +2005,14 @@ struct QTester {
 
 void* xorrunfunc(void* x) {
     QTester* qt = (QTester*) x;
+    placement.pin_thread(qt->me);
     Qxordeleterun(qt->me);
     return nullptr;
 } 
 
 void* transferrunfunc(void* x) {
     QTester* qt = (QTester*) x;
+    placement.pin_thread(qt->me);
     Qtransferrun(qt->me);
     return nullptr;
 } 
@@ -1464,15 +2040,122 @@ struct TesterPair {
     int me;
 };
 
+// Each thread's transaction outcomes so far, counted by a transaction end
+// hook while sampling. Only the owning thread writes its counters.
+struct thread_progress {
+    uint64_t commits;
+    uint64_t aborts;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+thread_progress progress[MAX_THREADS];
+
+void count_transaction_end(void* x) {
+    thread_progress* p = static_cast<thread_progress*>(x);
+    if (TThread::txn->aborted())
+        ++p->aborts;
+    else
+        ++p->commits;
+}
+
+// A sampler reading: seconds since the threads started, and each
+// thread's counters then.
+struct progress_sample {
+    double t;
+    std::vector<thread_progress> threads;
+    hw_phase_counters hw; // with --profile
+
+    uint64_t commits() const {
+        uint64_t n = 0;
+        for (auto& p : threads)
+            n += p.commits;
+        return n;
+    }
+    uint64_t aborts() const {
+        uint64_t n = 0;
+        for (auto& p : threads)
+            n += p.aborts;
+        return n;
+    }
+};
+
+std::vector<progress_sample> timeline;
+// the readings that bound the measured run: after the warmup, and as
+// the sampler raised stop (or after the threads finished)
+progress_sample measured_start, measured_end;
+volatile bool workers_done = false;
+
+double elapsed() {
+    return (read_tsc() - run_start_tsc) / tsc_ghz() / BILLION;
+}
+
+progress_sample take_sample(int nthreads) {
+    progress_sample s;
+    acquire_fence();
+    s.t = elapsed();
+    s.threads.assign(progress, progress + nthreads);
+    if (profile)
+        s.hw = Transaction::hw_counters_combined();
+    return s;
+}
+
+// Samples every sample_interval seconds until the threads finish. With
+// --duration, also marks the end of the warmup and raises stop once the
+// run is over.
+void run_sampler(int nthreads) {
+    double next = sample_interval;
+    bool warm = warmup_duration <= 0;
+    while (!workers_done) {
+        double t = elapsed();
+        double wake = next;
+        if (!warm)
+            wake = std::min(wake, warmup_duration);
+        if (run_duration > 0 && !stop)
+            wake = std::min(wake, warmup_duration + run_duration);
+        if (wake > t) {
+            // wake up often enough to notice the threads finishing
+            usleep(std::min((wake - t) * 1000000, 10000.0));
+            continue;
+        }
+        progress_sample s = take_sample(nthreads);
+        if (s.t >= next) {
+            timeline.push_back(s);
+            next += sample_interval;
+        }
+        if (!warm && s.t >= warmup_duration) {
+            measured_start = s;
+            warm = true;
+        }
+        if (run_duration > 0 && !stop && s.t >= warmup_duration + run_duration) {
+            measured_end = s;
+            release_fence();
+            stop = true;
+        }
+    }
+}
+
 void* runfunc(void* x) {
     TesterPair* tp = (TesterPair*) x;
+    std::unique_ptr<TContentionManager> cm;
+    TThread::set_id(tp->me);
+    placement.pin_thread(tp->me);
+    if (contention_policy) {
+        cm.reset(TContentionManager::make(contention_policy));
+        Transaction::set_contention_manager(cm.get());
+    }
+    if (sampling())
+        Transaction::add_hook(Transaction::hook_end, count_transaction_end, &progress[tp->me]);
     tp->t->run(tp->me);
+    if (sampling())
+        Transaction::remove_hook(Transaction::hook_end, count_transaction_end, &progress[tp->me]);
+    if (cm)
+        Transaction::set_contention_manager(nullptr);
     return nullptr;
 }
 
 void startAndWait(int n, Tester* tester) {
   pthread_t tids[n];
   TesterPair testers[n];
+  run_start_tsc = read_tsc();
+  measured_start = take_sample(n);
   for (int i = 0; i < n; ++i) {
       testers[i].t = tester;
       testers[i].me = i;
@@ -1482,9 +2165,63 @@ void startAndWait(int n, Tester* tester) {
   pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
   pthread_detach(advancer);
 
+  std::thread sampler;
+  if (sampling())
+      sampler = std::thread(run_sampler, n);
   for (int i = 0; i < n; ++i) {
     pthread_join(tids[i], NULL);
   }
+  if (sampling()) {
+      workers_done = true;
+      sampler.join();
+      progress_sample last = take_sample(n);
+      if (timeline.empty() || timeline.back().t < last.t)
+          timeline.push_back(last);
+      if (run_duration <= 0)
+          measured_end = last;
+  }
+}
+
+// Writes the timeline as CSV if file ends in ".csv", JSON otherwise. Each
+// interval has the commits and aborts of each thread since the previous
+// one.
+bool write_timeline(const char* file, const char* test, const char* ds, int nthreads) {
+  FILE* f = fopen(file, "w");
+  if (!f)
+      return false;
+  size_t len = strlen(file);
+  bool csv = len >= 4 && strcmp(file + len - 4, ".csv") == 0;
+  double time = measured_end.t - measured_start.t;
+  if (csv)
+      fprintf(f, "end,thread,commits,aborts\n");
+  else
+      fprintf(f, "{\"test\": \"%s\", \"ds\": \"%s\", \"nthreads\": %d, \"interval\": %g, \"warmup\": %g, \"duration\": %g,\n"
+              " \"time\": %f, \"commits\": %llu, \"aborts\": %llu,\n \"intervals\": [",
+              test, ds, nthreads, sample_interval, warmup_duration, run_duration, time,
+              (unsigned long long) (measured_end.commits() - measured_start.commits()),
+              (unsigned long long) (measured_end.aborts() - measured_start.aborts()));
+  std::vector<thread_progress> prev(nthreads, thread_progress());
+  for (size_t i = 0; i != timeline.size(); ++i) {
+      auto& s = timeline[i];
+      if (csv) {
+          for (int th = 0; th != nthreads; ++th)
+              fprintf(f, "%f,%d,%llu,%llu\n", s.t, th,
+                      (unsigned long long) (s.threads[th].commits - prev[th].commits),
+                      (unsigned long long) (s.threads[th].aborts - prev[th].aborts));
+      } else {
+          fprintf(f, "%s\n  {\"end\": %f, \"commits\": [", i ? "," : "", s.t);
+          for (int th = 0; th != nthreads; ++th)
+              fprintf(f, "%s%llu", th ? ", " : "", (unsigned long long) (s.threads[th].commits - prev[th].commits));
+          fprintf(f, "], \"aborts\": [");
+          for (int th = 0; th != nthreads; ++th)
+              fprintf(f, "%s%llu", th ? ", " : "", (unsigned long long) (s.threads[th].aborts - prev[th].aborts));
+          fprintf(f, "]}");
+      }
+      prev = s.threads;
+  }
+  if (!csv)
+      fprintf(f, "\n]}\n");
+  return fclose(f) == 0;
 }
 
 
@@ -1505,7 +2242,13 @@ void print_time(double time) {
     {name, desc, 7, new type<7, ## __VA_ARGS__>},     \
     {name, desc, 8, new type<8, ## __VA_ARGS__>},     \
     {name, desc, 9, new type<9, ## __VA_ARGS__>},     \
-    {name, desc, 10, new type<10, ## __VA_ARGS__>}
+    {name, desc, 10, new type<10, ## __VA_ARGS__>},    \
+    {name, desc, 11, new type<11, ## __VA_ARGS__>},    \
+    {name, desc, 12, new type<12, ## __VA_ARGS__>},    \
+    {name, desc, 13, new type<13, ## __VA_ARGS__>},    \
+    {name, desc, 14, new type<14, ## __VA_ARGS__>},    \
+    {name, desc, 15, new type<15, ## __VA_ARGS__>},    \
+    {name, desc, 16, new type<16, ## __VA_ARGS__>}
 
 struct Test {
     const char* name;
@@ -1524,7 +2267,13 @@ struct Test {
     MAKE_TESTER("hotspot", "contending hotspot", HotspotRW),
     MAKE_TESTER("hotspot2", "contending hotspot (less stupid)", Hotspot2RW),
     MAKE_TESTER("singlerw", "increment a single random element", SingleRW),
-    MAKE_TESTER("zipfrw", "Zipf random rw", ZipfRW)
+    MAKE_TESTER("zipfrw", "Zipf random rw", ZipfRW),
+    MAKE_TESTER("ycsb-a", "YCSB A: update heavy", YCSB, 'a'),
+    MAKE_TESTER("ycsb-b", "YCSB B: read mostly", YCSB, 'b'),
+    MAKE_TESTER("ycsb-c", "YCSB C: read only", YCSB, 'c'),
+    MAKE_TESTER("ycsb-d", "YCSB D: read latest", YCSB, 'd'),
+    MAKE_TESTER("ycsb-e", "YCSB E: short ranges", YCSB, 'e'),
+    MAKE_TESTER("ycsb-f", "YCSB F: read-modify-write", YCSB, 'f')
 };
 
 struct {
@@ -1536,17 +2285,23 @@ struct {
     {"hashtable", USE_HASHTABLE},
     {"hash", USE_HASHTABLE},
     {"hash-str", USE_HASHTABLE_STR},
+    {"hash-snapshot", USE_HASHTABLE_SNAPSHOT},
     {"masstree", USE_MASSTREE},
     {"mass", USE_MASSTREE},
     {"masstree-str", USE_MASSTREE_STR},
     {"tgeneric", USE_TGENERICARRAY},
     {"queue", USE_QUEUE},
     {"vector", USE_VECTOR},
-    {"tvector", USE_TVECTOR}
+    {"tvector", USE_TVECTOR},
+    {"tbtree", USE_TBTREE},
+    {"array-padded", USE_ARRAY_PADDED},
+    {"array-split", USE_ARRAY_SPLIT},
+    {"tvector-padded", USE_TVECTOR_PADDED},
+    {"tvector-split", USE_TVECTOR_SPLIT}
 };
 
 enum {
-    opt_test = 1, opt_nrmyw, opt_check, opt_profile, opt_dump, opt_nthreads, opt_ntrans, opt_opspertrans, opt_opspertrans_ro, opt_writepercent, opt_readonlypercent, opt_blindrandwrites, opt_prepopulate, opt_seed, opt_skew
+    opt_test = 1, opt_nrmyw, opt_check, opt_profile, opt_dump, opt_nthreads, opt_ntrans, opt_opspertrans, opt_opspertrans_ro, opt_writepercent, opt_readonlypercent, opt_blindrandwrites, opt_prepopulate, opt_seed, opt_skew, opt_dtid, opt_opacity_extensions, opt_validate_interval, opt_prefetch_validation, opt_group_commit, opt_read_only_txns, opt_isolation, opt_skip_own_writes, opt_contention, opt_fallback_aborts, opt_htm, opt_counters, opt_timing, opt_epoch_min, opt_epoch_max, opt_rcu_threshold, opt_rcu_budget, opt_log_dir, opt_duration, opt_warmup, opt_interval, opt_timeline, opt_pin, opt_numa_interleave, opt_numa_local, opt_pages, opt_local_txn_memory, opt_rate, opt_arrivals, opt_perf_record, opt_conflicts
 };
 
 static const Clp_Option options[] = {
@@ -1564,14 +2319,76 @@ static const Clp_Option options[] = {
   { "prepopulate", 0, opt_prepopulate, Clp_ValInt, Clp_Optional },
   { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
   { "skew", 0, opt_skew, Clp_ValDouble, Clp_Optional},
+  { "decentralized-tid", 0, opt_dtid, 0, Clp_Negate },
+  { "opacity-extensions", 0, opt_opacity_extensions, Clp_ValUnsigned, 0 },
+  { "validate-interval", 0, opt_validate_interval, Clp_ValUnsigned, 0 },
+  { "prefetch-validation", 0, opt_prefetch_validation, 0, Clp_Negate },
+  { "group-commit", 0, opt_group_commit, 0, Clp_Negate },
+  { "read-only-txns", 0, opt_read_only_txns, 0, Clp_Negate },
+  { "isolation", 0, opt_isolation, Clp_ValString, 0 },
+  { "skip-own-writes", 0, opt_skip_own_writes, 0, Clp_Negate },
+  { "contention", 0, opt_contention, Clp_ValString, 0 },
+  { "fallback-aborts", 0, opt_fallback_aborts, Clp_ValUnsigned, 0 },
+  { "htm", 0, opt_htm, Clp_ValUnsigned, 0 },
+  { "counters", 0, opt_counters, Clp_ValUnsigned, 0 },
+  { "timing", 0, opt_timing, 0, Clp_Negate },
+  { "epoch-min", 0, opt_epoch_min, Clp_ValUnsigned, 0 },
+  { "epoch-max", 0, opt_epoch_max, Clp_ValUnsigned, 0 },
+  { "rcu-threshold", 0, opt_rcu_threshold, Clp_ValUnsigned, 0 },
+  { "rcu-budget", 0, opt_rcu_budget, Clp_ValUnsigned, 0 },
+  { "log-dir", 0, opt_log_dir, Clp_ValString, 0 },
+  { "duration", 0, opt_duration, Clp_ValDouble, 0 },
+  { "warmup", 0, opt_warmup, Clp_ValDouble, 0 },
+  { "interval", 0, opt_interval, Clp_ValDouble, 0 },
+  { "timeline", 0, opt_timeline, Clp_ValString, 0 },
+  { "pin", 0, opt_pin, Clp_ValString, 0 },
+  { "numa-interleave", 0, opt_numa_interleave, 0, 0 },
+  { "numa-local", 0, opt_numa_local, 0, 0 },
+  { "pages", 0, opt_pages, Clp_ValString, 0 },
+  { "local-txn-memory", 0, opt_local_txn_memory, 0, Clp_Negate },
+  { "rate", 0, opt_rate, Clp_ValDouble, 0 },
+  { "arrivals", 0, opt_arrivals, Clp_ValString, 0 },
+  { "perf-record", 0, opt_perf_record, 0, Clp_Negate },
+  { "conflicts", 0, opt_conflicts, Clp_ValUnsigned, Clp_Optional },
 };
 
+// --profile: hardware counts per committed transaction, by phase
+void print_hw_profile(const hw_phase_counters& hw) {
+  if (!hw.events) {
+    printf("hardware counters: unavailable (check /proc/sys/kernel/perf_event_paranoid)\n");
+    return;
+  }
+  double n = std::max(hw.commits, uint64_t(1));
+  printf("hardware counters per commit (%llu commits):\n", (unsigned long long) hw.commits);
+  printf("  %-9s %12s %12s %6s %10s %10s\n", "phase", "cycles", "instructions", "IPC", "LLC miss", "br miss");
+  for (int p = 0; p <= hp_count; ++p) {
+    hw_sample s = p == hp_count ? hw.total() : hw.phase[p];
+    printf("  %-9s", p == hp_count ? "total" : hw_phase_counters::phase_name(p));
+    for (int e = 0; e != hw_count; ++e) {
+      int width = e <= hw_instructions ? 12 : 10;
+      if (hw.events & (1U << e))
+        printf(" %*.1f", width, s.v[e] / n);
+      else
+        printf(" %*s", width, "-");
+      if (e == hw_instructions) {
+        if ((hw.events & 3U) == 3U && s.v[hw_cycles])
+          printf(" %6.2f", double(s.v[hw_instructions]) / s.v[hw_cycles]);
+        else
+          printf(" %6s", "-");
+      }
+    }
+    printf("\n");
+  }
+}
+
 static void help(const char *name) {
   printf("Usage: %s test-number [OPTIONS]\n\
 Options:\n\
  -n, --no-readmywrites\n\
  -c, --check, run a check of the results afterwards\n\
- -p, --profile, run a perf profile of the execution porition of the benchmark\n\
+ -p, --profile, count cycles, instructions, LLC and branch misses per commit phase, and report container and STO memory\n\
+ --perf-record, run perf record over the execution portion of the benchmark\n\
+ --conflicts[=PERIOD], sample one in PERIOD (default 1) conflict aborts and print the most conflicting items\n\
  -d, --dump, dump the workload executed by each thread (works only for hotspot (8))\n\
  --nthreads=NTHREADS (default %d)\n\
  --ntrans=NTRANS, how many total transactions to run (they'll be split between threads) (default %d)\n\
@@ -1582,8 +2399,41 @@ Options:\n\
  --blindrandwrites, do blind random writes for random tests. makes checking impossible\n\
  --prepopulate=PREPOPULATE, prepopulate table with given number of items (default %d)\n\
  --seed=SEED\n\
- --skew=SKEW, skew parameter for zipfrw test type (default %f)\n",
-         name, nthreads, ntrans, opspertrans, write_percent, readonly_percent, prepopulate, zipf_skew);
+ --skew=SKEW, skew parameter for zipfrw test type (default %f)\n\
+ --decentralized-tid, derive commit TIDs per thread instead of from a global counter (default %s)\n\
+ --opacity-extensions=N, revalidate to extend the opacity snapshot at most N times per transaction, then abort as in TL2 (default unlimited)\n\
+ --validate-interval=N, recheck the read set every N items and abort doomed transactions early; 0 disables (default %u)\n\
+ --prefetch-validation, prefetch read versions during commit-time validation (default %s)\n\
+ --group-commit, lock, check and install items grouped by data structure (default %s)\n\
+ --read-only-txns, run transactions with no writes (and YCSB-C) as read-only transactions (default %s)\n\
+ --isolation=LEVEL, run hotspot, zipfrw and YCSB transactions at serializable, si (snapshot isolation; reads hash-snapshot tables as of a snapshot) or rc (read committed) (default serializable)\n\
+ --skip-own-writes, hotspot tests (not zipfrw) promise not to read their own writes, so hashtables skip looking up items (default %s)\n\
+ --contention=POLICY, contention manager: spin, backoff, abort-fast or adaptive (default %s)\n\
+ --fallback-aborts=N, run a transaction as the fallback after N aborts in a row; 0 disables (default %u)\n\
+ --htm=N, commit transactions of at most N items in hardware transactions; 0 disables (default %u)\n\
+ --counters=LEVEL, keep profiling counters up to LEVEL (0-2) and print them (default %u)\n\
+ --timing, keep TSC timing counters (default %s)\n\
+ --epoch-min=US, --epoch-max=US, bounds on the adaptive epoch interval (default %u, %u)\n\
+ --rcu-threshold=N, reclaim eagerly once a thread has N RCU elements pending; 0 disables (default %llu)\n\
+ --rcu-budget=N, free at most N RCU elements per transaction start; 0 means no limit (default %u)\n\
+ --log-dir=DIR, keep a redo log of array writes in DIR, synced once per epoch (default off)\n\
+ --duration=SECONDS, run for SECONDS (after the warmup) instead of a fixed number of transactions\n\
+ --warmup=SECONDS, with --duration, run this long before measuring (default 0)\n\
+ --interval=SECONDS, how often to sample per-thread commits and aborts (default %g)\n\
+ --timeline=FILE, write the per-interval samples to FILE, as CSV if it ends in .csv, JSON otherwise\n\
+ --pin=POLICY, pin threads: compact (fill a NUMA node first), scatter (round-robin over nodes), or a CPU list like 0,2,8-15 (default none)\n\
+ --numa-interleave, interleave memory over all NUMA nodes\n\
+ --numa-local, allocate memory on the node that first touches it, and prepopulate from the pinned threads\n\
+ --pages=POLICY, back containers, transaction contexts and buffers of 2 MB or more with normal pages, thp (transparent huge pages), 2m or 1g (hugetlbfs pages) (default %s)\n\
+ --local-txn-memory, bind each thread's transaction context, items and buffers to its NUMA node\n\
+ --rate=TXNS, run open loop: start TXNS transactions per second in total, and report latency from their scheduled starts\n\
+ --arrivals=DIST, open-loop arrivals: poisson or constant (default poisson)\n",
+         name, nthreads, ntrans, opspertrans, write_percent, readonly_percent, prepopulate, zipf_skew, Transaction::decentralized_tids ? "on" : "off",
+         Transaction::validate_interval, Transaction::prefetch_validation ? "on" : "off", Transaction::group_commit ? "on" : "off", ro_transactions ? "on" : "off", skip_own_writes ? "on" : "off", Transaction::default_contention.name(), Transaction::fallback_aborts,
+         Transaction::htm_max_items, Transaction::profile_level(), Transaction::profile_timing() ? "on" : "off",
+         Transaction::epoch_interval_min_us, Transaction::epoch_interval_max_us,
+         (unsigned long long) Transaction::rcu_eager_threshold, Transaction::rcu_clean_budget, sample_interval,
+         TPages::policy_name(TPages::policy()));
   printf("\nTests:\n");
   size_t testidx = 0;
   for (size_t ti = 0; ti != sizeof(tests)/sizeof(tests[0]); ++ti)
@@ -1609,7 +2459,7 @@ void time_and_run(double *real_time,
     startAndWait(nthreads, tester);
     unsigned long t2 = read_tsc();
     getrusage(RUSAGE_SELF, ru2);
-    *real_time = ((double)(t2-t1)) / BILLION / PROC_TSC_FREQ;
+    *real_time = ((double)(t2-t1)) / BILLION / tsc_ghz();
     tester->report();
 }
 
@@ -1640,6 +2490,12 @@ int main(int argc, char *argv[]) {
     case opt_profile:
       profile = !clp->negated;
       break;
+    case opt_perf_record:
+      perf_record = !clp->negated;
+      break;
+    case opt_conflicts:
+      Transaction::conflict_sample_period = clp->have_val ? clp->val.u : 1;
+      break;
     case opt_dump:
       dump_trace = !clp->negated;
       break;
@@ -1673,6 +2529,124 @@ int main(int argc, char *argv[]) {
     case opt_skew:
         zipf_skew = clp->val.d;
         break;
+    case opt_dtid:
+        Transaction::decentralized_tids = !clp->negated;
+        break;
+    case opt_opacity_extensions:
+        Transaction::opacity_extensions = clp->val.u;
+        break;
+    case opt_validate_interval:
+        Transaction::validate_interval = clp->val.u;
+        break;
+    case opt_prefetch_validation:
+        Transaction::prefetch_validation = !clp->negated;
+        break;
+    case opt_group_commit:
+        Transaction::group_commit = !clp->negated;
+        break;
+    case opt_read_only_txns:
+        ro_transactions = !clp->negated;
+        break;
+    case opt_isolation:
+        if (strcmp(clp->val.s, "serializable") == 0)
+            isolation_kind = TransactionLoopGuard::normal;
+        else if (strcmp(clp->val.s, "si") == 0)
+            isolation_kind = TransactionLoopGuard::snapshot_isolation;
+        else if (strcmp(clp->val.s, "rc") == 0)
+            isolation_kind = TransactionLoopGuard::read_committed;
+        else {
+            fprintf(stderr, "--isolation: expected serializable, si or rc, not %s\n", clp->val.s);
+            exit(1);
+        }
+        break;
+    case opt_skip_own_writes:
+        skip_own_writes = !clp->negated;
+        break;
+    case opt_contention: {
+        std::unique_ptr<TContentionManager> cm(TContentionManager::make(clp->val.s));
+        if (!cm) {
+            fprintf(stderr, "unknown contention policy %s\n", clp->val.s);
+            help(argv[0]);
+        }
+        contention_policy = clp->val.s;
+        break;
+    }
+    case opt_fallback_aborts:
+        Transaction::fallback_aborts = clp->val.u;
+        break;
+    case opt_htm:
+        Transaction::htm_max_items = clp->val.u;
+        break;
+    case opt_counters:
+        Transaction::set_profile_all(clp->val.u, Transaction::profile_timing());
+        break;
+    case opt_timing:
+        Transaction::set_profile_all(Transaction::profile_level(), !clp->negated);
+        break;
+    case opt_epoch_min:
+        Transaction::epoch_interval_min_us = clp->val.u;
+        break;
+    case opt_epoch_max:
+        Transaction::epoch_interval_max_us = clp->val.u;
+        break;
+    case opt_rcu_threshold:
+        Transaction::set_rcu_eager_threshold(clp->val.u);
+        break;
+    case opt_rcu_budget:
+        Transaction::rcu_clean_budget = clp->val.u;
+        break;
+    case opt_log_dir:
+        log_dir = clp->val.s;
+        break;
+    case opt_duration:
+        run_duration = clp->val.d;
+        break;
+    case opt_warmup:
+        warmup_duration = clp->val.d;
+        break;
+    case opt_interval:
+        sample_interval = clp->val.d;
+        break;
+    case opt_timeline:
+        timeline_file = clp->val.s;
+        break;
+    case opt_pin:
+        if (!placement.set_pin(clp->val.s)) {
+            fprintf(stderr, "--pin: expected compact, scatter, none or a CPU list, not %s\n", clp->val.s);
+            exit(1);
+        }
+        break;
+    case opt_numa_interleave:
+        placement.set_numa(ThreadPlacement::numa_interleave);
+        break;
+    case opt_numa_local:
+        placement.set_numa(ThreadPlacement::numa_local);
+        break;
+    case opt_pages: {
+        TPages::policy_type p;
+        if (!TPages::parse_policy(clp->val.s, p)) {
+            fprintf(stderr, "--pages: expected normal, thp, 2m or 1g, not %s\n", clp->val.s);
+            exit(1);
+        }
+        TPages::set_policy(p);
+        break;
+    }
+    case opt_local_txn_memory:
+        TPages::set_local(!clp->negated);
+        break;
+    case opt_rate:
+        arrival_rate = clp->val.d;
+        break;
+    case opt_arrivals:
+        if (strcmp(clp->val.s, "poisson") == 0)
+            poisson_arrivals = true;
+        else if (strcmp(clp->val.s, "constant") == 0)
+            poisson_arrivals = false;
+        else {
+            fprintf(stderr, "--arrivals: expected poisson or constant, not %s\n", clp->val.s);
+            exit(1);
+        }
+        break;
     default:
       help(argv[0]);
     }
@@ -1680,6 +2654,23 @@ int main(int argc, char *argv[]) {
 
   if (opspertrans_ro == -1)
     opspertrans_ro = opspertrans;
+  if (sample_interval <= 0 || run_duration < 0 || warmup_duration < 0
+      || (warmup_duration > 0 && run_duration <= 0)) {
+    fprintf(stderr, "--interval must be positive, and --warmup needs --duration\n");
+    exit(1);
+  }
+  if (arrival_rate < 0) {
+    fprintf(stderr, "--rate must be positive\n");
+    exit(1);
+  }
+  if (runCheck && run_duration > 0) {
+    fprintf(stderr, "--check needs a fixed number of transactions, not --duration\n");
+    exit(1);
+  }
+  if (!placement.apply_numa()) {
+    fprintf(stderr, "--numa-%s: no NUMA support\n", ThreadPlacement::numa_name(placement.numa()));
+    exit(1);
+  }
 
   Clp_DeleteParser(clp);
 
@@ -1691,10 +2682,8 @@ int main(int argc, char *argv[]) {
         initial_seeds[i] = random();
 
 #if DATA_STRUCTURE == USE_QUEUE
-    QueueType stack_q;
-    QueueType stack_q2;
-    q = &stack_q;
-    q2 = &stack_q2;
+    q = new QueueType;
+    q2 = new QueueType;
 
     empty_func();
     prepopulate_func();
@@ -1730,41 +2719,103 @@ int main(int argc, char *argv[]) {
     printf("Asked for %d threads but MAX_THREADS is %d\n", nthreads, MAX_THREADS);
     exit(1);
   }
+  if (unsigned(nthreads) > Transaction::max_threads())
+    Transaction::set_max_threads(nthreads);
 
   if (!strcmp(tests[test].name, "zipfrw") && (zipf_skew < 0.0 || zipf_skew >= 1000.0)) {
     printf("Please enter a skew parameter between 0 and 1000 (currently entered %f)\n", zipf_skew);
     exit(1);
   }
 
-  if (profile) {
+  if (perf_record) {
     printf("INFO: System profiler will be spawned after initialization.\n");
   }
 
+  if (log_dir && !TLog::open(log_dir)) {
+    perror(log_dir);
+    exit(1);
+  }
+
   Tester* tester = tests[test].tester;
   tester->initialize();
+  tsc_ghz(); // calibrate before timing anything
+  if (profile)
+    Transaction::set_profile_hw(true);
 
   double real_time;
   struct rusage ru1,ru2;
-  if (profile) {
+  if (perf_record) {
     Profiler::profile([&]() {
         time_and_run(&real_time, &ru1, &ru2, nthreads, tester);
     });
   } else {
     time_and_run(&real_time, &ru1, &ru2, nthreads, tester);
   }
+  size_t dsi = 0;
+  while (ds_names[dsi].ds != ds)
+      ++dsi;
+  if (run_duration > 0)
+    // the measured run, without the warmup or threads finishing up
+    real_time = measured_end.t - measured_start.t;
 #if !DATA_COLLECT
   printf("real time: ");
 #endif
   print_time(real_time);
+  if (sampling()) {
+    uint64_t commits = measured_end.commits() - measured_start.commits();
+    printf("commits: %llu, aborts: %llu, throughput: %.0f txn/s\n",
+           (unsigned long long) commits,
+           (unsigned long long) (measured_end.aborts() - measured_start.aborts()),
+           commits / real_time);
+  }
+  if (timeline_file && !write_timeline(timeline_file, tests[test].name, ds_names[dsi].name, nthreads))
+    perror(timeline_file);
+  if (log_dir) {
+    if (!TLog::close())
+      perror(log_dir);
+    printf("durable epoch: %llu\n", (unsigned long long) TLog::durable_epoch());
+  }
+  if (Transaction::profile_timing()) {
+    log_histogram txn = Transaction::latency_combined(tc_transaction);
+    log_histogram commit = Transaction::latency_combined(tc_commit);
+    double us = tsc_ghz() * 1000;
+    printf("latency (us): transaction p50 %.3f p99 %.3f p999 %.3f, commit p50 %.3f p99 %.3f p999 %.3f\n",
+           txn.quantile(0.5) / us, txn.quantile(0.99) / us, txn.quantile(0.999) / us,
+           commit.quantile(0.5) / us, commit.quantile(0.99) / us, commit.quantile(0.999) / us);
+  }
+  if (profile) {
+    print_hw_profile(sampling() ? measured_end.hw.since(measured_start.hw)
+                     : Transaction::hw_counters_combined());
+    footprint f = tester->memory_footprint();
+    if (f.total())
+      f.print(stdout, ds_names[dsi].name);
+    Transaction::memory_footprint_combined().print(stdout, "sto");
+  }
+  if (Transaction::conflict_sample_period)
+    for (auto& e : Transaction::top_conflicts(10))
+      printf("conflicts: %p key %#llx: %llu (%llu lock failures), error %llu\n",
+             (const void*) e.owner, (unsigned long long) reinterpret_cast<uintptr_t>(e.key),
+             (unsigned long long) e.count, (unsigned long long) e.locks, (unsigned long long) e.error);
+  if (open_loop()) {
+    log_histogram response, service;
+    for (int i = 0; i < nthreads; ++i) {
+      response.merge(open_loop_state[i].response);
+      service.merge(open_loop_state[i].service);
+    }
+    double us = tsc_ghz() * 1000;
+    printf("open loop %s: offered %.0f txn/s (%s), achieved %.0f txn/s\n",
+           ds_names[dsi].name, arrival_rate, poisson_arrivals ? "poisson" : "constant",
+           response.count() / real_time);
+    printf("latency (us): response p50 %.3f p99 %.3f p999 %.3f, service p50 %.3f p99 %.3f p999 %.3f\n",
+           response.quantile(0.5) / us, response.quantile(0.99) / us, response.quantile(0.999) / us,
+           service.quantile(0.5) / us, service.quantile(0.99) / us, service.quantile(0.999) / us);
+  }
 #if !DATA_COLLECT
   printf("utime: ");
   print_time(ru1.ru_utime, ru2.ru_utime);
   printf("stime: ");
   print_time(ru1.ru_stime, ru2.ru_stime);
 
-  size_t dsi = 0;
-  while (ds_names[dsi].ds != ds)
-      ++dsi;
   printf("Ran test %s %s\n", tests[test].name, ds_names[dsi].name);
   printf("  ARRAY_SZ: %d, readmywrites: %d, result check: %d, %d threads, %d transactions, %d ops per transaction, %f%% writes, prepopulate: %d, blindrandwrites: %d\n \
  MAINTAIN_TRUE_ARRAY_STATE: %d, INIT_SET_SIZE: %d, GLOBAL_SEED: %d, STO_PROFILE_COUNTERS: %d\n",
@@ -1772,12 +2823,28 @@ int main(int argc, char *argv[]) {
          MAINTAIN_TRUE_ARRAY_STATE, Transaction::tset_initial_capacity, seed, STO_PROFILE_COUNTERS);
   if (!strcmp(tests[test].name, "zipfrw"))
     printf("  Zipf distribution parameter(s): zipf_skew = %f, read-only txn prob. = %f, write prob. = %f\n", zipf_skew, readonly_percent, write_percent);
-  printf("  STO_SORT_WRITESET: %d\n", STO_SORT_WRITESET);
+  printf("  STO_SORT_WRITESET: %d, commit TIDs: %s, opacity extensions: %d, validate interval: %u, prefetch validation: %d, group commit: %d, read-only txns: %d, skip own writes: %d, contention: %s, fallback aborts: %u, HTM items: %u\n\
+  epoch interval: %u-%uus, RCU eager threshold: %llu\n", STO_SORT_WRITESET,
+         Transaction::decentralized_tids ? "decentralized" : "global", int(Transaction::opacity_extensions), Transaction::validate_interval, Transaction::prefetch_validation, Transaction::group_commit, ro_transactions, skip_own_writes,
+         contention_policy ? contention_policy : Transaction::default_contention.name(), Transaction::fallback_aborts,
+         Transaction::htm_max_items, Transaction::epoch_interval_min_us, Transaction::epoch_interval_max_us,
+         (unsigned long long) Transaction::rcu_eager_threshold);
+  if (placement.pinning() || placement.numa() != ThreadPlacement::numa_default) {
+    printf("  ");
+    placement.print(stdout);
+  }
+  printf("  isolation: %s\n", isolation_kind == TransactionLoopGuard::snapshot_isolation ? "si"
+         : isolation_kind == TransactionLoopGuard::read_committed ? "rc" : "serializable");
+  printf("  pages: %s, local transaction memory: %s",
+         TPages::policy_name(TPages::policy()), TPages::local() ? "on" : "off");
+  if (TPages::nfallbacks())
+    printf(", %lu hugetlbfs allocations fell back to thp", TPages::nfallbacks());
+  printf("\n");
 #endif
 
-#if STO_PROFILE_COUNTERS
-  Transaction::print_stats();
-  if (txp_count >= txp_total_aborts) {
+  if (Transaction::profile_level() || Transaction::profile_timing())
+    Transaction::print_stats();
+  if (Transaction::profile_level()) {
       txp_counters tc = Transaction::txp_counters_combined();
       const char* sep = "";
       if (txp_count > txp_total_w) {
@@ -1795,7 +2862,6 @@ int main(int argc, char *argv[]) {
       if (*sep)
           printf("\n");
   }
-#endif
 
   if (runCheck) {
     if (tester->check())
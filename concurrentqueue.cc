@@ -386,6 +386,8 @@ int main(int argc, char *argv[]) {
     printf("Asked for %d threads but MAX_THREADS is %d\n", nthreads, MAX_THREADS);
     exit(1);
   }
+  if (unsigned(nthreads) > Transaction::max_threads())
+    Transaction::set_max_threads(nthreads);
 
   struct timeval tv1,tv2;
   struct rusage ru1,ru2;
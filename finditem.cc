@@ -0,0 +1,137 @@
+// Microbenchmark for transaction item lookup.
+//
+// First compares the per-item scalar scan that Transaction::find_item used
+// to fall back on with the vectorized fingerprint scan, over 64, 512 and
+// 4096 items. Then times Sto::check_item on real transactions of those
+// sizes, which also exercises the item hashtable and the large-transaction
+// index.
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "Transaction.hh"
+#include "clp.h"
+#include "randgen.hh"
+
+class Dummy : public TObject {
+public:
+    bool lock(TransItem&, Transaction&) override { return true; }
+    bool check(TransItem&, Transaction&) override { return true; }
+    void install(TransItem&, Transaction&) override {}
+    void unlock(TransItem&) override {}
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+static double ns_since(clock_type::time_point start, unsigned n) {
+    auto d = clock_type::now() - start;
+    return std::chrono::duration<double, std::nano>(d).count() / n;
+}
+
+// same mixing as Transaction::index_hash
+static uint32_t fingerprint(const TObject* obj, void* key) {
+    uint64_t n = reinterpret_cast<uintptr_t>(key) ^ (reinterpret_cast<uintptr_t>(obj) << 12);
+    n *= 0x9E3779B97F4A7C15ULL;
+    return n >> 32;
+}
+
+static void* key_for(unsigned i) {
+    return reinterpret_cast<void*>(uintptr_t(i) * 8 + 8);
+}
+
+static void bench_scan(unsigned nitems, unsigned nlookups, Rand& r) {
+    Dummy d0, d1;
+    std::vector<TransItem> items;
+    std::vector<uint32_t> fps(iceil(nitems, sto_fingerprint::block_size), 0);
+    for (unsigned i = 0; i != nitems; ++i) {
+        TObject* owner = (i & 1 ? &d1 : &d0);
+        items.emplace_back(owner, key_for(i));
+        fps[i] = fingerprint(owner, key_for(i));
+    }
+    // half the lookups hit, half miss
+    std::vector<unsigned> probes;
+    for (unsigned i = 0; i != nlookups; ++i)
+        probes.push_back(r() % (2 * nitems));
+
+    unsigned found = 0;
+    auto start = clock_type::now();
+    for (unsigned p : probes) {
+        TObject* owner = (p & 1 ? &d1 : &d0);
+        void* key = key_for(p);
+        for (auto& it : items)
+            if (it.owner() == owner && it.key<void*>() == key) {
+                ++found;
+                break;
+            }
+    }
+    double scalar_ns = ns_since(start, nlookups);
+
+    unsigned found2 = 0;
+    start = clock_type::now();
+    for (unsigned p : probes) {
+        TObject* owner = (p & 1 ? &d1 : &d0);
+        void* key = key_for(p);
+        unsigned i = sto_fingerprint::find(fps.data(), nitems, fingerprint(owner, key), [&] (unsigned i) {
+                return items[i].owner() == owner && items[i].key<void*>() == key;
+            });
+        found2 += i != nitems;
+    }
+    double simd_ns = ns_since(start, nlookups);
+
+    always_assert(found == found2);
+    printf("scan  %5u items: scalar %9.1f ns, %s %9.1f ns, speedup %.2fx\n",
+           nitems, scalar_ns, sto_fingerprint::implementation(), simd_ns,
+           scalar_ns / simd_ns);
+}
+
+static void bench_transaction(unsigned nitems, unsigned nlookups, Rand& r) {
+    Dummy d;
+    unsigned found = 0;
+    double ns;
+    TRANSACTION {
+        for (unsigned i = 0; i != nitems; ++i)
+            Sto::item(&d, key_for(i)).add_write(i);
+        auto start = clock_type::now();
+        for (unsigned i = 0; i != nlookups; ++i)
+            if (Sto::check_item(&d, key_for(r() % (2 * nitems))))
+                ++found;
+        ns = ns_since(start, nlookups);
+    } RETRY(false);
+    printf("txn   %5u items: check_item %9.1f ns (%u/%u found)\n",
+           nitems, ns, found, nlookups);
+}
+
+static const Clp_Option options[] = {
+    { "nlookups", 'n', 'n', Clp_ValInt, 0 },
+    { "seed", 's', 's', Clp_ValUnsigned, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    unsigned nlookups = 200000;
+    unsigned seed = 1;
+
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case 'n':
+            nlookups = clp->val.i;
+            break;
+        case 's':
+            seed = clp->val.u;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n NLOOKUPS] [-s SEED]\n", argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    TThread::set_id(0);
+    Rand r(seed, seed * 7 + 1);
+    for (unsigned n : {64, 512, 4096})
+        bench_scan(n, nlookups, r);
+    for (unsigned n : {64, 512, 4096})
+        bench_transaction(n, nlookups, r);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "compiler.hh"
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Vectorized matching of 32-bit fingerprints. Transaction keeps one
+// fingerprint per item so it can find candidate items SIMD-wide instead of
+// comparing TransItems one at a time.
+
+namespace sto_fingerprint {
+static constexpr unsigned block_size = 16;
+
+// Returns a mask with bit i set iff fp[i] == needle, for i in [0, 16).
+// Reads exactly 16 fingerprints.
+inline unsigned match_block_scalar(const uint32_t* fp, uint32_t needle) {
+    unsigned m = 0;
+    for (unsigned i = 0; i != block_size; ++i)
+        m |= unsigned(fp[i] == needle) << i;
+    return m;
+}
+
+inline unsigned match_block(const uint32_t* fp, uint32_t needle) {
+#if defined(__AVX512F__)
+    __m512i n = _mm512_set1_epi32(needle);
+    return _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(fp), n);
+#elif defined(__AVX2__)
+    __m256i n = _mm256_set1_epi32(needle);
+    __m256i a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) fp), n);
+    __m256i b = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) (fp + 8)), n);
+    return unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(a)))
+        | (unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(b))) << 8);
+#elif defined(__SSE2__)
+    __m128i n = _mm_set1_epi32(needle);
+    unsigned m = 0;
+    for (unsigned i = 0; i != block_size; i += 4) {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (fp + i)), n);
+        m |= unsigned(_mm_movemask_ps(_mm_castsi128_ps(a))) << i;
+    }
+    return m;
+#else
+    return match_block_scalar(fp, needle);
+#endif
+}
+
+inline const char* implementation() {
+#if defined(__AVX512F__)
+    return "avx512";
+#elif defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// Calls f(i) for each i in [0, n) with fp[i] == needle, in increasing
+// order, until f returns true. Returns the index for which f returned
+// true, or n. fp must be readable up to a multiple of block_size.
+template <typename F>
+inline unsigned find(const uint32_t* fp, unsigned n, uint32_t needle, F f) {
+    for (unsigned base = 0; base < n; base += block_size) {
+        unsigned m = match_block(fp + base, needle);
+        if (n - base < block_size)
+            m &= (1U << (n - base)) - 1;
+        while (m) {
+            unsigned i = base + ctz(m);
+            if (f(i))
+                return i;
+            m &= m - 1;
+        }
+    }
+    return n;
+}
+}
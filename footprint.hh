@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+// Memory used by a container or by STO itself, in bytes, by category:
+// - data: keys and values as stored (not memory they own elsewhere)
+// - versions: version words, per element and per bucket
+// - index: the rest of the structure: chain and tree nodes, bucket and
+//   directory arrays, padding, unused capacity
+// - rcu_pending: memory waiting in RCU to be freed, with the bookkeeping
+//   that keeps track of it
+// Sizes are of the objects themselves, without allocator overhead.
+// Reports walk live structures without locking, so take them while the
+// structure is quiet.
+struct footprint {
+    size_t data;
+    size_t versions;
+    size_t index;
+    size_t rcu_pending;
+
+    footprint()
+        : data(0), versions(0), index(0), rcu_pending(0) {
+    }
+
+    size_t total() const {
+        return data + versions + index + rcu_pending;
+    }
+    footprint& operator+=(const footprint& x) {
+        data += x.data;
+        versions += x.versions;
+        index += x.index;
+        rcu_pending += x.rcu_pending;
+        return *this;
+    }
+
+    void print(FILE* f, const char* name) const {
+        fprintf(f, "memory %s: %zu bytes (%.1f MiB): data %zu, versions %zu, index %zu, rcu pending %zu\n",
+                name, total(), total() / 1048576.0, data, versions, index, rcu_pending);
+    }
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <string.h>
+
+// Log-linear histogram of unsigned samples, such as latencies in TSC
+// ticks. Values below 2^sub_bits have their own buckets; each larger
+// power-of-two range is split into 2^sub_bits buckets, so a bucket's
+// width is at most 1/2^sub_bits of its values. Histograms with the same
+// parameters merge by adding buckets.
+
+class log_histogram {
+public:
+    static constexpr unsigned sub_bits = 3;
+    // values of 2^max_bits and up share the last bucket
+    static constexpr unsigned max_bits = 48;
+    static constexpr unsigned nbuckets = (max_bits - sub_bits + 1) << sub_bits;
+
+    log_histogram() {
+        reset();
+    }
+
+    static unsigned bucket(uint64_t v) {
+        if (v < (uint64_t(1) << sub_bits))
+            return v;
+        unsigned e = 63 - clz((unsigned long long) v);
+        if (e >= max_bits)
+            return nbuckets - 1;
+        return ((e - sub_bits + 1) << sub_bits)
+            + ((v >> (e - sub_bits)) & ((1U << sub_bits) - 1));
+    }
+    // smallest value in bucket b
+    static uint64_t bucket_low(unsigned b) {
+        if (b < (1U << sub_bits))
+            return b;
+        unsigned e = (b >> sub_bits) + sub_bits - 1;
+        return (uint64_t(1) << e) | (uint64_t(b & ((1U << sub_bits) - 1)) << (e - sub_bits));
+    }
+    // one more than the largest value in bucket b
+    static uint64_t bucket_high(unsigned b) {
+        return b + 1 == nbuckets ? ~uint64_t(0) : bucket_low(b + 1);
+    }
+
+    void add(uint64_t v) {
+        ++n_[bucket(v)];
+    }
+    void merge(const log_histogram& x) {
+        for (unsigned b = 0; b != nbuckets; ++b)
+            n_[b] += x.n_[b];
+    }
+    // remove x's samples, which must all have been added to this
+    void subtract(const log_histogram& x) {
+        for (unsigned b = 0; b != nbuckets; ++b)
+            n_[b] -= x.n_[b];
+    }
+    void reset() {
+        memset(n_, 0, sizeof(n_));
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (unsigned b = 0; b != nbuckets; ++b)
+            n += n_[b];
+        return n;
+    }
+    uint64_t count(unsigned b) const {
+        return n_[b];
+    }
+
+    // Returns an estimate of the q-quantile (0 <= q <= 1): the midpoint
+    // of the bucket holding it. Returns 0 if the histogram is empty.
+    double quantile(double q) const {
+        uint64_t total = count();
+        if (!total)
+            return 0;
+        uint64_t rank = uint64_t(q * total);
+        if (rank >= total)
+            rank = total - 1;
+        for (unsigned b = 0; ; ++b)
+            if (rank < n_[b]) {
+                if (b + 1 == nbuckets)
+                    return bucket_low(b);
+                return (bucket_low(b) + bucket_high(b) - 1) / 2.0;
+            } else
+                rank -= n_[b];
+    }
+
+private:
+    uint64_t n_[nbuckets];
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+
+// Minimal hardware transactional memory interface for Transaction's HTM
+// commit path: Intel RTM, or Arm TME when compiled for it. HTM_SUPPORTED
+// is 0 where neither is available; htm_available() also checks the CPU.
+// Functions that call htm_begin() and friends must be declared HTM_TARGET.
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(STO_NO_HTM)
+#include <immintrin.h>
+#include <cpuid.h>
+#define HTM_SUPPORTED 1
+#define HTM_TARGET __attribute__((target("rtm")))
+typedef unsigned htm_status;
+#define HTM_STARTED _XBEGIN_STARTED
+#define htm_begin() _xbegin()
+#define htm_end() _xend()
+#define htm_abort(code) _xabort(code)
+inline bool htm_may_retry(htm_status s) {
+    return s & _XABORT_RETRY;
+}
+inline bool htm_capacity_abort(htm_status s) {
+    return s & _XABORT_CAPACITY;
+}
+inline bool htm_explicit_abort(htm_status s) {
+    return s & _XABORT_EXPLICIT;
+}
+inline bool htm_available() {
+    static const bool available = [] {
+        unsigned a, b, c, d;
+        return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_RTM);
+    }();
+    return available;
+}
+
+#elif defined(__ARM_FEATURE_TME) && !defined(STO_NO_HTM)
+#include <arm_acle.h>
+#define HTM_SUPPORTED 1
+#define HTM_TARGET
+typedef uint64_t htm_status;
+#define HTM_STARTED 0
+#define htm_begin() __tstart()
+#define htm_end() __tcommit()
+#define htm_abort(code) __tcancel(code)
+inline bool htm_may_retry(htm_status s) {
+    return s & _TMFAILURE_RTRY;
+}
+inline bool htm_capacity_abort(htm_status s) {
+    return s & _TMFAILURE_SIZE;
+}
+inline bool htm_explicit_abort(htm_status s) {
+    return s & _TMFAILURE_CNCL;
+}
+inline bool htm_available() {
+    return true;
+}
+
+#else
+#define HTM_SUPPORTED 0
+#define HTM_TARGET
+inline bool htm_available() {
+    return false;
+}
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+#include "compiler.hh"
+#include "TLog.hh"
+#include "print_value.hh"
+#include <string.h>
+#include <functional>
+#include <ostream>
+#include <string>
+
+// A string of at most N bytes, stored inline. Unlike std::string and
+// simple_str it is trivially copyable, so Hashtable elements and write
+// buffers hold it by value: reads copy it out under the version check and
+// installs copy it into place, with no allocation. Use it for keys and
+// values known to be short, e.g. Hashtable<inline_str<>, inline_str<>>.
+template <unsigned N = 23>
+class inline_str {
+public:
+    static_assert(N < 256, "inline_str length must fit in a byte");
+    static constexpr unsigned capacity = N;
+
+    inline_str()
+        : len_(0) {
+    }
+    inline_str(const char* s, size_t len) {
+        assign(s, len);
+    }
+    inline_str(const char* s) {
+        assign(s, strlen(s));
+    }
+    inline_str(const std::string& s) {
+        assign(s.data(), s.length());
+    }
+
+    static bool fits(size_t len) {
+        return len <= N;
+    }
+    void assign(const char* s, size_t len) {
+        always_assert(fits(len));
+        len_ = len;
+        memcpy(buf_, s, len);
+    }
+
+    const char* data() const {
+        return buf_;
+    }
+    size_t length() const {
+        return len_;
+    }
+    std::string str() const {
+        return std::string(buf_, len_);
+    }
+    operator std::string() const {
+        return str();
+    }
+
+    bool operator==(const inline_str<N>& x) const {
+        return len_ == x.len_ && memcmp(buf_, x.buf_, len_) == 0;
+    }
+    bool operator!=(const inline_str<N>& x) const {
+        return !(*this == x);
+    }
+    bool operator<(const inline_str<N>& x) const {
+        int c = memcmp(buf_, x.buf_, std::min(len_, x.len_));
+        return c < 0 || (c == 0 && len_ < x.len_);
+    }
+
+    // FNV-1a
+    size_t hash() const {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned i = 0; i != len_; ++i)
+            h = (h ^ (unsigned char) buf_[i]) * 1099511628211ULL;
+        return h;
+    }
+
+private:
+    uint8_t len_;
+    char buf_[N];
+};
+
+template <unsigned N>
+inline std::ostream& operator<<(std::ostream& w, const inline_str<N>& s) {
+    return w.write(s.data(), s.length());
+}
+
+namespace std {
+template <unsigned N> struct hash<inline_str<N> > {
+    size_t operator()(const inline_str<N>& s) const {
+        return s.hash();
+    }
+};
+}
+
+namespace mass {
+template <unsigned N> class is_printable<inline_str<N> > : public true_type {};
+}
+
+// logs just the string's bytes
+template <unsigned N>
+struct TLogCodec<inline_str<N>, true> {
+    static constexpr bool supported = true;
+    static size_t size(const inline_str<N>& x) {
+        return x.length();
+    }
+    static void encode(char* p, const inline_str<N>& x) {
+        memcpy(p, x.data(), x.length());
+    }
+    static inline_str<N> decode(const char* p, size_t len) {
+        return inline_str<N>(p, len);
+    }
+};
@@ -0,0 +1,173 @@
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <random>
+#include <thread>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "List.hh"
+#include "SkipList.hh"
+#include "clp.h"
+#include "randgen.hh"
+
+// Head-to-head: the same random find/insert/delete workload against the
+// sorted List and the SkipList.
+
+int nthreads = 4;
+int ntrans = 100000;
+int opspertrans = 4;
+int prepopulate = 1000;
+int keyspace = 2000;
+double find_percent = 0.8;
+int global_seed = 0;
+unsigned initial_seeds[128];
+
+template <typename T>
+void run(T* l, int me) {
+    TThread::set_id(me);
+    std::uniform_int_distribution<long> keydist(0, keyspace - 1);
+    std::uniform_int_distribution<long> opdist(0, 99);
+    Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+    int N = ntrans / nthreads;
+
+    for (int i = 0; i < N; ++i) {
+        // so that retries of this transaction do the same thing
+        Rand transgen_snap = transgen;
+        TRANSACTION {
+            transgen = transgen_snap;
+            for (int j = 0; j < opspertrans; ++j) {
+                int key = keydist(transgen);
+                int op = opdist(transgen);
+                if (op < find_percent * 100)
+                    l->transFind(key);
+                else if (op & 1)
+                    l->transInsert(key);
+                else
+                    l->transDelete(key);
+            }
+        } RETRY(true);
+    }
+}
+
+template <typename T>
+void run_and_report(const char* name) {
+    T l;
+    std::uniform_int_distribution<long> keydist(0, keyspace - 1);
+    Rand transgen(initial_seeds[0], initial_seeds[1]);
+    for (int i = 0; i < prepopulate; ++i)
+        l.insert(keydist(transgen));
+
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; ++i)
+        threads.emplace_back(run<T>, &l, i);
+    for (auto& t : threads)
+        t.join();
+    gettimeofday(&tv2, NULL);
+
+    double time = tv2.tv_sec - tv1.tv_sec + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+    printf("%s: %f s, %llu txn/s\n", name, time, (unsigned long long) (ntrans / time));
+#if STO_PROFILE_COUNTERS
+    Transaction::print_stats();
+    {
+        txp_counters tc = Transaction::txp_counters_combined();
+        printf("total_n: %llu, total_r: %llu, total_w: %llu, total_searched: %llu, total_aborts: %llu (%llu aborts at commit time)\n", tc.p(txp_total_n), tc.p(txp_total_r), tc.p(txp_total_w), tc.p(txp_total_searched), tc.p(txp_total_aborts), tc.p(txp_commit_time_aborts));
+    }
+    Transaction::clear_stats();
+#endif
+}
+
+enum {
+    opt_nthreads = 1, opt_ntrans, opt_opspertrans, opt_prepopulate, opt_keyspace, opt_findpercent, opt_seed
+};
+
+static const Clp_Option options[] = {
+    { "nthreads", 0, opt_nthreads, Clp_ValInt, Clp_Optional },
+    { "ntrans", 0, opt_ntrans, Clp_ValInt, Clp_Optional },
+    { "opspertrans", 0, opt_opspertrans, Clp_ValInt, Clp_Optional },
+    { "prepopulate", 0, opt_prepopulate, Clp_ValInt, Clp_Optional },
+    { "keyspace", 0, opt_keyspace, Clp_ValInt, Clp_Optional },
+    { "findpercent", 0, opt_findpercent, Clp_ValDouble, Clp_Optional },
+    { "seed", 0, opt_seed, Clp_ValInt, Clp_Optional }
+};
+
+static void help() {
+    printf("Usage: [OPTIONS] [list|skiplist]...\n\
+           Options:\n\
+           --nthreads=NTHREADS (default %d)\n\
+           --ntrans=NTRANS, how many total transactions to run (they'll be split between threads) (default %d)\n\
+           --opspertrans=OPSPERTRANS, how many operations to run per transaction (default %d)\n\
+           --prepopulate=PREPOPULATE, prepopulate the list with given number of elements (default %d)\n\
+           --keyspace=KEYSPACE, elements are drawn from [0, KEYSPACE) (default %d)\n\
+           --findpercent=FINDPERCENT, probability with which to do finds (default %f)\n\
+           --seed=SEED, global seed to run the experiment \n",
+           nthreads, ntrans, opspertrans, prepopulate, keyspace, find_percent);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    std::vector<const char*> tests;
+
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+            case opt_nthreads:
+                nthreads = clp->val.i;
+                break;
+            case opt_ntrans:
+                ntrans = clp->val.i;
+                break;
+            case opt_opspertrans:
+                opspertrans = clp->val.i;
+                break;
+            case opt_prepopulate:
+                prepopulate = clp->val.i;
+                break;
+            case opt_keyspace:
+                keyspace = clp->val.i;
+                break;
+            case opt_findpercent:
+                find_percent = clp->val.d;
+                break;
+            case opt_seed:
+                global_seed = clp->val.i;
+                break;
+            case Clp_NotOption:
+                tests.push_back(clp->vstr);
+                break;
+            default:
+                help();
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    if (tests.empty()) {
+        tests.push_back("list");
+        tests.push_back("skiplist");
+    }
+
+    if (global_seed)
+        srandom(global_seed);
+    else
+        srandomdev();
+    for (unsigned i = 0; i < arraysize(initial_seeds); ++i)
+        initial_seeds[i] = random();
+
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+
+    for (auto test : tests) {
+        if (strcmp(test, "list") == 0)
+            run_and_report<List<int>>("list");
+        else if (strcmp(test, "skiplist") == 0 || strcmp(test, "skip") == 0)
+            run_and_report<SkipList<int>>("skiplist");
+        else
+            help();
+    }
+
+    return 0;
+}
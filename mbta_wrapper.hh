@@ -2,6 +2,9 @@
 
 #include "Transaction.hh"
 #include "MassTrans.hh"
+#include "placement.hh"
+#include <atomic>
+#include <vector>
 
 #define STD_OP(f) auto& t = *unpack<Transaction*>(txn); \
   try { \
@@ -26,16 +29,26 @@ class mbta_wrapper : public abstract_db {
     //txn_epoch_sync<Transaction>::finish();
   }
 
+  // Pins loader and worker threads, each in order of their first call,
+  // as set by STO_PIN and STO_NUMA (see ThreadPlacement::from_env). Each
+  // thread gets its own STO thread id, and its transaction object is
+  // made here and reused by every new_txn.
   void
   thread_init(bool loader)
   {
-
+    static std::atomic<int> nloaders, nworkers, nthreads;
+    ThreadPlacement::from_env().pin_thread((loader ? nloaders : nworkers)++);
+    TThread::set_id(nthreads++ % MAX_THREADS);
+    Sto::update_threadid();
+    (void) Sto::transaction();
   }
 
   void
   thread_end()
   {
-
+    Sto::silent_abort();
+    delete TThread::txn;
+    TThread::txn = nullptr;
   }
 
   size_t
@@ -44,22 +57,31 @@ class mbta_wrapper : public abstract_db {
     return sizeof(Transaction);
   }
 
+  // MassTrans operates on the thread's current transaction, so that is
+  // the one we hand out, restarted; buf is unused. Read-only
+  // transactions read through Sto::read_item and never look items up,
+  // so they skip indexing their items.
   void *new_txn(
                 uint64_t txn_flags,
                 str_arena &arena,
                 void *buf,
                 TxnProfileHint hint = HINT_DEFAULT) {
-    Transaction *txn = new (buf) Transaction;
-    return txn;
+    Sto::start_transaction();
+    if ((txn_flags & TXN_FLAG_READ_ONLY)
+        || hint == HINT_TPCC_ORDER_STATUS_READ_ONLY
+        || hint == HINT_TPCC_STOCK_LEVEL_READ_ONLY)
+      Sto::defer_index();
+    return Sto::transaction();
   }
 
   bool commit_txn(void *txn) {
-    STD_OP(return t.commit());
+    STD_OP(return t.try_commit());
     return false;
   }
 
   void abort_txn(void *txn) {
-    STD_OP(t.abort());
+    (void) txn;
+    Sto::silent_abort();
   }
 
   abstract_ordered_index *
@@ -82,17 +104,15 @@ class mbta_ordered_index : public abstract_ordered_index {
 public:
   mbta_ordered_index(const std::string &name) : mbta(), name(name) {}
 
+  // value is usually an arena string, whose capacity assign() reuses
   bool get(void *txn, const std::string &key, std::string &value, size_t max_bytes_read) {
-    (void)max_bytes_read;
-#if 0
-    auto& t = *unpack<Transaction*>(txn);
-    try {
-      return mbta.transGet(t, key, value);
-    } catch (Transaction::Abort E) {
-      throw abstract_db::abstract_abort_exception();
-    }
-#endif
-    STD_OP(return mbta.transGet(t, key, value));
+    STD_OP({
+        (void) t;
+        bool found = mbta.transGet(key, value);
+        if (found && value.length() > max_bytes_read)
+          value.resize(max_bytes_read);
+        return found;
+      });
   }
 
   const char *put(
@@ -100,51 +120,103 @@ public:
       const std::string &key,
       const std::string &value)
   {
-    // TODO: there's an overload of put that takes non-const std::string and silo seems to use move for those.
-    // may be worth investigating if we can use that optimization to avoid copying keys
     STD_OP({
-        mbta.transPut(t, key, value);
+        (void) t;
+        mbta.transPut(key, value);
         return 0;
           });
   }
-  
+
+  // Silo passes keys and values it is done with; move them into the
+  // write set instead of copying
+  const char *put(
+      void *txn,
+      std::string &&key,
+      std::string &&value)
+  {
+    STD_OP({
+        (void) t;
+        mbta.transPut(std::move(key), std::move(value));
+        return 0;
+          });
+  }
+
   const char *insert(
                                          void *txn,
                                          const std::string &key,
                                          const std::string &value)
   {
-    STD_OP(mbta.transInsert(t, key, value); return 0;)
+    STD_OP((void) t; mbta.transInsert(key, value); return 0;)
+  }
+
+  const char *insert(
+                                         void *txn,
+                                         std::string &&key,
+                                         std::string &&value)
+  {
+    STD_OP((void) t; mbta.transInsert(std::move(key), std::move(value)); return 0;)
   }
 
   void remove(void *txn, const std::string &key) {
-    STD_OP(mbta.remove(t, key));
+    STD_OP((void) t; mbta.transDelete(key));
   }
 
+  // Rows are read into strings from arena, which keep their capacity
+  // across transactions, rather than into a fresh string per row; the
+  // callback gets a reference to that string.
   void scan(
             void *txn,
             const std::string &start_key,
             const std::string *end_key,
             scan_callback &callback,
             str_arena *arena = nullptr) {
-    Str end = end_key ? *end_key : Str();
-    STD_OP(mbta.transQuery(t, start_key, end, [&] (Str key, mbta_type::value_type& value) {
-          return callback.invoke(key.data(), key.length(), value);
-        }));
+    Str end = end_key ? Str(*end_key) : Str();
+    arena_allocator va{arena};
+    auto value_callback = [&] (Str key, mbta_type::value_type& value) {
+      return callback.invoke(key.data(), key.length(), value);
+    };
+    STD_OP({
+        (void) t;
+        if (arena)
+          mbta.transQuery(start_key, end, value_callback, &va);
+        else
+          mbta.transQuery(start_key, end, value_callback);
+      });
   }
 
+  // Descending scan from start_key (inclusive) down to end_key
+  // (exclusive), validated leaf by leaf like transScan.
   void rscan(
              void *txn,
              const std::string &start_key,
              const std::string *end_key,
              scan_callback &callback,
              str_arena *arena = nullptr) {
-#if 0
-    Str end = end_key ? *end_key : Str();
-    STD_OP(mbta.transRQuery(t, start_key, end, [&] (Str key, mbta_type::value_type& value) {
-          return callback.invoke(key.data(), key.length(), value);
-        }));
-#endif
-    throw "rscan unimplemented";
+    rscan(txn, start_key, end_key, callback, arena, 0);
+  }
+
+  // scan and rscan that stop after limit rows (0 means no limit), for
+  // queries such as TPC-C's Order-Status and Stock-Level that want only
+  // the first few rows of a range. Rows past the limit are not read, so
+  // they can't cause aborts.
+  void scan(
+            void *txn,
+            const std::string &start_key,
+            const std::string *end_key,
+            scan_callback &callback,
+            str_arena *arena,
+            size_t limit) {
+    limited_scan<false>(txn, start_key, end_key, callback, arena, limit);
+  }
+
+  void rscan(
+             void *txn,
+             const std::string &start_key,
+             const std::string *end_key,
+             scan_callback &callback,
+             str_arena *arena,
+             size_t limit) {
+    limited_scan<true>(txn, start_key, end_key, callback, arena, limit);
   }
 
   size_t size() const
@@ -152,16 +224,54 @@ public:
     return mbta.approx_size();
   }
 
-  // TODO: unclear if we need to implement, apparently this should clear the tree and possibly return some stats
+  // Removes every key in a transaction of its own, retried until it
+  // commits. Returns the number of keys removed as "keys_removed".
   std::map<std::string, uint64_t>
   clear() {
-    throw "clear unimplemented";
+    std::vector<std::string> keys;
+    TRANSACTION {
+      keys.clear();
+      mbta.transScan(Str(), Str(), [&] (Str key, mbta_type::value_type&) {
+          keys.emplace_back(key.data(), key.length());
+          return true;
+        });
+      for (auto& k : keys)
+        mbta.transDelete(k);
+    } RETRY(true);
+    std::map<std::string, uint64_t> stats;
+    stats["keys_removed"] = keys.size();
+    return stats;
   }
 
 private:
   typedef MassTrans<std::string> mbta_type;
   mbta_type mbta;
 
+  struct arena_allocator {
+    str_arena *arena;
+    std::string *operator()() {
+      return arena->next();
+    }
+  };
+
+  template <bool Reverse>
+  void limited_scan(void *txn, const std::string &start_key,
+                    const std::string *end_key, scan_callback &callback,
+                    str_arena *arena, size_t limit) {
+    Str end = end_key ? Str(*end_key) : Str();
+    arena_allocator va{arena};
+    auto value_callback = [&] (Str key, mbta_type::value_type& value) {
+      return callback.invoke(key.data(), key.length(), value);
+    };
+    STD_OP({
+        (void) t;
+        if (Reverse)
+          mbta.transRScan(start_key, end, value_callback, limit, arena ? &va : nullptr);
+        else
+          mbta.transScan(start_key, end, value_callback, limit, arena ? &va : nullptr);
+      });
+  }
+
   const std::string name;
 
 };
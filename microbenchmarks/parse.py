@@ -1,12 +1,53 @@
 # Parses the json results of running run_benchmark.py for the boosting 
 # microbenchmark. Expects the json filename as an argument.
+#
+# Also takes a concurrent --timeline file (JSON or CSV), and prints each
+# interval's throughput and the spread between threads.
 
 import sys
 import json
 from collections import defaultdict
 
+def parse_timeline_csv(f):
+    intervals = []
+    for line in f.read().splitlines()[1:]:
+        end, thread, commits, aborts = line.split(',')
+        if not intervals or intervals[-1]["end"] != float(end):
+            intervals.append({"end": float(end), "commits": [], "aborts": []})
+        intervals[-1]["commits"].append(int(commits))
+        intervals[-1]["aborts"].append(int(aborts))
+    return {"intervals": intervals}
+
+def summarize_timeline(d):
+    out = []
+    start = 0.0
+    for i in d["intervals"]:
+        length = i["end"] - start
+        start = i["end"]
+        if length <= 0:
+            continue
+        out.append({"end": i["end"],
+                    "throughput": sum(i["commits"]) / length,
+                    "abort_rate": sum(i["aborts"]) / length,
+                    "thread_min": min(i["commits"]) / length,
+                    "thread_max": max(i["commits"]) / length})
+    summary = {"intervals": out}
+    for k in ("test", "ds", "nthreads", "time", "commits", "aborts"):
+        if k in d:
+            summary[k] = d[k]
+    if d.get("time"):
+        summary["throughput"] = d["commits"] / d["time"]
+    return summary
+
 with open(sys.argv[1], 'r') as f:
-    d = json.loads(f.read())
+    if sys.argv[1].endswith(".csv"):
+        d = parse_timeline_csv(f)
+    else:
+        d = json.loads(f.read())
+
+if "intervals" in d:
+    print json.dumps(summarize_timeline(d), indent=2)
+    sys.exit(0)
 
 names = {"2": "sto", "3": "boostingsto", "4": "boostingstandalone"}
 output = defaultdict(lambda: {"results": []})
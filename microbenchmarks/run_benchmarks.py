@@ -57,6 +57,10 @@ def extract_numbers(output):
 
 	results = dict()
 	results["time"] = time
+	# runs with --duration also print commits and throughput
+	m = re.search("(?<=throughput: )[0-9]*", output)
+	if m:
+		results["throughput"] = int(m.group(0))
 #	results["num_txs"] = numtx
 	results["array_size"] = size
 #	results["tx_starts"] = tx_starts
@@ -188,9 +192,81 @@ def exp_opacity_tl2overhead(repetitions, records):
 	
 	save_results("opacity_modes", combined_stdout, records)
 
+def exp_prefetch_validation(repetitions, records):
+	print "@@@@\n@@@ Starting experiment: prefetch-validation:"
+	ntxs = 200000
+	txlen = 1000
+	writepercent = "0.1"
+	combined_stdout = ""
+
+	# writes keep the transactions off the read-only commit fast path,
+	# so every read is validated
+	for prefetch in [1, 0]:
+		for trail in range(0, repetitions):
+			for nthreads in nthreads_to_run_dual:
+				args = attach_args(0, nthreads, txlen, 1, ntxs, writepercent)
+				if prefetch:
+					args.append("--prefetch-validation")
+				print_cmd(args)
+				single_out = subprocess.check_output(args, stderr=subprocess.STDOUT)
+				run_key = getRecordKey(0, trail, ntxs, nthreads, txlen, 1, writepercent) + "/prefetch%d" % prefetch
+				records[run_key] = extract_numbers(single_out)
+				combined_stdout += to_strcmd(args) + "\n" + single_out
+
+	save_results("prefetch_validation", combined_stdout, records)
+
+def exp_opacity_extensions(repetitions, records):
+	print "@@@@\n@@@ Starting experiment: opacity-extensions:"
+	ntxs = 4000000
+	txlen = 50
+	writepercent = "0.5"
+	combined_stdout = ""
+
+	# unlimited extensions (the default) against TL2-style aborts after
+	# 0 or 1 extensions, with global and per-thread commit TIDs
+	for extensions in [-1, 0, 1]:
+		for dtid in [0, 1]:
+			for trail in range(0, repetitions):
+				for nthreads in nthreads_to_run_dual:
+					args = attach_args(0, nthreads, txlen, 1, ntxs, writepercent)
+					if extensions >= 0:
+						args.append("--opacity-extensions=%d" % extensions)
+					if dtid:
+						args.append("--decentralized-tid")
+					print_cmd(args)
+					single_out = subprocess.check_output(args, stderr=subprocess.STDOUT)
+					run_key = getRecordKey(0, trail, ntxs, nthreads, txlen, 1, writepercent) + "/ext%d/dtid%d" % (extensions, dtid)
+					records[run_key] = extract_numbers(single_out)
+					combined_stdout += to_strcmd(args) + "\n" + single_out
+
+	save_results("opacity_extensions", combined_stdout, records)
+
+def exp_ycsb(repetitions, records):
+	print "@@@@\n@@@ Starting experiment: ycsb:"
+	duration = 10
+	combined_stdout = ""
+
+	# YCSB runs one operation per transaction; inserts (D and E) grow
+	# hash, tvector, masstree and tbtree
+	for workload in "abcdef":
+		for ds in ["array", "hash", "tvector", "masstree", "tbtree"]:
+			for trail in range(0, repetitions):
+				for nthreads in nthreads_to_run_full:
+					args = [bm_execs[0], "ycsb-" + workload, ds,
+						"--nthreads=%d" % nthreads, "--opspertrans=1",
+						"--duration=%d" % duration, "--warmup=1"]
+					print_cmd(args)
+					single_out = subprocess.check_output(args, stderr=subprocess.STDOUT)
+					run_key = "ycsb-%s/%s/%d/%d" % (workload, ds, trail, nthreads)
+					records[run_key] = extract_numbers(single_out)
+					combined_stdout += to_strcmd(args) + "\n" + single_out
+
+	save_results("ycsb", combined_stdout, records)
+
 def print_usage(script_name):
-	usage = "Usage: " + script_name + """ num_rep
-  num_rep: Integer number specifying the number of repeated runs for each experiment, 5 is a good choice"""
+	usage = "Usage: " + script_name + """ num_rep [ycsb]
+  num_rep: Integer number specifying the number of repeated runs for each experiment, 5 is a good choice
+  ycsb: run only the YCSB A-F suite over each data structure"""
 	print usage
 
 def main(argc, argv):
@@ -206,6 +282,9 @@ def main(argc, argv):
 #	with open("experiment_data.json", "w+") as data_file:
 #		records = json.load(data_file)
 	records = dict()
+	if argc > 2 and argv[2] == "ycsb":
+		exp_ycsb(repetitions, records)
+		return
 	#exp_boosting_micro(repetitions, records)
 	exp_scalability_overhead(repetitions, records, 0, [10, 50])
 	exp_scalability_overhead(repetitions, records, 1, [10, 50])
@@ -213,6 +292,8 @@ def main(argc, argv):
 	#exp_scalability_largetx(repetitions, records)
 	#exp_opacity_modes(repetitions, records)
 	#exp_opacity_tl2overhead(repetitions, records)
+	#exp_prefetch_validation(repetitions, records)
+	#exp_opacity_extensions(repetitions, records)
 
 if __name__ == "__main__":
 	main(len(sys.argv), sys.argv)
@@ -0,0 +1,314 @@
+#pragma once
+#include "config.h"
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <vector>
+#if HAVE_LIBNUMA && HAVE_NUMA_H
+#include <numa.h>
+#endif
+
+// Where benchmark threads run and where their memory goes.
+//
+// Pinning assigns thread i a CPU from the CPUs the process may use:
+// - compact: fill one NUMA node (and within it, one core's hyperthreads)
+//   before the next.
+// - scatter: round-robin over NUMA nodes, using a hyperthread sibling
+//   only once every core of the node has a thread.
+// - a CPU list such as "0,2,8-15": thread i gets the i-th listed CPU.
+// Thread i wraps around to CPU i % ncpus if there are more threads.
+//
+// The NUMA policy applies to memory allocated after apply_numa():
+// - interleave: pages round-robin over all nodes (needs libnuma).
+// - local: pages on the node of the thread that first touches them.
+//   Use first_touch so each thread's share of the data is on its node.
+class ThreadPlacement {
+public:
+    enum pin_policy { pin_none, pin_compact, pin_scatter, pin_list };
+    enum numa_policy { numa_default, numa_local, numa_interleave };
+
+    ThreadPlacement()
+        : pin_(pin_none), numa_(numa_default) {
+    }
+
+    // Parses "compact", "scatter", "none", or a CPU list. Returns false
+    // (leaving the placement unchanged) on a bad spec.
+    bool set_pin(const char* spec) {
+        std::vector<int> cpus;
+        pin_policy p;
+        if (strcmp(spec, "none") == 0)
+            p = pin_none;
+        else if (strcmp(spec, "compact") == 0)
+            p = pin_compact;
+        else if (strcmp(spec, "scatter") == 0)
+            p = pin_scatter;
+        else if (parse_cpu_list(spec, cpus) && !cpus.empty())
+            p = pin_list;
+        else
+            return false;
+        pin_ = p;
+        if (p == pin_list)
+            cpus_ = cpus;
+        else if (p != pin_none)
+            cpus_ = ordered_cpus(p);
+        else
+            cpus_.clear();
+        return true;
+    }
+    void set_numa(numa_policy p) {
+        numa_ = p;
+    }
+
+    bool pinning() const {
+        return pin_ != pin_none && !cpus_.empty();
+    }
+    pin_policy pin() const {
+        return pin_;
+    }
+    numa_policy numa() const {
+        return numa_;
+    }
+    static const char* numa_name(numa_policy p) {
+        return p == numa_local ? "local" : p == numa_interleave ? "interleave" : "default";
+    }
+
+    // The CPU of thread i, or -1 if unpinned.
+    int cpu(int i) const {
+        return pinning() ? cpus_[i % cpus_.size()] : -1;
+    }
+    // The NUMA node of thread i, or -1 if unpinned.
+    int node(int i) const {
+        return pinning() ? node_of(cpu(i)) : -1;
+    }
+
+    // Sets the calling process's memory policy; threads created later
+    // inherit it. Call before allocating the benchmark's data. Returns
+    // false if the policy isn't available here.
+    bool apply_numa() const {
+        if (numa_ == numa_default)
+            return true;
+#if HAVE_LIBNUMA && HAVE_NUMA_H
+        if (numa_available() < 0)
+            return false;
+        if (numa_ == numa_interleave)
+            numa_set_interleave_mask(numa_all_nodes_ptr);
+        else
+            numa_set_localalloc();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Pins the calling thread as thread i. Returns false if pinning
+    // failed; does nothing if unpinned.
+    bool pin_thread(int i) const {
+        if (!pinning())
+            return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu(i), &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    // Touches [p, p + size) page by page from nthreads threads, each
+    // pinned as in pin_thread and writing zeros to a contiguous share, so
+    // that under the local policy each share lands on its thread's node.
+    void first_touch(void* p, size_t size, int nthreads) const {
+        if (!pinning() || nthreads <= 1) {
+            memset(p, 0, size);
+            return;
+        }
+        std::vector<std::thread> touchers;
+        for (int t = 0; t < nthreads; ++t)
+            touchers.emplace_back([=] {
+                pin_thread(t);
+                size_t begin = page_round(size * t / nthreads);
+                size_t end = t + 1 == nthreads ? size : page_round(size * (t + 1) / nthreads);
+                if (begin < end)
+                    memset(static_cast<char*>(p) + begin, 0, end - begin);
+            });
+        for (auto& t : touchers)
+            t.join();
+    }
+    // Allocates and constructs a T whose memory was first touched as in
+    // first_touch. Release it with p->~T() and free(p).
+    template <typename T, typename... Args>
+    T* first_touch_new(int nthreads, Args&&... args) const {
+        void* p;
+        if (posix_memalign(&p, page_size, sizeof(T)) != 0)
+            throw std::bad_alloc();
+        first_touch(p, sizeof(T), nthreads);
+        return ::new(p) T(std::forward<Args>(args)...);
+    }
+
+    void print(FILE* f) const {
+        fprintf(f, "placement: pin %s, numa %s", pin_name(), numa_name(numa_));
+        if (pinning()) {
+            fprintf(f, ", cpus");
+            for (size_t i = 0; i != cpus_.size() && i != 64; ++i)
+                fprintf(f, "%s%d", i ? "," : " ", cpus_[i]);
+            if (cpus_.size() > 64)
+                fprintf(f, ",...");
+        }
+        fprintf(f, "\n");
+    }
+
+    // The placement for threads that don't know their index, such as
+    // those that call mbta_wrapper::thread_init. Configured from the
+    // STO_PIN and STO_NUMA (local or interleave) environment variables.
+    static ThreadPlacement& from_env() {
+        static ThreadPlacement p = make_from_env();
+        return p;
+    }
+
+private:
+    static constexpr size_t page_size = 4096;
+
+    pin_policy pin_;
+    numa_policy numa_;
+    std::vector<int> cpus_;
+
+    const char* pin_name() const {
+        return pin_ == pin_compact ? "compact" : pin_ == pin_scatter ? "scatter"
+            : pin_ == pin_list ? "list" : "none";
+    }
+    static size_t page_round(size_t x) {
+        return x & ~(page_size - 1);
+    }
+
+    static ThreadPlacement make_from_env() {
+        ThreadPlacement p;
+        if (const char* pin = getenv("STO_PIN"))
+            if (!p.set_pin(pin))
+                fprintf(stderr, "STO_PIN: bad placement %s\n", pin);
+        if (const char* numa = getenv("STO_NUMA")) {
+            if (strcmp(numa, "local") == 0)
+                p.set_numa(numa_local);
+            else if (strcmp(numa, "interleave") == 0)
+                p.set_numa(numa_interleave);
+            else
+                fprintf(stderr, "STO_NUMA: bad policy %s\n", numa);
+        }
+        if (!p.apply_numa())
+            fprintf(stderr, "STO_NUMA: no NUMA support\n");
+        return p;
+    }
+
+    // "0,2,8-15"
+    static bool parse_cpu_list(const char* s, std::vector<int>& cpus) {
+        while (*s) {
+            char* end;
+            long lo = strtol(s, &end, 10), hi = lo;
+            if (end == s || lo < 0)
+                return false;
+            s = end;
+            if (*s == '-') {
+                hi = strtol(s + 1, &end, 10);
+                if (end == s + 1 || hi < lo)
+                    return false;
+                s = end;
+            }
+            if (hi >= CPU_SETSIZE)
+                return false;
+            for (long c = lo; c <= hi; ++c)
+                cpus.push_back(c);
+            if (*s == ',')
+                ++s;
+            else if (*s && *s != '\n')
+                return false;
+            else
+                break;
+        }
+        return true;
+    }
+
+    static int read_sys_int(int cpu, const char* file) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+        FILE* f = fopen(path, "r");
+        int x = -1;
+        if (f) {
+            if (fscanf(f, "%d", &x) != 1)
+                x = -1;
+            fclose(f);
+        }
+        return x;
+    }
+    static int node_of(int cpu) {
+#if HAVE_LIBNUMA && HAVE_NUMA_H
+        if (numa_available() >= 0)
+            return std::max(numa_node_of_cpu(cpu), 0);
+#endif
+        char path[64];
+        for (int n = 0; n != 1024; ++n) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+            FILE* f = fopen(path, "r");
+            if (!f) {
+                if (n >= 8)
+                    break;
+                continue;
+            }
+            char buf[1024];
+            std::vector<int> cpus;
+            bool ok = fgets(buf, sizeof(buf), f) && parse_cpu_list(buf, cpus);
+            fclose(f);
+            if (ok && std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+                return n;
+        }
+        return 0;
+    }
+
+    struct cpu_info {
+        int cpu, node, package, core, smt;
+    };
+    // The CPUs the process may use, in the order policy p hands them out.
+    static std::vector<int> ordered_cpus(pin_policy p) {
+        cpu_set_t set;
+        std::vector<cpu_info> info;
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return std::vector<int>();
+        for (int c = 0; c != CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set))
+                info.push_back(cpu_info{c, node_of(c), read_sys_int(c, "physical_package_id"),
+                                        read_sys_int(c, "core_id"), 0});
+        // smt: which hyperthread of its core a CPU is
+        for (auto& x : info)
+            for (auto& y : info)
+                if (y.cpu < x.cpu && y.package == x.package && y.core == x.core && y.core >= 0)
+                    ++x.smt;
+        if (p == pin_compact)
+            std::sort(info.begin(), info.end(), [](const cpu_info& a, const cpu_info& b) {
+                    return std::make_tuple(a.node, a.package, a.core, a.smt, a.cpu)
+                        < std::make_tuple(b.node, b.package, b.core, b.smt, b.cpu);
+                });
+        else {
+            // order each node's CPUs cores first, then deal one per node
+            std::sort(info.begin(), info.end(), [](const cpu_info& a, const cpu_info& b) {
+                    return std::make_tuple(a.node, a.smt, a.package, a.core, a.cpu)
+                        < std::make_tuple(b.node, b.smt, b.package, b.core, b.cpu);
+                });
+            std::vector<cpu_info> dealt;
+            std::vector<size_t> starts;
+            for (size_t i = 0; i != info.size(); ++i)
+                if (i == 0 || info[i].node != info[i - 1].node)
+                    starts.push_back(i);
+            starts.push_back(info.size());
+            for (size_t round = 0; dealt.size() != info.size(); ++round)
+                for (size_t n = 0; n + 1 < starts.size(); ++n)
+                    if (starts[n] + round < starts[n + 1])
+                        dealt.push_back(info[starts[n] + round]);
+            info.swap(dealt);
+        }
+        std::vector<int> cpus;
+        for (auto& x : info)
+            cpus.push_back(x.cpu);
+        return cpus;
+    }
+};
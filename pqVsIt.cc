@@ -11,6 +11,7 @@
 #include "TVector_nopred.hh"
 #include "PriorityQueue.hh"
 #include "PriorityQueue1.hh"
+#include "SkipPriorityQueue.hh"
 #include "clp.h"
 #include "randgen.hh"
 int waiting = 5000;
@@ -287,6 +288,10 @@ int main(int argc, char *argv[]) {
             run_and_report<std::priority_queue<int, TVector<int>>>("std");
         else if (strcmp(test, "std-nopred") == 0)
             run_and_report<std::priority_queue<int, TVector_nopred<int>>>("std-nopred");
+        else if (strcmp(test, "skip") == 0)
+            run_and_report<SkipPriorityQueue<int>>("skip");
+        else if (strcmp(test, "skip-relaxed") == 0)
+            run_and_report<SkipPriorityQueue<int, true>>("skip-relaxed");
         else
             assert(false);
     }
@@ -8,14 +8,21 @@
 #include "Vector.hh"
 #include "PriorityQueue.hh"
 #include "PriorityQueue1.hh"
+#include "SkipPriorityQueue.hh"
 #include "randgen.hh"
 
 #define GLOBAL_SEED 0
 #define MAX_VALUE  100000
 #define NTRANS 1000
 #define N_THREADS 4
+// set to 1 to test SkipPriorityQueue instead of PriorityQueue
+#define SKIP_PQ 0
 
+#if SKIP_PQ
+typedef SkipPriorityQueue<int> data_structure;
+#else
 typedef PriorityQueue<int> data_structure;
+#endif
 unsigned initial_seeds[128];
 
 
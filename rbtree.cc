@@ -6,6 +6,7 @@ unsigned long long rbaccount_rotation, rbaccount_flip, rbaccount_insert, rbaccou
 #include <map>
 #include <vector>
 #include <string.h>
+#include <thread>
 #include "RBTree.hh"
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -240,7 +241,51 @@ void mem_tests() {
     }
 }
 
+// lookups run during rebalancing inserts and erases: even keys stay put
+// while writers churn the odd keys around them
+void concurrent_lookup_tests() {
+    tree_type tree;
+    const int n = 2000, nwriters = 3;
+    {
+        TransactionGuard init;
+        for (int i = 0; i < n; i += 2)
+            tree[i] = i;
+    }
+    std::vector<std::thread> threads;
+    for (int w = 0; w < nwriters; ++w)
+        threads.emplace_back([&, w] {
+            TThread::set_id(w + 1);
+            for (int round = 0; round < 20; ++round)
+                for (int i = 2 * w + 1; i < n; i += 2 * nwriters) {
+                    TRANSACTION {
+                        if (round % 2 == 0)
+                            tree[i] = i;
+                        else
+                            tree.erase(i);
+                    } RETRY(true);
+                }
+        });
+    threads.emplace_back([&] {
+        TThread::set_id(nwriters + 1);
+        for (int round = 0; round < 20; ++round)
+            for (int i = 0; i < n; i += 2) {
+                TRANSACTION {
+                    assert(tree.count(i) == 1);
+                } RETRY(true);
+            }
+    });
+    for (auto& t : threads)
+        t.join();
+    TThread::set_id(0);
+    TransactionGuard t;
+    for (int i = 0; i < n; ++i)
+        assert(tree.count(i) == (i % 2 == 0));
+}
+
 int main() {
+    // runs real transactions on this thread, so goes before the
+    // TestTransactions
+    concurrent_lookup_tests();
     // test single-threaded operations
     {
         tree_type tree;
@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <sys/time.h>
+#include "Boosting_locks.hh"
+#include "clp.h"
+
+// Head-to-head: the reader-writer locks behind boosted data structures
+// (Boosting_locks.hh) under a read-mostly workload. Each operation read-
+// or write-locks one of a few locks, as a boosted map's transGet or put
+// locks its key, and checks the data the lock protects.
+
+int nthreads = 4;
+int nops = 4000000;
+int nlocks = 16;
+double read_percent = 0.99;
+
+struct protected_pair {
+    uint64_t a;
+    uint64_t b;
+};
+
+template <typename L>
+void run(std::vector<L>* locks, std::vector<protected_pair>* data, int me) {
+    uint64_t x = 88172645463325252ULL + me;
+    int n = nops / nthreads;
+    for (int i = 0; i < n; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        int k = x % nlocks;
+        L& l = (*locks)[k];
+        protected_pair& p = (*data)[k];
+        if ((x >> 32) % 10000 < read_percent * 10000) {
+            while (!l.tryReadLock(READ_SPIN))
+                /* retry */;
+            always_assert(p.a == p.b);
+            l.readUnlock();
+        } else {
+            while (!l.tryWriteLock(WRITE_SPIN))
+                /* retry */;
+            ++p.a;
+            fence();
+            ++p.b;
+            l.writeUnlock();
+        }
+    }
+}
+
+template <typename L>
+void run_and_report(const char* name) {
+    std::vector<L> locks(nlocks);
+    std::vector<protected_pair> data(nlocks, protected_pair{0, 0});
+
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; ++i)
+        threads.emplace_back(run<L>, &locks, &data, i);
+    for (auto& t : threads)
+        t.join();
+    gettimeofday(&tv2, NULL);
+
+    double time = tv2.tv_sec - tv1.tv_sec + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+    printf("%s: %f s, %llu ops/s\n", name, time, (unsigned long long) (nops / time));
+}
+
+enum {
+    opt_nthreads = 1, opt_nops, opt_nlocks, opt_readpercent
+};
+
+static const Clp_Option options[] = {
+    { "nthreads", 0, opt_nthreads, Clp_ValInt, Clp_Optional },
+    { "nops", 0, opt_nops, Clp_ValInt, Clp_Optional },
+    { "nlocks", 0, opt_nlocks, Clp_ValInt, Clp_Optional },
+    { "readpercent", 0, opt_readpercent, Clp_ValDouble, Clp_Optional }
+};
+
+static void help() {
+    printf("Usage: [OPTIONS] [rwlock|biased]...\n\
+           Options:\n\
+           --nthreads=NTHREADS (default %d)\n\
+           --nops=NOPS, how many total lock operations to run (they'll be split between threads) (default %d)\n\
+           --nlocks=NLOCKS, operations pick among this many locks (default %d)\n\
+           --readpercent=READPERCENT, probability with which to read-lock (default %f)\n",
+           nthreads, nops, nlocks, read_percent);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    std::vector<const char*> tests;
+
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+            case opt_nthreads:
+                nthreads = clp->val.i;
+                break;
+            case opt_nops:
+                nops = clp->val.i;
+                break;
+            case opt_nlocks:
+                nlocks = clp->val.i;
+                break;
+            case opt_readpercent:
+                read_percent = clp->val.d;
+                break;
+            case Clp_NotOption:
+                tests.push_back(clp->vstr);
+                break;
+            default:
+                help();
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    if (tests.empty()) {
+        tests.push_back("rwlock");
+        tests.push_back("biased");
+    }
+
+    for (auto test : tests) {
+        if (strcmp(test, "rwlock") == 0)
+            run_and_report<RWLock>("rwlock");
+        else if (strcmp(test, "biased") == 0)
+            run_and_report<BiasedRWLock>("biased");
+        else
+            help();
+    }
+
+    return 0;
+}
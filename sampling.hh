@@ -2,6 +2,7 @@
 
 //#include <iostream>
 
+#include <cstdint>
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
@@ -151,8 +152,20 @@ public:
             trace.push_back(sample());
         return trace;
     }
+    // Fills out[0, n), e.g. to draw a transaction's keys before it runs.
+    void sample_batch(index_t* out, size_t n) const {
+        for (size_t i = 0; i != n; ++i)
+            out[i] = sample();
+    }
 
 protected:
+    // uniform in (0, 1), with 53 random bits
+    double uniform01() const {
+        auto& g = uis.generator();
+        uint64_t x = (uint64_t(g()) << 21) ^ (g() >> 11);
+        return (double(x & ((uint64_t(1) << 53) - 1)) + 0.5) / 9007199254740992.0;
+    }
+
     void generate() {
         weight_type pmf = generate_weights();
         std::discrete_distribution<index_t> d_(pmf.begin(), pmf.end());
@@ -197,42 +210,165 @@ protected:
 };
 
 // specialization 2: zipf distribution
+//
+// Samples by rejection-inversion (Hoermann and Derflinger, "Rejection-
+// inversion to generate variates from monotone discrete distributions",
+// 1996): invert the integral H of h(x) = x^-skew, the continuous hat of
+// the pmf, and accept the nearest rank with the ratio of its mass to the
+// hat's. That takes O(1) memory and expected O(1) time, with few
+// rejections, so n can be huge. Skew must be nonnegative.
 class StoZipfDistribution : public StoRandomDistribution {
 public:
     static constexpr double default_skew = 1.0;
 
     StoZipfDistribution(int thid, index_t a, index_t b, double skew = default_skew, bool shuffle = false) :
         StoRandomDistribution(thid, a, b, shuffle), skewness(skew) {
-        calculate_sum();
-        generate();
+        setup();
     }
     StoZipfDistribution(int thid, index_t a, index_t b, double skew, std::vector<index_t> index_table) :
         StoRandomDistribution(thid, a, b, index_table), skewness(skew) {
-        calculate_sum();
-        generate();
+        setup();
+    }
+
+    index_t sample() const override {
+        index_t rank = draw() - 1;
+        if (index_transform)
+            return index_translation_table[rank];
+        else
+            return begin + rank;
     }
 
 protected:
+    // only for callers that want the pmf itself; sample() doesn't need it
     weight_type generate_weights() override {
         weight_type pmf;
-        for (auto i = begin; i <= end; ++i) {
-            double p = 1.0/(std::pow((double)(i-begin+1), skewness)*sum_);
-            //std::cout << p << std::endl;
-            pmf.push_back(p);
-        }
+        double sum = 0.0;
+        for (auto i = begin; i <= end; ++i)
+            sum += h(double(i - begin + 1));
+        for (auto i = begin; i <= end; ++i)
+            pmf.push_back(h(double(i - begin + 1)) / sum);
         return pmf;
     }
 
 private:
-    void calculate_sum() {
-        double s = 0.0;
-        for (auto i = begin; i <= end; ++i)
-            s += std::pow(1.0/(double)(i-begin+1), skewness);
-        sum_ = s;
+    void setup() {
+        assert(skewness >= 0);
+        n_ = double(end - begin + 1);
+        h_integral_x1_ = h_integral(1.5) - 1;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        s_ = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+    }
+
+    // a rank in [1, n]
+    index_t draw() const {
+        while (1) {
+            double u = h_integral_n_ + uniform01() * (h_integral_x1_ - h_integral_n_);
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1)
+                k = 1;
+            else if (k > n_)
+                k = n_;
+            if (k - x <= s_ || u >= h_integral(k + 0.5) - h(k))
+                return index_t(k);
+        }
+    }
+
+    double h(double x) const {
+        return std::exp(-skewness * std::log(x));
+    }
+    // H(x) = (x^(1-skew) - 1) / (1-skew), or log(x) when skew is 1
+    double h_integral(double x) const {
+        double log_x = std::log(x);
+        return expm1_over((1 - skewness) * log_x) * log_x;
+    }
+    double h_integral_inverse(double x) const {
+        double t = std::max(x * (1 - skewness), -1.0);
+        return std::exp(log1p_over(t) * x);
+    }
+    // log1p(x)/x and expm1(x)/x, continued through 0
+    static double log1p_over(double x) {
+        if (std::fabs(x) > 1e-8)
+            return std::log1p(x) / x;
+        return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+    static double expm1_over(double x) {
+        if (std::fabs(x) > 1e-8)
+            return std::expm1(x) / x;
+        return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
     }
 
     double skewness;
-    double sum_;
+    double n_;
+    double h_integral_x1_;
+    double h_integral_n_;
+    double s_;
+};
+
+// specialization 3: an arbitrary pmf over [a, a + weights.size()),
+// sampled by Walker's alias method (with Vose's setup): O(n) setup and
+// memory, then one uniform index and one coin flip per sample. The
+// weights needn't sum to 1.
+class StoAliasDistribution : public StoRandomDistribution {
+public:
+    StoAliasDistribution(int thid, index_t a, const weight_type& weights)
+        : StoRandomDistribution(thid, a, a + weights.size() - 1) {
+        setup(weights);
+    }
+
+    index_t sample() const override {
+        index_t i = uis.sample();
+        return begin + (uniform01() < prob_[i] ? i : alias_[i]);
+    }
+
+protected:
+    weight_type generate_weights() override {
+        // recover the pmf from the tables
+        size_t n = prob_.size();
+        weight_type pmf(n, 0.0);
+        for (size_t i = 0; i != n; ++i) {
+            pmf[i] += prob_[i] / n;
+            pmf[alias_[i]] += (1 - prob_[i]) / n;
+        }
+        return pmf;
+    }
+
+private:
+    void setup(const weight_type& weights) {
+        size_t n = weights.size();
+        double sum = 0;
+        for (double w : weights)
+            sum += w;
+        assert(sum > 0);
+        prob_.resize(n);
+        alias_.resize(n);
+        std::vector<index_t> small, large;
+        for (size_t i = 0; i != n; ++i) {
+            // scaled so the average is 1
+            prob_[i] = weights[i] * n / sum;
+            alias_[i] = i;
+            (prob_[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            index_t s = small.back(), l = large.back();
+            small.pop_back();
+            alias_[s] = l;
+            prob_[l] -= 1 - prob_[s];
+            if (prob_[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // the rest are 1 up to rounding
+        for (index_t i : small)
+            prob_[i] = 1;
+        for (index_t i : large)
+            prob_[i] = 1;
+        uis.set_params(std::uniform_int_distribution<index_t>::param_type(0, n - 1));
+    }
+
+    std::vector<double> prob_;
+    std::vector<index_t> alias_;
 };
 
 }; // namespace StoSampling
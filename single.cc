@@ -1,18 +1,27 @@
 #include <iostream>
+#include <algorithm>
+#include <vector>
 #include <assert.h>
 #include <stdio.h>
+#include <thread>
+#include <unistd.h>
 
 #include "Hashtable.hh"
+#include "inline_str.hh"
+#include "TSlab.hh"
+#include "TransAlloc.hh"
 #include "MassTrans.hh"
 #include "List.hh"
 #include "Queue.hh"
 #include "Transaction.hh"
 #include "IntStr.hh"
+#include "TPartitioned.hh"
+#include "composite_key.hh"
+#include "TReplication.hh"
+#include "TTrace.hh"
 
 #define N 100
 
-volatile mrcu_epoch_type active_epoch = 1;
-
 using namespace std;
 
 template <typename T> class IntMassTrans {
@@ -33,6 +42,24 @@ public:
     bool transDelete(int k) {
         return m_.transDelete(IntStr(k).str());
     }
+    bool trans_cas(int k, T expected, T desired) {
+        return m_.trans_cas(IntStr(k).str(), expected, desired);
+    }
+    bool trans_add_bounded(int k, T delta, T bound) {
+        return m_.trans_add_bounded(IntStr(k).str(), delta, bound);
+    }
+    bool trans_update_if(int k, T lo, T hi, T desired) {
+        return m_.trans_update_if(IntStr(k).str(), lo, hi, desired);
+    }
+    void track_size() {
+        m_.track_size();
+    }
+    const TShardedCounter<ssize_t>& trans_size() const {
+        return m_.trans_size();
+    }
+    size_t approx_size() const {
+        return m_.approx_size();
+    }
     void thread_init() {
         m_.thread_init();
     }
@@ -404,6 +431,1138 @@ void insertDeleteSeparateTest() {
   assert(!t3.try_commit());
 }
 
+typedef Hashtable<int, int, true, 129, int, std::hash<int>, std::equal_to<int>, true> SnapshotHashtable;
+
+void snapshotTests() {
+  SnapshotHashtable h;
+  {
+      TransactionGuard t;
+      for (int i = 1; i <= 3; ++i)
+          assert(h.transInsert(i, i * 10));
+  }
+
+  int x;
+  Sto::start_snapshot_transaction();
+  assert(h.transGet(1, x) && x == 10);
+  {
+      TestTransaction t1(1);
+      h.transPut(1, 11);
+      assert(h.transDelete(2));
+      assert(h.transInsert(4, 40));
+      assert(t1.try_commit());
+  }
+  {
+      TestTransaction t2(2);
+      h.transPut(1, 12);
+      assert(h.transInsert(2, 21));
+      assert(t2.try_commit());
+  }
+  // still the state as of the snapshot's start
+  assert(h.transGet(1, x) && x == 10);
+  assert(h.transGet(2, x) && x == 20);
+  assert(h.transGet(3, x) && x == 30);
+  assert(!h.transGet(4, x));
+  assert(Sto::try_commit());
+
+  SNAPSHOT_TRANSACTION {
+      assert(h.transGet(1, x) && x == 12);
+      assert(h.transGet(2, x) && x == 21);
+      assert(h.transGet(4, x) && x == 40);
+  } RETRY(false);
+}
+
+void massSnapshotTests() {
+  MassTrans<int, snapshot_versioned_value<int> > h;
+  {
+      TransactionGuard t;
+      for (int i = 10; i != 20; ++i)
+          assert(h.transInsert(IntStr(i).str(), i));
+  }
+
+  int x, n = 0;
+  Sto::start_snapshot_transaction();
+  assert(h.transGet(IntStr(10).str(), x) && x == 10);
+  {
+      TestTransaction t1(1);
+      h.transPut(IntStr(10).str(), 11);
+      assert(h.transDelete(IntStr(11).str()));
+      assert(h.transInsert(IntStr(20).str(), 20));
+      assert(t1.try_commit());
+  }
+  {
+      TestTransaction t2(2);
+      h.transPut(IntStr(10).str(), 12);
+      // the deleted key reads as absent
+      assert(!h.transGet(IntStr(11).str(), x));
+      assert(t2.try_commit());
+  }
+  // still the state as of the snapshot's start
+  assert(h.transGet(IntStr(10).str(), x) && x == 10);
+  assert(h.transGet(IntStr(11).str(), x) && x == 11);
+  assert(!h.transGet(IntStr(20).str(), x));
+  h.transQuery("10", Masstree::Str(), [&] (Masstree::Str, int v) { n += v; return true; });
+  assert(n == 145);
+  assert(h.transScan("10", Masstree::Str(), [&] (Masstree::Str, int) { return true; }, 3) == 3);
+  assert(Sto::try_commit());
+
+  SNAPSHOT_TRANSACTION {
+      n = 0;
+      assert(h.transGet(IntStr(10).str(), x) && x == 12);
+      assert(!h.transGet(IntStr(11).str(), x));
+      h.transQuery("10", Masstree::Str(), [&] (Masstree::Str, int v) { n += v; return true; });
+      assert(n == 156);
+  } RETRY(false);
+}
+
+void isolationTests() {
+  SnapshotHashtable h;
+  Hashtable<int, int> g;
+  {
+      TransactionGuard t;
+      for (int i = 1; i <= 3; ++i) {
+          assert(h.transInsert(i, i * 10));
+          assert(g.transInsert(i, i * 10));
+      }
+  }
+
+  // snapshot isolation reads the snapshot, shadowed by its own writes
+  int x;
+  Sto::start_transaction(Transaction::snapshot_isolation);
+  assert(h.transGet(1, x) && x == 10);
+  h.transPut(3, 31);
+  assert(h.transInsert(5, 50));
+  assert(h.transDelete(2));
+  {
+      TestTransaction t1(1);
+      h.transPut(1, 11);
+      assert(t1.try_commit());
+  }
+  assert(h.transGet(1, x) && x == 10);
+  assert(!h.transGet(2, x));
+  assert(h.transGet(3, x) && x == 31);
+  assert(h.transGet(5, x) && x == 50);
+  // key 1 changed since the snapshot, but only writes conflict
+  assert(Sto::try_commit());
+
+  // the first committer wins
+  Sto::start_transaction(Transaction::snapshot_isolation);
+  h.transPut(1, 12);
+  {
+      TestTransaction t2(2);
+      h.transPut(1, 13);
+      assert(t2.try_commit());
+  }
+  assert(!Sto::try_commit());
+  SNAPSHOT_TRANSACTION {
+      assert(h.transGet(1, x) && x == 13);
+      assert(!h.transGet(2, x));
+      assert(h.transGet(3, x) && x == 31);
+  } RETRY(false);
+
+  // read committed doesn't check reads of items it doesn't write...
+  Sto::start_transaction(Transaction::read_committed);
+  assert(g.transGet(1, x) && x == 10);
+  {
+      TestTransaction t3(3);
+      g.transPut(1, 11);
+      assert(t3.try_commit());
+  }
+  assert(g.transGet(3, x) && x == 30);
+  g.transPut(2, 21);
+  assert(Sto::try_commit());
+
+  // ...but does check those it writes
+  Sto::start_transaction(Transaction::read_committed);
+  assert(g.transGet(3, x) && x == 30);
+  {
+      TestTransaction t4(4);
+      g.transPut(3, 31);
+      assert(t4.try_commit());
+  }
+  g.transPut(3, x + 1);
+  assert(!Sto::try_commit());
+}
+
+void duplicateReadTests() {
+  // read-only lookups add duplicate items until the first write
+  Hashtable<int, int> h;
+  const int n = 2000;
+  {
+      TransactionGuard t;
+      for (int i = 0; i != n; ++i)
+          assert(h.transInsert(i, i));
+  }
+
+  int x;
+  {
+      TransactionGuard t;
+      for (int r = 0; r != 4; ++r)
+          for (int i = 0; i != n; ++i)
+              assert(h.transGet(i, x) && x == i);
+      // locks the first copy; the other copies' checks fail as locked
+      for (int i = 0; i != n; i += 2)
+          assert(h.transUpdate(i, i + 1));
+  }
+  {
+      TransactionGuard t;
+      for (int i = 0; i != n; ++i)
+          assert(h.transGet(i, x) && x == i + !(i % 2));
+  }
+
+  // a duplicate read still fails validation when another thread wrote
+  {
+      TestTransaction t1(1);
+      assert(h.transGet(1, x));
+      assert(h.transGet(3, x));
+      assert(h.transGet(1, x));
+      assert(h.transUpdate(3, 0));
+      TestTransaction t2(2);
+      assert(h.transUpdate(1, 100));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+}
+
+void noReadMyWritesTests() {
+  // reads before a write, each key written once
+  Hashtable<int, int> h;
+  {
+      TransactionGuard t;
+      for (int i = 0; i != 100; ++i)
+          assert(h.transInsert(i, i));
+  }
+  int x;
+  h.set_read_my_writes(false);
+  {
+      TransactionGuard t;
+      for (int i = 0; i != 100; ++i) {
+          assert(h.transGet(i, x) && x == i);
+          assert(h.transGet(i, x) && x == i);
+          assert(h.transPut(i, i + 1));
+      }
+  }
+  h.set_read_my_writes(true);
+  {
+      TransactionGuard t;
+      for (int i = 0; i != 100; ++i)
+          assert(h.transGet(i, x) && x == i + 1);
+  }
+
+  // the per-transaction hint; reads are still validated
+  {
+      TestTransaction t1(1);
+      Sto::no_read_my_writes();
+      assert(h.transGet(1, x));
+      assert(h.transUpdate(3, 0));
+      TestTransaction t2(2);
+      assert(h.transUpdate(1, 100));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+}
+
+void absentTests() {
+  // absent reads conflict only with inserts in their fingerprint's slot
+  Hashtable<int, int> h(1);
+  auto slot = [&](int k) { return (h.hash(k) >> 32) & (HASHTABLE_ABSENT_SLOTS - 1); };
+  int k0 = 1, other = 0, same = 0;
+  for (int k = 2; !same || (!other && HASHTABLE_ABSENT_SLOTS > 1); ++k)
+      if (h.bucket(k) == h.bucket(k0)) {
+          if (slot(k) != slot(k0))
+              other = other ? other : k;
+          else
+              same = same ? same : k;
+      }
+  Transaction::clear_stats();
+  int x;
+  if (HASHTABLE_ABSENT_SLOTS > 1) {
+      TestTransaction t1(1);
+      assert(!h.transGet(k0, x));
+      h.transPut(-1, 1);
+      TestTransaction t2(2);
+      assert(h.transInsert(other, other));
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+  {
+      TestTransaction t1(1);
+      assert(!h.transGet(k0, x));
+      h.transPut(-1, 2);
+      TestTransaction t2(2);
+      assert(h.transInsert(same, same));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  auto ac = Transaction::abort_counters_combined();
+  assert(ac.find(&h).n[ar_commit_check_absent] == 1);
+  assert(ac.find(&h).n[ar_commit_check] == 0);
+}
+
+void bulkLoadTests() {
+  // parallel loads into a reserved table
+  Hashtable<int, int> h(4);
+  const int n = 40000, nthreads = 4;
+  std::vector<int> keys, values;
+  for (int i = 0; i != n; ++i) {
+      keys.push_back(i);
+      values.push_back(i + 1);
+  }
+  h.reserve(n);
+  size_t nb = h.nbuckets();
+  std::vector<std::thread> loaders;
+  for (int t = 0; t != nthreads; ++t)
+      loaders.emplace_back([&, t] {
+          TThread::set_id(t);
+          int begin = n / nthreads * t, end = n / nthreads * (t + 1);
+          h.bulk_load(keys.data() + begin, values.data() + begin, end - begin);
+      });
+  for (auto& l : loaders)
+      l.join();
+  assert(h.nbuckets() == nb && nb >= size_t(n));
+  int x;
+  {
+      TransactionGuard t;
+      for (int i = 0; i < n; i += 7)
+          assert(h.transGet(i, x) && x == i + 1);
+      assert(!h.transGet(n, x));
+      assert(h.transUpdate(3, 0));
+  }
+  int count = 0;
+  for (auto it = h.begin(); it != h.end(); ++it, ++count)
+      assert((*it).second == ((*it).first == 3 ? 0 : (*it).first + 1));
+  assert(count == n);
+}
+
+void resizeTests() {
+  // the table grows as keys arrive, without aborting absent reads
+  Hashtable<int, int> h(4);
+  for (int i = 0; i != 8; ++i)
+      h.nontrans_insert(i, i);
+  size_t nb = h.nbuckets();
+  std::vector<int> keys;
+  int x;
+  {
+      TestTransaction t1(1);
+      assert(!h.transGet(-1, x));
+      assert(h.transGet(1, x) && x == 1);
+      h.transPut(2, 20);
+      TestTransaction t2(2);
+      assert(!h.transGet(-2, x));
+      h.transPut(4, 40);
+      // inserts into other buckets; -1's bucket migrates several times
+      for (int i = 8; i != 10000; ++i)
+          if (h.bucket(i) != h.bucket(-1))
+              keys.push_back(i);
+      for (int k : keys)
+          h.nontrans_insert(k, k);
+      assert(h.nbuckets() >= nb * 256);
+      assert(t1.try_commit());
+      // an insert into a split bucket still fails the absent read
+      h.nontrans_insert(-2, 0);
+      assert(!t2.try_commit());
+  }
+  {
+      TransactionGuard t;
+      for (int k : keys)
+          assert(h.transGet(k, x) && x == k);
+      assert(h.transGet(2, x) && x == 20);
+      assert(h.transGet(4, x) && x == 4);
+      assert(!h.transGet(-1, x));
+  }
+
+  // concurrent transactional inserts while lookups run
+  Hashtable<int, int> c(4);
+  const int nthreads = 4, per = 5000;
+  volatile bool stop = false;
+  std::thread reader([&] {
+      TThread::set_id(nthreads);
+      while (!stop) {
+          TRANSACTION {
+              int y;
+              assert(!c.transGet(-1, y));
+              for (int i = 0; i < per; i += 97)
+                  if (c.transGet(i, y))
+                      assert(y == i);
+          } RETRY(true);
+      }
+  });
+  std::vector<std::thread> writers;
+  for (int t = 0; t != nthreads; ++t)
+      writers.emplace_back([&c, t] {
+          TThread::set_id(t);
+          for (int i = t; i < nthreads * per; i += 10 * nthreads) {
+              TRANSACTION {
+                  for (int j = i; j < i + 10 * nthreads && j < nthreads * per; j += nthreads)
+                      assert(c.transInsert(j, j));
+              } RETRY(true);
+          }
+      });
+  for (auto& w : writers)
+      w.join();
+  stop = true;
+  reader.join();
+  int n = 0;
+  for (auto it = c.begin(); it != c.end(); ++it, ++n)
+      assert((*it).first == (*it).second);
+  assert(n == nthreads * per);
+  TRANSACTION {
+      for (int i = 0; i != nthreads * per; ++i)
+          assert(c.transGet(i, x) && x == i);
+  } RETRY(false);
+}
+
+void slabTests() {
+  // slots are cache-line friendly and freed slots are reused
+  struct node {
+      int64_t x[3];
+  };
+  node* a = TSlab<node>::make();
+  node* b = TSlab<node>::make();
+  assert((uintptr_t) a % 32 == 0 && (char*) b - (char*) a == 32);
+  TSlab<node>::free(a);
+  assert(TSlab<node>::make() == a);
+
+  // elements removed from a Hashtable go back to the pool after RCU
+  Hashtable<int, int> h;
+  for (int round = 0; round != 100; ++round) {
+      TRANSACTION {
+          for (int i = 0; i != 100; ++i)
+              h.transPut(i, round);
+      } RETRY(false);
+      TRANSACTION {
+          for (int i = 0; i != 100; ++i)
+              assert(h.transDelete(i));
+      } RETRY(false);
+  }
+  int x;
+  TRANSACTION {
+      assert(!h.transGet(0, x));
+  } RETRY(false);
+}
+
+void transAllocTests() {
+  TransAlloc ta;
+  // an aborted allocation goes straight back to the pool
+  void* p;
+  {
+      TestTransaction t(1);
+      p = ta.transMalloc(40);
+      assert((uintptr_t) p % 16 == 0);
+  }
+  TRANSACTION {
+      void* q = ta.transMalloc(40);
+      assert(q == p);
+      ta.transFree(q);
+  } RETRY(false);
+
+  // objects and large blocks
+  struct obj {
+      std::string s;
+  };
+  obj* o;
+  TRANSACTION {
+      o = ta.transNew<obj>();
+      o->s = "hello";
+      char* big = (char*) ta.transMalloc(TSlabAlloc::max_size + 1);
+      big[TSlabAlloc::max_size] = 1;
+      ta.transFree(big);
+  } RETRY(false);
+  assert(o->s == "hello");
+  TRANSACTION {
+      ta.transDelete(o);
+  } RETRY(false);
+}
+
+void batchTests() {
+  Hashtable<int, int> h;
+  int keys[50], vals[50], out[50];
+  bool found[50];
+  for (int i = 0; i != 50; ++i) {
+      keys[i] = i * 3;
+      vals[i] = i;
+  }
+  {
+      TransactionGuard t;
+      for (int i = 0; i != 10; ++i)
+          h.transPut(keys[i], -1);
+      assert(h.transPutMany(keys, vals, 40) == 10);
+      // reads our own writes, including inserts
+      assert(h.transGetMany(keys, 50, out, found) == 40);
+      for (int i = 0; i != 50; ++i)
+          assert(found[i] == (i < 40) && (i >= 40 || out[i] == i));
+  }
+  {
+      TransactionGuard t;
+      assert(h.transDelete(keys[5]));
+      assert(h.transGetMany(keys, 50, out, found) == 39 && !found[5]);
+  }
+
+  // a large batch of mostly new keys, one repeated
+  {
+      const int nb = 3000;
+      std::vector<int> bk(nb), bv(nb);
+      for (int i = 0; i != nb; ++i) {
+          bk[i] = 1000 + (i % 1000 == 999 ? 5 : i);
+          bv[i] = i;
+      }
+      {
+          TransactionGuard t;
+          assert(h.transPutMany(bk.data(), bv.data(), nb) == 3);
+          int x;
+          assert(h.transGet(1005, x) && x == 2999);
+          assert(h.transGet(3998, x) && x == 2998);
+      }
+      // an abort in the middle of a batch leaves no elements behind
+      for (int i = 0; i != nb; ++i)
+          bk[i] = 10000 + i;
+      {
+          TestTransaction t2(2);
+          h.transPut(bk[100], 1);
+          TestTransaction t1(1);
+          bool aborted = false;
+          try {
+              h.transPutMany(bk.data(), bv.data(), nb);
+          } catch (Transaction::Abort&) {
+              aborted = true;
+          }
+          assert(aborted);
+          t2.use();
+          assert(t2.try_commit());
+      }
+      {
+          TransactionGuard t;
+          int x;
+          for (int i = 0; i != nb; ++i)
+              assert(h.transGet(bk[i], x) == (i == 100));
+      }
+  }
+
+  // absent keys in a batch are checked at commit
+  {
+      TestTransaction t1(1);
+      assert(h.transGetMany(keys, 50, out) == 39);
+      h.transPut(1, 1);
+      TestTransaction t2(2);
+      h.transPut(keys[45], 45);
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+}
+
+void inlineStrTests() {
+  typedef inline_str<> istr;
+  static_assert(sizeof(istr) == 24 && mass::is_trivially_copyable<istr>::value, "inline_str layout");
+  Hashtable<istr, istr> h;
+  {
+      TransactionGuard t;
+      assert(h.transInsert(std::string("alpha"), "one"));
+      assert(h.transInsert("a key of 23 bytes......", std::string("beta")));
+      assert(!h.transInsert("alpha", "again"));
+  }
+  {
+      TransactionGuard t;
+      istr v;
+      assert(h.transGet("alpha", v) && v == "one");
+      std::string sv;
+      assert(h.transGet("a key of 23 bytes......", sv) && sv == "beta");
+      assert(!h.transGet("alph", v));
+      assert(h.transUpdate("alpha", "uno"));
+      assert(h.transGet("alpha", v) && v.str() == "uno");
+      assert(h.transDelete("a key of 23 bytes......"));
+  }
+  {
+      TransactionGuard t;
+      istr v;
+      assert(h.transGet("alpha", v) && v == "uno");
+      assert(!h.transGet("a key of 23 bytes......", v));
+  }
+}
+
+void commuteTests() {
+  // commutative updates of a present key don't conflict with each other
+  Hashtable<int, int> h;
+  {
+      TransactionGuard t;
+      assert(h.transInsert(1, 10));
+  }
+  {
+      TestTransaction t1(1);
+      h.trans_add(1, 5);
+      h.trans_add(2, 7);  // absent: inserted
+      TestTransaction t2(2);
+      h.trans_add(1, 3);
+      h.trans_max(1, 100);  // mixed kinds: materialized, t2 now reads 1
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+  int x;
+  {
+      TransactionGuard t;
+      assert(h.transGet(1, x) && x == 105);
+      assert(h.transGet(2, x) && x == 7);
+      h.trans_min(1, 50);
+      assert(h.transGet(1, x) && x == 50);
+      h.trans_add(1, 1);
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(1, x) && x == 51);
+  }
+
+  // but a concurrent delete aborts them
+  {
+      TestTransaction t1(1);
+      h.trans_add(1, 1);
+      TestTransaction t2(2);
+      assert(h.transDelete(1));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  {
+      TransactionGuard t;
+      assert(!h.transGet(1, x));
+      assert(h.transGet(2, x) && x == 7);
+  }
+}
+
+template <typename MapType>
+void conditionalTests(MapType& h) {
+  int x;
+  {
+      TransactionGuard t;
+      h.transPut(1, 10);
+      h.transPut(2, 19);
+  }
+
+  // bounded adds that both fit commute
+  {
+      TestTransaction t1(1);
+      assert(h.trans_add_bounded(1, 1, 20));
+      TestTransaction t2(2);
+      assert(h.trans_add_bounded(1, 1, 20));
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+  // but one that no longer fits aborts
+  {
+      TestTransaction t1(1);
+      assert(h.trans_add_bounded(2, 1, 20));
+      TestTransaction t2(2);
+      assert(h.trans_add_bounded(2, 1, 20));
+      assert(!h.trans_add_bounded(2, 2, 20));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(1, x) && x == 12);
+      assert(h.transGet(2, x) && x == 20);
+  }
+
+  // a CAS conflicts with a change of the value...
+  {
+      TestTransaction t1(1);
+      assert(h.trans_cas(1, 12, 30));
+      TestTransaction t2(2);
+      h.transPut(1, 13);
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  // ...but not with a change that is undone
+  {
+      TestTransaction t1(1);
+      assert(h.trans_cas(1, 13, 30));
+      TestTransaction t2(2);
+      h.transPut(1, 99);
+      assert(t2.try_commit());
+      TestTransaction t3(3);
+      h.transPut(1, 13);
+      assert(t3.try_commit());
+      assert(t1.try_commit());
+  }
+  // and a failed CAS only with changes to the expected value
+  {
+      TestTransaction t1(1);
+      assert(!h.trans_cas(1, 5, 6));
+      TestTransaction t2(2);
+      h.transPut(1, 31);
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+
+  {
+      TransactionGuard t;
+      assert(!h.trans_update_if(3, 0, 100, 1));
+      assert(h.trans_update_if(1, 0, 100, 40));
+      assert(h.trans_add_bounded(1, 2, 100));
+      assert(h.transGet(1, x) && x == 42);
+      assert(!h.trans_cas(1, 40, 0));
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(1, x) && x == 42);
+      assert(!h.transGet(3, x));
+  }
+}
+
+template <typename MapType>
+void sizeTests(MapType& h) {
+  {
+      TransactionGuard t;
+      h.transPut(1, 1);
+  }
+  h.track_size();
+
+  // a transaction's own inserts and deletes count
+  {
+      TransactionGuard t;
+      assert(h.trans_size() == 1L);
+      h.transPut(2, 2);
+      h.transPut(3, 3);
+      assert(h.transDelete(1));
+      assert(h.trans_size() == 2L);
+      h.transPut(1, 1);
+      assert(h.transDelete(3));
+      assert(h.trans_size() == 2L);
+  }
+  {
+      TransactionGuard t;
+      assert(!h.transDelete(3));
+      h.transPut(2, 20);
+      assert(h.trans_size() == 2L);
+  }
+
+  // a size test conflicts only with commits that change its outcome
+  {
+      TestTransaction t1(1);
+      assert(h.trans_size() < 4L);
+      h.transPut(1, 10);
+      TestTransaction t2(2);
+      h.transPut(10, 10);
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+  {
+      TestTransaction t1(1);
+      assert(h.trans_size() < 4L);
+      h.transPut(1, 11);
+      TestTransaction t2(2);
+      h.transPut(11, 11);
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  // and inserts and deletes don't conflict with each other
+  {
+      TestTransaction t1(1);
+      h.transPut(12, 12);
+      TestTransaction t2(2);
+      assert(h.transDelete(10));
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+  {
+      TransactionGuard t;
+      assert(h.trans_size() == 4L);
+  }
+}
+
+void scanTests() {
+  // with an item per element, then with an item per bucket
+  for (int bucket_scans = 0; bucket_scans != 2; ++bucket_scans) {
+    Hashtable<int, int> h(4);
+    Hashtable<int, int> other;
+    h.set_bucket_scans(bucket_scans);
+    {
+        TransactionGuard t;
+        for (int i = 0; i != 100; ++i)
+            h.transPut(i, i);
+    }
+
+    // parts split the keys, with more parts than buckets too
+    for (unsigned nparts = 1; nparts <= 1024; nparts *= 32) {
+        TransactionGuard t;
+        size_t n = 0;
+        int sum = 0;
+        for (unsigned p = 0; p != nparts; ++p)
+            n += h.trans_scan([&](int k, int v) {
+                    assert(k == v);
+                    sum += k;
+                }, p, nparts);
+        assert(n == 100 && sum == 4950);
+    }
+
+    // scans see the transaction's own writes
+    {
+        TransactionGuard t;
+        h.transPut(1000, 1000);
+        assert(h.transDelete(0));
+        h.transPut(1, 5);
+        int n = 0;
+        for (auto it = h.trans_begin(); it != h.trans_end(); ++it) {
+            assert(it->first != 0);
+            assert(it->second == (it->first == 1 ? 5 : it->first));
+            ++n;
+        }
+        assert(n == 100);
+    }
+
+    // a scan conflicts with commits that change the buckets it read...
+    {
+        TestTransaction t1(1);
+        assert(h.trans_scan([](int, int) {}) == 100);
+        other.transPut(0, 0);
+        TestTransaction t2(2);
+        h.transPut(50, 51);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    {
+        TestTransaction t1(1);
+        assert(h.trans_scan([](int, int) {}) == 100);
+        other.transPut(0, 0);
+        TestTransaction t2(2);
+        h.transPut(2000, 2000);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    // ...but not with commits to other parts
+    {
+        TestTransaction t1(1);
+        std::vector<int> seen;
+        h.trans_scan([&](int k, int) { seen.push_back(k); }, 0, 2);
+        other.transPut(0, 0);
+        int k = 1;
+        while (std::find(seen.begin(), seen.end(), k) != seen.end())
+            ++k;
+        TestTransaction t2(2);
+        h.transPut(k, -1);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+  }
+}
+
+struct HundredsRoute {
+  unsigned operator()(int k) const {
+    return k / 100;
+  }
+};
+
+void partitionTests() {
+  ThreadPlacement unpinned;
+  TPartitioned<Hashtable<int, int>, HundredsRoute> h(4);
+  h.build(unpinned);
+  assert(h.partition(5) == 0 && h.partition(105) == 1 && h.partition(405) == 0);
+  {
+      TestTransaction t(0);
+      h.transPut(5, 5);
+      h.transPut(105, 105);
+      h.transPut(205, 205);
+      assert(t.try_commit());
+  }
+  auto st = h.stats();
+  assert(st.local == 1 && st.remote == 2);
+  assert(h.thread_stats(0).remote == 2);
+
+  // a transaction across partitions is an ordinary transaction
+  int x;
+  {
+      TestTransaction t1(1);
+      assert(h.transGet(105, x) && x == 105);
+      h.transPut(5, 6);
+      TestTransaction t2(2);
+      h.transPut(105, 106);
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  {
+      TestTransaction t(1);
+      assert(h.transGet(5, x) && x == 5);
+      assert(h.transDelete(205));
+      assert(!h.transGet(205, x));
+      assert(t.try_commit());
+  }
+  st = h.thread_stats(1);
+  assert(st.local == 1 && st.remote == 4);
+  h.reset_stats();
+  assert(h.stats().local == 0 && h.stats().remote == 0);
+  assert(h.part(2).nontrans_find(205, x) == false);
+}
+
+void checkpointTests() {
+  char path[] = "/tmp/sto-ckpt-XXXXXX";
+  close(mkstemp(path));
+
+  // without snapshots, the checkpoint is a read-only transaction
+  Hashtable<int, int> h;
+  for (int i = 0; i != 1000; ++i)
+      h.nontrans_insert(i, i * 3);
+  TRANSACTION {
+      assert(h.transDelete(7));
+      h.transPut(1000, 1);
+  } RETRY(false);
+  assert(h.checkpoint(path));
+  Hashtable<int, int> r(5);
+  assert(r.restore(path) && r.nbuckets() >= 1000);
+  TRANSACTION {
+      int x;
+      for (int i = 0; i <= 1000; ++i)
+          if (i == 7)
+              assert(!r.transGet(i, x));
+          else
+              assert(r.transGet(i, x) && x == (i == 1000 ? 1 : i * 3));
+  } RETRY(false);
+
+  // with snapshots, writers keep committing during the checkpoint;
+  // transfers keep the sum at 100 * 100
+  SnapshotHashtable sh;
+  for (int i = 0; i != 100; ++i)
+      sh.nontrans_insert(i, 100);
+  volatile bool stop = false;
+  std::thread writer([&] {
+      TThread::set_id(1);
+      for (unsigned n = 0; !stop || n < 1000; ++n) {
+          TRANSACTION {
+              int a = n % 100, b = (n * 7 + 3) % 100, x, y;
+              assert(sh.transGet(a, x) && sh.transGet(b, y));
+              if (a != b) {
+                  sh.transPut(a, x - 1);
+                  sh.transPut(b, y + 1);
+              }
+          } RETRY(true);
+      }
+  });
+  for (int round = 0; round != 20; ++round) {
+      assert(sh.checkpoint(path));
+      TCheckpointReader ck;
+      assert(ck.open(path) && ck.count() == 100 && ck.tid() != 0);
+      SnapshotHashtable sr;
+      assert(sr.restore(path));
+      int sum = 0, x;
+      TRANSACTION {
+          sum = 0;
+          for (int i = 0; i != 100; ++i) {
+              assert(sr.transGet(i, x));
+              sum += x;
+          }
+      } RETRY(false);
+      assert(sum == 100 * 100);
+  }
+  stop = true;
+  writer.join();
+  unlink(path);
+}
+
+void logTests() {
+  char dir[] = "/tmp/sto-htlog-XXXXXX";
+  assert(mkdtemp(dir));
+  // the durable epoch waits for every thread slot's epoch
+  for (unsigned i = 0; i != Transaction::used_threads(); ++i)
+      if (i != unsigned(TThread::id()))
+          Transaction::tinfo[i].epoch = 0;
+  Hashtable<int, int> h;
+  h.set_log_id(1);
+  h.nontrans_insert(9, 9);
+  int data[2];
+  assert(pipe(data) == 0);
+  // a replica seeded with the unlogged bulk load
+  Hashtable<int, int> r;
+  r.nontrans_insert(9, 9);
+  TReplica replica(data[0]);
+  std::thread rt([&] {
+      assert(replica.run([&](const TLog::entry& e) {
+              assert(e.id == 1);
+              r.apply_log(e);
+          }));
+  });
+  TReplicator rep;
+  rep.add_replica(data[1]);
+  rep.start();
+  assert(TLog::open(dir));
+  TRANSACTION {
+      for (int i = 0; i != 5; ++i)
+          h.transPut(i, i);
+  } RETRY(false);
+  TRANSACTION {
+      h.transPut(2, 20);
+      assert(h.transDelete(3));
+      assert(h.transDelete(9));
+  } RETRY(false);
+  assert(TLog::close());
+  rep.stop();
+  close(data[1]);
+  rt.join();
+  close(data[0]);
+  assert(replica.applied_epoch() == TLog::durable_epoch() && rep.lag(0) == 0);
+
+  // replaying the log gives the same table
+  Hashtable<int, int> p;
+  p.nontrans_insert(9, 9);
+  assert(TLog::replay(dir, [&](const TLog::entry& e) { p.apply_log(e); }) > 0);
+  for (auto* t : {&r, &p}) {
+      int x;
+      for (int i = 0; i != 10; ++i)
+          if (i == 3 || i > 4)
+              assert(!t->nontrans_find(i, x));
+          else
+              assert(t->nontrans_find(i, x) && x == (i == 2 ? 20 : i));
+  }
+  unlink((std::string(dir) + "/log." + std::to_string(TThread::id())).c_str());
+  unlink((std::string(dir) + "/epoch").c_str());
+  rmdir(dir);
+}
+
+void traceTests() {
+  char path[] = "/tmp/sto-trace-XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  Hashtable<int, std::string> h;
+  Hashtable<std::string, int> g;
+  h.set_trace_id(1);
+  g.set_trace_id(2);
+  h.nontrans_insert(1, "one");
+  assert(TTrace::start(path));
+  TRANSACTION {
+      std::string v;
+      assert(h.transGet(1, v));
+      h.transPut(2, std::string("two"));
+      g.transInsert(std::string("k"), 5);
+  } RETRY(false);
+  try {
+      TRANSACTION {
+          h.transDelete(1);
+          Sto::abort();
+      } RETRY(false);
+  } catch (Transaction::Abort e) {
+  }
+  assert(TTrace::stop());
+  TRANSACTION {
+      h.transPut(3, std::string("untraced"));
+  } RETRY(false);
+
+  TTrace::reader r(path);
+  assert(r.ok());
+  TTrace::txn t;
+  assert(r.next(t) && t.committed && t.thread == unsigned(TThread::id()));
+  assert(t.ops.size() == 3);
+  assert(t.ops[0].container == 1 && t.ops[0].type == TTrace::op_get && t.ops[0].key == 1);
+  assert(t.ops[1].type == TTrace::op_put && t.ops[1].key == 2 && t.ops[1].value_size == 3);
+  assert(t.ops[2].container == 2 && t.ops[2].type == TTrace::op_insert
+         && t.ops[2].key == std::hash<std::string>()("k") && t.ops[2].value_size == sizeof(int));
+  assert(r.next(t) && !t.committed && t.ops.size() == 1 && t.ops[0].type == TTrace::op_erase);
+  assert(!r.next(t) && r.ok());
+  unlink(path);
+}
+
+void threadinfoTests() {
+  // a thread taking over an STO thread id reuses its Masstree threadinfo,
+  // whatever the tree type
+  threadinfo* first = nullptr;
+  std::thread a([&] {
+      TThread::set_id(1);
+      MassTrans<int>::thread_init();
+      first = MassTrans<int>::mythreadinfo.ti;
+  });
+  a.join();
+  std::thread b([&] {
+      TThread::set_id(1);
+      MassTrans<std::string>::thread_init();
+      assert(MassTrans<std::string>::mythreadinfo.ti == first);
+      IntMassTrans<int> m;
+      m.thread_init();
+      TRANSACTION {
+          m.transPut(1, 2);
+      } RETRY(false);
+      TRANSACTION {
+          int v;
+          assert(m.transGet(1, v) && v == 2);
+      } RETRY(false);
+  });
+  b.join();
+  assert(first && first != MassTrans<int>::mythreadinfo.ti);
+
+  // Masstree's epochs follow STO's
+  MassTrans<int>::static_init();
+  for (int i = 0; i != 3; ++i) {
+      Transaction::advance_epoch();
+      Transaction::epoch_advance_callback(Transaction::global_epochs.global_epoch);
+  }
+  assert(globalepoch == Transaction::global_epochs.global_epoch);
+  // Masstree frees nothing a running transaction might still see
+  assert(active_epoch < Transaction::global_epochs.active_epoch
+         || Transaction::global_epochs.active_epoch == 1);
+  Transaction::epoch_advance_callback = nullptr;
+}
+
+static int keycmp(const composite_key<>& a, const composite_key<>& b) {
+  int c = memcmp(a.data(), b.data(), std::min(a.length(), b.length()));
+  return c ? c : int(a.length()) - int(b.length());
+}
+
+void compositeKeyTests() {
+  // encodings sort like their components
+  composite_key<> k[6];
+  k[0].append(int32_t(-1)).append("z");
+  k[1].append(int32_t(1)).append("ab");
+  k[2].append(int32_t(1)).append("ab\0", 3);
+  k[3].append(int32_t(1)).append("abc");
+  k[4].append(int32_t(1)).append("b").append(uint64_t(255));
+  k[5].append(int32_t(1)).append("b").append(uint64_t(256));
+  for (int i = 0; i != 5; ++i)
+      assert(keycmp(k[i], k[i + 1]) < 0);
+
+  composite_key_reader r(k[2].str());
+  char buf[8];
+  assert(r.read<int32_t>() == 1);
+  assert(r.read(buf, sizeof(buf)) == 3 && memcmp(buf, "ab\0", 3) == 0);
+  assert(r.done());
+  composite_key_reader r0(k[0]);
+  assert(r0.read<int32_t>() == -1 && r0.read_string() == "z" && r0.done());
+
+  // (warehouse, district, order) keys, queried by prefix
+  MassTrans<int> h;
+  composite_key<> key;
+  {
+      TransactionGuard t;
+      for (int w = 1; w <= 3; ++w)
+          for (int d = 1; d <= 10; ++d) {
+              key.clear();
+              key.append(uint16_t(w)).append(uint8_t(d));
+              unsigned prefix = key.length();
+              for (int o = 1; o <= 5; ++o) {
+                  key.truncate(prefix);
+                  key.append(uint32_t(o));
+                  h.transPut(key.str(), w * 1000 + d * 10 + o);
+              }
+          }
+  }
+  {
+      TransactionGuard t;
+      int x;
+      key.clear();
+      key.append(uint16_t(2)).append(uint8_t(7)).append(uint32_t(3));
+      assert(h.transGet(key.str(), x) && x == 2073);
+
+      composite_key<> end;
+      key.truncate(2);
+      assert(key.prefix_end(end));
+      int n = 0, last = 0;
+      h.transQuery(key.str(), end.str(), [&] (Masstree::Str s, int v) {
+          composite_key_reader kr(s);
+          assert(kr.read<uint16_t>() == 2);
+          int d = kr.read<uint8_t>();
+          int o = kr.read<uint32_t>();
+          assert(kr.done() && d * 10 + o == v - 2000);
+          assert(v > last);
+          last = v;
+          ++n;
+          return true;
+      });
+      assert(n == 50);
+  }
+}
+
 void rangeQueryTest() {
   MassTrans<int> h;
   int n = 99;
@@ -445,6 +1604,102 @@ void rangeQueryTest() {
   }
 }
 
+void leafScanTest() {
+  MassTrans<int> h, g;
+  {
+      TransactionGuard t;
+      for (int i = 10; i <= 99; ++i)
+          assert(h.transInsert(IntStr(i).str(), i));
+  }
+
+  {
+      TransactionGuard t;
+      int x = 0;
+      assert(h.transScan("10", Masstree::Str(), [&] (Masstree::Str, int v) { assert(v == 10 + x); x++; return true; }) == 90);
+      assert(x == 90);
+      x = 0;
+      assert(h.transScan("20", "50", [&] (Masstree::Str, int) { x++; return true; }, 5) == 5);
+      assert(x == 5);
+      // reads our own writes
+      assert(h.transUpdate(IntStr(30).str(), 300));
+      int seen = 0;
+      h.transScan("30", "31", [&] (Masstree::Str, int v) { seen = v; return true; });
+      assert(seen == 300);
+  }
+
+  // an update to a scanned row fails the scan's leaf item
+  {
+      TestTransaction t1(1);
+      int x = 0;
+      h.transScan("40", "60", [&] (Masstree::Str, int) { x++; return true; });
+      assert(x == 20);
+      g.transPut(IntStr(5).str(), 5);
+      TestTransaction t2(2);
+      assert(h.transUpdate(IntStr(45).str(), 0));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+  // rows past the limit are not validated
+  {
+      TestTransaction t1(1);
+      assert(h.transScan("40", "60", [&] (Masstree::Str, int) { return true; }, 3) == 3);
+      g.transPut(IntStr(6).str(), 6);
+      TestTransaction t2(2);
+      assert(h.transUpdate(IntStr(50).str(), 0));
+      assert(t2.try_commit());
+      assert(t1.try_commit());
+  }
+
+  // reverse scans: keys <= begin and > end, in descending order
+  {
+      TransactionGuard t;
+      int last = 100, x = 0;
+      assert(h.transRScan("99", Masstree::Str(), [&] (Masstree::Str key, int) {
+                  int k = atoi(std::string(key.data(), key.length()).c_str());
+                  assert(k < last);
+                  last = k;
+                  x++;
+                  return true;
+              }) == 90);
+      assert(x == 90 && last == 10);
+      assert(h.transRScan("50", "20", [&] (Masstree::Str, int) { return true; }) == 30);
+      assert(h.transRScan("50", "20", [&] (Masstree::Str, int) { return true; }, 4) == 4);
+  }
+  {
+      TestTransaction t1(1);
+      h.transRScan("60", "40", [&] (Masstree::Str, int) { return true; });
+      g.transPut(IntStr(7).str(), 7);
+      TestTransaction t2(2);
+      assert(h.transUpdate(IntStr(55).str(), 0));
+      assert(t2.try_commit());
+      assert(!t1.try_commit());
+  }
+}
+
+void slabBoxTest() {
+  MassTrans<int, slab_versioned_value<int> > h;
+  {
+      TransactionGuard t;
+      for (int i = 10; i != 50; ++i)
+          assert(h.transInsert(IntStr(i).str(), i));
+  }
+  {
+      TransactionGuard t;
+      int x;
+      assert(h.transGet(IntStr(20).str(), x) && x == 20);
+      assert(h.transUpdate(IntStr(20).str(), 200));
+      assert(h.transDelete(IntStr(21).str()));
+  }
+  {
+      TransactionGuard t;
+      int x, n = 0;
+      assert(h.transGet(IntStr(20).str(), x) && x == 200);
+      assert(!h.transGet(IntStr(21).str(), x));
+      h.transQuery("10", Masstree::Str(), [&] (Masstree::Str, int) { n++; return true; });
+      assert(n == 39);
+  }
+}
+
 template <typename K, typename V>
 void basicQueryTests(MassTrans<K, V>& h) {
   TransactionGuard t19;
@@ -598,9 +1853,94 @@ int main() {
 
   rangeQueryTest();
 
+  // order-preserving composite keys
+  compositeKeyTests();
+
+  // range scans validated per leaf
+  leafScanTest();
+
+  // MassTrans with slab-allocated boxes
+  slabBoxTest();
+
   // string key testing
   stringKeyTests();
 
+  // snapshot reads of a multi-version Hashtable
+  snapshotTests();
+
+  // snapshot reads of a MassTrans with version history
+  massSnapshotTests();
+
+  // snapshot isolation and read committed
+  isolationTests();
+
+  // checkpoint and restore
+  checkpointTests();
+
+  // redo logging and replication
+  logTests();
+
+  // workload traces
+  traceTests();
+
+  // pooled Masstree threadinfos and epochs
+  threadinfoTests();
+
+  // validation with duplicate read items
+  duplicateReadTests();
+
+  // skipping item lookups without read-my-writes
+  noReadMyWritesTests();
+
+  // phantom protection by key fingerprint
+  absentTests();
+
+  // growing the table under transactions
+  resizeTests();
+
+  // non-transactional parallel loads
+  bulkLoadTests();
+
+  // slab-allocated elements
+  slabTests();
+
+  // slab-backed TransAlloc
+  transAllocTests();
+
+  // batched lookups and puts
+  batchTests();
+
+  // short strings stored inline
+  inlineStrTests();
+
+  // commutative updates
+  commuteTests();
+
+  // conditional updates
+  {
+      Hashtable<int, int> ch;
+      conditionalTests(ch);
+      IntMassTrans<int> cm;
+      cm.thread_init();
+      conditionalTests(cm);
+  }
+
+  // transactional size
+  {
+      Hashtable<int, int> sh;
+      sizeTests(sh);
+      IntMassTrans<int> sm;
+      sm.thread_init();
+      sizeTests(sm);
+      assert(sm.approx_size() == 4);
+  }
+
+  // transactional scans
+  scanTests();
+
+  // partitioned containers
+  partitionTests();
+
   linkedListTests();
   
   queueTests();
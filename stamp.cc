@@ -0,0 +1,591 @@
+// STAMP application kernels (Minh et al., IISWC 2008) on STO's own
+// containers, so STO's STAMP numbers can be tracked in-tree instead of
+// through the external STAMP tree and its TL2 shim (tm.h).
+//
+//   vacation: a travel reservation system. Cars, flights and rooms are
+//     RBTree relations from id to availability and price; customers and
+//     their reservations live in a Hashtable. Clients make reservations
+//     (querying several items and booking the most expensive of each
+//     kind), delete customers (cancelling their reservations), and add
+//     and remove inventory.
+//   kmeans: k-means clustering. Each point's transaction adds it to its
+//     nearest cluster's TCounter accumulators, so concurrent additions
+//     commute instead of conflicting.
+//   intruder: network intrusion detection. Threads take packet
+//     fragments from a shared Queue, reassemble flows in a Hashtable,
+//     and scan each completed flow for an attack signature.
+//
+// --high selects STAMP's high-contention parameters; --scale multiplies
+// the problem size. --check verifies each kernel's invariants afterwards.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "RBTree.hh"
+#include "Queue.hh"
+#include "TCounter.hh"
+#include "clp.h"
+
+namespace {
+
+int nthreads = 1;
+unsigned scale = 1;
+bool high = false;
+bool run_check = false;
+unsigned seed = 1;
+
+double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Run f(t) on threads 0..nthreads-1 and wait for them.
+template <typename F>
+void run_threads(F f) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&f, t] {
+                TThread::set_id(t);
+                f(t);
+            });
+    for (auto& th : threads)
+        th.join();
+}
+
+
+// vacation
+
+enum { res_car = 0, res_flight, res_room, res_ntypes };
+
+struct reservation {
+    int used;
+    int free;
+    int total;
+    int price;
+};
+
+std::ostream& operator<<(std::ostream& w, const reservation& r) {
+    return w << "{used " << r.used << ", free " << r.free << ", total " << r.total
+             << ", price " << r.price << "}";
+}
+
+struct customer {
+    static constexpr int capacity = 16;
+    struct booking {
+        int type;
+        long id;
+        int price;
+    };
+    int n;
+    booking b[capacity];
+};
+
+class vacation {
+public:
+    typedef RBTree<long, reservation, false> relation_type;
+
+    vacation()
+        : nrelations_(16384 * scale), ntransactions_(65536 * scale),
+          nqueries_(high ? 4 : 2), query_percent_(high ? 60 : 90),
+          user_percent_(high ? 90 : 98), customers_(nrelations_ * 2) {
+        std::mt19937 rng(seed);
+        for (long id = 1; id <= nrelations_; ++id) {
+            for (auto& r : relations_) {
+                int n = 100 * (rng() % 5 + 1);
+                r.nontrans_insert(id, reservation{0, n, n, int(rng() % 5) * 10 + 50});
+            }
+            customers_.nontrans_insert(id, customer());
+        }
+    }
+
+    void run() {
+        run_threads([&](int t) {
+                std::mt19937 rng(seed + t + 1);
+                long range = std::max(long(nrelations_) * query_percent_ / 100, 1L);
+                for (long i = t; i < ntransactions_; i += nthreads) {
+                    unsigned action = rng() % 100;
+                    if (action < user_percent_)
+                        make_reservation(rng, range);
+                    else if (action & 1)
+                        delete_customer(rng() % range + 1);
+                    else
+                        update_tables(rng, range);
+                }
+            });
+    }
+
+    bool check() {
+        std::vector<int> refs[res_ntypes];
+        for (auto& v : refs)
+            v.assign(nrelations_ + 1, 0);
+        for (long id = 1; id <= nrelations_; ++id) {
+            customer c = customers_.unsafe_get(id);
+            for (int i = 0; i != c.n; ++i)
+                ++refs[c.b[i].type][c.b[i].id];
+        }
+        for (int type = 0; type != res_ntypes; ++type)
+            for (long id = 1; id <= nrelations_; ++id) {
+                reservation r;
+                if (!relations_[type].nontrans_find(id, r)) {
+                    if (refs[type][id])
+                        return false;
+                } else if (r.used + r.free != r.total || r.used != refs[type][id])
+                    return false;
+            }
+        return true;
+    }
+
+private:
+    long nrelations_;
+    long ntransactions_;
+    unsigned nqueries_;
+    unsigned query_percent_;
+    unsigned user_percent_;
+    relation_type relations_[res_ntypes];
+    Hashtable<long, customer> customers_;
+
+    void make_reservation(std::mt19937& rng, long range) {
+        int types[8];
+        long ids[8];
+        for (unsigned q = 0; q != nqueries_; ++q) {
+            types[q] = rng() % res_ntypes;
+            ids[q] = rng() % range + 1;
+        }
+        long cid = rng() % range + 1;
+        TRANSACTION {
+            int max_price[res_ntypes] = {-1, -1, -1};
+            long max_id[res_ntypes] = {0, 0, 0};
+            for (unsigned q = 0; q != nqueries_; ++q) {
+                relation_type& rel = relations_[types[q]];
+                if (rel.count(ids[q])) {
+                    reservation r = rel[ids[q]];
+                    if (r.price > max_price[types[q]]) {
+                        max_price[types[q]] = r.price;
+                        max_id[types[q]] = ids[q];
+                    }
+                }
+            }
+            if (max_id[0] || max_id[1] || max_id[2]) {
+                customer c;
+                if (!customers_.transGet(cid, c))
+                    c.n = 0;
+                for (int type = 0; type != res_ntypes; ++type)
+                    if (max_id[type] && c.n != customer::capacity) {
+                        relation_type& rel = relations_[type];
+                        reservation r = rel[max_id[type]];
+                        if (r.free > 0) {
+                            --r.free;
+                            ++r.used;
+                            rel[max_id[type]] = r;
+                            c.b[c.n++] = customer::booking{type, max_id[type], r.price};
+                        }
+                    }
+                customers_.transPut(cid, c);
+            }
+        } RETRY(true);
+    }
+
+    void delete_customer(long cid) {
+        TRANSACTION {
+            customer c;
+            if (customers_.transGet(cid, c)) {
+                for (int i = 0; i != c.n; ++i) {
+                    relation_type& rel = relations_[c.b[i].type];
+                    reservation r = rel[c.b[i].id];
+                    ++r.free;
+                    --r.used;
+                    rel[c.b[i].id] = r;
+                }
+                customers_.transDelete(cid);
+            }
+        } RETRY(true);
+    }
+
+    void update_tables(std::mt19937& rng, long range) {
+        int types[8];
+        long ids[8];
+        bool adds[8];
+        int prices[8];
+        for (unsigned q = 0; q != nqueries_; ++q) {
+            types[q] = rng() % res_ntypes;
+            ids[q] = rng() % range + 1;
+            adds[q] = rng() & 1;
+            prices[q] = int(rng() % 5) * 10 + 50;
+        }
+        TRANSACTION {
+            for (unsigned q = 0; q != nqueries_; ++q) {
+                relation_type& rel = relations_[types[q]];
+                if (!rel.count(ids[q])) {
+                    if (adds[q])
+                        rel[ids[q]] = reservation{0, 100, 100, prices[q]};
+                    continue;
+                }
+                reservation r = rel[ids[q]];
+                if (adds[q]) {
+                    r.free += 100;
+                    r.total += 100;
+                    r.price = prices[q];
+                } else if (r.free >= 100) {
+                    r.free -= 100;
+                    r.total -= 100;
+                } else
+                    continue;
+                if (r.total == 0)
+                    rel.erase(ids[q]);
+                else
+                    rel[ids[q]] = r;
+            }
+        } RETRY(true);
+    }
+};
+
+
+// kmeans
+
+class kmeans {
+public:
+    static constexpr int ndims = 16;
+    static constexpr int max_iterations = 20;
+
+    kmeans()
+        : npoints_(16384 * scale), nclusters_(high ? 15 : 40),
+          points_(npoints_ * ndims), membership_(npoints_, -1),
+          centers_(nclusters_ * ndims),
+          sums_(new TCounter<int64_t>[nclusters_ * ndims]),
+          counts_(new TCounter<int64_t>[nclusters_]) {
+        std::mt19937 rng(seed);
+        for (auto& x : points_)
+            x = rng() % 1000;
+        for (int c = 0; c != nclusters_; ++c)
+            for (int d = 0; d != ndims; ++d)
+                centers_[c * ndims + d] = points_[c * ndims + d];
+    }
+
+    void run() {
+        for (iterations_ = 1; iterations_ <= max_iterations; ++iterations_) {
+            std::vector<long> changed(nthreads, 0);
+            run_threads([&](int t) {
+                    for (long p = t; p < npoints_; p += nthreads) {
+                        int c = nearest(&points_[p * ndims]);
+                        changed[t] += membership_[p] != c;
+                        membership_[p] = c;
+                        TRANSACTION {
+                            ++counts_[c];
+                            for (int d = 0; d != ndims; ++d)
+                                sums_[c * ndims + d] += points_[p * ndims + d];
+                        } RETRY(true);
+                    }
+                });
+            long nchanged = 0;
+            for (long x : changed)
+                nchanged += x;
+            if (run_check && !check_sums())
+                sums_ok_ = false;
+            // new centers; empty clusters keep theirs
+            for (int c = 0; c != nclusters_; ++c) {
+                int64_t n = counts_[c].nontrans_read();
+                for (int d = 0; d != ndims; ++d) {
+                    if (n)
+                        centers_[c * ndims + d] = double(sums_[c * ndims + d].nontrans_read()) / n;
+                    sums_[c * ndims + d].nontrans_write(0);
+                }
+                counts_[c].nontrans_write(0);
+            }
+            if (nchanged * 1000 < npoints_)
+                break;
+        }
+    }
+
+    bool check() {
+        return sums_ok_;
+    }
+    int iterations() const {
+        return std::min(iterations_, max_iterations);
+    }
+
+private:
+    long npoints_;
+    int nclusters_;
+    std::vector<int> points_;
+    std::vector<int> membership_;
+    std::vector<double> centers_;
+    std::unique_ptr<TCounter<int64_t>[]> sums_;
+    std::unique_ptr<TCounter<int64_t>[]> counts_;
+    int iterations_ = 0;
+    bool sums_ok_ = true;
+
+    int nearest(const int* pt) const {
+        int best = 0;
+        double best_dist = 0;
+        for (int c = 0; c != nclusters_; ++c) {
+            double dist = 0;
+            for (int d = 0; d != ndims; ++d) {
+                double x = pt[d] - centers_[c * ndims + d];
+                dist += x * x;
+            }
+            if (c == 0 || dist < best_dist) {
+                best = c;
+                best_dist = dist;
+            }
+        }
+        return best;
+    }
+
+    // the accumulators hold exactly the points assigned to each cluster
+    bool check_sums() {
+        std::vector<int64_t> n(nclusters_, 0), s(nclusters_ * ndims, 0);
+        for (long p = 0; p != npoints_; ++p) {
+            ++n[membership_[p]];
+            for (int d = 0; d != ndims; ++d)
+                s[membership_[p] * ndims + d] += points_[p * ndims + d];
+        }
+        for (int c = 0; c != nclusters_; ++c) {
+            if (counts_[c].nontrans_read() != n[c])
+                return false;
+            for (int d = 0; d != ndims; ++d)
+                if (sums_[c * ndims + d].nontrans_read() != s[c * ndims + d])
+                    return false;
+        }
+        return true;
+    }
+};
+
+
+// intruder
+
+class intruder {
+public:
+    static constexpr int fragment_size = 16;
+    static constexpr int max_fragments = 8;
+    static constexpr unsigned stream_capacity = 1U << 20;
+    struct fragment {
+        int flow;
+        uint8_t index;
+        uint8_t nfragments;
+        uint8_t length;
+        char data[fragment_size];
+    };
+    struct assembly {
+        unsigned have;
+        int length;
+        char data[fragment_size * max_fragments];
+    };
+    typedef Queue<fragment, stream_capacity> stream_type;
+
+    intruder()
+        : nflows_(4096 * scale), attack_percent_(high ? 10 : 2),
+          nattacks_(0), stream_(new stream_type), flows_(nflows_) {
+        std::mt19937 rng(seed);
+        std::vector<fragment> frags;
+        for (int f = 0; f != nflows_; ++f) {
+            int length = rng() % (fragment_size * max_fragments - 15) + 16;
+            char data[fragment_size * max_fragments];
+            for (int i = 0; i != length; ++i)
+                data[i] = 'a' + rng() % 26;
+            if (rng() % 100 < attack_percent_) {
+                memcpy(data + rng() % (length - 5), "ATTACK", 6);
+                ++nattacks_;
+            }
+            int nfragments = (length + fragment_size - 1) / fragment_size;
+            for (int i = 0; i != nfragments; ++i) {
+                fragment fr;
+                fr.flow = f;
+                fr.index = i;
+                fr.nfragments = nfragments;
+                fr.length = std::min(fragment_size, length - i * fragment_size);
+                memcpy(fr.data, data + i * fragment_size, fr.length);
+                frags.push_back(fr);
+            }
+        }
+        always_assert(frags.size() < stream_capacity);
+        std::shuffle(frags.begin(), frags.end(), rng);
+        for (auto& fr : frags)
+            stream_->nontrans_push(fr);
+    }
+
+    void run() {
+        std::vector<long> completed(nthreads, 0), found(nthreads, 0);
+        run_threads([&](int t) {
+                while (1) {
+                    fragment fr;
+                    bool got = false;
+                    TRANSACTION {
+                        got = stream_->transFront(fr) && stream_->transPop();
+                    } RETRY(true);
+                    if (!got)
+                        break;
+                    assembly a;
+                    bool done = false;
+                    TRANSACTION {
+                        bool present = flows_.transGet(fr.flow, a);
+                        if (!present) {
+                            a.have = 0;
+                            a.length = 0;
+                        }
+                        memcpy(a.data + fr.index * fragment_size, fr.data, fr.length);
+                        a.have |= 1U << fr.index;
+                        a.length += fr.length;
+                        done = a.have == (1U << fr.nfragments) - 1;
+                        if (!done)
+                            flows_.transPut(fr.flow, a);
+                        else if (present)
+                            flows_.transDelete(fr.flow);
+                    } RETRY(true);
+                    if (done) {
+                        ++completed[t];
+                        found[t] += memmem(a.data, a.length, "ATTACK", 6) != nullptr;
+                    }
+                }
+            });
+        for (int t = 0; t != nthreads; ++t) {
+            completed_ += completed[t];
+            found_ += found[t];
+        }
+    }
+
+    bool check() {
+        return completed_ == nflows_ && found_ == nattacks_;
+    }
+    long attacks_found() const {
+        return found_;
+    }
+
+private:
+    int nflows_;
+    unsigned attack_percent_;
+    long nattacks_;
+    std::unique_ptr<stream_type> stream_;
+    Hashtable<int, assembly> flows_;
+    long completed_ = 0;
+    long found_ = 0;
+};
+
+
+enum { opt_nthreads = 1, opt_scale, opt_high, opt_seed, opt_check, opt_counters };
+
+const Clp_Option options[] = {
+    { "nthreads", 'j', opt_nthreads, Clp_ValInt, 0 },
+    { "scale", 0, opt_scale, Clp_ValUnsigned, 0 },
+    { "high", 0, opt_high, 0, Clp_Negate },
+    { "seed", 0, opt_seed, Clp_ValUnsigned, 0 },
+    { "check", 'c', opt_check, 0, Clp_Negate },
+    { "counters", 0, opt_counters, 0, Clp_Negate }
+};
+
+void help(const char* name) {
+    printf("Usage: %s [OPTIONS] vacation|kmeans|intruder\n\
+Options:\n\
+ -j, --nthreads=N, threads (default 1)\n\
+ --scale=S, multiply the problem size by S (default 1)\n\
+ --high, use STAMP's high-contention parameters\n\
+ --seed=N, random seed (default 1)\n\
+ -c, --check, check the kernel's invariants afterwards\n\
+ --counters, print STO's counters afterwards\n", name);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const char* app = nullptr;
+    bool print_counters = false;
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nthreads:
+            nthreads = clp->val.i;
+            break;
+        case opt_scale:
+            scale = std::max(clp->val.u, 1U);
+            break;
+        case opt_high:
+            high = !clp->negated;
+            break;
+        case opt_seed:
+            seed = clp->val.u;
+            break;
+        case opt_check:
+            run_check = !clp->negated;
+            break;
+        case opt_counters:
+            print_counters = !clp->negated;
+            break;
+        case Clp_NotOption:
+            app = clp->vstr;
+            break;
+        default:
+            help(argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (!app || nthreads < 1
+        || (strcmp(app, "vacation") && strcmp(app, "kmeans") && strcmp(app, "intruder"))) {
+        help(argv[0]);
+        exit(1);
+    }
+    if (unsigned(nthreads) > Transaction::max_threads())
+        Transaction::set_max_threads(nthreads);
+    // aborts come from the txp counters
+    if (!Transaction::profile_level())
+        Transaction::set_profile_all(1, Transaction::profile_timing());
+    TThread::set_id(0);
+
+    pthread_t advancer;
+    pthread_create(&advancer, nullptr, Transaction::epoch_advancer, nullptr);
+    pthread_detach(advancer);
+
+    bool ok = true;
+    double elapsed;
+    txp_counters before = Transaction::txp_counters_combined();
+    if (strcmp(app, "vacation") == 0) {
+        vacation v;
+        double start = now_seconds();
+        v.run();
+        elapsed = now_seconds() - start;
+        ok = !run_check || v.check();
+    } else if (strcmp(app, "kmeans") == 0) {
+        kmeans k;
+        double start = now_seconds();
+        k.run();
+        elapsed = now_seconds() - start;
+        printf("%d iterations\n", k.iterations());
+        ok = !run_check || k.check();
+    } else {
+        intruder in;
+        double start = now_seconds();
+        in.run();
+        elapsed = now_seconds() - start;
+        printf("%ld attacks found\n", in.attacks_found());
+        ok = !run_check || in.check();
+    }
+    txp_counters after = Transaction::txp_counters_combined();
+    Transaction::global_epochs.run = false;
+
+    unsigned long long starts = after.p(txp_total_starts) - before.p(txp_total_starts);
+    unsigned long long aborts = after.p(txp_total_aborts) - before.p(txp_total_aborts);
+    printf("%s%s: %d threads, %.3f s, %llu commits, %llu aborts (%.3f%%), throughput: %.0f txn/s\n",
+           app, high ? "-high" : "", nthreads, elapsed, starts - aborts, aborts,
+           100.0 * aborts / std::max(starts, 1ULL), (starts - aborts) / elapsed);
+    fflush(stdout);
+    if (print_counters)
+        Transaction::print_stats();
+    if (run_check) {
+        if (!ok) {
+            printf("consistency check FAILED\n");
+            return 1;
+        }
+        printf("consistency check passed\n");
+    }
+    return 0;
+}
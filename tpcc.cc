@@ -0,0 +1,868 @@
+// TPC-C New-Order and Payment on STO's own data structures, without Silo.
+//
+// Tables follow the TPC-C schema. Point-accessed tables (warehouse,
+// district, customer, stock, item, history) are Hashtables; ordered
+// tables (order, new-order, order-line, and the customer last-name index
+// Payment scans) are MassTrans trees with big-endian composite keys. The
+// W_YTD and D_YTD sums Payment adds to are TCounters, so concurrent
+// Payments don't conflict on them, or with New-Orders on the district
+// row.
+//
+// Warehouses are partitioned over threads: thread t runs transactions
+// for home warehouses t+1, t+1+N, ... (or warehouse t%W+1 when there are
+// fewer warehouses than threads). As the spec requires, 1% of New-Order
+// items come from, and 15% of Payments are for customers of, another
+// warehouse; --no-remote turns that off.
+//
+// Aborts per transaction type come from the thread's txp counters, read
+// around each transaction.
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "MassTrans.hh"
+#include "TCounter.hh"
+#include "clp.h"
+#include "placement.hh"
+
+namespace {
+
+constexpr unsigned nitems = 100000;
+constexpr unsigned districts_per_warehouse = 10;
+constexpr unsigned customers_per_district = 3000;
+constexpr unsigned initial_orders_per_district = 3000;
+// orders from this one on are undelivered: in new-order, with no carrier
+constexpr unsigned first_undelivered_order = 2101;
+
+int nwarehouses = 1;
+int nthreads = 1;
+int ntrans = 200000;
+double run_duration = 0;
+double neworder_percent = 51; // 45:43 as in the spec's minimum mix
+bool remote = true;
+bool print_counters = false;
+bool run_check = false;
+ThreadPlacement placement;
+volatile bool stop = false;
+
+struct warehouse_row {
+    char name[11];
+    char street_1[21];
+    char street_2[21];
+    char city[21];
+    char state[3];
+    char zip[10];
+    uint32_t tax; // in 1/10000
+};
+
+struct district_row {
+    char name[11];
+    char street_1[21];
+    char street_2[21];
+    char city[21];
+    char state[3];
+    char zip[10];
+    uint32_t tax; // in 1/10000
+    uint32_t next_o_id;
+};
+
+struct customer_row {
+    char first[17];
+    char middle[3];
+    char last[17];
+    char street_1[21];
+    char street_2[21];
+    char city[21];
+    char state[3];
+    char zip[10];
+    char phone[17];
+    char credit[3];
+    uint32_t since;
+    uint32_t discount; // in 1/10000
+    int64_t credit_lim; // amounts in cents
+    int64_t balance;
+    int64_t ytd_payment;
+    uint32_t payment_cnt;
+    uint32_t delivery_cnt;
+    char data[501];
+};
+
+struct history_row {
+    uint32_t c_id;
+    uint32_t c_d_id;
+    uint32_t c_w_id;
+    uint32_t d_id;
+    uint32_t w_id;
+    uint32_t date;
+    int64_t amount;
+    char data[25];
+};
+
+struct item_row {
+    uint32_t im_id;
+    char name[25];
+    int64_t price;
+    char data[51];
+};
+
+struct stock_row {
+    int32_t quantity;
+    char dist[districts_per_warehouse][25];
+    uint32_t ytd;
+    uint32_t order_cnt;
+    uint32_t remote_cnt;
+    char data[51];
+};
+
+struct order_row {
+    uint32_t c_id;
+    uint32_t entry_d;
+    uint32_t carrier_id; // 0 until delivered
+    uint8_t ol_cnt;
+    uint8_t all_local;
+};
+
+struct order_line_row {
+    uint32_t i_id;
+    uint32_t supply_w_id;
+    uint32_t delivery_d;
+    uint32_t quantity;
+    int64_t amount;
+    char dist_info[25];
+};
+
+// sums Payment adds to, per warehouse
+struct warehouse_ytd {
+    TCounter<int64_t> w_ytd;
+    TCounter<int64_t> d_ytd[districts_per_warehouse];
+};
+
+struct tpcc_db {
+    Hashtable<uint32_t, warehouse_row> warehouse;
+    Hashtable<uint32_t, district_row> district;
+    Hashtable<uint64_t, customer_row> customer;
+    Hashtable<uint64_t, history_row> history;
+    Hashtable<uint32_t, item_row> item;
+    Hashtable<uint64_t, stock_row> stock;
+    MassTrans<order_row> order;
+    MassTrans<char> new_order;
+    MassTrans<order_line_row> order_line;
+    MassTrans<uint32_t> customer_by_name;
+    std::vector<std::unique_ptr<warehouse_ytd> > ytd;
+
+    tpcc_db(unsigned w)
+        : warehouse(w), district(w * districts_per_warehouse),
+          customer(w * districts_per_warehouse * customers_per_district),
+          history(w * districts_per_warehouse * customers_per_district * 2),
+          item(nitems), stock(w * nitems) {
+        for (unsigned i = 0; i != w; ++i)
+            ytd.emplace_back(new warehouse_ytd);
+    }
+};
+
+uint32_t district_key(uint32_t w, uint32_t d) {
+    return w * districts_per_warehouse + d - 1;
+}
+uint64_t customer_key(uint32_t w, uint32_t d, uint32_t c) {
+    return (uint64_t(district_key(w, d)) << 32) | c;
+}
+uint64_t stock_key(uint32_t w, uint32_t i) {
+    return (uint64_t(w) << 32) | i;
+}
+
+// A MassTrans key: fields in big-endian order, so keys sort by field.
+class tree_key {
+public:
+    tree_key()
+        : n_(0) {
+    }
+    tree_key& u8(uint32_t x) {
+        s_[n_++] = x;
+        return *this;
+    }
+    tree_key& u16(uint32_t x) {
+        return u8(x >> 8).u8(x);
+    }
+    tree_key& u32(uint32_t x) {
+        return u16(x >> 16).u16(x);
+    }
+    // a string, NUL-padded to width
+    tree_key& chars(const char* x, int width) {
+        int len = std::min(int(strlen(x)), width);
+        memcpy(s_ + n_, x, len);
+        memset(s_ + n_ + len, 0, width - len);
+        n_ += width;
+        return *this;
+    }
+    lcdf::Str str() const {
+        return lcdf::Str(s_, n_);
+    }
+
+private:
+    char s_[48];
+    int n_;
+};
+
+tree_key order_key(uint32_t w, uint32_t d, uint32_t o) {
+    return tree_key().u16(w).u8(d).u32(o);
+}
+tree_key order_line_key(uint32_t w, uint32_t d, uint32_t o, uint32_t ol) {
+    return tree_key().u16(w).u8(d).u32(o).u8(ol);
+}
+tree_key customer_name_key(uint32_t w, uint32_t d, const char* last) {
+    return tree_key().u16(w).u8(d).chars(last, 16);
+}
+
+// TPC-C's random functions (clause 2.1.6 and 4.3.2)
+class tpcc_random {
+public:
+    explicit tpcc_random(uint32_t seed)
+        : gen_(seed) {
+    }
+    uint32_t uniform(uint32_t lo, uint32_t hi) {
+        return lo + gen_() % (hi - lo + 1);
+    }
+    uint32_t nurand(uint32_t a, uint32_t c, uint32_t lo, uint32_t hi) {
+        return (((uniform(0, a) | uniform(lo, hi)) + c) % (hi - lo + 1)) + lo;
+    }
+    // a random string of lo to hi letters in x, NUL-terminated
+    void astring(char* x, unsigned lo, unsigned hi) {
+        unsigned n = uniform(lo, hi);
+        for (unsigned i = 0; i != n; ++i)
+            x[i] = 'a' + uniform(0, 25);
+        x[n] = 0;
+    }
+    void nstring(char* x, unsigned lo, unsigned hi) {
+        unsigned n = uniform(lo, hi);
+        for (unsigned i = 0; i != n; ++i)
+            x[i] = '0' + uniform(0, 9);
+        x[n] = 0;
+    }
+    // a string that contains "ORIGINAL" 10% of the time
+    void data_string(char* x, unsigned lo, unsigned hi) {
+        astring(x, lo, hi);
+        if (uniform(1, 10) == 1) {
+            unsigned at = uniform(0, strlen(x) - 8);
+            memcpy(x + at, "ORIGINAL", 8);
+        }
+    }
+
+private:
+    std::mt19937 gen_;
+};
+
+// NURand's run-time constants, and the C_LAST used to load
+struct nurand_constants {
+    uint32_t c_last_load, c_last, c_id, ol_i_id;
+
+    explicit nurand_constants(tpcc_random& r) {
+        c_last_load = r.uniform(0, 255);
+        // clause 2.1.6.1: the run's C_LAST differs from the load's by
+        // 65..119, but not 96 or 112
+        uint32_t delta;
+        do
+            delta = r.uniform(65, 119);
+        while (delta == 96 || delta == 112);
+        c_last = (c_last_load + delta) % 256;
+        c_id = r.uniform(0, 1023);
+        ol_i_id = r.uniform(0, 8191);
+    }
+};
+nurand_constants* nurand_c;
+
+void last_name(char* x, unsigned n) {
+    static const char* syllables[] = {
+        "BAR", "OUGHT", "ABLE", "PRI", "PRES", "ESE", "ANTI", "CALLY", "ATION", "EING"
+    };
+    strcpy(x, syllables[n / 100]);
+    strcat(x, syllables[(n / 10) % 10]);
+    strcat(x, syllables[n % 10]);
+}
+
+uint32_t now() {
+    return time(nullptr);
+}
+
+void copy_string(char* dst, const char* src, size_t size) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = 0;
+}
+
+// Loading. Hashtable rows go in nontransactionally; tree rows with one
+// transaction per batch, so the trees see the same code paths as at run
+// time.
+class loader {
+public:
+    loader(tpcc_db& db, uint32_t seed)
+        : db_(db), r_(seed) {
+    }
+
+    void load_items() {
+        for (uint32_t i = 1; i <= nitems; ++i) {
+            item_row it;
+            it.im_id = r_.uniform(1, 10000);
+            r_.astring(it.name, 14, 24);
+            it.price = r_.uniform(100, 10000);
+            r_.data_string(it.data, 26, 50);
+            db_.item.nontrans_insert(i, it);
+        }
+    }
+
+    void load_warehouse(uint32_t w) {
+        warehouse_row wr;
+        r_.astring(wr.name, 6, 10);
+        address(wr.street_1, wr.street_2, wr.city, wr.state, wr.zip);
+        wr.tax = r_.uniform(0, 2000);
+        db_.warehouse.nontrans_insert(w, wr);
+        db_.ytd[w - 1]->w_ytd.nontrans_write(30000000);
+
+        for (uint32_t i = 1; i <= nitems; ++i) {
+            stock_row s;
+            s.quantity = r_.uniform(10, 100);
+            for (auto& d : s.dist)
+                r_.astring(d, 24, 24);
+            s.ytd = s.order_cnt = s.remote_cnt = 0;
+            r_.data_string(s.data, 26, 50);
+            db_.stock.nontrans_insert(stock_key(w, i), s);
+        }
+
+        for (uint32_t d = 1; d <= districts_per_warehouse; ++d) {
+            district_row dr;
+            r_.astring(dr.name, 6, 10);
+            address(dr.street_1, dr.street_2, dr.city, dr.state, dr.zip);
+            dr.tax = r_.uniform(0, 2000);
+            dr.next_o_id = initial_orders_per_district + 1;
+            db_.district.nontrans_insert(district_key(w, d), dr);
+            db_.ytd[w - 1]->d_ytd[d - 1].nontrans_write(3000000);
+            load_customers(w, d);
+            load_orders(w, d);
+        }
+    }
+
+private:
+    static constexpr unsigned batch = 100;
+    tpcc_db& db_;
+    tpcc_random r_;
+
+    void address(char* street_1, char* street_2, char* city, char* state, char* zip) {
+        r_.astring(street_1, 10, 20);
+        r_.astring(street_2, 10, 20);
+        r_.astring(city, 10, 20);
+        r_.astring(state, 2, 2);
+        r_.nstring(zip, 4, 4);
+        strcat(zip, "11111");
+    }
+
+    // rows are generated outside the transaction, so retries insert the
+    // same ones
+    void load_customers(uint32_t w, uint32_t d) {
+        std::vector<customer_row> cs;
+        std::vector<history_row> hs;
+        for (uint32_t c = 1; c <= customers_per_district; ++c) {
+            customer_row cr;
+            r_.astring(cr.first, 8, 16);
+            strcpy(cr.middle, "OE");
+            last_name(cr.last, c <= 1000 ? c - 1 : r_.nurand(255, nurand_c->c_last_load, 0, 999));
+            address(cr.street_1, cr.street_2, cr.city, cr.state, cr.zip);
+            r_.nstring(cr.phone, 16, 16);
+            cr.since = now();
+            strcpy(cr.credit, r_.uniform(1, 10) == 1 ? "BC" : "GC");
+            cr.credit_lim = 5000000;
+            cr.discount = r_.uniform(0, 5000);
+            cr.balance = -1000;
+            cr.ytd_payment = 1000;
+            cr.payment_cnt = 1;
+            cr.delivery_cnt = 0;
+            r_.astring(cr.data, 300, 500);
+            cs.push_back(cr);
+
+            history_row h;
+            h.c_id = c;
+            h.c_d_id = h.d_id = d;
+            h.c_w_id = h.w_id = w;
+            h.date = now();
+            h.amount = 1000;
+            r_.astring(h.data, 12, 24);
+            hs.push_back(h);
+        }
+        for (uint32_t c0 = 1; c0 <= customers_per_district; c0 += batch) {
+            uint32_t c1 = std::min(c0 + batch, customers_per_district + 1);
+            TRANSACTION {
+                for (uint32_t c = c0; c != c1; ++c) {
+                    const customer_row& cr = cs[c - 1];
+                    db_.customer.transPut(customer_key(w, d, c), cr);
+                    db_.customer_by_name.transPut(customer_name_key(w, d, cr.last).chars(cr.first, 16).u32(c).str(), c);
+                    db_.history.transPut(customer_key(w, d, c), hs[c - 1]);
+                }
+            } RETRY(true);
+        }
+    }
+
+    void load_orders(uint32_t w, uint32_t d) {
+        // customer ids are a random permutation
+        std::vector<uint32_t> cids;
+        for (uint32_t c = 1; c <= customers_per_district; ++c)
+            cids.push_back(c);
+        for (uint32_t i = cids.size() - 1; i > 0; --i)
+            std::swap(cids[i], cids[r_.uniform(0, i)]);
+
+        std::vector<order_row> os;
+        std::vector<order_line_row> lines;
+        for (uint32_t o = 1; o <= initial_orders_per_district; ++o) {
+            bool delivered = o < first_undelivered_order;
+            order_row orow;
+            orow.c_id = cids[o - 1];
+            orow.entry_d = now();
+            orow.carrier_id = delivered ? r_.uniform(1, 10) : 0;
+            orow.ol_cnt = r_.uniform(5, 15);
+            orow.all_local = 1;
+            os.push_back(orow);
+            for (uint32_t ol = 1; ol <= orow.ol_cnt; ++ol) {
+                order_line_row line;
+                line.i_id = r_.uniform(1, nitems);
+                line.supply_w_id = w;
+                line.delivery_d = delivered ? orow.entry_d : 0;
+                line.quantity = 5;
+                line.amount = delivered ? 0 : r_.uniform(1, 999999);
+                r_.astring(line.dist_info, 24, 24);
+                lines.push_back(line);
+            }
+        }
+        size_t line0 = 0;
+        for (uint32_t o0 = 1; o0 <= initial_orders_per_district; o0 += batch) {
+            uint32_t o1 = std::min(o0 + batch, initial_orders_per_district + 1);
+            size_t line1 = line0;
+            TRANSACTION {
+                line1 = line0;
+                for (uint32_t o = o0; o != o1; ++o) {
+                    const order_row& orow = os[o - 1];
+                    db_.order.transPut(order_key(w, d, o).str(), orow);
+                    if (o >= first_undelivered_order)
+                        db_.new_order.transPut(order_key(w, d, o).str(), char(0));
+                    for (uint32_t ol = 1; ol <= orow.ol_cnt; ++ol)
+                        db_.order_line.transPut(order_line_key(w, d, o, ol).str(), lines[line1++]);
+                }
+            } RETRY(true);
+            line0 = line1;
+        }
+    }
+};
+
+enum { tx_neworder, tx_payment, tx_count };
+const char* const tx_names[] = {"new-order", "payment"};
+
+struct tx_stats {
+    uint64_t commits;
+    uint64_t aborts;        // that retried
+    uint64_t commit_aborts; // of which at commit time
+    uint64_t rollbacks;     // New-Orders rolled back by design (clause 2.4.2.3)
+};
+
+// One worker thread.
+class worker {
+public:
+    worker(tpcc_db& db, int id)
+        : db_(db), id_(id), r_(id * 7919 + 17), history_seq_(0) {
+        memset(stats_, 0, sizeof(stats_));
+        for (int w = id + 1; w <= nwarehouses; w += nthreads)
+            home_.push_back(w);
+        if (home_.empty())
+            home_.push_back(id % nwarehouses + 1);
+    }
+
+    void run(int ntrans) {
+        for (int i = 0; run_duration > 0 ? !stop : i < ntrans; ++i) {
+            int type = r_.uniform(1, 10000) <= neworder_percent * 100 ? tx_neworder : tx_payment;
+            uint32_t w = home_[r_.uniform(0, home_.size() - 1)];
+            txp_counters& p = Transaction::tinfo[TThread::id()].p_;
+            uint64_t aborts = p.p(txp_total_aborts), commit_aborts = p.p(txp_commit_time_aborts);
+            bool committed = type == tx_neworder ? new_order(w) : payment(w);
+            tx_stats& s = stats_[type];
+            s.commits += committed;
+            s.rollbacks += !committed;
+            s.aborts += p.p(txp_total_aborts) - aborts - !committed;
+            s.commit_aborts += p.p(txp_commit_time_aborts) - commit_aborts;
+        }
+    }
+
+    const tx_stats& stats(int type) const {
+        return stats_[type];
+    }
+
+private:
+    tpcc_db& db_;
+    int id_;
+    tpcc_random r_;
+    std::vector<uint32_t> home_;
+    uint64_t history_seq_;
+    tx_stats stats_[tx_count];
+
+    uint32_t other_warehouse(uint32_t w) {
+        uint32_t x = r_.uniform(1, nwarehouses - 1);
+        return x >= w ? x + 1 : x;
+    }
+
+    // Returns false if the order rolled back.
+    bool new_order(uint32_t w) {
+        uint32_t d = r_.uniform(1, districts_per_warehouse);
+        uint32_t c = r_.nurand(1023, nurand_c->c_id, 1, customers_per_district);
+        unsigned ol_cnt = r_.uniform(5, 15);
+        bool rollback = r_.uniform(1, 100) == 1;
+        uint32_t i_ids[15], supply_w[15], quantity[15];
+        bool all_local = true;
+        for (unsigned ol = 0; ol != ol_cnt; ++ol) {
+            i_ids[ol] = r_.nurand(8191, nurand_c->ol_i_id, 1, nitems);
+            supply_w[ol] = w;
+            if (remote && nwarehouses > 1 && r_.uniform(1, 100) == 1) {
+                supply_w[ol] = other_warehouse(w);
+                all_local = false;
+            }
+            quantity[ol] = r_.uniform(1, 10);
+        }
+        if (rollback)
+            i_ids[ol_cnt - 1] = nitems + 1; // unused item
+
+        try {
+            TRANSACTION {
+                warehouse_row wr;
+                district_row dr;
+                customer_row cr;
+                always_assert(db_.warehouse.transGet(w, wr));
+                always_assert(db_.district.transGet(district_key(w, d), dr));
+                uint32_t o = dr.next_o_id++;
+                db_.district.transPut(district_key(w, d), dr);
+                always_assert(db_.customer.transGet(customer_key(w, d, c), cr));
+
+                order_row orow;
+                orow.c_id = c;
+                orow.entry_d = now();
+                orow.carrier_id = 0;
+                orow.ol_cnt = ol_cnt;
+                orow.all_local = all_local;
+                db_.order.transInsert(order_key(w, d, o).str(), orow);
+                db_.new_order.transInsert(order_key(w, d, o).str(), char(0));
+
+                int64_t total = 0;
+                for (unsigned ol = 0; ol != ol_cnt; ++ol) {
+                    item_row it;
+                    if (!db_.item.transGet(i_ids[ol], it)) {
+                        // RETRY(!rollback) rethrows this abort
+                        Sto::abort();
+                    }
+                    stock_row s;
+                    always_assert(db_.stock.transGet(stock_key(supply_w[ol], i_ids[ol]), s));
+                    if (s.quantity >= int32_t(quantity[ol] + 10))
+                        s.quantity -= quantity[ol];
+                    else
+                        s.quantity += 91 - quantity[ol];
+                    s.ytd += quantity[ol];
+                    ++s.order_cnt;
+                    s.remote_cnt += supply_w[ol] != w;
+                    db_.stock.transPut(stock_key(supply_w[ol], i_ids[ol]), s);
+
+                    order_line_row line;
+                    line.i_id = i_ids[ol];
+                    line.supply_w_id = supply_w[ol];
+                    line.delivery_d = 0;
+                    line.quantity = quantity[ol];
+                    line.amount = quantity[ol] * it.price;
+                    memcpy(line.dist_info, s.dist[d - 1], sizeof(line.dist_info));
+                    db_.order_line.transInsert(order_line_key(w, d, o, ol + 1).str(), line);
+                    total += line.amount;
+                }
+                // the spec only displays the total
+                total = total * (10000 - cr.discount) / 10000 * (10000 + wr.tax + dr.tax) / 10000;
+                (void) total;
+            } RETRY(!rollback);
+        } catch (Transaction::Abort) {
+            return false;
+        }
+        return true;
+    }
+
+    bool payment(uint32_t w) {
+        uint32_t d = r_.uniform(1, districts_per_warehouse);
+        uint32_t c_w = w, c_d = d;
+        if (remote && nwarehouses > 1 && r_.uniform(1, 100) <= 15) {
+            c_w = other_warehouse(w);
+            c_d = r_.uniform(1, districts_per_warehouse);
+        }
+        bool by_name = r_.uniform(1, 100) <= 60;
+        char last[17];
+        uint32_t c = 0;
+        if (by_name)
+            last_name(last, r_.nurand(255, nurand_c->c_last, 0, 999));
+        else
+            c = r_.nurand(1023, nurand_c->c_id, 1, customers_per_district);
+        int64_t amount = r_.uniform(100, 500000);
+        // above the loaded history's customer_key()s
+        uint64_t h_key = (uint64_t(id_ + 1) << 52) | history_seq_;
+
+        TRANSACTION {
+            warehouse_row wr;
+            district_row dr;
+            customer_row cr;
+            always_assert(db_.warehouse.transGet(w, wr));
+            db_.ytd[w - 1]->w_ytd += amount;
+            always_assert(db_.district.transGet(district_key(w, d), dr));
+            db_.ytd[w - 1]->d_ytd[d - 1] += amount;
+
+            uint32_t cid = c;
+            if (by_name) {
+                // the customer in the middle, by first name, of those
+                // with this last name (clause 2.5.2.2)
+                std::vector<uint32_t> ids;
+                tree_key lo = customer_name_key(c_w, c_d, last);
+                tree_key hi = customer_name_key(c_w, c_d, last).u8(0xFF);
+                db_.customer_by_name.transQuery(lo.str(), hi.str(), [&](lcdf::Str, uint32_t id) {
+                        ids.push_back(id);
+                        return true;
+                    });
+                always_assert(!ids.empty());
+                cid = ids[(ids.size() + 1) / 2 - 1];
+            }
+            always_assert(db_.customer.transGet(customer_key(c_w, c_d, cid), cr));
+            cr.balance -= amount;
+            cr.ytd_payment += amount;
+            ++cr.payment_cnt;
+            if (strcmp(cr.credit, "BC") == 0) {
+                char buf[sizeof(cr.data)];
+                int n = snprintf(buf, sizeof(buf), "%u %u %u %u %u %lld|",
+                                 cid, c_d, c_w, d, w, (long long) amount);
+                copy_string(buf + n, cr.data, sizeof(buf) - n);
+                memcpy(cr.data, buf, sizeof(cr.data));
+            }
+            db_.customer.transPut(customer_key(c_w, c_d, cid), cr);
+
+            history_row h;
+            h.c_id = cid;
+            h.c_d_id = c_d;
+            h.c_w_id = c_w;
+            h.d_id = d;
+            h.w_id = w;
+            h.date = now();
+            h.amount = amount;
+            snprintf(h.data, sizeof(h.data), "%s    %s", wr.name, dr.name);
+            db_.history.transInsert(h_key, h);
+        } RETRY(true);
+        ++history_seq_;
+        return true;
+    }
+};
+
+// Consistency conditions 1 and 2 (clause 3.3.2): W_YTD is the sum of
+// its D_YTDs, and D_NEXT_O_ID - 1 is the district's highest order id.
+bool check(tpcc_db& db) {
+    bool ok = true;
+    for (int w = 1; w <= nwarehouses; ++w) {
+        warehouse_ytd& y = *db.ytd[w - 1];
+        int64_t sum = 0;
+        for (auto& d : y.d_ytd)
+            sum += d.nontrans_read();
+        if (y.w_ytd.nontrans_read() != sum) {
+            fprintf(stderr, "warehouse %d: W_YTD %lld != sum of D_YTD %lld\n",
+                    w, (long long) y.w_ytd.nontrans_read(), (long long) sum);
+            ok = false;
+        }
+        for (uint32_t d = 1; d <= districts_per_warehouse; ++d) {
+            district_row dr;
+            order_row orow;
+            bool last, next;
+            TRANSACTION {
+                always_assert(db.district.transGet(district_key(w, d), dr));
+                last = db.order.transGet(order_key(w, d, dr.next_o_id - 1).str(), orow);
+                next = db.order.transGet(order_key(w, d, dr.next_o_id).str(), orow);
+            } RETRY(true);
+            if (!last || next) {
+                fprintf(stderr, "district %d/%u: D_NEXT_O_ID %u isn't one past the last order\n",
+                        w, d, dr.next_o_id);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+enum {
+    opt_nthreads = 1, opt_warehouses, opt_ntrans, opt_duration, opt_neworder, opt_remote,
+    opt_counters, opt_pin, opt_check
+};
+
+const Clp_Option options[] = {
+    { "nthreads", 'j', opt_nthreads, Clp_ValInt, 0 },
+    { "warehouses", 'w', opt_warehouses, Clp_ValInt, 0 },
+    { "ntrans", 0, opt_ntrans, Clp_ValInt, 0 },
+    { "duration", 0, opt_duration, Clp_ValDouble, 0 },
+    { "new-order", 0, opt_neworder, Clp_ValDouble, 0 },
+    { "remote", 0, opt_remote, 0, Clp_Negate },
+    { "counters", 0, opt_counters, 0, Clp_Negate },
+    { "pin", 0, opt_pin, Clp_ValString, 0 },
+    { "check", 'c', opt_check, 0, Clp_Negate },
+};
+
+void help(const char* name) {
+    printf("Usage: %s [OPTIONS]\n\
+Options:\n\
+ -j, --nthreads=N, worker threads (default 1)\n\
+ -w, --warehouses=W, warehouses (default: one per thread)\n\
+ --ntrans=N, transactions to run, split between threads (default %d)\n\
+ --duration=S, run for S seconds instead\n\
+ --new-order=PCT, percent of New-Order transactions; the rest are Payments (default %g)\n\
+ --no-remote, only use home warehouses\n\
+ --counters, print STO's counters afterwards\n\
+ -c, --check, check consistency conditions 1 and 2 afterwards\n\
+ --pin=compact|scatter|CPULIST, pin threads as in concurrent\n",
+           name, ntrans, neworder_percent);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    bool warehouses_set = false;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nthreads:
+            nthreads = clp->val.i;
+            break;
+        case opt_warehouses:
+            nwarehouses = clp->val.i;
+            warehouses_set = true;
+            break;
+        case opt_ntrans:
+            ntrans = clp->val.i;
+            break;
+        case opt_duration:
+            run_duration = clp->val.d;
+            break;
+        case opt_neworder:
+            neworder_percent = clp->val.d;
+            break;
+        case opt_remote:
+            remote = !clp->negated;
+            break;
+        case opt_counters:
+            print_counters = !clp->negated;
+            break;
+        case opt_check:
+            run_check = !clp->negated;
+            break;
+        case opt_pin:
+            if (!placement.set_pin(clp->vstr)) {
+                fprintf(stderr, "bad --pin %s\n", clp->vstr);
+                exit(1);
+            }
+            break;
+        default:
+            help(argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (!warehouses_set)
+        nwarehouses = nthreads;
+    if (nthreads < 1 || nwarehouses < 1 || nwarehouses > 65535) {
+        help(argv[0]);
+        exit(1);
+    }
+    if (unsigned(nthreads) > Transaction::max_threads())
+        Transaction::set_max_threads(nthreads);
+    // aborts per type come from the txp counters
+    if (!Transaction::profile_level())
+        Transaction::set_profile_all(1, Transaction::profile_timing());
+
+    MassTrans<char>::static_init();
+    tpcc_random r(now());
+    nurand_c = new nurand_constants(r);
+    tpcc_db* db = new tpcc_db(nwarehouses);
+
+    pthread_t advancer;
+    pthread_create(&advancer, nullptr, Transaction::epoch_advancer, nullptr);
+    pthread_detach(advancer);
+
+    // load one warehouse per thread at a time
+    double t0 = now_seconds();
+    {
+        std::vector<std::thread> loaders;
+        for (int t = 0; t < std::min(nthreads, nwarehouses); ++t)
+            loaders.emplace_back([=] {
+                    TThread::set_id(t);
+                    placement.pin_thread(t);
+                    MassTrans<char>::thread_init();
+                    loader l(*db, t + 1);
+                    if (t == 0)
+                        l.load_items();
+                    for (int w = t + 1; w <= nwarehouses; w += nthreads)
+                        l.load_warehouse(w);
+                });
+        for (auto& t : loaders)
+            t.join();
+    }
+    printf("loaded %d warehouses in %.3f s\n", nwarehouses, now_seconds() - t0);
+
+    std::vector<std::unique_ptr<worker> > workers;
+    for (int t = 0; t < nthreads; ++t)
+        workers.emplace_back(new worker(*db, t));
+    double start = now_seconds();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+                TThread::set_id(t);
+                placement.pin_thread(t);
+                MassTrans<char>::thread_init();
+                workers[t]->run(ntrans / nthreads + (t < ntrans % nthreads));
+            });
+    if (run_duration > 0) {
+        usleep(run_duration * 1000000);
+        stop = true;
+    }
+    for (auto& t : threads)
+        t.join();
+    double elapsed = now_seconds() - start;
+
+    uint64_t total = 0;
+    for (int type = 0; type != tx_count; ++type) {
+        tx_stats s = tx_stats();
+        for (auto& w : workers) {
+            const tx_stats& x = w->stats(type);
+            s.commits += x.commits;
+            s.aborts += x.aborts;
+            s.commit_aborts += x.commit_aborts;
+            s.rollbacks += x.rollbacks;
+        }
+        printf("%s: %llu commits (%.0f/s), %llu aborts (%.3f%%, %llu at commit)",
+               tx_names[type], (unsigned long long) s.commits, s.commits / elapsed,
+               (unsigned long long) s.aborts,
+               100.0 * s.aborts / std::max(s.commits + s.rollbacks + s.aborts, uint64_t(1)),
+               (unsigned long long) s.commit_aborts);
+        if (type == tx_neworder)
+            printf(", %llu rollbacks", (unsigned long long) s.rollbacks);
+        printf("\n");
+        total += s.commits + s.rollbacks;
+    }
+    printf("real time: %f\n", elapsed);
+    printf("%d warehouses, %d threads, throughput: %.0f txn/s\n", nwarehouses, nthreads, total / elapsed);
+    fflush(stdout);
+    if (print_counters)
+        Transaction::print_stats();
+    if (run_check) {
+        if (!check(*db))
+            return 1;
+        printf("consistency check passed\n");
+    }
+    return 0;
+}
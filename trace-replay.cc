@@ -0,0 +1,290 @@
+// Replays a workload trace (see TTrace.hh) against STO Hashtables, one
+// table per traced container id, to compare builds on a recorded
+// production workload.
+//
+// Every key the trace touches before inserting it is loaded first, with
+// a value of the largest size recorded for its container. Committed
+// transaction records are then rerun as TRANSACTION loops; aborted
+// attempts are left out, since the retries that committed are in the
+// trace. Records go to thread (recorded thread % N), keeping each traced
+// thread's order. With --speed=X, each transaction waits for its
+// recorded start time divided by X; by default transactions run as fast
+// as possible.
+//
+// --save=FILE writes "name value" result lines; --compare=FILE prints
+// the throughput and abort deltas against such a file and exits with
+// status 1 if throughput dropped more than --threshold percent.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "TTrace.hh"
+#include "clp.h"
+
+namespace {
+
+typedef Hashtable<uint64_t, std::string> table_type;
+
+double now_seconds() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+struct replay_table {
+    std::unique_ptr<table_type> t;
+    uint32_t max_value_size = 8;
+};
+
+void run_op(std::unordered_map<uint32_t, replay_table>& tables,
+            const TTrace::op& o, const std::string& value) {
+    table_type& t = *tables.at(o.container).t;
+    std::string v;
+    switch (o.type) {
+    case TTrace::op_get:
+        t.transGet(o.key, v);
+        break;
+    case TTrace::op_put:
+        t.transPut(o.key, value.substr(0, o.value_size));
+        break;
+    case TTrace::op_insert:
+        t.transInsert(o.key, value.substr(0, o.value_size));
+        break;
+    case TTrace::op_update:
+        t.transUpdate(o.key, value.substr(0, o.value_size));
+        break;
+    case TTrace::op_erase:
+        t.transDelete(o.key);
+        break;
+    }
+}
+
+bool save(const char* file, const std::vector<std::pair<std::string, double> >& results) {
+    FILE* f = fopen(file, "w");
+    if (!f)
+        return false;
+    for (auto& r : results)
+        fprintf(f, "%s %.6g\n", r.first.c_str(), r.second);
+    return fclose(f) == 0;
+}
+
+// Returns 1 if throughput regressed, 0 if not, -1 if file can't be read.
+int compare(const char* file, const std::vector<std::pair<std::string, double> >& results,
+            double threshold) {
+    FILE* f = fopen(file, "r");
+    if (!f)
+        return -1;
+    std::map<std::string, double> baseline;
+    char name[128];
+    double x;
+    while (fscanf(f, "%127s %lf", name, &x) == 2)
+        baseline[name] = x;
+    fclose(f);
+    int regressed = 0;
+    printf("\n%-20s %12s %12s %8s\n", "vs baseline", "baseline", "now", "change");
+    for (auto& r : results) {
+        auto it = baseline.find(r.first);
+        if (it == baseline.end() || !it->second) {
+            printf("%-20s %12s %12.6g\n", r.first.c_str(), "-", r.second);
+            continue;
+        }
+        double change = 100 * (r.second - it->second) / it->second;
+        bool bad = r.first == "throughput" && -change > threshold;
+        regressed |= bad;
+        printf("%-20s %12.6g %12.6g %+7.1f%%%s\n", r.first.c_str(), it->second,
+               r.second, change, bad ? "  REGRESSION" : "");
+    }
+    return regressed;
+}
+
+enum { opt_nthreads = 1, opt_speed, opt_repeat, opt_save, opt_compare, opt_threshold, opt_counters };
+
+const Clp_Option options[] = {
+    { "nthreads", 'j', opt_nthreads, Clp_ValInt, 0 },
+    { "speed", 0, opt_speed, Clp_ValDouble, 0 },
+    { "repeat", 'r', opt_repeat, Clp_ValUnsigned, 0 },
+    { "save", 0, opt_save, Clp_ValString, 0 },
+    { "compare", 0, opt_compare, Clp_ValString, 0 },
+    { "threshold", 0, opt_threshold, Clp_ValDouble, 0 },
+    { "counters", 0, opt_counters, 0, Clp_Negate }
+};
+
+void help(const char* name) {
+    printf("Usage: %s [OPTIONS] TRACE\n\
+Options:\n\
+ -j, --nthreads=N, replay threads (default 1)\n\
+ --speed=X, run at X times the recorded rate (default: as fast as possible)\n\
+ -r, --repeat=N, replay the trace N times (default 1)\n\
+ --save=FILE, write results to FILE\n\
+ --compare=FILE, compare results with FILE from --save\n\
+ --threshold=PCT, throughput drop counted as a regression (default 10)\n\
+ --counters, print STO's counters afterwards\n", name);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int nthreads = 1;
+    double speed = 0;
+    unsigned repeat = 1;
+    const char* trace_file = nullptr;
+    const char* save_file = nullptr;
+    const char* compare_file = nullptr;
+    double threshold = 10;
+    bool print_counters = false;
+
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nthreads:
+            nthreads = clp->val.i;
+            break;
+        case opt_speed:
+            speed = clp->val.d;
+            break;
+        case opt_repeat:
+            repeat = std::max(clp->val.u, 1U);
+            break;
+        case opt_save:
+            save_file = clp->vstr;
+            break;
+        case opt_compare:
+            compare_file = clp->vstr;
+            break;
+        case opt_threshold:
+            threshold = clp->val.d;
+            break;
+        case opt_counters:
+            print_counters = !clp->negated;
+            break;
+        case Clp_NotOption:
+            trace_file = clp->vstr;
+            break;
+        default:
+            help(argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (!trace_file || nthreads < 1) {
+        help(argv[0]);
+        exit(1);
+    }
+    if (unsigned(nthreads) > Transaction::max_threads())
+        Transaction::set_max_threads(nthreads);
+    // aborts come from the txp counters
+    if (!Transaction::profile_level())
+        Transaction::set_profile_all(1, Transaction::profile_timing());
+    TThread::set_id(0);
+
+    // read the trace, split by thread
+    std::vector<std::vector<TTrace::txn> > work(nthreads);
+    std::unordered_map<uint32_t, replay_table> tables;
+    std::unordered_map<uint32_t, std::unordered_map<uint64_t, bool> > preload;
+    size_t nrecords = 0, nops = 0;
+    {
+        TTrace::reader r(trace_file);
+        TTrace::txn t;
+        while (r.next(t)) {
+            ++nrecords;
+            for (auto& o : t.ops) {
+                replay_table& rt = tables[o.container];
+                rt.max_value_size = std::max(rt.max_value_size, o.value_size);
+                // load keys that exist before their first insert
+                preload[o.container].emplace(o.key, o.type != TTrace::op_insert);
+            }
+            if (t.committed) {
+                nops += t.ops.size();
+                work[t.thread % nthreads].push_back(std::move(t));
+            }
+        }
+        if (!r.ok()) {
+            fprintf(stderr, "%s: not a trace or truncated\n", trace_file);
+            return 1;
+        }
+    }
+    uint32_t max_value_size = 8;
+    for (auto& it : tables) {
+        it.second.t.reset(new table_type(preload[it.first].size() * 2 + 1));
+        for (auto& k : preload[it.first])
+            if (k.second)
+                it.second.t->put(k.first, std::string(it.second.max_value_size, 'v'));
+        max_value_size = std::max(max_value_size, it.second.max_value_size);
+    }
+    const std::string value(max_value_size, 'x');
+    size_t ntxn = 0;
+    for (auto& w : work)
+        ntxn += w.size();
+    printf("%zu records, %zu committed transactions, %zu operations, %zu containers\n",
+           nrecords, ntxn, nops, tables.size());
+
+    pthread_t advancer;
+    pthread_create(&advancer, nullptr, Transaction::epoch_advancer, nullptr);
+    pthread_detach(advancer);
+
+    txp_counters before = Transaction::txp_counters_combined();
+    double start = now_seconds();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&, t] {
+                TThread::set_id(t);
+                for (unsigned rep = 0; rep != repeat; ++rep) {
+                    double rep_start = now_seconds();
+                    for (auto& txn : work[t]) {
+                        if (speed > 0) {
+                            double due = rep_start + txn.start_us / 1e6 / speed;
+                            double wait = due - now_seconds();
+                            if (wait > 0)
+                                usleep(wait * 1e6);
+                        }
+                        TRANSACTION {
+                            for (auto& o : txn.ops)
+                                run_op(tables, o, value);
+                        } RETRY(true);
+                    }
+                }
+            });
+    for (auto& t : threads)
+        t.join();
+    double elapsed = now_seconds() - start;
+    txp_counters after = Transaction::txp_counters_combined();
+    Transaction::global_epochs.run = false;
+
+    double commits = double(ntxn) * repeat;
+    double aborts = after.p(txp_total_aborts) - before.p(txp_total_aborts);
+    std::vector<std::pair<std::string, double> > results = {
+        {"throughput", commits / elapsed},
+        {"aborts", aborts},
+        {"aborts_per_commit", aborts / std::max(commits, 1.0)}
+    };
+    printf("%d threads, %.3f s, throughput: %.0f txn/s, %.0f aborts (%.4f per commit)\n",
+           nthreads, elapsed, results[0].second, aborts, results[2].second);
+    fflush(stdout);
+    if (print_counters)
+        Transaction::print_stats();
+
+    if (save_file && !save(save_file, results)) {
+        perror(save_file);
+        return 1;
+    }
+    if (compare_file) {
+        int n = compare(compare_file, results, threshold);
+        if (n < 0) {
+            perror(compare_file);
+            return 1;
+        }
+        return n;
+    }
+    return 0;
+}
@@ -61,7 +61,11 @@ void array_init(array_type& arr) {
         arr.nontrans_put(i, 0);
 }
 
-int main() {
+void run_test(bool decentralized_tids) {
+    Transaction::decentralized_tids = decentralized_tids;
+    std::cout << (decentralized_tids ? "decentralized" : "global")
+              << " commit TIDs." << std::endl;
+
     array_type arr;
     array_init(arr);
 
@@ -70,6 +74,11 @@ int main() {
 
     tw.join();
     tr.join();
+}
+
+int main() {
+    run_test(false);
+    run_test(true);
 
     std::cout << "Test pass." << std::endl;
 
@@ -70,6 +70,8 @@ int main(int argc, char* argv[]) {
         printf("Asked for %d threads but MAX_THREADS is %d\n", nthreads, MAX_THREADS);
         exit(1);
     }
+    if (unsigned(nthreads) > Transaction::max_threads())
+        Transaction::set_max_threads(nthreads);
 
     pthread_t tids[nthreads];
     for (uintptr_t i = 0; i < nthreads; ++i)
@@ -1,16 +1,99 @@
 #include "sampling.hh"
+#include <stdio.h>
+#include <cmath>
 #include <iostream>
 
 using namespace StoSampling;
 
-int main() {
-    StoRandomDistribution *dist = new StoZipfDistribution(1000);
+// frequency of each index among nsamples samples of dist over [0, n)
+static std::vector<double> frequencies(const StoRandomDistribution& dist, size_t n, size_t nsamples) {
+    std::vector<double> f(n, 0.0);
+    index_t batch[100];
+    for (size_t i = 0; i < nsamples; i += 100) {
+        dist.sample_batch(batch, 100);
+        for (index_t x : batch) {
+            assert(x < n);
+            f[x] += 1.0 / nsamples;
+        }
+    }
+    return f;
+}
+
+static void check_zipf(double skew) {
+    const size_t n = 1000, nsamples = 1000000;
+    StoZipfDistribution dist(1, 0, n - 1, skew);
+    std::vector<double> f = frequencies(dist, n, nsamples);
+    double sum = 0;
+    for (size_t k = 1; k <= n; ++k)
+        sum += std::pow(double(k), -skew);
+    // the heaviest ranks, within 5 standard deviations
+    for (size_t k = 1; k <= 10; ++k) {
+        double p = std::pow(double(k), -skew) / sum;
+        double sd = std::sqrt(p * (1 - p) / nsamples);
+        assert(std::fabs(f[k - 1] - p) < 5 * sd);
+    }
+}
+
+void testZipf() {
+    check_zipf(1.0);
+    check_zipf(0.99);
+    check_zipf(0.5);
+    check_zipf(2.0);
+    // uniform
+    check_zipf(0.0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
 
-    for (int i = 0; i < 1000; ++i)
-        std::cout << dist->sample() << ", ";
-    std::cout << std::endl;
+void testZipfRange() {
+    StoZipfDistribution dist(2, 100, 199, 1.2);
+    for (int i = 0; i < 100000; ++i) {
+        index_t x = dist.sample();
+        assert(x >= 100 && x <= 199);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testZipfHuge() {
+    // no per-index state, so this is instant
+    const index_t n = index_t(1) << 40;
+    StoZipfDistribution dist(3, 0, n - 1, 0.8);
+    size_t top = 0;
+    for (int i = 0; i < 100000; ++i) {
+        index_t x = dist.sample();
+        assert(x < n);
+        top += x < 1000;
+    }
+    assert(top > 0 && top < 100000);
+    printf("PASS: %s\n", __FUNCTION__);
+}
 
-    delete dist;
+void testAlias() {
+    const size_t nsamples = 1000000;
+    weight_type w = {1, 0, 3, 0.5, 10, 0, 2.5, 3};
+    double sum = 20;
+    StoAliasDistribution dist(4, 0, w);
+    std::vector<double> f = frequencies(dist, w.size(), nsamples);
+    for (size_t i = 0; i != w.size(); ++i) {
+        double p = w[i] / sum;
+        double sd = std::sqrt(p * (1 - p) / nsamples);
+        if (p == 0)
+            assert(f[i] == 0);
+        else
+            assert(std::fabs(f[i] - p) < 5 * sd);
+    }
 
+    StoAliasDistribution shifted(5, 50, w);
+    for (int i = 0; i < 10000; ++i) {
+        index_t x = shifted.sample();
+        assert(x >= 50 && x < 50 + w.size() && w[x - 50] > 0);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testZipf();
+    testZipfRange();
+    testZipfHuge();
+    testAlias();
     return 0;
 }
@@ -0,0 +1,345 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "SkipList.hh"
+#include "SkipPriorityQueue.hh"
+
+template <typename L>
+void testSimple() {
+    L l;
+
+    {
+        TransactionGuard g;
+        assert(!l.transFind(1));
+        assert(l.transInsert(1));
+        assert(l.transInsert(3));
+        assert(!l.transInsert(1));
+        assert(l.transFind(1) && *l.transFind(1) == 1);
+        assert(l.size() == 2);
+    }
+
+    {
+        TransactionGuard g;
+        assert(l.transFind(3));
+        assert(!l.transFind(2));
+        assert(l.transDelete(1));
+        assert(!l.transDelete(1));
+        assert(!l.transDelete(2));
+        assert(!l.transFind(1));
+        assert(l.size() == 1);
+    }
+
+    int v;
+    assert(!l.find(1, v));
+    assert(l.find(3, v) && v == 3);
+    assert(l.nontrans_size() == 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadMyWrites() {
+    SkipList<std::string> l;
+    l.insert("b");
+
+    {
+        TransactionGuard g;
+        // insert-then-delete, delete-then-insert
+        assert(l.transInsert("a"));
+        assert(l.transDelete("a"));
+        assert(!l.transFind("a"));
+        assert(l.transDelete("b"));
+        assert(!l.transFind("b"));
+        assert(l.transInsert("b"));
+        assert(l.transFind("b"));
+        assert(!l.transInsert("b"));
+        assert(l.size() == 1);
+    }
+
+    {
+        TransactionGuard g;
+        assert(!l.transFind("a"));
+        assert(l.transFind("b"));
+        assert(l.size() == 1);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testManyElements() {
+    SkipList<int> l;
+    for (int i = 0; i < 4000; i += 100) {
+        TransactionGuard g;
+        for (int j = i; j != i + 100; ++j)
+            assert(l.transInsert((j * 7919) % 4000));
+    }
+
+    {
+        TransactionGuard g;
+        assert(l.size() == 4000);
+        int n = 0;
+        for (auto it = l.begin(); it != l.end(); ++it, ++n)
+            assert(*it == n);
+        assert(n == 4000);
+        for (int i = 0; i < 4000; i += 2)
+            assert(l.transDelete(i));
+    }
+
+    {
+        TransactionGuard g;
+        int n = 1;
+        for (int x : l) {
+            assert(x == n);
+            n += 2;
+        }
+        assert(n == 4001);
+        assert(l.size() == 2000);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDuplicates() {
+    SkipList<int, true> l;
+
+    {
+        TransactionGuard g;
+        assert(l.transInsert(5));
+        assert(l.transInsert(5));
+        assert(l.transInsert(4));
+    }
+
+    {
+        TransactionGuard g;
+        assert(l.size() == 3);
+        assert(l.transDelete(5));
+        assert(l.transFind(5));
+        assert(l.transDelete(5));
+        assert(!l.transFind(5));
+        assert(!l.transDelete(5));
+    }
+
+    {
+        TransactionGuard g;
+        assert(l.size() == 1);
+        assert(!l.transFind(5));
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrentInserts() {
+    SkipList<int> l;
+    const int nthreads = 4, per = 2000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i)
+        threads.emplace_back([&l, i] {
+            TThread::set_id(i);
+            for (int j = 0; j < per; j += 10) {
+                TRANSACTION {
+                    for (int k = j; k != j + 10; ++k)
+                        l.transInsert(k * nthreads + i);
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    TransactionGuard g;
+    int n = 0;
+    for (auto it = l.begin(); it != l.end(); ++it, ++n)
+        assert(*it == n);
+    assert(n == nthreads * per);
+    assert(l.size() == size_t(n));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConflicts() {
+    SkipList<int> l;
+    for (int i = 0; i < 100; i += 10)
+        l.insert(i);
+
+    {
+        // absent element, then inserted into the same gap
+        TestTransaction t1(1);
+        assert(!l.transFind(15));
+        l.transInsert(1000);
+
+        TestTransaction t2(2);
+        assert(l.transInsert(17));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // absent element, then an insert into a different gap
+        TestTransaction t1(1);
+        assert(!l.transFind(25));
+        l.transInsert(1001);
+
+        TestTransaction t2(2);
+        assert(l.transInsert(55));
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // found element, then deleted
+        TestTransaction t1(1);
+        assert(l.transFind(30));
+        l.transInsert(1002);
+
+        TestTransaction t2(2);
+        assert(l.transDelete(30));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // scan, then an insert into the scanned range
+        TestTransaction t1(1);
+        int n = 0;
+        for (auto it = l.begin(); it != l.end() && *it < 50; ++it)
+            ++n;
+        l.transInsert(1003);
+
+        TestTransaction t2(2);
+        assert(l.transInsert(45));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // someone else's uncommitted insert aborts us
+        TestTransaction t1(1);
+        assert(l.transInsert(61));
+
+        TestTransaction t2(2);
+        bool aborted = false;
+        try {
+            l.transFind(61);
+        } catch (Transaction::Abort e) {
+            aborted = true;
+        }
+        assert(aborted);
+        t1.use();
+        assert(t1.try_commit());
+    }
+
+    {
+        // size conflicts with any committed insert
+        TestTransaction t1(1);
+        size_t n = l.size();
+        l.transInsert(1004);
+
+        TestTransaction t2(2);
+        assert(l.transInsert(87));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+        (void) n;
+    }
+
+    {
+        TransactionGuard g;
+        assert(l.transFind(17) && l.transFind(55) && l.transFind(45) && l.transFind(61));
+        assert(!l.transFind(30));
+        assert(l.transFind(1001));
+        assert(!l.transFind(1000) && !l.transFind(1002) && !l.transFind(1003));
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPriorityQueue() {
+    SkipPriorityQueue<int> q;
+
+    {
+        TransactionGuard g;
+        assert(q.pop() == -1);
+        q.push(1);
+        q.push(3);
+        q.push(2);
+        q.push(3);
+        assert(q.top() == 3);
+        assert(q.pop() == 3);
+        assert(q.top() == 3);
+    }
+
+    {
+        // pops of the same element conflict
+        TestTransaction t1(1);
+        assert(q.pop() == 3);
+
+        TestTransaction t2(2);
+        assert(q.pop() == 3);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // a pop conflicts with a larger push
+        TestTransaction t1(1);
+        assert(q.pop() == 2);
+
+        TestTransaction t2(2);
+        q.push(5);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // but not with a smaller one
+        TestTransaction t1(1);
+        assert(q.pop() == 5);
+
+        TestTransaction t2(2);
+        q.push(0);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        TransactionGuard g;
+        assert(q.pop() == 2);
+        assert(q.pop() == 1);
+        assert(q.pop() == 0);
+        assert(q.pop() == -1);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRelaxedPriorityQueue() {
+    SkipPriorityQueue<int, true> q(4);
+    for (int i = 0; i != 100; ++i)
+        q.push_nontrans(i);
+
+    std::vector<bool> seen(100, false);
+    for (int i = 0; i != 100; ++i) {
+        TransactionGuard g;
+        int v = q.pop();
+        assert(v >= 0 && v < 100 && !seen[v]);
+        // never more than spread elements below the maximum
+        int larger = 0;
+        for (int j = v + 1; j != 100; ++j)
+            larger += !seen[j];
+        assert(larger < 4);
+        seen[v] = true;
+    }
+
+    {
+        TransactionGuard g;
+        assert(q.pop() == -1);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimple<SkipList<int> >();
+    testSimple<SkipList<int, false, DefaultCompare<int>, false> >();
+    testReadMyWrites();
+    testManyElements();
+    testDuplicates();
+    testConcurrentInserts();
+    testConflicts();
+    testPriorityQueue();
+    testRelaxedPriorityQueue();
+    return 0;
+}
@@ -0,0 +1,69 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <assert.h>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "TAdmission.hh"
+#include "TBox.hh"
+
+void testAdmission() {
+    TAdmission gate(0.1, 0.3);
+    // four threads' worth of aborts close the gate and shrink the cap
+    for (unsigned tid = 0; tid != 4; ++tid)
+        for (unsigned i = 0; i != TAdmission::sample_min; ++i)
+            gate.leave(tid, gate.enter(tid), false);
+    assert(gate.limit() == 0);
+    gate.adjust();
+    assert(gate.limit() == 3);
+    for (unsigned i = 0; i != TAdmission::sample_min; ++i)
+        gate.leave(0, gate.enter(0), i % 2);
+    gate.adjust();
+    assert(gate.limit() == 2);
+    // too few attempts change nothing
+    gate.leave(0, gate.enter(0), false);
+    gate.adjust();
+    assert(gate.limit() == 2);
+
+    // one slot: threads take turns, and every transaction commits
+    for (unsigned i = 0; i != TAdmission::sample_min; ++i)
+        gate.leave(0, gate.enter(0), false);
+    gate.adjust();
+    assert(gate.limit() == 1);
+    TBox<int> n;
+    std::vector<std::thread> threads;
+    for (int t = 1; t != 5; ++t)
+        threads.emplace_back([&, t] {
+                TThread::set_id(t);
+                for (int i = 0; i != 200; ++i)
+                    TRANSACTION_LIMITED(TransactionLimits().admit(gate)) {
+                        n = n + 1;
+                    } RETRY(true);
+            });
+    for (auto& th : threads)
+        th.join();
+    assert(n.nontrans_read() == 800);
+
+    // commits reopen the gate
+    for (int round = 0; round != 4 && gate.limit(); ++round) {
+        for (unsigned tid = 0; tid != 4; ++tid)
+            for (unsigned i = 0; i != TAdmission::sample_min; ++i)
+                gate.leave(tid, gate.enter(tid), true);
+        gate.adjust();
+    }
+    assert(gate.limit() == 0);
+
+    // the global gate applies to plain loops
+    Transaction::admission = &gate;
+    TRANSACTION {
+        n = 0;
+    } RETRY(true);
+    Transaction::admission = nullptr;
+    assert(n.nontrans_read() == 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testAdmission();
+    return 0;
+}
@@ -3,8 +3,12 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <set>
+#include <thread>
 #include "Transaction.hh"
 #include "TArray.hh"
+#include "TBlockArray.hh"
+#include "TBitset.hh"
 #include "TBox.hh"
 
 void testSimpleInt() {
@@ -263,6 +267,429 @@ void testNoOpacity1() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testLargeTransaction() {
+    // large enough to use the transaction's big item index
+    constexpr int n = 6000;
+    TArray<int, n> f;
+    for (int i = 0; i < n; i++)
+        f.nontrans_put(i, 0);
+
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; i++)
+            f[i] = i;
+        for (int i = n - 1; i >= 0; i--) {
+            int x = f[i];
+            assert(x == i);
+        }
+    }
+
+    {
+        TestTransaction t1(1);
+        int sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += f[i];
+        assert(sum == n * (n - 1) / 2);
+        f[0] = -1;
+
+        TestTransaction t2(2);
+        f[n - 1] = 0;
+        assert(t2.try_commit());
+
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testCommutative() {
+    TArray<int, 10> f;
+    for (int i = 0; i < 10; i++)
+        f.nontrans_put(i, i);
+
+    {
+        // commutative updates of a hot cell don't conflict
+        TestTransaction t1(1);
+        f.trans_add(0, 10);
+        f.trans_max(1, 20);
+        TestTransaction t2(2);
+        f.trans_add(0, 1);
+        f.trans_min(1, -1);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(f.nontrans_get(0) == 11);
+    assert(f.nontrans_get(1) == 20);
+
+    {
+        // reading the cell observes it
+        TestTransaction t1(1);
+        f.trans_add(0, 1);
+        assert(f[0] == 12);
+        TestTransaction t2(2);
+        f.trans_add(0, 1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(f.nontrans_get(0) == 12);
+
+    TArray<std::set<int>, 2> s;
+    {
+        TestTransaction t1(1);
+        s.trans_union(0, {1, 2});
+        TestTransaction t2(2);
+        s.trans_union(0, {2, 3});
+        s.trans_union(0, {4});
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(s.nontrans_get(0) == std::set<int>({1, 2, 3, 4}));
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRanges() {
+    TArray<int, 200> a;
+    TBlockArray<int, 200, 64> b;
+    int in[150], out[150];
+    for (int i = 0; i < 150; i++)
+        in[i] = i + 1;
+
+    {
+        TransactionGuard t;
+        a.trans_write_range(30, 150, in);
+        b.trans_write_range(30, 150, in);
+        // own writes show up, over committed elements around them
+        b.trans_read_range(0, 100, out);
+        for (int i = 0; i < 100; i++)
+            assert(out[i] == (i < 30 ? 0 : i - 29));
+        assert(b[30] == 1);
+        b[31] = -1;
+        assert(b[31] == -1);
+    }
+    assert(b.nontrans_get(29) == 0 && b.nontrans_get(31) == -1);
+    assert(b.nontrans_get(179) == 150 && b.nontrans_get(180) == 0);
+
+    {
+        TransactionGuard t;
+        a.trans_read_range(30, 150, out);
+        for (int i = 0; i < 150; i++)
+            assert(out[i] == i + 1);
+        b.trans_read_range(32, 148, out);
+        for (int i = 0; i < 148; i++)
+            assert(out[i] == i + 3);
+    }
+
+    {
+        // a write conflicts with readers of its block...
+        TestTransaction t1(1);
+        b.trans_read_range(0, 10, out);
+        b[199] = 1;
+        TestTransaction t2(2);
+        b[63] = 2;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // ...but not of other blocks
+        TestTransaction t1(1);
+        b.trans_read_range(0, 10, out);
+        b[199] = 1;
+        TestTransaction t2(2);
+        b[64] = 3;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(b.nontrans_get(63) == 2 && b.nontrans_get(64) == 3 && b.nontrans_get(199) == 1);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+template <unsigned Group>
+void testBitset() {
+    TBitset<1000, Group> b;
+
+    {
+        TransactionGuard t;
+        assert(b.trans_find_first(0, 1000) == 1000);
+        assert(b.trans_find_first_clear(0, 1000) == 0);
+        b.transSet(3);
+        b[64] = true;
+        b.trans_assign_range(100, 300, true);
+        b.transClear(200);
+        // own writes show up in tests and scans
+        assert(b.transTest(3) && b[64] && !b[65] && !b[200]);
+        assert(b.trans_find_first(4, 1000) == 64);
+        assert(b.trans_find_first(65, 1000) == 100);
+        assert(b.trans_find_first_clear(100, 1000) == 200);
+        assert(b.trans_count(0, 1000) == 301);
+    }
+    assert(b.nontrans_count() == 301);
+    assert(b.nontrans_test(399) && !b.nontrans_test(400) && !b.nontrans_test(200));
+
+    {
+        TransactionGuard t;
+        assert(b.trans_count(100, 400) == 299);
+        assert(b.trans_count(101, 102) == 1);
+        assert(b.trans_find_first_clear(201, 1000) == 400);
+        assert(b.trans_find_first(400, 1000) == 1000);
+        assert(b.trans_find_first(400, 400) == 400);
+        b.trans_assign_range(0, 1000, false);
+        b.transSet(999);
+        assert(b.trans_find_first(0, 1000) == 999);
+        assert(b.trans_count(0, 999) == 0);
+    }
+    assert(b.nontrans_count() == 1);
+
+    {
+        // a scan observes only the groups it needed
+        TestTransaction t1(1);
+        assert(b.trans_find_first_clear(0, 1000) == 0);
+        b.transSet(1);
+        TestTransaction t2(2);
+        b.transSet(998);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but conflicts with writes to any of them
+        TestTransaction t1(1);
+        assert(b.trans_find_first(2, 1000) == 998);
+        b.transSet(0);
+        TestTransaction t2(2);
+        b.transSet(Group * 64);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(b.nontrans_count() == 4);
+    assert(b.nontrans_test(Group * 64) && !b.nontrans_test(0));
+
+    {
+        // bits in the same group conflict; bits in other groups don't
+        TestTransaction t1(1);
+        assert(!b.transTest(500));
+        b.transSet(0);
+        TestTransaction t2(2);
+        b.transSet(500 / (Group * 64) * Group * 64 + Group * 64 - 1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+
+        TestTransaction t3(1);
+        assert(!b.transTest(500));
+        b.transSet(0);
+        TestTransaction t4(2);
+        b.transSet(500 / (Group * 64) * Group * 64 + Group * 64);
+        assert(t4.try_commit());
+        assert(t3.try_commit());
+    }
+
+    printf("PASS: %s<%u>\n", __FUNCTION__, Group);
+}
+
+template <TLayout L>
+void testLayout() {
+    TArray<std::string, 100, TOpaqueWrapped, L> f;
+
+    {
+        TransactionGuard t;
+        for (int i = 0; i < 100; i++)
+            f[i] = std::to_string(i);
+    }
+
+    {
+        // neighbouring elements don't conflict
+        TestTransaction t1(1);
+        assert(f.transGet(10) == "10");
+        f[10] = "a";
+        TestTransaction t2(2);
+        assert(f.transGet(11) == "11");
+        f[11] = "b";
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but the same element does
+        TestTransaction t1(1);
+        assert(f.transGet(12) == "12");
+        f[13] = "c";
+        TestTransaction t2(2);
+        f[12] = "d";
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    for (int i = 0; i < 100; i++)
+        assert(f.nontrans_get(i) == (i == 10 ? "a" : i == 11 ? "b" : i == 12 ? "d" : std::to_string(i)));
+
+    printf("PASS: %s<%d>\n", __FUNCTION__, int(L));
+}
+
+// nontrivial values are moved, not copied, from the write through install
+struct copy_counted {
+    static int ncopies;
+    std::string s;
+    copy_counted() = default;
+    copy_counted(std::string x)
+        : s(std::move(x)) {
+    }
+    copy_counted(const copy_counted& x)
+        : s(x.s) {
+        ++ncopies;
+    }
+    copy_counted(copy_counted&&) = default;
+    copy_counted& operator=(const copy_counted& x) {
+        s = x.s;
+        ++ncopies;
+        return *this;
+    }
+    copy_counted& operator=(copy_counted&&) = default;
+};
+int copy_counted::ncopies;
+
+void testMoveWrites() {
+    TArray<copy_counted, 4> f;
+    {
+        TransactionGuard t;
+        f[1] = copy_counted(std::string(100, 'x'));
+        f[2] = copy_counted("y");
+    }
+    assert(copy_counted::ncopies == 0);
+    assert(f.nontrans_get(1).s == std::string(100, 'x'));
+    assert(f.nontrans_get(2).s == "y");
+    copy_counted::ncopies = 0;
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// every policy works, falling back where this machine lacks huge pages
+void testPages() {
+    TPages::policy_type old = TPages::policy();
+    for (TPages::policy_type p : {TPages::normal, TPages::thp, TPages::huge_2m, TPages::huge_1g}) {
+        TPages::set_policy(p);
+        for (size_t size : {size_t(100), size_t(20000), size_t(3) << 20}) {
+            char* x = static_cast<char*>(TPages::allocate(size));
+            assert(uintptr_t(x) % CACHE_LINE_SIZE == 0);
+            assert(TPages::size(x) >= size);
+            x[0] = x[size - 1] = 1;
+            TPages::free(x);
+        }
+
+        typedef TArray<int, 1000000, TOpaqueWrapped, TLayout::split> big_array;
+        big_array* a = new big_array;
+        {
+            TransactionGuard t;
+            (*a)[999999] = 2;
+        }
+        assert(a->nontrans_get(999999) == 2);
+        delete a;
+    }
+    TPages::set_policy(old);
+
+    TPages::set_local(true);
+    void* x = TPages::allocate_local(20000);
+    assert(TPages::size(x) >= 20000);
+    TPages::free(x);
+    TPages::set_local(false);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testGroupCommit() {
+    Transaction::group_commit = true;
+    TArray<int, 10> a, b;
+    TBox<int> c;
+
+    {
+        // items of three objects, interleaved
+        TransactionGuard t;
+        for (int i = 0; i < 10; ++i) {
+            a[i] = i;
+            c = c + 1;
+            b[9 - i] = i;
+        }
+    }
+    for (int i = 0; i < 10; ++i) {
+        assert(a.nontrans_get(i) == i);
+        assert(b.nontrans_get(i) == 9 - i);
+    }
+    assert(c.nontrans_read() == 10);
+
+    {
+        // a failed check aborts without installing any group
+        TestTransaction t1(1);
+        int x = a[3];
+        b[1] = x;
+        c = x;
+        a[4] = x;
+
+        TestTransaction t2(2);
+        a[3] = 30;
+        assert(t2.try_commit());
+
+        assert(!t1.try_commit());
+    }
+    assert(a.nontrans_get(3) == 30);
+    assert(a.nontrans_get(4) == 4);
+    assert(b.nontrans_get(1) == 8);
+    assert(c.nontrans_read() == 10);
+
+    Transaction::group_commit = false;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testParallelInstall() {
+    // the pool takes thread ids that aren't live
+    TThread::set_id(TThread::id());
+    Transaction::parallel_install_threshold = 1024;
+    Transaction::start_install_pool(3);
+    constexpr int N = 5000;
+    auto a = new TArray<int, N>;
+    TBox<int> c;
+    volatile bool done = false;
+    std::thread reader([&] {
+            TThread::register_thread();
+            while (!done) {
+                int x, y;
+                TRANSACTION {
+                    x = (*a)[0];
+                    y = (*a)[N - 1];
+                } RETRY(true);
+                // a writer's items are never seen half installed
+                assert(x == y);
+            }
+            TThread::unregister_thread();
+        });
+    for (int round = 1; round <= 20; ++round) {
+        Transaction::group_commit = round % 2;
+        TRANSACTION {
+            for (int i = 0; i != N; ++i)
+                (*a)[i] = round;
+            c = round;
+        } RETRY(false);
+        for (int i = 0; i != N; ++i)
+            assert(a->nontrans_get(i) == round);
+        assert(c.nontrans_read() == round);
+    }
+    done = true;
+    reader.join();
+
+    // the locks are all released
+    {
+        TestTransaction t(0);
+        (*a)[N / 2] = -1;
+        assert(t.try_commit());
+    }
+    assert(a->nontrans_get(N / 2) == -1);
+    delete a;
+    Transaction::stop_install_pool();
+    Transaction::parallel_install_threshold = 0;
+    Transaction::group_commit = false;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -275,5 +702,18 @@ int main() {
     testConflictingModifyIter3();
     testOpacity1();
     testNoOpacity1();
+    testLargeTransaction();
+    testCommutative();
+    testRanges();
+    testBitset<1>();
+    testBitset<4>();
+    testBitset<8>();
+    testLayout<TLayout::packed>();
+    testLayout<TLayout::padded>();
+    testLayout<TLayout::split>();
+    testMoveWrites();
+    testPages();
+    testGroupCommit();
+    testParallelInstall();
     return 0;
 }
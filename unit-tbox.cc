@@ -5,7 +5,9 @@
 #include <vector>
 #include "Transaction.hh"
 #include "TBox.hh"
+#include "TLargeBox.hh"
 #include "StringWrapper.hh"
+#include "TWrapped.hh"
 
 #define GUARDED if (TransactionGuard tguard{})
 
@@ -128,6 +130,63 @@ void testOpacity1() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testOpacityExtensions() {
+    TBox<int> f, g, h;
+    unsigned old_extensions = Transaction::opacity_extensions;
+
+    for (int dtid = 0; dtid != 2; ++dtid) {
+        Transaction::decentralized_tids = dtid;
+
+        // one extension is allowed: g's new version revalidates f
+        Transaction::opacity_extensions = 1;
+        {
+            TestTransaction t1(1);
+            int x = f;
+            h = 1;
+
+            TestTransaction t2(2);
+            g = x + 1;
+            assert(t2.try_commit());
+
+            t1.use();
+            int y = g;
+            assert(y == x + 1);
+            assert(t1.try_commit());
+        }
+
+        // no more extensions: a newer version aborts
+        Transaction::opacity_extensions = 0;
+        bool aborted = false;
+        try {
+            TestTransaction t1(1);
+            int x = f;
+            h = 2;
+
+            TestTransaction t2(2);
+            g = x + 2;
+            assert(t2.try_commit());
+
+            t1.use();
+            (void) g.read();
+            assert(false && "shouldn't get here");
+        } catch (Transaction::Abort e) {
+            aborted = true;
+        }
+        assert(aborted);
+
+        // the retry's snapshot covers the new version
+        TRANSACTION {
+            int x = f;
+            int y = g;
+            assert(y == x + 2);
+        } RETRY(false);
+    }
+
+    Transaction::opacity_extensions = old_extensions;
+    Transaction::decentralized_tids = STO_DECENTRALIZED_TID;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 void testNoOpacity1() {
     TBox<int, TNonopaqueWrapped<int> > f, g;
     TBox<int, TNonopaqueWrapped<int> > box;
@@ -245,12 +304,169 @@ void testStringWrapper() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+// a word whose version the test can hold locked as another thread
+void testCommutative() {
+    TBox<int> a, b;
+
+    {
+        // commutative updates don't conflict with each other
+        TestTransaction t1(1);
+        a.trans_add(2);
+        b.trans_max(5);
+        TestTransaction t2(2);
+        a.trans_add(3);
+        a.trans_add(4);
+        b.trans_max(3);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(a.nontrans_read() == 9);
+    assert(b.nontrans_read() == 5);
+
+    {
+        // but a read turns them into a plain write...
+        TestTransaction t1(1);
+        a.trans_add(1);
+        assert(a == 10);
+        a.trans_add(1);
+        TestTransaction t2(2);
+        a.trans_add(1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(a.nontrans_read() == 10);
+
+    {
+        // ...as does mixing kinds, and so does a plain write
+        TransactionGuard t;
+        a.trans_add(5);
+        a.trans_min(12);
+        assert(a == 12);
+        b = 1;
+        b.trans_max(4);
+        b.trans_min(3);
+    }
+    assert(a.nontrans_read() == 12);
+    assert(b.nontrans_read() == 3);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testBlindWrite() {
+    TBox<int> a, b;
+
+    {
+        // an uncontended blind write installs
+        TransactionGuard t;
+        a.write_blind(1);
+    }
+    assert(a.nontrans_read() == 1);
+
+    {
+        // a lone blind write overtaken by a concurrent writer is dropped
+        TestTransaction t1(1);
+        a.write_blind(2);
+        TestTransaction t2(2);
+        a = 3;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(a.nontrans_read() == 3);
+
+    {
+        // with other items it is an ordinary write that never conflicts
+        TestTransaction t1(1);
+        a.write_blind(4);
+        assert(b == 0);
+        TestTransaction t2(2);
+        a = 5;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(a.nontrans_read() == 4);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+struct large_blob {
+    static int live;
+    int id;
+    char data[1020];
+
+    large_blob(int i = 0)
+        : id(i) {
+        memset(data, i, sizeof(data));
+        ++live;
+    }
+    large_blob(const large_blob& x)
+        : id(x.id) {
+        memcpy(data, x.data, sizeof(data));
+        ++live;
+    }
+    ~large_blob() {
+        --live;
+    }
+    large_blob& operator=(const large_blob& x) {
+        id = x.id;
+        memcpy(data, x.data, sizeof(data));
+        return *this;
+    }
+};
+int large_blob::live;
+
+void testLargeBox() {
+    TLargeBox<large_blob> b(1);
+    assert(large_blob::live == 1);
+
+    {
+        // reads don't copy
+        TransactionGuard t;
+        const large_blob& r = b.read();
+        assert(&r == &b.nontrans_read() && r.id == 1);
+        assert(large_blob::live == 1);
+    }
+
+    {
+        // a read reference stays valid after a concurrent commit
+        TestTransaction t1(1);
+        const large_blob& r = b;
+        TestTransaction t2(2);
+        b = large_blob(2);
+        b.modify().id = 3;
+        assert(t2.try_commit());
+        assert(r.id == 1 && r.data[0] == 1);
+        t1.use();
+        b = large_blob(4);
+        assert(!t1.try_commit());
+    }
+    assert(b.nontrans_read().id == 3 && b.nontrans_read().data[0] == 2);
+    // t1's copy is gone; only the replaced value may await RCU
+    assert(large_blob::live <= 2);
+
+    {
+        TransactionGuard t;
+        large_blob& w = b.modify();
+        w.id = 5;
+        assert(b.read().id == 5 && &b.read() == &w);
+        b = large_blob(6);
+        assert(&b.read() == &w && w.id == 6);
+    }
+    assert(b.nontrans_read().id == 6);
+
+    assert(large_blob::live <= 3);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
     testConcurrentInt();
     testOpacity1();
+    testOpacityExtensions();
     testNoOpacity1();
     testStringWrapper();
+    testCommutative();
+    testBlindWrite();
+    testLargeBox();
     return 0;
 }
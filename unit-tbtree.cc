@@ -0,0 +1,242 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "TBTree.hh"
+
+void testSimple() {
+    TBTree<int, int> t;
+
+    {
+        TransactionGuard g;
+        assert(t.count(1) == 0);
+        t[1] = 10;
+        t[2] = 20;
+        assert(t.count(1) == 1);
+        assert(int(t[1]) == 10);
+    }
+
+    {
+        TransactionGuard g;
+        int v;
+        assert(t.transGet(2, v) && v == 20);
+        assert(!t.transGet(3, v));
+        assert(t.erase(1) == 1);
+        assert(t.erase(1) == 0);
+        assert(t.erase(3) == 0);
+        assert(t.count(1) == 0);
+    }
+
+    {
+        TransactionGuard g;
+        assert(t.count(1) == 0);
+        assert(t.count(2) == 1);
+    }
+
+    int v;
+    assert(!t.nontrans_find(1, v));
+    assert(t.nontrans_find(2, v) && v == 20);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadMyWrites() {
+    TBTree<int, int> t;
+
+    {
+        // erase-my-insert, then insert-my-delete
+        TransactionGuard g;
+        t[5] = 1;
+        assert(t.erase(5) == 1);
+        assert(t.count(5) == 0);
+        t[5] = 2;
+        assert(t.count(5) == 1);
+        assert(int(t[5]) == 2);
+        t[6] = 3;
+        assert(t.erase(6) == 1);
+    }
+
+    {
+        TransactionGuard g;
+        assert(int(t[5]) == 2);
+        assert(t.count(6) == 0);
+        assert(t.erase(5) == 1);
+        t[5] = 7;
+    }
+
+    int v;
+    assert(t.nontrans_find(5, v) && v == 7);
+    assert(!t.nontrans_find(6, v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+template <typename K>
+void testManyKeys(K base) {
+    TBTree<K, int> t;
+    std::vector<K> keys;
+    for (int i = 0; i != 5000; ++i)
+        keys.push_back(base + K(i * 3));
+    std::mt19937 g(1);
+    std::shuffle(keys.begin(), keys.end(), g);
+
+    for (size_t i = 0; i < keys.size(); i += 100) {
+        TransactionGuard guard;
+        for (size_t j = i; j != i + 100; ++j)
+            t[keys[j]] = int(keys[j] - base);
+    }
+
+    {
+        TransactionGuard guard;
+        for (int i = 0; i != 5000 * 3; ++i)
+            assert(t.count(base + K(i)) == (i % 3 == 0));
+        int n = 0;
+        for (auto it = t.begin(); it != t.end(); ++it, ++n) {
+            assert(it->first == base + K(n * 3));
+            assert(int(it->second) == n * 3);
+        }
+        assert(n == 5000);
+    }
+
+    {
+        TransactionGuard guard;
+        for (int i = 0; i != 5000; i += 2)
+            assert(t.erase(base + K(i * 3)) == 1);
+    }
+
+    {
+        TransactionGuard guard;
+        int n = 1;
+        for (auto kv : t) {
+            assert(kv.first == base + K(n * 3));
+            n += 2;
+        }
+        assert(n == 5001);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConflicts() {
+    TBTree<int, int> t;
+    TBTree<int, int> other;
+    {
+        TransactionGuard g;
+        t[10] = 1;
+        other[0] = 0;
+    }
+
+    {
+        // value read, then overwritten
+        TestTransaction t1(1);
+        assert(int(t[10]) == 1);
+        other[0] = 1;
+
+        TestTransaction t2(2);
+        t[10] = 2;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // absent key, then inserted
+        TestTransaction t1(1);
+        assert(t.count(11) == 0);
+        other[0] = 2;
+
+        TestTransaction t2(2);
+        t[11] = 3;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // present key, then erased
+        TestTransaction t1(1);
+        assert(t.count(11) == 1);
+        other[0] = 3;
+
+        TestTransaction t2(2);
+        assert(t.erase(11) == 1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // scan, then a key inserted into the scanned range
+        TestTransaction t1(1);
+        int n = 0;
+        for (auto it = t.begin(); it != t.end(); ++it)
+            ++n;
+        assert(n == 1);
+        other[0] = 4;
+
+        TestTransaction t2(2);
+        t[12] = 4;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // our own insert doesn't invalidate our earlier absent read
+        TestTransaction t1(1);
+        assert(t.count(13) == 0);
+        t[14] = 5;
+        assert(t1.try_commit());
+    }
+
+    {
+        // an aborted insert leaves nothing behind
+        TestTransaction t1(1);
+        t[20] = 6;
+        Sto::silent_abort();
+    }
+
+    {
+        TransactionGuard g;
+        assert(t.count(20) == 0);
+        assert(int(t[10]) == 2);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrentInserts() {
+    TBTree<int, int> t;
+    const int nthreads = 4, per = 2000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i)
+        threads.emplace_back([&t, i] {
+            TThread::set_id(i);
+            for (int j = 0; j < per; j += 10) {
+                TRANSACTION {
+                    for (int k = j; k != j + 10; ++k)
+                        t[k * nthreads + i] = k;
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    TransactionGuard g;
+    int n = 0;
+    for (auto it = t.begin(); it != t.end(); ++it, ++n) {
+        assert(it->first == n);
+        assert(int(it->second) == n / nthreads);
+    }
+    assert(n == nthreads * per);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimple();
+    testReadMyWrites();
+    testManyKeys<int16_t>(-7000);
+    testManyKeys<int>(-7000);
+    testManyKeys<uint32_t>(0x7FFFF000U);
+    testManyKeys<int64_t>(-(int64_t(1) << 40));
+    testConcurrentInserts();
+    testConflicts();
+    return 0;
+}
@@ -0,0 +1,80 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <utility>
+#include "Transaction.hh"
+
+void testCapacity() {
+    // TransactionBuffer keeps its grown capacity and destroys only
+    // nontrivial items
+    TransactionBuffer buf;
+    size_t cap = 0;
+    for (int round = 0; round != 2; ++round) {
+        for (int i = 0; i != 10000; ++i)
+            Packer<std::pair<uintptr_t, uintptr_t> >::pack(buf, i, i);
+        buf.clear();
+        assert(buf.buffer_size() == 0);
+        if (round == 0)
+            cap = buf.buffer_capacity();
+        else
+            assert(buf.buffer_capacity() == cap);
+    }
+    unsigned destroyed = 0;
+    struct counted {
+        unsigned* n;
+        counted(unsigned* x) : n(x) {}
+        ~counted() { ++*n; }
+    };
+    for (int i = 0; i != 1000; ++i) {
+        Packer<counted>::pack(buf, &destroyed);
+        Packer<std::pair<uintptr_t, uintptr_t> >::pack(buf, i, i);
+    }
+    std::string big(100, 'x');
+    void* bk = Packer<std::string>::pack_unique(buf, big);
+    assert(Packer<std::string>::pack_unique(buf, big) == bk);
+    buf.clear();
+    assert(destroyed == 1000);
+    // big chunks may be mapped separately
+    auto* huge = buf.allocate<std::array<char, (3 << 20)> >();
+    (*huge)[(3 << 20) - 1] = 1;
+    buf.clear();
+    assert(buf.buffer_capacity() >= (3 << 20));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testUniqueKeys() {
+    // hashed unique keys: many keys, keys of different types with equal
+    // hashes, and keys forgotten by rollback
+    TransactionBuffer buf;
+    std::vector<void*> ks;
+    for (int i = 0; i != 5000; ++i)
+        ks.push_back(Packer<std::string>::pack_unique(buf, std::to_string(i)));
+    for (int i = 0; i != 5000; ++i) {
+        assert(Packer<std::string>::pack_unique(buf, std::to_string(i)) == ks[i]);
+        assert(Packer<std::string>::unpack(ks[i]) == std::to_string(i));
+    }
+    typedef std::pair<uintptr_t, uintptr_t> pair_type;
+    void* pk = Packer<pair_type>::pack_unique(buf, pair_type(1, 2));
+    assert(Packer<pair_type>::pack_unique(buf, pair_type(1, 2)) == pk);
+    auto m = buf.mark();
+    void* a = Packer<std::string>::pack_unique(buf, "after mark");
+    assert(Packer<std::string>::pack_unique(buf, "after mark") == a);
+    buf.rollback(m);
+    void* b = Packer<std::string>::pack_unique(buf, "after mark");
+    assert(Packer<std::string>::unpack(b) == "after mark");
+    assert(Packer<std::string>::pack_unique(buf, "0") == ks[0]);
+    buf.clear();
+    void* c = Packer<std::string>::pack_unique(buf, "0");
+    assert(Packer<std::string>::unpack(c) == "0");
+    assert(Packer<std::string>::pack_unique(buf, "0") == c);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testCapacity();
+    testUniqueKeys();
+    return 0;
+}
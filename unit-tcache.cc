@@ -0,0 +1,173 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "TCache.hh"
+#include "TBox.hh"
+#include "randgen.hh"
+
+void testBasic() {
+    TCache<int, std::string> c(1000);
+    std::string v;
+
+    {
+        TransactionGuard t;
+        assert(!c.transGet(1, v));
+        c.transPut(1, "one", 100);
+        c.transPut(2, "two", 200);
+        assert(c.transGet(1, v) && v == "one");
+        // replacing a key charges the difference
+        c.transPut(2, "zwei", 250);
+        assert(c.transGet(2, v) && v == "zwei");
+    }
+    assert(c.nontrans_bytes() == 350);
+
+    {
+        TransactionGuard t;
+        assert(c.transErase(1));
+        assert(!c.transErase(1));
+        assert(!c.transGet(1, v));
+        c.transPut(3, "three", 10);
+        assert(c.transErase(3));
+    }
+    assert(c.nontrans_bytes() == 250);
+    assert(!c.nontrans_get(1, v) && !c.nontrans_get(3, v));
+    assert(c.nontrans_get(2, v) && v == "zwei");
+
+    {
+        // aborted transactions charge nothing
+        TestTransaction t(1);
+        c.transPut(4, "four", 500);
+        Sto::silent_abort();
+    }
+    assert(c.nontrans_bytes() == 250);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testEviction() {
+    TCache<int, int> c(10 * 8);
+    for (int i = 0; i != 10; ++i) {
+        TransactionGuard t;
+        c.transPut(i, i, 8);
+    }
+    assert(c.nontrans_bytes() == 80);
+
+    {
+        // hits protect keys from the next sweep
+        TransactionGuard t;
+        int v;
+        for (int i = 0; i != 5; ++i)
+            assert(c.transGet(i, v) && v == i);
+    }
+    for (int i = 10; i != 15; ++i) {
+        TransactionGuard t;
+        c.transPut(i, i, 8);
+    }
+    assert(c.nontrans_bytes() == 80);
+    int v;
+    for (int i = 0; i != 15; ++i)
+        assert(c.nontrans_get(i, v) == (i < 5 || i >= 10));
+
+    // a big entry evicts as much as it needs, but not itself
+    {
+        TransactionGuard t;
+        c.transPut(100, 100, 80);
+    }
+    assert(c.nontrans_bytes() <= 80);
+    assert(c.nontrans_get(100, v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConflicts() {
+    TCache<int, int> c(8);
+    // the boxes make each transaction validate its reads at commit
+    TBox<int> b1, b2;
+    int v;
+    {
+        TransactionGuard t;
+        c.transPut(1, 1, 8);
+    }
+
+    {
+        // hits don't conflict with each other
+        TestTransaction t1(1);
+        assert(c.transGet(1, v));
+        b1 = 1;
+        TestTransaction t2(2);
+        assert(c.transGet(1, v));
+        b2 = 1;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but a hit conflicts with a put of its key
+        TestTransaction t1(1);
+        assert(c.transGet(1, v) && v == 1);
+        b1 = 2;
+        TestTransaction t2(2);
+        c.transPut(1, 2, 8);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // and with its eviction
+        TestTransaction t1(1);
+        assert(c.transGet(1, v) && v == 2);
+        b1 = 3;
+        TestTransaction t2(2);
+        c.transPut(2, 2, 8);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(!c.nontrans_get(1, v) && c.nontrans_get(2, v));
+    assert(c.nontrans_bytes() == 8);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrent() {
+    TCache<int, int> c(200 * 8);
+    const int nthreads = 4, ntxns = 20000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i)
+        threads.emplace_back([&c, i] {
+            TThread::set_id(i);
+            Rand r(i + 1, i + 2);
+            for (int n = 0; n != ntxns; ++n) {
+                TRANSACTION {
+                    for (int j = 0; j != 4; ++j) {
+                        int k = r() % 1000, v;
+                        if (c.transGet(k, v))
+                            assert(v == k);
+                        else
+                            c.transPut(k, k, 8);
+                    }
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    // every charge was matched by an entry or an eviction
+    TransactionGuard t;
+    size_t present = 0;
+    for (int k = 0; k != 1000; ++k) {
+        int v;
+        present += c.transGet(k, v);
+    }
+    assert(c.nontrans_bytes() == present * 8);
+    assert(c.nontrans_bytes() <= c.budget());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testBasic();
+    testEviction();
+    testConflicts();
+    testConcurrent();
+    return 0;
+}
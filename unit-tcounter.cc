@@ -4,8 +4,10 @@
 #include <assert.h>
 #include <vector>
 #include <algorithm>
+#include <thread>
 #include "Transaction.hh"
 #include "TCounter.hh"
+#include "TShardedCounter.hh"
 #include "TBox.hh"
 
 void testTrivial() {
@@ -394,6 +396,117 @@ void testNoOpacity() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testShardedUpdate() {
+    TShardedCounter<int, 4> c;
+    TBox<int> box;
+    bool b;
+
+    {
+        // increments from different threads don't conflict
+        TestTransaction t1(1);
+        ++c;
+        TestTransaction t2(2);
+        c += 5;
+        TestTransaction t3(5);
+        c -= 2;
+        assert(t2.try_commit());
+        assert(t3.try_commit());
+        assert(t1.try_commit());
+        assert(c.nontrans_read() == 4);
+    }
+
+    {
+        // nor with a predicate they don't break
+        TestTransaction t1(1);
+        b = c > 0;
+        assert(b);
+        box = 1; /* avoid read-only txn */
+
+        TestTransaction t2(2);
+        c += 100;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but they do conflict with one they break
+        TestTransaction t1(1);
+        b = c < 200;
+        assert(b);
+        box = 2;
+
+        TestTransaction t2(3);
+        c += 100;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // exact reads include our own increments
+        TestTransaction t1(1);
+        c += 3;
+        int x = c;
+        assert(x == 207);
+        ++c;
+        b = c == 208;
+        assert(b);
+
+        TestTransaction t2(2);
+        ++c;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+        assert(c.nontrans_read() == 205);
+    }
+
+    {
+        // assignment replaces every shard
+        TransactionGuard t;
+        c = 10;
+        ++c;
+        int x = c;
+        assert(x == 11);
+    }
+    assert(c.nontrans_read() == 11);
+
+    {
+        TestTransaction t1(1);
+        c = 1;
+        b = c < 2;
+        assert(b);
+
+        TestTransaction t2(2);
+        c += 7;
+        assert(t2.try_commit());
+        // t1 overwrites all of c without having read it
+        assert(t1.try_commit());
+        assert(c.nontrans_read() == 1);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testShardedConcurrent() {
+    TShardedCounter<long> c;
+    const int nthreads = 4, per = 10000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i)
+        threads.emplace_back([&c, i] {
+            TThread::set_id(i);
+            for (int j = 0; j != per; ++j) {
+                TRANSACTION {
+                    ++c;
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    TransactionGuard t;
+    long x = c;
+    assert(x == nthreads * per);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testTrivial();
     testConcurrentUpdate();
@@ -403,5 +516,7 @@ int main() {
     testUpdateRead();
     testOpacity();
     testNoOpacity();
+    testShardedUpdate();
+    testShardedConcurrent();
     return 0;
 }
@@ -0,0 +1,277 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include "Transaction.hh"
+#include "TDeque.hh"
+
+template <typename D>
+void testEnds() {
+    D d;
+    int p;
+
+    {
+        // pushes at both ends, read back from both ends
+        TransactionGuard t;
+        assert(!d.transFront(p) && !d.transBack(p));
+        d.transPushBack(2);
+        d.transPushBack(3);
+        d.transPushFront(1);
+        d.transPushFront(0);
+        assert(d.transFront(p) && p == 0);
+        assert(d.transBack(p) && p == 3);
+    }
+    assert(d.nontrans_size() == 4);
+
+    {
+        // pops from both ends of committed elements
+        TransactionGuard t;
+        assert(d.transFront(p) && p == 0);
+        assert(d.transPopFront());
+        assert(d.transBack(p) && p == 3);
+        assert(d.transPopBack());
+        assert(d.transFront(p) && p == 1);
+        assert(d.transBack(p) && p == 2);
+    }
+    assert(d.nontrans_size() == 2);
+
+    {
+        // pops run through committed elements into our own pushes
+        TransactionGuard t;
+        d.transPushFront(10);
+        d.transPushBack(20);
+        assert(d.transPopBack());               // 20
+        assert(d.transPopBack());               // 2
+        assert(d.transPopBack());               // 1
+        assert(d.transBack(p) && p == 10);
+        d.transPushBack(21);
+        assert(d.transPopFront());              // 10
+        assert(d.transFront(p) && p == 21);
+        assert(d.transBack(p) && p == 21);
+    }
+
+    {
+        TransactionGuard t;
+        assert(d.transFront(p) && p == 21);
+        assert(d.transPopBack());
+        assert(!d.transPopBack());
+        assert(!d.transPopFront());
+    }
+    assert(d.nontrans_empty());
+
+    {
+        // own front pushes popped from the back come out oldest first
+        TransactionGuard t;
+        d.transPushFront(1);
+        d.transPushFront(2);
+        d.transPushFront(3);
+        assert(d.transBack(p) && p == 1);
+        assert(d.transPopBack());
+        assert(d.transBack(p) && p == 2);
+        assert(d.transFront(p) && p == 3);
+    }
+    assert(d.nontrans_size() == 2);
+    assert(d.nontrans_pop_back() == 2);
+    assert(d.nontrans_pop_front() == 3);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testGrowth() {
+    TDeque<int, 4> d;
+    // grow in both directions across many segments
+    for (int i = 0; i < 500; i += 25) {
+        TransactionGuard t;
+        for (int j = i; j != i + 25; ++j) {
+            d.transPushBack(j);
+            d.transPushFront(-1 - j);
+        }
+    }
+    assert(d.nontrans_size() == 1000);
+
+    for (int i = 0; i < 500; i += 30) {
+        TransactionGuard t;
+        int p;
+        for (int j = i; j != i + 30 && j != 500; ++j) {
+            assert(d.transFront(p) && p == -500 + j);
+            assert(d.transPopFront());
+            assert(d.transBack(p) && p == 499 - j);
+            assert(d.transPopBack());
+        }
+    }
+    assert(d.nontrans_empty());
+
+    // nontransactional calls share the same segments
+    for (int i = 0; i != 50; ++i) {
+        d.nontrans_push_back(i);
+        d.nontrans_push_front(-i);
+    }
+    for (int i = 49; i != 10; --i) {
+        assert(d.nontrans_pop_back() == i);
+        assert(d.nontrans_pop_front() == -i);
+    }
+    d.nontrans_clear();
+    assert(d.nontrans_empty());
+    {
+        TransactionGuard t;
+        d.transPushBack(7);
+    }
+    assert(d.nontrans_pop_front() == 7);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testOppositeEnds() {
+    TDeque<int> d;
+    int p;
+    for (int i = 0; i != 4; ++i)
+        d.nontrans_push_back(i);
+
+    {
+        // opposite ends don't conflict while elements separate them
+        TestTransaction t1(1);
+        assert(d.transPopFront());
+        d.transPushFront(10);
+        TestTransaction t2(2);
+        assert(d.transBack(p) && p == 3);
+        assert(d.transPopBack());
+        d.transPushBack(13);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        TransactionGuard t;
+        assert(d.transFront(p) && p == 10);
+        assert(d.transBack(p) && p == 13);
+    }
+
+    {
+        // but they do once one end reaches what the other popped
+        TestTransaction t1(1);
+        assert(d.transPopFront());              // 10
+        assert(d.transPopFront());              // 1
+        assert(d.transPopFront());              // 2
+        TestTransaction t2(2);
+        assert(d.transPopBack());               // 13
+        assert(d.transPopBack());               // 2
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(d.nontrans_size() == 2);
+
+    {
+        // same-end transactions still conflict
+        TestTransaction t1(1);
+        assert(d.transPopFront());
+        TestTransaction t2(2);
+        assert(d.transPopFront());
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // a transaction that saw the deque empty conflicts with any push
+        TestTransaction t1(1);
+        assert(d.transPopFront());
+        assert(!d.transPopFront());
+        d.transPushFront(5);
+        TestTransaction t2(2);
+        d.transPushBack(6);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNested() {
+    TDeque<int> d;
+    int p;
+    TRANSACTION {
+        d.transPushBack(1);
+        int tries = 0;
+        Sto::nested([&] {
+                d.transPushFront(0);
+                d.transPushBack(2);
+                assert(d.transPopBack());
+                if (++tries < 2)
+                    Sto::abort();
+            });
+        d.transPushBack(3);
+    } RETRY(false);
+
+    {
+        TransactionGuard t;
+        assert(d.transFront(p) && p == 0);
+        assert(d.transPopFront());
+        assert(d.transFront(p) && p == 1);
+        assert(d.transPopFront());
+        assert(d.transFront(p) && p == 3);
+        assert(d.transPopFront());
+        assert(!d.transPopFront());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrent() {
+    // two producers and two consumers, one of each at either end; every
+    // element comes out exactly once
+    TDeque<int, 16> d;
+    const int per = 4000;
+    std::vector<int> got[2];
+    std::atomic<int> consumed(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i != 2; ++i)
+        threads.emplace_back([&d, i] {
+            TThread::set_id(i);
+            for (int j = 0; j < per; j += 4) {
+                TRANSACTION {
+                    for (int k = j; k != j + 4; ++k)
+                        if (i == 0)
+                            d.transPushBack(k);
+                        else
+                            d.transPushFront(per + k);
+                } RETRY(true);
+            }
+        });
+    for (int i = 0; i != 2; ++i)
+        threads.emplace_back([&d, &got, &consumed, i] {
+            TThread::set_id(2 + i);
+            while (consumed < 2 * per) {
+                int v[2];
+                int n = 0;
+                TRANSACTION {
+                    int p;
+                    n = 0;
+                    for (int k = 0; k != 2; ++k)
+                        if (i == 0 ? d.transFront(p) && d.transPopFront()
+                                   : d.transBack(p) && d.transPopBack())
+                            v[n++] = p;
+                } RETRY(true);
+                got[i].insert(got[i].end(), v, v + n);
+                consumed += n;
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    std::vector<int> all(got[0]);
+    all.insert(all.end(), got[1].begin(), got[1].end());
+    assert(d.nontrans_empty());
+    std::sort(all.begin(), all.end());
+    assert(all.size() == size_t(2 * per));
+    for (int i = 0; i != 2 * per; ++i)
+        assert(all[i] == i);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testEnds<TDeque<int> >();
+    testEnds<TDeque<int, 2> >();
+    testEnds<TDeque<int, 1024, TNonopaqueWrapped> >();
+    testGrowth();
+    testOppositeEnds();
+    testNested();
+    testConcurrent();
+    return 0;
+}
@@ -132,10 +132,68 @@ void testVariableSizes() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testFalseConflicts() {
+    long w[4] = {0, 0, 0, 0};
+    // w[0] and w[2] share one of two versions
+    TGeneric g(1);
+
+    {
+        TestTransaction t1(1);
+        g.read(&w[0]);
+
+        TestTransaction t2(2);
+        g.write(&w[2], 5);
+        assert(t2.try_commit());
+
+        t1.use();
+        g.write(&w[1], 1);
+        assert(!t1.try_commit());
+    }
+    assert(g.conflicts().conflicts == 1);
+    assert(g.conflicts().false_conflicts == 1);
+
+    {
+        TestTransaction t1(1);
+        g.read(&w[2]);
+
+        TestTransaction t2(2);
+        g.write(&w[2], 6);
+        assert(t2.try_commit());
+
+        t1.use();
+        g.write(&w[1], 1);
+        assert(!t1.try_commit());
+    }
+    assert(g.conflicts().conflicts == 2);
+    assert(g.conflicts().false_conflicts == 1);
+    assert(g.conflicts().false_conflict_rate() == 0.5);
+
+    // in a region of their own the words don't collide
+    g.reset_conflicts();
+    g.add_region(w, sizeof(w));
+    {
+        TestTransaction t1(1);
+        g.read(&w[0]);
+
+        TestTransaction t2(2);
+        g.write(&w[2], 7);
+        assert(t2.try_commit());
+
+        t1.use();
+        g.write(&w[1], 1);
+        assert(t1.try_commit());
+    }
+    assert(g.conflicts().conflicts == 0);
+    assert(w[1] == 1 && w[2] == 7);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testOpacity1();
     testNoOpacity1();
     testVariableSizes();
+    testFalseConflicts();
     return 0;
 }
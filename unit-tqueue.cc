@@ -0,0 +1,381 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "TQueue.hh"
+
+template <typename Q>
+void testQueue() {
+    Q q;
+    int p;
+
+    // NONEMPTY TESTS
+    {
+        // ensure pops read pushes in FIFO order
+        TransactionGuard t;
+        // q is empty
+        q.transPush(1);
+        q.transPush(2);
+        assert(q.transFront(p) && p == 1); assert(q.transPop()); assert(q.transFront(p) && p == 2);
+        assert(q.transPop());
+    }
+
+    {
+        TransactionGuard t;
+        // q is empty
+        q.transPush(1);
+        q.transPush(2);
+    }
+
+    {
+        // front with no pops
+        TransactionGuard t;
+        assert(q.transFront(p));
+        assert(p == 1);
+        assert(q.transFront(p));
+        assert(p == 1);
+    }
+
+    {
+        // pop until empty
+        TransactionGuard t;
+        assert(q.transPop());
+        assert(q.transPop());
+        assert (!q.transPop());
+
+        // prepare pushes for next test
+        q.transPush(1);
+        q.transPush(2);
+        q.transPush(3);
+    }
+
+    {
+        // fronts intermixed with pops
+        TransactionGuard t;
+        assert(q.transFront(p));
+        assert(p == 1);
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 2);
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 3);
+        assert(q.transPop());
+        assert(!q.transPop());
+
+        // set up for next test
+        q.transPush(1);
+        q.transPush(2);
+        q.transPush(3);
+    }
+
+    {
+        // front intermixed with pushes on nonempty
+        TransactionGuard t;
+        assert(q.transFront(p));
+        assert(p == 1);
+        assert(q.transFront(p));
+        assert(p == 1);
+        q.transPush(4);
+        assert(q.transFront(p));
+        assert(p == 1);
+    }
+
+    {
+        // pops intermixed with pushes and front on nonempty
+        // q = [1 2 3 4]
+        TransactionGuard t;
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 2);
+        q.transPush(5);
+        // q = [2 3 4 5]
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 3);
+        q.transPush(6);
+        // q = [3 4 5 6]
+    }
+
+    // EMPTY TESTS
+    {
+        // front with empty queue
+        TransactionGuard t;
+        // empty the queue
+        assert(q.transPop());
+        assert(q.transPop());
+        assert(q.transPop());
+        assert(q.transPop());
+        assert(!q.transPop());
+        
+        assert(!q.transFront(p));
+       
+        q.transPush(1);
+        assert(q.transFront(p));
+        assert(p == 1);
+        assert(q.transFront(p));
+        assert(p == 1);
+    }
+
+    {
+        // pop with empty queue
+        TransactionGuard t;
+        // empty the queue
+        assert(q.transPop());
+        assert(!q.transPop());
+       
+        assert(!q.transFront(p));
+       
+        q.transPush(1);
+        assert(q.transPop());
+        assert(!q.transPop());
+    }
+
+    {
+        // pop and front with empty queue
+        TransactionGuard t;
+        assert(!q.transFront(p));
+       
+        q.transPush(1);
+        assert(q.transFront(p));
+        assert(p == 1);
+        assert(q.transPop());
+       
+        q.transPush(1);
+        assert(q.transPop());
+        assert(!q.transFront(p));
+        assert(!q.transPop());
+
+        // add items for next test
+        q.transPush(1);
+        q.transPush(2);
+    }
+
+    // CONFLICTING TRANSACTIONS TEST
+    {
+        // test abortion due to pops 
+        TestTransaction t1(1);
+        // q has >1 element
+        assert(q.transPop());
+        TestTransaction t2(2);
+        assert(q.transPop());
+        assert(t1.try_commit());
+        assert(!t2.try_commit());
+    }
+
+    {
+        // test nonabortion T1 pops, T2 pushes on nonempty q
+        TestTransaction t1(1);
+        // q has >1 element
+        assert(q.transPop());
+        TestTransaction t2(2);
+        q.transPush(3);
+        assert(t1.try_commit());
+        assert(t2.try_commit()); // commit should succeed 
+
+    }
+        {
+        TransactionGuard t1;
+        assert(q.transFront(p) && p == 3);
+        assert(q.transPop());
+        assert(!q.transPop());
+    }
+
+    {
+        // test abortion due to empty q pops
+        TestTransaction t1(1);
+        // q has 0 elements
+        assert(!q.transPop());
+        q.transPush(1);
+        q.transPush(2);
+        TestTransaction t2(2);
+        q.transPush(3);
+        q.transPush(4);
+        q.transPush(5);
+        
+        // read-my-write, lock tail
+        assert(q.transPop());
+        
+        assert(t1.try_commit());
+        assert(!t2.try_commit());
+    }
+
+    {
+        // test nonabortion T1 pops/fronts and pushes, T2 pushes on nonempty q
+        TestTransaction t1(1);
+        // q has 2 elements [1, 2]
+        assert(q.transFront(p) && p == 1);
+        q.transPush(4);
+
+        // pop from non-empty q
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 2);
+
+        TestTransaction t2(2);
+        q.transPush(3);
+        // order of pushes doesn't matter, commits succeed
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+
+        // check if q is in order
+        TestTransaction t(3);
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 3);
+        assert(q.transPop());
+        assert(q.transFront(p));
+        assert(p == 4);
+        assert(q.transPop());
+        assert(!q.transPop());
+        assert(t.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testGrowth() {
+    TQueue<int, 16> q;
+    for (int i = 0; i < 1000; i += 50) {
+        TransactionGuard t;
+        for (int j = i; j != i + 50; ++j)
+            q.transPush(j);
+    }
+    assert(q.nontrans_size() == 1000);
+
+    for (int i = 0; i < 1000; i += 30) {
+        TransactionGuard t;
+        int p;
+        for (int j = i; j != i + 30 && j != 1000; ++j) {
+            assert(q.transFront(p) && p == j);
+            assert(q.transPop());
+        }
+    }
+
+    {
+        TransactionGuard t;
+        assert(!q.transPop());
+    }
+    assert(q.nontrans_empty());
+
+    // nontransactional calls share the same segments
+    for (int i = 0; i != 100; ++i)
+        q.nontrans_push(i);
+    for (int i = 0; i != 50; ++i)
+        assert(q.nontrans_pop() == i);
+    q.nontrans_clear();
+    assert(q.nontrans_empty());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNested() {
+    TQueue<int> q;
+    int p;
+    TRANSACTION {
+        q.transPush(1);
+        int tries = 0;
+        Sto::nested([&] {
+                q.transPush(2);
+                assert(q.transPop());
+                if (++tries < 2)
+                    Sto::abort();
+            });
+        q.transPush(3);
+    } RETRY(false);
+
+    {
+        TransactionGuard t;
+        assert(q.transFront(p) && p == 2);
+        assert(q.transPop());
+        assert(q.transFront(p) && p == 3);
+        assert(q.transPop());
+        assert(!q.transPop());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrentPushes() {
+    TQueue<int, 64> q;
+    const int nthreads = 4, per = 2000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i)
+        threads.emplace_back([&q, i] {
+            TThread::set_id(i);
+            for (int j = 0; j < per; j += 10) {
+                TRANSACTION {
+                    for (int k = j; k != j + 10; ++k)
+                        q.transPush(k * nthreads + i);
+                } RETRY(true);
+            }
+        });
+    for (auto& th : threads)
+        th.join();
+
+    // each thread's pushes arrive in order and in one piece
+    std::vector<int> next(nthreads, 0);
+    for (int n = 0; n != nthreads * per; n += 10) {
+        int first = q.nontrans_pop();
+        int i = first % nthreads;
+        assert(first / nthreads == next[i]);
+        for (int k = 1; k != 10; ++k)
+            assert(q.nontrans_pop() == first + k * nthreads);
+        next[i] += 10;
+    }
+    assert(q.nontrans_empty());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSharded() {
+    TShardedQueue<int, 4> q;
+
+    {
+        // a pop that found every shard empty conflicts with any push
+        TestTransaction t1(1);
+        assert(!q.transPop());
+        q.transPush(10);
+
+        TestTransaction t2(2);
+        q.transPush(20);
+        q.transPush(21);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // but producers on different shards don't conflict
+        TestTransaction t1(1);
+        q.transPush(10);
+        TestTransaction t2(2);
+        q.transPush(22);
+        assert(t1.try_commit());
+        assert(t2.try_commit());
+    }
+
+    {
+        // a consumer prefers its own shard, in FIFO order
+        TestTransaction t(2);
+        int p;
+        assert(q.transFront(p) && p == 20);
+        assert(q.transPop());
+        assert(q.transPop());
+        assert(q.transPop());
+        assert(q.transFront(p) && p == 10);
+        assert(q.transPop());
+        assert(!q.transPop());
+        assert(t.try_commit());
+    }
+    assert(q.nontrans_empty());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testGrowth();
+    testNested();
+    testConcurrentPushes();
+    testQueue<TQueue<int> >();
+    testQueue<TQueue<int, 2> >();
+    testQueue<TQueue<int, 1024, TNonopaqueWrapped> >();
+    testSharded();
+    return 0;
+}
@@ -0,0 +1,1029 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "TIntRange.hh"
+#include "TWrapped.hh"
+#include "TInterleave.hh"
+#include "TMetrics.hh"
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+void testIncrementalValidation() {
+    typedef TBox<int, TNonopaqueWrapped<int> > box_type;
+    box_type f, g, h, k;
+    unsigned old_interval = Transaction::validate_interval;
+    Transaction::validate_interval = 2;
+
+    // a doomed transaction aborts as its read set grows
+    bool aborted = false;
+    try {
+        TestTransaction t1(1);
+        int x = f;
+        int y = g;
+
+        TestTransaction t2(2);
+        f = x + 1;
+        assert(t2.try_commit());
+
+        t1.use();
+        y += h;
+        assert(false && "shouldn't get here");
+        (void) y;
+    } catch (Transaction::Abort e) {
+        aborted = true;
+    }
+    assert(aborted);
+
+    // valid transactions are unaffected
+    TRANSACTION {
+        int x = f + g + h;
+        k = x;
+    } RETRY(false);
+    assert(k.nontrans_read() == 1);
+
+    Transaction::validate_interval = old_interval;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+struct LockableWord : public TObject {
+    TVersion vers;
+    TOpaqueWrapped<int> v;
+    TransactionTid::type& version_word() {
+        return const_cast<TransactionTid::type&>(vers.value());
+    }
+    bool lock(TransItem& item, Transaction& txn) override {
+        return txn.try_lock(item, vers);
+    }
+    bool check(TransItem& item, Transaction&) override {
+        return item.check_version(vers);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        v.write(item.write_value<int>());
+        txn.set_version_unlock(vers, item);
+    }
+    void unlock(TransItem&) override {
+        vers.unlock();
+    }
+};
+
+class CountingContention : public TContentionManager {
+public:
+    CountingContention(TContentionManager& base)
+        : base_(base), lock_waits(0), read_waits(0), aborts(0), retries(0) {
+    }
+    bool lock_wait(unsigned n) override {
+        ++lock_waits;
+        return base_.lock_wait(n);
+    }
+    bool read_wait(unsigned n, bool patient) override {
+        ++read_waits;
+        return base_.read_wait(n, patient);
+    }
+    void finish(bool committed) override {
+        aborts += !committed;
+    }
+    void before_retry(unsigned) override {
+        ++retries;
+    }
+    const char* name() const override {
+        return "counting";
+    }
+private:
+    TContentionManager& base_;
+public:
+    unsigned lock_waits, read_waits, aborts, retries;
+};
+
+void testContentionManager() {
+    LockableWord w, w2;
+    TAbortFastContention abort_fast;
+    TSpinContention spin(4, 16, true, false);
+    CountingContention cm(abort_fast), spin_cm(spin);
+    Transaction::set_contention_manager(&cm);
+
+    // a validation conflict aborts in both lock orders
+    {
+        TestTransaction t1(0);
+        w.v.read(Sto::item(&w, 0), w.vers);
+        Sto::item(&w2, 0).add_write(1);
+        TestTransaction t2(1);
+        Sto::item(&w, 0).add_write(1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(cm.aborts == 1);
+
+    // another thread holds the lock
+    TransactionTid::lock(w.version_word(), 7);
+#if !STO_SORT_WRITESET
+    // sorted commits block on locks without asking the manager, so the
+    // lock wait checks run only in unsorted builds
+    {
+        TestTransaction t1(0);
+        Sto::item(&w, 0).add_write(1);
+        assert(!t1.try_commit());
+    }
+    assert(cm.lock_waits == 1 && cm.aborts == 2);
+#endif
+    unsigned aborts = cm.aborts;
+    {
+        TestTransaction t2(0);
+        try {
+            w.v.read(Sto::item(&w, 0), w.vers);
+            assert(false);
+        } catch (Transaction::Abort e) {
+        }
+    }
+    assert(cm.read_waits == 1 && cm.aborts == aborts + 1);
+
+    Transaction::set_contention_manager(&spin_cm);
+#if !STO_SORT_WRITESET
+    {
+        TestTransaction t3(0);
+        Sto::item(&w, 0).add_write(2);
+        assert(!t3.try_commit());
+    }
+    assert(spin_cm.lock_waits == 4 && spin_cm.aborts == 1);
+#endif
+    TransactionTid::unlock(w.version_word(), 7);
+
+    aborts = spin_cm.aborts;
+    int attempts = 0;
+    TRANSACTION {
+        if (++attempts < 3)
+            Sto::abort();
+        Sto::item(&w, 0).add_write(3);
+    } RETRY(true);
+    assert(attempts == 3 && spin_cm.retries == 2 && spin_cm.aborts == aborts + 2);
+    Transaction::set_contention_manager(nullptr);
+
+    TAdaptiveContention adaptive;
+    assert(!adaptive.lock_wait(4));
+    for (int i = 0; i != 100; ++i)
+        adaptive.finish(false);
+    assert(adaptive.abort_rate() > TAdaptiveContention::one_rate / 2);
+    assert(adaptive.lock_wait(4));
+    for (int i = 0; i != 1000; ++i)
+        adaptive.finish(true);
+    assert(!adaptive.lock_wait(4));
+
+    for (const char* policy : {"spin", "backoff", "abort-fast", "adaptive"}) {
+        TContentionManager* m = TContentionManager::make(policy);
+        assert(m && strcmp(m->name(), policy) == 0);
+        delete m;
+    }
+    assert(!TContentionManager::make("bogus"));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+class LockOrder : public TObject {
+public:
+    std::vector<int> locked;
+    bool lock(TransItem& item, Transaction&) override {
+        locked.push_back(item.key<int>());
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        return true;
+    }
+    void install(TransItem&, Transaction&) override {
+    }
+    void unlock(TransItem&) override {
+    }
+};
+
+void testWriteSetOrder() {
+    // small write sets are comparison sorted, large ones radix sorted
+    for (int n : {5, 1000, 3000}) {
+        LockOrder lo;
+        std::vector<int> keys;
+        for (int i = 0; i != n; ++i)
+            keys.push_back((i * 7919) % n * 65537);
+        {
+            TransactionGuard t;
+            for (int k : keys) {
+                Sto::item(&lo, k).add_write(k);
+                Sto::item(&lo, k).add_read(0); // reads don't lock
+            }
+        }
+#if STO_SORT_WRITESET
+        std::sort(keys.begin(), keys.end());
+#endif
+        assert(lo.locked == keys);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortCounters() {
+    TBox<int> a, b;
+    Transaction::clear_stats();
+    {
+        TestTransaction t1(1);
+        int x = a;
+        b = x + 1;
+        TestTransaction t2(2);
+        a = 2;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    int attempts = 0;
+    TRANSACTION {
+        if (++attempts == 1)
+            Sto::abort();
+        b = 3;
+    } RETRY(true);
+
+    auto ac = Transaction::abort_counters_combined();
+    assert(ac.find(&a).n[ar_commit_check] == 1);
+    assert(ac.find(&b).n[ar_commit_check] == 0);
+    assert(ac.find(nullptr).n[ar_user] == 1);
+    assert(strcmp(abort_counters::reason_name(ar_commit_lock), "commit lock") == 0);
+    Transaction::clear_stats();
+    assert(Transaction::abort_counters_combined().find(&a).n[ar_commit_check] == 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testProfile() {
+    TBox<int> f;
+    unsigned level = Transaction::profile_level();
+    bool timing = Transaction::profile_timing();
+
+    Transaction::set_profile(1, false);
+    auto s0 = Transaction::counters_snapshot();
+    for (int i = 0; i != 10; ++i) {
+        TRANSACTION {
+            f = i;
+        } RETRY(false);
+    }
+    auto d1 = Transaction::counters_snapshot().since(s0);
+    assert(d1.p.p(txp_total_starts) == 10);
+    assert(d1.p.p(txp_total_w) == 0); // level 2 only
+    assert(d1.tc.timing_counter(tc_commit) == 0);
+
+    Transaction::set_profile(0, true);
+    auto s1 = Transaction::counters_snapshot();
+    {
+        TransactionGuard t;
+        f = 100;
+    }
+    TRANSACTION {
+        f = 99;
+    } RETRY(false);
+    auto d2 = Transaction::counters_snapshot().since(s1);
+    assert(d2.p.p(txp_total_starts) == 0);
+    assert(d2.tc.timing_counter(tc_commit) > 0);
+    assert(d2.latency[tc_commit].count() == 2);
+    assert(d2.latency[tc_transaction].count() == 1);
+
+    Transaction::set_profile(2, false);
+    auto s2 = Transaction::counters_snapshot();
+    {
+        TransactionGuard t;
+        f = 101;
+    }
+    auto d3 = Transaction::counters_snapshot().since(s2);
+    assert(d3.p.p(txp_total_starts) == 1 && d3.p.p(txp_total_w) == 1);
+
+    Transaction::set_profile(level, timing);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testItemLayout() {
+    // an item keeps read and write data in one word until it has both
+    static_assert(sizeof(TransItem) == 3 * sizeof(void*), "compact items");
+    TBox<int> a;
+    TBox<std::string> s;
+    TRANSACTION {
+        a = a + 1;
+        s = s.read() + "x";
+        auto item = Sto::item(&a, 0);
+        assert(item.has_read() && item.has_write() && item.write_value<int>() == 1);
+        // a savepoint's copy keeps the split data as it was
+        auto sp = Sto::savepoint();
+        a = 5;
+        s = std::string("y");
+        Sto::rollback(sp);
+        assert(a == 1 && s.read() == "x");
+        Sto::release(sp);
+    } RETRY(false);
+    assert(a.nontrans_read() == 1 && s.nontrans_read() == "x");
+
+    // split items still validate their reads
+    {
+        TestTransaction t1(1);
+        a = a + 1;
+        TestTransaction t2(2);
+        a = 10;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(a.nontrans_read() == 10);
+
+    // a predicate and xwrite data share an item without a write, in
+    // either order (TVector's size item)
+    {
+        typedef TIntRange<int> range;
+        TestTransaction t(1);
+        auto item = Sto::item(&a, 1);
+        item.set_predicate(range::unconstrained());
+        item.xwrite_value<range>() = range{3, 4};
+        assert(item.predicate_value<range>().first == range::unconstrained().first);
+        item.add_write();
+        ++item.xwrite_value<range>().second;
+        assert(item.predicate_value<range>().second == range::unconstrained().second);
+        assert(item.xwrite_value<range>().first == 3 && item.xwrite_value<range>().second == 5);
+
+        auto other = Sto::item(&a, 2);
+        other.xwrite_value<range>() = range{7, 8};
+        other.set_predicate(range{1, 2});
+        assert(other.xwrite_value<range>().first == 7 && other.predicate_value<range>().first == 1);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSavepoint() {
+    TBox<int> a, b, c;
+    TBox<std::string> s;
+    TRANSACTION {
+        a = 1;
+        s = std::string("before");
+        auto sp = Sto::savepoint();
+        a = 2;
+        b = 3;
+        s = std::string("after");
+        assert(a == 2 && b == 3 && s.read() == "after");
+        Sto::rollback(sp);
+        assert(a == 1 && b == 0 && s.read() == "before");
+        c = 4;
+        Sto::release(sp);
+    } RETRY(false);
+    assert(a.nontrans_read() == 1 && b.nontrans_read() == 0
+           && c.nontrans_read() == 4 && s.nontrans_read() == "before");
+
+    // nested scopes retry only their own work
+    int outer = 0, inner = 0;
+    TRANSACTION {
+        ++outer;
+        a = a + 10;
+        Sto::nested([&] {
+                ++inner;
+                b = inner;
+                if (inner < 3)
+                    Sto::abort();
+            });
+    } RETRY(false);
+    assert(outer == 1 && inner == 3);
+    assert(a.nontrans_read() == 11 && b.nontrans_read() == 3);
+
+    // out of retries: the whole transaction aborts
+    inner = 0;
+    bool aborted = false;
+    try {
+        TRANSACTION {
+            b = 100;
+            Sto::nested([&] {
+                    ++inner;
+                    Sto::abort();
+                }, 2);
+        } RETRY(false);
+    } catch (Transaction::Abort&) {
+        aborted = true;
+    }
+    assert(aborted && inner == 3 && b.nontrans_read() == 3);
+
+    // if a read from before the scope is stale, retrying can't help
+    inner = 0;
+    aborted = false;
+    try {
+        TRANSACTION {
+            int x = a;
+            Sto::nested([&] {
+                    ++inner;
+                    std::thread([&] {
+                            TThread::set_id(1);
+                            TRANSACTION {
+                                a = x + 1;
+                            } RETRY(false);
+                        }).join();
+                    Sto::abort();
+                });
+        } RETRY(false);
+    } catch (Transaction::Abort&) {
+        aborted = true;
+    }
+    assert(aborted && inner == 1 && a.nontrans_read() == 12);
+
+    // rolling back past the large-transaction index
+    std::vector<TBox<int>> boxes(2000);
+    TRANSACTION {
+        for (int i = 0; i != 200; ++i)
+            boxes[i] = i;
+        auto sp = Sto::savepoint();
+        for (int i = 0; i != 2000; ++i)
+            boxes[i] = -1;
+        Sto::rollback(sp);
+        for (int i = 0; i != 2000; ++i)
+            assert(boxes[i] == (i < 200 ? i : 0));
+        Sto::release(sp);
+    } RETRY(false);
+    assert(boxes[199].nontrans_read() == 199 && boxes[200].nontrans_read() == 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHugeTransaction() {
+    // well past the inline chunk directory and 16-bit item indexes
+    const unsigned n = 100000;
+    std::vector<TBox<int>> boxes(n);
+    TRANSACTION {
+        for (unsigned i = 0; i != n; ++i)
+            boxes[i] = i;
+        for (unsigned i = 0; i < n; i += 97)
+            assert(boxes[i] == int(i));
+    } RETRY(false);
+    TRANSACTION {
+        Sto::reserve_items(2 * n);
+        int sum = 0;
+        for (unsigned i = 0; i != n; ++i)
+            sum += boxes[i] == int(i);
+        assert(sum == int(n));
+        boxes[n - 1] = -1;
+    } RETRY(false);
+    TRANSACTION {
+        assert(boxes[n - 1] == -1 && boxes[0] == 0);
+    } RETRY(false);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// a wrong read-only hint still finds items, small and large
+void testDeferIndex() {
+    const unsigned n = 1000;
+    std::vector<TBox<int>> boxes(n);
+    for (unsigned size : {4U, n}) {
+        TRANSACTION {
+            Sto::defer_index();
+            std::vector<TransItem*> items;
+            for (unsigned i = 0; i != size; ++i)
+                items.push_back(&Sto::read_item(&boxes[i], 0).item());
+            for (unsigned i = 0; i != size; ++i)
+                assert(&Sto::item(&boxes[i], 0).item() == items[i]);
+            for (unsigned i = 0; i != size; ++i)
+                boxes[i] = i + 1;
+        } RETRY(false);
+        TRANSACTION {
+            for (unsigned i = 0; i != size; ++i) {
+                assert(boxes[i] == int(i + 1));
+                boxes[i] = 0;
+            }
+        } RETRY(false);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNewItems() {
+    const unsigned n = 1000;
+    std::vector<TBox<int>> boxes(n);
+    std::vector<TBox<int>*> keys;
+    for (auto& b : boxes)
+        keys.push_back(&b);
+    TBox<int> other;
+    Sto::start_transaction();
+    other = 1;
+    std::vector<TransItem*> items;
+    Sto::new_items(&other, keys.data(), n, [&] (TransProxy item, unsigned i) {
+            assert(item.item().key<TBox<int>*>() == &boxes[i]);
+            item.add_write(int(i));
+            items.push_back(&item.item());
+        });
+    // the items are found like any others
+    for (unsigned i = 0; i != n; ++i)
+        assert(&Sto::item(&other, keys[i]).item() == items[i]);
+    assert(Sto::item(&other, 0).item().write_value<int>() == 1);
+    Sto::silent_abort();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadOnly() {
+    const unsigned n = 100;
+    std::vector<TBox<int, TNonopaqueWrapped<int> > > boxes(n);
+    int sum = 0;
+    READ_ONLY_TRANSACTION {
+        sum = 0;
+        for (auto& b : boxes)
+            sum += b;
+    } RETRY(false);
+    assert(sum == 0);
+
+    // reads are validated at commit
+    Sto::start_read_only_transaction();
+    for (auto& b : boxes)
+        sum += b;
+    {
+        TestTransaction t(1);
+        boxes[n / 2] = 1;
+        assert(t.try_commit());
+    }
+    assert(!Sto::try_commit());
+    READ_ONLY_TRANSACTION {
+        sum = 0;
+        for (auto& b : boxes)
+            sum += b;
+    } RETRY(false);
+    assert(sum == 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+static unsigned rcu_freed;
+
+void testRcuPressure() {
+    // no epoch advancer runs here, so only eager reclamation frees.
+    // Earlier TestTransactions ran on this thread under other ids and
+    // left those ids' epochs pinned; quiesce each as its own id.
+    int me = TThread::id();
+    for (unsigned i = 0; i != Transaction::used_threads(); ++i) {
+        TThread::set_id(i);
+        Transaction::rcu_quiesce();
+    }
+    TThread::set_id(me);
+    auto old_threshold = Transaction::rcu_eager_threshold;
+    Transaction::set_rcu_eager_threshold(100);
+    auto e0 = Transaction::global_epochs.global_epoch;
+    uint64_t added = 0;
+    for (int i = 0; i != 1000; ++i) {
+        TRANSACTION {
+            for (int j = 0; j != 10; ++j)
+                Transaction::rcu_call([](void*) { ++rcu_freed; }, nullptr);
+        } RETRY(false);
+        added += 10;
+        assert(Transaction::rcu_backlog(TThread::id()) <= 200);
+    }
+    assert(Transaction::global_epochs.global_epoch != e0);
+    assert(rcu_freed + Transaction::rcu_backlog(TThread::id()) >= added);
+    assert(rcu_freed >= added - 200);
+    auto rcu = Transaction::rcu_backlog_combined();
+    assert(rcu.total >= rcu.max && rcu.max == Transaction::rcu_backlog(TThread::id()));
+    Transaction::set_rcu_eager_threshold(old_threshold);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRcuBudget() {
+    TRcuSet rs;
+    unsigned freed = 0;
+    auto count = [](void* p) { ++*static_cast<unsigned*>(p); };
+    for (int i = 0; i != 3000; ++i)
+        rs.add(1 + i / 1000, count, &freed);
+    rs.clean_until(3, 500);
+    assert(freed == 500 && rs.size() == 2500);
+    rs.clean_until(3, 1000);
+    assert(freed == 1500 && rs.size() == 1500);
+    rs.clean_until(3);
+    assert(freed == 2000 && rs.size() == 1000);
+    rs.clean_until(4);
+    assert(freed == 3000 && rs.size() == 0);
+    // emptied groups are reused
+    for (int i = 0; i != 3000; ++i)
+        rs.add(5, count, &freed);
+    rs.clean_until(6, 10);
+    assert(freed == 3010);
+    // many emptied groups: extras beyond max_spare_groups are freed
+    for (int i = 0; i != 30000; ++i)
+        rs.add(7, count, &freed);
+    rs.clean_until(8);
+    assert(freed == 36000 && rs.size() == 0);
+    rs.add(9, count, &freed);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testLatencyHistogram() {
+    log_histogram h;
+    for (unsigned b = 0; b != log_histogram::nbuckets; ++b)
+        assert(log_histogram::bucket(log_histogram::bucket_low(b)) == b
+               && log_histogram::bucket(log_histogram::bucket_high(b) - 1) == b);
+    for (uint64_t v = 1; v <= 1000; ++v)
+        h.add(v * 1000);
+    assert(h.count() == 1000);
+    // buckets are within 1/8 of their values
+    assert(fabs(h.quantile(0.5) - 500000) < 500000 / 8);
+    assert(fabs(h.quantile(0.99) - 990000) < 990000 / 8);
+    log_histogram h2;
+    h2.add(3);
+    h2.merge(h);
+    assert(h2.count() == 1001 && h2.quantile(0) == 3);
+    h2.subtract(h);
+    assert(h2.count() == 1);
+    assert(tsc_ghz() > 0.1 && tsc_ghz() < 100);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+struct IncrementTask {
+    TBox<int>* cells[3];
+    unsigned i;
+    int id;
+    std::vector<int>* trace;
+    void reset() {
+        i = 0;
+    }
+    bool step() {
+        trace->push_back(id);
+        *cells[i] = *cells[i] + 1;
+        if (++i == 3)
+            return true;
+        prefetch(cells[i]);
+        return false;
+    }
+};
+
+void testInterleave() {
+    TBox<int> cells[4];
+    std::vector<int> trace;
+    std::vector<IncrementTask> tasks(16);
+    for (int t = 0; t != 16; ++t) {
+        tasks[t].id = t;
+        tasks[t].trace = &trace;
+        for (int j = 0; j != 3; ++j)
+            tasks[t].cells[j] = &cells[(t + j) % 4];
+    }
+    TInterleaver<IncrementTask> il(4);
+    il.run(tasks.begin(), tasks.end());
+    // steps round-robin over the first four tasks
+    assert((std::vector<int>(trace.begin(), trace.begin() + 8)
+            == std::vector<int>{0, 1, 2, 3, 0, 1, 2, 3}));
+    // overlapping tasks conflict, so some restart
+    assert(il.restarts() > 0);
+    for (auto& c : cells)
+        assert(c.nontrans_read() == 12);
+    assert(!Sto::in_progress());
+
+    // the thread's epoch stays at the oldest in-flight context's epoch
+    auto& thr = Transaction::tinfo[TThread::id()];
+    Transaction* a = Sto::make_transaction();
+    Transaction* b = Sto::make_transaction();
+    Transaction* saved = Sto::swap_transaction(a);
+    Sto::start_transaction();
+    auto ea = thr.epoch;
+    Transaction::global_epochs.global_epoch += 2;
+    Sto::swap_transaction(b);
+    Sto::start_transaction();
+    assert(thr.epoch == ea);
+    Sto::swap_transaction(a);
+    assert(Sto::try_commit());
+    assert(thr.epoch == ea + 2);
+    Sto::swap_transaction(b);
+    assert(Sto::try_commit());
+    Sto::swap_transaction(saved);
+    Sto::delete_transaction(a);
+    Sto::delete_transaction(b);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testMetrics() {
+    const char* path = "/tmp/sto-unit-metrics.prom";
+    unsigned old_level = Transaction::profile_level();
+    bool old_timing = Transaction::profile_timing();
+    unlink(path);
+    TMetrics::export_file(path, 0);
+    assert(Transaction::profile_level() >= 1);
+    TBox<int> m;
+    for (int i = 0; i != 3; ++i)
+        TRANSACTION {
+            m = m + 1;
+        } RETRY(true);
+    try {
+        TRANSACTION {
+            Sto::abort();
+        } RETRY(false);
+    } catch (Transaction::Abort e) {
+    }
+
+    std::string text = TMetrics::render();
+    assert(text.find("# TYPE sto_transaction_commits_total counter\n") != std::string::npos);
+    assert(text.find("sto_transaction_aborts_total{reason=\"user\"} ") != std::string::npos);
+    assert(text.find("sto_commit_latency_seconds_bucket{le=\"+Inf\"} ") != std::string::npos);
+    assert(text.find("sto_rcu_backlog ") != std::string::npos);
+
+    // the epoch tick writes the file
+    TMetrics::epoch_tick();
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    char buf[256];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    assert(n > 0);
+    buf[n] = 0;
+    assert(strncmp(buf, "# HELP sto_transaction_starts_total", 35) == 0);
+
+    // and the endpoint serves it
+    int port = TMetrics::serve(0);
+    assert(port > 0);
+    int c = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(c, reinterpret_cast<struct sockaddr*>(&sin), sizeof(sin)) == 0);
+    const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    assert(write(c, req, sizeof(req) - 1) == ssize_t(sizeof(req) - 1));
+    std::string resp;
+    while ((n = read(c, buf, sizeof(buf))) > 0)
+        resp.append(buf, n);
+    close(c);
+    assert(resp.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+    assert(resp.find("sto_global_epoch ") != std::string::npos);
+
+    TMetrics::stop();
+    Transaction::set_profile_all(old_level, old_timing);
+    unlink(path);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRedoLog() {
+    char dir[] = "/tmp/sto-log-XXXXXX";
+    assert(mkdtemp(dir));
+    std::string log_path = std::string(dir) + "/log." + std::to_string(TThread::id());
+    // the durable epoch waits for every thread slot's epoch
+    for (unsigned i = 0; i != Transaction::used_threads(); ++i)
+        if (i != unsigned(TThread::id()))
+            Transaction::tinfo[i].epoch = 0;
+    TBox<int> a;
+    TBox<std::string> s;
+    a.set_log_id(1);
+    s.set_log_id(2);
+    assert(TLog::open(dir));
+    uint64_t e = 0;
+    for (int i = 1; i <= 3; ++i) {
+        TRANSACTION {
+            a = i;
+            s = std::string(i, 'x');
+        } RETRY(false);
+        assert(Sto::commit_epoch() >= e && Sto::commit_epoch() > 0);
+        e = Sto::commit_epoch();
+    }
+    TRANSACTION {
+        (void) a.read();
+    } RETRY(false);
+    assert(Sto::commit_epoch() == 0);
+    Transaction::rcu_quiesce();
+    Transaction::advance_epoch();
+    Transaction::advance_epoch();
+    assert(TLog::flush());
+    assert(TLog::durable_epoch() >= e);
+    assert(TLog::close());
+
+    int av = 0;
+    std::string sv;
+    unsigned n = 0;
+    auto apply = [&](const TLog::entry& x) {
+        ++n;
+        if (x.id == 1)
+            av = TLogCodec<int>::decode(x.data, x.length);
+        else if (x.id == 2)
+            sv = TLogCodec<std::string>::decode(x.data, x.length);
+    };
+    int64_t d = TLog::replay(dir, apply);
+    assert(d >= int64_t(e) && n == 6 && av == 3 && sv == "xxx");
+
+    // a torn record past the durable epoch is ignored, then trimmed
+    int fd = open(log_path.c_str(), O_WRONLY | O_APPEND);
+    assert(fd >= 0 && write(fd, "\xff\xff\xff\xff\xff\xff\xff\xff\x01", 9) == 9);
+    close(fd);
+    n = 0;
+    assert(TLog::replay(dir, apply) == d && n == 6);
+    assert(TLog::open(dir));
+    TRANSACTION {
+        a = 4;
+    } RETRY(false);
+    assert(Sto::commit_epoch() > uint64_t(d));
+    assert(TLog::close());
+    n = 0;
+    assert(TLog::replay(dir, apply) > d && n == 7 && av == 4);
+
+    unlink(log_path.c_str());
+    unlink((std::string(dir) + "/epoch").c_str());
+    rmdir(dir);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testFallback() {
+    TBox<int> f;
+    Transaction::fallback_aborts = 2;
+
+    std::vector<bool> held;
+    TRANSACTION {
+        held.push_back(Transaction::in_fallback());
+        if (held.size() < 4)
+            Sto::abort();
+        f = 1;
+    } RETRY(true);
+    assert((held == std::vector<bool>{false, false, true, true}));
+    assert(!Transaction::in_fallback());
+
+    // the token is released when the loop gives up
+    int attempts = 0;
+    try {
+        TRANSACTION {
+            ++attempts;
+            Sto::abort();
+        } RETRY(attempts < 3);
+        assert(false);
+    } catch (Transaction::Abort e) {
+    }
+    assert(!Transaction::in_fallback());
+
+    // writers on other threads wait for the fallback transaction
+    volatile bool done = false;
+    Transaction::acquire_fallback();
+    std::thread writer([&] {
+            TThread::set_id(1);
+            TRANSACTION {
+                f = 2;
+            } RETRY(true);
+            done = true;
+        });
+    usleep(20000);
+    assert(!done);
+    {
+        TransactionGuard t;
+        f = 3;
+    }
+    Transaction::release_fallback();
+    writer.join();
+    assert(done && f.nontrans_read() == 2);
+
+    Transaction::fallback_aborts = 0;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testLimits() {
+    TBox<int> f;
+    Transaction::clear_stats();
+
+    // the retry budget
+    int attempts = 0;
+    try {
+        TRANSACTION_LIMITED(TransactionLimits().attempts(3)) {
+            ++attempts;
+            Sto::abort();
+        } RETRY(true);
+        assert(false);
+    } catch (Transaction::Expired e) {
+    }
+    assert(attempts == 3);
+
+    // a cancelled transaction aborts as it adds items
+    TCancelToken token;
+    LockOrder lo;
+    attempts = 0;
+    try {
+        TRANSACTION_LIMITED(TransactionLimits().cancel_on(token)) {
+            ++attempts;
+            for (int i = 0; i != 100; ++i) {
+                if (i == 10)
+                    token.cancel();
+                Sto::item(&lo, i).add_write(i);
+            }
+            assert(false);
+        } RETRY(true);
+        assert(false);
+    } catch (Transaction::Expired e) {
+    }
+    assert(attempts == 1);
+    assert(Transaction::abort_counters_combined().find(nullptr).n[ar_cancelled] == 1);
+    token.reset();
+
+#if !STO_SORT_WRITESET
+    // a transaction stops waiting for a lock at its deadline
+    LockableWord w;
+    TSpinContention patient(~0U, ~0U, false, false);
+    Transaction::set_contention_manager(&patient);
+    TransactionTid::lock(w.version_word(), 7);
+    try {
+        TRANSACTION_LIMITED(TransactionLimits().within_us(2000)) {
+            Sto::item(&w, 0).add_write(1);
+        } RETRY(true);
+        assert(false);
+    } catch (Transaction::Expired e) {
+    }
+    TransactionTid::unlock(w.version_word(), 7);
+    Transaction::set_contention_manager(nullptr);
+    assert(Transaction::abort_counters_combined().find(&w).n[ar_deadline] >= 1);
+#endif
+
+    // limits end with their transaction
+    TRANSACTION {
+        f = 1;
+    } RETRY(false);
+    assert(f.nontrans_read() == 1);
+    Transaction::clear_stats();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+static void count_hook(void* ctx) {
+    ++*static_cast<int*>(ctx);
+}
+
+void testTransactionHooks() {
+    TBox<int> f;
+    int starts = 0, ends = 0, ends2 = 0;
+    Transaction::add_hook(Transaction::hook_start, count_hook, &starts);
+    Transaction::add_hook(Transaction::hook_end, count_hook, &ends);
+    Transaction::add_hook(Transaction::hook_end, count_hook, &ends);
+    Transaction::add_hook(Transaction::hook_end, count_hook, &ends2);
+
+    TRANSACTION {
+        f = 1;
+    } RETRY(false);
+    assert(starts == 1 && ends == 1 && ends2 == 1);
+
+    // end hooks run after aborts too
+    try {
+        TRANSACTION {
+            f = 2;
+            Sto::abort();
+        } RETRY(false);
+        assert(false);
+    } catch (Transaction::Abort e) {
+    }
+    assert(starts == 2 && ends == 2 && ends2 == 2);
+
+    Transaction::remove_hook(Transaction::hook_end, count_hook, &ends);
+    TRANSACTION {
+        f = 3;
+    } RETRY(false);
+    assert(starts == 3 && ends == 2 && ends2 == 3);
+
+    Transaction::remove_hook(Transaction::hook_start, count_hook, &starts);
+    Transaction::remove_hook(Transaction::hook_end, count_hook, &ends2);
+    TRANSACTION {
+        f = 4;
+    } RETRY(false);
+    assert(starts == 3 && ends == 2 && ends2 == 3);
+    assert(f.nontrans_read() == 4);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHtmCommit() {
+    // uses hardware transactions where available, otherwise the usual
+    // software commit; either way the result must be serializable
+    unsigned old_max = Transaction::htm_max_items;
+    Transaction::htm_max_items = 8;
+    TBox<int> a, b;
+    const int nthreads = 4, ntrans = 2000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != nthreads; ++t)
+        threads.emplace_back([&, t] {
+                TThread::set_id(t);
+                for (int i = 0; i != ntrans; ++i)
+                    TRANSACTION {
+                        a = a + 1;
+                        b = b - 1;
+                    } RETRY(true);
+            });
+    for (auto& th : threads)
+        th.join();
+    TThread::set_id(0);
+    assert(a.nontrans_read() == nthreads * ntrans);
+    assert(b.nontrans_read() == -nthreads * ntrans);
+
+    // transactions that are too large always commit in software
+    Transaction::htm_max_items = 1;
+    TRANSACTION {
+        a = 0;
+        b = 0;
+    } RETRY(false);
+    assert(a.nontrans_read() == 0 && b.nontrans_read() == 0);
+    Transaction::htm_max_items = old_max;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testIncrementalValidation();
+    testContentionManager();
+    testWriteSetOrder();
+    testAbortCounters();
+    testProfile();
+    testLatencyHistogram();
+    testRcuPressure();
+    testRcuBudget();
+    testHugeTransaction();
+    testDeferIndex();
+    testReadOnly();
+    testNewItems();
+    testItemLayout();
+    testSavepoint();
+    testInterleave();
+    testMetrics();
+    testRedoLog();
+    testFallback();
+    testLimits();
+    testTransactionHooks();
+    testHtmCommit();
+    return 0;
+}
@@ -0,0 +1,212 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "Transaction.hh"
+#include "TStream.hh"
+#include "TBox.hh"
+
+void testAppendRead() {
+    TStream<int, 16, 4> s;
+    TStream<int, 16, 4>::size_type pos = 0;
+    int x;
+
+    {
+        TransactionGuard t;
+        assert(!s.trans_read(pos, x));
+        for (int i = 0; i != 10; ++i)
+            s.transAppend(i);
+        // our own appends have no positions yet
+        assert(!s.trans_read(pos, x));
+    }
+    {
+        // an aborted transaction appends nothing
+        TestTransaction t(1);
+        s.transAppend(100);
+        Sto::silent_abort();
+    }
+
+    {
+        TransactionGuard t;
+        pos = 0;
+        for (int i = 0; i != 10; ++i)
+            assert(s.trans_read(pos, x) && x == i);
+        assert(!s.trans_read(pos, x));
+    }
+    assert(s.frontier() == 12);
+
+    // a thread's appends keep their order across blocks and segments
+    for (int i = 10; i != 100; ++i)
+        s.nontrans_append(i);
+    pos = 0;
+    for (int i = 0; i != 100; ++i)
+        assert(s.nontrans_read(pos, x) && x == i);
+    assert(!s.nontrans_read(pos, x));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHoles() {
+    TStream<int, 16, 4> s;
+    TStream<int, 16, 4>::size_type pos = 0, end;
+    int x;
+
+    // threads 0 and 1 each reserve a block
+    TThread::set_id(0);
+    s.nontrans_append(0);
+    TThread::set_id(1);
+    s.nontrans_append(10);
+    TThread::set_id(0);
+
+    {
+        // a reader skips the unused rest of thread 0's block
+        TransactionGuard t;
+        assert(s.trans_read(pos, x) && x == 0);
+        assert(s.trans_read(pos, x) && x == 10);
+        assert(!s.trans_read(pos, x));
+    }
+    end = pos;
+
+    // both threads' unused slots are now holes, so later appends land
+    // past where the reader stopped
+    s.nontrans_append(1);
+    TThread::set_id(1);
+    s.nontrans_append(11);
+    TThread::set_id(0);
+    assert(s.nontrans_read(pos, x) && x == 1 && pos > end);
+    assert(s.nontrans_read(pos, x) && x == 11);
+    assert(!s.nontrans_read(pos, x));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConflicts() {
+    TStream<int> s;
+    TBox<int> b1, b2;
+    TStream<int>::size_type pos;
+    int x;
+    s.nontrans_append(1);
+
+    {
+        // appenders don't conflict with each other, or with readers of
+        // stable positions
+        TestTransaction t1(1);
+        s.transAppend(2);
+        pos = 0;
+        assert(s.trans_read(pos, x) && x == 1);
+        b1 = 1;
+        TestTransaction t2(2);
+        s.transAppend(3);
+        pos = 0;
+        assert(s.trans_read(pos, x) && x == 1);
+        b2 = 1;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but a reader that reached the end conflicts with a later append
+        TestTransaction t1(1);
+        pos = 0;
+        while (s.trans_read(pos, x))
+            /* do nothing */;
+        b1 = 2;
+        TestTransaction t2(2);
+        s.transAppend(4);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // and not with one that commits after it
+        TestTransaction t1(1);
+        pos = 0;
+        int n = 0;
+        while (s.trans_read(pos, x))
+            ++n;
+        assert(n == 4);
+        b1 = 3;
+        assert(t1.try_commit());
+        TestTransaction t2(2);
+        s.transAppend(5);
+        assert(t2.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testTrim() {
+    TStream<int, 16, 4> s;
+    TStream<int, 16, 4>::size_type pos = 0;
+    int x;
+    for (int i = 0; i != 100; ++i)
+        s.nontrans_append(i);
+
+    s.trim(40);
+    assert(s.trim_point() == 40);
+    {
+        TransactionGuard t;
+        assert(s.trans_read(pos, x) && x == 40);
+    }
+    s.trim(1000);
+    assert(s.trim_point() == s.frontier());
+    pos = 0;
+    assert(!s.nontrans_read(pos, x) && pos == s.frontier());
+    s.nontrans_append(100);
+    {
+        TransactionGuard t;
+        assert(s.trans_read(pos, x) && x == 100);
+    }
+    Transaction::rcu_quiesce();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrent() {
+    // three appenders and a tailing reader; the reader sees every entry
+    // once, each appender's in order
+    TStream<int, 256, 16> s;
+    const int nappenders = 3, per = 6000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nappenders; ++i)
+        threads.emplace_back([&s, i] {
+            TThread::set_id(i);
+            for (int j = 0; j < per; j += 3) {
+                TRANSACTION {
+                    for (int k = j; k != j + 3; ++k)
+                        s.transAppend(i * per + k);
+                } RETRY(true);
+            }
+        });
+    std::vector<int> last(nappenders, -1);
+    int seen = 0;
+    std::thread reader([&] {
+        TThread::set_id(nappenders);
+        TStream<int, 256, 16>::size_type pos = 0;
+        while (seen != nappenders * per) {
+            TRANSACTION {
+                int x;
+                for (int k = 0; k != 8 && s.trans_read(pos, x); ++k) {
+                    int i = x / per;
+                    assert(x % per == last[i] + 1);
+                    last[i] = x % per;
+                    ++seen;
+                    if (k % 4 == 3)
+                        s.trim(pos);
+                }
+            } RETRY(false);
+        }
+    });
+    for (auto& th : threads)
+        th.join();
+    reader.join();
+    for (int i = 0; i != nappenders; ++i)
+        assert(last[i] == per - 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testAppendRead();
+    testHoles();
+    testConflicts();
+    testTrim();
+    testConcurrent();
+    return 0;
+}
@@ -3,8 +3,10 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <thread>
 #include "Transaction.hh"
 #include "TVector.hh"
+#include "TAppendVector.hh"
 #include "TBox.hh"
 #define GUARDED if (TransactionGuard tguard{})
 
@@ -1226,6 +1228,158 @@ void testNoOpacity() {
 
 
 
+template <TLayout L>
+void testLayout() {
+    TVector<std::string, TOpaqueWrapped, L> f;
+    f.nontrans_push_back("0");
+    f.nontrans_reserve(300);
+
+    {
+        TransactionGuard t;
+        f[0] = "0";
+        for (int i = 1; i != 300; ++i)
+            f.push_back(std::to_string(i));
+    }
+
+    {
+        // neighbouring elements don't conflict
+        TestTransaction t1(1);
+        assert(f.transGet(10) == "10");
+        f[10] = "a";
+        TestTransaction t2(2);
+        assert(f.transGet(11) == "11");
+        f[11] = "b";
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        TransactionGuard t;
+        assert(f.size() == 300);
+        for (int i = 0; i != 300; ++i)
+            assert(f.transGet(i) == (i == 10 ? "a" : i == 11 ? "b" : std::to_string(i)));
+        f.pop_back();
+    }
+    assert(f.nontrans_size() == 299);
+
+    printf("PASS: %s<%d>\n", __FUNCTION__, int(L));
+}
+
+void testFootprint() {
+    TVector<int> v;
+    for (int i = 0; i != 10; ++i)
+        v.nontrans_push_back(i);
+    footprint f = v.memory_footprint();
+    assert(f.data == 10 * sizeof(TOpaqueWrapped<int>));
+    assert(f.versions == 11 * sizeof(TVersion));
+    assert(f.rcu_pending == 0);
+
+    // the storage a reserve replaces waits in RCU, and is counted there
+    size_t pending = Transaction::memory_footprint_combined().rcu_pending;
+    v.nontrans_reserve(1000);
+    assert(v.memory_footprint().total() >= 1000 * (sizeof(int) + sizeof(TVersion)));
+    assert(v.memory_footprint().data == f.data);
+    assert(Transaction::memory_footprint_combined().rcu_pending > pending);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAppendVector() {
+    TAppendVector<int, 4> v;
+    v.nontrans_push_back(0);
+
+    {
+        TransactionGuard t;
+        for (int i = 1; i != 100; ++i)
+            v.push_back(i);
+        assert(v.size() == 100);
+        assert(v[0] == 0);
+    }
+    assert(v.nontrans_size() == 100);
+    for (int i = 0; i != 100; ++i)
+        assert(v.nontrans_get(i) == i);
+
+    {
+        // appenders don't conflict, nor do readers of elements in range
+        TestTransaction t1(1);
+        assert(v[10] == 10);
+        v.push_back(100);
+        TestTransaction t2(2);
+        v.push_back(101);
+        v[11] = -11;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // but size readers and out-of-range accesses do
+        TestTransaction t1(1);
+        assert(v.size() > 50);
+        v.push_back(102);
+        TestTransaction t2(2);
+        v.push_back(103);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+
+        TestTransaction t3(1);
+        assert(v.size() == 104);
+        v.push_back(104);
+        TestTransaction t4(2);
+        v.push_back(105);
+        assert(t4.try_commit());
+        assert(!t3.try_commit());
+
+        TestTransaction t5(1);
+        bool caught = false;
+        try {
+            v[105] = 1;
+        } catch (std::out_of_range&) {
+            caught = true;
+        }
+        assert(caught);
+        v[0] = 1;
+        TestTransaction t6(2);
+        v.push_back(106);
+        assert(t6.try_commit());
+        assert(!t5.try_commit());
+    }
+    assert(v.nontrans_size() == 106);
+    assert(v.nontrans_get(11) == -11);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConcurrentAppends() {
+    TAppendVector<int, 16> v;
+    const int nthreads = 4, per = 5000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != nthreads; ++t)
+        threads.emplace_back([&v, t] {
+                TThread::set_id(t);
+                for (int i = 0; i < per; i += 5)
+                    TRANSACTION {
+                        for (int j = i; j != i + 5; ++j)
+                            v.push_back(j * nthreads + t);
+                    } RETRY(true);
+            });
+    for (auto& th : threads)
+        th.join();
+    TThread::set_id(0);
+
+    assert(v.nontrans_size() == nthreads * per);
+    std::vector<int> seen(nthreads * per, 0);
+    std::vector<int> last(nthreads, -1);
+    for (int i = 0; i != nthreads * per; ++i) {
+        int x = v.nontrans_get(i);
+        ++seen[x];
+        // each thread's elements stay in order
+        assert(x / nthreads > last[x % nthreads]);
+        last[x % nthreads] = x / nthreads;
+    }
+    for (int s : seen)
+        assert(s == 1);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testWriteNPushBack();
@@ -1259,5 +1413,11 @@ int main() {
     testIndexPushOverlap();
     testOpacity();
     testNoOpacity();
+    testLayout<TLayout::packed>();
+    testLayout<TLayout::padded>();
+    testLayout<TLayout::split>();
+    testFootprint();
+    testAppendVector();
+    testConcurrentAppends();
     return 0;
 }
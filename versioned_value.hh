@@ -8,6 +8,8 @@
 // nearly everything STO-related and 2) don't accidentally call a Masstree
 // function (deallocate_rcu) in some other context.
 #include "kvthread.hh"
+#include "TSlab.hh"
+#include "TVersionChain.hh"
 
 template <typename T, typename=void>
 struct versioned_value_struct /*: public threadinfo::rcu_callback*/ {
@@ -134,3 +136,55 @@ private:
   version_type version_;
   value_type* valueptr_;
 };
+
+// A box for small trivially copyable values that draws boxes from
+// per-thread slabs (see TSlab.hh) instead of the heap. A box never
+// straddles cache lines, and the boxes of keys inserted together, as by
+// a bulk load, sit together, so scans and neighboring lookups share
+// lines and pages. Use as MassTrans<T, slab_versioned_value<T>>.
+template <typename T>
+struct slab_versioned_value : public versioned_value_struct<T> {
+  typedef T value_type;
+  typedef TransactionTid::type version_type;
+  static_assert(__has_trivial_copy(T), "slab_versioned_value needs a trivially copyable type");
+
+  slab_versioned_value(const value_type& val, version_type v)
+      : versioned_value_struct<T>(val, v) {}
+
+  static slab_versioned_value* make(const value_type& val, version_type version) {
+    return TSlab<slab_versioned_value<T> >::make(val, version);
+  }
+
+  // MassTrans only reads boxes in transactions, so STO's RCU covers them
+  inline void deallocate_rcu(threadinfo&) {
+    TSlab<slab_versioned_value<T> >::rcu_free(this);
+  }
+};
+
+// A box that also keeps the values it superseded, so MassTrans can serve
+// snapshot transactions (see Sto::start_snapshot_transaction). MassTrans
+// with this box keeps deleted keys in the tree as tombstones until no
+// snapshot can need them. Use as MassTrans<T, snapshot_versioned_value<T>>.
+template <typename T>
+struct snapshot_versioned_value : public versioned_value_struct<T> {
+  typedef T value_type;
+  typedef TransactionTid::type version_type;
+  static_assert(__has_trivial_copy(T), "snapshot_versioned_value needs a trivially copyable type");
+
+  snapshot_versioned_value(const value_type& val, version_type v)
+      : versioned_value_struct<T>(val, v) {}
+
+  static snapshot_versioned_value* make(const value_type& val, version_type version) {
+    return new snapshot_versioned_value<T>(val, version);
+  }
+
+  // runs the destructor, which frees the history
+  inline void deallocate_rcu(threadinfo&) {
+    Transaction::rcu_delete(this);
+  }
+
+  TVersionChain<T> history;
+};
+
+template <typename Box> struct box_keeps_history : public std::false_type {};
+template <typename T> struct box_keeps_history<snapshot_versioned_value<T> > : public std::true_type {};